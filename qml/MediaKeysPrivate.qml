@@ -50,7 +50,7 @@ Item {
     MediaKey {
         enabled: true
         key: Qt.Key_MediaPrevious
-        onReleased: Unplayer.Player.queue.previous()
+        onReleased: Unplayer.Player.previous()
     }
     MediaKey {
         enabled: true
@@ -65,6 +65,12 @@ Page {
                 anchors.horizontalCenter: parent.horizontalCenter
                 font.pixelSize: Theme.fontSizeLarge
                 text: "Unplayer %1".arg(Qt.application.version)
+
+                // Diagnostics page is hidden from regular users
+                MouseArea {
+                    anchors.fill: parent
+                    onPressAndHold: pageStack.push("DiagnosticsPage.qml")
+                }
             }
 
             Label {
@@ -26,10 +26,16 @@ MediaContainerSelectionDelegate {
 
     title: Theme.highlightText(model.displayedAlbum, searchPanel.searchText, Theme.highlightColor)
     secondDescription: model.year
-    mediaArt: Unplayer.LibraryUtils.randomMediaArtForAlbum(model.artist, model.album)
+    mediaArt: model.mediaArt
+    mediaArtPlaceholder: model.mediaArtPlaceholder
 
     menu: Component {
         ContextMenu {
+            MenuItem {
+                text: qsTranslate("unplayer", "Play next")
+                onClicked: Unplayer.Player.queue.insertTracksFromLibrary(albumsModel.getTracksForAlbum(albumsProxyModel.sourceIndex(model.index)))
+            }
+
             MenuItem {
                 text: qsTranslate("unplayer", "Add to queue")
                 onClicked: Unplayer.Player.queue.addTracksFromLibrary(albumsModel.getTracksForAlbum(albumsProxyModel.sourceIndex(model.index)))
@@ -61,11 +67,6 @@ MediaContainerSelectionDelegate {
         }
     }
 
-    Connections {
-        target: Unplayer.LibraryUtils
-        onMediaArtChanged: mediaArt = Unplayer.LibraryUtils.randomMediaArtForAlbum(model.artist, model.album)
-    }
-
     Component {
         id: albumPageComponent
         AlbumPage {
@@ -148,6 +148,8 @@ Page {
             text: qsTranslate("unplayer", "No albums")
         }
 
+        MediaArtPrefetcher { }
+
         VerticalScrollDecorator { }
     }
 }
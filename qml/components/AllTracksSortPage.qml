@@ -88,6 +88,18 @@ Page {
                 onClicked: tracksModel.sortMode = Unplayer.TracksModelSortMode.ArtistAlbumYear
             }
 
+            SortModeListItem {
+                current: tracksModel.sortMode === Unplayer.TracksModelSortMode.PlayCount
+                text: qsTranslate("unplayer", "Most played")
+                onClicked: tracksModel.sortMode = Unplayer.TracksModelSortMode.PlayCount
+            }
+
+            SortModeListItem {
+                current: tracksModel.sortMode === Unplayer.TracksModelSortMode.LastPlayed
+                text: qsTranslate("unplayer", "Recently played")
+                onClicked: tracksModel.sortMode = Unplayer.TracksModelSortMode.LastPlayed
+            }
+
             SectionHeader {
                 text: qsTranslate("unplayer", "Inside Album")
             }
@@ -174,6 +174,8 @@ Page {
             text: qsTranslate("unplayer", "No albums")
         }
 
+        MediaArtPrefetcher { }
+
         VerticalScrollDecorator { }
     }
 }
@@ -109,7 +109,8 @@ Page {
 
             title: Theme.highlightText(model.displayedArtist, searchPanel.searchText, Theme.highlightColor)
             description: qsTranslate("unplayer", "%n album(s)", String(), model.albumsCount)
-            mediaArt: Unplayer.LibraryUtils.randomMediaArtForArtist(model.artist)
+            mediaArt: model.mediaArt
+            mediaArtPlaceholder: model.mediaArtPlaceholder
             menu: Component {
                 ContextMenu {
                     MenuItem {
@@ -206,6 +207,8 @@ Page {
             text: qsTranslate("unplayer", "No artists")
         }
 
+        MediaArtPrefetcher { }
+
         VerticalScrollDecorator { }
     }
 }
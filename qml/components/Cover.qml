@@ -41,6 +41,11 @@ CoverBackground {
             source: Unplayer.Player.queue.currentMediaArt
             sourceSize.height: parent.height
             asynchronous: true
+            onStatusChanged: {
+                if (status === Image.Ready) {
+                    Unplayer.Player.queue.prefetchMediaArt(Qt.size(0, parent.height))
+                }
+            }
         }
 
         OpacityRampEffect {
@@ -97,7 +102,7 @@ CoverBackground {
 
         CoverAction {
             iconSource: "image://theme/icon-cover-previous-song"
-            onTriggered: Unplayer.Player.queue.previous()
+            onTriggered: Unplayer.Player.previous()
         }
 
         CoverAction {
@@ -0,0 +1,96 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import QtQuick 2.2
+import Sailfish.Silica 1.0
+
+import harbour.unplayer 0.1 as Unplayer
+
+Page {
+    Unplayer.Diagnostics {
+        id: diagnostics
+
+        onEntriesChanged: {
+            listModel.clear()
+            for (var i = 0, max = entries.length; i < max; ++i) {
+                listModel.append(entries[i])
+            }
+        }
+
+        Component.onCompleted: refresh()
+    }
+
+    SilicaListView {
+        anchors.fill: parent
+
+        header: PageHeader {
+            title: qsTranslate("unplayer", "Diagnostics")
+        }
+
+        model: ListModel {
+            id: listModel
+        }
+
+        section {
+            property: "section"
+            delegate: SectionHeader {
+                text: section
+            }
+        }
+
+        delegate: Column {
+            anchors {
+                left: parent.left
+                leftMargin: Theme.horizontalPageMargin
+                right: parent.right
+                rightMargin: Theme.horizontalPageMargin
+            }
+
+            Label {
+                width: parent.width
+                color: Theme.secondaryColor
+                font.pixelSize: Theme.fontSizeExtraSmall
+                wrapMode: Text.WrapAtWordBoundaryOrAnywhere
+                text: model.name
+            }
+
+            Label {
+                width: parent.width
+                wrapMode: Text.WordWrap
+                text: model.value
+            }
+
+            Item {
+                width: parent.width
+                height: Theme.paddingSmall
+            }
+        }
+
+        PullDownMenu {
+            busy: diagnostics.loading
+
+            MenuItem {
+                enabled: !diagnostics.loading
+                text: qsTranslate("unplayer", "Refresh")
+                onClicked: diagnostics.refresh()
+            }
+        }
+
+        VerticalScrollDecorator { }
+    }
+}
@@ -114,7 +114,8 @@ Page {
 
             PageHeader {
                 title: qsTranslate("unplayer", "Directories")
-                description: directoryTracksModel.directory
+                description: directoryTracksModel.libraryListing ? qsTranslate("unplayer", "%1 (library)").arg(directoryTracksModel.directory)
+                                                                 : directoryTracksModel.directory
             }
 
             ParentDirectoryItem {
@@ -154,7 +155,12 @@ Page {
                     }
 
                     MenuItem {
-                        visible: !model.isDirectory
+                        visible: model.isDirectory
+                        text: qsTranslate("unplayer", "Play")
+                        onClicked: Unplayer.Player.queue.addTracksFromUrls([model.filePath], true)
+                    }
+
+                    MenuItem {
                         text: qsTranslate("unplayer", "Add to queue")
                         onClicked: Unplayer.Player.queue.addTrackFromUrl(model.filePath)
                     }
@@ -165,6 +171,11 @@ Page {
                         onClicked: pageStack.push("AddToPlaylistPage.qml", { tracks: [model.filePath] })
                     }
 
+                    MenuItem {
+                        text: qsTranslate("unplayer", "Update in library")
+                        onClicked: Unplayer.LibraryUtils.updateDatabaseForPaths([model.filePath])
+                    }
+
                     MenuItem {
                         text: qsTranslate("unplayer", "Remove")
                         onClicked: fileDelegate.remove()
@@ -222,8 +233,16 @@ Page {
                     leftMargin: Theme.horizontalPageMargin
                     verticalCenter: parent.verticalCenter
                 }
+                width: Theme.iconSizeMedium
+                height: Theme.iconSizeMedium
                 asynchronous: true
+                sourceSize.width: width
+                sourceSize.height: height
+                fillMode: Image.PreserveAspectCrop
                 source: {
+                    if (model.mediaArt) {
+                        return model.mediaArt
+                    }
                     var iconSource = model.isDirectory ? "image://theme/icon-m-folder"
                                                        : "image://theme/icon-m-music"
                     if (highlighted || current) {
@@ -233,7 +252,7 @@ Page {
                 }
             }
 
-            Label {
+            Column {
                 anchors {
                     left: icon.right
                     leftMargin: Theme.paddingMedium
@@ -241,9 +260,26 @@ Page {
                     rightMargin: Theme.horizontalPageMargin
                     verticalCenter: parent.verticalCenter
                 }
-                text: Theme.highlightText(model.fileName, searchPanel.searchText, Theme.highlightColor)
-                color: highlighted || current ? Theme.highlightColor : Theme.primaryColor
-                truncationMode: TruncationMode.Fade
+
+                Label {
+                    width: parent.width
+                    text: Theme.highlightText(model.title ? model.title : model.fileName, searchPanel.searchText, Theme.highlightColor)
+                    color: highlighted || current ? Theme.highlightColor : Theme.primaryColor
+                    truncationMode: TruncationMode.Fade
+                }
+
+                Label {
+                    width: parent.width
+                    visible: model.duration > 0
+                    font.pixelSize: Theme.fontSizeExtraSmall
+                    text: {
+                        var duration = Format.formatDuration(model.duration, model.duration >= 3600 ? Format.DurationLong
+                                                                                                   : Format.DurationShort)
+                        return model.artist ? "%1 · %2".arg(model.artist).arg(duration) : duration
+                    }
+                    color: highlighted || current ? Theme.secondaryHighlightColor : Theme.secondaryColor
+                    truncationMode: TruncationMode.Fade
+                }
             }
         }
         model: Unplayer.DirectoryTracksProxyModel {
@@ -251,6 +287,8 @@ Page {
             sourceModel: Unplayer.DirectoryTracksModel {
                 id: directoryTracksModel
 
+                loadMetadata: true
+
                 onLoadedChanged: {
                     if (loaded) {
                         if (listView.goingUp) {
@@ -289,6 +327,11 @@ Page {
                 onClicked: Unplayer.Settings.defaultDirectory = directoryTracksModel.directory
             }
 
+            MenuItem {
+                text: qsTranslate("unplayer", "Update directory in library")
+                onClicked: Unplayer.LibraryUtils.updateDatabaseForPaths([directoryTracksModel.directory])
+            }
+
             MenuItem {
                 text: qsTranslate("unplayer", "Default directory")
                 onClicked: pullDownMenu.goBegin(Unplayer.Settings.defaultDirectory)
@@ -0,0 +1,142 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+import QtQuick 2.2
+import Sailfish.Silica 1.0
+
+import harbour.unplayer 0.1 as Unplayer
+
+Page {
+    SilicaListView {
+        id: listView
+
+        anchors.fill: parent
+        clip: true
+
+        header: PageHeader {
+            title: qsTranslate("unplayer", "Filter")
+            description: qsTranslate("unplayer", "%n track(s)", String(), facetsModel.tracksCount)
+        }
+        delegate: ListItem {
+            id: facetDelegate
+
+            readonly property bool highlightedText: highlighted || model.selected
+
+            contentHeight: Theme.itemSizeSmall
+            enabled: model.selected || model.tracksCount > 0
+            opacity: enabled ? 1.0 : 0.4
+
+            Label {
+                anchors {
+                    left: parent.left
+                    leftMargin: Theme.horizontalPageMargin
+                    right: countLabel.left
+                    rightMargin: Theme.paddingMedium
+                    verticalCenter: parent.verticalCenter
+                }
+                color: facetDelegate.highlightedText ? Theme.highlightColor : Theme.primaryColor
+                font.bold: model.selected
+                text: {
+                    switch (model.kind) {
+                    case Unplayer.FacetsModel.NotPlayedKind:
+                        return qsTranslate("unplayer", "Not played yet")
+                    case Unplayer.FacetsModel.DecadeKind:
+                        return qsTranslate("unplayer", "%1s").arg(model.title)
+                    default:
+                        return model.title
+                    }
+                }
+                truncationMode: TruncationMode.Fade
+            }
+
+            Label {
+                id: countLabel
+
+                anchors {
+                    right: parent.right
+                    rightMargin: Theme.horizontalPageMargin
+                    verticalCenter: parent.verticalCenter
+                }
+                color: facetDelegate.highlightedText ? Theme.secondaryHighlightColor : Theme.secondaryColor
+                font.pixelSize: Theme.fontSizeExtraSmall
+                text: model.tracksCount
+            }
+
+            onClicked: facetsModel.toggle(model.index)
+        }
+        model: Unplayer.FacetsModel {
+            id: facetsModel
+        }
+
+        section {
+            property: "kind"
+            delegate: SectionHeader {
+                text: {
+                    switch (Number(section)) {
+                    case Unplayer.FacetsModel.NotPlayedKind:
+                        return qsTranslate("unplayer", "Play count")
+                    case Unplayer.FacetsModel.GenreKind:
+                        return qsTranslate("unplayer", "Genres")
+                    case Unplayer.FacetsModel.DecadeKind:
+                        return qsTranslate("unplayer", "Decades")
+                    case Unplayer.FacetsModel.YearKind:
+                        return qsTranslate("unplayer", "Years")
+                    case Unplayer.FacetsModel.ArtistKind:
+                        return qsTranslate("unplayer", "Artists")
+                    }
+                    return String()
+                }
+            }
+        }
+
+        PullDownMenu {
+            MenuItem {
+                enabled: facetsModel.hasSelection
+                text: qsTranslate("unplayer", "Clear filter")
+                onClicked: facetsModel.clearSelection()
+            }
+
+            MenuItem {
+                enabled: facetsModel.tracksCount > 0
+                text: qsTranslate("unplayer", "Add to playlist")
+                onClicked: pageStack.push("AddToPlaylistPage.qml", { tracks: facetsModel.getTracks() })
+            }
+
+            MenuItem {
+                enabled: facetsModel.tracksCount > 0
+                text: qsTranslate("unplayer", "Add to queue")
+                onClicked: Unplayer.Player.queue.addTracksFromLibrary(facetsModel.getTracks())
+            }
+
+            MenuItem {
+                enabled: facetsModel.tracksCount > 0
+                text: qsTranslate("unplayer", "Play")
+                onClicked: Unplayer.Player.queue.addTracksFromLibrary(facetsModel.getTracks(), true, 0)
+            }
+        }
+
+        BusyIndicator {
+            anchors.centerIn: parent
+            running: !facetsModel.loaded
+            size: BusySize.Large
+        }
+
+        VerticalScrollDecorator { }
+    }
+}
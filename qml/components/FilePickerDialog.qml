@@ -131,8 +131,16 @@ Dialog {
                     leftMargin: Theme.horizontalPageMargin
                     verticalCenter: parent.verticalCenter
                 }
+                width: Theme.iconSizeMedium
+                height: Theme.iconSizeMedium
                 asynchronous: true
+                sourceSize.width: width
+                sourceSize.height: height
+                fillMode: Image.PreserveAspectCrop
                 source: {
+                    if (model.mediaArt) {
+                        return model.mediaArt
+                    }
                     var iconSource = model.isDirectory ? "image://theme/icon-m-folder"
                                                        : fileIcon
                     if (highlighted) {
@@ -27,15 +27,30 @@ Page {
         contentHeight: column.height
 
         PullDownMenu {
+            // Only artists and albums are shown from snapshot until database is opened
+            enabled: Unplayer.LibraryUtils.databaseInitialized
+
             MenuItem {
                 text: qsTranslate("unplayer", "Reset Library")
                 onClicked: Unplayer.LibraryUtils.resetDatabase()
             }
 
             MenuItem {
+                visible: !Unplayer.LibraryUtils.updating
                 text: qsTranslate("unplayer", "Update Library")
                 onClicked: Unplayer.LibraryUtils.updateDatabase()
             }
+
+            MenuItem {
+                visible: Unplayer.LibraryUtils.updating
+                text: qsTranslate("unplayer", "Cancel Update")
+                onClicked: Unplayer.LibraryUtils.cancelUpdate()
+            }
+
+            MenuItem {
+                text: qsTranslate("unplayer", "Search")
+                onClicked: pageStack.push("SearchPage.qml")
+            }
         }
 
         Column {
@@ -71,6 +86,7 @@ Page {
             }
 
             MainPageListItem {
+                enabled: Unplayer.LibraryUtils.databaseInitialized
                 title: qsTranslate("unplayer", "Tracks")
                 description: {
                     var tracksCount = Unplayer.LibraryUtils.tracksCount
@@ -95,10 +111,32 @@ Page {
             }
 
             MainPageListItem {
+                enabled: Unplayer.LibraryUtils.databaseInitialized
+                title: qsTranslate("unplayer", "Recently added albums")
+                mediaArt: Unplayer.LibraryUtils.randomMediaArt
+                onClicked: pageStack.push("RecentlyAddedAlbumsPage.qml")
+            }
+
+            MainPageListItem {
+                enabled: Unplayer.LibraryUtils.databaseInitialized
+                title: qsTranslate("unplayer", "Recently added tracks")
+                mediaArt: Unplayer.LibraryUtils.randomMediaArt
+                onClicked: pageStack.push("RecentlyAddedTracksPage.qml")
+            }
+
+            MainPageListItem {
+                enabled: Unplayer.LibraryUtils.databaseInitialized
                 title: qsTranslate("unplayer", "Genres")
                 mediaArt: Unplayer.LibraryUtils.randomMediaArt
                 onClicked: pageStack.push("GenresPage.qml")
             }
+
+            MainPageListItem {
+                enabled: Unplayer.LibraryUtils.databaseInitialized
+                title: qsTranslate("unplayer", "Filter")
+                mediaArt: Unplayer.LibraryUtils.randomMediaArt
+                onClicked: pageStack.push("FacetsPage.qml")
+            }
         }
 
         VerticalScrollDecorator { }
@@ -30,6 +30,11 @@ BaseTrackDelegate {
                 onClicked: pageStack.push("TrackInfoPage.qml", { filePath: model.filePath })
             }
 
+            MenuItem {
+                text: qsTranslate("unplayer", "Play next")
+                onClicked: Unplayer.Player.queue.insertTrackFromLibrary(tracksModel.getTrack(tracksProxyModel.sourceIndex(model.index)))
+            }
+
             MenuItem {
                 text: qsTranslate("unplayer", "Add to queue")
                 onClicked: Unplayer.Player.queue.addTrackFromLibrary(tracksModel.getTrack(tracksProxyModel.sourceIndex(model.index)))
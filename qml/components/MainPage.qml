@@ -47,9 +47,12 @@ Page {
             }
 
             MainPageListItem {
-                enabled: Unplayer.LibraryUtils.databaseInitialized
+                enabled: Unplayer.LibraryUtils.databaseInitialized || Unplayer.LibraryUtils.hasSnapshot
                 title: qsTranslate("unplayer", "Library")
                 description: {
+                    if (Unplayer.LibraryUtils.initializingDatabase) {
+                        return qsTranslate("unplayer", "Opening database...")
+                    }
                     if (!Unplayer.LibraryUtils.databaseInitialized) {
                         return qsTranslate("unplayer", "Error initializing database")
                     }
@@ -57,6 +60,11 @@ Page {
                         return qsTranslate("unplayer", "No selected directories")
                     }
                     if (Unplayer.LibraryUtils.updating) {
+                        if (Unplayer.LibraryUtils.scanProcessedFiles > 0) {
+                            return qsTranslate("unplayer", "Updating... %1/%2")
+                            .arg(Unplayer.LibraryUtils.scanProcessedFiles)
+                            .arg(Unplayer.LibraryUtils.scanDiscoveredFiles - Unplayer.LibraryUtils.scanSkippedFiles)
+                        }
                         return qsTranslate("unplayer", "Updating...")
                     }
                     var tracksCount = Unplayer.LibraryUtils.tracksCount
@@ -72,7 +80,7 @@ Page {
                 menu: Component {
                     ContextMenu {
                         MenuItem {
-                            enabled: Unplayer.Settings.hasLibraryDirectories
+                            enabled: Unplayer.LibraryUtils.databaseInitialized && Unplayer.Settings.hasLibraryDirectories
                             text: qsTranslate("unplayer", "Update Library")
                             onClicked: Unplayer.LibraryUtils.updateDatabase()
                         }
@@ -23,6 +23,9 @@ Item {
     property bool highlighted
     property int size
     property alias source: mediaArtImage.source
+    property alias status: mediaArtImage.status
+    // Dominant color of media art, shown until it is decoded
+    property color placeholder: "transparent"
     property string fallbackIcon: "image://theme/icon-m-music"
 
     width: size
@@ -41,7 +44,7 @@ Item {
                 color: Theme.rgba(Theme.primaryColor, 0.05)
             }
         }
-        visible: !mediaArtImage.visible
+        visible: !mediaArtImage.visible && !placeholderRectangle.visible
 
         Image {
             anchors.centerIn: parent
@@ -51,6 +54,14 @@ Item {
         }
     }
 
+    Rectangle {
+        id: placeholderRectangle
+
+        anchors.fill: parent
+        color: placeholder
+        visible: placeholder.a > 0 && !mediaArtImage.visible && mediaArtImage.status !== Image.Error
+    }
+
     Image {
         id: mediaArtImage
 
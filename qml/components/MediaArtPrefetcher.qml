@@ -0,0 +1,55 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import QtQuick 2.2
+import Sailfish.Silica 1.0
+
+import harbour.unplayer 0.1 as Unplayer
+
+// Decodes media art of rows that are within one screen above and below
+// visible ones, so that delegates created while scrolling show it right away
+Item {
+    property int mediaArtSize: Theme.itemSizeLarge
+
+    visible: false
+
+    Timer {
+        id: prefetchTimer
+
+        interval: 100
+        onTriggered: {
+            var first = listView.indexAt(0, listView.contentY)
+            var last = listView.indexAt(0, listView.contentY + listView.height - 1)
+            if (first === -1) {
+                first = 0
+            }
+            if (last === -1) {
+                last = listView.count - 1
+            }
+            var count = last - first + 1
+            Unplayer.Utils.prefetchMediaArt(listView.model, last + 1, last + count, mediaArtSize)
+            Unplayer.Utils.prefetchMediaArt(listView.model, first - count, first - 1, mediaArtSize)
+        }
+    }
+
+    Connections {
+        target: listView
+        onContentYChanged: prefetchTimer.restart()
+        onCountChanged: prefetchTimer.restart()
+    }
+}
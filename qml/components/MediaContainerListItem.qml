@@ -26,6 +26,7 @@ ListItem {
     property alias description: descriptionLabel.text
     property alias secondDescription: secondDescriptionLabel.text
     property alias mediaArt: mediaArt.source
+    property alias mediaArtPlaceholder: mediaArt.placeholder
 
     contentHeight: Theme.itemSizeLarge
 
@@ -0,0 +1,96 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import QtQuick 2.2
+import Sailfish.Silica 1.0
+
+import harbour.unplayer 0.1 as Unplayer
+
+Dialog {
+    // Rule presets, value is entered by user when valueLabel is set
+    readonly property var presets: [
+        {name: qsTranslate("unplayer", "Never played"), field: "playCount", operator: "=", value: 0},
+        {name: qsTranslate("unplayer", "Added in the last 30 days"), field: "addedWithinDays", operator: "", value: 30},
+        {name: qsTranslate("unplayer", "Genre"), field: "genre", operator: "=", valueLabel: qsTranslate("unplayer", "Genre")},
+        {name: qsTranslate("unplayer", "Artist"), field: "artist", operator: "=", valueLabel: qsTranslate("unplayer", "Artist")},
+        {name: qsTranslate("unplayer", "Released after year"), field: "year", operator: ">", valueLabel: qsTranslate("unplayer", "Year"), numeric: true}
+    ]
+    readonly property var preset: presets[presetComboBox.currentIndex]
+
+    canAccept: playlistNameField.text.trim() && (!preset.valueLabel || valueField.text.trim())
+
+    onAccepted: {
+        var value = preset.valueLabel ? valueField.text.trim() : preset.value
+        if (preset.numeric) {
+            value = parseInt(value)
+        }
+        Unplayer.PlaylistUtils.newSmartPlaylist(playlistNameField.text.trim(),
+                                                JSON.stringify([{field: preset.field, operator: preset.operator, value: value}]))
+    }
+
+    SilicaFlickable {
+        anchors.fill: parent
+        contentHeight: column.height
+
+        Column {
+            id: column
+            width: parent.width
+
+            DialogHeader {
+                title: qsTranslate("unplayer", "Add smart playlist")
+            }
+
+            TextField {
+                id: playlistNameField
+                label: qsTranslate("unplayer", "Playlist name")
+                placeholderText: label
+                width: parent.width
+
+                EnterKey.iconSource: "image://theme/icon-m-enter-next"
+                EnterKey.onClicked: valueField.visible ? valueField.forceActiveFocus() : accept()
+
+                Component.onCompleted: forceActiveFocus()
+            }
+
+            ComboBox {
+                id: presetComboBox
+                label: qsTranslate("unplayer", "Tracks")
+                menu: ContextMenu {
+                    Repeater {
+                        model: presets
+                        MenuItem {
+                            text: modelData.name
+                        }
+                    }
+                }
+            }
+
+            TextField {
+                id: valueField
+                visible: !!preset.valueLabel
+                label: preset.valueLabel ? preset.valueLabel : String()
+                placeholderText: label
+                inputMethodHints: preset.numeric ? Qt.ImhDigitsOnly : Qt.ImhNone
+                width: parent.width
+
+                EnterKey.iconSource: "image://theme/icon-m-enter-accept"
+                EnterKey.onClicked: accept()
+            }
+        }
+    }
+}
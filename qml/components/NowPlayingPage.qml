@@ -169,6 +169,12 @@ Page {
                 fillMode: Image.PreserveAspectCrop
                 visible: status === Image.Ready
                 source: Unplayer.Player.queue.currentMediaArt
+                onStatusChanged: {
+                    if (status === Image.Ready) {
+                        // Unset dimension of sourceSize would be read as size of loaded image
+                        Unplayer.Player.queue.prefetchMediaArt(landscapeLayout ? Qt.size(0, parent.height) : Qt.size(parent.width, 0))
+                    }
+                }
 
                 Rectangle {
                     anchors.fill: parent
@@ -271,7 +277,7 @@ Page {
                 IconButton {
                     anchors.verticalCenter: parent.verticalCenter
                     icon.source: "image://theme/icon-m-previous"
-                    onClicked: Unplayer.Player.queue.previous()
+                    onClicked: Unplayer.Player.previous()
                 }
 
                 IconButton {
@@ -118,6 +118,11 @@ DockedPanel {
                 highlighted: pressItem.highlighted
                 size: parent.height
                 source: Unplayer.Player.queue.currentMediaArt
+                onStatusChanged: {
+                    if (status === Image.Ready) {
+                        Unplayer.Player.queue.prefetchMediaArt(Qt.size(0, size))
+                    }
+                }
             }
 
             Column {
@@ -158,7 +163,7 @@ DockedPanel {
                     id: icon
                     height: parent.height
                     icon.source: "image://theme/icon-m-previous"
-                    onClicked: Unplayer.Player.queue.previous()
+                    onClicked: Unplayer.Player.previous()
                 }
 
                 IconButton {
@@ -50,6 +50,7 @@ Page {
 
             MenuItem {
                 enabled: playlistProxyModel.hasSelection
+                visible: !Unplayer.PlaylistUtils.isSmartPlaylist(filePath)
 
                 text: qsTranslate("unplayer", "Remove from playlist")
                 onClicked: {
@@ -94,6 +95,7 @@ Page {
                 }
 
                 MenuItem {
+                    visible: !Unplayer.PlaylistUtils.isSmartPlaylist(filePath)
                     text: qsTranslate("unplayer", "Remove from playlist")
                     onClicked: remorseAction(qsTranslate("unplayer", "Removing"), function() {
                         playlistModel.removeTrack(playlistProxyModel.sourceIndex(model.index))
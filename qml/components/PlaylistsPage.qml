@@ -124,6 +124,11 @@ Page {
                 onClicked: pageStack.push("NewPlaylistDialog.qml")
             }
 
+            MenuItem {
+                text: qsTranslate("unplayer", "New smart playlist...")
+                onClicked: pageStack.push("NewSmartPlaylistDialog.qml")
+            }
+
             SelectionMenuItem {
                 text: qsTranslate("unplayer", "Select playlists")
             }
@@ -102,6 +102,17 @@ Page {
 
         header: PageHeader {
             title: qsTranslate("unplayer", "Queue")
+            description: {
+                var queue = Unplayer.Player.queue
+                if (queue.remoteTracksCount > 0) {
+                    return qsTranslate("unplayer", "%1 left of %2, %n stream(s)", String(), queue.remoteTracksCount)
+                    .arg(Unplayer.Utils.formatDuration(queue.remainingDuration))
+                    .arg(Unplayer.Utils.formatDuration(queue.totalDuration))
+                }
+                return qsTranslate("unplayer", "%1 left of %2")
+                .arg(Unplayer.Utils.formatDuration(queue.remainingDuration))
+                .arg(Unplayer.Utils.formatDuration(queue.totalDuration))
+            }
         }
         delegate: BaseTrackDelegate {
             id: trackDelegate
@@ -117,6 +128,12 @@ Page {
                     onClicked: pageStack.push("TrackInfoPage.qml", { filePath: model.filePath })
                 }
 
+                MenuItem {
+                    visible: !trackDelegate.current && !Unplayer.Player.queue.addingTracks
+                    text: qsTranslate("unplayer", "Play next")
+                    onClicked: Unplayer.Player.queue.moveTrackAfterCurrent(queueProxyModel.sourceIndex(model.index))
+                }
+
                 MenuItem {
                     text: qsTranslate("unplayer", "Add to playlist")
                     onClicked: pageStack.push("AddToPlaylistPage.qml", { tracks: Unplayer.Player.queue.getTrack(queueProxyModel.sourceIndex(model.index)) })
@@ -144,7 +161,7 @@ Page {
                         Unplayer.Player.queue.currentIndex = queueProxyModel.sourceIndex(model.index)
                         Unplayer.Player.queue.currentTrackChanged()
                         if (Unplayer.Player.queue.shuffle) {
-                            Unplayer.Player.queue.resetNotPlayedTracks()
+                            Unplayer.Player.queue.resetShuffleOrder()
                         }
                     }
                 }
@@ -0,0 +1,69 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import QtQuick 2.2
+import Sailfish.Silica 1.0
+
+import harbour.unplayer 0.1 as Unplayer
+
+Page {
+    SilicaListView {
+        id: listView
+
+        anchors.fill: parent
+        clip: true
+
+        header: PageHeader {
+            title: qsTranslate("unplayer", "Recently added albums")
+        }
+        delegate: MediaContainerListItem {
+            id: albumDelegate
+
+            title: model.displayedAlbum
+            description: model.displayedArtist
+            secondDescription: model.year
+            mediaArt: model.mediaArt
+            mediaArtPlaceholder: model.mediaArtPlaceholder
+
+            onClicked: pageStack.push(albumPageComponent)
+
+            Component {
+                id: albumPageComponent
+                AlbumPage {
+                    artist: model.artist
+                    displayedArtist: model.displayedArtist
+                    album: model.album
+                    displayedAlbum: model.displayedAlbum
+                    tracksCount: model.tracksCount
+                    duration: model.duration
+                    mediaArt: albumDelegate.mediaArt
+                }
+            }
+        }
+        // Next page is loaded when view reaches the end
+        model: Unplayer.RecentlyAddedAlbumsModel {
+            id: albumsModel
+        }
+
+        ListViewPlaceholder {
+            text: qsTranslate("unplayer", "No albums")
+        }
+
+        VerticalScrollDecorator { }
+    }
+}
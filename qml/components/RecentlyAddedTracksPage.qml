@@ -0,0 +1,121 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+import QtQuick 2.2
+import Sailfish.Silica 1.0
+
+import harbour.unplayer 0.1 as Unplayer
+
+Page {
+    SilicaListView {
+        id: listView
+
+        anchors.fill: parent
+        clip: true
+
+        header: PageHeader {
+            title: qsTranslate("unplayer", "Recently added tracks")
+        }
+        delegate: ListItem {
+            id: trackDelegate
+
+            readonly property bool current: model.filePath === Unplayer.Player.queue.currentFilePath
+
+            Column {
+                anchors {
+                    left: parent.left
+                    leftMargin: Theme.horizontalPageMargin
+                    right: durationLabel.left
+                    rightMargin: Theme.paddingMedium
+                    verticalCenter: parent.verticalCenter
+                }
+
+                Label {
+                    color: trackDelegate.highlighted || current ? Theme.highlightColor : Theme.primaryColor
+                    text: model.title
+                    truncationMode: TruncationMode.Fade
+                    width: parent.width
+                }
+
+                Label {
+                    color: trackDelegate.highlighted || current ? Theme.secondaryHighlightColor : Theme.secondaryColor
+                    font.pixelSize: Theme.fontSizeExtraSmall
+                    text: qsTranslate("unplayer", "%1 - %2").arg(model.artist).arg(model.album)
+                    truncationMode: TruncationMode.Fade
+                    width: parent.width
+                }
+            }
+
+            Label {
+                id: durationLabel
+
+                anchors {
+                    right: parent.right
+                    rightMargin: Theme.horizontalPageMargin
+                    bottom: parent.bottom
+                    bottomMargin: Theme.paddingSmall
+                }
+
+                color: trackDelegate.highlighted || current ? Theme.secondaryHighlightColor : Theme.secondaryColor
+                font.pixelSize: Theme.fontSizeExtraSmall
+                text: model.duration >= 0 ? Format.formatDuration(model.duration, model.duration >= 3600 ? Format.DurationLong
+                                                                                                           : Format.DurationShort)
+                                          : String()
+            }
+
+            menu: Component {
+                ContextMenu {
+                    MenuItem {
+                        text: qsTranslate("unplayer", "Track information")
+                        onClicked: pageStack.push("TrackInfoPage.qml", { filePath: model.filePath })
+                    }
+
+                    MenuItem {
+                        text: qsTranslate("unplayer", "Add to queue")
+                        onClicked: Unplayer.Player.queue.addTrackFromLibrary(tracksModel.getTrack(model.index))
+                    }
+
+                    MenuItem {
+                        text: qsTranslate("unplayer", "Add to playlist")
+                        onClicked: pageStack.push("AddToPlaylistPage.qml", { tracks: tracksModel.getTrack(model.index) })
+                    }
+                }
+            }
+
+            onClicked: {
+                if (current) {
+                    if (!Unplayer.Player.playing) {
+                        Unplayer.Player.play()
+                    }
+                } else {
+                    Unplayer.Player.queue.addTracksFromLibrary(tracksModel.getTracks(), true, model.index)
+                }
+            }
+        }
+        // Next page is loaded when view reaches the end
+        model: Unplayer.RecentlyAddedTracksModel {
+            id: tracksModel
+        }
+
+        ListViewPlaceholder {
+            text: qsTranslate("unplayer", "No tracks")
+        }
+
+        VerticalScrollDecorator { }
+    }
+}
@@ -0,0 +1,141 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+import QtQuick 2.2
+import Sailfish.Silica 1.0
+
+import harbour.unplayer 0.1 as Unplayer
+
+Page {
+    Binding {
+        target: modalDialog
+        property: "active"
+        value: tracksModel.removingFiles
+    }
+
+    Binding {
+        target: modalDialog
+        property: "text"
+        value: qsTranslate("unplayer", "Removing tracks...")
+    }
+
+    RemorsePopup {
+        id: remorsePopup
+    }
+
+    SelectionPanel {
+        id: selectionPanel
+        selectionText: qsTranslate("unplayer", "%n track(s) selected", String(), tracksProxyModel.selectedIndexesCount)
+
+        PushUpMenu {
+            MenuItem {
+                enabled: tracksProxyModel.hasSelection
+                text: qsTranslate("unplayer", "Add to queue")
+                onClicked: {
+                    Unplayer.Player.queue.addTracksFromLibrary(tracksModel.getTracks(tracksProxyModel.selectedSourceIndexes))
+                    selectionPanel.showPanel = false
+                }
+            }
+
+            MenuItem {
+                enabled: tracksProxyModel.hasSelection
+                text: qsTranslate("unplayer", "Add to playlist")
+                onClicked: pageStack.push(addToPlaylistPage)
+
+                Component {
+                    id: addToPlaylistPage
+
+                    AddToPlaylistPage {
+                        tracks: tracksModel.getTracks(tracksProxyModel.selectedSourceIndexes)
+                        Component.onDestruction: {
+                            if (added) {
+                                selectionPanel.showPanel = false
+                            }
+                        }
+                    }
+                }
+            }
+
+            MenuItem {
+                enabled: tracksProxyModel.hasSelection
+                text: qsTranslate("unplayer", "Remove")
+                onClicked: pageStack.push(removeTracksDialog)
+
+                Component {
+                    id: removeTracksDialog
+
+                    RemoveFilesDialog {
+                        title: qsTranslate("unplayer", "Are you sure you want to remove %n selected tracks?", String(), tracksProxyModel.selectedIndexesCount)
+                        onAccepted: {
+                            tracksModel.removeTracks(tracksProxyModel.selectedSourceIndexes, deleteFiles)
+                            selectionPanel.showPanel = false
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    SilicaListView {
+        id: listView
+
+        anchors {
+            fill: parent
+            bottomMargin: selectionPanel.visible ? selectionPanel.visibleSize : 0
+        }
+        clip: true
+
+        header: Column {
+            width: listView.width
+
+            PageHeader {
+                title: qsTranslate("unplayer", "Search")
+            }
+
+            SearchField {
+                width: parent.width
+                placeholderText: qsTranslate("unplayer", "Title, artist or album")
+                onTextChanged: tracksModel.query = text.trim()
+                Component.onCompleted: forceActiveFocus()
+            }
+        }
+        delegate: LibraryTrackDelegate {
+            showArtistAndAlbum: true
+        }
+        model: Unplayer.FilterProxyModel {
+            id: tracksProxyModel
+            sourceModel: Unplayer.LibrarySearchModel {
+                id: tracksModel
+            }
+        }
+
+        PullDownMenu {
+            SelectionMenuItem {
+                text: qsTranslate("unplayer", "Select tracks")
+            }
+        }
+
+        ListViewPlaceholder {
+            enabled: !listView.count && tracksModel.query
+            text: qsTranslate("unplayer", "No tracks")
+        }
+
+        VerticalScrollDecorator { }
+    }
+}
@@ -67,7 +67,22 @@ DockedPanel {
             }
             enabled: open
 
-            onTextChanged: listView.model.filterRegExp = new RegExp(Unplayer.Utils.escapeRegExp(text.trim()), "i")
+            onTextChanged: {
+                // Filter after user stops typing
+                if (text.trim())
+                    filterTimer.restart()
+                else
+                    filterTimer.triggered()
+            }
+        }
+
+        Timer {
+            id: filterTimer
+            interval: 150
+            onTriggered: {
+                stop()
+                listView.model.filterText = searchField.text.trim()
+            }
         }
 
         IconButton {
@@ -53,7 +53,7 @@ DockedPanel {
 
     onShowPanelChanged: {
         if (!showPanel) {
-            listView.model.selectionModel.clear()
+            listView.model.clearSelection()
         }
     }
 
@@ -119,7 +119,7 @@ DockedPanel {
                         right: parent.right
                     }
                     text: qsTranslate("unplayer", "None")
-                    onClicked: listView.model.selectionModel.clear()
+                    onClicked: listView.model.clearSelection()
                 }
             }
 
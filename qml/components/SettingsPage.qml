@@ -64,6 +64,37 @@ Page {
                 Component.onCompleted: useDirectoryMediaArt = Unplayer.Settings.useDirectoryMediaArt
             }
 
+            TextSwitch {
+                id: prefetchSwitch
+                text: qsTranslate("unplayer", "Read next track ahead")
+                description: qsTranslate("unplayer", "Load beginning of next track into memory before current one ends")
+                onCheckedChanged: Unplayer.Settings.prefetchNextTrack = checked
+                Component.onCompleted: checked = Unplayer.Settings.prefetchNextTrack
+            }
+
+            Slider {
+                width: parent.width
+                visible: prefetchSwitch.checked
+                label: qsTranslate("unplayer", "Read ahead size")
+                minimumValue: 1
+                maximumValue: 32
+                stepSize: 1
+                valueText: qsTranslate("unplayer", "%1 MiB").arg(value)
+                onReleased: Unplayer.Settings.prefetchSize = value
+                Component.onCompleted: value = Unplayer.Settings.prefetchSize
+            }
+
+            Slider {
+                width: parent.width
+                label: qsTranslate("unplayer", "Cache of next tracks from network and memory card")
+                minimumValue: 0
+                maximumValue: 2048
+                stepSize: 64
+                valueText: value === 0 ? qsTranslate("unplayer", "Disabled") : qsTranslate("unplayer", "%1 MiB").arg(value)
+                onReleased: Unplayer.Settings.trackCacheSize = value
+                Component.onCompleted: value = Unplayer.Settings.trackCacheSize
+            }
+
             SectionHeader {
                 text: qsTranslate("unplayer", "Directories")
             }
@@ -74,6 +105,13 @@ Page {
                 Component.onCompleted: checked = Unplayer.Settings.showVideoFiles
             }
 
+            TextSwitch {
+                text: qsTranslate("unplayer", "Browse library directories from database")
+                description: qsTranslate("unplayer", "Show directories in library as of last library update, without reading storage. Files that are not in library are not shown")
+                onCheckedChanged: Unplayer.Settings.browseLibraryDirectories = checked
+                Component.onCompleted: checked = Unplayer.Settings.browseLibraryDirectories
+            }
+
             SectionHeader {
                 text: qsTranslate("unplayer", "Library")
             }
@@ -84,6 +122,34 @@ Page {
                 Component.onCompleted: checked = Unplayer.Settings.openLibraryOnStartup
             }
 
+            TextSwitch {
+                text: qsTranslate("unplayer", "Refine durations of MP3 files")
+                description: qsTranslate("unplayer", "After library update, read whole MP3 files which duration was estimated")
+                onCheckedChanged: Unplayer.Settings.refineDurations = checked
+                Component.onCompleted: checked = Unplayer.Settings.refineDurations
+            }
+
+            TextSwitch {
+                text: qsTranslate("unplayer", "Keep library in memory")
+                description: qsTranslate("unplayer", "Copy library database to memory on startup so that browsing doesn't read from storage. Takes effect after restart")
+                onCheckedChanged: Unplayer.Settings.inMemoryLibrary = checked
+                Component.onCompleted: checked = Unplayer.Settings.inMemoryLibrary
+            }
+
+            TextSwitch {
+                text: qsTranslate("unplayer", "Defer library maintenance until charging")
+                description: qsTranslate("unplayer", "Compact database and thumbnails and periodically update whole library only while device is charging with display off")
+                onCheckedChanged: Unplayer.Settings.deferLibraryMaintenance = checked
+                Component.onCompleted: checked = Unplayer.Settings.deferLibraryMaintenance
+            }
+
+            Button {
+                anchors.horizontalCenter: parent.horizontalCenter
+                text: qsTranslate("unplayer", "Run maintenance now")
+                enabled: Unplayer.LibraryUtils.databaseInitialized
+                onClicked: Unplayer.LibraryUtils.runMaintenance()
+            }
+
             BackgroundItem {
                 id: libraryDirectoriesItem
 
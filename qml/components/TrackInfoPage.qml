@@ -101,11 +101,13 @@ Page {
             }
 
             DetailItem {
+                visible: trackInfo.loaded
                 label: qsTranslate("unplayer", "File size")
                 value: Unplayer.Utils.formatByteSize(trackInfo.fileSize)
             }
 
             DetailItem {
+                visible: trackInfo.loaded
                 label: qsTranslate("unplayer", "MIME type")
                 value: trackInfo.mimeType
             }
@@ -117,11 +119,46 @@ Page {
             }
 
             DetailItem {
+                visible: trackInfo.loaded
                 label: qsTranslate("unplayer", "Bitrate")
                 value: trackInfo.bitrate
             }
+
+            DetailItem {
+                visible: trackInfo.loaded && trackInfo.sampleRate > 0
+                label: qsTranslate("unplayer", "Sample rate")
+                value: qsTranslate("unplayer", "%1 Hz").arg(trackInfo.sampleRate)
+            }
+
+            DetailItem {
+                visible: trackInfo.loaded && trackInfo.channels > 0
+                label: qsTranslate("unplayer", "Channels")
+                value: trackInfo.channels
+            }
+
+            DetailItem {
+                visible: trackInfo.trackGain.length > 0
+                label: qsTranslate("unplayer", "Track gain")
+                value: trackInfo.trackGain
+            }
+
+            DetailItem {
+                visible: trackInfo.albumGain.length > 0
+                label: qsTranslate("unplayer", "Album gain")
+                value: trackInfo.albumGain
+            }
         }
 
         VerticalScrollDecorator { }
     }
+
+    BusyIndicator {
+        anchors {
+            horizontalCenter: parent.horizontalCenter
+            bottom: parent.bottom
+            bottomMargin: Theme.paddingLarge
+        }
+        size: BusyIndicatorSize.Medium
+        running: !trackInfo.loaded
+    }
 }
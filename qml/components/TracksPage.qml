@@ -144,6 +144,12 @@ Page {
         }
 
         PullDownMenu {
+            MenuItem {
+                enabled: listView.count > 0
+                text: qsTranslate("unplayer", "Shuffle all")
+                onClicked: Unplayer.Player.queue.addShuffledLibraryTracks(allArtists ? String() : artist, genre)
+            }
+
             MenuItem {
                 text: qsTranslate("unplayer", "Sort")
                 onClicked: pageStack.push("AllTracksSortPage.qml", {tracksModel: tracksModel})
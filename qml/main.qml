@@ -41,14 +41,31 @@ ApplicationWindow
     cover: Qt.resolvedUrl("components/Cover.qml")
     initialPage: Qt.resolvedUrl("components/MainPage.qml")
 
+    // Database is initialized in background after first page is shown
+    function onDatabaseInitialized() {
+        if (Unplayer.LibraryUtils.createdTable && Unplayer.Settings.hasLibraryDirectories) {
+            Unplayer.LibraryUtils.updateDatabase()
+        }
+        if (Unplayer.Settings.openLibraryOnStartup && Unplayer.Settings.hasLibraryDirectories && pageStack.depth === 1) {
+            pageStack.push("components/LibraryPage.qml", null, PageStackAction.Immediate)
+        }
+    }
+
+    Connections {
+        target: Unplayer.LibraryUtils
+        onDatabaseInitializedChanged: {
+            if (Unplayer.LibraryUtils.databaseInitialized) {
+                onDatabaseInitialized()
+            }
+        }
+    }
+
     Component.onCompleted: {
         if (Unplayer.LibraryUtils.databaseInitialized) {
-            if (Unplayer.LibraryUtils.createdTable && Unplayer.Settings.hasLibraryDirectories) {
-                Unplayer.LibraryUtils.updateDatabase()
-            }
-            if (Unplayer.Settings.openLibraryOnStartup && Unplayer.Settings.hasLibraryDirectories) {
-                pageStack.push("components/LibraryPage.qml", null, PageStackAction.Immediate)
-            }
+            onDatabaseInitialized()
+        } else if (Unplayer.LibraryUtils.hasSnapshot && Unplayer.Settings.openLibraryOnStartup && Unplayer.Settings.hasLibraryDirectories) {
+            // Library snapshot is shown while database is opened
+            pageStack.push("components/LibraryPage.qml", null, PageStackAction.Immediate)
         }
         if (commandLineArguments.length) {
             Unplayer.Player.queue.addTracksFromUrls(commandLineArguments, true)
@@ -75,6 +92,22 @@ ApplicationWindow
                 Unplayer.Player.queue.addTracksFromUrls(tracks, true)
             }
         }
+
+        function dumpQueryStatistics() {
+            Unplayer.LibraryUtils.dumpQueryStatistics()
+        }
+
+        function updateLibrary() {
+            Unplayer.LibraryUtils.updateDatabase()
+        }
+
+        function runLibraryMaintenance() {
+            Unplayer.LibraryUtils.runMaintenance()
+        }
+
+        function importLibrary(directory, volumeRoot) {
+            Unplayer.LibraryUtils.importLibrary(directory, volumeRoot ? volumeRoot : Unplayer.Utils.sdcardPath)
+        }
     }
 
     Rectangle {
@@ -19,6 +19,7 @@ BuildRequires: pkgconfig(Qt5Multimedia)
 BuildRequires: pkgconfig(Qt5Quick)
 BuildRequires: pkgconfig(Qt5Sql)
 BuildRequires: pkgconfig(sailfishapp)
+BuildRequires: pkgconfig(sqlite3)
 BuildRequires: cmake
 BuildRequires: desktop-file-utils
 
@@ -44,6 +45,19 @@ BuildRequires: boost-devel
 %global harbour ON
 #%%global harbour OFF
 
+# Play with playbin directly instead of QtMultimedia
+%global gstreamer OFF
+#%%global gstreamer ON
+
+%if "%{gstreamer}" == "ON"
+BuildRequires: pkgconfig(gstreamer-1.0)
+BuildRequires: pkgconfig(audioresource)
+%endif
+
+# Update library in systemd user service, not allowed in Harbour
+%global library_service OFF
+#%%global library_service ON
+
 %global build_directory "%{_builddir}/build-%{_arch}"
 
 %global qtdbusextended "%{_builddir}/3rdparty/qtdbusextended-0.0.3"
@@ -113,6 +127,8 @@ cd %{build_directory}
 %cmake .. \
     -DCMAKE_BUILD_TYPE=%{build_type} \
     -DHARBOUR=%{harbour} \
+    -DGSTREAMER=%{gstreamer} \
+    -DLIBRARY_SERVICE=%{library_service} \
     -DQTMPRIS_STATIC=ON \
     -DTAGLIB_STATIC=ON
 %{__make} %{?_smp_mflags}
@@ -126,6 +142,11 @@ desktop-file-install \
     --dir %{buildroot}/%{_datadir}/applications \
     %{buildroot}/%{_datadir}/applications/%{name}.desktop
 
+%if "%{library_service}" == "ON"
+%{__mkdir_p} %{buildroot}/%{_prefix}/lib/systemd/user/user-session.target.wants
+ln -s ../%{name}-library.service %{buildroot}/%{_prefix}/lib/systemd/user/user-session.target.wants/%{name}-library.service
+%endif
+
 #install -m 644 -D %{_libdir}/libstdc++.so.6 %{buildroot}/%{_datadir}/%{name}/lib/libstdc++.so.6
 
 %files
@@ -134,3 +155,8 @@ desktop-file-install \
 %{_datadir}/%{name}
 %{_datadir}/applications/%{name}.desktop
 %{_datadir}/icons/hicolor/*/apps/%{name}.png
+%if "%{library_service}" == "ON"
+%{_prefix}/lib/systemd/user/%{name}-library.service
+%{_prefix}/lib/systemd/user/user-session.target.wants/%{name}-library.service
+%{_datadir}/dbus-1/services/org.equeim.unplayer.Library.service
+%endif
@@ -20,18 +20,18 @@
 
 #include <functional>
 
+#include <QColor>
 #include <QCoreApplication>
 #include <QDebug>
-#include <QFile>
-#include <QFutureWatcher>
-#include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
-#include <QtConcurrentRun>
 
+#include "artimageprovider.h"
+#include "libraryindex.h"
+#include "librarysnapshot.h"
 #include "libraryutils.h"
 #include "settings.h"
-#include "utils.h"
+#include "sqlquery.h"
 
 namespace unplayer
 {
@@ -43,8 +43,102 @@ namespace unplayer
             AlbumField,
             YearField,
             TracksCountField,
-            DurationField
+            DurationField,
+            MediaArtField,
+            ArtistSortKeyField,
+            AlbumSortKeyField,
+            MediaArtPlaceholderField
         };
+
+        Album albumFromQuery(const QSqlQuery& query)
+        {
+            const QString artist(query.value(ArtistField).toString());
+            const QString album(query.value(AlbumField).toString());
+            const QVariant year(query.value(YearField));
+            return {artist,
+                    artist.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : artist,
+                    album,
+                    album.isEmpty() ? qApp->translate("unplayer", "Unknown album") : album,
+                    year.toInt(),
+                    query.value(TracksCountField).toInt(),
+                    query.value(DurationField).toInt(),
+                    query.value(MediaArtField).toString(),
+                    query.value(MediaArtPlaceholderField).toUInt(),
+                    query.value(ArtistSortKeyField).toString().toUtf8(),
+                    query.value(AlbumSortKeyField).toString().toUtf8(),
+                    LibraryUtils::intSortKey(year)};
+        }
+
+        QVariantList albumBindValues(const Album& album)
+        {
+            return {album.artist, album.album};
+        }
+
+        QString albumsQueryString(bool allArtists, AlbumsModel::SortMode sortMode, bool sortDescending)
+        {
+            QString queryString(QLatin1String("SELECT artists.title AS artist, albums.title AS album, year, tracksCount, duration, mediaArt, "
+                                              "artists.sortKey, albums.sortKey, COALESCE(thumbnails.placeholder, 0) FROM album_summary "
+                                              "JOIN albums ON albums.id = album_summary.albumId "
+                                              "JOIN artists ON artists.id = album_summary.artistId "
+                                              "LEFT JOIN thumbnails ON thumbnails.url = album_summary.mediaArt "));
+            if (!allArtists) {
+                queryString += QLatin1String("WHERE artists.title = ? ");
+            }
+
+            switch (sortMode) {
+            case AlbumsModel::SortAlbum:
+                queryString += QLatin1String("ORDER BY albums.sortKey %1");
+                break;
+            case AlbumsModel::SortYear:
+                queryString += QLatin1String("ORDER BY year %1, albums.sortKey %1");
+                break;
+            case AlbumsModel::SortArtistAlbum:
+                queryString += QLatin1String("ORDER BY artists.sortKey %1, albums.sortKey %1");
+                break;
+            case AlbumsModel::SortArtistYear:
+                queryString += QLatin1String("ORDER BY artists.sortKey %1, year %1, albums.sortKey %1");
+            }
+
+            return queryString.arg(sortDescending ? QLatin1String("DESC")
+                                                  : QLatin1String("ASC"));
+        }
+
+        template<typename T>
+        int compare(const T& first, const T& second)
+        {
+            if (first < second) {
+                return -1;
+            }
+            if (second < first) {
+                return 1;
+            }
+            return 0;
+        }
+
+        // Same order as ORDER BY in albumsQueryString()
+        int compareAlbums(const Album& first, const Album& second, AlbumsModel::SortMode sortMode)
+        {
+            int result = 0;
+            switch (sortMode) {
+            case AlbumsModel::SortAlbum:
+                break;
+            case AlbumsModel::SortYear:
+                result = compare(first.yearSortKey, second.yearSortKey);
+                break;
+            case AlbumsModel::SortArtistAlbum:
+                result = compare(first.artistSortKey, second.artistSortKey);
+                break;
+            case AlbumsModel::SortArtistYear:
+                if ((result = compare(first.artistSortKey, second.artistSortKey)) == 0) {
+                    result = compare(first.yearSortKey, second.yearSortKey);
+                }
+                break;
+            }
+            if (result != 0) {
+                return result;
+            }
+            return compare(first.albumSortKey, second.albumSortKey);
+        }
     }
 
     AlbumsModel::~AlbumsModel()
@@ -73,12 +167,56 @@ namespace unplayer
 
         emit sortModeChanged();
 
-        execQuery();
+        mSections.updateOnRowsChanged(this, std::bind(&AlbumsModel::updateSections, this));
+
+        if (LibraryUtils::instance()->isDatabaseInitialized()) {
+            execQuery();
+        } else {
+            // Show albums from previous run until database is opened
+            const std::shared_ptr<const LibraryIndex> index(LibraryIndex::current());
+            const LibrarySnapshot& snapshot = LibrarySnapshot::instance();
+            if (index) {
+                setRows(mAllArtists ? index->albums(mSortMode, mSortDescending)
+                                    : index->artistAlbums(mArtist, mSortMode, mSortDescending));
+            } else if (mAllArtists && snapshot.albumsSortMode == mSortMode && snapshot.albumsSortDescending == mSortDescending) {
+                setRows(std::vector<Album>(snapshot.albums));
+            }
+            QObject::connect(LibraryUtils::instance(), &LibraryUtils::databaseInitializedChanged, this, [this]() {
+                if (LibraryUtils::instance()->isDatabaseInitialized()) {
+                    execQuery(true);
+                }
+            });
+        }
+        // Show tracks that were added while library is being updated
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::libraryChanged, this, [this](const LibraryChanges& changes) {
+            if (changesFilter()(changes)) {
+                execQuery(true);
+            }
+        });
+    }
+
+    std::vector<Album> AlbumsModel::queryFirstRows(const QSqlDatabase& db, SortMode sortMode, bool sortDescending, int count)
+    {
+        std::vector<Album> albums;
+        SqlQuery query(db);
+        if (!query.exec(QString::fromLatin1("%1 LIMIT %2").arg(albumsQueryString(true, sortMode, sortDescending)).arg(count))) {
+            qWarning() << "failed to query albums" << query.lastError();
+            return albums;
+        }
+        while (query.next()) {
+            albums.push_back(albumFromQuery(query));
+        }
+        return albums;
+    }
+
+    bool AlbumsModel::lessThan(const Album& first, const Album& second, SortMode sortMode)
+    {
+        return compareAlbums(first, second, sortMode) < 0;
     }
 
     QVariant AlbumsModel::data(const QModelIndex& index, int role) const
     {
-        const Album& album = mAlbums[index.row()];
+        const Album& album = mRows[index.row()];
 
         switch (role) {
         case ArtistRole:
@@ -99,16 +237,15 @@ namespace unplayer
             return album.tracksCount;
         case DurationRole:
             return album.duration;
+        case MediaArtRole:
+            return ArtImageProvider::url(album.mediaArt);
+        case MediaArtPlaceholderRole:
+            return QColor::fromRgba(album.mediaArtPlaceholder);
         default:
             return QVariant();
         }
     }
 
-    int AlbumsModel::rowCount(const QModelIndex&) const
-    {
-        return mAlbums.size();
-    }
-
     bool AlbumsModel::allArtists() const
     {
         return mAllArtists;
@@ -139,7 +276,7 @@ namespace unplayer
     {
         if (descending != mSortDescending) {
             mSortDescending = descending;
-            execQuery();
+            sortRows(true);
         }
     }
 
@@ -153,55 +290,30 @@ namespace unplayer
         if (mode != mSortMode) {
             mSortMode = mode;
             emit sortModeChanged();
-            execQuery();
+            sortRows(false);
         }
     }
 
-    bool AlbumsModel::isRemovingFiles() const
+    SectionsModel* AlbumsModel::sections()
     {
-        return mRemovingFiles;
+        return &mSections;
     }
 
-    std::vector<LibraryTrack> AlbumsModel::getTracksForAlbum(int index) const
+    TrackList AlbumsModel::getTracksForAlbum(int index) const
     {
-        QSqlQuery query;
-        query.prepare(QStringLiteral("SELECT filePath, title, artist, album, duration, mediaArt FROM tracks "
-                                     "WHERE artist = ? AND album = ? "
-                                     "ORDER BY trackNumber, title"));
-        const Album& album = mAlbums[index];
-        query.addBindValue(album.artist);
-        query.addBindValue(album.album);
-        if (query.exec()) {
-            std::vector<LibraryTrack> tracks;
-            query.last();
-            if (query.at() > 0) {
-                tracks.reserve(query.at() + 1);
-            }
-            query.seek(QSql::BeforeFirstRow);
-            while (query.next()) {
-                tracks.push_back({query.value(0).toString(),
-                                  query.value(1).toString(),
-                                  query.value(2).toString(),
-                                  query.value(3).toString(),
-                                  query.value(4).toInt(),
-                                  query.value(6).toString()});
-            }
-            return tracks;
-        }
-        qWarning() << "failed to get tracks from database" << query.lastError();
-        return {};
+        return getTracksForAlbums({index});
     }
 
-    std::vector<LibraryTrack> AlbumsModel::getTracksForAlbums(const std::vector<int>& indexes) const
+    TrackList AlbumsModel::getTracksForAlbums(const std::vector<int>& indexes) const
     {
-        std::vector<LibraryTrack> tracks;
-        QSqlDatabase::database().transaction();
-        for (int index : indexes) {
-            std::vector<LibraryTrack> albumTracks(getTracksForAlbum(index));
-            tracks.insert(tracks.end(), std::make_move_iterator(albumTracks.begin()), std::make_move_iterator(albumTracks.end()));
-        }
-        QSqlDatabase::database().commit();
-        return tracks;
+        return TrackList(tracksForRows(indexes,
+                                       albumBindValues,
+                                       QLatin1String("JOIN artists ON artists.title = query_keys.key0 "
+                                                     "JOIN tracks_artists ON tracks_artists.artistId = artists.id "
+                                                     "JOIN tracks_albums ON tracks_albums.trackId = tracks_artists.trackId "
+                                                     "JOIN albums ON albums.id = tracks_albums.albumId AND albums.title = query_keys.key1 "
+                                                     "JOIN tracks ON tracks.id = tracks_artists.trackId"),
+                                       QLatin1String("trackNumber, title")));
     }
 
     void AlbumsModel::removeAlbum(int index, bool deleteFiles)
@@ -211,76 +323,14 @@ namespace unplayer
 
     void AlbumsModel::removeAlbums(std::vector<int> indexes, bool deleteFiles)
     {
-        if (mRemovingFiles) {
-            return;
-        }
-
-        mRemovingFiles = true;
-        emit removingFilesChanged();
-
-        auto future = QtConcurrent::run(std::bind([this, deleteFiles](std::vector<int>& indexes) {
-            std::sort(indexes.begin(), indexes.end(), std::greater<int>());
-            std::vector<int> removed;
-            {
-                auto db = QSqlDatabase::addDatabase(LibraryUtils::databaseType, staticMetaObject.className());
-                db.setDatabaseName(LibraryUtils::instance()->databaseFilePath());
-                if (!db.open()) {
-                    QSqlDatabase::removeDatabase(staticMetaObject.className());
-                    qWarning() << "failed to open database" << db.lastError();
-                    return removed;
-                }
-                db.transaction();
-
-                for (int index : indexes) {
-                    const QString artist(mAlbums[index].artist);
-                    const QString album(mAlbums[index].album);
-
-                    if (deleteFiles) {
-                        QSqlQuery query(db);
-                        query.prepare(QStringLiteral("SELECT DISTINCT filePath FROM tracks WHERE artist = ? AND album = ?"));
-                        query.addBindValue(artist);
-                        query.addBindValue(album);
-                        query.exec();
-                        while (query.next()) {
-                            const QString filePath(query.value(0).toString());
-                            if (!QFile::remove(filePath)) {
-                                qWarning() << "failed to remove file:" << filePath;
-                            }
-                        }
-                    }
-
-                    QSqlQuery query(db);
-                    query.prepare(QStringLiteral("DELETE FROM tracks WHERE artist = ? AND album = ?"));
-                    query.addBindValue(artist);
-                    query.addBindValue(album);
-                    if (query.exec()) {
-                        removed.push_back(index);
-                    } else {
-                        qWarning() << "failed to remove files from database" << query.lastQuery() << query.lastError();
-                    }
-                }
-                db.commit();
-            }
-            QSqlDatabase::removeDatabase(staticMetaObject.className());
-
-            return removed;
-        }, std::move(indexes)));
-
-        using Watcher = QFutureWatcher<std::vector<int>>;
-        auto watcher = new Watcher(this);
-        QObject::connect(watcher, &Watcher::finished, this, [this, watcher]() {
-            mRemovingFiles = false;
-            emit removingFilesChanged();
-
-            for (int index : watcher->result()) {
-                beginRemoveRows(QModelIndex(), index, index);
-                mAlbums.erase(mAlbums.begin() + index);
-                endRemoveRows();
-            }
-            emit LibraryUtils::instance()->databaseChanged();
-            watcher->deleteLater();
-        });
-        watcher->setFuture(future);
+        removeRows(indexes,
+                   deleteFiles,
+                   QLatin1String("SELECT tracks_artists.trackId FROM query_keys "
+                                 "JOIN artists ON artists.title = query_keys.key0 "
+                                 "JOIN tracks_artists ON tracks_artists.artistId = artists.id "
+                                 "JOIN tracks_albums ON tracks_albums.trackId = tracks_artists.trackId "
+                                 "JOIN albums ON albums.id = tracks_albums.albumId AND albums.title = query_keys.key1"),
+                   albumBindValues);
     }
 
     QHash<int, QByteArray> AlbumsModel::roleNames() const
@@ -293,61 +343,75 @@ namespace unplayer
                 {UnknownAlbumRole, "unknownAlbum"},
                 {YearRole, "year"},
                 {TracksCountRole, "tracksCount"},
-            {DurationRole, "duration"}};
+                {DurationRole, "duration"},
+                {MediaArtRole, "mediaArt"},
+                {MediaArtPlaceholderRole, "mediaArtPlaceholder"}};
     }
 
-    void AlbumsModel::execQuery()
+    void AlbumsModel::execQuery(bool update)
+    {
+        QVariantList bindValues;
+        if (!mAllArtists) {
+            bindValues.push_back(mArtist);
+        }
+
+        AsyncQueryModel::execQuery(albumsQueryString(mAllArtists, mSortMode, mSortDescending),
+                                   bindValues,
+                                   albumFromQuery,
+                                   update ? albumBindValues : nullptr,
+                                   changesFilter());
+    }
+
+    AlbumsModel::LibraryChangesFilter AlbumsModel::changesFilter() const
     {
-        QString queryString(QLatin1String("SELECT artist, album, year, COUNT(*), SUM(duration) FROM "
-                                          "(SELECT artist, album, year, duration FROM tracks GROUP BY id, artist, album) "));
         if (mAllArtists) {
-            queryString += QLatin1String("GROUP BY album, artist ");
-        } else {
-            queryString += QLatin1String("WHERE artist = ? "
-                                   "GROUP BY album ");
+            return [](const LibraryChanges&) {
+                return true;
+            };
         }
+        const QString artist(mArtist);
+        return [artist](const LibraryChanges& changes) {
+            return changes.affectsArtist(artist);
+        };
+    }
 
+    void AlbumsModel::updateSections()
+    {
         switch (mSortMode) {
         case SortAlbum:
-            queryString += QLatin1String("ORDER BY album = '' %1, album %1");
+            mSections.update(mRows.size(), [this](int row) {
+                return mRows[row].albumSortKey;
+            });
             break;
         case SortYear:
-            queryString += QLatin1String("ORDER BY year %1, album = '' %1, album %1");
+            mSections.clear();
             break;
         case SortArtistAlbum:
-            queryString += QLatin1String("ORDER BY artist = '' %1, artist %1, album = '' %1, album %1");
-            break;
         case SortArtistYear:
-            queryString += QLatin1String("ORDER BY artist = '' %1, artist %1, year %1, album = '' %1, album %1");
+            mSections.update(mRows.size(), [this](int row) {
+                return mRows[row].artistSortKey;
+            });
         }
+    }
 
-        queryString = queryString.arg(mSortDescending ? QLatin1String("DESC")
-                                                      : QLatin1String("ASC"));
-
-
-        QSqlQuery query;
-        query.prepare(queryString);
-        if (!mAllArtists) {
-            query.addBindValue(mArtist);
+    void AlbumsModel::sortRows(bool reverse)
+    {
+        if (!canSortRows()) {
+            execQuery();
+            return;
         }
 
-        beginResetModel();
-        mAlbums.clear();
-        if (query.exec()) {
-            while (query.next()) {
-                const QString artist(query.value(ArtistField).toString());
-                const QString album(query.value(AlbumField).toString());
-                mAlbums.push_back({artist,
-                                   artist.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : artist,
-                                   album,
-                                   album.isEmpty() ? qApp->translate("unplayer", "Unknown album") : album,
-                                   query.value(YearField).toInt(),
-                                   query.value(TracksCountField).toInt(),
-                                   query.value(DurationField).toInt()});
-            }
-        } else {
-            qWarning() << query.lastError();
+        // Only direction has changed
+        if (reverse && !isSortingRows()) {
+            reverseRows();
+            return;
         }
-        endResetModel();
+
+        const bool descending = mSortDescending;
+        const SortMode sortMode = mSortMode;
+        AsyncQueryModel::sortRows([=](const Album& first, const Album& second) {
+            return descending ? compareAlbums(second, first, sortMode) < 0
+                              : compareAlbums(first, second, sortMode) < 0;
+        });
     }
 }
@@ -21,10 +21,13 @@
 
 #include <vector>
 
-#include <QAbstractListModel>
 #include <QQmlParserStatus>
+#include <QRgb>
 
+#include "asyncquerymodel.h"
 #include "librarytrack.h"
+#include "sectionsmodel.h"
+#include "tracklist.h"
 
 namespace unplayer
 {
@@ -37,9 +40,17 @@ namespace unplayer
         int year;
         int tracksCount;
         int duration;
+        QString mediaArt;
+        // Dominant color of media art thumbnail, 0 if it is unknown
+        QRgb mediaArtPlaceholder;
+
+        // Values of columns that rows are sorted by, sort keys are UTF-8
+        QByteArray artistSortKey;
+        QByteArray albumSortKey;
+        int yearSortKey;
     };
 
-    class AlbumsModel : public QAbstractListModel, public QQmlParserStatus
+    class AlbumsModel : public AsyncQueryModel<Album>, public QQmlParserStatus
     {
         Q_OBJECT
         Q_INTERFACES(QQmlParserStatus)
@@ -47,7 +58,7 @@ namespace unplayer
         Q_PROPERTY(QString artist READ artist WRITE setArtist)
         Q_PROPERTY(bool sortDescending READ sortDescending WRITE setSortDescending)
         Q_PROPERTY(SortMode sortMode READ sortMode WRITE setSortMode NOTIFY sortModeChanged)
-        Q_PROPERTY(bool removingFiles READ isRemovingFiles NOTIFY removingFilesChanged)
+        Q_PROPERTY(unplayer::SectionsModel* sections READ sections CONSTANT)
     public:
         enum Role
         {
@@ -59,7 +70,9 @@ namespace unplayer
             UnknownAlbumRole,
             YearRole,
             TracksCountRole,
-            DurationRole
+            DurationRole,
+            MediaArtRole,
+            MediaArtPlaceholderRole
         };
         Q_ENUM(Role)
 
@@ -73,11 +86,16 @@ namespace unplayer
         Q_ENUM(SortMode)
 
         ~AlbumsModel() override;
+
+        // Returns first rows of all albums in given order, used for library snapshot
+        static std::vector<Album> queryFirstRows(const QSqlDatabase& db, SortMode sortMode, bool sortDescending, int count);
+        // Same order as query in given sort mode
+        static bool lessThan(const Album& first, const Album& second, SortMode sortMode);
+
         void classBegin() override;
         void componentComplete() override;
 
         QVariant data(const QModelIndex& index, int role) const override;
-        int rowCount(const QModelIndex& parent) const override;
 
         bool allArtists() const;
         void setAllArtists(bool allArtists);
@@ -90,10 +108,11 @@ namespace unplayer
         SortMode sortMode() const;
         void setSortMode(SortMode mode);
 
-        bool isRemovingFiles() const;
+        // Empty when albums are sorted by year
+        SectionsModel* sections();
 
-        Q_INVOKABLE std::vector<unplayer::LibraryTrack> getTracksForAlbum(int index) const;
-        Q_INVOKABLE std::vector<unplayer::LibraryTrack> getTracksForAlbums(const std::vector<int>& indexes) const;
+        Q_INVOKABLE unplayer::TrackList getTracksForAlbum(int index) const;
+        Q_INVOKABLE unplayer::TrackList getTracksForAlbums(const std::vector<int>& indexes) const;
 
         Q_INVOKABLE void removeAlbum(int index, bool deleteFiles);
         Q_INVOKABLE void removeAlbums(std::vector<int> indexes, bool deleteFiles);
@@ -102,9 +121,13 @@ namespace unplayer
         QHash<int, QByteArray> roleNames() const override;
 
     private:
-        void execQuery();
-
-        std::vector<Album> mAlbums;
+        // Updates rows in place if update is true
+        void execQuery(bool update = false);
+        // Changes that affect rows with current artist, album or genre
+        LibraryChangesFilter changesFilter() const;
+        // Reorders rows in memory if all of them are loaded, otherwise queries them again
+        void sortRows(bool reverse);
+        void updateSections();
 
         bool mAllArtists = true;
         QString mArtist;
@@ -112,12 +135,11 @@ namespace unplayer
         bool mSortDescending = false;
         SortMode mSortMode = SortAlbum;
 
-        bool mRemovingFiles = false;
+        SectionsModel mSections;
 
     signals:
         void allArtistsChanged();
         void sortModeChanged();
-        void removingFilesChanged();
     };
 }
 
@@ -0,0 +1,275 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "artimageprovider.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <QBuffer>
+#include <QDebug>
+#include <QFutureInterface>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QUrl>
+
+#include "perfcounters.h"
+#include "utils.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        const int imageCacheMaxSize = 24 * 1024 * 1024;
+
+        const QLatin1String urlPrefix("image://art/");
+        const QLatin1String fileIdPrefix("file/");
+
+        ArtImageProvider* providerInstance = nullptr;
+
+        class ArtImageResponse final : public QQuickImageResponse, public QRunnable
+        {
+        public:
+            explicit ArtImageResponse(ArtImageProvider* provider, const QString& id, const QSize& requestedSize)
+                : mProvider(provider),
+                  mId(id),
+                  mRequestedSize(requestedSize)
+            {
+                // Deleted by QML engine
+                setAutoDelete(false);
+            }
+
+            QQuickTextureFactory* textureFactory() const override
+            {
+                return QQuickTextureFactory::textureFactoryForImage(mImage);
+            }
+
+            void run() override
+            {
+                mImage = mProvider->image(mId, mRequestedSize);
+                emit finished();
+            }
+
+        private:
+            ArtImageProvider* mProvider;
+            QString mId;
+            QSize mRequestedSize;
+            QImage mImage;
+        };
+
+        class PrefetchRunnable final : public QRunnable
+        {
+        public:
+            explicit PrefetchRunnable(ArtImageProvider* provider, const QString& id, const QSize& requestedSize)
+                : mProvider(provider),
+                  mId(id),
+                  mRequestedSize(requestedSize)
+            {
+
+            }
+
+            void run() override
+            {
+                mProvider->image(mId, mRequestedSize);
+            }
+
+        private:
+            ArtImageProvider* mProvider;
+            QString mId;
+            QSize mRequestedSize;
+        };
+
+        // Unset dimension of requested size may be either 0 or -1
+        QString cacheKey(const QString& id, const QSize& requestedSize)
+        {
+            return QString::fromLatin1("%1@%2x%3").arg(id).arg(std::max(requestedSize.width(), 0)).arg(std::max(requestedSize.height(), 0));
+        }
+    }
+
+    const QString ArtImageProvider::providerId(QLatin1String("art"));
+
+    QString ArtImageProvider::url(const QString& mediaArt)
+    {
+        if (mediaArt.isEmpty() || mediaArt.startsWith(urlPrefix)) {
+            return mediaArt;
+        }
+        return urlPrefix + fileIdPrefix + QString::fromLatin1(QUrl::toPercentEncoding(mediaArt.mid(1), "/"));
+    }
+
+    ArtImageProvider* ArtImageProvider::instance()
+    {
+        return providerInstance;
+    }
+
+    ArtImageProvider::ArtImageProvider(const QString& mediaArtDirectory)
+        : mAtlas(mediaArtDirectory),
+          mCacheSize(0),
+          mCacheHits(0),
+          mCacheMisses(0),
+          mSharedRequests(0)
+    {
+        providerInstance = this;
+    }
+
+    ArtImageProvider::~ArtImageProvider()
+    {
+        providerInstance = nullptr;
+        mThreadPool.clear();
+        mThreadPool.waitForDone();
+    }
+
+    QQuickImageResponse* ArtImageProvider::requestImageResponse(const QString& id, const QSize& requestedSize)
+    {
+        auto response = new ArtImageResponse(this, id, requestedSize);
+        mThreadPool.start(response);
+        return response;
+    }
+
+    QImage ArtImageProvider::image(const QString& id, const QSize& requestedSize)
+    {
+        const QString key(cacheKey(id, requestedSize));
+
+        QFutureInterface<QImage> futureInterface;
+        {
+            QMutexLocker locker(&mCacheMutex);
+            const auto found(mCacheIndex.find(key));
+            if (found != mCacheIndex.end()) {
+                ++mCacheHits;
+                perfcounters::add(perfcounters::ArtCacheHits);
+                mCache.splice(mCache.begin(), mCache, found->second);
+                return found->second->second;
+            }
+
+            const auto pending(mPending.find(key));
+            if (pending != mPending.end()) {
+                ++mSharedRequests;
+                QFuture<QImage> future(pending->second);
+                locker.unlock();
+                future.waitForFinished();
+                return future.resultCount() > 0 ? future.result() : QImage();
+            }
+
+            ++mCacheMisses;
+            perfcounters::add(perfcounters::ArtCacheMisses);
+            futureInterface.reportStarted();
+            mPending.emplace(key, futureInterface.future());
+        }
+
+        const QImage image(decode(id, requestedSize));
+
+        {
+            const QMutexLocker locker(&mCacheMutex);
+            mPending.erase(key);
+            if (!image.isNull() && image.byteCount() <= imageCacheMaxSize) {
+                mCache.emplace_front(key, image);
+                mCacheIndex.insert({key, mCache.begin()});
+                mCacheSize += image.byteCount();
+                evict(imageCacheMaxSize);
+            }
+        }
+
+        futureInterface.reportResult(image);
+        futureInterface.reportFinished();
+        return image;
+    }
+
+    void ArtImageProvider::prefetch(const QStringList& urls, const QSize& requestedSize)
+    {
+        std::vector<QString> ids;
+        {
+            const QMutexLocker locker(&mCacheMutex);
+            for (const QString& url : urls) {
+                if (!url.startsWith(urlPrefix)) {
+                    continue;
+                }
+                QString id(url.mid(urlPrefix.size()));
+                const QString key(cacheKey(id, requestedSize));
+                if (mCacheIndex.find(key) == mCacheIndex.end() && mPending.find(key) == mPending.end()) {
+                    ids.push_back(std::move(id));
+                }
+            }
+        }
+        for (const QString& id : ids) {
+            // Requests from QML have priority 0 and are started first
+            mThreadPool.start(new PrefetchRunnable(this, id, requestedSize), -1);
+        }
+    }
+
+    void ArtImageProvider::trimCache(MemoryPressure::Level level)
+    {
+        const QMutexLocker locker(&mCacheMutex);
+        evict(level == MemoryPressure::Level::Critical ? 0 : imageCacheMaxSize / 4);
+    }
+
+    ArtImageProvider::CacheStatistics ArtImageProvider::cacheStatistics()
+    {
+        const QMutexLocker locker(&mCacheMutex);
+        return {static_cast<int>(mCache.size()), mCacheSize, mCacheHits, mCacheMisses, mSharedRequests};
+    }
+
+    void ArtImageProvider::evict(int maxSize)
+    {
+        while (mCacheSize > maxSize) {
+            const auto& last = mCache.back();
+            mCacheSize -= last.second.byteCount();
+            mCacheIndex.erase(last.first);
+            mCache.pop_back();
+        }
+    }
+
+    QImage ArtImageProvider::decode(const QString& id, const QSize& requestedSize)
+    {
+        ThumbnailAtlasReader::Thumbnail thumbnail;
+        QBuffer buffer;
+        QImageReader reader;
+        if (thumbnailatlas::isThumbnail(id)) {
+            thumbnail = mAtlas.thumbnail(id);
+            if (thumbnail.data.isEmpty()) {
+                return QImage();
+            }
+            buffer.setData(thumbnail.data);
+            buffer.open(QIODevice::ReadOnly);
+            reader.setDevice(&buffer);
+        } else if (id.startsWith(fileIdPrefix)) {
+            reader.setFileName(QLatin1Char('/') + QUrl::fromPercentEncoding(id.midRef(fileIdPrefix.size()).toUtf8()));
+        } else {
+            qWarning() << "invalid media art id" << id;
+            return QImage();
+        }
+
+        const QSize imageSize(reader.size());
+        QSize size(imageSize);
+        if ((requestedSize.width() > 0 || requestedSize.height() > 0) && size.isValid()) {
+            QSize newSize(requestedSize);
+            if (newSize.width() <= 0) {
+                newSize.setWidth(size.width());
+            }
+            if (newSize.height() <= 0) {
+                newSize.setHeight(size.height());
+            }
+            size.scale(newSize, Qt::KeepAspectRatio);
+        }
+
+        const QImage image(Utils::readScaledImage(reader, imageSize, size));
+        if (image.isNull()) {
+            qWarning() << "failed to decode media art" << id << reader.errorString();
+        }
+        return image;
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_ARTIMAGEPROVIDER_H
+#define UNPLAYER_ARTIMAGEPROVIDER_H
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+#include <QFuture>
+#include <QImage>
+#include <QMutex>
+#include <QQuickImageProvider>
+#include <QThreadPool>
+
+#include "memorypressure.h"
+#include "stdutils.h"
+#include "thumbnailatlas.h"
+
+namespace unplayer
+{
+    // Decodes media art of library, both thumbnails in atlases (image://art/thumbnails/...)
+    // and image files (image://art/file/<path>). Recently requested images are kept in memory
+    // and concurrent requests of the same image are decoded once
+    class ArtImageProvider final : public QQuickAsyncImageProvider
+    {
+    public:
+        static const QString providerId;
+
+        // Returns URL of media art file or thumbnail from the database, or empty string
+        static QString url(const QString& mediaArt);
+
+        // Provider added to QML engine, or nullptr
+        static ArtImageProvider* instance();
+
+        explicit ArtImageProvider(const QString& mediaArtDirectory);
+        ~ArtImageProvider() override;
+        ArtImageProvider(const ArtImageProvider& other) = delete;
+        ArtImageProvider& operator=(const ArtImageProvider& other) = delete;
+        QQuickImageResponse* requestImageResponse(const QString& id, const QSize& requestedSize) override;
+
+        // Thread-safe
+        QImage image(const QString& id, const QSize& requestedSize);
+
+        // Decodes images that are not in memory yet with lower priority than requests from QML.
+        // requestedSize should be the same as sourceSize of Image that will show them
+        void prefetch(const QStringList& urls, const QSize& requestedSize);
+
+        // Drops least recently used images, all of them on critical memory level
+        void trimCache(MemoryPressure::Level level);
+
+        struct CacheStatistics
+        {
+            int images;
+            int bytes;
+            qint64 hits;
+            qint64 misses;
+            // Requests that waited for the same image to be decoded by another thread
+            qint64 shared;
+        };
+        CacheStatistics cacheStatistics();
+
+    private:
+        // Must be called with mCacheMutex locked
+        void evict(int maxSize);
+        QImage decode(const QString& id, const QSize& requestedSize);
+
+        ThumbnailAtlasReader mAtlas;
+        QThreadPool mThreadPool;
+
+        // Most recently used images are at the front
+        using CacheList = std::list<std::pair<QString, QImage>>;
+        QMutex mCacheMutex;
+        CacheList mCache;
+        std::unordered_map<QString, CacheList::iterator> mCacheIndex;
+        // Images that are being decoded
+        std::unordered_map<QString, QFuture<QImage>> mPending;
+        int mCacheSize;
+        qint64 mCacheHits;
+        qint64 mCacheMisses;
+        qint64 mSharedRequests;
+    };
+}
+
+#endif // UNPLAYER_ARTIMAGEPROVIDER_H
@@ -18,18 +18,18 @@
 
 #include "artistsmodel.h"
 
-#include <functional>
-
+#include <QColor>
 #include <QCoreApplication>
 #include <QDebug>
-#include <QFile>
-#include <QFutureWatcher>
 #include <QSqlError>
 #include <QSqlQuery>
-#include <QtConcurrentRun>
 
+#include "artimageprovider.h"
+#include "libraryindex.h"
+#include "librarysnapshot.h"
 #include "libraryutils.h"
 #include "settings.h"
+#include "sqlquery.h"
 
 namespace unplayer
 {
@@ -40,20 +40,90 @@ namespace unplayer
             ArtistField,
             AlbumsCountField,
             TracksCountField,
-            DurationField
+            DurationField,
+            MediaArtField,
+            SortKeyField,
+            MediaArtPlaceholderField
         };
+
+        Artist artistFromQuery(const QSqlQuery& query)
+        {
+            const QString artist(query.value(ArtistField).toString());
+            return {artist,
+                    artist.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : artist,
+                    query.value(AlbumsCountField).toInt(),
+                    query.value(TracksCountField).toInt(),
+                    query.value(DurationField).toInt(),
+                    query.value(MediaArtField).toString(),
+                    query.value(MediaArtPlaceholderField).toUInt(),
+                    query.value(SortKeyField).toString().toUtf8()};
+        }
+
+        QVariantList artistBindValues(const Artist& artist)
+        {
+            return {artist.artist};
+        }
+
+        QString artistsQueryString(bool sortDescending)
+        {
+            return QString::fromLatin1("SELECT artists.title AS artist, albumsCount, tracksCount, duration, mediaArt, artists.sortKey, "
+                                       "COALESCE(thumbnails.placeholder, 0) FROM artist_summary "
+                                       "JOIN artists ON artists.id = artist_summary.artistId "
+                                       "LEFT JOIN thumbnails ON thumbnails.url = artist_summary.mediaArt "
+                                       "ORDER BY artists.sortKey %1").arg(sortDescending ? QLatin1String("DESC")
+                                                                                         : QLatin1String("ASC"));
+        }
     }
 
     ArtistsModel::ArtistsModel()
-        : mSortDescending(Settings::instance()->artistsSortDescending()),
-          mRemovingFiles(false)
+        : mSortDescending(Settings::instance()->artistsSortDescending())
     {
-        execQuery();
+        mSections.updateOnRowsChanged(this, [this]() {
+            mSections.update(mRows.size(), [this](int row) {
+                return mRows[row].sortKey;
+            });
+        });
+
+        if (LibraryUtils::instance()->isDatabaseInitialized()) {
+            execQuery();
+        } else {
+            // Show artists from previous run until database is opened
+            const std::shared_ptr<const LibraryIndex> index(LibraryIndex::current());
+            const LibrarySnapshot& snapshot = LibrarySnapshot::instance();
+            if (index) {
+                setRows(index->artists(mSortDescending));
+            } else if (snapshot.artistsSortDescending == mSortDescending) {
+                setRows(std::vector<Artist>(snapshot.artists));
+            }
+            QObject::connect(LibraryUtils::instance(), &LibraryUtils::databaseInitializedChanged, this, [this]() {
+                if (LibraryUtils::instance()->isDatabaseInitialized()) {
+                    execQuery(true);
+                }
+            });
+        }
+        // Show tracks that were added while library is being updated
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::libraryChanged, this, [this]() {
+            execQuery(true);
+        });
+    }
+
+    std::vector<Artist> ArtistsModel::queryFirstRows(const QSqlDatabase& db, bool sortDescending, int count)
+    {
+        std::vector<Artist> artists;
+        SqlQuery query(db);
+        if (!query.exec(QString::fromLatin1("%1 LIMIT %2").arg(artistsQueryString(sortDescending)).arg(count))) {
+            qWarning() << "failed to query artists" << query.lastError();
+            return artists;
+        }
+        while (query.next()) {
+            artists.push_back(artistFromQuery(query));
+        }
+        return artists;
     }
 
     QVariant ArtistsModel::data(const QModelIndex& index, int role) const
     {
-        const Artist& artist = mArtists[index.row()];
+        const Artist& artist = mRows[index.row()];
 
         switch (role) {
         case ArtistRole:
@@ -66,16 +136,15 @@ namespace unplayer
             return artist.tracksCount;
         case DurationRole:
             return artist.duration;
+        case MediaArtRole:
+            return ArtImageProvider::url(artist.mediaArt);
+        case MediaArtPlaceholderRole:
+            return QColor::fromRgba(artist.mediaArtPlaceholder);
         default:
             return QVariant();
         }
     }
 
-    int ArtistsModel::rowCount(const QModelIndex&) const
-    {
-        return mArtists.size();
-    }
-
     bool ArtistsModel::sortDescending() const
     {
         return mSortDescending;
@@ -89,50 +158,26 @@ namespace unplayer
         execQuery();
     }
 
-    bool ArtistsModel::isRemovingFiles() const
+    SectionsModel* ArtistsModel::sections()
     {
-        return mRemovingFiles;
+        return &mSections;
     }
 
-    std::vector<LibraryTrack> ArtistsModel::getTracksForArtist(int index) const
+    TrackList ArtistsModel::getTracksForArtist(int index) const
     {
-        QSqlQuery query;
-        query.prepare(QStringLiteral("SELECT filePath, title, artist, album, duration, mediaArt FROM tracks "
-                                     "WHERE artist = ? "
-                                     "ORDER BY album = '', year, album, trackNumber, title"));
-        query.addBindValue(mArtists[index].artist);
-        if (query.exec()) {
-            std::vector<LibraryTrack> tracks;
-            query.last();
-            if (query.at() > 0) {
-                tracks.reserve(query.at() + 1);
-            }
-            query.seek(QSql::BeforeFirstRow);
-            while (query.next()) {
-                tracks.push_back({query.value(0).toString(),
-                                  query.value(1).toString(),
-                                  query.value(2).toString(),
-                                  query.value(3).toString(),
-                                  query.value(4).toInt(),
-                                  query.value(6).toString()});
-            }
-            return tracks;
-        }
-
-        qWarning() << "failed to get tracks from database" << query.lastError();
-        return {};
+        return getTracksForArtists({index});
     }
 
-    std::vector<LibraryTrack> ArtistsModel::getTracksForArtists(const std::vector<int>& indexes) const
+    TrackList ArtistsModel::getTracksForArtists(const std::vector<int>& indexes) const
     {
-        std::vector<LibraryTrack> tracks;
-        QSqlDatabase::database().transaction();
-        for (int index : indexes) {
-            std::vector<LibraryTrack> artistTracks(getTracksForArtist(index));
-            tracks.insert(tracks.end(), std::make_move_iterator(artistTracks.begin()), std::make_move_iterator(artistTracks.end()));
-        }
-        QSqlDatabase::database().commit();
-        return tracks;
+        return TrackList(tracksForRows(indexes,
+                                       artistBindValues,
+                                       QLatin1String("JOIN artists ON artists.title = query_keys.key0 "
+                                                     "JOIN tracks_artists ON tracks_artists.artistId = artists.id "
+                                                     "JOIN tracks ON tracks.id = tracks_artists.trackId "
+                                                     "JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
+                                                     "JOIN albums ON albums.id = tracks_albums.albumId"),
+                                       QLatin1String("album = '', year, album, trackNumber, title")));
     }
 
     void ArtistsModel::removeArtist(int index, bool deleteFiles)
@@ -142,73 +187,12 @@ namespace unplayer
 
     void ArtistsModel::removeArtists(std::vector<int> indexes, bool deleteFiles)
     {
-        if (mRemovingFiles) {
-            return;
-        }
-
-        mRemovingFiles = true;
-        emit removingFilesChanged();
-
-        auto future = QtConcurrent::run(std::bind([this, deleteFiles](std::vector<int>& indexes) {
-            std::sort(indexes.begin(), indexes.end(), std::greater<int>());
-            std::vector<int> removed;
-            {
-                auto db = QSqlDatabase::addDatabase(LibraryUtils::databaseType, staticMetaObject.className());
-                db.setDatabaseName(LibraryUtils::instance()->databaseFilePath());
-                if (!db.open()) {
-                    QSqlDatabase::removeDatabase(staticMetaObject.className());
-                    qWarning() << "failed to open database" << db.lastError();
-                    return removed;
-                }
-                db.transaction();
-
-                for (int index : indexes) {
-                    const QString artist(mArtists[index].artist);
-
-                    if (deleteFiles) {
-                        QSqlQuery query(db);
-                        query.prepare(QStringLiteral("SELECT DISTINCT filePath FROM tracks WHERE artist = ?"));
-                        query.addBindValue(artist);
-                        query.exec();
-                        while (query.next()) {
-                            const QString filePath(query.value(0).toString());
-                            if (!QFile::remove(filePath)) {
-                                qWarning() << "failed to remove file:" << filePath;
-                            }
-                        }
-                    }
-
-                    QSqlQuery query(db);
-                    query.prepare(QStringLiteral("DELETE FROM tracks WHERE artist = ?"));
-                    query.addBindValue(artist);
-                    if (query.exec()) {
-                        removed.push_back(index);
-                    } else {
-                        qWarning() << "failed to remove files from database" << query.lastQuery() << query.lastError();
-                    }
-                }
-                db.commit();
-            }
-            QSqlDatabase::removeDatabase(staticMetaObject.className());
-
-            return removed;
-        }, std::move(indexes)));
-
-        using Watcher = QFutureWatcher<std::vector<int>>;
-        auto watcher = new Watcher(this);
-        QObject::connect(watcher, &Watcher::finished, this, [this, watcher]() {
-            mRemovingFiles = false;
-            emit removingFilesChanged();
-
-            for (int index : watcher->result()) {
-                beginRemoveRows(QModelIndex(), index, index);
-                mArtists.erase(mArtists.begin() + index);
-                endRemoveRows();
-            }
-            emit LibraryUtils::instance()->databaseChanged();
-            watcher->deleteLater();
-        });
-        watcher->setFuture(future);
+        removeRows(indexes,
+                   deleteFiles,
+                   QLatin1String("SELECT tracks_artists.trackId FROM query_keys "
+                                 "JOIN artists ON artists.title = query_keys.key0 "
+                                 "JOIN tracks_artists ON tracks_artists.artistId = artists.id"),
+                   artistBindValues);
     }
 
     QHash<int, QByteArray> ArtistsModel::roleNames() const
@@ -217,31 +201,16 @@ namespace unplayer
                 {DisplayedArtistRole, "displayedArtist"},
                 {AlbumsCountRole, "albumsCount"},
                 {TracksCountRole, "tracksCount"},
-            {DurationRole, "duration"}};
+                {DurationRole, "duration"},
+                {MediaArtRole, "mediaArt"},
+                {MediaArtPlaceholderRole, "mediaArtPlaceholder"}};
     }
 
-    void ArtistsModel::execQuery()
+    void ArtistsModel::execQuery(bool update)
     {
-        beginResetModel();
-        mArtists.clear();
-        QSqlQuery query(QString::fromLatin1("SELECT artist, COUNT(DISTINCT(album)), COUNT(*), SUM(duration) FROM "
-                                            "(SELECT artist, album, duration FROM tracks GROUP BY id, artist, album) "
-                                            "GROUP BY artist "
-                                            "ORDER BY artist = '' %1, artist %1").arg(mSortDescending ? QLatin1String("DESC")
-                                                                                                      : QLatin1String("ASC")));
-        if (query.lastError().type() == QSqlError::NoError) {
-            while (query.next()) {
-                const QString artist(query.value(ArtistField).toString());
-                mArtists.push_back({artist,
-                                    artist.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : artist,
-                                    query.value(AlbumsCountField).toInt(),
-                                    query.value(TracksCountField).toInt(),
-                                    query.value(DurationField).toInt()});
-            }
-
-        } else {
-            qWarning() << query.lastError();
-        }
-        endResetModel();
+        AsyncQueryModel::execQuery(artistsQueryString(mSortDescending),
+                                   QVariantList(),
+                                   artistFromQuery,
+                                   update ? artistBindValues : nullptr);
     }
 }
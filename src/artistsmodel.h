@@ -20,9 +20,13 @@
 #define UNPLAYER_ARTISTSMODEL_H
 
 #include <vector>
-#include <QAbstractListModel>
 
+#include <QRgb>
+
+#include "asyncquerymodel.h"
 #include "librarytrack.h"
+#include "sectionsmodel.h"
+#include "tracklist.h"
 
 namespace unplayer
 {
@@ -33,13 +37,19 @@ namespace unplayer
         int albumsCount;
         int tracksCount;
         int duration;
+        QString mediaArt;
+        // Dominant color of media art thumbnail, 0 if it is unknown
+        QRgb mediaArtPlaceholder;
+
+        // UTF-8
+        QByteArray sortKey;
     };
 
-    class ArtistsModel : public QAbstractListModel
+    class ArtistsModel : public AsyncQueryModel<Artist>
     {
         Q_OBJECT
         Q_PROPERTY(bool sortDescending READ sortDescending NOTIFY sortDescendingChanged)
-        Q_PROPERTY(bool removingFiles READ isRemovingFiles NOTIFY removingFilesChanged)
+        Q_PROPERTY(unplayer::SectionsModel* sections READ sections CONSTANT)
     public:
         enum Role
         {
@@ -47,23 +57,27 @@ namespace unplayer
             DisplayedArtistRole,
             AlbumsCountRole,
             TracksCountRole,
-            DurationRole
+            DurationRole,
+            MediaArtRole,
+            MediaArtPlaceholderRole
         };
         Q_ENUM(Role)
 
         ArtistsModel();
 
+        // Returns first rows in given order, used for library snapshot
+        static std::vector<Artist> queryFirstRows(const QSqlDatabase& db, bool sortDescending, int count);
+
         QVariant data(const QModelIndex& index, int role) const override;
-        int rowCount(const QModelIndex& parent) const override;
 
         bool sortDescending() const;
 
         Q_INVOKABLE void toggleSortOrder();
 
-        bool isRemovingFiles() const;
+        SectionsModel* sections();
 
-        Q_INVOKABLE std::vector<unplayer::LibraryTrack> getTracksForArtist(int index) const;
-        Q_INVOKABLE std::vector<unplayer::LibraryTrack> getTracksForArtists(const std::vector<int>& indexes) const;
+        Q_INVOKABLE unplayer::TrackList getTracksForArtist(int index) const;
+        Q_INVOKABLE unplayer::TrackList getTracksForArtists(const std::vector<int>& indexes) const;
 
         Q_INVOKABLE void removeArtist(int index, bool deleteFiles);
         Q_INVOKABLE void removeArtists(std::vector<int> indexes, bool deleteFiles);
@@ -71,15 +85,13 @@ namespace unplayer
         QHash<int, QByteArray> roleNames() const override;
 
     private:
-        void execQuery();
+        // Updates rows in place if update is true
+        void execQuery(bool update = false);
 
-        std::vector<Artist> mArtists;
         bool mSortDescending;
-
-        bool mRemovingFiles;
+        SectionsModel mSections;
     signals:
         void sortDescendingChanged();
-        void removingFilesChanged();
     };
 }
 
@@ -0,0 +1,250 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "asyncquerymodel.h"
+
+#include <QStringList>
+
+#include "fileutils.h"
+#include "sqlquery.h"
+#include "threadpools.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        int currentLibraryGeneration = 0;
+        bool libraryGenerationConnected = false;
+    }
+
+    bool AbstractAsyncQueryModel::isRemovingFiles() const
+    {
+        return mRemovingFiles;
+    }
+
+    int AbstractAsyncQueryModel::removingFilesProgress() const
+    {
+        return mRemovingFilesProgress;
+    }
+
+    AbstractAsyncQueryModel::AbstractAsyncQueryModel(QObject* parent)
+        : QAbstractListModel(parent),
+          mRemovingFiles(false),
+          mRemovingFilesProgress(0)
+    {
+        if (!libraryGenerationConnected) {
+            const auto increment = []() {
+                ++currentLibraryGeneration;
+            };
+            QObject::connect(LibraryUtils::instance(), &LibraryUtils::libraryChanged, increment);
+            QObject::connect(LibraryUtils::instance(), &LibraryUtils::databaseInitializedChanged, increment);
+            libraryGenerationConnected = true;
+        }
+    }
+
+    void AbstractAsyncQueryModel::setRemovingFiles(bool removing)
+    {
+        mRemovingFiles = removing;
+        setRemovingFilesProgress(0);
+        emit removingFilesChanged();
+    }
+
+    void AbstractAsyncQueryModel::setRemovingFilesProgress(int progress)
+    {
+        if (progress != mRemovingFilesProgress) {
+            mRemovingFilesProgress = progress;
+            emit removingFilesProgressChanged();
+        }
+    }
+
+    void AbstractAsyncQueryModel::finishRemovingFiles(int job)
+    {
+        JobManager::instance()->finish(job);
+        if (!JobManager::instance()->hasJobs(this, JobManager::Type::RemoveFiles)) {
+            setRemovingFiles(false);
+        }
+    }
+
+    int AbstractAsyncQueryModel::libraryGeneration()
+    {
+        return currentLibraryGeneration;
+    }
+
+    QString AbstractAsyncQueryModel::queryCacheKey(const QString& queryString, const QVariantList& bindValues)
+    {
+        QString key(queryString);
+        for (const QVariant& value : bindValues) {
+            key += QChar();
+            key += value.toString();
+        }
+        return key;
+    }
+
+    // Selects ids of tracks in temporary table and deletes them with one statement.
+    // Files are removed after transaction is committed so that database
+    // is not locked while they are removed
+    class AbstractAsyncQueryModel::RemoveTracksRunnable final : public QRunnable
+    {
+    public:
+        explicit RemoveTracksRunnable(const QString& tracksQuery, const std::vector<QVariantList>& keys, bool deleteFiles)
+            : mTracksQuery(tracksQuery),
+              mKeys(keys),
+              mDeleteFiles(deleteFiles)
+        {
+            mFutureInterface.reportStarted();
+        }
+
+        QFuture<bool> future()
+        {
+            return mFutureInterface.future();
+        }
+
+        void run() override
+        {
+            QStringList filePaths;
+            bool removed = false;
+
+            QSqlDatabase db(LibraryUtils::threadDatabase());
+            if (db.isOpen()) {
+                db.transaction();
+                removed = removeTracks(db, filePaths);
+                if (removed) {
+                    removed = db.commit();
+                    if (removed) {
+                        LibraryUtils::notifyLibraryChanged(mChanges);
+                    } else {
+                        qWarning() << "failed to commit transaction" << db.lastError();
+                    }
+                } else {
+                    db.rollback();
+                }
+            }
+
+            if (removed && !filePaths.isEmpty()) {
+                fileutils::removeFiles(filePaths, &mFutureInterface);
+            }
+
+            mFutureInterface.reportResult(removed);
+            mFutureInterface.reportFinished();
+        }
+
+    private:
+        bool removeTracks(const QSqlDatabase& db, QStringList& filePaths)
+        {
+            if (!LibraryUtils::insertQueryKeys(db, mKeys)) {
+                return false;
+            }
+
+            SqlQuery query(db);
+            if (!query.exec(QLatin1String("CREATE TEMP TABLE IF NOT EXISTS removed_tracks (id INTEGER PRIMARY KEY)")) ||
+                    !query.exec(QLatin1String("DELETE FROM removed_tracks"))) {
+                qWarning() << "failed to create removed tracks table" << query.lastError();
+                return false;
+            }
+
+            query.prepare(QString::fromLatin1("INSERT OR IGNORE INTO removed_tracks %1").arg(mTracksQuery));
+            LibraryUtils::explainQuery(query, db);
+            if (!query.exec()) {
+                qWarning() << "failed to select removed tracks" << query.lastError();
+                return false;
+            }
+
+            if (mDeleteFiles) {
+                SqlQuery selectQuery(db);
+                selectQuery.setForwardOnly(true);
+                if (!selectQuery.exec(QLatin1String("SELECT filePath FROM tracks WHERE id IN (SELECT id FROM removed_tracks)"))) {
+                    qWarning() << "failed to get files from database" << selectQuery.lastError();
+                    return false;
+                }
+                while (selectQuery.next()) {
+                    filePaths.push_back(selectQuery.value(0).toString());
+                }
+            }
+
+            mChanges = LibraryChanges::forTracks(db, QLatin1String("SELECT id FROM removed_tracks"));
+
+            if (!query.exec(QLatin1String("DELETE FROM tracks WHERE id IN (SELECT id FROM removed_tracks)"))) {
+                qWarning() << "failed to remove files from database" << query.lastError();
+                return false;
+            }
+
+            return LibraryUtils::updateSummaries(db);
+        }
+
+        QFutureInterface<bool> mFutureInterface;
+        const QString mTracksQuery;
+        const std::vector<QVariantList> mKeys;
+        const bool mDeleteFiles;
+        LibraryChanges mChanges;
+    };
+
+    QFuture<bool> AbstractAsyncQueryModel::startRemovingTracks(const QString& tracksQuery,
+                                                               const std::vector<QVariantList>& keys,
+                                                               bool deleteFiles)
+    {
+        auto runnable = new RemoveTracksRunnable(tracksQuery, keys, deleteFiles);
+        QFuture<bool> future(runnable->future());
+        threadpools::start(threadpools::JobClass::Bulk, runnable);
+        return future;
+    }
+
+    std::vector<LibraryTrack> AbstractAsyncQueryModel::queryTracks(const QSqlDatabase& db,
+                                                                   const std::vector<QVariantList>& keys,
+                                                                   const QString& keysJoin,
+                                                                   const QString& orderBy)
+    {
+        if (keys.empty()) {
+            return {};
+        }
+
+        std::vector<LibraryTrack> tracks;
+
+        QSqlDatabase database(db);
+        database.transaction();
+
+        if (!LibraryUtils::insertQueryKeys(db, keys)) {
+            database.rollback();
+            return tracks;
+        }
+
+        SqlQuery query(db);
+        query.setForwardOnly(true);
+        query.prepare(QString::fromLatin1("SELECT filePath, tracks.title AS title, artists.title AS artist, albums.title AS album, duration, mediaArt FROM query_keys "
+                                          "%1 "
+                                          "ORDER BY query_keys.position, %2").arg(keysJoin, orderBy));
+        LibraryUtils::explainQuery(query, db);
+        if (query.exec()) {
+            while (query.next()) {
+                tracks.push_back({query.value(0).toString(),
+                                  query.value(1).toString(),
+                                  query.value(2).toString(),
+                                  query.value(3).toString(),
+                                  query.value(4).toInt(),
+                                  query.value(5).toString()});
+            }
+        } else {
+            qWarning() << "failed to get tracks from database" << query.lastError();
+        }
+        query.finish();
+
+        // Keys are not needed after query
+        database.rollback();
+
+        return tracks;
+    }
+}
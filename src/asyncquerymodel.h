@@ -0,0 +1,631 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_ASYNCQUERYMODEL_H
+#define UNPLAYER_ASYNCQUERYMODEL_H
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <QAbstractListModel>
+#include <QDebug>
+#include <QFutureInterface>
+#include <QFutureWatcher>
+#include <QRunnable>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QVariantList>
+
+#include "jobmanager.h"
+#include "latestload.h"
+#include "librarychanges.h"
+#include "librarytrack.h"
+#include "libraryutils.h"
+#include "memorypressure.h"
+#include "sqlquery.h"
+#include "stdutils.h"
+#include "threadpools.h"
+#include "tracing.h"
+
+namespace unplayer
+{
+    // Non-template part of AsyncQueryModel
+    class AbstractAsyncQueryModel : public QAbstractListModel
+    {
+        Q_OBJECT
+        Q_PROPERTY(bool removingFiles READ isRemovingFiles NOTIFY removingFilesChanged)
+        Q_PROPERTY(int removingFilesProgress READ removingFilesProgress NOTIFY removingFilesProgressChanged)
+    public:
+        bool isRemovingFiles() const;
+        // Percentage of removed files
+        int removingFilesProgress() const;
+
+    protected:
+        explicit AbstractAsyncQueryModel(QObject* parent = nullptr);
+
+        void setRemovingFiles(bool removing);
+        void setRemovingFilesProgress(int progress);
+        // Finishes job of JobManager, removingFiles becomes false if there are no more of them
+        void finishRemovingFiles(int job);
+
+        // Returns true if rows of query could have changed
+        using LibraryChangesFilter = std::function<bool(const LibraryChanges& changes)>;
+
+        // Incremented when library database changes, results of
+        // queries that were running at that time are not cached
+        static int libraryGeneration();
+        static QString queryCacheKey(const QString& queryString, const QVariantList& bindValues);
+
+        // Removes tracks of several rows from database on worker thread, and their files
+        // if deleteFiles is true. Keys of rows are inserted in temporary table query_keys,
+        // tracksQuery selects ids of their tracks from it. Future reports progress
+        // of removing files, its result is true if tracks were removed from database
+        static QFuture<bool> startRemovingTracks(const QString& tracksQuery,
+                                                 const std::vector<QVariantList>& keys,
+                                                 bool deleteFiles);
+
+        // Returns tracks of several rows using one query. Bind values of rows are
+        // inserted in temporary table query_keys (columns position, key0 and key1),
+        // keysJoin joins it with tracks, artists and albums tables.
+        // Tracks are ordered by position of row and then by orderBy
+        static std::vector<LibraryTrack> queryTracks(const QSqlDatabase& db,
+                                                     const std::vector<QVariantList>& keys,
+                                                     const QString& keysJoin,
+                                                     const QString& orderBy);
+
+    private:
+        class RemoveTracksRunnable;
+
+        bool mRemovingFiles;
+        int mRemovingFilesProgress;
+
+    signals:
+        void removingFilesChanged();
+        void removingFilesProgressChanged();
+        // All rows of query are loaded
+        void queryFinished();
+    };
+
+    // Model which rows are loaded from library database on worker thread
+    template<typename Row>
+    class AsyncQueryModel : public AbstractAsyncQueryModel
+    {
+    public:
+        int rowCount(const QModelIndex& = QModelIndex()) const override
+        {
+            return mRows.size();
+        }
+
+    protected:
+        using RowFromQuery = Row (*)(const QSqlQuery& query);
+        using RowBindValues = QVariantList (*)(const Row& row);
+
+        explicit AsyncQueryModel(QObject* parent = nullptr)
+            : AbstractAsyncQueryModel(parent),
+              mQuery(this),
+              mSort(this)
+        {
+            static bool cacheConnected = false;
+            if (!cacheConnected) {
+                QObject::connect(LibraryUtils::instance(), &LibraryUtils::libraryChanged, &discardCachedRows);
+                // Queries that were made before database was opened returned nothing
+                QObject::connect(LibraryUtils::instance(), &LibraryUtils::databaseInitializedChanged, []() {
+                    queryCache().clear();
+                });
+                QObject::connect(MemoryPressure::instance(), &MemoryPressure::trimRequested, []() {
+                    queryCache().clear();
+                });
+                cacheConnected = true;
+            }
+        }
+
+        // Previous query is cancelled. Rows are added in batches,
+        // rows of previous query are replaced when first batch arrives.
+        // If updateRowKey is set and all rows are already loaded, they are kept
+        // until query finishes, and then only rows that were removed or added
+        // are removed and inserted, rows with the same key are updated in place.
+        // Cached rows are kept until library changes pass affectedBy,
+        // or until any change if it is not set
+        void execQuery(const QString& queryString,
+                       const QVariantList& bindValues,
+                       RowFromQuery rowFromQuery,
+                       RowBindValues updateRowKey = nullptr,
+                       const LibraryChangesFilter& affectedBy = nullptr)
+        {
+            mSort.cancel();
+
+            if (mQuery.isRunning() && !mUpdatingRows) {
+                // Rows are still loading
+                updateRowKey = nullptr;
+            }
+
+            // Pages that were already visited are shown from memory
+            const QString cacheKey(queryCacheKey(queryString, bindValues));
+            if (!updateRowKey && loadCachedRows(cacheKey)) {
+                emit queryFinished();
+                return;
+            }
+
+            const int libraryGeneration = AbstractAsyncQueryModel::libraryGeneration();
+
+            auto runnable = new QueryRunnable(queryString, bindValues, rowFromQuery);
+
+            using Watcher = QFutureWatcher<std::vector<Row>>;
+            auto watcher = new Watcher(this);
+            const int generation = mQuery.start(watcher);
+            mUpdatingRows = (updateRowKey != nullptr);
+            mResetOnNextBatch = !mUpdatingRows;
+            const auto updatedRows = std::make_shared<std::vector<Row>>();
+            QObject::connect(watcher, &Watcher::resultsReadyAt, this, [=](int beginIndex, int endIndex) {
+                for (int i = beginIndex; i < endIndex; ++i) {
+                    if (updateRowKey) {
+                        const std::vector<Row> rows(watcher->resultAt(i));
+                        updatedRows->insert(updatedRows->end(), rows.begin(), rows.end());
+                    } else {
+                        addRows(watcher->resultAt(i));
+                    }
+                }
+            });
+            QObject::connect(watcher, &Watcher::finished, this, [=]() {
+                if (updateRowKey) {
+                    if (!watcher->isCanceled()) {
+                        updateRows(std::move(*updatedRows), updateRowKey);
+                    }
+                } else if (mResetOnNextBatch) {
+                    // No rows
+                    addRows({});
+                }
+                if (!watcher->isCanceled()) {
+                    cacheRows(cacheKey, libraryGeneration, affectedBy);
+                }
+                mUpdatingRows = false;
+                mQuery.finish(generation);
+                watcher->deleteLater();
+                if (!watcher->isCanceled()) {
+                    emit queryFinished();
+                }
+            });
+            watcher->setFuture(runnable->future());
+
+            threadpools::start(threadpools::JobClass::Interactive, runnable);
+        }
+
+        // Shows rows that were not queried, e.g. saved on previous run,
+        // until execQuery() with updateRowKey replaces them
+        void setRows(std::vector<Row>&& rows)
+        {
+            mQuery.cancel();
+            mSort.cancel();
+            resetRows(std::move(rows));
+        }
+
+        // Removes tracks of rows from library in background.
+        // tracksQuery selects ids of tracks of rows from query_keys table,
+        // keys of row are returned by rowBindValues
+        void removeRows(const std::vector<int>& indexes, bool deleteFiles, const QString& tracksQuery, RowBindValues rowBindValues)
+        {
+            std::vector<QVariantList> keys;
+            keys.reserve(indexes.size());
+            for (int index : indexes) {
+                keys.push_back(rowBindValues(mRows[index]));
+            }
+
+            if (!isRemovingFiles()) {
+                setRemovingFiles(true);
+            }
+
+            // Rows may change while job is waiting, they are found by their keys when it starts
+            JobManager::instance()->add(this, JobManager::Type::RemoveFiles, threadpools::JobClass::Bulk, [=](int job) {
+                std::unordered_set<QString> rowKeys;
+                for (const QVariantList& key : keys) {
+                    rowKeys.insert(queryCacheKey(QString(), key));
+                }
+                std::vector<int> currentIndexes;
+                for (int i = 0, max = mRows.size(); i < max; ++i) {
+                    if (contains(rowKeys, queryCacheKey(QString(), rowBindValues(mRows[i])))) {
+                        currentIndexes.push_back(i);
+                    }
+                }
+
+                setRemovingFilesProgress(0);
+
+                using Watcher = QFutureWatcher<bool>;
+                auto watcher = new Watcher(this);
+                QObject::connect(watcher, &Watcher::progressValueChanged, this, [=](int value) {
+                    const int maximum = watcher->progressMaximum();
+                    setRemovingFilesProgress(maximum > 0 ? value * 100 / maximum : 0);
+                    JobManager::instance()->reportProgress(job, value, maximum);
+                });
+                QObject::connect(watcher, &Watcher::finished, this, [=]() {
+                    if (watcher->result()) {
+                        removeRowsFromModel(currentIndexes);
+                    }
+                    emit LibraryUtils::instance()->databaseChanged();
+                    watcher->deleteLater();
+                    finishRemovingFiles(job);
+                });
+                watcher->setFuture(startRemovingTracks(tracksQuery, keys, deleteFiles));
+            });
+        }
+
+        std::vector<LibraryTrack> tracksForRows(const std::vector<int>& indexes,
+                                                RowBindValues rowBindValues,
+                                                const QString& keysJoin,
+                                                const QString& orderBy) const
+        {
+            UNPLAYER_TRACE("AsyncQueryModel::tracksForRows");
+            std::vector<QVariantList> keys;
+            keys.reserve(indexes.size());
+            for (int index : indexes) {
+                keys.push_back(rowBindValues(mRows[index]));
+            }
+            return queryTracks(QSqlDatabase::database(), keys, keysJoin, orderBy);
+        }
+
+        // Rows can be reordered in memory only when all of them are loaded
+        bool canSortRows() const
+        {
+            return !mQuery.isRunning();
+        }
+
+        bool isSortingRows() const
+        {
+            return mSort.isRunning();
+        }
+
+        void reverseRows()
+        {
+            mSort.cancel();
+
+            emit layoutAboutToBeChanged();
+            const int last = mRows.size() - 1;
+            std::reverse(mRows.begin(), mRows.end());
+            changePersistentIndexes([last](int row) { return last - row; });
+            emit layoutChanged();
+        }
+
+        // Stable sort on worker thread, rows are reordered when it finishes
+        void sortRows(const std::function<bool(const Row&, const Row&)>& lessThan)
+        {
+            // FIXME: use init capture when moving to C++14
+            auto future = threadpools::run(threadpools::JobClass::Interactive, std::bind([lessThan](const std::vector<Row>& rows) {
+                std::vector<int> permutation(rows.size());
+                std::iota(permutation.begin(), permutation.end(), 0);
+                std::stable_sort(permutation.begin(), permutation.end(), [&](int first, int second) {
+                    return lessThan(rows[first], rows[second]);
+                });
+                return permutation;
+            }, mRows));
+
+            using Watcher = QFutureWatcher<std::vector<int>>;
+            auto watcher = new Watcher(this);
+            const int generation = mSort.start(watcher);
+            mSortLessThan = lessThan;
+            QObject::connect(watcher, &Watcher::finished, this, [=]() {
+                mSort.finish(generation);
+                applyPermutation(watcher->result());
+                watcher->deleteLater();
+            });
+            watcher->setFuture(future);
+        }
+
+        std::vector<Row> mRows;
+
+    private:
+        // First batch is small so that first screen of rows is shown quickly
+        static const size_t firstBatchSize = 100;
+        static const size_t batchSize = 2000;
+
+        class QueryRunnable final : public QRunnable
+        {
+        public:
+            explicit QueryRunnable(const QString& queryString, const QVariantList& bindValues, RowFromQuery rowFromQuery)
+                : mQueryString(queryString),
+                  mBindValues(bindValues),
+                  mRowFromQuery(rowFromQuery)
+            {
+                mFutureInterface.reportStarted();
+            }
+
+            QFuture<std::vector<Row>> future()
+            {
+                return mFutureInterface.future();
+            }
+
+            void run() override
+            {
+                if (!mFutureInterface.isCanceled()) {
+                    const QSqlDatabase db(LibraryUtils::readDatabase());
+                    if (db.isOpen()) {
+                        execQuery(db);
+                    }
+                }
+                mFutureInterface.reportFinished();
+            }
+
+        private:
+            void execQuery(const QSqlDatabase& db)
+            {
+                const tracing::Span span("model query");
+                span.setDetail(mQueryString);
+                SqlQuery query(db);
+                query.setForwardOnly(true);
+                query.prepareCached(mQueryString);
+                for (const QVariant& value : mBindValues) {
+                    query.addBindValue(value);
+                }
+                LibraryUtils::explainQuery(query, db);
+
+                if (!query.exec()) {
+                    qWarning() << query.lastError();
+                    return;
+                }
+
+                std::vector<Row> rows;
+                size_t size = firstBatchSize;
+                rows.reserve(size);
+                while (!mFutureInterface.isCanceled() && query.next()) {
+                    rows.push_back(mRowFromQuery(query));
+                    if (rows.size() == size) {
+                        mFutureInterface.reportResult(rows);
+                        rows.clear();
+                        size = batchSize;
+                        rows.reserve(size);
+                    }
+                }
+                if (!rows.empty() && !mFutureInterface.isCanceled()) {
+                    mFutureInterface.reportResult(rows);
+                }
+            }
+
+            QFutureInterface<std::vector<Row>> mFutureInterface;
+            const QString mQueryString;
+            const QVariantList mBindValues;
+            const RowFromQuery mRowFromQuery;
+        };
+
+        struct CachedRows
+        {
+            QString key;
+            std::vector<Row> rows;
+            LibraryChangesFilter affectedBy;
+        };
+
+        static const size_t queryCacheSize = 16;
+
+        // Results of recent queries shared by all models with the same row type,
+        // most recently used first. Accessed only from main thread
+        static std::list<CachedRows>& queryCache()
+        {
+            static std::list<CachedRows> cache;
+            return cache;
+        }
+
+        bool loadCachedRows(const QString& key)
+        {
+            std::list<CachedRows>& cache = queryCache();
+            for (auto i = cache.begin(), end = cache.end(); i != end; ++i) {
+                if (i->key == key) {
+                    cache.splice(cache.begin(), cache, i);
+
+                    mQuery.cancel();
+                    mResetOnNextBatch = false;
+                    beginResetModel();
+                    mRows = cache.front().rows;
+                    endResetModel();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void cacheRows(const QString& key, int generation, const LibraryChangesFilter& affectedBy)
+        {
+            std::list<CachedRows>& cache = queryCache();
+            for (auto i = cache.begin(), end = cache.end(); i != end; ++i) {
+                if (i->key == key) {
+                    cache.erase(i);
+                    break;
+                }
+            }
+            // Database has changed while query was running
+            if (generation != libraryGeneration()) {
+                return;
+            }
+            cache.push_front({key, mRows, affectedBy});
+            if (cache.size() > queryCacheSize) {
+                cache.pop_back();
+            }
+        }
+
+        static void discardCachedRows(const LibraryChanges& changes)
+        {
+            std::list<CachedRows>& cache = queryCache();
+            for (auto i = cache.begin(), end = cache.end(); i != end;) {
+                if (changes.all || !i->affectedBy || i->affectedBy(changes)) {
+                    i = cache.erase(i);
+                } else {
+                    ++i;
+                }
+            }
+        }
+
+        // Maps old rows of persistent indexes to new ones
+        void changePersistentIndexes(const std::function<int(int)>& newRow)
+        {
+            const QModelIndexList from(persistentIndexList());
+            QModelIndexList to;
+            to.reserve(from.size());
+            for (const QModelIndex& index : from) {
+                to.push_back(index.isValid() ? this->index(newRow(index.row()), index.column()) : index);
+            }
+            changePersistentIndexList(from, to);
+        }
+
+        // New row i is old row permutation[i]
+        void applyPermutation(const std::vector<int>& permutation)
+        {
+            if (permutation.size() != mRows.size()) {
+                return;
+            }
+
+            emit layoutAboutToBeChanged();
+            std::vector<Row> rows;
+            rows.reserve(mRows.size());
+            std::vector<int> newRows(permutation.size());
+            for (int i = 0, max = permutation.size(); i < max; ++i) {
+                rows.push_back(std::move(mRows[permutation[i]]));
+                newRows[permutation[i]] = i;
+            }
+            mRows = std::move(rows);
+            changePersistentIndexes([&](int row) { return newRows[row]; });
+            emit layoutChanged();
+        }
+
+        // Removes contiguous ranges of rows at once
+        void removeRowsFromModel(std::vector<int> indexes)
+        {
+            // Permutation of sort in progress doesn't match rows anymore
+            const bool sorting = mSort.isRunning();
+            mSort.cancel();
+
+            std::sort(indexes.begin(), indexes.end(), std::greater<int>());
+            indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+            for (auto i = indexes.begin(), end = indexes.end(); i != end;) {
+                const int last = *i;
+                int first = last;
+                for (++i; i != end && *i == first - 1; ++i) {
+                    first = *i;
+                }
+                beginRemoveRows(QModelIndex(), first, last);
+                mRows.erase(mRows.begin() + first, mRows.begin() + last + 1);
+                endRemoveRows();
+            }
+
+            if (sorting) {
+                sortRows(mSortLessThan);
+            }
+        }
+
+        // Applies difference between current rows and rows of new query.
+        // Model is reset if order of rows that are kept has changed
+        void updateRows(std::vector<Row>&& rows, RowBindValues rowKey)
+        {
+            const auto keyOf = [&](const Row& row) {
+                return queryCacheKey(QString(), rowKey(row));
+            };
+
+            std::unordered_map<QString, int> newIndexes;
+            newIndexes.reserve(rows.size());
+            for (int i = 0, max = rows.size(); i < max; ++i) {
+                if (!newIndexes.emplace(keyOf(rows[i]), i).second) {
+                    resetRows(std::move(rows));
+                    return;
+                }
+            }
+
+            std::vector<int> removed;
+            // New indexes of kept rows, in current order
+            std::vector<int> kept;
+            for (int i = 0, max = mRows.size(); i < max; ++i) {
+                const auto found(newIndexes.find(keyOf(mRows[i])));
+                if (found == newIndexes.end()) {
+                    removed.push_back(i);
+                } else {
+                    kept.push_back(found->second);
+                }
+            }
+            if (std::adjacent_find(kept.begin(), kept.end(), std::greater_equal<int>()) != kept.end()) {
+                resetRows(std::move(rows));
+                return;
+            }
+
+            if (!removed.empty()) {
+                removeRowsFromModel(std::move(removed));
+            }
+
+            std::size_t nextKept = 0;
+            const auto isKept = [&](std::size_t index) {
+                return nextKept < kept.size() && kept[nextKept] == static_cast<int>(index);
+            };
+            int row = 0;
+            for (std::size_t i = 0, size = rows.size(); i < size;) {
+                if (isKept(i)) {
+                    mRows[row] = std::move(rows[i]);
+                    ++row;
+                    ++nextKept;
+                    ++i;
+                    continue;
+                }
+
+                std::size_t end = i + 1;
+                while (end < size && !isKept(end)) {
+                    ++end;
+                }
+                const int count = end - i;
+                beginInsertRows(QModelIndex(), row, row + count - 1);
+                mRows.insert(mRows.begin() + row, std::make_move_iterator(rows.begin() + i), std::make_move_iterator(rows.begin() + end));
+                endInsertRows();
+                row += count;
+                i = end;
+            }
+
+            if (!mRows.empty()) {
+                emit dataChanged(index(0), index(mRows.size() - 1));
+            }
+        }
+
+        void resetRows(std::vector<Row>&& rows)
+        {
+            beginResetModel();
+            mRows = std::move(rows);
+            endResetModel();
+        }
+
+        void addRows(std::vector<Row>&& rows)
+        {
+            if (mResetOnNextBatch) {
+                resetRows(std::move(rows));
+                mResetOnNextBatch = false;
+            } else if (!rows.empty()) {
+                const int first = mRows.size();
+                beginInsertRows(QModelIndex(), first, first + rows.size() - 1);
+                mRows.insert(mRows.end(), std::make_move_iterator(rows.begin()), std::make_move_iterator(rows.end()));
+                endInsertRows();
+            }
+        }
+
+        LatestLoad mQuery;
+        LatestLoad mSort;
+        std::function<bool(const Row&, const Row&)> mSortLessThan;
+        bool mResetOnNextBatch = false;
+        // Current query updates rows that are already loaded
+        bool mUpdatingRows = false;
+    };
+}
+
+#endif // UNPLAYER_ASYNCQUERYMODEL_H
@@ -0,0 +1,60 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_BATCHESRUNNABLE_H
+#define UNPLAYER_BATCHESRUNNABLE_H
+
+#include <functional>
+
+#include <QFuture>
+#include <QFutureInterface>
+#include <QRunnable>
+
+namespace unplayer
+{
+    // Runs function that reports batches of results through future interface,
+    // so that they can be shown before the whole job is finished.
+    // Future is started on construction and finished after function returns
+    template<typename Batch>
+    class BatchesRunnable final : public QRunnable
+    {
+    public:
+        explicit BatchesRunnable(const std::function<void(QFutureInterface<Batch>&)>& function)
+            : mFunction(function)
+        {
+            mFutureInterface.reportStarted();
+        }
+
+        QFuture<Batch> future()
+        {
+            return mFutureInterface.future();
+        }
+
+        void run() override
+        {
+            mFunction(mFutureInterface);
+            mFutureInterface.reportFinished();
+        }
+
+    private:
+        QFutureInterface<Batch> mFutureInterface;
+        const std::function<void(QFutureInterface<Batch>&)> mFunction;
+    };
+}
+
+#endif // UNPLAYER_BATCHESRUNNABLE_H
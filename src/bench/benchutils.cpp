@@ -0,0 +1,261 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchutils.h"
+
+#include <algorithm>
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QSqlError>
+
+#include "libraryutils.h"
+
+namespace unplayer
+{
+    namespace bench
+    {
+        double elapsedMs(const QElapsedTimer& timer)
+        {
+            return timer.nsecsElapsed() / 1000000.0;
+        }
+
+        void resetLocations(std::initializer_list<QStandardPaths::StandardLocation> locations)
+        {
+            for (const QStandardPaths::StandardLocation location : locations) {
+                QDir(QStandardPaths::writableLocation(location)).removeRecursively();
+            }
+        }
+
+        bool waitForDatabase()
+        {
+            LibraryUtils* libraryUtils = LibraryUtils::instance();
+            if (!libraryUtils->isDatabaseInitialized()) {
+                QEventLoop loop;
+                QObject::connect(libraryUtils, &LibraryUtils::databaseInitializedChanged, &loop, &QEventLoop::quit);
+                loop.exec();
+            }
+            if (!libraryUtils->isDatabaseInitialized()) {
+                qWarning() << "failed to initialize database";
+                return false;
+            }
+            return true;
+        }
+
+        QString word(int number, int syllables)
+        {
+            static const char* const parts[] = {"ka", "lo", "mi", "ra", "su", "te", "no", "vi",
+                                                "da", "pe", "zo", "ri", "ba", "ne", "shu", "ya"};
+            quint32 hash = static_cast<quint32>(number) * 2654435761u;
+            QString string;
+            for (int i = 0; i < syllables; ++i) {
+                string.push_back(QLatin1String(parts[hash & 15]));
+                hash >>= 4;
+            }
+            string[0] = string[0].toUpper();
+            return string;
+        }
+
+        QString artistTitle(int artist)
+        {
+            return QString::fromLatin1("%1 %2").arg(word(artist, 3)).arg(artist);
+        }
+
+        QString albumTitle(int album)
+        {
+            return QString::fromLatin1("%1 %2").arg(word(album + 1000003, 3)).arg(album);
+        }
+
+        QString genreTitle(int genre)
+        {
+            return QString::fromLatin1("%1 %2").arg(word(genre + 2000003, 2)).arg(genre);
+        }
+
+        bool exec(QSqlQuery& query, const QVariantList& values)
+        {
+            for (int i = 0, max = values.size(); i < max; ++i) {
+                query.bindValue(i, values[i]);
+            }
+            if (!query.exec()) {
+                qWarning() << "failed to insert" << query.lastError();
+                return false;
+            }
+            return true;
+        }
+
+        double percentile(const std::vector<double>& samples, int p)
+        {
+            if (samples.empty()) {
+                return 0.0;
+            }
+            return samples[std::min(samples.size() - 1, samples.size() * p / 100)];
+        }
+
+        QJsonObject percentiles(std::vector<double> samples)
+        {
+            if (samples.empty()) {
+                return {{QLatin1String("count"), 0}};
+            }
+            std::sort(samples.begin(), samples.end());
+            return {{QLatin1String("count"), static_cast<int>(samples.size())},
+                    {QLatin1String("min"), samples.front()},
+                    {QLatin1String("p50"), percentile(samples, 50)},
+                    {QLatin1String("p90"), percentile(samples, 90)},
+                    {QLatin1String("p95"), percentile(samples, 95)},
+                    {QLatin1String("p99"), percentile(samples, 99)},
+                    {QLatin1String("max"), samples.back()}};
+        }
+
+        bool createTrackFiles(const QString& directory, int first, int last, QStringList& files)
+        {
+            files.reserve(files.size() + last - first);
+            for (int i = first; i < last; ++i) {
+                const QString subdirectory(QString::fromLatin1("%1/%2").arg(directory).arg(i / filesPerDirectory));
+                if ((i == first || i % filesPerDirectory == 0) && !QDir().mkpath(subdirectory)) {
+                    qWarning() << "failed to create directory" << subdirectory;
+                    return false;
+                }
+                const QString filePath(QString::fromLatin1("%1/%2 %3.flac").arg(subdirectory).arg(word(i, 3)).arg(i));
+                QFile file(filePath);
+                if (!file.open(QIODevice::WriteOnly)) {
+                    qWarning() << "failed to create file" << filePath << file.errorString();
+                    return false;
+                }
+                files.push_back(filePath);
+            }
+            return true;
+        }
+
+        SyntheticTrack::SyntheticTrack(int index)
+            : id(index + 1),
+              modificationTime(0),
+              title(QString::fromLatin1("%1 %2").arg(word(index, 4)).arg(index)),
+              album(index / tracksPerAlbum),
+              genre(album % genresCount),
+              year(1970 + album % 50),
+              trackNumber(index % tracksPerAlbum + 1),
+              duration(120 + index % 300),
+              mediaArt(QLatin1String(""))
+        {
+            artist = album / albumsPerArtist;
+            discNumber = (album % 4 == 0 && trackNumber > tracksPerAlbum / 2) ? QLatin1String("2") : QLatin1String("1");
+            filePath = QString::fromLatin1("/synthetic/%1/%2/%3.flac").arg(artist).arg(album).arg(index);
+        }
+
+        TracksInserter::TracksInserter(const QSqlDatabase& db)
+            : mDb(db),
+              mOk(mDb.transaction()),
+              mArtistQuery(mDb),
+              mAlbumQuery(mDb),
+              mGenreQuery(mDb),
+              mTrackQuery(mDb),
+              mTrackArtistQuery(mDb),
+              mTrackAlbumQuery(mDb),
+              mTrackGenreQuery(mDb)
+        {
+            if (!mOk) {
+                qWarning() << "failed to begin transaction" << mDb.lastError();
+                return;
+            }
+            mArtistQuery.prepare(QStringLiteral("INSERT OR IGNORE INTO artists (id, title, sortKey) VALUES (?, ?, ?)"));
+            mAlbumQuery.prepare(QStringLiteral("INSERT OR IGNORE INTO albums (id, title, sortKey) VALUES (?, ?, ?)"));
+            mGenreQuery.prepare(QStringLiteral("INSERT OR IGNORE INTO genres (id, title) VALUES (?, ?)"));
+            mTrackQuery.prepare(QStringLiteral("INSERT INTO tracks (id, filePath, modificationTime, title, year, trackNumber, discNumber, "
+                                               "duration, mediaArt, embeddedMediaArtHash, titleSortKey, discNumberSortKey) "
+                                               "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, NULL, ?, ?)"));
+            mTrackArtistQuery.prepare(QStringLiteral("INSERT INTO tracks_artists (trackId, artistId) VALUES (?, ?)"));
+            mTrackAlbumQuery.prepare(QStringLiteral("INSERT INTO tracks_albums (trackId, albumId) VALUES (?, ?)"));
+            mTrackGenreQuery.prepare(QStringLiteral("INSERT INTO tracks_genres (trackId, genreId) VALUES (?, ?)"));
+        }
+
+        bool TracksInserter::add(const SyntheticTrack& track)
+        {
+            mOk = mOk &&
+                  exec(mTrackQuery, {track.id,
+                                     track.filePath,
+                                     track.modificationTime,
+                                     track.title,
+                                     track.year,
+                                     track.trackNumber,
+                                     track.discNumber,
+                                     track.duration,
+                                     track.mediaArt,
+                                     LibraryUtils::sortKey(track.title),
+                                     LibraryUtils::sortKey(track.discNumber)});
+            if (mOk && track.artist != -1) {
+                mOk = addArtist(track.id, track.artist);
+            }
+            if (mOk && track.album != -1) {
+                if (mAlbums.insert(track.album).second) {
+                    const QString title(albumTitle(track.album));
+                    mOk = exec(mAlbumQuery, {track.album + 1, title, LibraryUtils::sortKey(title)});
+                }
+                mOk = mOk && exec(mTrackAlbumQuery, {track.id, track.album + 1});
+            }
+            if (mOk && track.genre != -1) {
+                mOk = addGenre(track.id, track.genre);
+            }
+            return mOk;
+        }
+
+        bool TracksInserter::addArtist(int trackId, int artist)
+        {
+            mOk = mOk && insertArtist(artist) && exec(mTrackArtistQuery, {trackId, artist + 1});
+            return mOk;
+        }
+
+        bool TracksInserter::addGenre(int trackId, int genre)
+        {
+            mOk = mOk && insertGenre(genre) && exec(mTrackGenreQuery, {trackId, genre + 1});
+            return mOk;
+        }
+
+        bool TracksInserter::finish(bool ok)
+        {
+            if (!ok || !mOk || !LibraryUtils::updateSummaries(mDb)) {
+                mDb.rollback();
+                return false;
+            }
+            if (!mDb.commit()) {
+                qWarning() << "failed to commit transaction" << mDb.lastError();
+                return false;
+            }
+            return true;
+        }
+
+        bool TracksInserter::insertArtist(int artist)
+        {
+            if (!mArtists.insert(artist).second) {
+                return true;
+            }
+            const QString title(artistTitle(artist));
+            return exec(mArtistQuery, {artist + 1, title, LibraryUtils::sortKey(title)});
+        }
+
+        bool TracksInserter::insertGenre(int genre)
+        {
+            if (!mGenres.insert(genre).second) {
+                return true;
+            }
+            return exec(mGenreQuery, {genre + 1, genreTitle(genre)});
+        }
+    }
+}
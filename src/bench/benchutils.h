@@ -0,0 +1,134 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_BENCH_BENCHUTILS_H
+#define UNPLAYER_BENCH_BENCHUTILS_H
+
+#include <initializer_list>
+#include <unordered_set>
+#include <vector>
+
+#include <QJsonObject>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QStandardPaths>
+#include <QString>
+#include <QStringList>
+#include <QVariantList>
+
+class QElapsedTimer;
+
+namespace unplayer
+{
+    // Helpers shared by benchmarks that fill library database with synthetic tracks
+    namespace bench
+    {
+        const int tracksPerAlbum = 10;
+        const int albumsPerArtist = 5;
+        const int genresCount = 50;
+        const int filesPerDirectory = 1000;
+
+        double elapsedMs(const QElapsedTimer& timer);
+
+        // Removes data of the app, so that benchmark starts with empty database
+        void resetLocations(std::initializer_list<QStandardPaths::StandardLocation> locations = {QStandardPaths::DataLocation,
+                                                                                                QStandardPaths::CacheLocation});
+        // Waits until LibraryUtils initializes database. Returns false on error
+        bool waitForDatabase();
+
+        // Pseudo words so that sort order of titles doesn't follow their ids
+        QString word(int number, int syllables);
+
+        QString artistTitle(int artist);
+        QString albumTitle(int album);
+        QString genreTitle(int genre);
+
+        // Binds values by position and executes query
+        bool exec(QSqlQuery& query, const QVariantList& values);
+
+        // Percentile p of samples sorted in ascending order, 0 if there are no samples
+        double percentile(const std::vector<double>& samples, int p);
+
+        // Count of samples, their minimum, maximum and percentiles
+        QJsonObject percentiles(std::vector<double> samples);
+
+        // Creates empty files of tracks in range [first, last) in subdirectories of directory.
+        // Names of files start with pseudo words so that their order doesn't follow indexes
+        bool createTrackFiles(const QString& directory, int first, int last, QStringList& files);
+
+        // Metadata of synthetic track which depends only on its index.
+        // Artist, album and genre are indexes, -1 if track doesn't have one
+        struct SyntheticTrack
+        {
+            explicit SyntheticTrack(int index);
+
+            int id;
+            QString filePath;
+            long long modificationTime;
+            QString title;
+            int artist;
+            int album;
+            int genre;
+            int year;
+            int trackNumber;
+            QString discNumber;
+            int duration;
+            QString mediaArt;
+        };
+
+        // Adds tracks with their artists, albums and genres to library in one transaction
+        class TracksInserter final
+        {
+        public:
+            // Begins transaction
+            explicit TracksInserter(const QSqlDatabase& db);
+            TracksInserter(const TracksInserter&) = delete;
+            TracksInserter& operator=(const TracksInserter&) = delete;
+
+            bool add(const SyntheticTrack& track);
+            // Featured artist or second genre
+            bool addArtist(int trackId, int artist);
+            bool addGenre(int trackId, int genre);
+
+            // Updates summaries and commits transaction, or rolls it back if ok is false
+            // or any track was not added. Returns false on error
+            bool finish(bool ok = true);
+
+        private:
+            bool insertArtist(int artist);
+            bool insertGenre(int genre);
+
+            QSqlDatabase mDb;
+            bool mOk;
+
+            std::unordered_set<int> mArtists;
+            std::unordered_set<int> mAlbums;
+            std::unordered_set<int> mGenres;
+
+            QSqlQuery mArtistQuery;
+            QSqlQuery mAlbumQuery;
+            QSqlQuery mGenreQuery;
+            QSqlQuery mTrackQuery;
+            QSqlQuery mTrackArtistQuery;
+            QSqlQuery mTrackAlbumQuery;
+            QSqlQuery mTrackGenreQuery;
+        };
+    }
+}
+
+#endif // UNPLAYER_BENCH_BENCHUTILS_H
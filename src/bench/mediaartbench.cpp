@@ -0,0 +1,426 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <map>
+#include <vector>
+
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QGuiApplication>
+#include <QImage>
+#include <QImageReader>
+#include <QPainter>
+#include <QSqlDatabase>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include <QtConcurrentRun>
+#include <QtTest>
+
+#include "artimageprovider.h"
+#include "benchutils.h"
+#include "directorymediaartcache.h"
+#include "libraryupdater.h"
+#include "libraryutils.h"
+#include "thumbnailatlas.h"
+#include "utils.h"
+
+using namespace unplayer;
+
+// Media art path from extraction of embedded pictures to images shown in list views:
+// hashing and deduplication of pictures, lookup of directory covers, thumbnails
+// creation, scaled decoding and image provider under concurrent requests
+
+namespace
+{
+    const int thumbnailSize = 256;
+    const int imagesPerResolution = 16;
+
+    // Noise makes JPEG size close to the one of a photo with the same resolution
+    QByteArray createPicture(int resolution, int seed)
+    {
+        QImage image(resolution, resolution, QImage::Format_RGB32);
+        quint32 state = static_cast<quint32>(seed) * 2654435761u + 1;
+        for (int y = 0; y < resolution; ++y) {
+            auto line = reinterpret_cast<QRgb*>(image.scanLine(y));
+            for (int x = 0; x < resolution; ++x) {
+                state = state * 1664525u + 1013904223u;
+                line[x] = qRgb((x + seed * 13) & 0xff, (y + seed * 7) & 0xff, state >> 24);
+            }
+        }
+        QByteArray data;
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "JPEG", 90);
+        return data;
+    }
+}
+
+class MediaArtBenchmark final : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void embeddedMediaArtHash_data();
+    void embeddedMediaArtHash();
+    void embeddedMediaArtHashRecent_data();
+    void embeddedMediaArtHashRecent();
+    void saveEmbeddedMediaArt_data();
+    void saveEmbeddedMediaArt();
+    void findMediaArtForDirectory_data();
+    void findMediaArtForDirectory();
+    void findMediaArtForDirectoryCached_data();
+    void findMediaArtForDirectoryCached();
+    void addThumbnail_data();
+    void addThumbnail();
+    void scaledDecode_data();
+    void scaledDecode();
+    void providerConcurrent_data();
+    void providerConcurrent();
+
+private:
+    void addResolutions();
+    QString mediaArtDirectory() const;
+    // Image files of resolution, created once
+    const QStringList& files(int resolution);
+
+    QTemporaryDir mDirectory;
+    std::map<int, QStringList> mFiles;
+    std::map<int, QStringList> mThumbnails;
+};
+
+void MediaArtBenchmark::initTestCase()
+{
+    QVERIFY(mDirectory.isValid());
+
+    bench::resetLocations();
+    QVERIFY(bench::waitForDatabase());
+    QVERIFY(QDir().mkpath(mediaArtDirectory()));
+}
+
+void MediaArtBenchmark::embeddedMediaArtHash_data()
+{
+    addResolutions();
+}
+
+void MediaArtBenchmark::embeddedMediaArtHash()
+{
+    QFETCH(int, resolution);
+    std::vector<QByteArray> pictures;
+    for (int i = 0; i < imagesPerResolution; ++i) {
+        pictures.push_back(createPicture(resolution, i));
+    }
+    // Every picture is new, so it is hashed
+    int seed = 0;
+    QBENCHMARK {
+        MediaArtCache cache(mediaArtDirectory());
+        for (const QByteArray& picture : pictures) {
+            QByteArray data(picture);
+            // Last byte differs, so that picture is not found among recent ones
+            data[data.size() - 1] = static_cast<char>(++seed);
+            cache.embeddedMediaArtHash(data);
+        }
+    }
+}
+
+void MediaArtBenchmark::embeddedMediaArtHashRecent_data()
+{
+    addResolutions();
+}
+
+void MediaArtBenchmark::embeddedMediaArtHashRecent()
+{
+    QFETCH(int, resolution);
+    // Tracks of album with the same picture, only first of them is hashed
+    const QByteArray picture(createPicture(resolution, 0));
+    MediaArtCache cache(mediaArtDirectory());
+    cache.embeddedMediaArtHash(picture);
+    QBENCHMARK {
+        for (int i = 0; i < imagesPerResolution; ++i) {
+            const QByteArray copy(picture.constData(), picture.size());
+            cache.embeddedMediaArtHash(copy);
+        }
+    }
+}
+
+void MediaArtBenchmark::saveEmbeddedMediaArt_data()
+{
+    QTest::addColumn<int>("resolution");
+    QTest::addColumn<bool>("duplicate");
+    for (const int resolution : {300, 1000, 3000}) {
+        QTest::newRow(qPrintable(QString::fromLatin1("%1px").arg(resolution))) << resolution << false;
+        QTest::newRow(qPrintable(QString::fromLatin1("%1px duplicate").arg(resolution))) << resolution << true;
+    }
+}
+
+void MediaArtBenchmark::saveEmbeddedMediaArt()
+{
+    QFETCH(int, resolution);
+    QFETCH(bool, duplicate);
+    std::vector<QByteArray> pictures;
+    for (int i = 0; i < imagesPerResolution; ++i) {
+        pictures.push_back(createPicture(resolution, i));
+    }
+
+    MediaArtCache cache(mediaArtDirectory());
+    if (duplicate) {
+        // Files exist already and are found by hash
+        for (const QByteArray& picture : pictures) {
+            cache.saveEmbeddedMediaArt(picture, cache.embeddedMediaArtHash(picture));
+        }
+    }
+
+    // Includes downscaling of pictures larger than maximum resolution
+    QBENCHMARK_ONCE {
+        for (const QByteArray& picture : pictures) {
+            QVERIFY(!cache.saveEmbeddedMediaArt(picture, cache.embeddedMediaArtHash(picture)).isEmpty());
+        }
+    }
+
+    for (const QString& filePath : cache.takeSavedFiles()) {
+        QFile::remove(filePath);
+    }
+}
+
+void MediaArtBenchmark::findMediaArtForDirectory_data()
+{
+    QTest::addColumn<int>("files");
+    QTest::newRow("10 files") << 10;
+    QTest::newRow("100 files") << 100;
+    QTest::newRow("1000 files") << 1000;
+    QTest::newRow("5000 files") << 5000;
+}
+
+void MediaArtBenchmark::findMediaArtForDirectory()
+{
+    QFETCH(int, files);
+    const QString directory(QString::fromLatin1("%1/directory-%2").arg(mDirectory.path()).arg(files));
+    if (!QFileInfo::exists(directory)) {
+        QVERIFY(QDir().mkpath(directory));
+        for (int i = 0; i < files; ++i) {
+            QFile file(QString::fromLatin1("%1/%2.flac").arg(directory).arg(i));
+            QVERIFY(file.open(QIODevice::WriteOnly));
+        }
+        QFile cover(directory + QLatin1String("/folder.jpg"));
+        QVERIFY(cover.open(QIODevice::WriteOnly));
+        QVERIFY(cover.write(createPicture(300, 0)) > 0);
+    }
+
+    // Directory is listed every time
+    QBENCHMARK {
+        DirectoryMediaArtCache::instance().clear();
+        QVERIFY(!LibraryUtils::findMediaArtForDirectory(directory).isEmpty());
+    }
+}
+
+void MediaArtBenchmark::findMediaArtForDirectoryCached_data()
+{
+    findMediaArtForDirectory_data();
+}
+
+void MediaArtBenchmark::findMediaArtForDirectoryCached()
+{
+    QFETCH(int, files);
+    const QString directory(QString::fromLatin1("%1/directory-%2").arg(mDirectory.path()).arg(files));
+    QVERIFY(QFileInfo::exists(directory));
+    LibraryUtils::findMediaArtForDirectory(directory);
+
+    // Only modification time of directory is checked
+    QBENCHMARK {
+        QVERIFY(!LibraryUtils::findMediaArtForDirectory(directory).isEmpty());
+    }
+}
+
+void MediaArtBenchmark::addThumbnail_data()
+{
+    addResolutions();
+}
+
+void MediaArtBenchmark::addThumbnail()
+{
+    QFETCH(int, resolution);
+    const QStringList& images = files(resolution);
+
+    QSqlDatabase db(QSqlDatabase::database());
+    QVERIFY(db.transaction());
+    QStringList thumbnails;
+    {
+        ThumbnailAtlasWriter atlas(mediaArtDirectory(), db);
+        // Each image is decoded, scaled, encoded and appended to atlas
+        QBENCHMARK_ONCE {
+            for (const QString& image : images) {
+                const QString thumbnail(LibraryUpdater::addThumbnail(atlas, image, thumbnailSize));
+                QVERIFY(!thumbnail.isEmpty());
+                thumbnails.push_back(thumbnail);
+            }
+        }
+    }
+    QVERIFY(db.commit());
+    mThumbnails[resolution] = thumbnails;
+}
+
+void MediaArtBenchmark::scaledDecode_data()
+{
+    QTest::addColumn<int>("resolution");
+    QTest::addColumn<int>("size");
+    for (const int resolution : {300, 1000, 3000}) {
+        for (const int size : {128, 256, 0}) {
+            QTest::newRow(qPrintable(QString::fromLatin1("%1px to %2").arg(resolution).arg(size ? QString::number(size) : QString::fromLatin1("full")))) << resolution << size;
+        }
+    }
+}
+
+void MediaArtBenchmark::scaledDecode()
+{
+    QFETCH(int, resolution);
+    QFETCH(int, size);
+    const QStringList& images = files(resolution);
+
+    QBENCHMARK {
+        for (const QString& image : images) {
+            QImageReader reader(image);
+            const QSize imageSize(reader.size());
+            QSize scaledSize(imageSize);
+            if (size > 0) {
+                scaledSize.scale(size, size, Qt::KeepAspectRatio);
+            }
+            QVERIFY(!Utils::readScaledImage(reader, imageSize, scaledSize).isNull());
+        }
+    }
+}
+
+void MediaArtBenchmark::providerConcurrent_data()
+{
+    QTest::addColumn<bool>("thumbnails");
+    QTest::addColumn<int>("threads");
+    QTest::addColumn<bool>("shared");
+    for (const bool thumbnails : {false, true}) {
+        for (const int threads : {1, 4, 8}) {
+            for (const bool shared : {false, true}) {
+                if (threads == 1 && shared) {
+                    continue;
+                }
+                QTest::newRow(qPrintable(QString::fromLatin1("%1, %2 threads%3")
+                                         .arg(thumbnails ? QLatin1String("thumbnails") : QLatin1String("files"))
+                                         .arg(threads)
+                                         .arg(shared ? QLatin1String(", same images") : QLatin1String(""))))
+                    << thumbnails << threads << shared;
+            }
+        }
+    }
+}
+
+void MediaArtBenchmark::providerConcurrent()
+{
+    QFETCH(bool, thumbnails);
+    QFETCH(int, threads);
+    QFETCH(bool, shared);
+
+    QStringList urls;
+    if (thumbnails) {
+        for (const auto& resolutionThumbnails : mThumbnails) {
+            urls.append(resolutionThumbnails.second);
+        }
+        if (urls.isEmpty()) {
+            QSKIP("addThumbnail benchmark should run first");
+        }
+    } else {
+        for (const int resolution : {300, 1000, 3000}) {
+            for (const QString& image : files(resolution)) {
+                urls.push_back(ArtImageProvider::url(image));
+            }
+        }
+    }
+    const QLatin1String prefix("image://art/");
+    QStringList ids;
+    for (const QString& url : urls) {
+        ids.push_back(url.mid(prefix.size()));
+    }
+
+    ArtImageProvider provider(mediaArtDirectory());
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    const QSize requestedSize(thumbnailSize, thumbnailSize);
+
+    // Cache is dropped so that every image is decoded. Without shared images each thread
+    // requests its own part of them, with them all threads request all images
+    QBENCHMARK {
+        provider.trimCache(MemoryPressure::Level::Critical);
+        std::vector<QFuture<void>> futures;
+        for (int thread = 0; thread < threads; ++thread) {
+            futures.push_back(QtConcurrent::run(&pool, [&, thread]() {
+                for (int i = shared ? 0 : thread, max = ids.size(); i < max; i += shared ? 1 : threads) {
+                    provider.image(ids[i], requestedSize);
+                }
+            }));
+        }
+        for (QFuture<void>& future : futures) {
+            future.waitForFinished();
+        }
+    }
+
+    const ArtImageProvider::CacheStatistics statistics(provider.cacheStatistics());
+    qDebug() << "hits" << statistics.hits << "misses" << statistics.misses << "shared" << statistics.shared;
+}
+
+void MediaArtBenchmark::addResolutions()
+{
+    QTest::addColumn<int>("resolution");
+    QTest::newRow("300px") << 300;
+    QTest::newRow("1000px") << 1000;
+    QTest::newRow("3000px") << 3000;
+}
+
+QString MediaArtBenchmark::mediaArtDirectory() const
+{
+    return LibraryUtils::instance()->mediaArtDirectory();
+}
+
+const QStringList& MediaArtBenchmark::files(int resolution)
+{
+    QStringList& resolutionFiles = mFiles[resolution];
+    if (resolutionFiles.isEmpty()) {
+        for (int i = 0; i < imagesPerResolution; ++i) {
+            const QString filePath(QString::fromLatin1("%1/%2-%3.jpg").arg(mDirectory.path()).arg(resolution).arg(i));
+            QFile file(filePath);
+            if (file.open(QIODevice::WriteOnly)) {
+                file.write(createPicture(resolution, i));
+                resolutionFiles.push_back(filePath);
+            }
+        }
+    }
+    return resolutionFiles;
+}
+
+int main(int argc, char* argv[])
+{
+    // Database and media art are kept apart from the ones of the app
+    QStandardPaths::setTestMode(true);
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication app(argc, argv);
+    MediaArtBenchmark benchmark;
+    return QTest::qExec(&benchmark, argc, argv);
+}
+
+#include "mediaartbench.moc"
@@ -0,0 +1,127 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <unordered_map>
+#include <vector>
+
+#include <QFileInfo>
+#include <QMimeDatabase>
+#include <QtTest>
+
+#include "libraryutils.h"
+#include "stdutils.h"
+
+using namespace unplayer;
+
+// Classification of audio files by their suffixes, which is done for every file
+// found by library scan and for every file added to queue. MIME names path is how
+// files were classified before: lowercase suffix QString looked up in hash table,
+// then MIME name looked up in set of supported types and converted to MimeType.
+// Files are not created, since suffixes that are measured are trusted without
+// reading file contents
+
+namespace
+{
+    const int filesCount = 100000;
+
+    bool isAudioByMimeName(const QFileInfo& fileInfo)
+    {
+        static const std::unordered_map<QString, QString> types{
+            {QLatin1String("flac"), QLatin1String("audio/flac")},
+
+            {QLatin1String("m4a"), QLatin1String("audio/mp4")},
+            {QLatin1String("f4a"), QLatin1String("audio/mp4")},
+            {QLatin1String("m4b"), QLatin1String("audio/x-m4b")},
+            {QLatin1String("f4b"), QLatin1String("audio/x-m4b")},
+
+            {QLatin1String("mp3"), QLatin1String("audio/mpeg")},
+            {QLatin1String("mpga"), QLatin1String("audio/mpeg")},
+
+            {QLatin1String("opus"), QLatin1String("audio/x-opus+ogg")},
+
+            {QLatin1String("ape"), QLatin1String("audio/x-ape")},
+
+            {QLatin1String("wav"), QLatin1String("audio/x-wav")},
+            {QLatin1String("wv"), QLatin1String("audio/x-wavpack")},
+            {QLatin1String("wvp"), QLatin1String("audio/x-wavpack")}
+        };
+        static const auto end(types.end());
+
+        const auto found(types.find(fileInfo.suffix().toLower()));
+        if (found == end) {
+            return false;
+        }
+        return contains(LibraryUtils::mimeTypesByContent, found->second) &&
+               mimeTypeFromString(found->second) != MimeType::Other;
+    }
+}
+
+class MimeTypeBenchmark final : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void classify_data();
+    void classify();
+
+private:
+    std::vector<QFileInfo> mFiles;
+    QMimeDatabase mMimeDb;
+};
+
+void MimeTypeBenchmark::initTestCase()
+{
+    const char* const suffixes[] = {"flac", "mp3", "m4a", "opus", "wv", "FLAC", "MP3"};
+    const int suffixesCount = sizeof(suffixes) / sizeof(suffixes[0]);
+    mFiles.reserve(filesCount);
+    for (int i = 0; i < filesCount; ++i) {
+        mFiles.emplace_back(QString::fromLatin1("/synthetic/%1/%2/%3.%4")
+                                .arg(i / 1000)
+                                .arg(i / 10)
+                                .arg(i)
+                                .arg(QLatin1String(suffixes[i % suffixesCount])));
+    }
+}
+
+void MimeTypeBenchmark::classify_data()
+{
+    QTest::addColumn<bool>("byMimeName");
+    QTest::newRow("MimeType") << false;
+    QTest::newRow("MIME names") << true;
+}
+
+void MimeTypeBenchmark::classify()
+{
+    QFETCH(bool, byMimeName);
+    int audioFiles = 0;
+    QBENCHMARK {
+        audioFiles = 0;
+        for (const QFileInfo& fileInfo : mFiles) {
+            if (byMimeName ? isAudioByMimeName(fileInfo) : audioTypeForFile(fileInfo, mMimeDb) != MimeType::Other) {
+                ++audioFiles;
+            }
+        }
+    }
+    QCOMPARE(audioFiles, filesCount);
+}
+
+QTEST_APPLESS_MAIN(MimeTypeBenchmark)
+
+#include "mimetypebench.moc"
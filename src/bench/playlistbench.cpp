@@ -0,0 +1,329 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <vector>
+
+#include <QDebug>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QGuiApplication>
+#include <QSqlDatabase>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QtTest>
+
+#include "benchutils.h"
+#include "playlistmodel.h"
+#include "playlistutils.h"
+
+using namespace unplayer;
+
+// Playlist parsing, saving and loading of pls, m3u and m3u8 files of 100 to 100k entries.
+// Even entries are absolute paths of library tracks, odd ones are relative paths
+// that are not in library. Titles are long and names contain non-ASCII characters
+
+namespace
+{
+    const std::vector<int> sizes{100, 1000, 10000, 100000};
+    const QStringList formats{QLatin1String("pls"), QLatin1String("m3u"), QLatin1String("m3u8")};
+
+    QString entryPath(int index)
+    {
+        if (index % 2 == 0) {
+            return QString::fromUtf8("/synthetic/music/Artist %1/Альбом %2/%3 Track.flac").arg(index / 50).arg(index / 10).arg(index);
+        }
+        return QString::fromUtf8("Relative/Naïve 東京 %1/%2.mp3").arg(index / 10).arg(index);
+    }
+
+    QString entryTitle(int index)
+    {
+        return QString::fromUtf8("Артист %1 - A rather long title of track number %2 that goes on and on, "
+                                 "with a parenthesized remix note (Extended Ümlaut Version) and a feat. credit %3")
+            .arg(index / 50)
+            .arg(index)
+            .arg(index % 7);
+    }
+
+    bool writePlaylist(const QString& filePath, const QString& format, int size)
+    {
+        QFile file(filePath);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "failed to open" << filePath << file.errorString();
+            return false;
+        }
+
+        QTextStream stream(&file);
+        stream.setCodec("UTF-8");
+        if (format == QLatin1String("pls")) {
+            stream << "[playlist]\n";
+            for (int i = 0; i < size; ++i) {
+                const int number = i + 1;
+                stream << "File" << number << '=' << entryPath(i) << '\n';
+                stream << "Title" << number << '=' << entryTitle(i) << '\n';
+                stream << "Length" << number << '=' << (120 + i % 300) << '\n';
+            }
+            stream << "NumberOfEntries=" << size << '\n';
+            stream << "Version=2\n";
+        } else {
+            stream << "#EXTM3U\n";
+            for (int i = 0; i < size; ++i) {
+                stream << "#EXTINF:" << (120 + i % 300) << ',' << entryTitle(i) << '\n';
+                stream << entryPath(i) << '\n';
+            }
+        }
+        stream.flush();
+        return stream.status() == QTextStream::Ok;
+    }
+
+    void waitUntilLoaded(PlaylistModel& model)
+    {
+        if (model.isLoaded()) {
+            return;
+        }
+        QEventLoop loop;
+        QObject::connect(&model, &PlaylistModel::loadedChanged, &loop, [&]() {
+            if (model.isLoaded()) {
+                loop.quit();
+            }
+        });
+        loop.exec();
+    }
+}
+
+class PlaylistBenchmark final : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void parsePlaylist_data();
+    void parsePlaylist();
+    void getPlaylistTracks_data();
+    void getPlaylistTracks();
+    void getPlaylistTracksCount_data();
+    void getPlaylistTracksCount();
+    void savePlaylist_data();
+    void savePlaylist();
+    void loadIndexedPlaylist_data();
+    void loadIndexedPlaylist();
+    void playlistModel_data();
+    void playlistModel();
+    void indexedPlaylistModel_data();
+    void indexedPlaylistModel();
+
+private:
+    void addPlaylists();
+    // Playlist outside of playlists directory, which is parsed every time
+    QString corpusFilePath(const QString& format, int size) const;
+    // Playlist in playlists directory, which is indexed in database
+    QString indexedFilePath(const QString& format, int size) const;
+
+    QTemporaryDir mDirectory;
+};
+
+void PlaylistBenchmark::initTestCase()
+{
+    QVERIFY(mDirectory.isValid());
+
+    bench::resetLocations();
+    QVERIFY(bench::waitForDatabase());
+
+    QVERIFY(QDir().mkpath(PlaylistUtils::instance()->playlistsDirectoryPath()));
+    for (const QString& format : formats) {
+        for (const int size : sizes) {
+            QVERIFY(writePlaylist(corpusFilePath(format, size), format, size));
+            QVERIFY(writePlaylist(indexedFilePath(format, size), format, size));
+        }
+    }
+
+    // Library tracks for absolute entries, so that PlaylistModel finds half of tracks
+    bench::TracksInserter inserter(QSqlDatabase::database());
+    for (int i = 0; i < sizes.back(); i += 2) {
+        bench::SyntheticTrack track(i / 2);
+        track.filePath = entryPath(i);
+        track.artist = -1;
+        track.album = -1;
+        track.genre = -1;
+        QVERIFY(inserter.add(track));
+    }
+    QVERIFY(inserter.finish());
+}
+
+void PlaylistBenchmark::parsePlaylist_data()
+{
+    addPlaylists();
+}
+
+void PlaylistBenchmark::parsePlaylist()
+{
+    QFETCH(QString, format);
+    QFETCH(int, size);
+    const QString filePath(corpusFilePath(format, size));
+    QBENCHMARK {
+        QCOMPARE(static_cast<int>(PlaylistUtils::parsePlaylist(filePath).size()), size);
+    }
+}
+
+void PlaylistBenchmark::getPlaylistTracks_data()
+{
+    addPlaylists();
+}
+
+void PlaylistBenchmark::getPlaylistTracks()
+{
+    QFETCH(QString, format);
+    QFETCH(int, size);
+    const QString filePath(corpusFilePath(format, size));
+    QBENCHMARK {
+        QCOMPARE(PlaylistUtils::getPlaylistTracks(filePath).size(), size);
+    }
+}
+
+void PlaylistBenchmark::getPlaylistTracksCount_data()
+{
+    addPlaylists();
+}
+
+void PlaylistBenchmark::getPlaylistTracksCount()
+{
+    QFETCH(QString, format);
+    QFETCH(int, size);
+    const QString filePath(corpusFilePath(format, size));
+    QBENCHMARK {
+        QCOMPARE(PlaylistUtils::getPlaylistTracksCount(filePath), size);
+    }
+}
+
+void PlaylistBenchmark::savePlaylist_data()
+{
+    addPlaylists();
+}
+
+void PlaylistBenchmark::savePlaylist()
+{
+    QFETCH(QString, format);
+    QFETCH(int, size);
+    const std::vector<PlaylistTrack> tracks(PlaylistUtils::parsePlaylist(corpusFilePath(format, size)));
+    const QString filePath(QString::fromLatin1("%1/saved.%2").arg(mDirectory.path(), format));
+    QBENCHMARK {
+        PlaylistUtils::writePlaylist(filePath, tracks);
+    }
+    QCOMPARE(PlaylistUtils::getPlaylistTracksCount(filePath), size);
+}
+
+void PlaylistBenchmark::loadIndexedPlaylist_data()
+{
+    addPlaylists();
+}
+
+void PlaylistBenchmark::loadIndexedPlaylist()
+{
+    QFETCH(QString, format);
+    QFETCH(int, size);
+    const QString filePath(indexedFilePath(format, size));
+    // First load indexes playlist
+    QCOMPARE(static_cast<int>(PlaylistUtils::loadPlaylist(filePath).size()), size);
+    QBENCHMARK {
+        QCOMPARE(static_cast<int>(PlaylistUtils::loadPlaylist(filePath).size()), size);
+    }
+}
+
+void PlaylistBenchmark::playlistModel_data()
+{
+    addPlaylists();
+}
+
+void PlaylistBenchmark::playlistModel()
+{
+    QFETCH(QString, format);
+    QFETCH(int, size);
+    const QString filePath(corpusFilePath(format, size));
+    // Parsing, showing entries and looking up their tracks in library
+    QBENCHMARK {
+        PlaylistModel model;
+        model.setFilePath(filePath);
+        waitUntilLoaded(model);
+        QCOMPARE(model.rowCount(QModelIndex()), size);
+    }
+}
+
+void PlaylistBenchmark::indexedPlaylistModel_data()
+{
+    addPlaylists();
+}
+
+void PlaylistBenchmark::indexedPlaylistModel()
+{
+    QFETCH(QString, format);
+    QFETCH(int, size);
+    const QString filePath(indexedFilePath(format, size));
+    QCOMPARE(static_cast<int>(PlaylistUtils::loadPlaylist(filePath).size()), size);
+    QBENCHMARK {
+        PlaylistModel model;
+        model.setFilePath(filePath);
+        waitUntilLoaded(model);
+        QCOMPARE(model.rowCount(QModelIndex()), size);
+    }
+}
+
+void PlaylistBenchmark::addPlaylists()
+{
+    QTest::addColumn<QString>("format");
+    QTest::addColumn<int>("size");
+    for (const QString& format : formats) {
+        for (const int size : sizes) {
+            QTest::newRow(qPrintable(QString::fromLatin1("%1-%2").arg(format).arg(size))) << format << size;
+        }
+    }
+}
+
+QString PlaylistBenchmark::corpusFilePath(const QString& format, int size) const
+{
+    return QString::fromUtf8("%1/Плейлист %2.%3").arg(mDirectory.path()).arg(size).arg(format);
+}
+
+QString PlaylistBenchmark::indexedFilePath(const QString& format, int size) const
+{
+    return QString::fromUtf8("%1/Плейлист %2.%3").arg(PlaylistUtils::instance()->playlistsDirectoryPath()).arg(size).arg(format);
+}
+
+int main(int argc, char* argv[])
+{
+    // Playlists directory is in music directory, which is not affected by test mode
+    const QTemporaryDir home;
+    if (!home.isValid()) {
+        qWarning() << "failed to create temporary directory";
+        return 1;
+    }
+    qputenv("HOME", QFile::encodeName(home.path()));
+
+    // Database is kept apart from the one of the app
+    QStandardPaths::setTestMode(true);
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication app(argc, argv);
+    PlaylistBenchmark benchmark;
+    return QTest::qExec(&benchmark, argc, argv);
+}
+
+#include "playlistbench.moc"
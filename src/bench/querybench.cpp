@@ -0,0 +1,361 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <malloc.h>
+
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMetaEnum>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QStandardPaths>
+
+#include "albumsmodel.h"
+#include "artistsmodel.h"
+#include "benchutils.h"
+#include "genresmodel.h"
+#include "librarychanges.h"
+#include "libraryutils.h"
+#include "settings.h"
+#include "tracksmodel.h"
+
+using namespace unplayer;
+
+// Fills library database with synthetic tracks and measures queries of browse models
+// and LibraryUtils with growing number of tracks. Results are printed as JSON
+
+namespace
+{
+    // Adds tracks with ids in range [first, last), metadata of track depends only on its index
+    bool addTracks(int first, int last)
+    {
+        bench::TracksInserter inserter(QSqlDatabase::database());
+        for (int i = first; i < last; ++i) {
+            bench::SyntheticTrack track(i);
+            if (track.album % 2 == 0) {
+                track.mediaArt = QString::fromLatin1("/synthetic/media-art/%1.jpg").arg(track.album);
+            }
+            if (!inserter.add(track)) {
+                break;
+            }
+
+            // Featured artists and second genres
+            if (i % bench::tracksPerAlbum == 3) {
+                inserter.addArtist(track.id, track.artist + 1);
+            }
+            if (track.album % 3 == 0) {
+                inserter.addGenre(track.id, (track.album + 7) % bench::genresCount);
+            }
+        }
+
+        if (!inserter.finish()) {
+            return false;
+        }
+
+        // Statistics and cached query results
+        emit LibraryUtils::instance()->libraryChanged(LibraryChanges::everything());
+        emit LibraryUtils::instance()->databaseChanged();
+
+        return true;
+    }
+
+    // Percentiles with samples in order of measurement
+    QJsonObject samplesObject(const std::vector<double>& samples)
+    {
+        QJsonObject object(bench::percentiles(samples));
+        QJsonArray array;
+        for (const double sample : samples) {
+            array.push_back(sample);
+        }
+        object.insert(QLatin1String("samples"), array);
+        return object;
+    }
+
+    template<typename Enum>
+    QString enumKey(Enum value)
+    {
+        return QLatin1String(QMetaEnum::fromType<Enum>().valueToKey(value));
+    }
+
+    // Measures loading of model with empty query cache. setUp is called after model is constructed
+    template<typename Model>
+    QJsonObject measureModel(const QString& name, const QJsonObject& parameters, int repeat, const std::function<void(Model&)>& setUp)
+    {
+        std::vector<double> firstRows;
+        std::vector<double> allRows;
+        int rows = 0;
+
+        for (int i = 0; i < repeat; ++i) {
+            emit LibraryUtils::instance()->libraryChanged(LibraryChanges::everything());
+
+            QElapsedTimer timer;
+            QEventLoop loop;
+            double firstRowsTime = -1.0;
+            bool finished = false;
+
+            timer.start();
+            Model model;
+            QObject::connect(&model, &QAbstractItemModel::modelReset, &loop, [&]() {
+                if (firstRowsTime < 0.0) {
+                    firstRowsTime = bench::elapsedMs(timer);
+                }
+            });
+            QObject::connect(&model, &Model::queryFinished, &loop, [&]() {
+                finished = true;
+                loop.quit();
+            });
+            setUp(model);
+            if (!finished) {
+                loop.exec();
+            }
+
+            allRows.push_back(bench::elapsedMs(timer));
+            firstRows.push_back(std::max(firstRowsTime, 0.0));
+            rows = model.rowCount();
+        }
+
+        QJsonObject result(parameters);
+        result.insert(QLatin1String("name"), name);
+        result.insert(QLatin1String("rows"), rows);
+        result.insert(QLatin1String("firstRowsMs"), samplesObject(firstRows));
+        result.insert(QLatin1String("allRowsMs"), samplesObject(allRows));
+        return result;
+    }
+
+    QJsonObject measureCall(const QString& name, int repeat, const std::function<void()>& call)
+    {
+        std::vector<double> samples;
+        for (int i = 0; i < repeat; ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            call();
+            samples.push_back(bench::elapsedMs(timer));
+        }
+        return {{QLatin1String("name"), name},
+                {QLatin1String("ms"), samplesObject(samples)}};
+    }
+
+    // Heap memory held by query after all tracks are read, scrollable query
+    // keeps copy of every row until it is finished
+    QJsonObject measureResultMemory(bool forwardOnly)
+    {
+        QSqlQuery query(QSqlDatabase::database());
+        query.setForwardOnly(forwardOnly);
+        const int before = mallinfo().uordblks;
+        if (!query.exec(QLatin1String("SELECT id, filePath, title, mediaArt FROM tracks"))) {
+            qWarning() << "failed to select tracks" << query.lastError();
+        }
+        int rows = 0;
+        while (query.next()) {
+            ++rows;
+        }
+        const int after = mallinfo().uordblks;
+        return {{QLatin1String("name"), QLatin1String("resultMemory")},
+                {QLatin1String("forwardOnly"), forwardOnly},
+                {QLatin1String("rows"), rows},
+                {QLatin1String("heapKiB"), (after - before) / 1024}};
+    }
+
+    QJsonArray measure(int repeat)
+    {
+        QJsonArray results;
+
+        const QString artist(bench::artistTitle(0));
+        const QString album(bench::albumTitle(0));
+        const QString genre(bench::genreTitle(0));
+
+        const auto tracksSortModes = QMetaEnum::fromType<TracksModel::SortMode>();
+        const auto insideAlbumSortModes = QMetaEnum::fromType<TracksModel::InsideAlbumSortMode>();
+        for (int i = 0; i < tracksSortModes.keyCount(); ++i) {
+            const auto sortMode = static_cast<TracksModel::SortMode>(tracksSortModes.value(i));
+            for (int j = 0; j < insideAlbumSortModes.keyCount(); ++j) {
+                const auto insideAlbumSortMode = static_cast<TracksModel::InsideAlbumSortMode>(insideAlbumSortModes.value(j));
+                Settings::instance()->setAllTracksSortSettings(false, sortMode, insideAlbumSortMode);
+                results.push_back(measureModel<TracksModel>(QLatin1String("tracks"),
+                                                            {{QLatin1String("sortMode"), enumKey(sortMode)},
+                                                             {QLatin1String("insideAlbumSortMode"), enumKey(insideAlbumSortMode)}},
+                                                            repeat,
+                                                            [](TracksModel& model) {
+                    model.classBegin();
+                    model.componentComplete();
+                }));
+            }
+        }
+
+        results.push_back(measureModel<TracksModel>(QLatin1String("artistTracks"), {}, repeat, [&](TracksModel& model) {
+            model.classBegin();
+            model.setAllArtists(false);
+            model.setArtist(artist);
+            model.componentComplete();
+        }));
+        results.push_back(measureModel<TracksModel>(QLatin1String("albumTracks"), {}, repeat, [&](TracksModel& model) {
+            model.classBegin();
+            model.setAllArtists(false);
+            model.setAllAlbums(false);
+            model.setArtist(artist);
+            model.setAlbum(album);
+            model.componentComplete();
+        }));
+        results.push_back(measureModel<TracksModel>(QLatin1String("genreTracks"), {}, repeat, [&](TracksModel& model) {
+            model.classBegin();
+            model.setGenre(genre);
+            model.componentComplete();
+        }));
+
+        const auto albumsSortModes = QMetaEnum::fromType<AlbumsModel::SortMode>();
+        for (int i = 0; i < albumsSortModes.keyCount(); ++i) {
+            const auto sortMode = static_cast<AlbumsModel::SortMode>(albumsSortModes.value(i));
+            Settings::instance()->setAllAlbumsSortSettings(false, sortMode);
+            results.push_back(measureModel<AlbumsModel>(QLatin1String("albums"),
+                                                        {{QLatin1String("sortMode"), enumKey(sortMode)}},
+                                                        repeat,
+                                                        [](AlbumsModel& model) {
+                model.classBegin();
+                model.componentComplete();
+            }));
+        }
+        results.push_back(measureModel<AlbumsModel>(QLatin1String("artistAlbums"), {}, repeat, [&](AlbumsModel& model) {
+            model.classBegin();
+            model.setAllArtists(false);
+            model.setArtist(artist);
+            model.componentComplete();
+        }));
+
+        results.push_back(measureModel<ArtistsModel>(QLatin1String("artists"), {}, repeat, [](ArtistsModel&) {}));
+        results.push_back(measureModel<GenresModel>(QLatin1String("genres"), {}, repeat, [](GenresModel&) {}));
+
+        LibraryUtils* libraryUtils = LibraryUtils::instance();
+        results.push_back(measureCall(QLatin1String("statistics"), repeat, [libraryUtils]() {
+            emit libraryUtils->databaseChanged();
+            libraryUtils->artistsCount();
+            libraryUtils->albumsCount();
+            libraryUtils->tracksCount();
+            libraryUtils->tracksDuration();
+        }));
+        results.push_back(measureCall(QLatin1String("randomMediaArt"), repeat, [libraryUtils]() {
+            libraryUtils->randomMediaArt();
+        }));
+        results.push_back(measureCall(QLatin1String("randomMediaArtForArtist"), repeat, [&]() {
+            libraryUtils->randomMediaArtForArtist(artist);
+        }));
+        results.push_back(measureCall(QLatin1String("randomMediaArtForAlbum"), repeat, [&]() {
+            libraryUtils->randomMediaArtForAlbum(artist, album);
+        }));
+        results.push_back(measureCall(QLatin1String("randomMediaArtForGenre"), repeat, [&]() {
+            libraryUtils->randomMediaArtForGenre(genre);
+        }));
+
+        results.push_back(measureResultMemory(false));
+        results.push_back(measureResultMemory(true));
+
+        return results;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // Database and settings are kept apart from the ones of the app
+    QStandardPaths::setTestMode(true);
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    const QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QLatin1String("Measures library queries with synthetic database, results are printed as JSON"));
+    parser.addHelpOption();
+    const QCommandLineOption tracksOption(QLatin1String("tracks"), QLatin1String("Comma separated list of library sizes"), QLatin1String("counts"), QLatin1String("10000,100000,500000"));
+    const QCommandLineOption repeatOption(QLatin1String("repeat"), QLatin1String("Number of times each query is measured"), QLatin1String("count"), QLatin1String("5"));
+    const QCommandLineOption outputOption(QLatin1String("output"), QLatin1String("Write results to file instead of standard output"), QLatin1String("path"));
+    parser.addOptions({tracksOption, repeatOption, outputOption});
+    parser.process(app);
+
+    std::vector<int> sizes;
+    for (const QString& size : parser.value(tracksOption).split(QLatin1Char(','), QString::SkipEmptyParts)) {
+        const int count = size.toInt();
+        if (count <= 0) {
+            qWarning() << "invalid library size" << size;
+            return 1;
+        }
+        sizes.push_back(count);
+    }
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+    const int repeat = std::max(1, parser.value(repeatOption).toInt());
+
+    bench::resetLocations();
+    if (!bench::waitForDatabase()) {
+        return 1;
+    }
+
+    QJsonArray results;
+    int tracks = 0;
+    for (const int size : sizes) {
+        qDebug() << "filling database with" << size << "tracks";
+        QElapsedTimer timer;
+        timer.start();
+        if (!addTracks(tracks, size)) {
+            return 1;
+        }
+        const double fillTime = bench::elapsedMs(timer);
+        tracks = size;
+
+        qDebug() << "measuring queries with" << size << "tracks";
+        results.push_back(QJsonObject{{QLatin1String("tracks"), size},
+                                      {QLatin1String("artists"), libraryUtils->artistsCount()},
+                                      {QLatin1String("albums"), libraryUtils->albumsCount()},
+                                      {QLatin1String("fillMs"), fillTime},
+                                      {QLatin1String("queries"), measure(repeat)}});
+    }
+
+    QSqlQuery versionQuery(QLatin1String("SELECT sqlite_version()"));
+    const QString sqliteVersion(versionQuery.next() ? versionQuery.value(0).toString() : QString());
+
+    const QByteArray json(QJsonDocument(QJsonObject{{QLatin1String("repeat"), repeat},
+                                                    {QLatin1String("sqliteVersion"), sqliteVersion},
+                                                    {QLatin1String("results"), results}}).toJson());
+
+    const QString outputPath(parser.value(outputOption));
+    if (outputPath.isEmpty()) {
+        QFile output;
+        output.open(stdout, QIODevice::WriteOnly);
+        output.write(json);
+    } else {
+        QFile output(outputPath);
+        if (!output.open(QIODevice::WriteOnly) || output.write(json) < 0) {
+            qWarning() << "failed to write results to" << outputPath << output.errorString();
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,316 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <memory>
+#include <vector>
+
+#include <QDebug>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QSqlDatabase>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include "benchutils.h"
+#include "queue.h"
+
+using namespace unplayer;
+
+// Queue operations with queues of 1k, 10k, 50k and 100k tracks. Tracks are empty files
+// which metadata is in library database, so they are not parsed when added
+
+namespace
+{
+    const int maxQueueSize = 100000;
+
+    void waitUntilAdded(Queue& queue)
+    {
+        if (!queue.isAddingTracks()) {
+            return;
+        }
+        QEventLoop loop;
+        QObject::connect(&queue, &Queue::addingTracksChanged, &loop, [&]() {
+            if (!queue.isAddingTracks()) {
+                loop.quit();
+            }
+        });
+        loop.exec();
+    }
+}
+
+class QueueBenchmark final : public QObject
+{
+    Q_OBJECT
+private slots:
+    void initTestCase();
+
+    void addTracksFromUrls_data();
+    void addTracksFromUrls();
+    void addTracksFromUrlsReusing_data();
+    void addTracksFromUrlsReusing();
+    void removeTracks_data();
+    void removeTracks();
+    void shuffleNext_data();
+    void shuffleNext();
+    void shuffleNextOnEos_data();
+    void shuffleNextOnEos();
+    void imageLookup_data();
+    void imageLookup();
+    void saveSnapshot_data();
+    void saveSnapshot();
+    void restoreSnapshot_data();
+    void restoreSnapshot();
+
+private:
+    void addSizes();
+    QStringList urls(int count) const;
+    // Fills queue with first count tracks
+    void fill(Queue& queue, int count) const;
+
+    QTemporaryDir mDirectory;
+    QStringList mFiles;
+};
+
+void QueueBenchmark::initTestCase()
+{
+    QVERIFY(mDirectory.isValid());
+
+    bench::resetLocations();
+    QVERIFY(bench::waitForDatabase());
+
+    QVERIFY(bench::createTrackFiles(mDirectory.path(), 0, maxQueueSize, mFiles));
+
+    bench::TracksInserter inserter(QSqlDatabase::database());
+    for (int i = 0; i < maxQueueSize; ++i) {
+        bench::SyntheticTrack track(i);
+        track.filePath = mFiles[i];
+        track.modificationTime = QFileInfo(track.filePath).lastModified().toMSecsSinceEpoch();
+        QVERIFY(inserter.add(track));
+    }
+    QVERIFY(inserter.finish());
+}
+
+void QueueBenchmark::addTracksFromUrls_data()
+{
+    addSizes();
+}
+
+void QueueBenchmark::addTracksFromUrls()
+{
+    QFETCH(int, size);
+    const QStringList trackUrls(urls(size));
+    QBENCHMARK {
+        Queue queue(nullptr);
+        queue.addTracksFromUrls(trackUrls);
+        waitUntilAdded(queue);
+        QCOMPARE(static_cast<int>(queue.tracks().size()), size);
+    }
+}
+
+void QueueBenchmark::addTracksFromUrlsReusing_data()
+{
+    addSizes();
+}
+
+void QueueBenchmark::addTracksFromUrlsReusing()
+{
+    QFETCH(int, size);
+    const QStringList trackUrls(urls(size));
+    Queue queue(nullptr);
+    fill(queue, size);
+    // Replaces queue with the same tracks, which are not looked up in database
+    QBENCHMARK {
+        queue.addTracksFromUrls(trackUrls, true);
+        waitUntilAdded(queue);
+    }
+    QCOMPARE(static_cast<int>(queue.tracks().size()), size);
+}
+
+void QueueBenchmark::removeTracks_data()
+{
+    addSizes();
+}
+
+void QueueBenchmark::removeTracks()
+{
+    QFETCH(int, size);
+    Queue queue(nullptr);
+    fill(queue, size);
+    queue.setShuffle(true);
+
+    // Every other track, so that each of them is a separate range
+    std::vector<int> indexes;
+    indexes.reserve(size / 2);
+    for (int i = 0; i < size; i += 2) {
+        indexes.push_back(i);
+    }
+
+    QBENCHMARK_ONCE {
+        queue.removeTracks(indexes);
+    }
+    QCOMPARE(static_cast<int>(queue.tracks().size()), size / 2);
+}
+
+void QueueBenchmark::shuffleNext_data()
+{
+    addSizes();
+}
+
+void QueueBenchmark::shuffleNext()
+{
+    QFETCH(int, size);
+    Queue queue(nullptr);
+    fill(queue, size);
+    queue.setShuffle(true);
+    queue.setCurrentToFirstIfNeeded();
+
+    // Whole shuffle order, including its reset at the end
+    QBENCHMARK {
+        for (int i = 0; i < size; ++i) {
+            queue.next();
+        }
+    }
+}
+
+void QueueBenchmark::shuffleNextOnEos_data()
+{
+    addSizes();
+}
+
+void QueueBenchmark::shuffleNextOnEos()
+{
+    QFETCH(int, size);
+    Queue queue(nullptr);
+    fill(queue, size);
+    queue.setShuffle(true);
+    queue.setRepeatMode(Queue::RepeatAll);
+    queue.setCurrentToFirstIfNeeded();
+
+    QBENCHMARK {
+        for (int i = 0; i < size; ++i) {
+            queue.nextIndexOnEos();
+            queue.nextOnEos();
+        }
+    }
+}
+
+void QueueBenchmark::imageLookup_data()
+{
+    addSizes();
+}
+
+void QueueBenchmark::imageLookup()
+{
+    QFETCH(int, size);
+    Queue queue(nullptr);
+    fill(queue, size);
+    QueueImageProvider provider(&queue);
+
+    QStringList ids;
+    ids.reserve(size);
+    for (const auto& track : queue.tracks()) {
+        ids.push_back(track->trackId.mid(1));
+    }
+
+    // Tracks don't have embedded media art, this measures only lookup of track
+    QBENCHMARK {
+        for (const QString& id : ids) {
+            provider.image(id, QSize(128, 128));
+        }
+    }
+}
+
+void QueueBenchmark::saveSnapshot_data()
+{
+    addSizes();
+}
+
+void QueueBenchmark::saveSnapshot()
+{
+    QFETCH(int, size);
+    Queue queue(nullptr);
+    fill(queue, size);
+    queue.setShuffle(true);
+
+    QBENCHMARK {
+        queue.saveSnapshot();
+    }
+}
+
+void QueueBenchmark::restoreSnapshot_data()
+{
+    addSizes();
+}
+
+void QueueBenchmark::restoreSnapshot()
+{
+    QFETCH(int, size);
+    {
+        Queue queue(nullptr);
+        fill(queue, size);
+        queue.setShuffle(true);
+        queue.saveSnapshot();
+    }
+
+    // Includes checking of files in background
+    QBENCHMARK {
+        Queue queue(nullptr);
+        QVERIFY(queue.restoreSnapshot());
+        waitUntilAdded(queue);
+        QCOMPARE(static_cast<int>(queue.tracks().size()), size);
+    }
+}
+
+void QueueBenchmark::addSizes()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("50k") << 50000;
+    QTest::newRow("100k") << 100000;
+}
+
+QStringList QueueBenchmark::urls(int count) const
+{
+    return mFiles.mid(0, count);
+}
+
+void QueueBenchmark::fill(Queue& queue, int count) const
+{
+    queue.addTracksFromUrls(urls(count), true);
+    waitUntilAdded(queue);
+    QCOMPARE(static_cast<int>(queue.tracks().size()), count);
+}
+
+int main(int argc, char* argv[])
+{
+    // Database and queue are kept apart from the ones of the app
+    QStandardPaths::setTestMode(true);
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication app(argc, argv);
+    QueueBenchmark benchmark;
+    return QTest::qExec(&benchmark, argc, argv);
+}
+
+#include "queuebench.moc"
@@ -0,0 +1,136 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <QUrl>
+#include <QtTest>
+
+#include "flathash.h"
+
+using namespace unplayer;
+
+// Matching of urls added to queue with tracks that are already in it, when queue of
+// 10k and 50k tracks is restored or re-added. Linear lookup with erasing from the
+// middle of vector is how tracks were matched before, hashed lookup is how Queue
+// matches them now. Whole restore of queue is measured by unplayer-bench-queue
+
+namespace
+{
+    struct OldTrack
+    {
+        QUrl url;
+        long long modificationTime;
+    };
+
+    using OldTracks = std::vector<std::shared_ptr<OldTrack>>;
+
+    OldTracks createOldTracks(int count)
+    {
+        OldTracks tracks;
+        tracks.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            tracks.push_back(std::make_shared<OldTrack>(OldTrack{QUrl::fromLocalFile(QString::fromLatin1("/synthetic/%1/%2.flac").arg(i / 1000).arg(i)),
+                                                                 1000000 + i}));
+        }
+        return tracks;
+    }
+
+    int reuseLinear(OldTracks oldTracks, const std::vector<OldTrack>& newTracks)
+    {
+        int reused = 0;
+        for (const OldTrack& newTrack : newTracks) {
+            const auto found(std::find_if(oldTracks.begin(), oldTracks.end(), [&](const std::shared_ptr<OldTrack>& track) {
+                return track->url == newTrack.url && track->modificationTime == newTrack.modificationTime;
+            }));
+            if (found != oldTracks.end()) {
+                oldTracks.erase(found);
+                ++reused;
+            }
+        }
+        return reused;
+    }
+
+    int reuseHashed(OldTracks oldTracks, const std::vector<OldTrack>& newTracks)
+    {
+        FlatHashMap<QUrl, std::shared_ptr<OldTrack>> oldTracksMap;
+        oldTracksMap.reserve(oldTracks.size());
+        for (auto& track : oldTracks) {
+            const QUrl url(track->url);
+            oldTracksMap.insert({url, std::move(track)});
+        }
+        oldTracks.clear();
+
+        int reused = 0;
+        for (const OldTrack& newTrack : newTracks) {
+            const auto found(oldTracksMap.find(newTrack.url));
+            if (found != oldTracksMap.end() && found->second->modificationTime == newTrack.modificationTime) {
+                oldTracksMap.erase(found);
+                ++reused;
+            }
+        }
+        return reused;
+    }
+}
+
+class QueueReuseBenchmark final : public QObject
+{
+    Q_OBJECT
+private slots:
+    void reuseTracks_data();
+    void reuseTracks();
+};
+
+void QueueReuseBenchmark::reuseTracks_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<bool>("hashed");
+    for (const int size : {10000, 50000}) {
+        const QByteArray name(QByteArray::number(size / 1000) + 'k');
+        QTest::newRow((name + " linear").constData()) << size << false;
+        QTest::newRow((name + " hashed").constData()) << size << true;
+    }
+}
+
+void QueueReuseBenchmark::reuseTracks()
+{
+    QFETCH(int, size);
+    QFETCH(bool, hashed);
+
+    const OldTracks oldTracks(createOldTracks(size));
+    // Saved queue is restored in the same order, every tenth file was modified since
+    std::vector<OldTrack> newTracks;
+    newTracks.reserve(size);
+    for (int i = 0; i < size; ++i) {
+        const OldTrack& track = *oldTracks[i];
+        newTracks.push_back({track.url, i % 10 == 0 ? track.modificationTime + 1 : track.modificationTime});
+    }
+
+    int reused = 0;
+    QBENCHMARK_ONCE {
+        reused = hashed ? reuseHashed(oldTracks, newTracks) : reuseLinear(oldTracks, newTracks);
+    }
+    QCOMPARE(reused, size - size / 10);
+}
+
+QTEST_APPLESS_MAIN(QueueReuseBenchmark)
+
+#include "queuereusebench.moc"
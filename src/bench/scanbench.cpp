@@ -0,0 +1,781 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QImage>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include <sys/resource.h>
+
+#include <attachedpictureframe.h>
+#include <fileref.h>
+#include <flacfile.h>
+#include <flacpicture.h>
+#include <id3v2tag.h>
+#include <mp4coverart.h>
+#include <mp4file.h>
+#include <mp4tag.h>
+#include <mpegfile.h>
+#include <opusfile.h>
+#include <tag.h>
+#include <tpropertymap.h>
+#include <xiphcomment.h>
+
+#include "benchutils.h"
+#include "libraryutils.h"
+#include "settings.h"
+
+using namespace unplayer;
+
+// Generates synthetic library and scans it three times using LibraryUtils::updateDatabase():
+// with empty database, without changes and with a percent of files changed.
+// Files per second are computed for the whole library, not only for processed files
+
+namespace
+{
+    enum class Format
+    {
+        Flac,
+        Mp3,
+        Opus,
+        M4a
+    };
+
+    enum class Layout
+    {
+        // All files in library directory
+        Flat,
+        // Artist/Album/Track
+        Albums,
+        // Genre/Artist/Year - Album/CD N/Track
+        Deep
+    };
+
+    const int tracksPerAlbum = 10;
+    const int albumsPerArtist = 3;
+    const int genresCount = 25;
+    const int durationSeconds = 3;
+
+    struct Options
+    {
+        int files = 2000;
+        std::vector<Format> formats;
+        int artSize = 500;
+        int artVariants = 20;
+        Layout layout = Layout::Albums;
+        QString directory;
+        bool reuse = false;
+        double changedPercent = 1.0;
+        int threads = 0;
+    };
+
+    struct PhaseResult
+    {
+        qint64 elapsed;
+        int processedFiles;
+        int skippedFiles;
+        qint64 bytesRead;
+        qint64 peakRss;
+    };
+
+    QString suffix(Format format)
+    {
+        switch (format) {
+        case Format::Flac:
+            return QLatin1String("flac");
+        case Format::Mp3:
+            return QLatin1String("mp3");
+        case Format::Opus:
+            return QLatin1String("opus");
+        case Format::M4a:
+            return QLatin1String("m4a");
+        }
+        return QString();
+    }
+
+    void appendBigEndian(QByteArray& data, quint64 value, int size)
+    {
+        for (int i = size - 1; i >= 0; --i) {
+            data.append(static_cast<char>((value >> (i * 8)) & 0xff));
+        }
+    }
+
+    void appendLittleEndian(QByteArray& data, quint64 value, int size)
+    {
+        for (int i = 0; i < size; ++i) {
+            data.append(static_cast<char>((value >> (i * 8)) & 0xff));
+        }
+    }
+
+    //
+    // Minimal audio streams. They are not decodable, but their headers are valid
+    // so that TagLib can write tags into them and read duration back
+    //
+
+    QByteArray flacStream()
+    {
+        QByteArray data("fLaC");
+        // Last metadata block, STREAMINFO, 34 bytes
+        data.append(static_cast<char>(0x80));
+        appendBigEndian(data, 34, 3);
+        // Block sizes and frame sizes
+        appendBigEndian(data, 4096, 2);
+        appendBigEndian(data, 4096, 2);
+        appendBigEndian(data, 0, 3);
+        appendBigEndian(data, 0, 3);
+        // 44100 Hz, 2 channels, 16 bits per sample, total samples
+        appendBigEndian(data, (quint64(44100) << 44) | (quint64(1) << 41) | (quint64(15) << 36) | quint64(44100 * durationSeconds), 8);
+        // MD5
+        data.append(QByteArray(16, 0));
+        data.append(QByteArray(16384, 0));
+        return data;
+    }
+
+    QByteArray mp3Stream()
+    {
+        // MPEG-1 Layer III, 128 kbps, 44100 Hz, no CRC, 417 byte frames of 1152 samples
+        QByteArray frame(417, 0);
+        frame[0] = static_cast<char>(0xff);
+        frame[1] = static_cast<char>(0xfb);
+        frame[2] = static_cast<char>(0x90);
+        frame[3] = static_cast<char>(0x00);
+
+        QByteArray data;
+        for (int i = 0, max = 44100 * durationSeconds / 1152; i < max; ++i) {
+            data.append(frame);
+        }
+        return data;
+    }
+
+    quint32 oggCrc(const QByteArray& data)
+    {
+        static const std::vector<quint32> table([]() {
+            std::vector<quint32> table(256);
+            for (quint32 i = 0; i < 256; ++i) {
+                quint32 r = i << 24;
+                for (int j = 0; j < 8; ++j) {
+                    r = (r & 0x80000000) ? ((r << 1) ^ 0x04c11db7) : (r << 1);
+                }
+                table[i] = r;
+            }
+            return table;
+        }());
+
+        quint32 crc = 0;
+        for (const char byte : data) {
+            crc = (crc << 8) ^ table[((crc >> 24) ^ static_cast<quint8>(byte)) & 0xff];
+        }
+        return crc;
+    }
+
+    QByteArray oggPage(int headerType, quint64 granule, quint32 sequence, const std::vector<QByteArray>& packets)
+    {
+        QByteArray segments;
+        QByteArray body;
+        for (const QByteArray& packet : packets) {
+            int size = packet.size();
+            for (; size >= 255; size -= 255) {
+                segments.append(static_cast<char>(255));
+            }
+            segments.append(static_cast<char>(size));
+            body.append(packet);
+        }
+
+        QByteArray page("OggS");
+        page.append(static_cast<char>(0));
+        page.append(static_cast<char>(headerType));
+        appendLittleEndian(page, granule, 8);
+        // Serial number
+        appendLittleEndian(page, 1, 4);
+        appendLittleEndian(page, sequence, 4);
+        // CRC is computed with zero checksum field
+        appendLittleEndian(page, 0, 4);
+        page.append(static_cast<char>(segments.size()));
+        page.append(segments);
+        page.append(body);
+
+        QByteArray crc;
+        appendLittleEndian(crc, oggCrc(page), 4);
+        page.replace(22, 4, crc);
+        return page;
+    }
+
+    QByteArray opusStream()
+    {
+        const int preSkip = 312;
+
+        QByteArray head("OpusHead");
+        head.append(static_cast<char>(1));
+        // Channels
+        head.append(static_cast<char>(2));
+        appendLittleEndian(head, preSkip, 2);
+        // Input sample rate
+        appendLittleEndian(head, 48000, 4);
+        // Output gain and mapping family
+        appendLittleEndian(head, 0, 2);
+        head.append(static_cast<char>(0));
+
+        QByteArray tags("OpusTags");
+        const QByteArray vendor("unplayer-bench-scan");
+        appendLittleEndian(tags, vendor.size(), 4);
+        tags.append(vendor);
+        appendLittleEndian(tags, 0, 4);
+
+        QByteArray audioPacket(100, 0);
+        audioPacket[0] = static_cast<char>(0xfc);
+
+        QByteArray data(oggPage(0x02, 0, 0, {head}));
+        data.append(oggPage(0x00, 0, 1, {tags}));
+        data.append(oggPage(0x04, preSkip + 48000 * durationSeconds, 2, std::vector<QByteArray>(50, audioPacket)));
+        return data;
+    }
+
+    QByteArray mp4Box(const char* type, const QByteArray& payload)
+    {
+        QByteArray box;
+        appendBigEndian(box, 8 + payload.size(), 4);
+        box.append(type, 4);
+        box.append(payload);
+        return box;
+    }
+
+    QByteArray m4aStream()
+    {
+        QByteArray ftyp("M4A ");
+        appendBigEndian(ftyp, 0, 4);
+        ftyp.append("M4A mp42isom");
+
+        QByteArray mvhd;
+        // Version and flags, creation and modification time
+        appendBigEndian(mvhd, 0, 12);
+        // Time scale and duration
+        appendBigEndian(mvhd, 1000, 4);
+        appendBigEndian(mvhd, 1000 * durationSeconds, 4);
+        // Rate, volume and reserved
+        appendBigEndian(mvhd, 0x00010000, 4);
+        appendBigEndian(mvhd, 0x0100, 2);
+        mvhd.append(QByteArray(10, 0));
+        // Unity matrix
+        for (const quint32 value : {0x00010000u, 0u, 0u, 0u, 0x00010000u, 0u, 0u, 0u, 0x40000000u}) {
+            appendBigEndian(mvhd, value, 4);
+        }
+        mvhd.append(QByteArray(24, 0));
+        // Next track id
+        appendBigEndian(mvhd, 2, 4);
+
+        QByteArray mdhd;
+        appendBigEndian(mdhd, 0, 12);
+        appendBigEndian(mdhd, 44100, 4);
+        appendBigEndian(mdhd, 44100 * durationSeconds, 4);
+        // Language and quality
+        appendBigEndian(mdhd, 0x55c4, 2);
+        appendBigEndian(mdhd, 0, 2);
+
+        QByteArray hdlr;
+        appendBigEndian(hdlr, 0, 8);
+        hdlr.append("soun");
+        hdlr.append(QByteArray(13, 0));
+
+        QByteArray data(mp4Box("ftyp", ftyp));
+        data.append(mp4Box("moov", mp4Box("mvhd", mvhd) +
+                                   mp4Box("trak", mp4Box("mdia", mp4Box("mdhd", mdhd) + mp4Box("hdlr", hdlr)))));
+        data.append(mp4Box("mdat", QByteArray(16384, 0)));
+        return data;
+    }
+
+    QByteArray emptyStream(Format format)
+    {
+        switch (format) {
+        case Format::Flac:
+            return flacStream();
+        case Format::Mp3:
+            return mp3Stream();
+        case Format::Opus:
+            return opusStream();
+        case Format::M4a:
+            return m4aStream();
+        }
+        return QByteArray();
+    }
+
+    // Noisy gradient, so that JPEG size is close to real cover of the same resolution
+    QByteArray generateArt(int size, int variant)
+    {
+        QImage image(size, size, QImage::Format_RGB32);
+        std::mt19937 random(static_cast<std::mt19937::result_type>(variant));
+        std::uniform_int_distribution<int> noise(0, 63);
+        const int red = (variant * 53) % 256;
+        const int green = (variant * 97) % 256;
+        const int blue = (variant * 151) % 256;
+        for (int y = 0; y < size; ++y) {
+            QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+            for (int x = 0; x < size; ++x) {
+                line[x] = qRgb((red + x + noise(random)) % 256,
+                               (green + y + noise(random)) % 256,
+                               (blue + noise(random)) % 256);
+            }
+        }
+
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "JPEG", 90);
+        return buffer.data();
+    }
+
+    TagLib::String toTString(const QString& string)
+    {
+        return TagLib::String(string.toStdWString());
+    }
+
+    bool writeTags(const QString& filePath, Format format, const TagLib::PropertyMap& properties, const QByteArray& art)
+    {
+        const QByteArray encodedPath(QFile::encodeName(filePath));
+        const TagLib::ByteVector artData(art.constData(), static_cast<unsigned int>(art.size()));
+
+        switch (format) {
+        case Format::Flac:
+        {
+            TagLib::FLAC::File file(encodedPath.constData(), false);
+            if (!file.isValid()) {
+                return false;
+            }
+            file.setProperties(properties);
+            if (!art.isEmpty()) {
+                auto picture = new TagLib::FLAC::Picture();
+                picture->setType(TagLib::FLAC::Picture::FrontCover);
+                picture->setMimeType("image/jpeg");
+                picture->setData(artData);
+                file.addPicture(picture);
+            }
+            return file.save();
+        }
+        case Format::Mp3:
+        {
+            TagLib::MPEG::File file(encodedPath.constData(), false);
+            if (!file.isValid()) {
+                return false;
+            }
+            TagLib::ID3v2::Tag* tag = file.ID3v2Tag(true);
+            tag->setProperties(properties);
+            if (!art.isEmpty()) {
+                auto frame = new TagLib::ID3v2::AttachedPictureFrame();
+                frame->setType(TagLib::ID3v2::AttachedPictureFrame::FrontCover);
+                frame->setMimeType("image/jpeg");
+                frame->setPicture(artData);
+                tag->addFrame(frame);
+            }
+            return file.save(TagLib::MPEG::File::ID3v2);
+        }
+        case Format::Opus:
+        {
+            TagLib::Ogg::Opus::File file(encodedPath.constData(), false);
+            if (!file.isValid()) {
+                return false;
+            }
+            file.tag()->setProperties(properties);
+            if (!art.isEmpty()) {
+                auto picture = new TagLib::FLAC::Picture();
+                picture->setType(TagLib::FLAC::Picture::FrontCover);
+                picture->setMimeType("image/jpeg");
+                picture->setData(artData);
+                file.tag()->addPicture(picture);
+            }
+            return file.save();
+        }
+        case Format::M4a:
+        {
+            TagLib::MP4::File file(encodedPath.constData(), false);
+            if (!file.isValid()) {
+                return false;
+            }
+            file.tag()->setProperties(properties);
+            if (!art.isEmpty()) {
+                TagLib::MP4::CoverArtList covers;
+                covers.append(TagLib::MP4::CoverArt(TagLib::MP4::CoverArt::JPEG, artData));
+                file.tag()->setItem("covr", covers);
+            }
+            return file.save();
+        }
+        }
+        return false;
+    }
+
+    // Returns paths of generated files
+    QStringList generateLibrary(const Options& options)
+    {
+        QTextStream out(stdout);
+        out << "generating " << options.files << " files in " << options.directory << endl;
+
+        std::map<Format, QByteArray> streams;
+        for (const Format format : options.formats) {
+            streams.emplace(format, emptyStream(format));
+        }
+
+        std::vector<QByteArray> arts;
+        if (options.artSize > 0) {
+            for (int i = 0; i < options.artVariants; ++i) {
+                arts.push_back(generateArt(options.artSize, i));
+            }
+        }
+
+        const int albumsCount = (options.files + tracksPerAlbum - 1) / tracksPerAlbum;
+        const int artistsCount = (albumsCount + albumsPerArtist - 1) / albumsPerArtist;
+
+        QStringList files;
+        files.reserve(options.files);
+        for (int i = 0; i < options.files; ++i) {
+            const int album = i / tracksPerAlbum;
+            const int artist = album / albumsPerArtist;
+            const int trackNumber = i % tracksPerAlbum + 1;
+            const Format format = options.formats[static_cast<size_t>(album) % options.formats.size()];
+            const int year = 1970 + album % 50;
+            // Every fourth album has two discs
+            const int disc = (album % 4 == 0 && trackNumber > tracksPerAlbum / 2) ? 2 : 1;
+
+            const QString title(QString::fromLatin1("Track %1").arg(i));
+            const QString albumTitle(QString::fromLatin1("Album %1").arg(album));
+            const QString artistName(QString::fromLatin1("Artist %1").arg(artist));
+            const QString genre(QString::fromLatin1("Genre %1").arg(album % genresCount));
+
+            TagLib::PropertyMap properties;
+            properties.insert("TITLE", toTString(title));
+            properties.insert("ALBUM", toTString(albumTitle));
+            TagLib::StringList artists(toTString(artistName));
+            // Featured artists
+            if (i % 7 == 0) {
+                artists.append(toTString(QString::fromLatin1("Artist %1").arg((artist + 1) % artistsCount)));
+            }
+            properties.insert("ARTIST", artists);
+            TagLib::StringList genres(toTString(genre));
+            if (album % 3 == 0) {
+                genres.append(toTString(QString::fromLatin1("Genre %1").arg((album + 7) % genresCount)));
+            }
+            properties.insert("GENRE", genres);
+            properties.insert("DATE", TagLib::String::number(year));
+            properties.insert("TRACKNUMBER", TagLib::String::number(trackNumber));
+            properties.insert("DISCNUMBER", TagLib::String::number(disc));
+
+            QString directory;
+            switch (options.layout) {
+            case Layout::Flat:
+                directory = options.directory;
+                break;
+            case Layout::Albums:
+                directory = QString::fromLatin1("%1/%2/%3").arg(options.directory, artistName, albumTitle);
+                break;
+            case Layout::Deep:
+                directory = QString::fromLatin1("%1/%2/%3/%4 - %5/CD %6").arg(options.directory,
+                                                                              genre,
+                                                                              artistName,
+                                                                              QString::number(year),
+                                                                              albumTitle,
+                                                                              QString::number(disc));
+                break;
+            }
+            if (!QDir().mkpath(directory)) {
+                qWarning() << "failed to create directory" << directory;
+                return QStringList();
+            }
+
+            const QString filePath(QString::fromLatin1("%1/%2 %3.%4").arg(directory,
+                                                                         QString::number(i).rightJustified(6, QLatin1Char('0')),
+                                                                         title,
+                                                                         suffix(format)));
+            QFile file(filePath);
+            if (!file.open(QIODevice::WriteOnly) || file.write(streams[format]) < 0) {
+                qWarning() << "failed to write file" << filePath << file.errorString();
+                return QStringList();
+            }
+            file.close();
+
+            if (!writeTags(filePath, format, properties, arts.empty() ? QByteArray() : arts[static_cast<size_t>(album % options.artVariants)])) {
+                qWarning() << "failed to write tags" << filePath;
+                return QStringList();
+            }
+
+            files.push_back(filePath);
+        }
+
+        return files;
+    }
+
+    // Changes title of every n-th file. Files are edited in a copy which replaces
+    // original, like tag editors do, so that modification time of directory changes too
+    int changeFiles(const QStringList& files, double percent)
+    {
+        if (percent <= 0.0) {
+            return 0;
+        }
+
+        const int step = std::max(1, static_cast<int>(100.0 / percent));
+        int changed = 0;
+        for (int i = 0, max = files.size(); i < max; i += step) {
+            const QString& filePath = files[i];
+            const QFileInfo fileInfo(filePath);
+            const QString tempFilePath(QString::fromLatin1("%1/.bench-%2").arg(fileInfo.path(), fileInfo.fileName()));
+            QFile::remove(tempFilePath);
+            if (!QFile::copy(filePath, tempFilePath)) {
+                qWarning() << "failed to copy file" << filePath;
+                continue;
+            }
+
+            {
+                TagLib::FileRef ref(QFile::encodeName(tempFilePath).constData(), false);
+                if (ref.isNull()) {
+                    qWarning() << "failed to open file" << tempFilePath;
+                    QFile::remove(tempFilePath);
+                    continue;
+                }
+                ref.tag()->setTitle(ref.tag()->title() + " (changed)");
+                ref.save();
+            }
+
+            if (!QFile::remove(filePath) || !QFile::rename(tempFilePath, filePath)) {
+                qWarning() << "failed to replace file" << filePath;
+                continue;
+            }
+            ++changed;
+        }
+        return changed;
+    }
+
+    // Resets peak resident set size of process. Returns false if it is not supported
+    bool resetPeakRss()
+    {
+        QFile file(QLatin1String("/proc/self/clear_refs"));
+        return file.open(QIODevice::WriteOnly) && file.write("5") == 1;
+    }
+
+    // In KiB
+    qint64 peakRss()
+    {
+        QFile file(QLatin1String("/proc/self/status"));
+        if (file.open(QIODevice::ReadOnly)) {
+            while (!file.atEnd()) {
+                const QByteArray line(file.readLine());
+                if (line.startsWith("VmHWM:")) {
+                    return line.mid(6).trimmed().split(' ').first().toLongLong();
+                }
+            }
+        }
+
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    PhaseResult runScan()
+    {
+        LibraryUtils* libraryUtils = LibraryUtils::instance();
+
+        QEventLoop loop;
+        QObject::connect(libraryUtils, &LibraryUtils::updatingChanged, &loop, [&loop, libraryUtils]() {
+            if (!libraryUtils->isUpdating()) {
+                loop.quit();
+            }
+        });
+
+        QElapsedTimer timer;
+        timer.start();
+        libraryUtils->updateDatabase();
+        loop.exec();
+
+        return {timer.elapsed(),
+                libraryUtils->scanProcessedFiles(),
+                libraryUtils->scanSkippedFiles(),
+                libraryUtils->scanBytesRead(),
+                peakRss()};
+    }
+
+    bool parseOptions(const QCoreApplication& app, Options& options)
+    {
+        QCommandLineParser parser;
+        parser.setApplicationDescription(QLatin1String("Generates synthetic music library and measures cold, warm and partially changed scans of it"));
+        parser.addHelpOption();
+
+        const QCommandLineOption filesOption(QLatin1String("files"), QLatin1String("Number of generated files"), QLatin1String("count"), QString::number(options.files));
+        const QCommandLineOption formatsOption(QLatin1String("formats"), QLatin1String("Comma separated list of formats: flac, mp3, opus, m4a"), QLatin1String("formats"), QLatin1String("flac,mp3,opus,m4a"));
+        const QCommandLineOption artSizeOption(QLatin1String("art-size"), QLatin1String("Side of embedded media art in pixels, 0 to not embed media art"), QLatin1String("pixels"), QString::number(options.artSize));
+        const QCommandLineOption artVariantsOption(QLatin1String("art-variants"), QLatin1String("Number of distinct embedded media art images"), QLatin1String("count"), QString::number(options.artVariants));
+        const QCommandLineOption layoutOption(QLatin1String("layout"), QLatin1String("Directory layout: flat, albums or deep"), QLatin1String("layout"), QLatin1String("albums"));
+        const QCommandLineOption directoryOption(QLatin1String("directory"), QLatin1String("Directory for generated files, temporary directory is used by default"), QLatin1String("path"));
+        const QCommandLineOption reuseOption(QLatin1String("reuse"), QLatin1String("Don't generate files if directory is not empty"));
+        const QCommandLineOption changedOption(QLatin1String("changed"), QLatin1String("Percent of files changed before last scan"), QLatin1String("percent"), QString::number(options.changedPercent));
+        const QCommandLineOption threadsOption(QLatin1String("threads"), QLatin1String("Library update threads count, 0 to use setting's default"), QLatin1String("count"), QString::number(options.threads));
+        parser.addOptions({filesOption, formatsOption, artSizeOption, artVariantsOption, layoutOption, directoryOption, reuseOption, changedOption, threadsOption});
+        parser.process(app);
+
+        options.files = parser.value(filesOption).toInt();
+        options.artSize = parser.value(artSizeOption).toInt();
+        options.artVariants = std::max(1, parser.value(artVariantsOption).toInt());
+        options.directory = parser.value(directoryOption);
+        options.reuse = parser.isSet(reuseOption);
+        options.changedPercent = parser.value(changedOption).toDouble();
+        options.threads = parser.value(threadsOption).toInt();
+
+        for (const QString& format : parser.value(formatsOption).split(QLatin1Char(','), QString::SkipEmptyParts)) {
+            if (format == QLatin1String("flac")) {
+                options.formats.push_back(Format::Flac);
+            } else if (format == QLatin1String("mp3")) {
+                options.formats.push_back(Format::Mp3);
+            } else if (format == QLatin1String("opus")) {
+                options.formats.push_back(Format::Opus);
+            } else if (format == QLatin1String("m4a")) {
+                options.formats.push_back(Format::M4a);
+            } else {
+                qWarning() << "unknown format" << format;
+                return false;
+            }
+        }
+
+        const QString layout(parser.value(layoutOption));
+        if (layout == QLatin1String("flat")) {
+            options.layout = Layout::Flat;
+        } else if (layout == QLatin1String("albums")) {
+            options.layout = Layout::Albums;
+        } else if (layout == QLatin1String("deep")) {
+            options.layout = Layout::Deep;
+        } else {
+            qWarning() << "unknown layout" << layout;
+            return false;
+        }
+
+        if (options.files <= 0 || options.formats.empty()) {
+            qWarning() << "nothing to generate";
+            return false;
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // Database, media art and settings are kept apart from the ones of the app
+    QStandardPaths::setTestMode(true);
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    const QGuiApplication app(argc, argv);
+
+    Options options;
+    if (!parseOptions(app, options)) {
+        return 1;
+    }
+
+    std::unique_ptr<QTemporaryDir> temporaryDirectory;
+    if (options.directory.isEmpty()) {
+        temporaryDirectory.reset(new QTemporaryDir());
+        if (!temporaryDirectory->isValid()) {
+            qWarning() << "failed to create temporary directory";
+            return 1;
+        }
+        options.directory = temporaryDirectory->path();
+    }
+    options.directory = QFileInfo(options.directory).absoluteFilePath();
+
+    QStringList files;
+    if (options.reuse && !QDir(options.directory).isEmpty()) {
+        QStringList nameFilters;
+        for (const Format format : options.formats) {
+            nameFilters.push_back(QString::fromLatin1("*.%1").arg(suffix(format)));
+        }
+        std::function<void(const QString&)> walk = [&](const QString& directory) {
+            const QDir dir(directory);
+            for (const QFileInfo& info : dir.entryInfoList(nameFilters, QDir::Files, QDir::Name)) {
+                files.push_back(info.filePath());
+            }
+            for (const QFileInfo& info : dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name)) {
+                walk(info.filePath());
+            }
+        };
+        walk(options.directory);
+    } else {
+        QElapsedTimer timer;
+        timer.start();
+        files = generateLibrary(options);
+        if (files.isEmpty()) {
+            return 1;
+        }
+        QTextStream(stdout) << "generated in " << timer.elapsed() << " ms" << endl;
+    }
+
+    bench::resetLocations();
+
+    Settings* settings = Settings::instance();
+    settings->setLibraryDirectories({options.directory});
+    settings->setBlacklistedDirectories({});
+    if (options.threads > 0) {
+        settings->setLibraryUpdateThreadsCount(options.threads);
+    }
+
+    if (!bench::waitForDatabase()) {
+        return 1;
+    }
+
+    const bool perPhaseRss = resetPeakRss();
+
+    QTextStream out(stdout);
+    const auto report = [&](const char* phase, const PhaseResult& result) {
+        const double seconds = result.elapsed / 1000.0;
+        out << QString::fromLatin1("%1 %2 s, %3 files/s, %4 processed, %5 skipped, %6 MiB read, peak RSS %7 MiB")
+               .arg(QString::fromLatin1(phase), -14)
+               .arg(seconds, 8, 'f', 2)
+               .arg(seconds > 0.0 ? files.size() / seconds : 0.0, 10, 'f', 0)
+               .arg(result.processedFiles, 7)
+               .arg(result.skippedFiles, 7)
+               .arg(result.bytesRead / (1024.0 * 1024.0), 0, 'f', 1)
+               .arg(result.peakRss / 1024.0, 0, 'f', 1)
+            << endl;
+        resetPeakRss();
+    };
+
+    report("cold", runScan());
+    report("warm", runScan());
+
+    // Stop watching library while files are changed, otherwise watcher would update them
+    settings->setLibraryDirectories({});
+    const int changed = changeFiles(files, options.changedPercent);
+    settings->setLibraryDirectories({options.directory});
+    out << "changed " << changed << " files" << endl;
+    report("changed", runScan());
+
+    if (!perPhaseRss) {
+        out << "peak RSS can't be reset, it is measured since process start" << endl;
+    }
+
+    return 0;
+}
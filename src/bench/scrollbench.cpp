@@ -0,0 +1,394 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <QAbstractEventDispatcher>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QQmlContext>
+#include <QQmlEngine>
+#include <QQmlExpression>
+#include <QQuickItem>
+#include <QQuickView>
+#include <QSqlDatabase>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTimer>
+
+#include <sailfishapp.h>
+
+#include "artimageprovider.h"
+#include "benchutils.h"
+#include "libraryutils.h"
+#include "player.h"
+#include "queue.h"
+#include "settings.h"
+#include "utils.h"
+
+using namespace unplayer;
+
+// Loads list pages in QQuickView with synthetic library, media art and queue, flings
+// their list views and records frame intervals and how busy main thread was.
+// Results are printed as JSON with percentiles
+
+namespace
+{
+    const int mediaArtSize = 256;
+
+    // Different image for each album, so that every delegate decodes its own
+    bool createMediaArt(const QString& filePath, int album)
+    {
+        QImage image(mediaArtSize, mediaArtSize, QImage::Format_RGB32);
+        image.fill(QColor::fromHsv(album * 37 % 360, 160, 200));
+        QPainter painter(&image);
+        painter.drawText(image.rect(), Qt::AlignCenter, QString::number(album));
+        painter.end();
+        if (!image.save(filePath, "JPEG", 85)) {
+            qWarning() << "failed to save media art" << filePath;
+            return false;
+        }
+        return true;
+    }
+
+    // Creates empty track files, media art of every album and adds them to library
+    bool fillLibrary(const QString& root, int count, QStringList& files)
+    {
+        const QString mediaArtDirectory(root + QLatin1String("/art"));
+        if (!QDir().mkpath(mediaArtDirectory)) {
+            qWarning() << "failed to create directory" << mediaArtDirectory;
+            return false;
+        }
+
+        if (!bench::createTrackFiles(root + QLatin1String("/tracks"), 0, count, files)) {
+            return false;
+        }
+
+        bench::TracksInserter inserter(QSqlDatabase::database());
+        bool ok = true;
+        QString mediaArt;
+        for (int i = 0; ok && i < count; ++i) {
+            bench::SyntheticTrack track(i);
+            if (i % bench::tracksPerAlbum == 0) {
+                mediaArt = QString::fromLatin1("%1/%2.jpg").arg(mediaArtDirectory).arg(track.album);
+                ok = createMediaArt(mediaArt, track.album);
+            }
+            track.filePath = files[i];
+            track.modificationTime = QFileInfo(track.filePath).lastModified().toMSecsSinceEpoch();
+            track.mediaArt = mediaArt;
+            ok = ok && inserter.add(track);
+        }
+        if (!inserter.finish(ok)) {
+            return false;
+        }
+
+        emit LibraryUtils::instance()->databaseChanged();
+        return true;
+    }
+
+    // Processes events until condition is true or timeout expires
+    bool waitFor(const std::function<bool()>& condition, int timeout)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        while (!condition()) {
+            if (timer.elapsed() > timeout) {
+                return false;
+            }
+            QEventLoop loop;
+            QTimer::singleShot(10, &loop, &QEventLoop::quit);
+            loop.exec();
+        }
+        return true;
+    }
+
+    QQuickItem* findListView(QQuickItem* item)
+    {
+        for (QQuickItem* child : item->childItems()) {
+            if (child->inherits("QQuickListView") || child->inherits("QQuickGridView")) {
+                return child;
+            }
+            if (QQuickItem* found = findListView(child)) {
+                return found;
+            }
+        }
+        return nullptr;
+    }
+
+    // Frame intervals and main thread busy time while flinging. Frames are swapped
+    // on render thread, main thread is busy between waking up and going to sleep
+    class Recorder final
+    {
+    public:
+        explicit Recorder(QQuickView* view)
+            : mRecording(false),
+              mLastFrame(-1),
+              mStarted(0),
+              mAwake(-1),
+              mBusy(0)
+        {
+            mTimer.start();
+            QObject::connect(view, &QQuickWindow::frameSwapped, view, [=]() {
+                const QMutexLocker locker(&mFramesMutex);
+                const qint64 now = mTimer.nsecsElapsed();
+                if (mRecording && mLastFrame >= 0) {
+                    mFrameIntervals.push_back((now - mLastFrame) / 1000000.0);
+                }
+                mLastFrame = now;
+            }, Qt::DirectConnection);
+
+            QAbstractEventDispatcher* dispatcher = QAbstractEventDispatcher::instance();
+            QObject::connect(dispatcher, &QAbstractEventDispatcher::awake, view, [=]() {
+                if (mAwake < 0) {
+                    mAwake = mTimer.nsecsElapsed();
+                }
+            }, Qt::DirectConnection);
+            QObject::connect(dispatcher, &QAbstractEventDispatcher::aboutToBlock, view, [=]() {
+                if (mAwake >= 0) {
+                    if (mRecording) {
+                        mBusy += mTimer.nsecsElapsed() - mAwake;
+                    }
+                    mAwake = -1;
+                }
+            }, Qt::DirectConnection);
+        }
+
+        void start()
+        {
+            {
+                const QMutexLocker locker(&mFramesMutex);
+                mFrameIntervals.clear();
+                mLastFrame = -1;
+                mRecording = true;
+            }
+            mBusy = 0;
+            mAwake = mTimer.nsecsElapsed();
+            mStarted = mTimer.nsecsElapsed();
+        }
+
+        QJsonObject stop()
+        {
+            const qint64 total = mTimer.nsecsElapsed() - mStarted;
+            std::vector<double> intervals;
+            {
+                const QMutexLocker locker(&mFramesMutex);
+                mRecording = false;
+                intervals.swap(mFrameIntervals);
+            }
+            const int janky = std::count_if(intervals.begin(), intervals.end(), [](double interval) {
+                return interval > 1000.0 / 60.0 * 1.5;
+            });
+            return {{QLatin1String("durationMs"), total / 1000000.0},
+                    {QLatin1String("frameMs"), bench::percentiles(std::move(intervals))},
+                    {QLatin1String("jankyFrames"), janky},
+                    {QLatin1String("mainThreadBusyPercent"), total > 0 ? mBusy * 100.0 / total : 0.0}};
+        }
+
+    private:
+        QElapsedTimer mTimer;
+        QMutex mFramesMutex;
+        bool mRecording;
+        std::vector<double> mFrameIntervals;
+        qint64 mLastFrame;
+        qint64 mStarted;
+        qint64 mAwake;
+        qint64 mBusy;
+    };
+
+    QJsonObject measurePage(QQuickView* view, Recorder& recorder, const QString& name, const QString& page, int flings, double velocity)
+    {
+        QJsonObject result{{QLatin1String("page"), name}};
+
+        QQmlExpression push(view->engine()->rootContext(),
+                            view->rootObject(),
+                            QString::fromLatin1("pageStack.push(Qt.resolvedUrl(\"components/%1\"), {}, PageStackAction.Immediate)").arg(page));
+        QElapsedTimer timer;
+        timer.start();
+        auto pageItem = qobject_cast<QQuickItem*>(push.evaluate().value<QObject*>());
+        if (push.hasError() || !pageItem) {
+            qWarning() << "failed to push page" << page << push.error();
+            result.insert(QLatin1String("error"), QLatin1String("push"));
+            return result;
+        }
+
+        QQuickItem* listView = findListView(pageItem);
+        if (!listView) {
+            qWarning() << "no list view on page" << page;
+            result.insert(QLatin1String("error"), QLatin1String("listView"));
+            return result;
+        }
+
+        // Page is ready when list view has rows and model stopped loading them
+        int lastCount = -1;
+        waitFor([&]() {
+            const int count = listView->property("count").toInt();
+            const bool stable = (count > 0 && count == lastCount);
+            lastCount = count;
+            return stable;
+        }, 60000);
+        result.insert(QLatin1String("loadMs"), bench::elapsedMs(timer));
+        result.insert(QLatin1String("rows"), listView->property("count").toInt());
+
+        recorder.start();
+        double direction = -1.0;
+        for (int i = 0; i < flings; ++i) {
+            if ((direction < 0.0 && listView->property("atYEnd").toBool()) ||
+                (direction > 0.0 && listView->property("atYBeginning").toBool())) {
+                direction = -direction;
+            }
+            QMetaObject::invokeMethod(listView, "flick", Q_ARG(qreal, 0.0), Q_ARG(qreal, direction * velocity));
+            waitFor([&]() { return !listView->property("moving").toBool(); }, 10000);
+        }
+        result.insert(QLatin1String("flings"), flings);
+        result.insert(QLatin1String("scroll"), recorder.stop());
+
+        QQmlExpression pop(view->engine()->rootContext(), view->rootObject(), QLatin1String("pageStack.pop(null, PageStackAction.Immediate)"));
+        pop.evaluate();
+        // Let destroyed page and its models go away before next one
+        waitFor([]() { return false; }, 500);
+
+        return result;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // Database, settings and queue are kept apart from the ones of the app
+    QStandardPaths::setTestMode(true);
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    const std::unique_ptr<QGuiApplication> app(SailfishApp::application(argc, argv));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QLatin1String("Measures frame times of scrolling list pages with synthetic library, "
+                                                   "results are printed as JSON. Set QT_QPA_PLATFORM to measure on screen"));
+    parser.addHelpOption();
+    const QCommandLineOption tracksOption(QLatin1String("tracks"), QLatin1String("Number of tracks in library and queue"), QLatin1String("count"), QLatin1String("100000"));
+    const QCommandLineOption flingsOption(QLatin1String("flings"), QLatin1String("Number of flings on each page"), QLatin1String("count"), QLatin1String("20"));
+    const QCommandLineOption velocityOption(QLatin1String("velocity"), QLatin1String("Velocity of flings"), QLatin1String("pixels/s"), QLatin1String("5000"));
+    const QCommandLineOption outputOption(QLatin1String("output"), QLatin1String("Write results to file instead of standard output"), QLatin1String("path"));
+    parser.addOptions({tracksOption, flingsOption, velocityOption, outputOption});
+    parser.process(*app);
+
+    const int tracks = parser.value(tracksOption).toInt();
+    if (tracks <= 0) {
+        qWarning() << "invalid number of tracks" << parser.value(tracksOption);
+        return 1;
+    }
+    const int flings = std::max(1, parser.value(flingsOption).toInt());
+    const double velocity = std::max(100.0, parser.value(velocityOption).toDouble());
+
+    // Start with empty database, queue and settings
+    bench::resetLocations({QStandardPaths::DataLocation, QStandardPaths::CacheLocation, QStandardPaths::ConfigLocation});
+
+    const QTemporaryDir root;
+    if (!root.isValid()) {
+        qWarning() << "failed to create temporary directory";
+        return 1;
+    }
+
+    Settings* settings = Settings::instance();
+    settings->setLibraryDirectories({root.path() + QLatin1String("/tracks")});
+    settings->setDefaultDirectory(root.path() + QLatin1String("/tracks/0"));
+    settings->setRestorePlayerState(false);
+
+    if (!bench::waitForDatabase()) {
+        return 1;
+    }
+
+    qDebug() << "filling library with" << tracks << "tracks";
+    QStringList files;
+    if (!fillLibrary(root.path(), tracks, files)) {
+        return 1;
+    }
+
+    Queue* queue = Player::instance()->queue();
+    queue->addTracksFromUrls(files, true);
+    waitFor([queue]() { return !queue->isAddingTracks(); }, 600000);
+
+    const std::unique_ptr<QQuickView> view(SailfishApp::createView());
+    view->rootContext()->setContextProperty(QLatin1String("commandLineArguments"), QStringList());
+    Utils::registerTypes();
+    view->engine()->addImageProvider(QueueImageProvider::providerId, new QueueImageProvider(queue));
+    view->engine()->addImageProvider(ArtImageProvider::providerId, new ArtImageProvider(LibraryUtils::instance()->mediaArtDirectory()));
+    view->setSource(SailfishApp::pathTo(QLatin1String("qml/main.qml")));
+    if (view->status() != QQuickView::Ready) {
+        qWarning() << "failed to load QML" << view->errors();
+        return 1;
+    }
+    view->show();
+
+    Recorder recorder(view.get());
+
+    struct Page
+    {
+        const char* name;
+        const char* file;
+    };
+    const Page pages[] = {{"artists", "ArtistsPage.qml"},
+                          {"albums", "AllAlbumsPage.qml"},
+                          {"tracks", "TracksPage.qml"},
+                          {"queue", "QueuePage.qml"},
+                          {"directories", "DirectoriesPage.qml"}};
+
+    QJsonArray results;
+    for (const Page& page : pages) {
+        qDebug() << "measuring" << page.name;
+        results.push_back(measurePage(view.get(), recorder, QLatin1String(page.name), QLatin1String(page.file), flings, velocity));
+    }
+
+    const QByteArray json(QJsonDocument(QJsonObject{{QLatin1String("tracks"), tracks},
+                                                    {QLatin1String("flings"), flings},
+                                                    {QLatin1String("velocity"), velocity},
+                                                    {QLatin1String("platform"), QGuiApplication::platformName()},
+                                                    {QLatin1String("results"), results}}).toJson());
+
+    const QString outputPath(parser.value(outputOption));
+    if (outputPath.isEmpty()) {
+        QFile output;
+        output.open(stdout, QIODevice::WriteOnly);
+        output.write(json);
+    } else {
+        QFile output(outputPath);
+        if (!output.open(QIODevice::WriteOnly) || output.write(json) < 0) {
+            qWarning() << "failed to write results to" << outputPath << output.errorString();
+            return 1;
+        }
+    }
+
+    return 0;
+}
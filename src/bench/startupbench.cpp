@@ -0,0 +1,332 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QSqlDatabase>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTimer>
+
+#include "benchutils.h"
+#include "queue.h"
+#include "settings.h"
+
+using namespace unplayer;
+
+// Launches the app repeatedly with libraries of different sizes and saved queues of
+// different lengths, with cold and warm page cache, and collects startup phases it
+// reports with --profile-startup. Data of the app is redirected to temporary directory
+// with XDG environment variables. Results are printed as JSON
+
+namespace
+{
+    const char* const phases[] = {"first frame", "library counts", "queue restored"};
+
+    // Creates empty files for tracks in range [first, last) and adds them to library
+    bool addTracks(const QString& directory, int first, int last, QStringList& files)
+    {
+        const int offset = files.size();
+        if (!bench::createTrackFiles(directory, first, last, files)) {
+            return false;
+        }
+
+        bench::TracksInserter inserter(QSqlDatabase::database());
+        for (int i = first; i < last; ++i) {
+            bench::SyntheticTrack track(i);
+            track.filePath = files[offset + i - first];
+            track.modificationTime = QFileInfo(track.filePath).lastModified().toMSecsSinceEpoch();
+            if (!inserter.add(track)) {
+                break;
+            }
+        }
+        return inserter.finish();
+    }
+
+    bool saveQueue(const QStringList& files, int length)
+    {
+        Queue queue(nullptr);
+        queue.addTracksFromUrls(files.mid(0, length), true);
+        if (queue.isAddingTracks()) {
+            QEventLoop loop;
+            QObject::connect(&queue, &Queue::addingTracksChanged, &loop, [&]() {
+                if (!queue.isAddingTracks()) {
+                    loop.quit();
+                }
+            });
+            loop.exec();
+        }
+        if (static_cast<int>(queue.tracks().size()) != length) {
+            qWarning() << "failed to fill queue with" << length << "tracks";
+            return false;
+        }
+        queue.saveSnapshot();
+        return true;
+    }
+
+    void evictFile(const QString& filePath)
+    {
+        const int fd = open(QFile::encodeName(filePath).constData(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+
+    // Drops whole page cache if we are allowed to, otherwise evicts files that the app
+    // reads on startup: its data, its executable and QML files
+    QString dropPageCache(const QStringList& paths)
+    {
+        sync();
+        QFile dropCaches(QLatin1String("/proc/sys/vm/drop_caches"));
+        if (dropCaches.open(QIODevice::WriteOnly) && dropCaches.write("3\n") > 0) {
+            return QLatin1String("dropCaches");
+        }
+        for (const QString& path : paths) {
+            if (QFileInfo(path).isDir()) {
+                QDirIterator iterator(path, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+                while (iterator.hasNext()) {
+                    evictFile(iterator.next());
+                }
+            } else {
+                evictFile(path);
+            }
+        }
+        return QLatin1String("fadvise");
+    }
+
+    // Launches the app and returns time of every phase it reported, until all
+    // phases that are measured are reported or timeout expires
+    std::map<QString, double> launch(const QString& program, const QProcessEnvironment& environment, int timeout)
+    {
+        static const QRegularExpression phaseRegex(QLatin1String("startup: (.+) in (\\d+) ms"));
+
+        std::map<QString, double> times;
+        QProcess process;
+        process.setProcessEnvironment(environment);
+        process.setProcessChannelMode(QProcess::MergedChannels);
+
+        QEventLoop loop;
+        QObject::connect(&process, &QProcess::readyRead, &loop, [&]() {
+            while (process.canReadLine()) {
+                const QRegularExpressionMatch match(phaseRegex.match(QString::fromLocal8Bit(process.readLine())));
+                if (match.hasMatch()) {
+                    times.emplace(match.captured(1), match.captured(2).toDouble());
+                }
+            }
+            if (std::all_of(std::begin(phases), std::end(phases), [&](const char* phase) { return times.count(QLatin1String(phase)) > 0; })) {
+                loop.quit();
+            }
+        });
+        QObject::connect(&process, static_cast<void(QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished), &loop, &QEventLoop::quit);
+        QTimer::singleShot(timeout, &loop, &QEventLoop::quit);
+
+        process.start(program, {QLatin1String("--profile-startup")});
+        loop.exec();
+
+        if (process.state() == QProcess::NotRunning) {
+            qWarning() << "app exited before reporting all phases, is another instance running?";
+        } else {
+            process.terminate();
+            if (!process.waitForFinished(5000)) {
+                process.kill();
+                process.waitForFinished();
+            }
+        }
+        return times;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // App and its data are created in temporary directory, which is passed to the app
+    const QTemporaryDir root;
+    if (!root.isValid()) {
+        qWarning() << "failed to create temporary directory";
+        return 1;
+    }
+    const QString dataHome(root.path() + QLatin1String("/data"));
+    const QString cacheHome(root.path() + QLatin1String("/cache"));
+    const QString configHome(root.path() + QLatin1String("/config"));
+    qputenv("XDG_DATA_HOME", QFile::encodeName(dataHome));
+    qputenv("XDG_CACHE_HOME", QFile::encodeName(cacheHome));
+    qputenv("XDG_CONFIG_HOME", QFile::encodeName(configHome));
+
+    // Environment of the app is captured before we are switched to offscreen platform
+    const QProcessEnvironment environment(QProcessEnvironment::systemEnvironment());
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication app(argc, argv);
+    // Same locations as the app
+    app.setOrganizationName(QLatin1String("harbour-unplayer"));
+    app.setApplicationName(QLatin1String("harbour-unplayer"));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QLatin1String("Measures startup phases of the app with synthetic libraries and queues, "
+                                                   "results are printed as JSON"));
+    parser.addHelpOption();
+    const QCommandLineOption appOption(QLatin1String("app"), QLatin1String("Path to the app"), QLatin1String("path"), QLatin1String("/usr/bin/harbour-unplayer"));
+    const QCommandLineOption tracksOption(QLatin1String("tracks"), QLatin1String("Comma separated list of library sizes"), QLatin1String("counts"), QLatin1String("1000,10000,100000"));
+    const QCommandLineOption queueOption(QLatin1String("queue"), QLatin1String("Comma separated list of saved queue lengths"), QLatin1String("counts"), QLatin1String("0,1000,10000"));
+    const QCommandLineOption repeatOption(QLatin1String("repeat"), QLatin1String("Number of launches in each state"), QLatin1String("count"), QLatin1String("5"));
+    const QCommandLineOption timeoutOption(QLatin1String("timeout"), QLatin1String("Time to wait for all phases of one launch"), QLatin1String("milliseconds"), QLatin1String("60000"));
+    const QCommandLineOption outputOption(QLatin1String("output"), QLatin1String("Write results to file instead of standard output"), QLatin1String("path"));
+    parser.addOptions({appOption, tracksOption, queueOption, repeatOption, timeoutOption, outputOption});
+    parser.process(app);
+
+    const auto parseCounts = [](const QString& value, bool allowZero, std::vector<int>& counts) {
+        for (const QString& string : value.split(QLatin1Char(','), QString::SkipEmptyParts)) {
+            bool ok;
+            const int count = string.toInt(&ok);
+            if (!ok || count < 0 || (count == 0 && !allowZero)) {
+                qWarning() << "invalid count" << string;
+                return false;
+            }
+            counts.push_back(count);
+        }
+        std::sort(counts.begin(), counts.end());
+        counts.erase(std::unique(counts.begin(), counts.end()), counts.end());
+        return !counts.empty();
+    };
+    std::vector<int> sizes;
+    std::vector<int> queueLengths;
+    if (!parseCounts(parser.value(tracksOption), false, sizes) || !parseCounts(parser.value(queueOption), true, queueLengths)) {
+        return 1;
+    }
+    const QString program(QFileInfo(parser.value(appOption)).absoluteFilePath());
+    if (!QFileInfo(program).isExecutable()) {
+        qWarning() << "app is not found" << program;
+        return 1;
+    }
+    const int repeat = std::max(1, parser.value(repeatOption).toInt());
+    const int timeout = std::max(1000, parser.value(timeoutOption).toInt());
+
+    const QString tracksDirectory(root.path() + QLatin1String("/tracks"));
+    Settings* settings = Settings::instance();
+    settings->setLibraryDirectories({tracksDirectory});
+    settings->setRestorePlayerState(true);
+
+    if (!bench::waitForDatabase()) {
+        return 1;
+    }
+
+    // Files read by the app on startup, evicted for cold launches
+    const QStringList startupFiles{program,
+                                   dataHome,
+                                   cacheHome,
+                                   configHome,
+                                   QFileInfo(program).absolutePath() + QLatin1String("/../share/harbour-unplayer")};
+
+    QJsonArray results;
+    QString dropMethod;
+    QStringList files;
+    int tracks = 0;
+    for (const int size : sizes) {
+        qDebug() << "filling library with" << size << "tracks";
+        if (!addTracks(tracksDirectory, tracks, size, files)) {
+            return 1;
+        }
+        tracks = size;
+        // Snapshot is outdated now, it is saved again by the app on first launch
+        QFile::remove(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QLatin1String("/library-snapshot"));
+
+        for (const int queueLength : queueLengths) {
+            if (queueLength > size) {
+                continue;
+            }
+            if (!saveQueue(files, queueLength)) {
+                return 1;
+            }
+            // App saves snapshot of library on first launch, which is not measured
+            launch(program, environment, timeout);
+
+            for (const bool cold : {true, false}) {
+                qDebug() << "launching with" << size << "tracks," << queueLength << "tracks in queue," << (cold ? "cold" : "warm");
+                if (!cold) {
+                    launch(program, environment, timeout);
+                }
+
+                std::map<QString, std::vector<double>> samples;
+                int failed = 0;
+                for (int i = 0; i < repeat; ++i) {
+                    if (cold) {
+                        dropMethod = dropPageCache(startupFiles);
+                    }
+                    const std::map<QString, double> times(launch(program, environment, timeout));
+                    if (times.empty()) {
+                        ++failed;
+                    }
+                    for (const auto& phase : times) {
+                        samples[phase.first].push_back(phase.second);
+                    }
+                }
+
+                QJsonObject phasesObject;
+                for (auto& phase : samples) {
+                    phasesObject.insert(phase.first, bench::percentiles(std::move(phase.second)));
+                }
+                results.push_back(QJsonObject{{QLatin1String("tracks"), size},
+                                              {QLatin1String("queue"), queueLength},
+                                              {QLatin1String("pageCache"), cold ? QLatin1String("cold") : QLatin1String("warm")},
+                                              {QLatin1String("failedLaunches"), failed},
+                                              {QLatin1String("phasesMs"), phasesObject}});
+            }
+        }
+    }
+
+    const QByteArray json(QJsonDocument(QJsonObject{{QLatin1String("repeat"), repeat},
+                                                    {QLatin1String("app"), program},
+                                                    {QLatin1String("coldCacheMethod"), dropMethod},
+                                                    {QLatin1String("results"), results}}).toJson());
+
+    const QString outputPath(parser.value(outputOption));
+    if (outputPath.isEmpty()) {
+        QFile output;
+        output.open(stdout, QIODevice::WriteOnly);
+        output.write(json);
+    } else {
+        QFile output(outputPath);
+        if (!output.open(QIODevice::WriteOnly) || output.write(json) < 0) {
+            qWarning() << "failed to write results to" << outputPath << output.errorString();
+            return 1;
+        }
+    }
+
+    return 0;
+}
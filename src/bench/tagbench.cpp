@@ -0,0 +1,237 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMimeDatabase>
+#include <QTextStream>
+
+#include "benchutils.h"
+#include "libraryutils.h"
+#include "tagutils.h"
+
+using namespace unplayer;
+
+// Reads tags of audio files in directory with different read profiles and reports
+// latency percentiles per file type, with bytes and read syscalls from /proc/self/io.
+// Tags parsing time is the difference between "without media art" and "properties" profiles
+
+namespace
+{
+    struct Profile
+    {
+        const char* name;
+        tagutils::ReadProfile profile;
+    };
+
+    const std::vector<Profile> profiles{{"full", tagutils::ReadProfile::Full},
+                                        {"fast", tagutils::ReadProfile::Fast},
+                                        {"no-media-art", tagutils::ReadProfile::FullWithoutMediaArt},
+                                        {"properties", tagutils::ReadProfile::PropertiesOnly},
+                                        {"media-art", tagutils::ReadProfile::MediaArtOnly}};
+
+    const char* mimeTypeName(MimeType mimeType)
+    {
+        switch (mimeType) {
+        case MimeType::Flac:
+            return "flac";
+        case MimeType::Mp4:
+            return "mp4";
+        case MimeType::Mp4b:
+            return "mp4b";
+        case MimeType::Mpeg:
+            return "mpeg";
+        case MimeType::VorbisOgg:
+            return "vorbis-ogg";
+        case MimeType::FlacOgg:
+            return "flac-ogg";
+        case MimeType::OpusOgg:
+            return "opus-ogg";
+        case MimeType::Ape:
+            return "ape";
+        case MimeType::Matroska:
+            return "matroska";
+        case MimeType::Wav:
+            return "wav";
+        case MimeType::Wavpack:
+            return "wavpack";
+        case MimeType::Other:
+            break;
+        }
+        return "other";
+    }
+
+    struct IoCounters
+    {
+        qint64 bytes = 0;
+        qint64 syscalls = 0;
+    };
+
+    // Characters read and read syscalls of process, including page cache hits
+    IoCounters ioCounters()
+    {
+        IoCounters counters;
+        QFile file(QLatin1String("/proc/self/io"));
+        if (file.open(QIODevice::ReadOnly)) {
+            for (const QByteArray& line : file.readAll().split('\n')) {
+                if (line.startsWith("rchar:")) {
+                    counters.bytes = line.mid(6).trimmed().toLongLong();
+                } else if (line.startsWith("syscr:")) {
+                    counters.syscalls = line.mid(6).trimmed().toLongLong();
+                }
+            }
+        }
+        return counters;
+    }
+
+    struct Samples
+    {
+        std::vector<double> times;
+        qint64 bytes = 0;
+        qint64 syscalls = 0;
+        int mediaArtFiles = 0;
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    const QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QLatin1String("Measures reading of tags of audio files in directory"));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QLatin1String("directory"), QLatin1String("Directory with audio files, scanned recursively"));
+    const QCommandLineOption warmupOption(QLatin1String("warmup"), QLatin1String("Read all files once before measuring, so that they are in page cache"));
+    const QCommandLineOption passesOption(QLatin1String("passes"), QLatin1String("Number of times each file is read with each profile"), QLatin1String("count"), QLatin1String("1"));
+    parser.addOptions({warmupOption, passesOption});
+    parser.process(app);
+
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(1);
+    }
+    const int passes = std::max(1, parser.value(passesOption).toInt());
+
+    QTextStream out(stdout);
+
+    const QMimeDatabase mimeDb;
+    std::vector<std::pair<QFileInfo, MimeType>> files;
+    QDirIterator iterator(parser.positionalArguments().first(), QDir::Files | QDir::Readable, QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
+    while (iterator.hasNext()) {
+        iterator.next();
+        const QFileInfo fileInfo(iterator.fileInfo());
+        const MimeType mimeType = audioTypeForFile(fileInfo, mimeDb);
+        if (mimeType != MimeType::Other) {
+            files.emplace_back(fileInfo, mimeType);
+        }
+    }
+    out << "found " << files.size() << " audio files" << endl;
+    if (files.empty()) {
+        return 1;
+    }
+
+    if (parser.isSet(warmupOption)) {
+        for (const auto& file : files) {
+            tagutils::getTrackInfo(file.first, file.second, tagutils::ReadProfile::Full);
+        }
+    }
+
+    // Reading /proc/self/io is counted too
+    const IoCounters overhead([]() {
+        const IoCounters first(ioCounters());
+        const IoCounters second(ioCounters());
+        IoCounters counters;
+        counters.bytes = second.bytes - first.bytes;
+        counters.syscalls = second.syscalls - first.syscalls;
+        return counters;
+    }());
+
+    // Profile index -> mime type -> samples
+    std::vector<std::map<MimeType, Samples>> results(profiles.size());
+
+    // Each profile reads all files before the next one, so that they don't warm cache for each other
+    for (std::size_t i = 0; i < profiles.size(); ++i) {
+        const Profile& profile = profiles[i];
+        for (int pass = 0; pass < passes; ++pass) {
+            for (const auto& file : files) {
+                Samples& samples = results[i][file.second];
+
+                const IoCounters before(ioCounters());
+                QElapsedTimer timer;
+                timer.start();
+                const tagutils::Info info(tagutils::getTrackInfo(file.first, file.second, profile.profile));
+                const double time = timer.nsecsElapsed() / 1000000.0;
+                const IoCounters after(ioCounters());
+
+                samples.times.push_back(time);
+                samples.bytes += after.bytes - before.bytes - overhead.bytes;
+                samples.syscalls += after.syscalls - before.syscalls - overhead.syscalls;
+                if (!info.mediaArtData.isEmpty()) {
+                    ++samples.mediaArtFiles;
+                }
+            }
+        }
+    }
+
+    out << endl
+        << QString::fromLatin1("%1 %2 %3 %4 %5 %6 %7 %8 %9")
+           .arg(QLatin1String("type"), -11)
+           .arg(QLatin1String("profile"), -13)
+           .arg(QLatin1String("files"), 7)
+           .arg(QLatin1String("p50 ms"), 9)
+           .arg(QLatin1String("p90 ms"), 9)
+           .arg(QLatin1String("p99 ms"), 9)
+           .arg(QLatin1String("max ms"), 9)
+           .arg(QLatin1String("KiB/file"), 10)
+           .arg(QLatin1String("reads/file"), 11)
+        << endl;
+
+    std::map<MimeType, bool> mimeTypes;
+    for (const auto& file : files) {
+        mimeTypes[file.second] = true;
+    }
+    for (const auto& mimeType : mimeTypes) {
+        for (std::size_t i = 0; i < profiles.size(); ++i) {
+            Samples& samples = results[i][mimeType.first];
+            std::sort(samples.times.begin(), samples.times.end());
+            const double count = samples.times.size();
+            out << QString::fromLatin1("%1 %2 %3 %4 %5 %6 %7 %8 %9")
+                   .arg(QLatin1String(mimeTypeName(mimeType.first)), -11)
+                   .arg(QLatin1String(profiles[i].name), -13)
+                   .arg(samples.times.size() / passes, 7)
+                   .arg(bench::percentile(samples.times, 50), 9, 'f', 3)
+                   .arg(bench::percentile(samples.times, 90), 9, 'f', 3)
+                   .arg(bench::percentile(samples.times, 99), 9, 'f', 3)
+                   .arg(bench::percentile(samples.times, 100), 9, 'f', 3)
+                   .arg(samples.bytes / count / 1024.0, 10, 'f', 1)
+                   .arg(samples.syscalls / count, 11, 'f', 1)
+                << endl;
+        }
+    }
+
+    return 0;
+}
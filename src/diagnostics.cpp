@@ -0,0 +1,241 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "diagnostics.h"
+
+#include <functional>
+
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QQmlEngine>
+#include <QSqlDatabase>
+#include <QThreadPool>
+
+#include "artimageprovider.h"
+#include "libraryutils.h"
+#include "player.h"
+#include "queue.h"
+#include "sqlquery.h"
+#include "threadpools.h"
+#include "utils.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        // Slowest queries by total time
+        const std::size_t maxQueries = 10;
+        // Directories from last scan with most time spent and most errors
+        const int maxDirectories = 10;
+
+        QVariantMap entry(const QString& section, const QString& name, const QString& value)
+        {
+            return {{QStringLiteral("section"), section},
+                    {QStringLiteral("name"), name},
+                    {QStringLiteral("value"), value}};
+        }
+
+        QString percent(qint64 part, qint64 total)
+        {
+            return QString::fromLatin1("%1%").arg(total > 0 ? (part * 100.0 / total) : 0.0, 0, 'f', 1);
+        }
+
+        QString msecs(qint64 nsecs)
+        {
+            return QString::fromLatin1("%1 ms").arg(nsecs / 1000000.0, 0, 'f', 1);
+        }
+
+        // Runs on thread pool
+        QVariantList storageEntries(const QString& databaseFilePath, const QString& mediaArtDirectory)
+        {
+            QVariantList entries;
+
+            const QString database(QLatin1String("Database"));
+            qint64 databaseSize = 0;
+            for (const QLatin1String suffix : {QLatin1String(""), QLatin1String("-wal"), QLatin1String("-shm")}) {
+                databaseSize += QFileInfo(databaseFilePath + suffix).size();
+            }
+            entries.push_back(entry(database, QLatin1String("Size"), Utils::formatByteSize(databaseSize)));
+
+            const QSqlDatabase db(LibraryUtils::threadDatabase());
+            if (db.isOpen()) {
+                // Full-text search shadow tables are skipped
+                SqlQuery query(QLatin1String("SELECT name FROM sqlite_master WHERE type = 'table' "
+                                             "AND name NOT LIKE 'sqlite_%' AND name NOT LIKE 'tracks_search_%' "
+                                             "ORDER BY name"), db);
+                QStringList tables;
+                while (query.next()) {
+                    tables.push_back(query.value(0).toString());
+                }
+                for (const QString& table : tables) {
+                    SqlQuery countQuery(QString::fromLatin1("SELECT COUNT(*) FROM %1").arg(table), db);
+                    if (countQuery.next()) {
+                        entries.push_back(entry(database, table, countQuery.value(0).toString()));
+                    }
+                }
+
+                const std::pair<QLatin1String, QLatin1String> directoriesQueries[] = {
+                    {QLatin1String("Slowest directories"), QLatin1String("ORDER BY time DESC")},
+                    {QLatin1String("Directories with parse errors"), QLatin1String("WHERE errors > 0 ORDER BY errors DESC")}
+                };
+                for (const auto& directories : directoriesQueries) {
+                    SqlQuery directoriesQuery(QString::fromLatin1("SELECT directory, examinedFiles, parsedFiles, bytesRead, time, errors "
+                                                                  "FROM scanStatistics %1 LIMIT %2").arg(directories.second).arg(maxDirectories), db);
+                    while (directoriesQuery.next()) {
+                        entries.push_back(entry(directories.first,
+                                                directoriesQuery.value(0).toString(),
+                                                QString::fromLatin1("%1 ms, %2 of %3 files parsed, %4 read, %5 errors")
+                                                .arg(directoriesQuery.value(4).toLongLong())
+                                                .arg(directoriesQuery.value(2).toInt())
+                                                .arg(directoriesQuery.value(1).toInt())
+                                                .arg(Utils::formatByteSize(directoriesQuery.value(3).toLongLong()))
+                                                .arg(directoriesQuery.value(5).toInt())));
+                    }
+                }
+            }
+
+            qint64 mediaArtSize = 0;
+            int mediaArtFiles = 0;
+            QDirIterator iterator(mediaArtDirectory, QDir::Files);
+            while (iterator.hasNext()) {
+                iterator.next();
+                mediaArtSize += iterator.fileInfo().size();
+                ++mediaArtFiles;
+            }
+            const QString mediaArt(QLatin1String("Media art"));
+            entries.push_back(entry(mediaArt, QLatin1String("Files"), QString::number(mediaArtFiles)));
+            entries.push_back(entry(mediaArt, QLatin1String("Size"), Utils::formatByteSize(mediaArtSize)));
+
+            return entries;
+        }
+    }
+
+    Diagnostics::Diagnostics(QObject* parent)
+        : QObject(parent),
+          mLoading(false)
+    {
+    }
+
+    const QVariantList& Diagnostics::entries() const
+    {
+        return mEntries;
+    }
+
+    bool Diagnostics::isLoading() const
+    {
+        return mLoading;
+    }
+
+    void Diagnostics::refresh()
+    {
+        if (mLoading) {
+            return;
+        }
+
+        mEntries.clear();
+
+        const QString imageCache(QLatin1String("Queue image cache"));
+        const QQmlEngine* engine = qmlEngine(this);
+        if (engine) {
+            const auto provider = static_cast<QueueImageProvider*>(engine->imageProvider(QueueImageProvider::providerId));
+            if (provider) {
+                const QueueImageProvider::CacheStatistics cache(provider->cacheStatistics());
+                mEntries.push_back(entry(imageCache, QLatin1String("Images"), QString::number(cache.images)));
+                mEntries.push_back(entry(imageCache, QLatin1String("Size"), Utils::formatByteSize(cache.bytes)));
+                mEntries.push_back(entry(imageCache, QLatin1String("Hit rate"), QString::fromLatin1("%1 (%2 of %3)")
+                                         .arg(percent(cache.hits, cache.hits + cache.misses))
+                                         .arg(cache.hits)
+                                         .arg(cache.hits + cache.misses)));
+            }
+
+            const auto artProvider = static_cast<ArtImageProvider*>(engine->imageProvider(ArtImageProvider::providerId));
+            if (artProvider) {
+                const QString artCache(QLatin1String("Media art cache"));
+                const ArtImageProvider::CacheStatistics cache(artProvider->cacheStatistics());
+                mEntries.push_back(entry(artCache, QLatin1String("Images"), QString::number(cache.images)));
+                mEntries.push_back(entry(artCache, QLatin1String("Size"), Utils::formatByteSize(cache.bytes)));
+                mEntries.push_back(entry(artCache, QLatin1String("Hit rate"), QString::fromLatin1("%1 (%2 of %3)")
+                                         .arg(percent(cache.hits, cache.hits + cache.misses))
+                                         .arg(cache.hits)
+                                         .arg(cache.hits + cache.misses)));
+                mEntries.push_back(entry(artCache, QLatin1String("Shared decodes"), QString::number(cache.shared)));
+            }
+        }
+
+        const Queue* queue = Player::instance()->queue();
+        const QString queueSection(QLatin1String("Queue"));
+        mEntries.push_back(entry(queueSection, QLatin1String("Tracks"), QString::number(queue->tracks().size())));
+        mEntries.push_back(entry(queueSection, QLatin1String("Memory"), Utils::formatByteSize(queue->memoryUsage())));
+
+        const QString threads(QLatin1String("Thread pools"));
+        for (const auto& pool : {std::make_pair(QLatin1String("Interactive"), threadpools::JobClass::Interactive),
+                                 std::make_pair(QLatin1String("Bulk"), threadpools::JobClass::Bulk),
+                                 std::make_pair(QLatin1String("Scan"), threadpools::JobClass::Scan)}) {
+            const QThreadPool* threadPool = threadpools::pool(pool.second);
+            mEntries.push_back(entry(threads, pool.first, QString::fromLatin1("%1 of %2 threads busy")
+                                     .arg(threadPool->activeThreadCount())
+                                     .arg(threadPool->maxThreadCount())));
+        }
+
+        LibraryUtils* libraryUtils = LibraryUtils::instance();
+        const QString scan(libraryUtils->isUpdating() ? QLatin1String("Running scan") : QLatin1String("Last scan"));
+        const qint64 scanDuration = libraryUtils->scanDuration();
+        mEntries.push_back(entry(scan, QLatin1String("Duration"), QString::fromLatin1("%1 s").arg(scanDuration / 1000.0, 0, 'f', 1)));
+        mEntries.push_back(entry(scan, QLatin1String("Discovered files"), QString::number(libraryUtils->scanDiscoveredFiles())));
+        mEntries.push_back(entry(scan, QLatin1String("Processed files"), QString::number(libraryUtils->scanProcessedFiles())));
+        mEntries.push_back(entry(scan, QLatin1String("Skipped files"), QString::number(libraryUtils->scanSkippedFiles())));
+        mEntries.push_back(entry(scan, QLatin1String("Files per second"), QString::number(libraryUtils->scanFilesPerSecond(), 'f', 1)));
+        mEntries.push_back(entry(scan, QLatin1String("Read"), QString::fromLatin1("%1 (%2/s)")
+                                 .arg(Utils::formatByteSize(libraryUtils->scanBytesRead()))
+                                 .arg(Utils::formatByteSize(scanDuration > 0 ? (libraryUtils->scanBytesRead() * 1000.0 / scanDuration) : 0.0))));
+
+        const QString queries(QLatin1String("Slowest queries"));
+        std::vector<SqlQuery::Statistics> statistics(SqlQuery::statistics());
+        if (statistics.size() > maxQueries) {
+            statistics.resize(maxQueries);
+        }
+        for (const SqlQuery::Statistics& query : statistics) {
+            mEntries.push_back(entry(queries, query.query, QString::fromLatin1("%1 total, %2 max, %3 executions, %4 rows")
+                                     .arg(msecs(query.total))
+                                     .arg(msecs(query.max))
+                                     .arg(query.executions)
+                                     .arg(query.rows)));
+        }
+
+        emit entriesChanged();
+
+        mLoading = true;
+        emit loadingChanged();
+
+        using Watcher = QFutureWatcher<QVariantList>;
+        auto watcher = new Watcher(this);
+        QObject::connect(watcher, &Watcher::finished, this, [=]() {
+            const QVariantList storage(watcher->result());
+            // Storage is shown first
+            mEntries = storage + mEntries;
+            mLoading = false;
+            emit entriesChanged();
+            emit loadingChanged();
+            watcher->deleteLater();
+        });
+        watcher->setFuture(threadpools::run(threadpools::JobClass::Interactive,
+                                            std::bind(storageEntries, libraryUtils->databaseFilePath(), libraryUtils->mediaArtDirectory())));
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_DIAGNOSTICS_H
+#define UNPLAYER_DIAGNOSTICS_H
+
+#include <QObject>
+#include <QVariantList>
+
+namespace unplayer
+{
+    // Statistics of database, caches, memory and background work shown on diagnostics page.
+    // Entries are maps with section, name and value strings
+    class Diagnostics final : public QObject
+    {
+        Q_OBJECT
+        Q_PROPERTY(QVariantList entries READ entries NOTIFY entriesChanged)
+        Q_PROPERTY(bool loading READ isLoading NOTIFY loadingChanged)
+    public:
+        explicit Diagnostics(QObject* parent = nullptr);
+
+        const QVariantList& entries() const;
+        bool isLoading() const;
+
+        // In-memory statistics are collected immediately, database and
+        // media art directory are read in background
+        Q_INVOKABLE void refresh();
+
+    private:
+        QVariantList mEntries;
+        bool mLoading;
+
+    signals:
+        void entriesChanged();
+        void loadingChanged();
+    };
+}
+
+#endif // UNPLAYER_DIAGNOSTICS_H
@@ -19,17 +19,50 @@
 #include "directorycontentmodel.h"
 
 #include <QDir>
+#include <QDirIterator>
 #include <QFutureWatcher>
 #include <QStandardPaths>
-#include <QtConcurrentRun>
+
+#include "directorylistingcache.h"
+#include "directorymediaartcache.h"
+#include "threadpools.h"
 
 namespace unplayer
 {
+    namespace
+    {
+        std::vector<DirectoryContentFile> filesFromEntries(const QString& directory,
+                                                           const std::vector<DirectoryListingCache::Entry>& entries,
+                                                           bool showFiles,
+                                                           const QStringList& nameFilters)
+        {
+            std::vector<DirectoryContentFile> files;
+            for (const DirectoryListingCache::Entry& entry : entries) {
+                // Name filters are not applied to directories
+                if (!entry.isDirectory && (!showFiles || (!nameFilters.isEmpty() && !QDir::match(nameFilters, entry.name)))) {
+                    continue;
+                }
+                QString filePath(DirectoryListingCache::filePath(directory, entry.name));
+                // Unreadable directories are still shown when files are not
+                if (showFiles && !DirectoryListingCache::isReadable(filePath)) {
+                    continue;
+                }
+                files.push_back({std::move(filePath),
+                                 entry.name,
+                                 entry.isDirectory,
+                                 QString()});
+            }
+            return files;
+        }
+    }
+
     DirectoryContentModel::DirectoryContentModel()
         : mComponentCompleted(false),
           mDirectory(QStandardPaths::writableLocation(QStandardPaths::HomeLocation)),
           mShowFiles(true),
-          mLoading(false)
+          mLoading(false),
+          mLoad(this),
+          mMediaArtLoad(this)
     {
         QDir dir(mDirectory);
         dir.cdUp();
@@ -56,6 +89,8 @@ namespace unplayer
             return file.name;
         case IsDirectoryRole:
             return file.isDirectory;
+        case MediaArtRole:
+            return file.mediaArt;
         }
         return QVariant();
     }
@@ -128,48 +163,117 @@ namespace unplayer
     {
         return {{FilePathRole, "filePath"},
                 {NameRole, "name"},
-                {IsDirectoryRole, "isDirectory"}};
+                {IsDirectoryRole, "isDirectory"},
+                {MediaArtRole, "mediaArt"}};
     }
 
     void DirectoryContentModel::loadDirectory()
     {
+        const int generation = mLoad.start();
+        mMediaArtLoad.cancel();
+
         mLoading = true;
         emit loadingChanged();
 
-        beginRemoveRows(QModelIndex(), 0, mFiles.size() - 1);
-        mFiles.clear();
-        endRemoveRows();
+        if (!mFiles.empty()) {
+            beginRemoveRows(QModelIndex(), 0, mFiles.size() - 1);
+            mFiles.clear();
+            endRemoveRows();
+        }
 
         const QString directory(mDirectory);
         const QStringList nameFilters(mNameFilters);
-        QDir::Filters filters = QDir::AllDirs | QDir::NoDotAndDotDot;
-        if (mShowFiles) {
-            filters |= QDir::Files | QDir::Readable;
+        const bool showFiles = mShowFiles;
+
+        const DirectoryListingCache::Listing cached(DirectoryListingCache::instance().listing(directory));
+        if (cached) {
+            setFiles(filesFromEntries(directory, *cached, showFiles, nameFilters));
+            return;
         }
 
-        auto future = QtConcurrent::run([=]() {
-            std::vector<DirectoryContentFile> files;
-            const QList<QFileInfo> fileInfos(QDir(directory).entryInfoList(nameFilters, filters));
-            files.reserve(fileInfos.size());
-            for (const QFileInfo& info : fileInfos) {
-                files.push_back({info.filePath(),
-                                 info.fileName(),
-                                 info.isDir()});
+        const LatestLoad::Token token(mLoad.token());
+        auto future = threadpools::run(threadpools::JobClass::Interactive, [=]() {
+            const long long modificationTime = DirectoryListingCache::modificationTime(directory);
+            std::vector<DirectoryListingCache::Entry> entries;
+            QDirIterator iterator(directory, QDir::AllEntries | QDir::NoDotAndDotDot);
+            while (iterator.hasNext()) {
+                if (token->load()) {
+                    return std::vector<DirectoryContentFile>();
+                }
+                iterator.next();
+                const QFileInfo info(iterator.fileInfo());
+                entries.push_back({info.fileName(), info.isDir()});
             }
+            std::vector<DirectoryContentFile> files(filesFromEntries(directory, entries, showFiles, nameFilters));
+            DirectoryListingCache::instance().add(directory, modificationTime, std::move(entries));
             return files;
         });
 
         using FutureWatcher = QFutureWatcher<std::vector<DirectoryContentFile>>;
         auto watcher = new FutureWatcher(this);
+        mLoad.setWatcher(generation, watcher);
         QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
-            std::vector<DirectoryContentFile> files(watcher->result());
+            mLoad.finish(generation);
+            setFiles(watcher->result());
+            watcher->deleteLater();
+        });
+        watcher->setFuture(future);
+    }
+
+    void DirectoryContentModel::setFiles(std::vector<DirectoryContentFile>&& files)
+    {
+        if (!files.empty()) {
             beginInsertRows(QModelIndex(), 0, files.size() - 1);
             mFiles = std::move(files);
             endInsertRows();
+        }
 
-            mLoading = false;
-            emit loadingChanged();
+        mLoading = false;
+        emit loadingChanged();
+
+        loadDirectoriesMediaArt();
+    }
+
+    void DirectoryContentModel::loadDirectoriesMediaArt()
+    {
+        std::vector<DirectoryMediaArtCache::Cover> directories;
+        for (int row = 0, count = static_cast<int>(mFiles.size()); row < count; ++row) {
+            const DirectoryContentFile& file = mFiles[row];
+            if (file.isDirectory) {
+                directories.push_back({row, file.filePath, QString()});
+            }
+        }
+        if (directories.empty()) {
+            return;
+        }
+
+        using Watcher = QFutureWatcher<DirectoryMediaArtCache::CoversBatch>;
+        auto watcher = new Watcher(this);
+        const int generation = mMediaArtLoad.start(watcher);
+        QObject::connect(watcher, &Watcher::resultsReadyAt, this, [=](int beginIndex, int endIndex) {
+            std::vector<int> changed;
+            for (int i = beginIndex; i < endIndex; ++i) {
+                for (const DirectoryMediaArtCache::Cover& cover : watcher->resultAt(i)) {
+                    mFiles[cover.row].mediaArt = cover.url;
+                    changed.push_back(cover.row);
+                }
+            }
+
+            // One signal for each contiguous range of rows
+            const QVector<int> roles{MediaArtRole};
+            for (auto i = changed.begin(), end = changed.end(); i != end;) {
+                const int first = *i;
+                int last = first;
+                for (++i; i != end && *i == last + 1; ++i) {
+                    last = *i;
+                }
+                emit dataChanged(index(first), index(last), roles);
+            }
         });
-        watcher->setFuture(future);
+        QObject::connect(watcher, &Watcher::finished, this, [=]() {
+            mMediaArtLoad.finish(generation);
+            watcher->deleteLater();
+        });
+        watcher->setFuture(DirectoryMediaArtCache::loadCovers(std::move(directories)));
     }
 }
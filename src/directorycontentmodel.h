@@ -22,6 +22,8 @@
 #include <QAbstractListModel>
 #include <QQmlParserStatus>
 
+#include "latestload.h"
+
 namespace unplayer
 {
     struct DirectoryContentFile
@@ -29,6 +31,8 @@ namespace unplayer
         QString filePath;
         QString name;
         bool isDirectory;
+        // Cover of directory, found in background
+        QString mediaArt;
     };
 
     class DirectoryContentModel : public QAbstractListModel, public QQmlParserStatus
@@ -45,7 +49,8 @@ namespace unplayer
         {
             FilePathRole,
             NameRole,
-            IsDirectoryRole
+            IsDirectoryRole,
+            MediaArtRole
         };
         Q_ENUM(Role)
 
@@ -74,6 +79,8 @@ namespace unplayer
 
     private:
         void loadDirectory();
+        void setFiles(std::vector<DirectoryContentFile>&& files);
+        void loadDirectoriesMediaArt();
 
         bool mComponentCompleted;
         std::vector<DirectoryContentFile> mFiles;
@@ -83,6 +90,8 @@ namespace unplayer
         QStringList mNameFilters;
 
         bool mLoading;
+        LatestLoad mLoad;
+        LatestLoad mMediaArtLoad;
     signals:
         void directoryChanged();
         void loadingChanged();
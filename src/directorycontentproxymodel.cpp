@@ -12,13 +12,8 @@ namespace unplayer
         mIsDirectoryRole = isDirectoryRole;
     }
 
-    bool DirectoryContentProxyModel::lessThan(const QModelIndex& left, const QModelIndex& right) const
+    int DirectoryContentProxyModel::sortGroup(int sourceRow) const
     {
-        const bool leftIsDirectory = left.data(mIsDirectoryRole).toBool();
-        const bool rightIsDirectory = right.data(mIsDirectoryRole).toBool();
-        if (leftIsDirectory != rightIsDirectory) {
-            return leftIsDirectory;
-        }
-        return FilterProxyModel::lessThan(left, right);
+        return sourceModel()->index(sourceRow, 0).data(mIsDirectoryRole).toBool() ? 0 : 1;
     }
 }
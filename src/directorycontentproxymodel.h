@@ -32,7 +32,8 @@ namespace unplayer
         void setIsDirectoryRole(int isDirectoryRole);
 
     protected:
-        bool lessThan(const QModelIndex& left, const QModelIndex& right) const override;
+        // Directories are placed before files
+        int sortGroup(int sourceRow) const override;
 
     private:
         int mIsDirectoryRole = 0;
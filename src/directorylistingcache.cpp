@@ -0,0 +1,120 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "directorylistingcache.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QMutexLocker>
+
+#include "perfcounters.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        const std::size_t maxListingsCount = 32;
+
+        // Directories changed more recently than that are not cached, since another
+        // change within resolution of modification time would not be noticed
+        const long long minListingAge = 2000;
+    }
+
+    DirectoryListingCache& DirectoryListingCache::instance()
+    {
+        static DirectoryListingCache cache;
+        return cache;
+    }
+
+    long long DirectoryListingCache::modificationTime(const QString& directory)
+    {
+        const QFileInfo info(directory);
+        if (!info.isDir()) {
+            return -1;
+        }
+        return info.lastModified().toMSecsSinceEpoch();
+    }
+
+    QString DirectoryListingCache::filePath(const QString& directory, const QString& name)
+    {
+        if (directory.endsWith(QLatin1Char('/'))) {
+            return directory + name;
+        }
+        return directory + QLatin1Char('/') + name;
+    }
+
+    bool DirectoryListingCache::isReadable(const QString& filePath)
+    {
+        return QFileInfo(filePath).isReadable();
+    }
+
+    DirectoryListingCache::Listing DirectoryListingCache::listing(const QString& directory)
+    {
+        const long long time = modificationTime(directory);
+
+        QMutexLocker locker(&mMutex);
+        const auto found(mListings.find(directory));
+        if (found == mListings.end()) {
+            perfcounters::add(perfcounters::DirectoryListingCacheMisses);
+            return nullptr;
+        }
+        if (time == -1 || found->second.modificationTime != time) {
+            perfcounters::add(perfcounters::DirectoryListingCacheMisses);
+            mRecent.erase(found->second.recent);
+            mListings.erase(found);
+            return nullptr;
+        }
+        perfcounters::add(perfcounters::DirectoryListingCacheHits);
+        mRecent.splice(mRecent.begin(), mRecent, found->second.recent);
+        return found->second.entries;
+    }
+
+    void DirectoryListingCache::add(const QString& directory, long long modificationTime, std::vector<Entry>&& entries)
+    {
+        if (modificationTime == -1 ||
+                DirectoryListingCache::modificationTime(directory) != modificationTime ||
+                QDateTime::currentMSecsSinceEpoch() - modificationTime < minListingAge) {
+            return;
+        }
+
+        Listing listing(std::make_shared<const std::vector<Entry>>(std::move(entries)));
+
+        QMutexLocker locker(&mMutex);
+        const auto found(mListings.find(directory));
+        if (found != mListings.end()) {
+            found->second.modificationTime = modificationTime;
+            found->second.entries = std::move(listing);
+            mRecent.splice(mRecent.begin(), mRecent, found->second.recent);
+            return;
+        }
+
+        mRecent.push_front(directory);
+        mListings.insert({directory, CachedListing{modificationTime, std::move(listing), mRecent.begin()}});
+        if (mListings.size() > maxListingsCount) {
+            mListings.erase(mRecent.back());
+            mRecent.pop_back();
+        }
+    }
+
+    void DirectoryListingCache::clear()
+    {
+        QMutexLocker locker(&mMutex);
+        mListings.clear();
+        mRecent.clear();
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_DIRECTORYLISTINGCACHE_H
+#define UNPLAYER_DIRECTORYLISTINGCACHE_H
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <QMutex>
+#include <QString>
+
+#include "stdutils.h"
+
+namespace unplayer
+{
+    // Recently listed directories, shared by directory models so that
+    // going back to a directory doesn't list it again.
+    // Listing is used only while modification time of directory doesn't change.
+    // Permissions of files are not cached since changing them doesn't change
+    // modification time of directory, they are checked when entries are used
+    class DirectoryListingCache final
+    {
+    public:
+        struct Entry
+        {
+            QString name;
+            bool isDirectory;
+        };
+        using Listing = std::shared_ptr<const std::vector<Entry>>;
+
+        static DirectoryListingCache& instance();
+
+        static long long modificationTime(const QString& directory);
+        static QString filePath(const QString& directory, const QString& name);
+        static bool isReadable(const QString& filePath);
+
+        // Returns nullptr if directory is not cached or has changed since it was listed
+        Listing listing(const QString& directory);
+
+        // modificationTime must be taken before directory was listed.
+        // Listing is not stored if directory was changed during listing,
+        // or so recently that next change may have the same modification time
+        void add(const QString& directory, long long modificationTime, std::vector<Entry>&& entries);
+
+        void clear();
+
+    private:
+        DirectoryListingCache() = default;
+
+        struct CachedListing
+        {
+            long long modificationTime;
+            Listing entries;
+            std::list<QString>::iterator recent;
+        };
+
+        QMutex mMutex;
+        std::unordered_map<QString, CachedListing> mListings;
+        // Most recently used first
+        std::list<QString> mRecent;
+    };
+}
+
+#endif // UNPLAYER_DIRECTORYLISTINGCACHE_H
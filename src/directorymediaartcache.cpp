@@ -0,0 +1,199 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "directorymediaartcache.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QFutureInterface>
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QSqlDatabase>
+#include <QRunnable>
+#include <QSqlError>
+
+#include "artimageprovider.h"
+#include "libraryutils.h"
+#include "perfcounters.h"
+#include "sqlquery.h"
+#include "threadpools.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        QString findMediaArt(const QString& directoryPath)
+        {
+            const QDir dir(directoryPath);
+            const QStringList found(dir.entryList(QDir::Files | QDir::Readable)
+                                    .filter(QRegularExpression(QStringLiteral("^(albumart.*|cover|folder|front)\\.(jpeg|jpg|png)$"),
+                                                               QRegularExpression::CaseInsensitiveOption)));
+            if (found.isEmpty()) {
+                return QString();
+            }
+            return dir.filePath(found.first());
+        }
+
+        // First batch is small so that covers of visible rows are shown quickly
+        const std::size_t firstCoversBatchSize = 20;
+        const std::size_t coversBatchSize = 100;
+
+        class CoversRunnable final : public QRunnable
+        {
+        public:
+            explicit CoversRunnable(std::vector<DirectoryMediaArtCache::Cover>&& directories)
+                : mDirectories(std::move(directories))
+            {
+                mFutureInterface.reportStarted();
+            }
+
+            QFuture<DirectoryMediaArtCache::CoversBatch> future()
+            {
+                return mFutureInterface.future();
+            }
+
+            void run() override
+            {
+                DirectoryMediaArtCache& cache = DirectoryMediaArtCache::instance();
+                DirectoryMediaArtCache::CoversBatch batch;
+                std::size_t batchSize = firstCoversBatchSize;
+                for (DirectoryMediaArtCache::Cover& directory : mDirectories) {
+                    if (mFutureInterface.isCanceled()) {
+                        break;
+                    }
+                    directory.url = ArtImageProvider::url(cache.mediaArt(directory.directoryPath));
+                    // Rows without cover don't change
+                    if (!directory.url.isEmpty()) {
+                        batch.push_back(std::move(directory));
+                    }
+                    if (batch.size() >= batchSize) {
+                        mFutureInterface.reportResult(std::move(batch));
+                        batch = DirectoryMediaArtCache::CoversBatch();
+                        batchSize = coversBatchSize;
+                    }
+                }
+                if (!batch.empty()) {
+                    mFutureInterface.reportResult(std::move(batch));
+                }
+                mFutureInterface.reportFinished();
+            }
+
+        private:
+            QFutureInterface<DirectoryMediaArtCache::CoversBatch> mFutureInterface;
+            std::vector<DirectoryMediaArtCache::Cover> mDirectories;
+        };
+    }
+
+    DirectoryMediaArtCache& DirectoryMediaArtCache::instance()
+    {
+        static DirectoryMediaArtCache cache;
+        return cache;
+    }
+
+    QString DirectoryMediaArtCache::mediaArt(const QString& directoryPath)
+    {
+        const long long modificationTime = QFileInfo(directoryPath).lastModified().toMSecsSinceEpoch();
+        {
+            QMutexLocker locker(&mMutex);
+            if (!mLoaded) {
+                load();
+            }
+            const auto found(mEntries.find(directoryPath));
+            if (found != mEntries.end() && found->second.modificationTime == modificationTime) {
+                perfcounters::add(perfcounters::DirectoryMediaArtCacheHits);
+                return found->second.mediaArt;
+            }
+        }
+        perfcounters::add(perfcounters::DirectoryMediaArtCacheMisses);
+
+        // Don't hold the lock while listing directory.
+        // Several threads may list the same directory, but result is the same
+        QString mediaArt(findMediaArt(directoryPath));
+
+        QMutexLocker locker(&mMutex);
+        mEntries[directoryPath] = {modificationTime, mediaArt};
+        mChangedDirectories.insert(directoryPath);
+        return mediaArt;
+    }
+
+    QFuture<DirectoryMediaArtCache::CoversBatch> DirectoryMediaArtCache::loadCovers(std::vector<Cover> directories)
+    {
+        auto runnable = new CoversRunnable(std::move(directories));
+        QFuture<CoversBatch> future(runnable->future());
+        threadpools::start(threadpools::JobClass::Interactive, runnable);
+        return future;
+    }
+
+    void DirectoryMediaArtCache::save(const QSqlDatabase& db)
+    {
+        QMutexLocker locker(&mMutex);
+        if (mChangedDirectories.empty()) {
+            return;
+        }
+
+        SqlQuery query(db);
+        query.prepare(QStringLiteral("INSERT OR REPLACE INTO directoryMediaArt (path, modificationTime, mediaArt) VALUES (?, ?, ?)"));
+        for (const QString& directory : mChangedDirectories) {
+            const Entry& entry = mEntries[directory];
+            query.bindValue(0, directory);
+            query.bindValue(1, entry.modificationTime);
+            // Empty if directory doesn't have media art
+            query.bindValue(2, entry.mediaArt.isNull() ? QLatin1String("") : entry.mediaArt);
+            if (!query.exec()) {
+                qWarning() << "failed to save directory media art" << query.lastError();
+                return;
+            }
+        }
+        mChangedDirectories.clear();
+    }
+
+    void DirectoryMediaArtCache::clear()
+    {
+        QMutexLocker locker(&mMutex);
+        mEntries.clear();
+        mChangedDirectories.clear();
+        mLoaded = true;
+    }
+
+    DirectoryMediaArtCache::DirectoryMediaArtCache()
+        : mLoaded(false)
+    {
+    }
+
+    void DirectoryMediaArtCache::load()
+    {
+        // Directories browsed before database is opened are listed,
+        // saved entries are loaded on next call
+        const QSqlDatabase db(LibraryUtils::threadDatabase());
+        if (!db.isOpen()) {
+            return;
+        }
+        mLoaded = true;
+
+        SqlQuery query(QLatin1String("SELECT path, modificationTime, mediaArt FROM directoryMediaArt"), db);
+        if (query.lastError().type() != QSqlError::NoError) {
+            qWarning() << "failed to load directory media art" << query.lastError();
+            return;
+        }
+        while (query.next()) {
+            mEntries.insert({query.value(0).toString(), {query.value(1).toLongLong(), query.value(2).toString()}});
+        }
+    }
+}
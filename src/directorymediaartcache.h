@@ -0,0 +1,83 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_DIRECTORYMEDIAARTCACHE_H
+#define UNPLAYER_DIRECTORYMEDIAARTCACHE_H
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <QFuture>
+#include <QMutex>
+#include <QString>
+
+#include "stdutils.h"
+
+class QSqlDatabase;
+
+namespace unplayer
+{
+    // Cover images of directories, shared by library updater and queue.
+    // Directory is listed again only when its modification time changes.
+    // Results are stored in the database and loaded on first use
+    class DirectoryMediaArtCache final
+    {
+    public:
+        static DirectoryMediaArtCache& instance();
+
+        // Returns path of cover image in directory, or empty string
+        QString mediaArt(const QString& directoryPath);
+
+        struct Cover
+        {
+            // Row of directory in model, checked against directoryPath when result is applied
+            int row;
+            QString directoryPath;
+            // ArtImageProvider URL, empty if directory doesn't have cover
+            QString url;
+        };
+        using CoversBatch = std::vector<Cover>;
+
+        // Finds covers of directories on worker thread. Results are reported
+        // in batches, so that models can update rows in contiguous ranges
+        static QFuture<CoversBatch> loadCovers(std::vector<Cover> directories);
+
+        // Writes entries that have changed since they were loaded. Must be called in transaction
+        void save(const QSqlDatabase& db);
+        // Database table is cleared by caller
+        void clear();
+
+    private:
+        DirectoryMediaArtCache();
+        void load();
+
+        struct Entry
+        {
+            long long modificationTime;
+            QString mediaArt;
+        };
+
+        QMutex mMutex;
+        bool mLoaded;
+        std::unordered_map<QString, Entry> mEntries;
+        std::unordered_set<QString> mChangedDirectories;
+    };
+}
+
+#endif // UNPLAYER_DIRECTORYMEDIAARTCACHE_H
@@ -18,24 +18,384 @@
 
 #include "directorytracksmodel.h"
 
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
-#include <QFile>
+#include <QDirIterator>
+#include <QFutureInterface>
 #include <QFutureWatcher>
-#include <QItemSelectionModel>
+#include <QMimeDatabase>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QStandardPaths>
 #include <QSqlDatabase>
 #include <QSqlError>
-#include <QSqlQuery>
+#include <QThread>
+#include <QThreadPool>
 #include <QtConcurrentRun>
 
+#include "artimageprovider.h"
+#include "batchesrunnable.h"
+#include "directorylistingcache.h"
+#include "directorymediaartcache.h"
+#include "fileutils.h"
+#include "jobmanager.h"
 #include "libraryutils.h"
 #include "playlistutils.h"
 #include "settings.h"
+#include "sqlquery.h"
 #include "stdutils.h"
+#include "tagutils.h"
+#include "threadpools.h"
 
 namespace unplayer
 {
+    namespace
+    {
+        // First batch is small so that directory is shown quickly
+        const std::size_t firstFilesBatchSize = 100;
+        const std::size_t filesBatchSize = 1000;
+
+        // Tags of files outside of library are reported in batches of this size
+        const std::size_t metadataBatchSize = 50;
+        // Parsed tags of files outside of library are kept until there are this many of them
+        const std::size_t maxParsedTagsCount = 4096;
+
+        using FilesBatch = std::vector<DirectoryTrackFile>;
+        using FilesFutureInterface = QFutureInterface<FilesBatch>;
+        using FilesFutureWatcher = QFutureWatcher<FilesBatch>;
+
+        struct FileMetadata
+        {
+            // Row when load was started, checked against file path when result is applied
+            int row;
+            QString filePath;
+            QString title;
+            QString artist;
+            int duration;
+        };
+
+        using MetadataBatch = std::vector<FileMetadata>;
+        using MetadataFutureInterface = QFutureInterface<MetadataBatch>;
+        using MetadataFutureWatcher = QFutureWatcher<MetadataBatch>;
+
+        using FilesRunnable = BatchesRunnable<FilesBatch>;
+        using MetadataRunnable = BatchesRunnable<MetadataBatch>;
+
+        // Tags of files outside of library that were parsed by previous loads,
+        // so that going back to directory doesn't parse them again
+        class ParsedTagsCache final
+        {
+        public:
+            static ParsedTagsCache& instance()
+            {
+                static ParsedTagsCache cache;
+                return cache;
+            }
+
+            bool find(const QString& filePath, long long modificationTime, FileMetadata& metadata)
+            {
+                const QMutexLocker locker(&mMutex);
+                const auto found(mTags.find(filePath));
+                if (found == mTags.end() || found->second.first != modificationTime) {
+                    return false;
+                }
+                metadata.title = found->second.second.title;
+                metadata.artist = found->second.second.artist;
+                metadata.duration = found->second.second.duration;
+                return true;
+            }
+
+            void add(long long modificationTime, const FileMetadata& metadata)
+            {
+                const QMutexLocker locker(&mMutex);
+                if (mTags.size() >= maxParsedTagsCount) {
+                    mTags.clear();
+                }
+                mTags[metadata.filePath] = {modificationTime, metadata};
+            }
+
+        private:
+            QMutex mMutex;
+            std::unordered_map<QString, std::pair<long long, FileMetadata>> mTags;
+        };
+
+        FileMetadata parseFileMetadata(const FileMetadata& file, const QFileInfo& fileInfo, long long modificationTime)
+        {
+            const tagutils::Info info(tagutils::getTrackInfo(fileInfo,
+                                                             audioTypeForFile(fileInfo, QMimeDatabase()),
+                                                             tagutils::ReadProfile::FastWithoutMediaArt));
+            FileMetadata metadata(file);
+            metadata.title = info.title;
+            metadata.artist = LibraryUtils::displayString(info.artists);
+            metadata.duration = info.duration;
+            ParsedTagsCache::instance().add(modificationTime, metadata);
+            return metadata;
+        }
+
+        // Looks up tags of files in library and externalTracks table (files that were added
+        // to queue), then parses remaining ones in parallel
+        void loadTracksMetadata(MetadataFutureInterface& futureInterface, std::vector<FileMetadata>& files, bool useDatabase)
+        {
+            MetadataBatch batch;
+            std::vector<std::pair<FileMetadata, QFileInfo>> filesToParse;
+
+            const QSqlDatabase db(useDatabase ? LibraryUtils::readDatabase() : QSqlDatabase());
+            if (db.isOpen()) {
+                std::vector<QString> filePaths;
+                filePaths.reserve(files.size());
+                for (const FileMetadata& file : files) {
+                    filePaths.push_back(file.filePath);
+                }
+                const std::unordered_map<QString, LibraryTrackMetadata> libraryTracks(LibraryUtils::getTracksMetadata(db, filePaths));
+
+                std::vector<FileMetadata> notInLibrary;
+                for (FileMetadata& file : files) {
+                    const auto found(libraryTracks.find(file.filePath));
+                    if (found == libraryTracks.end()) {
+                        notInLibrary.push_back(std::move(file));
+                    } else {
+                        file.title = found->second.title;
+                        file.artist = found->second.artist;
+                        file.duration = found->second.duration;
+                        batch.push_back(std::move(file));
+                    }
+                }
+                files = std::move(notInLibrary);
+
+                if (!batch.empty()) {
+                    futureInterface.reportResult(std::move(batch));
+                    batch = MetadataBatch();
+                }
+            }
+
+            if (futureInterface.isCanceled() || files.empty()) {
+                return;
+            }
+
+            std::unordered_map<QString, std::tuple<long long, QString, QString, int>> externalTracks;
+            if (db.isOpen()) {
+                std::vector<QVariantList> keys;
+                keys.reserve(files.size());
+                for (const FileMetadata& file : files) {
+                    keys.push_back({file.filePath});
+                }
+
+                QSqlDatabase database(db);
+                database.transaction();
+                if (LibraryUtils::insertQueryKeys(db, keys)) {
+                    SqlQuery query(db);
+                    query.setForwardOnly(true);
+                    query.prepare(QLatin1String("SELECT filePath, modificationTime, title, artist, duration FROM query_keys "
+                                                "JOIN externalTracks ON externalTracks.filePath = query_keys.key0"));
+                    LibraryUtils::explainQuery(query, db);
+                    if (query.exec()) {
+                        while (query.next()) {
+                            externalTracks.emplace(query.value(0).toString(), std::make_tuple(query.value(1).toLongLong(),
+                                                                                              query.value(2).toString(),
+                                                                                              query.value(3).toString(),
+                                                                                              query.value(4).toInt()));
+                        }
+                    } else {
+                        qWarning() << "failed to get external tracks" << query.lastError();
+                    }
+                    query.finish();
+                }
+                // Keys are not needed after query
+                database.rollback();
+            }
+
+            for (FileMetadata& file : files) {
+                const QFileInfo fileInfo(file.filePath);
+                const QDateTime lastModified(fileInfo.lastModified());
+                const long long modificationTime = lastModified.isValid() ? lastModified.toMSecsSinceEpoch() : -1;
+
+                const auto found(externalTracks.find(file.filePath));
+                if (found != externalTracks.end() && std::get<0>(found->second) == modificationTime) {
+                    file.title = std::get<1>(found->second);
+                    file.artist = std::get<2>(found->second);
+                    file.duration = std::get<3>(found->second);
+                    batch.push_back(std::move(file));
+                } else if (ParsedTagsCache::instance().find(file.filePath, modificationTime, file)) {
+                    batch.push_back(std::move(file));
+                } else {
+                    filesToParse.push_back({std::move(file), fileInfo});
+                }
+            }
+            if (!batch.empty()) {
+                futureInterface.reportResult(std::move(batch));
+                batch = MetadataBatch();
+            }
+
+            if (futureInterface.isCanceled() || filesToParse.empty()) {
+                return;
+            }
+
+            QThreadPool workers;
+            workers.setMaxThreadCount(QThread::idealThreadCount());
+
+            std::vector<QFuture<FileMetadata>> parsed;
+            parsed.reserve(filesToParse.size());
+            for (const auto& file : filesToParse) {
+                const QDateTime lastModified(file.second.lastModified());
+                parsed.push_back(QtConcurrent::run(&workers, std::bind(parseFileMetadata,
+                                                                       file.first,
+                                                                       file.second,
+                                                                       lastModified.isValid() ? lastModified.toMSecsSinceEpoch() : -1)));
+            }
+
+            // Results are reported in order of rows, so that visible rows at the top come first
+            for (QFuture<FileMetadata>& future : parsed) {
+                if (futureInterface.isCanceled()) {
+                    workers.clear();
+                    return;
+                }
+                batch.push_back(future.result());
+                if (batch.size() >= metadataBatchSize) {
+                    futureInterface.reportResult(std::move(batch));
+                    batch = MetadataBatch();
+                }
+            }
+            if (!batch.empty()) {
+                futureInterface.reportResult(std::move(batch));
+            }
+        }
+
+        bool isInDirectories(const QString& directory, const QStringList& directories)
+        {
+            for (const QString& dir : directories) {
+                if (directory == dir || directory.startsWith(dir + QLatin1Char('/'))) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool isInLibrary(const QString& directory)
+        {
+            return isInDirectories(directory, Settings::instance()->libraryDirectories()) &&
+                   !isInDirectories(directory, Settings::instance()->blacklistedDirectories());
+        }
+
+        // Lists subdirectories and tracks of directory from library database.
+        // Returns false if directory is not in the last complete scan, then it should be listed from file system
+        bool listLibraryDirectory(FilesFutureInterface& futureInterface, const QString& directory)
+        {
+            const QSqlDatabase db(LibraryUtils::readDatabase());
+            if (!db.isOpen()) {
+                return false;
+            }
+
+            // Interrupted scan may have not written all subdirectories
+            if (!SqlQuery(QLatin1String("SELECT 1 FROM libraryState WHERE key = 'directoriesComplete'"), db).next()) {
+                return false;
+            }
+
+            SqlQuery query(db);
+            query.setForwardOnly(true);
+            query.prepare(QStringLiteral("SELECT 1 FROM directories WHERE path = ?"));
+            query.addBindValue(directory);
+            if (!query.exec() || !query.next()) {
+                return false;
+            }
+
+            const QString prefix(directory.endsWith(QLatin1Char('/')) ? directory : directory + QLatin1Char('/'));
+            // Paths between "directory/" and "directory0" ('0' follows '/') that don't have
+            // another '/' after prefix, range uses index on path
+            const QString upperBound(prefix.left(prefix.size() - 1) + QLatin1Char('0'));
+
+            FilesBatch files;
+
+            query.prepare(QStringLiteral("SELECT directories.path, directoryMediaArt.mediaArt FROM directories "
+                                         "LEFT JOIN directoryMediaArt ON directoryMediaArt.path = directories.path "
+                                         "WHERE directories.path > ? AND directories.path < ? AND instr(substr(directories.path, ?), '/') = 0"));
+            query.addBindValue(prefix);
+            query.addBindValue(upperBound);
+            query.addBindValue(prefix.size() + 1);
+            if (!query.exec()) {
+                qWarning() << "failed to get directories from database" << query.lastError();
+                return false;
+            }
+            while (query.next()) {
+                const QString path(query.value(0).toString());
+                DirectoryTrackFile file{path, path.mid(prefix.size()), true, false};
+                file.mediaArt = ArtImageProvider::url(query.value(1).toString());
+                files.push_back(std::move(file));
+            }
+
+            if (futureInterface.isCanceled()) {
+                return true;
+            }
+
+            query.prepare(QStringLiteral("SELECT filePath, title, duration, COALESCE(NULLIF(mediaArtThumbnail, ''), mediaArt), displayArtist FROM tracks "
+                                         "WHERE filePath > ? AND filePath < ? AND instr(substr(filePath, ?), '/') = 0 "
+                                         "ORDER BY filePath"));
+            query.addBindValue(prefix);
+            query.addBindValue(upperBound);
+            query.addBindValue(prefix.size() + 1);
+            if (!query.exec()) {
+                qWarning() << "failed to get tracks from database" << query.lastError();
+                return false;
+            }
+            while (query.next()) {
+                const QString filePath(query.value(0).toString());
+                DirectoryTrackFile file{filePath, filePath.mid(prefix.size()), false, false};
+                file.title = query.value(1).toString();
+                file.duration = query.value(2).toInt();
+                file.mediaArt = ArtImageProvider::url(query.value(3).toString());
+                file.artist = query.value(4).toString();
+                files.push_back(std::move(file));
+            }
+
+            if (!files.empty()) {
+                futureInterface.reportResult(std::move(files));
+            }
+            return true;
+        }
+
+        // Returns false if entry is not shown
+        bool trackFileFromEntry(const QString& directory, const DirectoryListingCache::Entry& entry, bool showVideoFiles, DirectoryTrackFile& file)
+        {
+            if (entry.isDirectory) {
+                const QString filePath(DirectoryListingCache::filePath(directory, entry.name));
+                if (!DirectoryListingCache::isReadable(filePath)) {
+                    return false;
+                }
+                file = {filePath,
+                        entry.name,
+                        true,
+                        false};
+                return true;
+            }
+
+            const int dotIndex = entry.name.lastIndexOf(QLatin1Char('.'));
+            // Looked up without copying suffix
+            const QStringRef suffix(dotIndex == -1 ? QStringRef() : entry.name.midRef(dotIndex + 1));
+            const bool isPlaylist = contains(PlaylistUtils::playlistsExtensions, suffix);
+            if (isPlaylist ||
+                    contains(LibraryUtils::mimeTypesExtensions, suffix) ||
+                    (showVideoFiles && contains(LibraryUtils::videoMimeTypesExtensions, suffix))) {
+                const QString filePath(DirectoryListingCache::filePath(directory, entry.name));
+                if (!DirectoryListingCache::isReadable(filePath)) {
+                    return false;
+                }
+                file = {filePath,
+                        entry.name,
+                        false,
+                        isPlaylist};
+                return true;
+            }
+            return false;
+        }
+    }
+
     void DirectoryTracksModel::classBegin()
     {
     }
@@ -43,6 +403,7 @@ namespace unplayer
     void DirectoryTracksModel::componentComplete()
     {
         mShowVideoFiles = Settings::instance()->showVideoFiles();
+        mBrowseLibrary = Settings::instance()->browseLibraryDirectories();
         setDirectory(Settings::instance()->defaultDirectory());
     }
 
@@ -63,6 +424,14 @@ namespace unplayer
             return file.isDirectory;
         case IsPlaylistRole:
             return file.isPlaylist;
+        case TitleRole:
+            return file.title;
+        case ArtistRole:
+            return file.artist;
+        case DurationRole:
+            return file.duration;
+        case MediaArtRole:
+            return file.mediaArt;
         default:
             return QVariant();
         }
@@ -86,7 +455,10 @@ namespace unplayer
     void DirectoryTracksModel::setDirectory(QString newDirectory)
     {
         QDir dir(newDirectory);
-        if (!dir.isReadable()) {
+        if (mBrowseLibrary && isInLibrary(QDir::cleanPath(dir.absolutePath()))) {
+            // Listed from library, file system is not accessed
+            newDirectory = QDir::cleanPath(dir.absolutePath());
+        } else if (!dir.isReadable()) {
             qWarning() << "directory is not readable:" << newDirectory;
             newDirectory = QStandardPaths::writableLocation(QStandardPaths::HomeLocation);
         } else {
@@ -94,6 +466,7 @@ namespace unplayer
         }
         if (newDirectory != mDirectory) {
             mDirectory = newDirectory;
+            LibraryUtils::instance()->prioritizeDirectory(mDirectory);
             emit directoryChanged();
             loadDirectory();
         }
@@ -109,6 +482,11 @@ namespace unplayer
         return mLoaded;
     }
 
+    bool DirectoryTracksModel::isLibraryListing() const
+    {
+        return mLibraryListing;
+    }
+
     QString DirectoryTracksModel::getTrack(int index) const
     {
         return mFiles[index].filePath;
@@ -134,81 +512,150 @@ namespace unplayer
 
     void DirectoryTracksModel::removeTracks(std::vector<int> indexes)
     {
-        if (mRemovingFiles || !mLoaded) {
+        if (!mLoaded) {
             return;
         }
 
-        mRemovingFiles = true;
-        emit removingFilesChanged();
+        // Rows may change while job is waiting, they are found by file path when it starts
+        std::unordered_set<QString> filePaths;
+        for (int index : indexes) {
+            filePaths.insert(mFiles[index].filePath);
+        }
+
+        if (!mRemovingFiles) {
+            mRemovingFiles = true;
+            emit removingFilesChanged();
+        }
+
+        JobManager::instance()->add(this, JobManager::Type::RemoveFiles, threadpools::JobClass::Bulk, [=](int job) {
+            startRemovingFiles(job, filePaths);
+        });
+    }
+
+    void DirectoryTracksModel::startRemovingFiles(int job, const std::unordered_set<QString>& filePaths)
+    {
+        std::vector<int> indexes;
+        std::vector<DirectoryTrackFile> files;
+        for (int index = 0, count = static_cast<int>(mFiles.size()); index < count; ++index) {
+            if (filePaths.count(mFiles[index].filePath) > 0) {
+                indexes.push_back(index);
+                files.push_back(mFiles[index]);
+            }
+        }
+        if (indexes.empty()) {
+            finishRemovingFiles(job);
+            return;
+        }
+
+        // FIXME: use init capture when moving to C++14
+        auto future = threadpools::run(threadpools::JobClass::Bulk, std::bind([](std::vector<int>& indexes, const std::vector<DirectoryTrackFile>& files) {
+            QStringList paths;
+            paths.reserve(files.size());
+            for (const DirectoryTrackFile& file : files) {
+                paths.push_back(file.filePath);
+            }
+
+            // Files are removed before opening database so that it is not locked meanwhile
+            const std::vector<bool> removedFiles(fileutils::removeFiles(paths));
 
-        auto future = QtConcurrent::run(std::bind([this](std::vector<int>& indexes) {
             std::vector<int> removed;
-            auto db = QSqlDatabase::addDatabase(LibraryUtils::databaseType, staticMetaObject.className());
-            db.setDatabaseName(LibraryUtils::instance()->databaseFilePath());
-            if (!db.open()) {
-                QSqlDatabase::removeDatabase(staticMetaObject.className());
-                qWarning() << "failed to open database" << db.lastError();
+            std::vector<QVariantList> removedTracks;
+            QStringList removedDirectories;
+            for (int i = 0, max = files.size(); i < max; ++i) {
+                if (removedFiles[i]) {
+                    removed.push_back(indexes[i]);
+                    if (files[i].isDirectory) {
+                        removedDirectories.push_back(files[i].filePath);
+                    } else {
+                        removedTracks.push_back({files[i].filePath});
+                    }
+                }
+            }
+
+            if (removed.empty()) {
                 return removed;
             }
-            db.transaction();
-            std::sort(indexes.begin(), indexes.end(), std::greater<int>());
-            for (int index : indexes) {
-                QString filePath(mFiles[index].filePath);
-                const bool isDir = QFileInfo(filePath).isDir();
-                if (isDir) {
-                    if (!QDir(filePath).removeRecursively()) {
-                        qWarning() << "failed to remove directory:" << filePath;
-                        continue;
+
+            QSqlDatabase db(LibraryUtils::threadDatabase());
+            if (db.isOpen()) {
+                db.transaction();
+
+                LibraryChanges changes;
+                SqlQuery query(db);
+                if (!removedTracks.empty() && LibraryUtils::insertQueryKeys(db, removedTracks)) {
+                    changes = LibraryChanges::forTracks(db, QLatin1String("SELECT id FROM tracks WHERE filePath IN (SELECT key0 FROM query_keys)"));
+                    if (!query.exec(QLatin1String("DELETE FROM tracks WHERE filePath IN (SELECT key0 FROM query_keys)"))) {
+                        qWarning() << "failed to remove files from database" << query.lastError();
                     }
-                } else {
-                    if (!QFile::remove(filePath)) {
-                        qWarning() << "failed to remove file:" << filePath;
-                        continue;
+                }
+
+                if (!removedDirectories.isEmpty()) {
+                    // Tracks in directories are not listed
+                    changes.all = true;
+                    // Paths between "directory/" and "directory0" ('0' follows '/'),
+                    // unlike instr() this uses index on filePath
+                    query.prepare(QStringLiteral("DELETE FROM tracks WHERE filePath > ? AND filePath < ?"));
+                    for (const QString& directory : removedDirectories) {
+                        query.bindValue(0, directory + QLatin1Char('/'));
+                        query.bindValue(1, directory + QLatin1Char('0'));
+                        if (!query.exec()) {
+                            qWarning() << "failed to remove directory from database" << query.lastError();
+                        }
                     }
                 }
-                removed.push_back(index);
 
-                QSqlQuery query(db);
-                if (isDir) {
-                    query.prepare(QStringLiteral("DELETE FROM tracks WHERE instr(filePath, ?) = 1"));
-                    filePath.append(QLatin1Char('/'));
+                LibraryUtils::updateSummaries(db);
+                if (db.commit()) {
+                    LibraryUtils::notifyLibraryChanged(changes);
                 } else {
-                    query.prepare(QStringLiteral("DELETE FROM tracks WHERE filePath = ?"));
-                }
-                query.addBindValue(filePath);
-                if (!query.exec()) {
-                    qWarning() << "failed to remove file from database" << query.lastQuery();
+                    qWarning() << "failed to commit transaction" << db.lastError();
                 }
             }
-            db.commit();
-            QSqlDatabase::removeDatabase(db.connectionName());
 
             return removed;
-        }, std::move(indexes)));
+        }, std::move(indexes), std::move(files)));
 
         using Watcher = QFutureWatcher<std::vector<int>>;
         auto watcher = new Watcher(this);
-        QObject::connect(watcher, &Watcher::finished, this, [this, watcher]() {
-            mRemovingFiles = false;
-            emit removingFilesChanged();
-
-            for (int index : watcher->result()) {
-                beginRemoveRows(QModelIndex(), index, index);
-                mFiles.erase(mFiles.begin() + index);
+        QObject::connect(watcher, &Watcher::finished, this, [this, watcher, job]() {
+            // Indexes are sorted, remove contiguous ranges from the end
+            const std::vector<int> removed(watcher->result());
+            for (auto i = removed.rbegin(), end = removed.rend(); i != end;) {
+                const int last = *i;
+                int first = last;
+                for (++i; i != end && *i == first - 1; ++i) {
+                    first = *i;
+                }
+                beginRemoveRows(QModelIndex(), first, last);
+                mFiles.erase(mFiles.begin() + first, mFiles.begin() + last + 1);
                 endRemoveRows();
             }
             emit LibraryUtils::instance()->databaseChanged();
             watcher->deleteLater();
+            finishRemovingFiles(job);
         });
         watcher->setFuture(future);
     }
 
+    void DirectoryTracksModel::finishRemovingFiles(int job)
+    {
+        JobManager::instance()->finish(job);
+        if (!JobManager::instance()->hasJobs(this, JobManager::Type::RemoveFiles)) {
+            mRemovingFiles = false;
+            emit removingFilesChanged();
+        }
+    }
+
     QHash<int, QByteArray> DirectoryTracksModel::roleNames() const
     {
         return {{FilePathRole, "filePath"},
                 {FileNameRole, "fileName"},
                 {IsDirectoryRole, "isDirectory"},
-                {IsPlaylistRole, "isPlaylist"}};
+                {IsPlaylistRole, "isPlaylist"},
+                {TitleRole, "title"},
+                {ArtistRole, "artist"},
+                {DurationRole, "duration"},
+                {MediaArtRole, "mediaArt"}};
     }
 
     void DirectoryTracksModel::loadDirectory()
@@ -217,55 +664,121 @@ namespace unplayer
             return;
         }
 
+        const int generation = mLoad.start();
+        mMetadataLoad.cancel();
+        mMediaArtLoad.cancel();
+
         mLoaded = false;
+        mLibraryListing = false;
         emit loadedChanged();
 
-        beginRemoveRows(QModelIndex(), 0, mFiles.size() - 1);
-        mFiles.clear();
-        endRemoveRows();
+        if (!mFiles.empty()) {
+            beginRemoveRows(QModelIndex(), 0, mFiles.size() - 1);
+            mFiles.clear();
+            endRemoveRows();
+        }
+        mTracksCount = 0;
 
         const QString directory(mDirectory);
         const bool showVideoFiles = mShowVideoFiles;
-        auto future = QtConcurrent::run([directory, showVideoFiles]() {
+
+        const bool fromLibrary = mBrowseLibrary &&
+                                 LibraryUtils::instance()->isDatabaseInitialized() &&
+                                 isInLibrary(directory);
+
+        const DirectoryListingCache::Listing cached(fromLibrary ? DirectoryListingCache::Listing()
+                                                                : DirectoryListingCache::instance().listing(directory));
+        if (cached) {
             std::vector<DirectoryTrackFile> files;
-            int tracksCount = 0;
-            const QFileInfoList fileInfos(QDir(directory).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::Files | QDir::Readable));
-            for (const QFileInfo& info : fileInfos) {
-                if (info.isDir()) {
-                    files.push_back({info.filePath(),
-                                     info.fileName(),
-                                     true,
-                                     false});
-                } else {
-                    const QString suffix(info.suffix());
-                    const bool isPlaylist = contains(PlaylistUtils::playlistsExtensions, suffix);
-                    if (isPlaylist ||
-                            contains(LibraryUtils::mimeTypesExtensions, suffix) ||
-                            (showVideoFiles && contains(LibraryUtils::videoMimeTypesExtensions, suffix))) {
-                        files.push_back({info.filePath(),
-                                         info.fileName(),
-                                         false,
-                                         isPlaylist});
-                        ++tracksCount;
+            files.reserve(cached->size());
+            DirectoryTrackFile file;
+            for (const DirectoryListingCache::Entry& entry : *cached) {
+                if (trackFileFromEntry(directory, entry, showVideoFiles, file)) {
+                    if (!file.isDirectory) {
+                        ++mTracksCount;
                     }
+                    files.push_back(std::move(file));
                 }
             }
-            return std::pair<std::vector<DirectoryTrackFile>, int>(std::move(files), tracksCount);
-        });
+            if (!files.empty()) {
+                beginInsertRows(QModelIndex(), 0, files.size() - 1);
+                mFiles = std::move(files);
+                endInsertRows();
+            }
+            mLoaded = true;
+            emit loadedChanged();
+            loadFilesMetadata();
+            loadDirectoriesMediaArt();
+            return;
+        }
 
-        using FutureWatcher = QFutureWatcher<std::pair<std::vector<DirectoryTrackFile>, int>>;
-        auto watcher = new FutureWatcher(this);
-        QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
-            auto result(watcher->result());
-            beginInsertRows(QModelIndex(), 0, result.first.size() - 1);
-            mFiles = std::move(result.first);
-            endInsertRows();
-            mTracksCount = result.second;
+        // Set in worker thread before future is finished
+        const auto listedFromLibrary(std::make_shared<bool>(false));
 
+        auto runnable = new FilesRunnable([directory, showVideoFiles, fromLibrary, listedFromLibrary](FilesFutureInterface& futureInterface) {
+            if (fromLibrary && listLibraryDirectory(futureInterface, directory)) {
+                *listedFromLibrary = true;
+                return;
+            }
+
+            const long long modificationTime = DirectoryListingCache::modificationTime(directory);
+            std::vector<DirectoryListingCache::Entry> entries;
+
+            FilesBatch batch;
+            std::size_t batchSize = firstFilesBatchSize;
+            DirectoryTrackFile file;
+            QDirIterator iterator(directory, QDir::AllEntries | QDir::NoDotAndDotDot);
+            while (iterator.hasNext()) {
+                if (futureInterface.isCanceled()) {
+                    return;
+                }
+                iterator.next();
+                const QFileInfo info(iterator.fileInfo());
+                entries.push_back({info.fileName(), info.isDir()});
+
+                if (trackFileFromEntry(directory, entries.back(), showVideoFiles, file)) {
+                    batch.push_back(std::move(file));
+                    if (batch.size() >= batchSize) {
+                        futureInterface.reportResult(std::move(batch));
+                        batch = FilesBatch();
+                        batchSize = filesBatchSize;
+                    }
+                }
+            }
+            if (!batch.empty()) {
+                futureInterface.reportResult(std::move(batch));
+            }
+
+            DirectoryListingCache::instance().add(directory, modificationTime, std::move(entries));
+        });
+
+        auto watcher = new FilesFutureWatcher(this);
+        mLoad.setWatcher(generation, watcher);
+        QObject::connect(watcher, &FilesFutureWatcher::resultsReadyAt, this, [=](int beginIndex, int endIndex) {
+            for (int i = beginIndex; i < endIndex; ++i) {
+                const FilesBatch batch(watcher->resultAt(i));
+                beginInsertRows(QModelIndex(), mFiles.size(), mFiles.size() + batch.size() - 1);
+                for (const DirectoryTrackFile& file : batch) {
+                    if (!file.isDirectory) {
+                        ++mTracksCount;
+                    }
+                }
+                mFiles.insert(mFiles.end(), batch.begin(), batch.end());
+                endInsertRows();
+            }
+        });
+        QObject::connect(watcher, &FilesFutureWatcher::finished, this, [=]() {
+            mLoad.finish(generation);
             mLoaded = true;
+            mLibraryListing = *listedFromLibrary;
             emit loadedChanged();
+            watcher->deleteLater();
+            loadFilesMetadata();
+            loadDirectoriesMediaArt();
         });
-        watcher->setFuture(future);
+        watcher->setFuture(runnable->future());
+
+        threadpools::start(threadpools::JobClass::Interactive, runnable);
     }
 
     bool DirectoryTracksModel::isRemovingFiles() const
@@ -273,6 +786,137 @@ namespace unplayer
         return mRemovingFiles;
     }
 
+    bool DirectoryTracksModel::loadMetadata() const
+    {
+        return mLoadMetadata;
+    }
+
+    void DirectoryTracksModel::setLoadMetadata(bool load)
+    {
+        if (load != mLoadMetadata) {
+            mLoadMetadata = load;
+            emit loadMetadataChanged();
+            if (mLoadMetadata) {
+                if (mLoaded) {
+                    loadFilesMetadata();
+                }
+            } else {
+                mMetadataLoad.cancel();
+            }
+        }
+    }
+
+    void DirectoryTracksModel::loadFilesMetadata()
+    {
+        if (!mLoadMetadata) {
+            return;
+        }
+
+        std::vector<FileMetadata> files;
+        for (int row = 0, count = static_cast<int>(mFiles.size()); row < count; ++row) {
+            const DirectoryTrackFile& file = mFiles[row];
+            if (!file.isDirectory && !file.isPlaylist && file.duration == 0) {
+                files.push_back({row, file.filePath, QString(), QString(), 0});
+            }
+        }
+        if (files.empty()) {
+            return;
+        }
+
+        const int generation = mMetadataLoad.start();
+
+        const bool useDatabase = LibraryUtils::instance()->isDatabaseInitialized();
+        // FIXME: use init capture when we switch to C++14
+        auto runnable = new MetadataRunnable(std::bind([useDatabase](MetadataFutureInterface& futureInterface, std::vector<FileMetadata>& files) {
+            loadTracksMetadata(futureInterface, files, useDatabase);
+        }, std::placeholders::_1, std::move(files)));
+
+        auto watcher = new MetadataFutureWatcher(this);
+        mMetadataLoad.setWatcher(generation, watcher);
+        QObject::connect(watcher, &MetadataFutureWatcher::resultsReadyAt, this, [=](int beginIndex, int endIndex) {
+            std::vector<int> changed;
+            for (int i = beginIndex; i < endIndex; ++i) {
+                const MetadataBatch batch(watcher->resultAt(i));
+                for (const FileMetadata& metadata : batch) {
+                    // Rows may have been removed meanwhile
+                    if (metadata.row < static_cast<int>(mFiles.size()) && mFiles[metadata.row].filePath == metadata.filePath) {
+                        DirectoryTrackFile& file = mFiles[metadata.row];
+                        file.title = metadata.title;
+                        file.artist = metadata.artist;
+                        file.duration = metadata.duration;
+                        changed.push_back(metadata.row);
+                    }
+                }
+            }
+
+            // One signal for each contiguous range of rows
+            std::sort(changed.begin(), changed.end());
+            const QVector<int> roles{TitleRole, ArtistRole, DurationRole};
+            for (auto i = changed.begin(), end = changed.end(); i != end;) {
+                const int first = *i;
+                int last = first;
+                for (++i; i != end && *i == last + 1; ++i) {
+                    last = *i;
+                }
+                emit dataChanged(index(first), index(last), roles);
+            }
+        });
+        QObject::connect(watcher, &MetadataFutureWatcher::finished, this, [=]() {
+            mMetadataLoad.finish(generation);
+            watcher->deleteLater();
+        });
+        watcher->setFuture(runnable->future());
+
+        threadpools::start(threadpools::JobClass::Interactive, runnable);
+    }
+
+    void DirectoryTracksModel::loadDirectoriesMediaArt()
+    {
+        std::vector<DirectoryMediaArtCache::Cover> directories;
+        for (int row = 0, count = static_cast<int>(mFiles.size()); row < count; ++row) {
+            const DirectoryTrackFile& file = mFiles[row];
+            // Directories listed from library already have covers
+            if (file.isDirectory && file.mediaArt.isEmpty()) {
+                directories.push_back({row, file.filePath, QString()});
+            }
+        }
+        if (directories.empty()) {
+            return;
+        }
+
+        using Watcher = QFutureWatcher<DirectoryMediaArtCache::CoversBatch>;
+        auto watcher = new Watcher(this);
+        const int generation = mMediaArtLoad.start(watcher);
+        QObject::connect(watcher, &Watcher::resultsReadyAt, this, [=](int beginIndex, int endIndex) {
+            std::vector<int> changed;
+            for (int i = beginIndex; i < endIndex; ++i) {
+                for (const DirectoryMediaArtCache::Cover& cover : watcher->resultAt(i)) {
+                    // Rows may have been removed meanwhile
+                    if (cover.row < static_cast<int>(mFiles.size()) && mFiles[cover.row].filePath == cover.directoryPath) {
+                        mFiles[cover.row].mediaArt = cover.url;
+                        changed.push_back(cover.row);
+                    }
+                }
+            }
+
+            // Directories are listed in order of rows
+            const QVector<int> roles{MediaArtRole};
+            for (auto i = changed.begin(), end = changed.end(); i != end;) {
+                const int first = *i;
+                int last = first;
+                for (++i; i != end && *i == last + 1; ++i) {
+                    last = *i;
+                }
+                emit dataChanged(index(first), index(last), roles);
+            }
+        });
+        QObject::connect(watcher, &Watcher::finished, this, [=]() {
+            mMediaArtLoad.finish(generation);
+            watcher->deleteLater();
+        });
+        watcher->setFuture(DirectoryMediaArtCache::loadCovers(std::move(directories)));
+    }
+
     DirectoryTracksProxyModel::DirectoryTracksProxyModel()
         : mDirectoriesCount(0),
           mTracksCount(0)
@@ -285,25 +929,17 @@ namespace unplayer
 
     void DirectoryTracksProxyModel::componentComplete()
     {
-        auto updateCount = [=]() {
-            mDirectoriesCount = 0;
-            mTracksCount = 0;
-            const std::vector<DirectoryTrackFile>& files = static_cast<const DirectoryTracksModel*>(sourceModel())->files();
-            for (int i = 0, max = rowCount(); i < max; ++i) {
-                if (files.at(sourceIndex(i)).isDirectory) {
-                    mDirectoriesCount++;
-                } else {
-                    mTracksCount++;
-                }
-            }
-            emit countChanged();
-        };
-
-        QObject::connect(this, &QAbstractItemModel::modelReset, this, updateCount);
-        QObject::connect(this, &QAbstractItemModel::rowsInserted, this, updateCount);
-        QObject::connect(this, &QAbstractItemModel::rowsRemoved, this, updateCount);
+        QObject::connect(this, &QAbstractItemModel::modelReset, this, &DirectoryTracksProxyModel::resetCount);
+        QObject::connect(this, &QAbstractItemModel::layoutChanged, this, &DirectoryTracksProxyModel::resetCount);
+        QObject::connect(this, &QAbstractItemModel::rowsInserted, this, [=](const QModelIndex&, int first, int last) {
+            updateCount(first, last, 1);
+        });
+        // Rows are still in the model
+        QObject::connect(this, &QAbstractItemModel::rowsAboutToBeRemoved, this, [=](const QModelIndex&, int first, int last) {
+            updateCount(first, last, -1);
+        });
 
-        updateCount();
+        resetCount();
 
         DirectoryContentProxyModel::componentComplete();
     }
@@ -332,16 +968,35 @@ namespace unplayer
 
     void DirectoryTracksProxyModel::selectAll()
     {
+        // Directories are sorted before files
+        if (mTracksCount > 0) {
+            selectRows(mDirectoriesCount, rowCount() - 1);
+        }
+    }
+
+    void DirectoryTracksProxyModel::resetCount()
+    {
+        mDirectoriesCount = 0;
+        mTracksCount = 0;
+        updateCount(0, rowCount() - 1, 1);
+    }
+
+    void DirectoryTracksProxyModel::updateCount(int first, int last, int sign)
+    {
+        if (last < first) {
+            emit countChanged();
+            return;
+        }
         const std::vector<DirectoryTrackFile>& files = static_cast<const DirectoryTracksModel*>(sourceModel())->files();
-        int firstFileIndex = -1;
-        for (int i = 0, max = rowCount(); i < max; ++i) {
-            if (!files[sourceIndex(i)].isDirectory) {
-                firstFileIndex = i;
-                break;
+        const std::vector<int>& rows = sourceRows();
+        int directories = 0;
+        for (int i = first; i <= last; ++i) {
+            if (files[rows[i]].isDirectory) {
+                ++directories;
             }
         }
-        if (firstFileIndex != -1) {
-            selectionModel()->select(QItemSelection(index(firstFileIndex, 0), index(rowCount() - 1, 0)), QItemSelectionModel::Select);
-        }
+        mDirectoriesCount += sign * directories;
+        mTracksCount += sign * (last - first + 1 - directories);
+        emit countChanged();
     }
 }
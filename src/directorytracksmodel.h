@@ -19,10 +19,13 @@
 #ifndef UNPLAYER_DIRECTORYTRACKSMODEL_H
 #define UNPLAYER_DIRECTORYTRACKSMODEL_H
 
+#include <unordered_set>
 #include <vector>
 #include <QAbstractListModel>
 
 #include "directorycontentproxymodel.h"
+#include "latestload.h"
+#include "stdutils.h"
 
 namespace unplayer
 {
@@ -32,6 +35,14 @@ namespace unplayer
         QString fileName;
         bool isDirectory;
         bool isPlaylist;
+        // Filled in background if DirectoryTracksModel::loadMetadata is true,
+        // empty and 0 until then or if file doesn't have tags
+        QString title;
+        QString artist;
+        int duration;
+        // Media art of track when directory is listed from library, and cover of directory.
+        // Covers of directories listed from file system are found in background
+        QString mediaArt;
     };
 
     class DirectoryTracksModel : public QAbstractListModel, public QQmlParserStatus
@@ -42,6 +53,13 @@ namespace unplayer
         Q_PROPERTY(QString parentDirectory READ parentDirectory NOTIFY directoryChanged)
         Q_PROPERTY(bool loaded READ isLoaded NOTIFY loadedChanged)
         Q_PROPERTY(bool removingFiles READ isRemovingFiles NOTIFY removingFilesChanged)
+        // Tags are looked up in library database for all files at once after directory is listed,
+        // files that are not in library are parsed in parallel. Rows are updated in batches
+        Q_PROPERTY(bool loadMetadata READ loadMetadata WRITE setLoadMetadata NOTIFY loadMetadataChanged)
+        // If Settings::browseLibraryDirectories is enabled, directories that were walked by the last
+        // complete library scan are listed from directories and tracks tables without accessing file system.
+        // Files that are not in library (e.g. playlists) are not shown then
+        Q_PROPERTY(bool libraryListing READ isLibraryListing NOTIFY loadedChanged)
     public:
         enum Role
         {
@@ -49,6 +67,10 @@ namespace unplayer
             FileNameRole,
             IsDirectoryRole,
             IsPlaylistRole,
+            TitleRole,
+            ArtistRole,
+            DurationRole,
+            MediaArtRole
         };
         Q_ENUM(Role)
 
@@ -65,6 +87,7 @@ namespace unplayer
 
         QString parentDirectory() const;
         bool isLoaded() const;
+        bool isLibraryListing() const;
 
         Q_INVOKABLE QString getTrack(int index) const;
         Q_INVOKABLE QStringList getTracks(const std::vector<int>& indexes, bool includePlaylists = true) const;
@@ -74,12 +97,19 @@ namespace unplayer
 
         bool isRemovingFiles() const;
 
+        bool loadMetadata() const;
+        void setLoadMetadata(bool load);
+
     protected:
         QHash<int, QByteArray> roleNames() const override;
 
     private:
         void loadDirectory();
         void onQueryFinished();
+        void loadFilesMetadata();
+        void loadDirectoriesMediaArt();
+        void startRemovingFiles(int job, const std::unordered_set<QString>& filePaths);
+        void finishRemovingFiles(int job);
 
     private:
         std::vector<DirectoryTrackFile> mFiles;
@@ -88,14 +118,23 @@ namespace unplayer
 
         QString mDirectory;
         bool mLoaded = false;
+        LatestLoad mLoad{this};
 
         bool mShowVideoFiles = false;
+        bool mBrowseLibrary = false;
+        bool mLibraryListing = false;
 
         bool mRemovingFiles = false;
+
+        bool mLoadMetadata = false;
+        LatestLoad mMetadataLoad{this};
+
+        LatestLoad mMediaArtLoad{this};
     signals:
         void directoryChanged();
         void loadedChanged();
         void removingFilesChanged();
+        void loadMetadataChanged();
     };
 
     class DirectoryTracksProxyModel : public DirectoryContentProxyModel
@@ -114,6 +153,10 @@ namespace unplayer
         Q_INVOKABLE void selectAll();
 
     private:
+        void resetCount();
+        // Adds (sign is 1) or subtracts (sign is -1) counts of rows from first to last
+        void updateCount(int first, int last, int sign);
+
         int mDirectoriesCount;
         int mTracksCount;
     signals:
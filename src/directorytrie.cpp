@@ -0,0 +1,75 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "directorytrie.h"
+
+#include <QVector>
+
+namespace unplayer
+{
+    DirectoryTrie::DirectoryTrie()
+    {
+        clear();
+    }
+
+    void DirectoryTrie::clear()
+    {
+        mNodes.clear();
+        mNodes.push_back({{}, false});
+    }
+
+    void DirectoryTrie::insert(const QString& directory)
+    {
+        std::size_t node = 0;
+        for (const QStringRef& component : directory.splitRef(QLatin1Char('/'), QString::SkipEmptyParts)) {
+            const QString name(component.toString());
+            const auto found(mNodes[node].children.find(name));
+            if (found == mNodes[node].children.end()) {
+                const std::size_t child = mNodes.size();
+                // Insert before push_back, it may invalidate references to nodes
+                mNodes[node].children.insert({name, child});
+                mNodes.push_back({{}, false});
+                node = child;
+            } else {
+                node = found->second;
+            }
+        }
+        mNodes[node].isDirectory = true;
+    }
+
+    bool DirectoryTrie::containsPath(const QString& path) const
+    {
+        std::size_t node = 0;
+        if (mNodes[node].isDirectory) {
+            return true;
+        }
+        for (const QStringRef& component : path.splitRef(QLatin1Char('/'), QString::SkipEmptyParts)) {
+            const auto& children = mNodes[node].children;
+            const auto found(children.find(component.toString()));
+            if (found == children.end()) {
+                return false;
+            }
+            node = found->second;
+            if (mNodes[node].isDirectory) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
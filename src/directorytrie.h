@@ -0,0 +1,56 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_DIRECTORYTRIE_H
+#define UNPLAYER_DIRECTORYTRIE_H
+
+#include <unordered_map>
+#include <vector>
+
+#include <QString>
+
+#include "stdutils.h"
+
+namespace unplayer
+{
+    // Set of directories that finds whether path is inside any of them
+    // by looking up each component of path once
+    class DirectoryTrie final
+    {
+    public:
+        DirectoryTrie();
+
+        void clear();
+        void insert(const QString& directory);
+
+        // True if path is one of directories or is inside one of them
+        bool containsPath(const QString& path) const;
+
+    private:
+        struct Node
+        {
+            std::unordered_map<QString, std::size_t> children;
+            bool isDirectory;
+        };
+        // First node is root
+        std::vector<Node> mNodes;
+    };
+}
+
+#endif // UNPLAYER_DIRECTORYTRIE_H
@@ -0,0 +1,369 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "facetsmodel.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+
+#include <QDebug>
+#include <QFutureWatcher>
+#include <QSqlError>
+
+#include "libraryutils.h"
+#include "playstatistics.h"
+#include "sqlquery.h"
+#include "threadpools.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        // Position of track id in sorted ids, or -1
+        int trackPosition(const std::vector<int>& trackIds, int id)
+        {
+            const auto found = std::lower_bound(trackIds.begin(), trackIds.end(), id);
+            if (found == trackIds.end() || *found != id) {
+                return -1;
+            }
+            return static_cast<int>(found - trackIds.begin());
+        }
+    }
+
+    FacetsModel::FacetsModel(QObject* parent)
+        : QAbstractListModel(parent),
+          mLoad(this)
+    {
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::databaseInitializedChanged, this, &FacetsModel::load);
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::libraryChanged, this, &FacetsModel::load);
+        QObject::connect(PlayStatistics::instance(), &PlayStatistics::statisticsChanged, this, &FacetsModel::load);
+        load();
+    }
+
+    int FacetsModel::rowCount(const QModelIndex&) const
+    {
+        return mIndex ? static_cast<int>(mIndex->facets.size()) : 0;
+    }
+
+    QVariant FacetsModel::data(const QModelIndex& index, int role) const
+    {
+        const Facet& facet = mIndex->facets[static_cast<std::size_t>(index.row())];
+        switch (role) {
+        case KindRole:
+            return facet.kind;
+        case TitleRole:
+            return facet.title;
+        case TracksCountRole:
+            return mCounts[static_cast<std::size_t>(index.row())];
+        case SelectedRole:
+            return static_cast<bool>(mSelected[static_cast<std::size_t>(index.row())]);
+        default:
+            return QVariant();
+        }
+    }
+
+    bool FacetsModel::isLoaded() const
+    {
+        return static_cast<bool>(mIndex);
+    }
+
+    int FacetsModel::tracksCount() const
+    {
+        return mMatching.cardinality();
+    }
+
+    bool FacetsModel::hasSelection() const
+    {
+        return std::find(mSelected.begin(), mSelected.end(), true) != mSelected.end();
+    }
+
+    void FacetsModel::toggle(int row)
+    {
+        if (row < 0 || row >= rowCount()) {
+            return;
+        }
+        mSelected[static_cast<std::size_t>(row)] = !mSelected[static_cast<std::size_t>(row)];
+        emit dataChanged(index(row), index(row), {SelectedRole});
+        updateCounts();
+    }
+
+    void FacetsModel::clearSelection()
+    {
+        if (!hasSelection()) {
+            return;
+        }
+        std::fill(mSelected.begin(), mSelected.end(), false);
+        emit dataChanged(index(0), index(rowCount() - 1), {SelectedRole});
+        updateCounts();
+    }
+
+    TrackList FacetsModel::getTracks() const
+    {
+        if (!mIndex) {
+            return TrackList();
+        }
+
+        const std::vector<quint32> positions(mMatching.values());
+        if (positions.empty()) {
+            return TrackList();
+        }
+
+        std::vector<QVariantList> keys;
+        keys.reserve(positions.size());
+        for (quint32 position : positions) {
+            keys.push_back({mIndex->trackIds[position]});
+        }
+
+        const QSqlDatabase db(QSqlDatabase::database());
+        QSqlDatabase database(db);
+        database.transaction();
+
+        std::vector<LibraryTrack> tracks;
+        if (!LibraryUtils::insertQueryKeys(db, keys)) {
+            database.rollback();
+            return TrackList();
+        }
+
+        SqlQuery query(db);
+        query.setForwardOnly(true);
+        query.prepare(QLatin1String("SELECT filePath, title, displayArtist, displayAlbum, duration, mediaArt FROM query_keys "
+                                    "JOIN tracks ON tracks.id = query_keys.key0 "
+                                    "ORDER BY displayArtist = '', displayArtist, year, displayAlbum, discNumber, trackNumber, titleSortKey"));
+        LibraryUtils::explainQuery(query, db);
+        if (query.exec()) {
+            tracks.reserve(positions.size());
+            while (query.next()) {
+                tracks.push_back({query.value(0).toString(),
+                                  query.value(1).toString(),
+                                  query.value(2).toString(),
+                                  query.value(3).toString(),
+                                  query.value(4).toInt(),
+                                  query.value(5).toString()});
+            }
+        } else {
+            qWarning() << "failed to get tracks from database" << query.lastError();
+        }
+        query.finish();
+
+        // Keys are not needed after query
+        database.rollback();
+
+        return TrackList(std::move(tracks));
+    }
+
+    QHash<int, QByteArray> FacetsModel::roleNames() const
+    {
+        return {{KindRole, "kind"},
+                {TitleRole, "title"},
+                {TracksCountRole, "tracksCount"},
+                {SelectedRole, "selected"}};
+    }
+
+    std::shared_ptr<FacetsModel::Index> FacetsModel::loadIndex(const LatestLoad::Token& token)
+    {
+        auto index = std::make_shared<Index>();
+        const QSqlDatabase db(LibraryUtils::threadDatabase());
+
+        Facet notPlayed{NotPlayedKind, QString(), RoaringBitmap()};
+        std::map<int, RoaringBitmap> years;
+        std::map<int, RoaringBitmap> decades;
+        {
+            SqlQuery query(db);
+            query.setForwardOnly(true);
+            if (!query.exec(QLatin1String("SELECT id, year, playCount FROM tracks ORDER BY id"))) {
+                qWarning() << "failed to query tracks" << query.lastError();
+                return nullptr;
+            }
+            while (query.next()) {
+                const auto position = static_cast<quint32>(index->trackIds.size());
+                index->trackIds.push_back(query.value(0).toInt());
+                index->allTracks.append(position);
+                const int year = query.value(1).toInt();
+                if (year > 0) {
+                    years[year].append(position);
+                    decades[year / 10 * 10].append(position);
+                }
+                if (query.value(2).toInt() == 0) {
+                    notPlayed.tracks.append(position);
+                }
+            }
+        }
+
+        if (token->load()) {
+            return nullptr;
+        }
+
+        index->facets.push_back(std::move(notPlayed));
+
+        // Links are sorted by track id, so that track positions are appended in ascending order
+        const auto addLinkedFacets = [&](Kind kind, const QString& queryString) {
+            SqlQuery query(db);
+            query.setForwardOnly(true);
+            if (!query.exec(queryString)) {
+                qWarning() << "failed to query facets" << query.lastError();
+                return false;
+            }
+            int lastPosition = -1;
+            while (query.next()) {
+                QString title(query.value(0).toString());
+                if (index->facets.back().kind != kind || index->facets.back().title != title) {
+                    index->facets.push_back({kind, std::move(title), RoaringBitmap()});
+                    lastPosition = -1;
+                }
+                // Skips duplicate links and tracks added after tracks were queried
+                const int position = trackPosition(index->trackIds, query.value(1).toInt());
+                if (position > lastPosition) {
+                    index->facets.back().tracks.append(static_cast<quint32>(position));
+                    lastPosition = position;
+                }
+            }
+            return !token->load();
+        };
+
+        if (!addLinkedFacets(GenreKind, QLatin1String("SELECT genres.title, trackId FROM tracks_genres "
+                                                      "JOIN genres ON genres.id = tracks_genres.genreId "
+                                                      "WHERE genres.title != '' "
+                                                      "ORDER BY genres.title, trackId"))) {
+            return nullptr;
+        }
+
+        for (auto i = decades.rbegin(), end = decades.rend(); i != end; ++i) {
+            index->facets.push_back({DecadeKind, QString::number(i->first), std::move(i->second)});
+        }
+        for (auto i = years.rbegin(), end = years.rend(); i != end; ++i) {
+            index->facets.push_back({YearKind, QString::number(i->first), std::move(i->second)});
+        }
+
+        if (!addLinkedFacets(ArtistKind, QLatin1String("SELECT artists.title, trackId FROM tracks_artists "
+                                                       "JOIN artists ON artists.id = tracks_artists.artistId "
+                                                       "WHERE artists.title != '' "
+                                                       "ORDER BY artists.title, trackId"))) {
+            return nullptr;
+        }
+
+        return index;
+    }
+
+    void FacetsModel::load()
+    {
+        if (!LibraryUtils::instance()->isDatabaseInitialized()) {
+            return;
+        }
+
+        const int generation = mLoad.start();
+        const LatestLoad::Token token(mLoad.token());
+        auto future = threadpools::run(threadpools::JobClass::Bulk, [token]() {
+            return loadIndex(token);
+        });
+
+        using FutureWatcher = QFutureWatcher<std::shared_ptr<Index>>;
+        auto watcher = new FutureWatcher(this);
+        mLoad.setWatcher(generation, watcher);
+        QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
+            mLoad.finish(generation);
+            const std::shared_ptr<Index> index(watcher->result());
+            if (index) {
+                setIndex(index);
+            }
+            watcher->deleteLater();
+        });
+        watcher->setFuture(future);
+    }
+
+    void FacetsModel::setIndex(const std::shared_ptr<const Index>& index)
+    {
+        // Keep selected values that still exist
+        std::vector<bool> selected(index->facets.size());
+        if (mIndex) {
+            for (std::size_t i = 0, max = mIndex->facets.size(); i < max; ++i) {
+                if (!mSelected[i]) {
+                    continue;
+                }
+                const Facet& facet = mIndex->facets[i];
+                const auto found = std::find_if(index->facets.begin(), index->facets.end(), [&](const Facet& newFacet) {
+                    return newFacet.kind == facet.kind && newFacet.title == facet.title;
+                });
+                if (found != index->facets.end()) {
+                    selected[static_cast<std::size_t>(found - index->facets.begin())] = true;
+                }
+            }
+        }
+
+        const bool wasLoaded = isLoaded();
+
+        beginResetModel();
+        mIndex = index;
+        mSelected = std::move(selected);
+        mCounts.assign(mIndex->facets.size(), 0);
+        endResetModel();
+
+        updateCounts();
+
+        if (!wasLoaded) {
+            emit loadedChanged();
+        }
+    }
+
+    void FacetsModel::updateCounts()
+    {
+        if (!mIndex) {
+            return;
+        }
+
+        const std::vector<Facet>& facets = mIndex->facets;
+
+        // Union of selected values of each kind
+        std::array<RoaringBitmap, KindsCount> selections;
+        std::array<bool, KindsCount> active{};
+        for (std::size_t i = 0, max = facets.size(); i < max; ++i) {
+            if (mSelected[i]) {
+                const Facet& facet = facets[i];
+                selections[facet.kind] = RoaringBitmap::united(selections[facet.kind], facet.tracks);
+                active[facet.kind] = true;
+            }
+        }
+
+        // Tracks matching selection of all kinds except one.
+        // Selecting another value of that kind extends it, so count of value is its
+        // intersection with this set rather than with tracks matching whole selection
+        std::array<RoaringBitmap, KindsCount> others;
+        for (int kind = 0; kind < KindsCount; ++kind) {
+            RoaringBitmap tracks(mIndex->allTracks);
+            for (int other = 0; other < KindsCount; ++other) {
+                if (other != kind && active[other]) {
+                    tracks = RoaringBitmap::intersected(tracks, selections[other]);
+                }
+            }
+            others[kind] = std::move(tracks);
+        }
+
+        mMatching = active[NotPlayedKind] ? RoaringBitmap::intersected(others[NotPlayedKind], selections[NotPlayedKind])
+                                          : others[NotPlayedKind];
+
+        for (std::size_t i = 0, max = facets.size(); i < max; ++i) {
+            mCounts[i] = RoaringBitmap::intersectionCount(others[facets[i].kind], facets[i].tracks);
+        }
+
+        if (!facets.empty()) {
+            emit dataChanged(index(0), index(static_cast<int>(facets.size()) - 1), {TracksCountRole});
+        }
+        emit selectionChanged();
+    }
+}
@@ -0,0 +1,119 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_FACETSMODEL_H
+#define UNPLAYER_FACETSMODEL_H
+
+#include <memory>
+#include <vector>
+
+#include <QAbstractListModel>
+
+#include "latestload.h"
+#include "roaringbitmap.h"
+#include "tracklist.h"
+
+namespace unplayer
+{
+    // Library filter by genres, decades, years, artists and whether track was played.
+    // Tracks of each facet value are kept in compressed bitmap over track positions,
+    // so that toggling value only intersects bitmaps in memory and does not query database.
+    // Selected values of the same kind are combined with OR, different kinds with AND.
+    // Count of each value is number of tracks that would match if it was selected
+    class FacetsModel final : public QAbstractListModel
+    {
+        Q_OBJECT
+        Q_PROPERTY(bool loaded READ isLoaded NOTIFY loadedChanged)
+        Q_PROPERTY(int tracksCount READ tracksCount NOTIFY selectionChanged)
+        Q_PROPERTY(bool hasSelection READ hasSelection NOTIFY selectionChanged)
+    public:
+        enum Kind
+        {
+            NotPlayedKind,
+            GenreKind,
+            DecadeKind,
+            YearKind,
+            ArtistKind,
+            KindsCount
+        };
+        Q_ENUM(Kind)
+
+        enum Role
+        {
+            KindRole = Qt::UserRole,
+            TitleRole,
+            TracksCountRole,
+            SelectedRole
+        };
+        Q_ENUM(Role)
+
+        explicit FacetsModel(QObject* parent = nullptr);
+
+        int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+        QVariant data(const QModelIndex& index, int role) const override;
+
+        bool isLoaded() const;
+        // Tracks matching current selection, all tracks when nothing is selected
+        int tracksCount() const;
+        bool hasSelection() const;
+
+        Q_INVOKABLE void toggle(int row);
+        Q_INVOKABLE void clearSelection();
+
+        Q_INVOKABLE unplayer::TrackList getTracks() const;
+
+    protected:
+        QHash<int, QByteArray> roleNames() const override;
+
+    private:
+        struct Facet
+        {
+            Kind kind;
+            QString title;
+            // Positions in Index::trackIds
+            RoaringBitmap tracks;
+        };
+
+        struct Index
+        {
+            // Ids of tracks in ascending order
+            std::vector<int> trackIds;
+            RoaringBitmap allTracks;
+            std::vector<Facet> facets;
+        };
+
+        static std::shared_ptr<Index> loadIndex(const LatestLoad::Token& token);
+
+        void load();
+        void setIndex(const std::shared_ptr<const Index>& index);
+        void updateCounts();
+
+        std::shared_ptr<const Index> mIndex;
+        std::vector<bool> mSelected;
+        std::vector<int> mCounts;
+        RoaringBitmap mMatching;
+        LatestLoad mLoad;
+
+    signals:
+        void loadedChanged();
+        void selectionChanged();
+    };
+}
+
+#endif // UNPLAYER_FACETSMODEL_H
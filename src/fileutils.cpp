@@ -0,0 +1,244 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "fileutils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+#include <QAtomicInt>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureInterfaceBase>
+#include <QRunnable>
+#include <QStorageInfo>
+#include <QThreadPool>
+
+#ifdef Q_OS_LINUX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace unplayer
+{
+    namespace fileutils
+    {
+        namespace
+        {
+            // Removal is bound by storage, not CPU, and SD cards
+            // don't benefit from many concurrent requests
+            const int maxThreads = 4;
+            const int progressInterval = 100;
+
+            class RemoveRunnable final : public QRunnable
+            {
+            public:
+                explicit RemoveRunnable(const QStringList& paths,
+                                        std::vector<char>& removed,
+                                        QAtomicInt& nextIndex,
+                                        QAtomicInt& processedCount)
+                    : mPaths(paths),
+                      mRemoved(removed),
+                      mNextIndex(nextIndex),
+                      mProcessedCount(processedCount)
+                {
+
+                }
+
+                void run() override
+                {
+                    const int count = mPaths.size();
+                    for (int index = mNextIndex.fetchAndAddRelaxed(1); index < count; index = mNextIndex.fetchAndAddRelaxed(1)) {
+                        const QString& path = mPaths[index];
+                        bool ok;
+                        if (QFileInfo(path).isDir()) {
+                            ok = QDir(path).removeRecursively();
+                            if (!ok) {
+                                qWarning() << "failed to remove directory:" << path;
+                            }
+                        } else {
+                            ok = QFile::remove(path);
+                            if (!ok) {
+                                qWarning() << "failed to remove file:" << path;
+                            }
+                        }
+                        // Each thread writes only elements of indexes it has taken
+                        mRemoved[index] = ok;
+                        mProcessedCount.fetchAndAddRelaxed(1);
+                    }
+                }
+
+            private:
+                const QStringList& mPaths;
+                std::vector<char>& mRemoved;
+                QAtomicInt& mNextIndex;
+                QAtomicInt& mProcessedCount;
+            };
+        }
+
+        std::vector<bool> removeFiles(const QStringList& paths, QFutureInterfaceBase* futureInterface)
+        {
+            if (paths.isEmpty()) {
+                return {};
+            }
+
+            std::vector<char> removed(paths.size(), false);
+            QAtomicInt nextIndex(0);
+            QAtomicInt processedCount(0);
+
+            if (futureInterface) {
+                futureInterface->setProgressRange(0, paths.size());
+            }
+
+            {
+                QThreadPool pool;
+                pool.setMaxThreadCount(std::min(maxThreads, paths.size()));
+                for (int i = 0, max = pool.maxThreadCount(); i < max; ++i) {
+                    pool.start(new RemoveRunnable(paths, removed, nextIndex, processedCount));
+                }
+                while (!pool.waitForDone(progressInterval)) {
+                    if (futureInterface) {
+                        futureInterface->setProgressValue(processedCount.load());
+                    }
+                }
+            }
+
+            if (futureInterface) {
+                futureInterface->setProgressValue(paths.size());
+            }
+
+            return std::vector<bool>(removed.begin(), removed.end());
+        }
+
+        std::vector<FileEntry> listFiles(const QString& directory, const FlatHashSet<QByteArray>& suffixes)
+        {
+            std::vector<FileEntry> files;
+            const QString prefix(directory + QLatin1Char('/'));
+
+#ifdef Q_OS_LINUX
+            const int fd = open(QFile::encodeName(directory).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd == -1) {
+                qWarning() << "failed to open directory:" << directory;
+                return files;
+            }
+            // readdir() reads entries in bulk with getdents64()
+            DIR* dir = fdopendir(fd);
+            if (!dir) {
+                qWarning() << "failed to open directory:" << directory;
+                close(fd);
+                return files;
+            }
+
+            while (const dirent* entry = readdir(dir)) {
+                const char* name = entry->d_name;
+                // Also skips "." and ".."
+                if (name[0] == '.') {
+                    continue;
+                }
+                if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+                    continue;
+                }
+
+                const char* dot = std::strrchr(name, '.');
+                if (!dot || !contains(suffixes, QByteArray::fromRawData(dot + 1, static_cast<int>(std::strlen(dot + 1))))) {
+                    continue;
+                }
+
+                struct stat info;
+                if (fstatat(fd, name, &info, 0) != 0 || !S_ISREG(info.st_mode)) {
+                    continue;
+                }
+                if (faccessat(fd, name, R_OK, 0) != 0) {
+                    continue;
+                }
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+                const long long modificationTime = static_cast<long long>(info.st_mtim.tv_sec) * 1000 + info.st_mtim.tv_nsec / 1000000;
+#else
+                const long long modificationTime = static_cast<long long>(info.st_mtim.tv_sec) * 1000;
+#endif
+                files.push_back({prefix + QFile::decodeName(name),
+                                 modificationTime,
+                                 static_cast<qint64>(info.st_size),
+                                 static_cast<quint64>(info.st_dev),
+                                 static_cast<quint64>(info.st_ino)});
+            }
+
+            closedir(dir);
+#else
+            const QFileInfoList entries(QDir(directory).entryInfoList(QDir::Files | QDir::Readable));
+            for (const QFileInfo& fileInfo : entries) {
+                if (contains(suffixes, QFile::encodeName(fileInfo.suffix()))) {
+                    files.push_back({fileInfo.filePath(), fileInfo.lastModified().toMSecsSinceEpoch(), fileInfo.size(), 0, 0});
+                }
+            }
+#endif
+
+            return files;
+        }
+
+        void prefetchFile(const QString& filePath, qint64 prefetchedSize)
+        {
+            QFile file(filePath);
+            if (!file.open(QIODevice::ReadOnly)) {
+                qWarning() << "failed to open file for prefetching:" << filePath;
+                return;
+            }
+
+#ifdef Q_OS_LINUX
+            // Rest of file is read by kernel in background
+            posix_fadvise(file.handle(), 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+            const qint64 bufferSize = 64 * 1024;
+            QByteArray buffer(bufferSize, Qt::Uninitialized);
+            for (qint64 read = 0; read < prefetchedSize;) {
+                const qint64 count = file.read(buffer.data(), std::min(bufferSize, prefetchedSize - read));
+                if (count <= 0) {
+                    break;
+                }
+                read += count;
+            }
+        }
+
+        bool isNetworkFileSystem(const QString& path)
+        {
+            static const std::unordered_set<QByteArray> types{
+                QByteArrayLiteral("nfs"),
+                QByteArrayLiteral("nfs4"),
+                QByteArrayLiteral("cifs"),
+                QByteArrayLiteral("smb3"),
+                QByteArrayLiteral("smbfs"),
+                QByteArrayLiteral("9p"),
+                QByteArrayLiteral("davfs"),
+                QByteArrayLiteral("fuse.sshfs"),
+                QByteArrayLiteral("fuse.rclone"),
+                QByteArrayLiteral("fuse.davfs2")
+            };
+            const QStorageInfo storage(path);
+            return storage.isValid() && types.count(storage.fileSystemType()) > 0;
+        }
+    }
+}
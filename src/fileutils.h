@@ -0,0 +1,70 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_FILEUTILS_H
+#define UNPLAYER_FILEUTILS_H
+
+#include <vector>
+
+#include <QByteArray>
+#include <QStringList>
+
+#include "flathash.h"
+#include "stdutils.h"
+
+class QFutureInterfaceBase;
+
+namespace unplayer
+{
+    namespace fileutils
+    {
+        // Removes files and directories (recursively) using several threads.
+        // Blocks until all paths are processed. If futureInterface is not null,
+        // its progress value is set to number of processed paths.
+        // Returns true for each path which was removed
+        std::vector<bool> removeFiles(const QStringList& paths, QFutureInterfaceBase* futureInterface = nullptr);
+
+        struct FileEntry
+        {
+            QString filePath;
+            // Milliseconds since epoch, with the same precision as QFileInfo::lastModified()
+            long long modificationTime;
+            qint64 size;
+            // Zero if unknown
+            quint64 device;
+            quint64 inode;
+        };
+
+        // Lists readable non-hidden files in directory (following symlinks) which suffixes
+        // are contained in suffixes (encoded with QFile::encodeName()).
+        // On Linux names are filtered before they are decoded, and only matching files
+        // are stat'ed, relative to directory descriptor
+        std::vector<FileEntry> listFiles(const QString& directory, const FlatHashSet<QByteArray>& suffixes);
+
+        // Makes file contents cached by the system, so that opening and reading it later
+        // doesn't wait for slow storage. Blocks until first prefetchedSize bytes are read
+        void prefetchFile(const QString& filePath, qint64 prefetchedSize);
+
+        // Returns true if path is on NFS, SMB, sshfs or other file system
+        // which is accessed over network
+        bool isNetworkFileSystem(const QString& path);
+    }
+}
+
+#endif // UNPLAYER_FILEUTILS_H
@@ -19,16 +19,127 @@
 #include "filterproxymodel.h"
 
 #include <algorithm>
-#include <QItemSelectionModel>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <numeric>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define UNPLAYER_NEON
+#endif
+
+#include <QFutureWatcher>
+#include <QTimer>
+#include <QtAlgorithms>
+
+#include "threadpools.h"
 
 namespace unplayer
 {
+    namespace
+    {
+        inline bool matchesAt(const ushort* haystack, const ushort* needle, int needleSize)
+        {
+            return std::memcmp(haystack + 1, needle + 1, static_cast<size_t>(needleSize - 1) * sizeof(ushort)) == 0;
+        }
+
+        // Looks for first character of needle in 8 UTF-16 code units at once,
+        // and compares the rest only where it was found
+        bool contains(const QString& haystack, const QString& needle)
+        {
+            const int needleSize = needle.size();
+            if (needleSize == 0) {
+                return true;
+            }
+            const int positions = haystack.size() - needleSize + 1;
+            if (positions <= 0) {
+                return false;
+            }
+
+            const ushort* h = haystack.utf16();
+            const ushort* n = needle.utf16();
+            int i = 0;
+
+#if defined(__SSE2__)
+            const __m128i first = _mm_set1_epi16(static_cast<short>(n[0]));
+            for (; i + 8 <= positions; i += 8) {
+                const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h + i));
+                // Two bits for each code unit
+                uint mask = static_cast<uint>(_mm_movemask_epi8(_mm_cmpeq_epi16(chunk, first)));
+                while (mask != 0) {
+                    const int offset = qCountTrailingZeroBits(mask) / 2;
+                    if (matchesAt(h + i + offset, n, needleSize)) {
+                        return true;
+                    }
+                    mask &= ~(3u << (offset * 2));
+                }
+            }
+#elif defined(UNPLAYER_NEON)
+            const uint16x8_t first = vdupq_n_u16(n[0]);
+            for (; i + 8 <= positions; i += 8) {
+                const uint16x8_t equal = vceqq_u16(vld1q_u16(h + i), first);
+                // Eight bits for each code unit
+                quint64 mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(equal, 4)), 0);
+                while (mask != 0) {
+                    const int offset = qCountTrailingZeroBits(mask) / 8;
+                    if (matchesAt(h + i + offset, n, needleSize)) {
+                        return true;
+                    }
+                    mask &= ~(Q_UINT64_C(0xff) << (offset * 8));
+                }
+            }
+#endif
+
+            for (; i < positions; ++i) {
+                if (h[i] == n[0] && matchesAt(h + i, n, needleSize)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    }
+
     FilterProxyModel::FilterProxyModel()
-        : mSortEnabled(false),
-          mSelectionModel(new QItemSelectionModel(this))
+        : mSortKeysValid(false),
+          mStringSortKeys(false),
+          mSortEnabled(false),
+          mSortColumn(-1),
+          mSortOrder(Qt::AscendingOrder),
+          mSortRanksValid(false),
+          mSortingQueued(false),
+          mSortLoad(this),
+          mSearchKeysValid(false),
+          mSearchKeysRole(-1),
+          mRowsMappingValid(false),
+          mSelectedCount(0)
     {
         mCollator.setNumericMode(true);
-        QObject::connect(mSelectionModel, &QItemSelectionModel::selectionChanged, this, &FilterProxyModel::selectionChanged);
+
+        // Connected first so that mapping is rebuilt before other slots use it
+        QObject::connect(this, &QAbstractItemModel::rowsInserted, this, &FilterProxyModel::invalidateRowsMapping);
+        QObject::connect(this, &QAbstractItemModel::rowsRemoved, this, &FilterProxyModel::invalidateRowsMapping);
+        QObject::connect(this, &QAbstractItemModel::rowsMoved, this, &FilterProxyModel::invalidateRowsMapping);
+        QObject::connect(this, &QAbstractItemModel::layoutChanged, this, &FilterProxyModel::invalidateRowsMapping);
+        QObject::connect(this, &QAbstractItemModel::modelReset, this, &FilterProxyModel::invalidateRowsMapping);
+
+        // Rows that are filtered out are deselected. This is also called
+        // before rows are removed from source model
+        QObject::connect(this, &QAbstractItemModel::rowsAboutToBeRemoved, this, [=](const QModelIndex&, int first, int last) {
+            if (mSelectedCount == 0) {
+                return;
+            }
+            const int count = mSelectedCount;
+            const std::vector<int>& rows = sourceRows();
+            for (int i = first; i <= last; ++i) {
+                setSourceRowSelected(rows[i], false);
+            }
+            if (mSelectedCount != count) {
+                emit selectionChanged();
+            }
+        });
     }
 
     void FilterProxyModel::classBegin()
@@ -45,12 +156,15 @@ namespace unplayer
 
     std::vector<int> FilterProxyModel::sourceIndexes() const
     {
-        std::vector<int> indexes;
-        indexes.reserve(rowCount());
-        for (int i = 0, max = rowCount(); i < max; ++i) {
-            indexes.push_back(sourceIndex(i));
+        return sourceRows();
+    }
+
+    const std::vector<int>& FilterProxyModel::sourceRows() const
+    {
+        if (!mRowsMappingValid) {
+            buildRowsMapping();
         }
-        return indexes;
+        return mSourceRows;
     }
 
     bool FilterProxyModel::isSortEnabled() const
@@ -61,67 +175,502 @@ namespace unplayer
     void FilterProxyModel::setSortEnabled(bool sortEnabled)
     {
         mSortEnabled = sortEnabled;
+        // Changed rows are resorted on worker thread instead of
+        // being compared one by one on main thread
+        setDynamicSortFilter(!sortEnabled);
     }
 
-    int FilterProxyModel::proxyIndex(int sourceIndex) const
+    const QString& FilterProxyModel::filterText() const
     {
-        return mapFromSource(sourceModel()->index(sourceIndex, 0)).row();
+        return mFilterText;
     }
 
-    int FilterProxyModel::sourceIndex(int proxyIndex) const
+    void FilterProxyModel::setFilterText(const QString& filterText)
     {
-        return mapToSource(index(proxyIndex, 0)).row();
+        if (filterText == mFilterText) {
+            return;
+        }
+        const QString folded(filterText.toCaseFolded());
+        // Rows that didn't match previous text can't match text that contains it
+        if (mFoldedFilterText.isEmpty() || !folded.contains(mFoldedFilterText)) {
+            mFilterCandidates.assign(mFilterCandidates.size(), true);
+        }
+        mFilterText = filterText;
+        mFoldedFilterText = folded;
+        emit filterTextChanged();
+        invalidateFilter();
     }
 
-    QItemSelectionModel* FilterProxyModel::selectionModel() const
+    int FilterProxyModel::proxyIndex(int sourceIndex) const
     {
-        return mSelectionModel;
+        if (!mRowsMappingValid) {
+            buildRowsMapping();
+        }
+        if (sourceIndex < 0 || sourceIndex >= static_cast<int>(mProxyRows.size())) {
+            return -1;
+        }
+        return mProxyRows[sourceIndex];
+    }
+
+    int FilterProxyModel::sourceIndex(int proxyIndex) const
+    {
+        const std::vector<int>& rows = sourceRows();
+        if (proxyIndex < 0 || proxyIndex >= static_cast<int>(rows.size())) {
+            return -1;
+        }
+        return rows[proxyIndex];
     }
 
     bool FilterProxyModel::hasSelection() const
     {
-        return mSelectionModel->hasSelection();
+        return mSelectedCount > 0;
     }
 
     int FilterProxyModel::selectedIndexesCount() const
     {
-        return mSelectionModel->selectedIndexes().size();
+        return mSelectedCount;
     }
 
     std::vector<int> FilterProxyModel::selectedSourceIndexes() const
     {
-        QModelIndexList modelIndexes(mSelectionModel->selectedIndexes());
-        std::sort(modelIndexes.begin(), modelIndexes.end());
-
         std::vector<int> indexes;
-        indexes.reserve(modelIndexes.size());
-        for (const QModelIndex& index : modelIndexes) {
-            indexes.push_back(index.row());
+        if (mSelectedCount == 0) {
+            return indexes;
+        }
+        indexes.reserve(mSelectedCount);
+
+        // Filtering keeps order of source rows
+        if (!mSortEnabled) {
+            for (int i = 0, max = mSelectedRows.size(); i < max; ++i) {
+                if (mSelectedRows[i]) {
+                    indexes.push_back(i);
+                }
+            }
+            return indexes;
+        }
+
+        for (int row : sourceRows()) {
+            if (mSelectedRows[row]) {
+                indexes.push_back(row);
+            }
         }
         return indexes;
     }
 
     bool FilterProxyModel::isSelected(int row) const
     {
-        return mSelectionModel->isSelected(index(row, 0));
+        if (mSelectedCount == 0) {
+            return false;
+        }
+        const int sourceRow = sourceIndex(row);
+        return sourceRow >= 0 && sourceRow < static_cast<int>(mSelectedRows.size()) && mSelectedRows[sourceRow];
     }
 
     void FilterProxyModel::select(int row)
     {
-        mSelectionModel->select(index(row, 0), QItemSelectionModel::Toggle);
+        const int sourceRow = sourceIndex(row);
+        if (sourceRow < 0 || sourceRow >= static_cast<int>(mSelectedRows.size())) {
+            return;
+        }
+        setSourceRowSelected(sourceRow, !mSelectedRows[sourceRow]);
+        emit selectionChanged();
     }
 
     void FilterProxyModel::selectAll()
     {
-        mSelectionModel->select(QItemSelection(index(0, 0), index(rowCount() - 1, 0)), QItemSelectionModel::Select);
+        const int count = rowCount();
+        if (count == static_cast<int>(mSelectedRows.size())) {
+            // Nothing is filtered out
+            mSelectedRows.assign(mSelectedRows.size(), true);
+            mSelectedCount = count;
+            emit selectionChanged();
+        } else {
+            selectRows(0, count - 1);
+        }
+    }
+
+    void FilterProxyModel::clearSelection()
+    {
+        if (mSelectedCount > 0) {
+            mSelectedRows.assign(mSelectedRows.size(), false);
+            mSelectedCount = 0;
+            emit selectionChanged();
+        }
+    }
+
+    void FilterProxyModel::selectRows(int first, int last)
+    {
+        const std::vector<int>& rows = sourceRows();
+        for (int i = std::max(first, 0), max = std::min(last, static_cast<int>(rows.size()) - 1); i <= max; ++i) {
+            setSourceRowSelected(rows[i], true);
+        }
+        emit selectionChanged();
+    }
+
+    void FilterProxyModel::setSourceModel(QAbstractItemModel* sourceModel)
+    {
+        if (this->sourceModel()) {
+            QObject::disconnect(this->sourceModel(), nullptr, this, nullptr);
+        }
+
+        invalidateSortKeys();
+        invalidateSortRanks();
+        invalidateSearchKeys();
+
+        const bool hadSelection = (mSelectedCount > 0);
+        mSelectedRows.assign(sourceModel ? sourceModel->rowCount() : 0, false);
+        mSelectedCount = 0;
+        if (hadSelection) {
+            emit selectionChanged();
+        }
+
+        // Connect before QSortFilterProxyModel does, so that sort keys
+        // are updated when it sorts changed rows
+        if (sourceModel) {
+            QObject::connect(sourceModel, &QAbstractItemModel::rowsInserted, this, [=](const QModelIndex&, int first, int last) {
+                mSelectedRows.insert(mSelectedRows.begin() + first, last - first + 1, false);
+
+                invalidateSortRanks();
+                queueSorting();
+
+                if (mSortKeysValid && mStringSortKeys) {
+                    std::vector<QCollatorSortKey> keys;
+                    keys.reserve(last - first + 1);
+                    for (int i = first; i <= last; ++i) {
+                        keys.push_back(sortKey(i));
+                    }
+                    mSortKeys.insert(mSortKeys.begin() + first, std::make_move_iterator(keys.begin()), std::make_move_iterator(keys.end()));
+                }
+
+                if (mSearchKeysValid) {
+                    std::vector<QString> keys;
+                    keys.reserve(last - first + 1);
+                    for (int i = first; i <= last; ++i) {
+                        keys.push_back(searchKey(i));
+                    }
+                    mSearchKeys.insert(mSearchKeys.begin() + first, std::make_move_iterator(keys.begin()), std::make_move_iterator(keys.end()));
+                    mFilterCandidates.insert(mFilterCandidates.begin() + first, last - first + 1, true);
+                }
+            });
+            QObject::connect(sourceModel, &QAbstractItemModel::rowsRemoved, this, [=](const QModelIndex&, int first, int last) {
+                // Removed rows were deselected when proxy removed them
+                mSelectedRows.erase(mSelectedRows.begin() + first, mSelectedRows.begin() + last + 1);
+
+                // Order of remaining rows doesn't change
+                if (mSortRanksValid) {
+                    mSortRanks.erase(mSortRanks.begin() + first, mSortRanks.begin() + last + 1);
+                }
+
+                if (mSortKeysValid && mStringSortKeys) {
+                    mSortKeys.erase(mSortKeys.begin() + first, mSortKeys.begin() + last + 1);
+                }
+
+                if (mSearchKeysValid) {
+                    mSearchKeys.erase(mSearchKeys.begin() + first, mSearchKeys.begin() + last + 1);
+                    mFilterCandidates.erase(mFilterCandidates.begin() + first, mFilterCandidates.begin() + last + 1);
+                }
+            });
+            QObject::connect(sourceModel, &QAbstractItemModel::dataChanged, this, [=](const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles) {
+                if (roles.isEmpty() || roles.contains(sortRole())) {
+                    invalidateSortRanks();
+                    queueSorting();
+                }
+
+                if (mSortKeysValid && mStringSortKeys && (roles.isEmpty() || roles.contains(sortRole()))) {
+                    for (int i = topLeft.row(), max = bottomRight.row(); i <= max; ++i) {
+                        mSortKeys[i] = sortKey(i);
+                    }
+                }
+
+                if (mSearchKeysValid && (roles.isEmpty() || roles.contains(mSearchKeysRole))) {
+                    for (int i = topLeft.row(), max = bottomRight.row(); i <= max; ++i) {
+                        mSearchKeys[i] = searchKey(i);
+                        mFilterCandidates[i] = true;
+                    }
+                }
+            });
+            QObject::connect(sourceModel, &QAbstractItemModel::rowsMoved, this, [=]() {
+                invalidateSortKeys();
+                invalidateSortRanks();
+                queueSorting();
+                invalidateSearchKeys();
+                clearSelection();
+            });
+            QObject::connect(sourceModel, &QAbstractItemModel::layoutAboutToBeChanged, this, [=]() {
+                mSelectedDuringLayoutChange.clear();
+                if (mSelectedCount > 0) {
+                    mSelectedDuringLayoutChange.reserve(mSelectedCount);
+                    for (int i = 0, max = mSelectedRows.size(); i < max; ++i) {
+                        if (mSelectedRows[i]) {
+                            mSelectedDuringLayoutChange.emplace_back(this->sourceModel()->index(i, 0));
+                        }
+                    }
+                }
+            });
+            QObject::connect(sourceModel, &QAbstractItemModel::layoutChanged, this, [=]() {
+                invalidateSortKeys();
+                invalidateSortRanks();
+                queueSorting();
+                invalidateSearchKeys();
+                if (!mSelectedDuringLayoutChange.empty()) {
+                    mSelectedRows.assign(this->sourceModel()->rowCount(), false);
+                    mSelectedCount = 0;
+                    for (const QPersistentModelIndex& index : mSelectedDuringLayoutChange) {
+                        if (index.isValid()) {
+                            setSourceRowSelected(index.row(), true);
+                        }
+                    }
+                    mSelectedDuringLayoutChange.clear();
+                    emit selectionChanged();
+                }
+            });
+            QObject::connect(sourceModel, &QAbstractItemModel::modelReset, this, [=]() {
+                invalidateSortKeys();
+                invalidateSortRanks();
+                queueSorting();
+                invalidateSearchKeys();
+                const bool hadSelection = (mSelectedCount > 0);
+                mSelectedRows.assign(this->sourceModel()->rowCount(), false);
+                mSelectedCount = 0;
+                if (hadSelection) {
+                    emit selectionChanged();
+                }
+            });
+        }
+
+        QSortFilterProxyModel::setSourceModel(sourceModel);
+        queueSorting();
+    }
+
+    void FilterProxyModel::sort(int column, Qt::SortOrder order)
+    {
+        // Sort role may have changed
+        invalidateSortKeys();
+        invalidateSortRanks();
+        mSortColumn = column;
+        mSortOrder = order;
+        if (mSortEnabled && column >= 0 && sourceModel()) {
+            startSorting();
+        } else {
+            QSortFilterProxyModel::sort(column, order);
+        }
+    }
+
+    bool FilterProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex& sourceParent) const
+    {
+        if (mFoldedFilterText.isEmpty()) {
+            return QSortFilterProxyModel::filterAcceptsRow(sourceRow, sourceParent);
+        }
+
+        if (!mSearchKeysValid || mSearchKeysRole != filterRole()) {
+            buildSearchKeys();
+        }
+        std::vector<bool>::reference candidate(mFilterCandidates[sourceRow]);
+        if (!candidate) {
+            return false;
+        }
+        const bool accepted = contains(mSearchKeys[sourceRow], mFoldedFilterText);
+        candidate = accepted;
+        return accepted;
     }
 
     bool FilterProxyModel::lessThan(const QModelIndex& left, const QModelIndex& right) const
     {
-        const QVariant leftVariant(left.data(sortRole()));
-        if (leftVariant.type() == QVariant::String) {
-            return (mCollator.compare(leftVariant.toString(), right.data(sortRole()).toString()) < 0);
+        if (mSortRanksValid) {
+            return mSortRanks[left.row()] < mSortRanks[right.row()];
+        }
+
+        const int leftGroup = sortGroup(left.row());
+        const int rightGroup = sortGroup(right.row());
+        if (leftGroup != rightGroup) {
+            return leftGroup < rightGroup;
+        }
+
+        if (!mSortKeysValid) {
+            buildSortKeys();
+        }
+        if (mStringSortKeys) {
+            return (mSortKeys[left.row()].compare(mSortKeys[right.row()]) < 0);
         }
         return QSortFilterProxyModel::lessThan(left, right);
     }
+
+    int FilterProxyModel::sortGroup(int) const
+    {
+        return 0;
+    }
+
+    void FilterProxyModel::startSorting()
+    {
+        mSortingQueued = false;
+
+        const QAbstractItemModel* model = sourceModel();
+        const int count = model->rowCount();
+        if (count == 0 || model->index(0, 0).data(sortRole()).type() != QVariant::String) {
+            // Numbers and other types are cheap to compare on main thread
+            mSortLoad.cancel();
+            QSortFilterProxyModel::sort(mSortColumn, mSortOrder);
+            return;
+        }
+
+        std::vector<std::pair<int, QString>> rows;
+        rows.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            rows.emplace_back(sortGroup(i), model->index(i, 0).data(sortRole()).toString());
+        }
+
+        // QCollator is not thread-safe, worker uses its own
+        const QLocale locale(mCollator.locale());
+
+        // FIXME: use init capture when moving to C++14
+        auto future = threadpools::run(threadpools::JobClass::Interactive, std::bind([locale](const std::vector<std::pair<int, QString>>& rows) {
+            QCollator collator(locale);
+            collator.setNumericMode(true);
+
+            std::vector<QCollatorSortKey> keys;
+            keys.reserve(rows.size());
+            for (const auto& row : rows) {
+                keys.push_back(collator.sortKey(row.second));
+            }
+
+            std::vector<int> permutation(rows.size());
+            std::iota(permutation.begin(), permutation.end(), 0);
+            std::stable_sort(permutation.begin(), permutation.end(), [&](int first, int second) {
+                if (rows[first].first != rows[second].first) {
+                    return rows[first].first < rows[second].first;
+                }
+                return keys[first].compare(keys[second]) < 0;
+            });
+
+            std::vector<int> ranks(rows.size());
+            for (int i = 0, max = permutation.size(); i < max; ++i) {
+                ranks[permutation[i]] = i;
+            }
+            return ranks;
+        }, std::move(rows)));
+
+        using Watcher = QFutureWatcher<std::vector<int>>;
+        auto watcher = new Watcher(this);
+        const int generation = mSortLoad.start(watcher);
+        QObject::connect(watcher, &Watcher::finished, this, [=]() {
+            mSortLoad.finish(generation);
+            std::vector<int> ranks(watcher->result());
+            watcher->deleteLater();
+            // Source model changes after rows were copied supersede this load,
+            // so this can only happen if it was replaced without signals
+            if (static_cast<int>(ranks.size()) != sourceModel()->rowCount()) {
+                queueSorting();
+                return;
+            }
+            mSortRanks = std::move(ranks);
+            mSortRanksValid = true;
+            // Comparing ranks is cheap, proxy emits single layoutChanged
+            QSortFilterProxyModel::sort(mSortColumn, mSortOrder);
+        });
+        watcher->setFuture(future);
+    }
+
+    void FilterProxyModel::queueSorting()
+    {
+        if (mSortingQueued || !mSortEnabled || mSortColumn < 0 || !sourceModel()) {
+            return;
+        }
+        mSortingQueued = true;
+        QTimer::singleShot(0, this, [=]() {
+            if (mSortingQueued && sourceModel()) {
+                startSorting();
+            }
+        });
+    }
+
+    void FilterProxyModel::invalidateSortRanks()
+    {
+        mSortRanks.clear();
+        mSortRanksValid = false;
+        // Rows were copied before source model changed
+        mSortLoad.cancel();
+    }
+
+    void FilterProxyModel::buildSortKeys() const
+    {
+        mSortKeys.clear();
+        const int count = sourceModel()->rowCount();
+        mStringSortKeys = (count > 0 && sourceModel()->index(0, 0).data(sortRole()).type() == QVariant::String);
+        if (mStringSortKeys) {
+            mSortKeys.reserve(count);
+            for (int i = 0; i < count; ++i) {
+                mSortKeys.push_back(sortKey(i));
+            }
+        }
+        // Type of data is not known until there are rows
+        mSortKeysValid = (count > 0);
+    }
+
+    QCollatorSortKey FilterProxyModel::sortKey(int sourceRow) const
+    {
+        return mCollator.sortKey(sourceModel()->index(sourceRow, 0).data(sortRole()).toString());
+    }
+
+    void FilterProxyModel::invalidateSortKeys()
+    {
+        mSortKeys.clear();
+        mSortKeysValid = false;
+    }
+
+    void FilterProxyModel::buildSearchKeys() const
+    {
+        mSearchKeysRole = filterRole();
+        const int count = sourceModel()->rowCount();
+        mSearchKeys.clear();
+        mSearchKeys.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            mSearchKeys.push_back(searchKey(i));
+        }
+        mFilterCandidates.assign(count, true);
+        mSearchKeysValid = true;
+    }
+
+    QString FilterProxyModel::searchKey(int sourceRow) const
+    {
+        return sourceModel()->index(sourceRow, 0).data(mSearchKeysRole).toString().toCaseFolded();
+    }
+
+    void FilterProxyModel::invalidateSearchKeys()
+    {
+        mSearchKeys.clear();
+        mFilterCandidates.clear();
+        mSearchKeysValid = false;
+    }
+
+    void FilterProxyModel::buildRowsMapping() const
+    {
+        const int count = rowCount();
+        mSourceRows.resize(count);
+        mProxyRows.assign(sourceModel() ? sourceModel()->rowCount() : 0, -1);
+        for (int i = 0; i < count; ++i) {
+            const int sourceRow = mapToSource(index(i, 0)).row();
+            mSourceRows[i] = sourceRow;
+            if (sourceRow >= 0 && sourceRow < static_cast<int>(mProxyRows.size())) {
+                mProxyRows[sourceRow] = i;
+            }
+        }
+        mRowsMappingValid = true;
+    }
+
+    void FilterProxyModel::invalidateRowsMapping()
+    {
+        mRowsMappingValid = false;
+    }
+
+    void FilterProxyModel::setSourceRowSelected(int sourceRow, bool selected)
+    {
+        if (sourceRow < 0 || sourceRow >= static_cast<int>(mSelectedRows.size())) {
+            return;
+        }
+        std::vector<bool>::reference bit(mSelectedRows[sourceRow]);
+        if (bit != selected) {
+            bit = selected;
+            mSelectedCount += selected ? 1 : -1;
+        }
+    }
 }
@@ -22,10 +22,11 @@
 #include <vector>
 
 #include <QCollator>
+#include <QPersistentModelIndex>
 #include <QQmlParserStatus>
 #include <QSortFilterProxyModel>
 
-class QItemSelectionModel;
+#include "latestload.h"
 
 namespace unplayer
 {
@@ -34,8 +35,8 @@ namespace unplayer
         Q_OBJECT
         Q_INTERFACES(QQmlParserStatus)
         Q_PROPERTY(bool sortEnabled READ isSortEnabled WRITE setSortEnabled)
+        Q_PROPERTY(QString filterText READ filterText WRITE setFilterText NOTIFY filterTextChanged)
         Q_PROPERTY(std::vector<int> sourceIndexes READ sourceIndexes)
-        Q_PROPERTY(QItemSelectionModel* selectionModel READ selectionModel CONSTANT)
         Q_PROPERTY(bool hasSelection READ hasSelection NOTIFY selectionChanged)
         Q_PROPERTY(int selectedIndexesCount READ selectedIndexesCount NOTIFY selectionChanged)
         Q_PROPERTY(std::vector<int> selectedSourceIndexes READ selectedSourceIndexes)
@@ -45,29 +46,104 @@ namespace unplayer
         void componentComplete() override;
 
         std::vector<int> sourceIndexes() const;
+        // Source rows of proxy rows, computed once after proxy rows change
+        const std::vector<int>& sourceRows() const;
 
         bool isSortEnabled() const;
         void setSortEnabled(bool sortEnabled);
 
+        // Case insensitive substring filter on filterRole. When new text
+        // contains previous one, only rows that matched it are tested again
+        const QString& filterText() const;
+        void setFilterText(const QString& filterText);
+
         Q_INVOKABLE int proxyIndex(int sourceIndex) const;
         Q_INVOKABLE int sourceIndex(int proxyIndex) const;
 
-        QItemSelectionModel* selectionModel() const;
         bool hasSelection() const;
         int selectedIndexesCount() const;
+        // Ordered as proxy rows
         std::vector<int> selectedSourceIndexes() const;
         Q_INVOKABLE bool isSelected(int row) const;
         Q_INVOKABLE void select(int row);
         Q_INVOKABLE void selectAll();
+        Q_INVOKABLE void clearSelection();
+
+        void setSourceModel(QAbstractItemModel* sourceModel) override;
+        void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
 
     protected:
+        bool filterAcceptsRow(int sourceRow, const QModelIndex& sourceParent) const override;
         bool lessThan(const QModelIndex& left, const QModelIndex& right) const override;
 
+        // Rows of lower group are placed before rows of higher group regardless of their sort role data.
+        // Called on main thread
+        virtual int sortGroup(int sourceRow) const;
+
+        // Selects proxy rows from first to last
+        void selectRows(int first, int last);
+
     private:
+        // String data of sort role is collated and sorted on worker thread.
+        // Proxy is sorted by ranks of source rows when it finishes
+        void startSorting();
+        // Coalesces resorting after several changes of source model
+        void queueSorting();
+        void invalidateSortRanks();
+
+        // Collation sort keys of source rows are computed once and then
+        // compared instead of collating strings on every comparison
+        void buildSortKeys() const;
+        QCollatorSortKey sortKey(int sourceRow) const;
+        void invalidateSortKeys();
+
+        // Case folded filterRole data of source rows
+        void buildSearchKeys() const;
+        QString searchKey(int sourceRow) const;
+        void invalidateSearchKeys();
+
+        void setSourceRowSelected(int sourceRow, bool selected);
+
+        void buildRowsMapping() const;
+        void invalidateRowsMapping();
+
         QCollator mCollator;
+        mutable std::vector<QCollatorSortKey> mSortKeys;
+        mutable bool mSortKeysValid;
+        mutable bool mStringSortKeys;
+
         bool mSortEnabled;
-        QItemSelectionModel* mSelectionModel;
+        int mSortColumn;
+        Qt::SortOrder mSortOrder;
+
+        // Position of each source row in sorted order
+        std::vector<int> mSortRanks;
+        bool mSortRanksValid;
+        bool mSortingQueued;
+        LatestLoad mSortLoad;
+
+        QString mFilterText;
+        QString mFoldedFilterText;
+        mutable std::vector<QString> mSearchKeys;
+        mutable bool mSearchKeysValid;
+        mutable int mSearchKeysRole;
+        // Source rows that can still match filter text (false if they
+        // didn't match its prefix)
+        mutable std::vector<bool> mFilterCandidates;
+
+        // Proxy row to source row and source row to proxy row (-1 if filtered out)
+        mutable std::vector<int> mSourceRows;
+        mutable std::vector<int> mProxyRows;
+        mutable bool mRowsMappingValid;
+
+        // Selection is stored as bit for each source row, so that
+        // selecting all rows and counting selected ones are cheap
+        std::vector<bool> mSelectedRows;
+        int mSelectedCount;
+        // Selected rows while source model changes its layout
+        std::vector<QPersistentModelIndex> mSelectedDuringLayoutChange;
     signals:
+        void filterTextChanged();
         void selectionChanged();
     };
 }
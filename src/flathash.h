@@ -0,0 +1,403 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_FLATHASH_H
+#define UNPLAYER_FLATHASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include <QByteArray>
+#include <QString>
+#include <QUrl>
+
+namespace unplayer
+{
+    // Hash for FlatHashMap and FlatHashSet. Strings are hashed by their characters,
+    // so QStringRef and QLatin1String can be used to find QString key without
+    // creating QString, and QByteArray::fromRawData() to find QByteArray key.
+    // Result is mixed so that its low bits are used as index in the table
+    struct FlatHash
+    {
+        static std::uint32_t mix(std::uint64_t hash)
+        {
+            hash ^= hash >> 33;
+            hash *= 0xff51afd7ed558ccdULL;
+            hash ^= hash >> 33;
+            hash *= 0xc4ceb9fe1a85ec53ULL;
+            hash ^= hash >> 33;
+            return static_cast<std::uint32_t>(hash);
+        }
+
+        // FNV-1a
+        template<class Char>
+        static std::uint32_t hashCharacters(const Char* characters, int size)
+        {
+            std::uint64_t hash = 0xcbf29ce484222325ULL;
+            for (int i = 0; i < size; ++i) {
+                hash ^= static_cast<std::uint16_t>(characters[i]);
+                hash *= 0x100000001b3ULL;
+            }
+            return mix(hash);
+        }
+
+        std::uint32_t operator()(const QString& string) const
+        {
+            return hashCharacters(string.utf16(), string.size());
+        }
+
+        std::uint32_t operator()(const QStringRef& string) const
+        {
+            return hashCharacters(reinterpret_cast<const ushort*>(string.unicode()), string.size());
+        }
+
+        std::uint32_t operator()(QLatin1String string) const
+        {
+            return hashCharacters(reinterpret_cast<const uchar*>(string.data()), string.size());
+        }
+
+        std::uint32_t operator()(const QByteArray& bytes) const
+        {
+            return hashCharacters(reinterpret_cast<const uchar*>(bytes.constData()), bytes.size());
+        }
+
+        std::uint32_t operator()(const QUrl& url) const
+        {
+            return mix(qHash(url));
+        }
+
+        std::uint32_t operator()(int value) const
+        {
+            return mix(static_cast<std::uint32_t>(value));
+        }
+    };
+
+    namespace flathash
+    {
+        struct Identity
+        {
+            template<class T>
+            const T& operator()(const T& value) const
+            {
+                return value;
+            }
+        };
+
+        struct First
+        {
+            template<class P>
+            const typename P::first_type& operator()(const P& pair) const
+            {
+                return pair.first;
+            }
+        };
+    }
+
+    // Hash table with open addressing and linear probing. Entries are stored in one array,
+    // without allocation per entry. Unlike std::unordered_map, insert() and erase()
+    // invalidate iterators and pointers to entries.
+    // Lookup functions accept any type that FlatHash supports and is comparable with Key
+    template<class Key, class Entry, class KeyOf>
+    class FlatHashTable
+    {
+        struct Slot
+        {
+            // Zero if slot is empty
+            std::uint32_t hash;
+            Entry entry;
+        };
+
+    public:
+        using key_type = Key;
+        using value_type = Entry;
+
+        template<class SlotType, class EntryType>
+        class Iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Entry;
+            using difference_type = std::ptrdiff_t;
+            using pointer = EntryType*;
+            using reference = EntryType&;
+
+            Iterator(SlotType* slot, SlotType* end)
+                : mSlot(slot),
+                  mEnd(end)
+            {
+                skipEmpty();
+            }
+
+            reference operator*() const
+            {
+                return mSlot->entry;
+            }
+
+            pointer operator->() const
+            {
+                return &mSlot->entry;
+            }
+
+            Iterator& operator++()
+            {
+                ++mSlot;
+                skipEmpty();
+                return *this;
+            }
+
+            bool operator==(const Iterator& other) const
+            {
+                return mSlot == other.mSlot;
+            }
+
+            bool operator!=(const Iterator& other) const
+            {
+                return mSlot != other.mSlot;
+            }
+
+        private:
+            friend class FlatHashTable;
+
+            void skipEmpty()
+            {
+                while (mSlot != mEnd && mSlot->hash == 0) {
+                    ++mSlot;
+                }
+            }
+
+            SlotType* mSlot;
+            SlotType* mEnd;
+        };
+
+        using iterator = Iterator<Slot, Entry>;
+        using const_iterator = Iterator<const Slot, const Entry>;
+
+        FlatHashTable()
+            : mSize(0)
+        {
+
+        }
+
+        FlatHashTable(std::initializer_list<Entry> entries)
+            : FlatHashTable()
+        {
+            reserve(entries.size());
+            for (const Entry& entry : entries) {
+                insert(entry);
+            }
+        }
+
+        std::size_t size() const
+        {
+            return mSize;
+        }
+
+        bool empty() const
+        {
+            return mSize == 0;
+        }
+
+        // Capacity is kept
+        void clear()
+        {
+            for (Slot& slot : mSlots) {
+                if (slot.hash != 0) {
+                    slot = Slot{0, Entry()};
+                }
+            }
+            mSize = 0;
+        }
+
+        void reserve(std::size_t count)
+        {
+            // Load factor is at most 0.75
+            std::size_t capacity = 8;
+            while (capacity * 3 < count * 4) {
+                capacity *= 2;
+            }
+            if (capacity > mSlots.size()) {
+                rehash(capacity);
+            }
+        }
+
+        template<class K>
+        iterator find(const K& key)
+        {
+            const std::size_t index = indexOf(key);
+            return index == notFound ? end() : iterator(&mSlots[index], slotsEnd());
+        }
+
+        template<class K>
+        const_iterator find(const K& key) const
+        {
+            const std::size_t index = indexOf(key);
+            return index == notFound ? end() : const_iterator(&mSlots[index], slotsEnd());
+        }
+
+        template<class K>
+        std::size_t count(const K& key) const
+        {
+            return indexOf(key) == notFound ? 0 : 1;
+        }
+
+        // Existing entry is not replaced
+        std::pair<iterator, bool> insert(Entry entry)
+        {
+            reserve(mSize + 1);
+            const Key& key = KeyOf()(entry);
+            const std::uint32_t hash = hashOf(key);
+            const std::size_t mask = mSlots.size() - 1;
+            std::size_t index = hash & mask;
+            for (; mSlots[index].hash != 0; index = (index + 1) & mask) {
+                if (mSlots[index].hash == hash && KeyOf()(mSlots[index].entry) == key) {
+                    return {iterator(&mSlots[index], slotsEnd()), false};
+                }
+            }
+            mSlots[index] = Slot{hash, std::move(entry)};
+            ++mSize;
+            return {iterator(&mSlots[index], slotsEnd()), true};
+        }
+
+        template<class K>
+        std::size_t erase(const K& key)
+        {
+            const std::size_t index = indexOf(key);
+            if (index == notFound) {
+                return 0;
+            }
+            eraseAt(index);
+            return 1;
+        }
+
+        void erase(const_iterator position)
+        {
+            eraseAt(static_cast<std::size_t>(position.mSlot - mSlots.data()));
+        }
+
+        void erase(iterator position)
+        {
+            eraseAt(static_cast<std::size_t>(position.mSlot - mSlots.data()));
+        }
+
+        iterator begin()
+        {
+            return iterator(mSlots.data(), slotsEnd());
+        }
+
+        iterator end()
+        {
+            return iterator(slotsEnd(), slotsEnd());
+        }
+
+        const_iterator begin() const
+        {
+            return const_iterator(mSlots.data(), slotsEnd());
+        }
+
+        const_iterator end() const
+        {
+            return const_iterator(slotsEnd(), slotsEnd());
+        }
+
+    private:
+        static const std::size_t notFound = static_cast<std::size_t>(-1);
+
+        template<class K>
+        static std::uint32_t hashOf(const K& key)
+        {
+            // Zero marks empty slot
+            const std::uint32_t hash = FlatHash()(key);
+            return hash == 0 ? 1 : hash;
+        }
+
+        Slot* slotsEnd()
+        {
+            return mSlots.data() + mSlots.size();
+        }
+
+        const Slot* slotsEnd() const
+        {
+            return mSlots.data() + mSlots.size();
+        }
+
+        template<class K>
+        std::size_t indexOf(const K& key) const
+        {
+            if (mSize == 0) {
+                return notFound;
+            }
+            const std::uint32_t hash = hashOf(key);
+            const std::size_t mask = mSlots.size() - 1;
+            for (std::size_t index = hash & mask; mSlots[index].hash != 0; index = (index + 1) & mask) {
+                if (mSlots[index].hash == hash && KeyOf()(mSlots[index].entry) == key) {
+                    return index;
+                }
+            }
+            return notFound;
+        }
+
+        // Following entries are shifted back so that lookup doesn't need tombstones
+        void eraseAt(std::size_t hole)
+        {
+            const std::size_t mask = mSlots.size() - 1;
+            for (std::size_t next = (hole + 1) & mask; mSlots[next].hash != 0; next = (next + 1) & mask) {
+                const std::size_t home = mSlots[next].hash & mask;
+                // Entry can be moved if hole is between its home slot and its slot
+                if (((next - home) & mask) >= ((next - hole) & mask)) {
+                    mSlots[hole] = std::move(mSlots[next]);
+                    hole = next;
+                }
+            }
+            mSlots[hole] = Slot{0, Entry()};
+            --mSize;
+        }
+
+        void rehash(std::size_t capacity)
+        {
+            std::vector<Slot> old;
+            old.swap(mSlots);
+            mSlots.resize(capacity, Slot{0, Entry()});
+            const std::size_t mask = capacity - 1;
+            for (Slot& slot : old) {
+                if (slot.hash != 0) {
+                    std::size_t index = slot.hash & mask;
+                    while (mSlots[index].hash != 0) {
+                        index = (index + 1) & mask;
+                    }
+                    mSlots[index] = std::move(slot);
+                }
+            }
+        }
+
+        std::vector<Slot> mSlots;
+        std::size_t mSize;
+    };
+
+    template<class Key, class Value>
+    using FlatHashMap = FlatHashTable<Key, std::pair<Key, Value>, flathash::First>;
+
+    template<class Key>
+    using FlatHashSet = FlatHashTable<Key, Key, flathash::Identity>;
+}
+
+#endif // UNPLAYER_FLATHASH_H
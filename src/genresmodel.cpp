@@ -18,17 +18,14 @@
 
 #include "genresmodel.h"
 
-#include <functional>
-
 #include <QDebug>
-#include <QFile>
-#include <QFutureWatcher>
 #include <QSqlError>
 #include <QSqlQuery>
-#include <QtConcurrentRun>
 
+#include "libraryindex.h"
 #include "libraryutils.h"
 #include "settings.h"
+#include "sqlquery.h"
 
 namespace unplayer
 {
@@ -47,18 +44,73 @@ namespace unplayer
             TracksCountRole,
             DurationRole
         };
+
+        Genre genreFromQuery(const QSqlQuery& query)
+        {
+            return {query.value(GenreField).toString(),
+                    query.value(TracksCountField).toInt(),
+                    query.value(DurationField).toInt()};
+        }
+
+        QVariantList genreBindValues(const Genre& genre)
+        {
+            return {genre.genre};
+        }
+
+        QString genresQueryString(bool sortDescending)
+        {
+            return QString::fromLatin1("SELECT genres.title AS genre, COUNT(*), SUM(duration) FROM tracks_genres "
+                                       "JOIN genres ON genres.id = tracks_genres.genreId "
+                                       "JOIN tracks ON tracks.id = tracks_genres.trackId "
+                                       "WHERE genres.title != '' "
+                                       "GROUP BY genres.id "
+                                       "ORDER BY genre %1").arg(sortDescending ? QLatin1String("DESC")
+                                                                               : QLatin1String("ASC"));
+        }
     }
 
     GenresModel::GenresModel()
-        : mSortDescending(Settings::instance()->genresSortDescending()),
-          mRemovingFiles(false)
+        : mSortDescending(Settings::instance()->genresSortDescending())
     {
-        execQuery();
+        if (LibraryUtils::instance()->isDatabaseInitialized()) {
+            execQuery();
+        } else {
+            // Show genres from previous run until database is opened
+            const std::shared_ptr<const LibraryIndex> index(LibraryIndex::current());
+            if (index) {
+                setRows(index->genres(mSortDescending));
+            }
+            QObject::connect(LibraryUtils::instance(), &LibraryUtils::databaseInitializedChanged, this, [this]() {
+                if (LibraryUtils::instance()->isDatabaseInitialized()) {
+                    execQuery(true);
+                }
+            });
+        }
+        // Show tracks that were added while library is being updated
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::libraryChanged, this, [this](const LibraryChanges& changes) {
+            if (changesFilter()(changes)) {
+                execQuery(true);
+            }
+        });
+    }
+
+    std::vector<Genre> GenresModel::queryFirstRows(const QSqlDatabase& db, bool sortDescending, int count)
+    {
+        std::vector<Genre> genres;
+        SqlQuery query(db);
+        if (!query.exec(QString::fromLatin1("%1 LIMIT %2").arg(genresQueryString(sortDescending)).arg(count))) {
+            qWarning() << "failed to query genres" << query.lastError();
+            return genres;
+        }
+        while (query.next()) {
+            genres.push_back(genreFromQuery(query));
+        }
+        return genres;
     }
 
     QVariant GenresModel::data(const QModelIndex& index, int role) const
     {
-        const Genre& genre = mGenres[index.row()];
+        const Genre& genre = mRows[index.row()];
         switch (role) {
         case GenreRole:
             return genre.genre;
@@ -71,11 +123,6 @@ namespace unplayer
         }
     }
 
-    int GenresModel::rowCount(const QModelIndex&) const
-    {
-        return mGenres.size();
-    }
-
     bool GenresModel::sortDescending() const
     {
         return mSortDescending;
@@ -89,50 +136,23 @@ namespace unplayer
         execQuery();
     }
 
-    bool GenresModel::isRemovingFiles() const
+    TrackList GenresModel::getTracksForGenre(int index) const
     {
-        return mRemovingFiles;
+        return getTracksForGenres({index});
     }
 
-    std::vector<LibraryTrack> GenresModel::getTracksForGenre(int index) const
+    TrackList GenresModel::getTracksForGenres(const std::vector<int>& indexes) const
     {
-        QSqlQuery query;
-        query.prepare(QStringLiteral("SELECT filePath, title, artist, album, duration, mediaArt FROM tracks "
-                                     "WHERE genre = ?  "
-                                     "ORDER BY artist = '', artist, album = '', year, album, trackNumber, title"));
-        query.addBindValue(mGenres[index].genre);
-        if (query.exec()) {
-            std::vector<LibraryTrack> tracks;
-            query.last();
-            if (query.at() > 0) {
-                tracks.reserve(query.at() + 1);
-            }
-            query.seek(QSql::BeforeFirstRow);
-            while (query.next()) {
-                tracks.push_back({query.value(0).toString(),
-                                  query.value(1).toString(),
-                                  query.value(2).toString(),
-                                  query.value(3).toString(),
-                                  query.value(4).toInt(),
-                                  query.value(6).toString()});
-            }
-            return tracks;
-        }
-
-        qWarning() << "failed to get tracks from database";
-        return {};
-    }
-
-    std::vector<LibraryTrack> GenresModel::getTracksForGenres(const std::vector<int>& indexes) const
-    {
-        std::vector<LibraryTrack> tracks;
-        QSqlDatabase::database().transaction();
-        for (int index : indexes) {
-            std::vector<LibraryTrack> genreTracks(getTracksForGenre(index));
-            tracks.insert(tracks.end(), std::make_move_iterator(genreTracks.begin()), std::make_move_iterator(genreTracks.end()));
-        }
-        QSqlDatabase::database().commit();
-        return tracks;
+        return TrackList(tracksForRows(indexes,
+                                       genreBindValues,
+                                       QLatin1String("JOIN genres ON genres.title = query_keys.key0 "
+                                                     "JOIN tracks_genres ON tracks_genres.genreId = genres.id "
+                                                     "JOIN tracks ON tracks.id = tracks_genres.trackId "
+                                                     "JOIN tracks_artists ON tracks_artists.trackId = tracks.id "
+                                                     "JOIN artists ON artists.id = tracks_artists.artistId "
+                                                     "JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
+                                                     "JOIN albums ON albums.id = tracks_albums.albumId"),
+                                       QLatin1String("artist = '', artist, album = '', year, album, trackNumber, title")));
     }
 
     void GenresModel::removeGenre(int index, bool deleteFiles)
@@ -142,73 +162,12 @@ namespace unplayer
 
     void GenresModel::removeGenres(std::vector<int> indexes, bool deleteFiles)
     {
-        if (mRemovingFiles) {
-            return;
-        }
-
-        mRemovingFiles = true;
-        emit removingFilesChanged();
-
-        auto future = QtConcurrent::run(std::bind([this, deleteFiles](std::vector<int>& indexes) {
-            std::sort(indexes.begin(), indexes.end(), std::greater<int>());
-            std::vector<int> removed;
-            {
-                auto db = QSqlDatabase::addDatabase(LibraryUtils::databaseType, staticMetaObject.className());
-                db.setDatabaseName(LibraryUtils::instance()->databaseFilePath());
-                if (!db.open()) {
-                    QSqlDatabase::removeDatabase(staticMetaObject.className());
-                    qWarning() << "failed to open database" << db.lastError();
-                    return removed;
-                }
-                db.transaction();
-
-                for (int index : indexes) {
-                    const QString genre(mGenres[index].genre);
-
-                    if (deleteFiles) {
-                        QSqlQuery query(db);
-                        query.prepare(QStringLiteral("SELECT DISTINCT filePath FROM tracks WHERE genre = ?"));
-                        query.addBindValue(genre);
-                        query.exec();
-                        while (query.next()) {
-                            const QString filePath(query.value(0).toString());
-                            if (!QFile::remove(filePath)) {
-                                qWarning() << "failed to remove file:" << filePath;
-                            }
-                        }
-                    }
-
-                    QSqlQuery query(db);
-                    query.prepare(QStringLiteral("DELETE FROM tracks WHERE genre = ?"));
-                    query.addBindValue(genre);
-                    if (query.exec()) {
-                        removed.push_back(index);
-                    } else {
-                        qWarning() << "failed to remove files from database" << query.lastQuery() << query.lastError();
-                    }
-                }
-                db.commit();
-            }
-            QSqlDatabase::removeDatabase(staticMetaObject.className());
-
-            return removed;
-        }, std::move(indexes)));
-
-        using Watcher = QFutureWatcher<std::vector<int>>;
-        auto watcher = new Watcher(this);
-        QObject::connect(watcher, &Watcher::finished, this, [this, watcher]() {
-            mRemovingFiles = false;
-            emit removingFilesChanged();
-
-            for (int index : watcher->result()) {
-                beginRemoveRows(QModelIndex(), index, index);
-                mGenres.erase(mGenres.begin() + index);
-                endRemoveRows();
-            }
-            emit LibraryUtils::instance()->databaseChanged();
-            watcher->deleteLater();
-        });
-        watcher->setFuture(future);
+        removeRows(indexes,
+                   deleteFiles,
+                   QLatin1String("SELECT tracks_genres.trackId FROM query_keys "
+                                 "JOIN genres ON genres.title = query_keys.key0 "
+                                 "JOIN tracks_genres ON tracks_genres.genreId = genres.id"),
+                   genreBindValues);
     }
 
     QHash<int, QByteArray> GenresModel::roleNames() const
@@ -218,26 +177,19 @@ namespace unplayer
             {DurationRole, "duration"}};
     }
 
-    void GenresModel::execQuery()
+    void GenresModel::execQuery(bool update)
     {
-        beginResetModel();
-        mGenres.clear();
-        QSqlQuery query(QString::fromLatin1("SELECT genre, COUNT(*), SUM(duration) FROM tracks "
-                                            "WHERE genre != '' "
-                                            "GROUP BY genre "
-                                            "ORDER BY genre %1").arg(mSortDescending ? QLatin1String("DESC")
-                                                                                     : QLatin1String("ASC")));
-
-        if (query.lastError().type() == QSqlError::NoError) {
-            while (query.next()) {
-                mGenres.push_back({query.value(GenreField).toString(),
-                                   query.value(TracksCountField).toInt(),
-                                   query.value(DurationField).toInt()});
-            }
+        AsyncQueryModel::execQuery(genresQueryString(mSortDescending),
+                                   QVariantList(),
+                                   genreFromQuery,
+                                   update ? genreBindValues : nullptr,
+                                   changesFilter());
+    }
 
-        } else {
-            qWarning() << query.lastError();
-        }
-        endResetModel();
+    GenresModel::LibraryChangesFilter GenresModel::changesFilter() const
+    {
+        return [](const LibraryChanges& changes) {
+            return changes.all || !changes.genres.empty();
+        };
     }
 }
@@ -20,9 +20,10 @@
 #define UNPLAYER_GENRESMODEL_H
 
 #include <vector>
-#include <QAbstractListModel>
 
+#include "asyncquerymodel.h"
 #include "librarytrack.h"
+#include "tracklist.h"
 
 namespace unplayer
 {
@@ -33,24 +34,23 @@ namespace unplayer
         int duration;
     };
 
-    class GenresModel : public QAbstractListModel
+    class GenresModel : public AsyncQueryModel<Genre>
     {
         Q_OBJECT
         Q_PROPERTY(bool sortDescending READ sortDescending NOTIFY sortDescendingChanged)
-        Q_PROPERTY(bool removingFiles READ isRemovingFiles NOTIFY removingFilesChanged)
     public:
         GenresModel();
 
+        // Returns first rows in given order, used for library index
+        static std::vector<Genre> queryFirstRows(const QSqlDatabase& db, bool sortDescending, int count);
+
         QVariant data(const QModelIndex& index, int role) const override;
-        int rowCount(const QModelIndex& parent) const override;
 
         bool sortDescending() const;
         Q_INVOKABLE void toggleSortOrder();
 
-        bool isRemovingFiles() const;
-
-        Q_INVOKABLE std::vector<unplayer::LibraryTrack> getTracksForGenre(int index) const;
-        Q_INVOKABLE std::vector<unplayer::LibraryTrack> getTracksForGenres(const std::vector<int>& indexes) const;
+        Q_INVOKABLE unplayer::TrackList getTracksForGenre(int index) const;
+        Q_INVOKABLE unplayer::TrackList getTracksForGenres(const std::vector<int>& indexes) const;
 
         Q_INVOKABLE void removeGenre(int index, bool deleteFiles);
         Q_INVOKABLE void removeGenres(std::vector<int> indexes, bool deleteFiles);
@@ -58,16 +58,14 @@ namespace unplayer
         QHash<int, QByteArray> roleNames() const override;
 
     private:
-        void execQuery();
+        // Updates rows in place if update is true
+        void execQuery(bool update = false);
+        LibraryChangesFilter changesFilter() const;
 
-        std::vector<Genre> mGenres;
         bool mSortDescending;
 
-        bool mRemovingFiles;
-
     signals:
         void sortDescendingChanged();
-        void removingFilesChanged();
     };
 }
 
@@ -0,0 +1,520 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gstplayer.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QEvent>
+#include <QMutexLocker>
+#include <QTimer>
+
+#include <audioresource.h>
+#include <gst/gst.h>
+
+namespace unplayer
+{
+    namespace
+    {
+        // GstPlayFlags of playbin, which are not in public headers
+        const int playFlagVideo = 1 << 0;
+        const int playFlagText = 1 << 2;
+
+        const int defaultSinkBufferTime = 200;
+
+        // Bus messages are posted from streaming threads and handled on main thread
+        class MessageEvent final : public QEvent
+        {
+        public:
+            static const QEvent::Type eventType;
+
+            explicit MessageEvent(GstMessage* message)
+                : QEvent(eventType),
+                  message(gst_message_ref(message))
+            {
+
+            }
+
+            ~MessageEvent() override
+            {
+                gst_message_unref(message);
+            }
+
+            GstMessage* const message;
+        };
+
+        const QEvent::Type MessageEvent::eventType = static_cast<QEvent::Type>(QEvent::registerEventType());
+
+        GstBusSyncReply busSyncHandler(GstBus*, GstMessage* message, gpointer player)
+        {
+            QCoreApplication::postEvent(static_cast<GstPlayer*>(player), new MessageEvent(message));
+            return GST_BUS_DROP;
+        }
+
+        QByteArray uri(const QUrl& url)
+        {
+            return url.toString(QUrl::FullyEncoded).toUtf8();
+        }
+    }
+
+    GstPlayer::GstPlayer(QObject* parent)
+        : QObject(parent),
+          mPlaybin(nullptr),
+          mSink(nullptr),
+          mAudioResource(nullptr),
+          mAudioResourceAcquired(false),
+          mState(StoppedState),
+          mMediaStatus(NoMedia),
+          mError(NoError),
+          mDuration(0),
+          mSeekable(false),
+          mPendingPosition(-1),
+          mPositionTimer(new QTimer(this)),
+          mSinkBufferTime(defaultSinkBufferTime),
+          mGaplessSwitch(false)
+    {
+        mPositionTimer->setInterval(1000);
+        QObject::connect(mPositionTimer, &QTimer::timeout, this, [=]() {
+            emit positionChanged(position());
+        });
+
+        if (!gst_is_initialized()) {
+            GError* error = nullptr;
+            if (!gst_init_check(nullptr, nullptr, &error)) {
+                qWarning() << "failed to initialize GStreamer:" << error->message;
+                g_error_free(error);
+                return;
+            }
+        }
+
+        mPlaybin = gst_element_factory_make("playbin", "unplayer-playbin");
+        if (!mPlaybin) {
+            qWarning() << "failed to create playbin";
+            return;
+        }
+        gst_object_ref_sink(mPlaybin);
+
+        int flags = 0;
+        g_object_get(mPlaybin, "flags", &flags, nullptr);
+        g_object_set(mPlaybin, "flags", flags & ~(playFlagVideo | playFlagText), nullptr);
+
+        mSink = gst_element_factory_make("pulsesink", nullptr);
+        if (mSink) {
+            gst_object_ref_sink(mSink);
+            GstStructure* properties = gst_structure_new("properties", "media.role", G_TYPE_STRING, "music", nullptr);
+            g_object_set(mSink, "stream-properties", properties, nullptr);
+            gst_structure_free(properties);
+            updateSinkBufferTime();
+            g_object_set(mPlaybin, "audio-sink", mSink, nullptr);
+        } else {
+            qWarning() << "failed to create pulsesink, using default audio sink";
+        }
+
+        GstBus* bus = gst_element_get_bus(mPlaybin);
+        gst_bus_set_sync_handler(bus, busSyncHandler, this, nullptr);
+        gst_object_unref(bus);
+
+        g_signal_connect(mPlaybin, "about-to-finish", G_CALLBACK(onAboutToFinish), this);
+
+        // Callback is called from GLib event loop, which is used by Qt on Sailfish OS
+        mAudioResource = audioresource_init(AUDIO_RESOURCE_MEDIA, onAudioResourceAcquired, this);
+    }
+
+    GstPlayer::~GstPlayer()
+    {
+        if (mAudioResource) {
+            releaseAudioResource();
+            audioresource_free(mAudioResource);
+        }
+        if (mPlaybin) {
+            gst_element_set_state(mPlaybin, GST_STATE_NULL);
+            GstBus* bus = gst_element_get_bus(mPlaybin);
+            gst_bus_set_sync_handler(bus, nullptr, nullptr, nullptr);
+            gst_object_unref(bus);
+            gst_object_unref(mPlaybin);
+        }
+        if (mSink) {
+            gst_object_unref(mSink);
+        }
+    }
+
+    qint64 GstPlayer::duration() const
+    {
+        return mDuration;
+    }
+
+    qint64 GstPlayer::position() const
+    {
+        if (mPendingPosition >= 0) {
+            return mPendingPosition;
+        }
+        gint64 position = 0;
+        if (mPlaybin && mMediaStatus != EndOfMedia && gst_element_query_position(mPlaybin, GST_FORMAT_TIME, &position)) {
+            return position / GST_MSECOND;
+        }
+        return 0;
+    }
+
+    bool GstPlayer::isSeekable() const
+    {
+        return mSeekable;
+    }
+
+    GstPlayer::State GstPlayer::state() const
+    {
+        return mState;
+    }
+
+    GstPlayer::MediaStatus GstPlayer::mediaStatus() const
+    {
+        return mMediaStatus;
+    }
+
+    GstPlayer::Error GstPlayer::error() const
+    {
+        return mError;
+    }
+
+    QString GstPlayer::errorString() const
+    {
+        return mErrorString;
+    }
+
+    int GstPlayer::notifyInterval() const
+    {
+        return mPositionTimer->interval();
+    }
+
+    void GstPlayer::setNotifyInterval(int milliseconds)
+    {
+        mPositionTimer->setInterval(milliseconds);
+    }
+
+    void GstPlayer::setMedia(const QUrl& url)
+    {
+        if (mGaplessSwitch && url == mUrl) {
+            return;
+        }
+
+        {
+            const QMutexLocker locker(&mNextUrlMutex);
+            mNextUrl.clear();
+            mQueuedUrl.clear();
+        }
+
+        if (mPlaybin) {
+            gst_element_set_state(mPlaybin, GST_STATE_NULL);
+        }
+
+        mUrl = url;
+        mError = NoError;
+        mErrorString.clear();
+        mPendingPosition = -1;
+        setState(StoppedState);
+        if (mDuration != 0) {
+            mDuration = 0;
+            emit durationChanged(mDuration);
+        }
+        if (mSeekable) {
+            mSeekable = false;
+            emit seekableChanged(mSeekable);
+        }
+
+        if (url.isEmpty() || !mPlaybin) {
+            releaseAudioResource();
+            setMediaStatus(NoMedia);
+            return;
+        }
+
+        updateSinkBufferTime();
+        g_object_set(mPlaybin, "uri", uri(url).constData(), nullptr);
+        setMediaStatus(LoadingMedia);
+        // Preroll so that duration is known and position can be set before playing
+        setPipelineState(GST_STATE_PAUSED);
+    }
+
+    void GstPlayer::setNextMedia(const QUrl& url)
+    {
+        const QMutexLocker locker(&mNextUrlMutex);
+        mNextUrl = url;
+    }
+
+    void GstPlayer::setSinkBufferTime(int milliseconds)
+    {
+        mSinkBufferTime = milliseconds;
+        if (mPlaybin && GST_STATE(mPlaybin) <= GST_STATE_READY) {
+            updateSinkBufferTime();
+        }
+    }
+
+    void GstPlayer::play()
+    {
+        if (mUrl.isEmpty() || mMediaStatus == InvalidMedia) {
+            return;
+        }
+        if (mAudioResourceAcquired || !mAudioResource) {
+            setPipelineState(GST_STATE_PLAYING);
+        } else {
+            // Pipeline is played when resource is acquired
+            audioresource_acquire(mAudioResource);
+        }
+        if (mMediaStatus == EndOfMedia && !mGaplessSwitch) {
+            setMediaStatus(LoadingMedia);
+        }
+        setState(PlayingState);
+    }
+
+    void GstPlayer::pause()
+    {
+        if (mUrl.isEmpty() || mMediaStatus == InvalidMedia) {
+            return;
+        }
+        setPipelineState(GST_STATE_PAUSED);
+        setState(PausedState);
+        releaseAudioResource();
+    }
+
+    void GstPlayer::stop()
+    {
+        if (mState == StoppedState) {
+            return;
+        }
+        // Pipeline is prerolled again so that it can be started from the beginning
+        setPipelineState(GST_STATE_READY);
+        if (mMediaStatus != EndOfMedia) {
+            setMediaStatus(LoadingMedia);
+            setPipelineState(GST_STATE_PAUSED);
+        }
+        setState(StoppedState);
+        releaseAudioResource();
+        emit positionChanged(0);
+    }
+
+    void GstPlayer::setPosition(qint64 position)
+    {
+        if (!mPlaybin || mUrl.isEmpty()) {
+            return;
+        }
+        position = std::max(position, static_cast<qint64>(0));
+        if (mMediaStatus == LoadingMedia || mMediaStatus == EndOfMedia) {
+            // Applied when pipeline is prerolled
+            mPendingPosition = position;
+            if (mMediaStatus == EndOfMedia) {
+                setMediaStatus(LoadingMedia);
+                setPipelineState(GST_STATE_PAUSED);
+            }
+        } else if (!gst_element_seek_simple(mPlaybin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH, position * GST_MSECOND)) {
+            qWarning() << "failed to seek to" << position;
+            return;
+        }
+        emit positionChanged(position);
+    }
+
+    bool GstPlayer::event(QEvent* event)
+    {
+        if (event->type() == MessageEvent::eventType) {
+            handleMessage(static_cast<MessageEvent*>(event)->message);
+            return true;
+        }
+        return QObject::event(event);
+    }
+
+    void GstPlayer::onAboutToFinish(GstElement* playbin, GstPlayer* player)
+    {
+        const QMutexLocker locker(&player->mNextUrlMutex);
+        if (player->mNextUrl.isEmpty()) {
+            return;
+        }
+        g_object_set(playbin, "uri", uri(player->mNextUrl).constData(), nullptr);
+        player->mQueuedUrl = player->mNextUrl;
+        player->mNextUrl.clear();
+    }
+
+    void GstPlayer::onAudioResourceAcquired(audioresource_t*, bool acquired, void* player)
+    {
+        auto self = static_cast<GstPlayer*>(player);
+        self->mAudioResourceAcquired = acquired;
+        if (self->mState != PlayingState) {
+            // Paused or stopped before resource was acquired
+            self->releaseAudioResource();
+            return;
+        }
+        if (acquired) {
+            self->setPipelineState(GST_STATE_PLAYING);
+        } else {
+            qDebug() << "audio resource was lost, pausing";
+            self->setPipelineState(GST_STATE_PAUSED);
+            self->setState(PausedState);
+        }
+    }
+
+    void GstPlayer::handleMessage(GstMessage* message)
+    {
+        switch (GST_MESSAGE_TYPE(message)) {
+        case GST_MESSAGE_ERROR:
+        {
+            GError* error = nullptr;
+            gchar* debug = nullptr;
+            gst_message_parse_error(message, &error, &debug);
+            mError = (error->domain == GST_RESOURCE_ERROR) ? ResourceError : FormatError;
+            mErrorString = QString::fromUtf8(error->message);
+            qWarning() << "playback error:" << mErrorString << debug;
+            g_error_free(error);
+            g_free(debug);
+
+            gst_element_set_state(mPlaybin, GST_STATE_NULL);
+            mPendingPosition = -1;
+            setState(StoppedState);
+            releaseAudioResource();
+            setMediaStatus(InvalidMedia);
+            break;
+        }
+        case GST_MESSAGE_EOS:
+            // Audio resource is kept since next track is usually started right away
+            gst_element_set_state(mPlaybin, GST_STATE_READY);
+            mPendingPosition = -1;
+            // State is changed first, like in QMediaPlayer, so that next track
+            // can be started when EndOfMedia is reported
+            setState(StoppedState);
+            setMediaStatus(EndOfMedia);
+            break;
+        case GST_MESSAGE_ASYNC_DONE:
+            if (mMediaStatus == LoadingMedia) {
+                setMediaStatus(LoadedMedia);
+            }
+            updateDuration();
+            updateSeekable();
+            if (mPendingPosition >= 0) {
+                const qint64 position = mPendingPosition;
+                mPendingPosition = -1;
+                if (position > 0 && !gst_element_seek_simple(mPlaybin, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH, position * GST_MSECOND)) {
+                    qWarning() << "failed to seek to" << position;
+                }
+            }
+            break;
+        case GST_MESSAGE_DURATION_CHANGED:
+            updateDuration();
+            break;
+        case GST_MESSAGE_STREAM_START:
+        {
+            QUrl queuedUrl;
+            {
+                const QMutexLocker locker(&mNextUrlMutex);
+                queuedUrl = std::move(mQueuedUrl);
+                mQueuedUrl.clear();
+            }
+            if (queuedUrl.isEmpty()) {
+                break;
+            }
+
+            // Previous track has ended without stopping pipeline
+            mUrl = queuedUrl;
+            mGaplessSwitch = true;
+            setMediaStatus(EndOfMedia);
+            mGaplessSwitch = false;
+            setMediaStatus(LoadedMedia);
+            updateDuration();
+            updateSeekable();
+            emit positionChanged(position());
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void GstPlayer::setPipelineState(int state)
+    {
+        if (gst_element_set_state(mPlaybin, static_cast<GstState>(state)) == GST_STATE_CHANGE_FAILURE) {
+            qWarning() << "failed to change pipeline state to" << gst_element_state_get_name(static_cast<GstState>(state));
+        }
+    }
+
+    void GstPlayer::setState(State state)
+    {
+        if (state == mState) {
+            return;
+        }
+        mState = state;
+        if (mState == PlayingState) {
+            mPositionTimer->start();
+        } else {
+            mPositionTimer->stop();
+        }
+        emit stateChanged(mState);
+    }
+
+    void GstPlayer::setMediaStatus(MediaStatus status)
+    {
+        if (status == mMediaStatus) {
+            return;
+        }
+        mMediaStatus = status;
+        emit mediaStatusChanged(mMediaStatus);
+    }
+
+    void GstPlayer::updateDuration()
+    {
+        gint64 duration = 0;
+        if (!gst_element_query_duration(mPlaybin, GST_FORMAT_TIME, &duration)) {
+            return;
+        }
+        const qint64 milliseconds = duration / GST_MSECOND;
+        if (milliseconds != mDuration) {
+            mDuration = milliseconds;
+            emit durationChanged(mDuration);
+        }
+    }
+
+    void GstPlayer::updateSeekable()
+    {
+        bool seekable = false;
+        GstQuery* query = gst_query_new_seeking(GST_FORMAT_TIME);
+        if (gst_element_query(mPlaybin, query)) {
+            gboolean value = FALSE;
+            gst_query_parse_seeking(query, nullptr, &value, nullptr, nullptr);
+            seekable = value;
+        }
+        gst_query_unref(query);
+        if (seekable != mSeekable) {
+            mSeekable = seekable;
+            emit seekableChanged(mSeekable);
+        }
+    }
+
+    void GstPlayer::updateSinkBufferTime()
+    {
+        if (!mSink) {
+            return;
+        }
+        // Sink writes to PulseAudio in segments of latency-time
+        const gint64 bufferTime = static_cast<gint64>(mSinkBufferTime) * 1000;
+        g_object_set(mSink, "buffer-time", bufferTime, "latency-time", bufferTime / 4, nullptr);
+    }
+
+    void GstPlayer::releaseAudioResource()
+    {
+        if (mAudioResourceAcquired) {
+            audioresource_release(mAudioResource);
+            mAudioResourceAcquired = false;
+        }
+    }
+}
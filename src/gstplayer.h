@@ -0,0 +1,162 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_GSTPLAYER_H
+#define UNPLAYER_GSTPLAYER_H
+
+#include <QMutex>
+#include <QObject>
+#include <QUrl>
+
+class QTimer;
+
+typedef struct _GstElement GstElement;
+typedef struct _GstMessage GstMessage;
+typedef struct audioresource_t audioresource_t;
+
+namespace unplayer
+{
+    // Playback engine built directly on playbin, used instead of QMediaPlayer when
+    // GSTREAMER option is enabled. Its API is the subset of QMediaPlayer that Player uses.
+    // One pipeline is kept for all tracks. Next track set with setNextMedia() is queued
+    // in about-to-finish and played without gap, then EndOfMedia is reported for
+    // previous one while state stays PlayingState.
+    // Pipeline is played only while audio resource is acquired. When it is taken by
+    // another application, e.g. on incoming call, playback is paused
+    class GstPlayer : public QObject
+    {
+        Q_OBJECT
+        Q_PROPERTY(qint64 duration READ duration NOTIFY durationChanged)
+        Q_PROPERTY(qint64 position READ position WRITE setPosition NOTIFY positionChanged)
+        Q_PROPERTY(bool seekable READ isSeekable NOTIFY seekableChanged)
+        Q_PROPERTY(State state READ state NOTIFY stateChanged)
+        Q_PROPERTY(MediaStatus mediaStatus READ mediaStatus NOTIFY mediaStatusChanged)
+        Q_PROPERTY(int notifyInterval READ notifyInterval WRITE setNotifyInterval)
+    public:
+        enum State
+        {
+            StoppedState,
+            PlayingState,
+            PausedState
+        };
+        Q_ENUM(State)
+
+        enum MediaStatus
+        {
+            NoMedia,
+            LoadingMedia,
+            LoadedMedia,
+            EndOfMedia,
+            InvalidMedia
+        };
+        Q_ENUM(MediaStatus)
+
+        enum Error
+        {
+            NoError,
+            ResourceError,
+            FormatError
+        };
+        Q_ENUM(Error)
+
+        explicit GstPlayer(QObject* parent = nullptr);
+        ~GstPlayer() override;
+        GstPlayer(const GstPlayer& other) = delete;
+        GstPlayer& operator=(const GstPlayer& other) = delete;
+
+        qint64 duration() const;
+        qint64 position() const;
+        bool isSeekable() const;
+        State state() const;
+        MediaStatus mediaStatus() const;
+        Error error() const;
+        QString errorString() const;
+
+        int notifyInterval() const;
+        void setNotifyInterval(int milliseconds);
+
+        // Empty URL stops playback. Does nothing if url is the track that
+        // is already playing after gapless switch
+        void setMedia(const QUrl& url);
+        // Track that is played after current one without gap. Can be changed
+        // until current track is about to finish
+        void setNextMedia(const QUrl& url);
+
+        // Bigger buffer lets CPU sleep longer between writes when nobody
+        // is looking at position. Applied when audio sink is started next time
+        void setSinkBufferTime(int milliseconds);
+
+        Q_INVOKABLE void play();
+        Q_INVOKABLE void pause();
+        Q_INVOKABLE void stop();
+        void setPosition(qint64 position);
+
+    protected:
+        bool event(QEvent* event) override;
+
+    private:
+        static void onAboutToFinish(GstElement* playbin, GstPlayer* player);
+        static void onAudioResourceAcquired(audioresource_t* audioResource, bool acquired, void* player);
+
+        void handleMessage(GstMessage* message);
+        void setPipelineState(int state);
+        void setState(State state);
+        void setMediaStatus(MediaStatus status);
+        void updateDuration();
+        void updateSeekable();
+        void updateSinkBufferTime();
+        void releaseAudioResource();
+
+        GstElement* mPlaybin;
+        GstElement* mSink;
+
+        audioresource_t* mAudioResource;
+        bool mAudioResourceAcquired;
+
+        QUrl mUrl;
+        State mState;
+        MediaStatus mMediaStatus;
+        Error mError;
+        QString mErrorString;
+        qint64 mDuration;
+        bool mSeekable;
+        // Position that is set when pipeline is prerolled
+        qint64 mPendingPosition;
+
+        QTimer* mPositionTimer;
+        int mSinkBufferTime;
+
+        // True while EndOfMedia of previous track is reported after gapless switch
+        bool mGaplessSwitch;
+
+        // Accessed from streaming thread in about-to-finish
+        QMutex mNextUrlMutex;
+        QUrl mNextUrl;
+        // Next track that was given to playbin, until it starts
+        QUrl mQueuedUrl;
+
+    signals:
+        void durationChanged(qint64 duration);
+        void positionChanged(qint64 position);
+        void seekableChanged(bool seekable);
+        void stateChanged(unplayer::GstPlayer::State state);
+        void mediaStatusChanged(unplayer::GstPlayer::MediaStatus status);
+    };
+}
+
+#endif // UNPLAYER_GSTPLAYER_H
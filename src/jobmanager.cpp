@@ -0,0 +1,292 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "jobmanager.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QThreadPool>
+
+namespace unplayer
+{
+    namespace
+    {
+        JobManager* instancePointer = nullptr;
+    }
+
+    JobManager* JobManager::instance()
+    {
+        if (!instancePointer) {
+            instancePointer = new JobManager(qApp);
+        }
+        return instancePointer;
+    }
+
+    int JobManager::add(QObject* owner,
+                        Type type,
+                        threadpools::JobClass jobClass,
+                        const StartFunction& start,
+                        Priority priority,
+                        Coalescing coalescing)
+    {
+        const auto sameLane = [&](const Job& job) {
+            return job.owner == owner && job.type == type;
+        };
+
+        switch (coalescing) {
+        case Coalescing::Queue:
+            break;
+        case Coalescing::ReplacePending:
+        {
+            std::vector<int> dropped;
+            for (auto i = mPendingJobs.begin(); i != mPendingJobs.end();) {
+                if (sameLane(*i)) {
+                    dropped.push_back(i->id);
+                    i = mPendingJobs.erase(i);
+                } else {
+                    ++i;
+                }
+            }
+            for (int job : dropped) {
+                emit jobFinished(job, true);
+            }
+            break;
+        }
+        case Coalescing::DropIfPending:
+            if (std::any_of(mPendingJobs.begin(), mPendingJobs.end(), sameLane)) {
+                return 0;
+            }
+        }
+
+        if (mOwners.insert(owner).second) {
+            QObject::connect(owner, &QObject::destroyed, this, [=]() {
+                removeOwner(owner);
+            });
+        }
+
+        const int id = ++mLastJobId;
+        mPendingJobs.push_back({id, owner, type, jobClass, priority, start, CancelFunction()});
+        startJobs();
+        setBusy();
+        return id;
+    }
+
+    void JobManager::setCancelFunction(int job, const CancelFunction& cancel)
+    {
+        const auto found(mRunningJobs.find(job));
+        if (found != mRunningJobs.end()) {
+            found->second.cancel = cancel;
+        }
+    }
+
+    void JobManager::finish(int job)
+    {
+        if (mRunningJobs.erase(job) == 0) {
+            return;
+        }
+
+        bool cancelled;
+        {
+            const QMutexLocker locker(&mCancelledJobsMutex);
+            cancelled = mCancelledJobs.erase(job) > 0;
+        }
+        emit jobFinished(job, cancelled);
+
+        startJobs();
+        setBusy();
+    }
+
+    void JobManager::cancel(int job)
+    {
+        const auto pending(std::find_if(mPendingJobs.begin(), mPendingJobs.end(), [job](const Job& pendingJob) {
+            return pendingJob.id == job;
+        }));
+        if (pending != mPendingJobs.end()) {
+            mPendingJobs.erase(pending);
+            emit jobFinished(job, true);
+            setBusy();
+            return;
+        }
+
+        const auto running(mRunningJobs.find(job));
+        if (running == mRunningJobs.end()) {
+            return;
+        }
+        {
+            const QMutexLocker locker(&mCancelledJobsMutex);
+            if (!mCancelledJobs.insert(job).second) {
+                return;
+            }
+        }
+        // Job is finished by its owner
+        if (running->second.cancel) {
+            const CancelFunction cancel(running->second.cancel);
+            cancel();
+        }
+    }
+
+    void JobManager::cancelJobs(const QObject* owner, Type type)
+    {
+        std::vector<int> jobs;
+        for (const Job& job : mPendingJobs) {
+            if (job.owner == owner && job.type == type) {
+                jobs.push_back(job.id);
+            }
+        }
+        for (const auto& i : mRunningJobs) {
+            if (i.second.owner == owner && i.second.type == type) {
+                jobs.push_back(i.first);
+            }
+        }
+        for (int job : jobs) {
+            cancel(job);
+        }
+    }
+
+    bool JobManager::hasJobs(const QObject* owner, Type type) const
+    {
+        const auto sameLane = [&](const Job& job) {
+            return job.owner == owner && job.type == type;
+        };
+        return std::any_of(mPendingJobs.begin(), mPendingJobs.end(), sameLane) ||
+               std::any_of(mRunningJobs.begin(), mRunningJobs.end(), [&](const std::pair<const int, Job>& i) {
+                   return sameLane(i.second);
+               });
+    }
+
+    bool JobManager::isBusy() const
+    {
+        return mBusy;
+    }
+
+    bool JobManager::isCancelled(int job)
+    {
+        const QMutexLocker locker(&mCancelledJobsMutex);
+        return mCancelledJobs.find(job) != mCancelledJobs.end();
+    }
+
+    void JobManager::reportProgress(int job, int processed, int total)
+    {
+        QMetaObject::invokeMethod(this, "jobProgress", Qt::QueuedConnection, Q_ARG(int, job), Q_ARG(int, processed), Q_ARG(int, total));
+    }
+
+    JobManager::JobManager(QObject* parent)
+        : QObject(parent),
+          mLastJobId(0),
+          mBusy(false)
+    {
+
+    }
+
+    void JobManager::startJobs()
+    {
+        while (true) {
+            // Highest priority job that can be started, earliest one among jobs with the same priority
+            auto next = mPendingJobs.end();
+            for (auto i = mPendingJobs.begin(), end = mPendingJobs.end(); i != end; ++i) {
+                if (next != end && i->priority <= next->priority) {
+                    continue;
+                }
+
+                int classJobsCount = 0;
+                bool laneBusy = false;
+                for (const auto& running : mRunningJobs) {
+                    const Job& job = running.second;
+                    if (job.owner == i->owner && job.type == i->type) {
+                        laneBusy = true;
+                        break;
+                    }
+                    if (job.jobClass == i->jobClass) {
+                        ++classJobsCount;
+                    }
+                }
+                if (!laneBusy && classJobsCount < threadpools::pool(i->jobClass)->maxThreadCount()) {
+                    next = i;
+                }
+            }
+
+            if (next == mPendingJobs.end()) {
+                return;
+            }
+
+            const int id = next->id;
+            const StartFunction start(next->start);
+            mRunningJobs.insert({id, std::move(*next)});
+            mPendingJobs.erase(next);
+
+            emit jobStarted(id);
+            // May finish job and start other ones right away
+            start(id);
+        }
+    }
+
+    void JobManager::removeOwner(const QObject* owner)
+    {
+        mOwners.erase(owner);
+
+        // Running jobs of owner won't be finished since their watchers are destroyed with it
+        std::vector<int> removed;
+        for (auto i = mPendingJobs.begin(); i != mPendingJobs.end();) {
+            if (i->owner == owner) {
+                removed.push_back(i->id);
+                i = mPendingJobs.erase(i);
+            } else {
+                ++i;
+            }
+        }
+        for (auto i = mRunningJobs.begin(); i != mRunningJobs.end();) {
+            if (i->second.owner == owner) {
+                removed.push_back(i->first);
+                i = mRunningJobs.erase(i);
+            } else {
+                ++i;
+            }
+        }
+
+        if (removed.empty()) {
+            return;
+        }
+
+        // Workers that are still running see them as cancelled
+        {
+            const QMutexLocker locker(&mCancelledJobsMutex);
+            for (int job : removed) {
+                mCancelledJobs.insert(job);
+            }
+        }
+        for (int job : removed) {
+            emit jobFinished(job, true);
+        }
+
+        startJobs();
+        setBusy();
+    }
+
+    void JobManager::setBusy()
+    {
+        const bool busy = !mPendingJobs.empty() || !mRunningJobs.empty();
+        if (busy != mBusy) {
+            mBusy = busy;
+            emit busyChanged();
+        }
+    }
+}
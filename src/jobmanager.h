@@ -0,0 +1,136 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_JOBMANAGER_H
+#define UNPLAYER_JOBMANAGER_H
+
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <QMutex>
+#include <QObject>
+
+#include "threadpools.h"
+
+namespace unplayer
+{
+    // Runs long operations started by user: adding tracks to queue, removing files,
+    // writing playlists, updating library.
+    // Jobs of the same owner and type are run one after another. Number of running jobs
+    // of each thread pool class is limited by thread count of its pool, so that waiting jobs
+    // stay here where they can be reordered by priority, coalesced or cancelled.
+    // Should be used from main thread, except where noted
+    class JobManager final : public QObject
+    {
+        Q_OBJECT
+        Q_PROPERTY(bool busy READ isBusy NOTIFY busyChanged)
+    public:
+        enum class Type
+        {
+            AddTracksToQueue,
+            RemoveFiles,
+            WritePlaylist,
+            UpdateLibrary
+        };
+
+        enum Priority
+        {
+            LowPriority,
+            NormalPriority,
+            HighPriority
+        };
+
+        // What happens to pending jobs of the same owner and type when job is added
+        enum class Coalescing
+        {
+            // Job is run after them
+            Queue,
+            // They are dropped, e.g. when new job makes their result obsolete
+            ReplacePending,
+            // Job is not added if there is a pending one, because it will do the same
+            DropIfPending
+        };
+
+        // Called on main thread when job is started, job must call finish() when it is done.
+        // Job is started right away if it doesn't need to wait
+        using StartFunction = std::function<void(int job)>;
+        // Called on main thread when running job is cancelled
+        using CancelFunction = std::function<void()>;
+
+        static JobManager* instance();
+
+        // Returns id of job, or 0 if it was not added
+        int add(QObject* owner,
+                Type type,
+                threadpools::JobClass jobClass,
+                const StartFunction& start,
+                Priority priority = NormalPriority,
+                Coalescing coalescing = Coalescing::Queue);
+        void setCancelFunction(int job, const CancelFunction& cancel);
+        void finish(int job);
+
+        Q_INVOKABLE void cancel(int job);
+        void cancelJobs(const QObject* owner, Type type);
+
+        // Whether owner has running or pending jobs of type
+        bool hasJobs(const QObject* owner, Type type) const;
+        bool isBusy() const;
+
+        // Thread-safe
+        bool isCancelled(int job);
+        void reportProgress(int job, int processed, int total);
+
+    private:
+        explicit JobManager(QObject* parent);
+
+        struct Job
+        {
+            int id;
+            const QObject* owner;
+            Type type;
+            threadpools::JobClass jobClass;
+            Priority priority;
+            StartFunction start;
+            CancelFunction cancel;
+        };
+
+        void startJobs();
+        void removeOwner(const QObject* owner);
+        void setBusy();
+
+        int mLastJobId;
+        // In order in which they were added
+        std::deque<Job> mPendingJobs;
+        std::unordered_map<int, Job> mRunningJobs;
+        std::unordered_set<const QObject*> mOwners;
+        bool mBusy;
+
+        QMutex mCancelledJobsMutex;
+        std::unordered_set<int> mCancelledJobs;
+    signals:
+        void busyChanged();
+        void jobStarted(int job);
+        void jobProgress(int job, int processed, int total);
+        void jobFinished(int job, bool cancelled);
+    };
+}
+
+#endif // UNPLAYER_JOBMANAGER_H
@@ -0,0 +1,87 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "latestload.h"
+
+#include <QFutureWatcher>
+
+namespace unplayer
+{
+    LatestLoad::LatestLoad(QObject* receiver)
+        : mReceiver(receiver),
+          mWatcher(nullptr),
+          mGeneration(0),
+          mCancelled(std::make_shared<std::atomic_bool>(false))
+    {
+
+    }
+
+    LatestLoad::~LatestLoad()
+    {
+        cancel();
+    }
+
+    int LatestLoad::start(QFutureWatcherBase* watcher)
+    {
+        cancel();
+        ++mGeneration;
+        mCancelled = std::make_shared<std::atomic_bool>(false);
+        mWatcher = watcher;
+        return mGeneration;
+    }
+
+    void LatestLoad::setWatcher(int generation, QFutureWatcherBase* watcher)
+    {
+        if (generation == mGeneration) {
+            mWatcher = watcher;
+        }
+    }
+
+    void LatestLoad::cancel()
+    {
+        mCancelled->store(true);
+        if (mWatcher) {
+            QObject::disconnect(mWatcher, nullptr, mReceiver, nullptr);
+            mWatcher->cancel();
+            mWatcher->deleteLater();
+            mWatcher = nullptr;
+        }
+    }
+
+    bool LatestLoad::isCurrent(int generation) const
+    {
+        return generation == mGeneration && !mCancelled->load();
+    }
+
+    bool LatestLoad::isRunning() const
+    {
+        return mWatcher != nullptr;
+    }
+
+    void LatestLoad::finish(int generation)
+    {
+        if (generation == mGeneration) {
+            mWatcher = nullptr;
+        }
+    }
+
+    LatestLoad::Token LatestLoad::token() const
+    {
+        return mCancelled;
+    }
+}
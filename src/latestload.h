@@ -0,0 +1,68 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_LATESTLOAD_H
+#define UNPLAYER_LATESTLOAD_H
+
+#include <atomic>
+#include <memory>
+
+class QFutureWatcherBase;
+class QObject;
+
+namespace unplayer
+{
+    // Keeps track of the latest background load started by a model.
+    // Starting a new load supersedes previous one: its watcher is disconnected
+    // from receiver and cancelled, so that results it already reported
+    // are dropped and its worker can stop early
+    class LatestLoad final
+    {
+    public:
+        // Cancellation flag for workers which future can't be cancelled
+        using Token = std::shared_ptr<const std::atomic_bool>;
+
+        explicit LatestLoad(QObject* receiver);
+        ~LatestLoad();
+        LatestLoad(const LatestLoad&) = delete;
+        LatestLoad& operator=(const LatestLoad&) = delete;
+
+        // Cancels previous load and returns generation of new one.
+        // watcher may be null for loads which results are available
+        // synchronously, or set later with setWatcher()
+        int start(QFutureWatcherBase* watcher = nullptr);
+        void setWatcher(int generation, QFutureWatcherBase* watcher);
+        void cancel();
+
+        bool isCurrent(int generation) const;
+        bool isRunning() const;
+        // Should be called when watcher of load finishes
+        void finish(int generation);
+
+        // Token of current load, it is set when load is superseded or cancelled
+        Token token() const;
+
+    private:
+        QObject* const mReceiver;
+        QFutureWatcherBase* mWatcher;
+        int mGeneration;
+        std::shared_ptr<std::atomic_bool> mCancelled;
+    };
+}
+
+#endif // UNPLAYER_LATESTLOAD_H
@@ -0,0 +1,118 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "librarychanges.h"
+
+#include <QDebug>
+#include <QSqlError>
+
+#include "sqlquery.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        void selectTitles(const QSqlDatabase& db,
+                          const QString& table,
+                          const QString& linkTable,
+                          const QString& idColumn,
+                          const QString& tracksQuery,
+                          std::unordered_set<QString>& titles)
+        {
+            SqlQuery query(db);
+            query.setForwardOnly(true);
+            if (!query.exec(QString::fromLatin1("SELECT DISTINCT %1.title FROM %2 "
+                                                "JOIN %1 ON %1.id = %2.%3 "
+                                                "WHERE %2.trackId IN (%4)").arg(table, linkTable, idColumn, tracksQuery))) {
+                qWarning() << "failed to get changed entries from" << table << query.lastError();
+                return;
+            }
+            while (query.next()) {
+                titles.insert(query.value(0).toString().toCaseFolded());
+            }
+        }
+
+        void insertTitles(std::unordered_set<QString>& to, const QStringList& titles)
+        {
+            if (titles.isEmpty()) {
+                to.insert(QString());
+            } else {
+                for (const QString& title : titles) {
+                    to.insert(title.toCaseFolded());
+                }
+            }
+        }
+
+        void insertAll(std::unordered_set<QString>& to, const std::unordered_set<QString>& from)
+        {
+            to.insert(from.begin(), from.end());
+        }
+    }
+
+    LibraryChanges LibraryChanges::everything()
+    {
+        LibraryChanges changes;
+        changes.all = true;
+        return changes;
+    }
+
+    LibraryChanges LibraryChanges::forTracks(const QSqlDatabase& db, const QString& tracksQuery)
+    {
+        LibraryChanges changes;
+        selectTitles(db, QLatin1String("artists"), QLatin1String("tracks_artists"), QLatin1String("artistId"), tracksQuery, changes.artists);
+        selectTitles(db, QLatin1String("albums"), QLatin1String("tracks_albums"), QLatin1String("albumId"), tracksQuery, changes.albums);
+        selectTitles(db, QLatin1String("genres"), QLatin1String("tracks_genres"), QLatin1String("genreId"), tracksQuery, changes.genres);
+        return changes;
+    }
+
+    void LibraryChanges::addTrack(const QStringList& artists, const QStringList& albums, const QStringList& genres)
+    {
+        insertTitles(this->artists, artists);
+        insertTitles(this->albums, albums);
+        insertTitles(this->genres, genres);
+    }
+
+    bool LibraryChanges::isEmpty() const
+    {
+        return !all && artists.empty() && albums.empty() && genres.empty();
+    }
+
+    void LibraryChanges::merge(const LibraryChanges& other)
+    {
+        all = all || other.all;
+        insertAll(artists, other.artists);
+        insertAll(albums, other.albums);
+        insertAll(genres, other.genres);
+    }
+
+    bool LibraryChanges::affectsArtist(const QString& artist) const
+    {
+        return all || artists.count(artist.toCaseFolded()) > 0;
+    }
+
+    bool LibraryChanges::affectsAlbum(const QString& album) const
+    {
+        return all || albums.count(album.toCaseFolded()) > 0;
+    }
+
+    bool LibraryChanges::affectsGenre(const QString& genre) const
+    {
+        return all || genres.count(genre.toCaseFolded()) > 0;
+    }
+}
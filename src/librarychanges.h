@@ -0,0 +1,66 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_LIBRARYCHANGES_H
+#define UNPLAYER_LIBRARYCHANGES_H
+
+#include <unordered_set>
+
+#include <QMetaType>
+#include <QString>
+#include <QStringList>
+
+#include "stdutils.h"
+
+class QSqlDatabase;
+
+namespace unplayer
+{
+    // Artists, albums and genres which tracks were added, removed or changed.
+    // Titles are case folded since database ignores their case,
+    // tracks without artist, album or genre have empty one
+    struct LibraryChanges
+    {
+        std::unordered_set<QString> artists;
+        std::unordered_set<QString> albums;
+        std::unordered_set<QString> genres;
+        // Scope of change is unknown, e.g. database was reset
+        bool all = false;
+
+        static LibraryChanges everything();
+
+        // Artists, albums and genres of tracks which ids are selected by tracksQuery.
+        // Must be called before tracks are removed or unlinked
+        static LibraryChanges forTracks(const QSqlDatabase& db, const QString& tracksQuery);
+
+        // Artists, albums and genres from tags of added or changed track
+        void addTrack(const QStringList& artists, const QStringList& albums, const QStringList& genres);
+
+        bool isEmpty() const;
+        void merge(const LibraryChanges& other);
+
+        bool affectsArtist(const QString& artist) const;
+        bool affectsAlbum(const QString& album) const;
+        bool affectsGenre(const QString& genre) const;
+    };
+}
+
+Q_DECLARE_METATYPE(unplayer::LibraryChanges)
+
+#endif // UNPLAYER_LIBRARYCHANGES_H
@@ -0,0 +1,473 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "libraryindex.h"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "librarymigrations.h"
+#include "stdutils.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        const quint32 indexMagic = 0x554e4c49; // "UNLI"
+        const quint32 indexVersion = 2;
+        const int sortModesCount = AlbumsModel::SortArtistYear + 1;
+
+        // File consists of header, artist entries, album entries, album orders
+        // (one array of album indexes for each sort mode), genre entries,
+        // UTF-16 strings and UTF-8 sort keys. Everything is in native byte order
+        // and 4-byte aligned, so entries are read directly from mapped memory
+
+        struct Header
+        {
+            quint32 magic;
+            quint32 version;
+            qint32 databaseVersion;
+            quint32 artistsCount;
+            quint32 albumsCount;
+            quint32 genresCount;
+            // In UTF-16 code units
+            quint32 stringsSize;
+            quint32 sortKeysSize;
+        };
+
+        // Equal strings are stored once
+        struct StringRef
+        {
+            quint32 offset;
+            quint32 size;
+        };
+
+        // Entries of artists and genres are in ascending order
+        struct ArtistEntry
+        {
+            StringRef artist;
+            StringRef mediaArt;
+            StringRef sortKey;
+            quint32 mediaArtPlaceholder;
+            qint32 albumsCount;
+            qint32 tracksCount;
+            qint32 duration;
+        };
+
+        struct AlbumEntry
+        {
+            StringRef artist;
+            StringRef album;
+            StringRef mediaArt;
+            StringRef artistSortKey;
+            StringRef albumSortKey;
+            quint32 mediaArtPlaceholder;
+            qint32 year;
+            qint32 tracksCount;
+            qint32 duration;
+            qint32 yearSortKey;
+        };
+
+        struct GenreEntry
+        {
+            StringRef genre;
+            qint32 tracksCount;
+            qint32 duration;
+        };
+
+        QString indexFilePath()
+        {
+            return QString::fromLatin1("%1/library-index").arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+        }
+
+        qint64 artistsOffset()
+        {
+            return sizeof(Header);
+        }
+
+        qint64 albumsOffset(const Header& header)
+        {
+            return artistsOffset() + static_cast<qint64>(header.artistsCount) * sizeof(ArtistEntry);
+        }
+
+        qint64 albumOrdersOffset(const Header& header)
+        {
+            return albumsOffset(header) + static_cast<qint64>(header.albumsCount) * sizeof(AlbumEntry);
+        }
+
+        qint64 genresOffset(const Header& header)
+        {
+            return albumOrdersOffset(header) + sortModesCount * static_cast<qint64>(header.albumsCount) * sizeof(quint32);
+        }
+
+        qint64 stringsOffset(const Header& header)
+        {
+            return genresOffset(header) + static_cast<qint64>(header.genresCount) * sizeof(GenreEntry);
+        }
+
+        qint64 sortKeysOffset(const Header& header)
+        {
+            return stringsOffset(header) + static_cast<qint64>(header.stringsSize) * sizeof(QChar);
+        }
+
+        qint64 fileSize(const Header& header)
+        {
+            // Keep size multiple of 4
+            return sortKeysOffset(header) + ((static_cast<qint64>(header.sortKeysSize) + 3) & ~3ll);
+        }
+
+        template<typename Data>
+        class StringTable
+        {
+        public:
+            StringRef add(const Data& string)
+            {
+                if (string.isEmpty()) {
+                    return {0, 0};
+                }
+                const auto found(mOffsets.find(string));
+                if (found != mOffsets.end()) {
+                    return {found->second, static_cast<quint32>(string.size())};
+                }
+                const auto offset = static_cast<quint32>(mData.size());
+                mData.append(string);
+                mOffsets.emplace(string, offset);
+                return {offset, static_cast<quint32>(string.size())};
+            }
+
+            const Data& data() const
+            {
+                return mData;
+            }
+
+        private:
+            Data mData;
+            std::unordered_map<Data, quint32> mOffsets;
+        };
+
+        class Reader
+        {
+        public:
+            explicit Reader(const uchar* data)
+                : mData(data),
+                  mHeader(*reinterpret_cast<const Header*>(data))
+            {
+
+            }
+
+            const Header& header() const
+            {
+                return mHeader;
+            }
+
+            const ArtistEntry& artist(quint32 index) const
+            {
+                return reinterpret_cast<const ArtistEntry*>(mData + artistsOffset())[index];
+            }
+
+            const AlbumEntry& album(quint32 index) const
+            {
+                return reinterpret_cast<const AlbumEntry*>(mData + albumsOffset(mHeader))[index];
+            }
+
+            const quint32* albumOrder(AlbumsModel::SortMode sortMode) const
+            {
+                return reinterpret_cast<const quint32*>(mData + albumOrdersOffset(mHeader)) + sortMode * mHeader.albumsCount;
+            }
+
+            const GenreEntry& genre(quint32 index) const
+            {
+                return reinterpret_cast<const GenreEntry*>(mData + genresOffset(mHeader))[index];
+            }
+
+            QString string(StringRef ref) const
+            {
+                if (ref.size == 0 || ref.offset > mHeader.stringsSize || ref.size > mHeader.stringsSize - ref.offset) {
+                    return QString();
+                }
+                return QString(reinterpret_cast<const QChar*>(mData + stringsOffset(mHeader)) + ref.offset,
+                               static_cast<int>(ref.size));
+            }
+
+            QByteArray sortKey(StringRef ref) const
+            {
+                if (ref.size == 0 || ref.offset > mHeader.sortKeysSize || ref.size > mHeader.sortKeysSize - ref.offset) {
+                    return QByteArray();
+                }
+                return QByteArray(reinterpret_cast<const char*>(mData + sortKeysOffset(mHeader)) + ref.offset,
+                                  static_cast<int>(ref.size));
+            }
+
+        private:
+            const uchar* mData;
+            const Header& mHeader;
+        };
+
+        template<typename Entry>
+        bool writeEntries(QSaveFile& file, const std::vector<Entry>& entries)
+        {
+            const auto size = static_cast<qint64>(entries.size() * sizeof(Entry));
+            return file.write(reinterpret_cast<const char*>(entries.data()), size) == size;
+        }
+    }
+
+    std::shared_ptr<const LibraryIndex> LibraryIndex::current()
+    {
+        return std::atomic_load(&published());
+    }
+
+    void LibraryIndex::write(const QSqlDatabase& db)
+    {
+        const std::vector<Artist> artists(ArtistsModel::queryFirstRows(db, false, -1));
+        const std::vector<Album> albums(AlbumsModel::queryFirstRows(db, AlbumsModel::SortAlbum, false, -1));
+        const std::vector<Genre> genres(GenresModel::queryFirstRows(db, false, -1));
+
+        StringTable<QString> strings;
+        StringTable<QByteArray> sortKeys;
+
+        std::vector<ArtistEntry> artistEntries;
+        artistEntries.reserve(artists.size());
+        for (const Artist& artist : artists) {
+            artistEntries.push_back({strings.add(artist.artist),
+                                     strings.add(artist.mediaArt),
+                                     sortKeys.add(artist.sortKey),
+                                     artist.mediaArtPlaceholder,
+                                     artist.albumsCount,
+                                     artist.tracksCount,
+                                     artist.duration});
+        }
+
+        std::vector<AlbumEntry> albumEntries;
+        albumEntries.reserve(albums.size());
+        for (const Album& album : albums) {
+            albumEntries.push_back({strings.add(album.artist),
+                                    strings.add(album.album),
+                                    strings.add(album.mediaArt),
+                                    sortKeys.add(album.artistSortKey),
+                                    sortKeys.add(album.albumSortKey),
+                                    album.mediaArtPlaceholder,
+                                    album.year,
+                                    album.tracksCount,
+                                    album.duration,
+                                    album.yearSortKey});
+        }
+
+        std::vector<quint32> albumOrders;
+        albumOrders.reserve(sortModesCount * albums.size());
+        for (int i = 0; i < sortModesCount; ++i) {
+            const auto sortMode = static_cast<AlbumsModel::SortMode>(i);
+            std::vector<quint32> order(albums.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&albums, sortMode](quint32 first, quint32 second) {
+                return AlbumsModel::lessThan(albums[first], albums[second], sortMode);
+            });
+            albumOrders.insert(albumOrders.end(), order.begin(), order.end());
+        }
+
+        std::vector<GenreEntry> genreEntries;
+        genreEntries.reserve(genres.size());
+        for (const Genre& genre : genres) {
+            genreEntries.push_back({strings.add(genre.genre), genre.tracksCount, genre.duration});
+        }
+
+        const Header header{indexMagic,
+                            indexVersion,
+                            librarymigrations::currentVersion(),
+                            static_cast<quint32>(artistEntries.size()),
+                            static_cast<quint32>(albumEntries.size()),
+                            static_cast<quint32>(genreEntries.size()),
+                            static_cast<quint32>(strings.data().size()),
+                            static_cast<quint32>(sortKeys.data().size())};
+
+        const QString filePath(indexFilePath());
+        if (!QDir().mkpath(QFileInfo(filePath).path())) {
+            qWarning() << "failed to create directory for library index";
+            return;
+        }
+        // File is replaced, not overwritten, so mapping of previous file stays valid
+        QSaveFile file(filePath);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "failed to open library index file" << file.errorString();
+            return;
+        }
+        const QByteArray padding(static_cast<int>(fileSize(header) - sortKeysOffset(header)) - sortKeys.data().size(), 0);
+        const auto stringsSize = static_cast<qint64>(strings.data().size() * sizeof(QChar));
+        if (file.write(reinterpret_cast<const char*>(&header), sizeof(Header)) != sizeof(Header) ||
+                !writeEntries(file, artistEntries) ||
+                !writeEntries(file, albumEntries) ||
+                !writeEntries(file, albumOrders) ||
+                !writeEntries(file, genreEntries) ||
+                file.write(reinterpret_cast<const char*>(strings.data().constData()), stringsSize) != stringsSize ||
+                file.write(sortKeys.data()) != sortKeys.data().size() ||
+                file.write(padding) != padding.size()) {
+            qWarning() << "failed to write library index" << file.errorString();
+            file.cancelWriting();
+            return;
+        }
+        if (!file.commit()) {
+            qWarning() << "failed to save library index" << file.errorString();
+            return;
+        }
+
+        std::atomic_store(&published(), map(filePath));
+    }
+
+
+    std::vector<Artist> LibraryIndex::artists(bool sortDescending) const
+    {
+        std::vector<Artist> artists;
+        const Reader reader(mData);
+        const quint32 count = reader.header().artistsCount;
+        artists.reserve(count);
+        for (quint32 i = 0; i < count; ++i) {
+            const ArtistEntry& entry = reader.artist(sortDescending ? count - i - 1 : i);
+            const QString artist(reader.string(entry.artist));
+            artists.push_back({artist,
+                               artist.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : artist,
+                               entry.albumsCount,
+                               entry.tracksCount,
+                               entry.duration,
+                               reader.string(entry.mediaArt),
+                               entry.mediaArtPlaceholder,
+                               reader.sortKey(entry.sortKey)});
+        }
+        return artists;
+    }
+
+    std::vector<Album> LibraryIndex::albums(AlbumsModel::SortMode sortMode, bool sortDescending) const
+    {
+        return albums(sortMode, sortDescending, true, QString());
+    }
+
+    std::vector<Album> LibraryIndex::artistAlbums(const QString& artist, AlbumsModel::SortMode sortMode, bool sortDescending) const
+    {
+        return albums(sortMode, sortDescending, false, artist);
+    }
+
+    std::vector<Genre> LibraryIndex::genres(bool sortDescending) const
+    {
+        std::vector<Genre> genres;
+        const Reader reader(mData);
+        const quint32 count = reader.header().genresCount;
+        genres.reserve(count);
+        for (quint32 i = 0; i < count; ++i) {
+            const GenreEntry& entry = reader.genre(sortDescending ? count - i - 1 : i);
+            genres.push_back({reader.string(entry.genre), entry.tracksCount, entry.duration});
+        }
+        return genres;
+    }
+
+    LibraryIndex::LibraryIndex(const QString& filePath)
+        : mFile(filePath),
+          mData(nullptr)
+    {
+        if (!mFile.exists()) {
+            return;
+        }
+        if (!mFile.open(QIODevice::ReadOnly)) {
+            qWarning() << "failed to open library index file" << mFile.errorString();
+            return;
+        }
+        const qint64 size = mFile.size();
+        if (size < static_cast<qint64>(sizeof(Header))) {
+            qWarning() << "library index is invalid";
+            return;
+        }
+        const uchar* data = mFile.map(0, size);
+        if (!data) {
+            qWarning() << "failed to map library index file" << mFile.errorString();
+            return;
+        }
+
+        const Header& header = *reinterpret_cast<const Header*>(data);
+        if (header.magic != indexMagic || header.version != indexVersion || fileSize(header) != size) {
+            qWarning() << "library index is invalid";
+            return;
+        }
+        if (header.databaseVersion != librarymigrations::currentVersion()) {
+            return;
+        }
+        const quint32* albumOrders = reinterpret_cast<const quint32*>(data + albumOrdersOffset(header));
+        const quint64 albumOrdersCount = sortModesCount * static_cast<quint64>(header.albumsCount);
+        if (std::any_of(albumOrders, albumOrders + albumOrdersCount, [&header](quint32 album) { return album >= header.albumsCount; })) {
+            qWarning() << "library index is invalid";
+            return;
+        }
+
+        mData = data;
+    }
+
+    std::shared_ptr<const LibraryIndex> LibraryIndex::map(const QString& filePath)
+    {
+        std::shared_ptr<const LibraryIndex> index(new LibraryIndex(filePath));
+        if (!index->mData) {
+            return nullptr;
+        }
+        return index;
+    }
+
+    std::shared_ptr<const LibraryIndex>& LibraryIndex::published()
+    {
+        static std::shared_ptr<const LibraryIndex> index(map(indexFilePath()));
+        return index;
+    }
+
+    std::vector<Album> LibraryIndex::albums(AlbumsModel::SortMode sortMode, bool sortDescending, bool allArtists, const QString& artist) const
+    {
+        std::vector<Album> albums;
+        if (sortMode < 0 || sortMode >= sortModesCount) {
+            return albums;
+        }
+        const Reader reader(mData);
+        const quint32 count = reader.header().albumsCount;
+        const quint32* order = reader.albumOrder(sortMode);
+        if (allArtists) {
+            albums.reserve(count);
+        }
+        for (quint32 i = 0; i < count; ++i) {
+            const AlbumEntry& entry = reader.album(order[sortDescending ? count - i - 1 : i]);
+            const QString albumArtist(reader.string(entry.artist));
+            if (!allArtists && albumArtist != artist) {
+                continue;
+            }
+            const QString album(reader.string(entry.album));
+            albums.push_back({albumArtist,
+                              albumArtist.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : albumArtist,
+                              album,
+                              album.isEmpty() ? qApp->translate("unplayer", "Unknown album") : album,
+                              entry.year,
+                              entry.tracksCount,
+                              entry.duration,
+                              reader.string(entry.mediaArt),
+                              entry.mediaArtPlaceholder,
+                              reader.sortKey(entry.artistSortKey),
+                              reader.sortKey(entry.albumSortKey),
+                              entry.yearSortKey});
+        }
+        return albums;
+    }
+}
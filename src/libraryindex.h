@@ -0,0 +1,77 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_LIBRARYINDEX_H
+#define UNPLAYER_LIBRARYINDEX_H
+
+#include <memory>
+#include <vector>
+
+#include <QFile>
+
+#include "albumsmodel.h"
+#include "artistsmodel.h"
+#include "genresmodel.h"
+
+class QSqlDatabase;
+
+namespace unplayer
+{
+    // All artists, albums and genres with interned strings and album sort orders,
+    // written to a binary file after library is updated. On startup the file is memory
+    // mapped and rows are built from it without opening the database.
+    //
+    // Index is immutable. Writer maps the new file on worker thread and publishes it
+    // by atomically replacing current index, readers never wait for it. Previous index
+    // is unmapped when the last reader that holds it is done, so rows don't
+    // reference mapped memory
+    class LibraryIndex final
+    {
+    public:
+        // Index that was published last, mapped from file written on previous run on first call.
+        // Null if file is missing, corrupted or written for other database schema.
+        // Thread-safe, the same index should be used for the whole load
+        static std::shared_ptr<const LibraryIndex> current();
+
+        // Queries all rows, writes index file and publishes it, should be called on worker thread
+        static void write(const QSqlDatabase& db);
+
+        LibraryIndex(const LibraryIndex&) = delete;
+        LibraryIndex& operator=(const LibraryIndex&) = delete;
+
+        std::vector<Artist> artists(bool sortDescending) const;
+        std::vector<Album> albums(AlbumsModel::SortMode sortMode, bool sortDescending) const;
+        std::vector<Album> artistAlbums(const QString& artist, AlbumsModel::SortMode sortMode, bool sortDescending) const;
+        std::vector<Genre> genres(bool sortDescending) const;
+
+    private:
+        explicit LibraryIndex(const QString& filePath);
+        static std::shared_ptr<const LibraryIndex> map(const QString& filePath);
+        // Accessed only with std::atomic_load() and std::atomic_store()
+        static std::shared_ptr<const LibraryIndex>& published();
+
+        std::vector<Album> albums(AlbumsModel::SortMode sortMode, bool sortDescending, bool allArtists, const QString& artist) const;
+
+        QFile mFile;
+        // Null if file is not valid
+        const uchar* mData;
+    };
+}
+
+#endif // UNPLAYER_LIBRARYINDEX_H
@@ -0,0 +1,338 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "librarymaintenance.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <QDateTime>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QTimer>
+
+#include "librarychanges.h"
+#include "libraryutils.h"
+#include "scanthrottle.h"
+#include "settings.h"
+#include "sqlquery.h"
+#include "threadpools.h"
+#include "thumbnailatlas.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        // Library updater commits in batches, wait until it has finished
+        const int scheduleDelay = 30000;
+        const int vacuumStepInterval = 2000;
+        // Queued jobs start after device has been charging with display off for this long
+        const int idleDelay = 60000;
+        // Library is fully updated once a week, to pick up changes missed by file watcher
+        const qint64 fullUpdateInterval = 7 * 24 * 60 * 60 * 1000ll;
+        // 1 MiB with default page size
+        const int vacuumStepPages = 256;
+        // Statistics are updated when number of tracks has changed by this fraction
+        const int analyzeChangeDivisor = 10;
+        const int analyzeMinChange = 100;
+
+        struct StepResult
+        {
+            bool ok;
+            int freePages;
+            // Thumbnails were moved
+            bool libraryChanged;
+        };
+
+        int freePages(const QSqlDatabase& db)
+        {
+            SqlQuery query(QLatin1String("PRAGMA freelist_count"), db);
+            if (query.next()) {
+                return query.value(0).toInt();
+            }
+            qWarning() << "failed to get number of free pages" << query.lastError();
+            return -1;
+        }
+
+        // Number of tracks when ANALYZE was run last time, or -1
+        int analyzedTracksCount(const QSqlDatabase& db)
+        {
+            SqlQuery query(QLatin1String("SELECT 1 FROM sqlite_master WHERE name = 'sqlite_stat1'"), db);
+            if (!query.next()) {
+                // ANALYZE was never run
+                return -1;
+            }
+            if (query.exec(QLatin1String("SELECT stat FROM sqlite_stat1 WHERE tbl = 'tracks' LIMIT 1")) && query.next()) {
+                // First number is number of rows
+                return query.value(0).toString().section(QLatin1Char(' '), 0, 0).toInt();
+            }
+            return -1;
+        }
+
+        bool needsAnalyze(const QSqlDatabase& db)
+        {
+            const int analyzed = analyzedTracksCount(db);
+            if (analyzed < 0) {
+                return true;
+            }
+            SqlQuery query(QLatin1String("SELECT COUNT(*) FROM tracks"), db);
+            if (!query.next()) {
+                qWarning() << "failed to get number of tracks" << query.lastError();
+                return false;
+            }
+            const int count = query.value(0).toInt();
+            return std::abs(count - analyzed) > std::max(analyzed / analyzeChangeDivisor, analyzeMinChange);
+        }
+
+        void analyze(const QSqlDatabase& db)
+        {
+            SqlQuery query(db);
+            QElapsedTimer timer;
+            timer.start();
+            if (needsAnalyze(db)) {
+                if (query.exec(QLatin1String("ANALYZE"))) {
+                    qDebug() << "analyzed database in" << timer.elapsed() << "ms";
+                } else {
+                    qWarning() << "failed to analyze database" << query.lastError();
+                }
+            } else if (!query.exec(QLatin1String("PRAGMA optimize"))) {
+                // Older SQLite ignores unknown pragmas
+                qWarning() << "failed to optimize database" << query.lastError();
+            }
+        }
+
+        StepResult vacuum(const QSqlDatabase& db)
+        {
+            int pages = freePages(db);
+            if (pages > 0) {
+                SqlQuery query(db);
+                // One page is freed per step of statement
+                if (query.exec(QString::fromLatin1("PRAGMA incremental_vacuum(%1)").arg(vacuumStepPages))) {
+                    while (query.next()) {}
+                } else {
+                    qWarning() << "failed to vacuum database" << query.lastError();
+                    return {false, 0, false};
+                }
+                query.finish();
+                pages = freePages(db);
+            }
+            return {pages >= 0, pages, false};
+        }
+
+        StepResult compactThumbnails(const QSqlDatabase& db, const QString& mediaArtDirectory)
+        {
+            if (!db.transaction()) {
+                qWarning() << "failed to start transaction" << db.lastError();
+                return {false, 0, false};
+            }
+            const bool compacted = ThumbnailAtlasWriter(mediaArtDirectory, db).compactAtlases();
+            // Summaries have URLs of thumbnails
+            if (compacted) {
+                LibraryUtils::updateSummaries(db);
+            }
+            if (!db.commit()) {
+                qWarning() << "failed to commit transaction" << db.lastError();
+                return {false, 0, false};
+            }
+            return {true, 0, compacted};
+        }
+    }
+
+    LibraryMaintenance::LibraryMaintenance(const QString& databaseFilePath, const QString& mediaArtDirectory, QObject* parent)
+        : QObject(parent),
+          mDatabaseFilePath(databaseFilePath),
+          mMediaArtDirectory(mediaArtDirectory),
+          mTimer(new QTimer(this)),
+          mRunning(false),
+          mAnalyzePending(false),
+          mCompactPending(false),
+          mVacuumPending(false),
+          mForced(false)
+    {
+        mTimer->setSingleShot(true);
+        QObject::connect(mTimer, &QTimer::timeout, this, &LibraryMaintenance::start);
+
+        QObject::connect(ScanThrottle::instance(), &ScanThrottle::chargingChanged, this, &LibraryMaintenance::onDeviceStateChanged);
+        QObject::connect(ScanThrottle::instance(), &ScanThrottle::displayOffChanged, this, &LibraryMaintenance::onDeviceStateChanged);
+        QObject::connect(Settings::instance(), &Settings::deferLibraryMaintenanceChanged, this, &LibraryMaintenance::onDeviceStateChanged);
+    }
+
+    bool LibraryMaintenance::enableIncrementalVacuum(const QSqlDatabase& db)
+    {
+        SqlQuery query(db);
+        // 2 is INCREMENTAL
+        if (query.exec(QLatin1String("PRAGMA auto_vacuum")) && query.next() && query.value(0).toInt() == 2) {
+            return true;
+        }
+        query.finish();
+
+        // Mode of database that has tables is changed only by VACUUM
+        qDebug() << "enabling incremental auto vacuum";
+        if (!query.exec(QLatin1String("PRAGMA auto_vacuum = INCREMENTAL"))) {
+            qWarning() << "failed to enable incremental auto vacuum" << query.lastError();
+            return false;
+        }
+        // VACUUM copies database to temporary one, don't keep it in memory
+        query.exec(QLatin1String("PRAGMA temp_store = FILE"));
+        const bool ok = query.exec(QLatin1String("VACUUM"));
+        if (!ok) {
+            qWarning() << "failed to vacuum database" << query.lastError();
+        }
+        query.exec(QLatin1String("PRAGMA temp_store = MEMORY"));
+        return ok;
+    }
+
+    void LibraryMaintenance::schedule()
+    {
+        mAnalyzePending = true;
+        mCompactPending = true;
+        mVacuumPending = true;
+        if (!mRunning) {
+            mTimer->start(scheduleDelay);
+        }
+    }
+
+    void LibraryMaintenance::runNow()
+    {
+        mForced = true;
+        if (!mRunning) {
+            mTimer->start(0);
+        }
+    }
+
+    void LibraryMaintenance::start()
+    {
+        LibraryUtils* libraryUtils = LibraryUtils::instance();
+        // Scan pool has one thread, so step would wait for update anyway
+        if (libraryUtils->isUpdating()) {
+            mTimer->start(scheduleDelay);
+            return;
+        }
+
+        if (mAnalyzePending) {
+            mAnalyzePending = false;
+            runStep(Step::Analyze);
+            return;
+        }
+
+        if (!hasQueuedJobs()) {
+            mForced = false;
+            return;
+        }
+        // Started again by onDeviceStateChanged()
+        if (!canRunQueuedJobs()) {
+            return;
+        }
+
+        if (isFullUpdateDue()) {
+            qDebug() << "starting periodic full library update";
+            // Other jobs are scheduled again when update is committed
+            libraryUtils->updateDatabase();
+        } else if (mCompactPending) {
+            mCompactPending = false;
+            runStep(Step::CompactThumbnails);
+        } else {
+            runStep(Step::Vacuum);
+        }
+    }
+
+    void LibraryMaintenance::runStep(Step step)
+    {
+        mRunning = true;
+
+        using Watcher = QFutureWatcher<StepResult>;
+        auto watcher = new Watcher(this);
+        QObject::connect(watcher, &Watcher::finished, this, [=]() {
+            const StepResult result(watcher->result());
+            watcher->deleteLater();
+            mRunning = false;
+
+            if (result.libraryChanged) {
+                // URLs of thumbnails have changed
+                LibraryUtils::notifyLibraryChanged(LibraryChanges::everything());
+            }
+            if (step == Step::Vacuum && (!result.ok || result.freePages <= 0)) {
+                mVacuumPending = false;
+            }
+
+            if (mAnalyzePending) {
+                // Library was changed during step
+                mTimer->start(scheduleDelay);
+            } else if (step == Step::Vacuum && mVacuumPending) {
+                mTimer->start(vacuumStepInterval);
+            } else {
+                mTimer->start(0);
+            }
+        });
+        const QString databaseFilePath(mDatabaseFilePath);
+        const QString mediaArtDirectory(mMediaArtDirectory);
+        watcher->setFuture(threadpools::run(threadpools::JobClass::Scan, [databaseFilePath, mediaArtDirectory, step]() -> StepResult {
+            const QSqlDatabase db(LibraryUtils::threadDatabase(databaseFilePath));
+            if (!db.isOpen()) {
+                return {false, 0, false};
+            }
+            switch (step) {
+            case Step::Analyze:
+                analyze(db);
+                break;
+            case Step::CompactThumbnails:
+                return compactThumbnails(db, mediaArtDirectory);
+            case Step::Vacuum:
+                return vacuum(db);
+            }
+            return {true, 0, false};
+        }));
+    }
+
+    bool LibraryMaintenance::hasQueuedJobs() const
+    {
+        return mCompactPending || mVacuumPending || isFullUpdateDue();
+    }
+
+    bool LibraryMaintenance::canRunQueuedJobs() const
+    {
+        if (mForced || !Settings::instance()->deferLibraryMaintenance()) {
+            return true;
+        }
+        const ScanThrottle* throttle = ScanThrottle::instance();
+        return throttle->isCharging() && throttle->isDisplayOff();
+    }
+
+    bool LibraryMaintenance::isFullUpdateDue() const
+    {
+        const Settings* settings = Settings::instance();
+        if (!settings->hasLibraryDirectories()) {
+            return false;
+        }
+        return QDateTime::currentMSecsSinceEpoch() - settings->lastFullLibraryUpdate() > fullUpdateInterval;
+    }
+
+    void LibraryMaintenance::onDeviceStateChanged()
+    {
+        if (mRunning || mTimer->isActive() || !hasQueuedJobs()) {
+            return;
+        }
+        if (canRunQueuedJobs()) {
+            // Wait until device has been idle for a while
+            mTimer->start(idleDelay);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_LIBRARYMAINTENANCE_H
+#define UNPLAYER_LIBRARYMAINTENANCE_H
+
+#include <QObject>
+#include <QString>
+
+class QSqlDatabase;
+class QTimer;
+
+namespace unplayer
+{
+    // Keeps query planner statistics up to date after library is changed.
+    // Heavy jobs (returning free pages of database to file system, compacting thumbnail
+    // atlases and periodic full library update) are queued and run when device is charging
+    // with display off, unless deferring is disabled in settings or runNow() is called.
+    // Free pages are returned in small steps, so that each of them holds write lock only briefly.
+    // Jobs run on Scan thread pool, after library updater
+    class LibraryMaintenance final : public QObject
+    {
+        Q_OBJECT
+    public:
+        explicit LibraryMaintenance(const QString& databaseFilePath, const QString& mediaArtDirectory, QObject* parent);
+
+        // Switches database to incremental auto vacuum, rewriting it if needed.
+        // Must not be called in transaction
+        static bool enableIncrementalVacuum(const QSqlDatabase& db);
+
+        // Starts maintenance when library has not been changed for some time
+        void schedule();
+
+        // Runs queued jobs without waiting for device to be charging
+        void runNow();
+
+    private:
+        enum class Step
+        {
+            Analyze,
+            CompactThumbnails,
+            Vacuum
+        };
+
+        void start();
+        void runStep(Step step);
+        bool hasQueuedJobs() const;
+        bool canRunQueuedJobs() const;
+        bool isFullUpdateDue() const;
+        void onDeviceStateChanged();
+
+        const QString mDatabaseFilePath;
+        const QString mMediaArtDirectory;
+        QTimer* mTimer;
+        bool mRunning;
+        // Statistics are checked on first step after library was changed
+        bool mAnalyzePending;
+        bool mCompactPending;
+        bool mVacuumPending;
+        // Set by runNow() until queue is empty
+        bool mForced;
+    };
+}
+
+#endif // UNPLAYER_LIBRARYMAINTENANCE_H
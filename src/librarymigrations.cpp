@@ -0,0 +1,1010 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "librarymigrations.h"
+
+#include <vector>
+
+#include <QDebug>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QStringList>
+
+#include "libraryutils.h"
+#include "sqlquery.h"
+#include "stdutils.h"
+
+namespace unplayer
+{
+    namespace librarymigrations
+    {
+        namespace
+        {
+            // Migration from previous version, returns false on error
+            using Migration = bool (*)(const QSqlDatabase& db, bool& tracksTableCreated);
+
+            bool exec(const QSqlDatabase& db, const QString& queryString)
+            {
+                SqlQuery query(db);
+                if (!query.exec(queryString)) {
+                    qWarning() << "failed to execute query" << queryString << query.lastError();
+                    return false;
+                }
+                return true;
+            }
+
+            // Version 1: tracks, directories and libraryState tables
+            bool createInitialSchema(const QSqlDatabase& db, bool& tracksTableCreated)
+            {
+                // Databases created before migrations were introduced don't have user_version,
+                // keep tracks table if it has the right columns
+                bool createTable = !db.tables().contains(QLatin1String("tracks"));
+                if (!createTable) {
+                    static const std::vector<QString> fields{QLatin1String("id"),
+                                                             QLatin1String("filePath"),
+                                                             QLatin1String("modificationTime"),
+                                                             QLatin1String("title"),
+                                                             QLatin1String("artist"),
+                                                             QLatin1String("album"),
+                                                             QLatin1String("year"),
+                                                             QLatin1String("trackNumber"),
+                                                             QLatin1String("discNumber"),
+                                                             QLatin1String("genre"),
+                                                             QLatin1String("duration"),
+                                                             QLatin1String("mediaArt")};
+
+                    const QSqlRecord record(db.record(QLatin1String("tracks")));
+                    if (record.count() == static_cast<int>(fields.size())) {
+                        for (int i = 0, max = record.count(); i < max; ++i) {
+                            if (!contains(fields, record.fieldName(i))) {
+                                createTable = true;
+                            }
+                        }
+                    } else {
+                        createTable = true;
+                    }
+
+                    if (createTable) {
+                        if (!exec(db, QLatin1String("DROP TABLE tracks"))) {
+                            return false;
+                        }
+                    }
+                }
+
+                if (createTable) {
+                    if (!exec(db, QLatin1String("CREATE TABLE tracks ("
+                                                "    id INTEGER,"
+                                                "    filePath TEXT,"
+                                                "    modificationTime INTEGER,"
+                                                "    title TEXT COLLATE NOCASE,"
+                                                "    artist TEXT COLLATE NOCASE,"
+                                                "    album TEXT COLLATE NOCASE,"
+                                                "    year INTEGER,"
+                                                "    trackNumber INTEGER,"
+                                                "    discNumber TEXT,"
+                                                "    genre TEXT,"
+                                                "    duration INTEGER,"
+                                                "    mediaArt TEXT"
+                                                ")"))) {
+                        return false;
+                    }
+                    tracksTableCreated = true;
+                }
+
+                // Modification times of directories from last scan
+                if (!exec(db, QLatin1String("CREATE TABLE IF NOT EXISTS directories ("
+                                            "    path TEXT PRIMARY KEY,"
+                                            "    modificationTime INTEGER"
+                                            ")"))) {
+                    return false;
+                }
+                if (tracksTableCreated) {
+                    if (!exec(db, QLatin1String("DELETE FROM directories"))) {
+                        return false;
+                    }
+                }
+
+                return exec(db, QLatin1String("CREATE TABLE IF NOT EXISTS libraryState ("
+                                              "    key TEXT PRIMARY KEY,"
+                                              "    value TEXT"
+                                              ")"));
+            }
+
+            // Version 2: normalized schema.
+            // Artists, albums and genres are moved to separate tables,
+            // tracks table has one row per track
+            bool normalizeSchema(const QSqlDatabase& db, bool&)
+            {
+                static const std::vector<QString> queries{
+                    QLatin1String("ALTER TABLE tracks RENAME TO tracks_old"),
+
+                    QLatin1String("CREATE TABLE tracks ("
+                                  "    id INTEGER PRIMARY KEY,"
+                                  "    filePath TEXT NOT NULL UNIQUE,"
+                                  "    modificationTime INTEGER NOT NULL,"
+                                  "    title TEXT COLLATE NOCASE,"
+                                  "    year INTEGER,"
+                                  "    trackNumber INTEGER,"
+                                  "    discNumber TEXT,"
+                                  "    duration INTEGER,"
+                                  "    mediaArt TEXT"
+                                  ")"),
+
+                    // Tracks without artist, album or genre are linked to empty string
+                    QLatin1String("CREATE TABLE artists (id INTEGER PRIMARY KEY, title TEXT NOT NULL UNIQUE COLLATE NOCASE)"),
+                    QLatin1String("CREATE TABLE albums (id INTEGER PRIMARY KEY, title TEXT NOT NULL UNIQUE COLLATE NOCASE)"),
+                    QLatin1String("CREATE TABLE genres (id INTEGER PRIMARY KEY, title TEXT NOT NULL UNIQUE)"),
+
+                    QLatin1String("CREATE TABLE tracks_artists ("
+                                  "    trackId INTEGER NOT NULL REFERENCES tracks(id),"
+                                  "    artistId INTEGER NOT NULL REFERENCES artists(id),"
+                                  "    PRIMARY KEY (trackId, artistId)"
+                                  ")"),
+                    QLatin1String("CREATE TABLE tracks_albums ("
+                                  "    trackId INTEGER NOT NULL REFERENCES tracks(id),"
+                                  "    albumId INTEGER NOT NULL REFERENCES albums(id),"
+                                  "    PRIMARY KEY (trackId, albumId)"
+                                  ")"),
+                    QLatin1String("CREATE TABLE tracks_genres ("
+                                  "    trackId INTEGER NOT NULL REFERENCES tracks(id),"
+                                  "    genreId INTEGER NOT NULL REFERENCES genres(id),"
+                                  "    PRIMARY KEY (trackId, genreId)"
+                                  ")"),
+                    QLatin1String("CREATE INDEX tracks_artists_artistId ON tracks_artists (artistId)"),
+                    QLatin1String("CREATE INDEX tracks_albums_albumId ON tracks_albums (albumId)"),
+                    QLatin1String("CREATE INDEX tracks_genres_genreId ON tracks_genres (genreId)"),
+
+                    // Foreign keys are not enabled, so remove links using trigger
+                    QLatin1String("CREATE TRIGGER tracks_delete AFTER DELETE ON tracks BEGIN"
+                                  "    DELETE FROM tracks_artists WHERE trackId = OLD.id;"
+                                  "    DELETE FROM tracks_albums WHERE trackId = OLD.id;"
+                                  "    DELETE FROM tracks_genres WHERE trackId = OLD.id;"
+                                  "END"),
+
+                    // Move data
+                    QLatin1String("INSERT OR IGNORE INTO tracks (id, filePath, modificationTime, title, year, trackNumber, discNumber, duration, mediaArt) "
+                                  "SELECT id, filePath, modificationTime, title, year, trackNumber, discNumber, duration, mediaArt "
+                                  "FROM tracks_old GROUP BY id"),
+
+                    QLatin1String("INSERT OR IGNORE INTO artists (title) SELECT DISTINCT COALESCE(artist, '') FROM tracks_old"),
+                    QLatin1String("INSERT OR IGNORE INTO albums (title) SELECT DISTINCT COALESCE(album, '') FROM tracks_old"),
+                    QLatin1String("INSERT OR IGNORE INTO genres (title) SELECT DISTINCT COALESCE(genre, '') FROM tracks_old"),
+
+                    QLatin1String("INSERT OR IGNORE INTO tracks_artists (trackId, artistId) "
+                                  "SELECT tracks.id, artists.id FROM tracks_old "
+                                  "JOIN tracks ON tracks.id = tracks_old.id "
+                                  "JOIN artists ON artists.title = COALESCE(tracks_old.artist, '')"),
+                    QLatin1String("INSERT OR IGNORE INTO tracks_albums (trackId, albumId) "
+                                  "SELECT tracks.id, albums.id FROM tracks_old "
+                                  "JOIN tracks ON tracks.id = tracks_old.id "
+                                  "JOIN albums ON albums.title = COALESCE(tracks_old.album, '')"),
+                    QLatin1String("INSERT OR IGNORE INTO tracks_genres (trackId, genreId) "
+                                  "SELECT tracks.id, genres.id FROM tracks_old "
+                                  "JOIN tracks ON tracks.id = tracks_old.id "
+                                  "JOIN genres ON genres.title = COALESCE(tracks_old.genre, '')"),
+
+                    QLatin1String("DROP TABLE tracks_old")
+                };
+
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 3: covering indexes for library queries.
+            // filePath, id, and titles of artists, albums and genres are already
+            // indexed by their UNIQUE and PRIMARY KEY constraints
+            bool addIndexes(const QSqlDatabase& db, bool&)
+            {
+                static const std::vector<QString> queries{
+                    // Lookup of tracks by artist, album or genre doesn't need to touch the table
+                    QLatin1String("DROP INDEX tracks_artists_artistId"),
+                    QLatin1String("DROP INDEX tracks_albums_albumId"),
+                    QLatin1String("DROP INDEX tracks_genres_genreId"),
+                    QLatin1String("CREATE INDEX tracks_artists_artistId_trackId ON tracks_artists (artistId, trackId)"),
+                    QLatin1String("CREATE INDEX tracks_albums_albumId_trackId ON tracks_albums (albumId, trackId)"),
+                    QLatin1String("CREATE INDEX tracks_genres_genreId_trackId ON tracks_genres (genreId, trackId)"),
+
+                    // Random media art and removal of deleted media art files
+                    QLatin1String("CREATE INDEX tracks_mediaArt ON tracks (mediaArt)")
+                };
+
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 4: hash of embedded media art.
+            // NULL means that it is unknown and file should be read again
+            bool addEmbeddedMediaArtHash(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("ALTER TABLE tracks ADD COLUMN embeddedMediaArtHash TEXT")) &&
+                       // Name of embedded media art file starts with MD5 hash of its data
+                       exec(db, QLatin1String("UPDATE tracks SET embeddedMediaArtHash = substr(mediaArt, instr(mediaArt, '-embedded.') - 32, 32) "
+                                              "WHERE instr(mediaArt, '-embedded.') > 32"));
+            }
+
+            // Version 5: downscaled media art.
+            // NULL means that thumbnail was not created yet
+            bool addMediaArtThumbnail(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("ALTER TABLE tracks ADD COLUMN mediaArtThumbnail TEXT"));
+            }
+
+            // Version 6: full-text search index of titles, artists and albums.
+            // Rowid is id of track. FTS5 may be not available, then FTS4 is used
+            bool addSearchIndex(const QSqlDatabase& db, bool&)
+            {
+                static const std::vector<QString> createQueries{
+                    QLatin1String("CREATE VIRTUAL TABLE tracks_search USING fts5(title, artist, album, "
+                                  "tokenize = 'unicode61 remove_diacritics 1', prefix = '1 2 3')"),
+                    QLatin1String("CREATE VIRTUAL TABLE tracks_search USING fts4(title, artist, album, "
+                                  "tokenize=unicode61 \"remove_diacritics=1\", prefix=\"1,2,3\")"),
+                    QLatin1String("CREATE VIRTUAL TABLE tracks_search USING fts4(title, artist, album, prefix=\"1,2,3\")")
+                };
+
+                bool created = false;
+                for (const QString& queryString : createQueries) {
+                    SqlQuery query(db);
+                    if (query.exec(queryString)) {
+                        created = true;
+                        break;
+                    }
+                    qWarning() << "failed to create search index" << query.lastError();
+                }
+                if (!created) {
+                    return false;
+                }
+
+                static const std::vector<QString> queries{
+                    QLatin1String("INSERT INTO tracks_search (rowid, title, artist, album) "
+                                  "SELECT id, title, "
+                                  "(SELECT group_concat(artists.title, ', ') FROM tracks_artists "
+                                  " JOIN artists ON artists.id = tracks_artists.artistId WHERE tracks_artists.trackId = tracks.id), "
+                                  "(SELECT group_concat(albums.title, ', ') FROM tracks_albums "
+                                  " JOIN albums ON albums.id = tracks_albums.albumId WHERE tracks_albums.trackId = tracks.id) "
+                                  "FROM tracks"),
+
+                    QLatin1String("CREATE TRIGGER tracks_search_delete AFTER DELETE ON tracks BEGIN"
+                                  "    DELETE FROM tracks_search WHERE rowid = OLD.id;"
+                                  "END")
+                };
+
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 7: library statistics.
+            // Counts are updated by triggers, so that they don't have to be computed
+            // from whole tables every time library changes
+            bool addStatistics(const QSqlDatabase& db, bool&)
+            {
+                static const std::vector<QString> queries{
+                    QLatin1String("CREATE TABLE libraryStatistics ("
+                                  "    id INTEGER PRIMARY KEY CHECK (id = 0),"
+                                  "    artistsCount INTEGER NOT NULL,"
+                                  "    albumsCount INTEGER NOT NULL,"
+                                  "    tracksCount INTEGER NOT NULL,"
+                                  "    tracksDuration INTEGER NOT NULL"
+                                  ")"),
+                    QLatin1String("INSERT INTO libraryStatistics (id, artistsCount, albumsCount, tracksCount, tracksDuration) VALUES (0, "
+                                  "(SELECT COUNT(DISTINCT(artistId)) FROM tracks_artists), "
+                                  "(SELECT COUNT(DISTINCT(albumId)) FROM tracks_albums), "
+                                  "(SELECT COUNT(*) FROM tracks), "
+                                  "(SELECT COALESCE(SUM(duration), 0) FROM tracks))"),
+
+                    QLatin1String("CREATE TRIGGER tracks_statistics_insert AFTER INSERT ON tracks BEGIN"
+                                  "    UPDATE libraryStatistics SET tracksCount = tracksCount + 1, tracksDuration = tracksDuration + COALESCE(NEW.duration, 0);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_statistics_delete AFTER DELETE ON tracks BEGIN"
+                                  "    UPDATE libraryStatistics SET tracksCount = tracksCount - 1, tracksDuration = tracksDuration - COALESCE(OLD.duration, 0);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_statistics_update AFTER UPDATE OF duration ON tracks BEGIN"
+                                  "    UPDATE libraryStatistics SET tracksDuration = tracksDuration - COALESCE(OLD.duration, 0) + COALESCE(NEW.duration, 0);"
+                                  "END"),
+
+                    // Artists and albums are counted when their first track is linked
+                    // and when their last track is unlinked
+                    QLatin1String("CREATE TRIGGER tracks_artists_statistics_insert AFTER INSERT ON tracks_artists "
+                                  "WHEN NOT EXISTS (SELECT 1 FROM tracks_artists WHERE artistId = NEW.artistId AND trackId != NEW.trackId) BEGIN"
+                                  "    UPDATE libraryStatistics SET artistsCount = artistsCount + 1;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_artists_statistics_delete AFTER DELETE ON tracks_artists "
+                                  "WHEN NOT EXISTS (SELECT 1 FROM tracks_artists WHERE artistId = OLD.artistId) BEGIN"
+                                  "    UPDATE libraryStatistics SET artistsCount = artistsCount - 1;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_albums_statistics_insert AFTER INSERT ON tracks_albums "
+                                  "WHEN NOT EXISTS (SELECT 1 FROM tracks_albums WHERE albumId = NEW.albumId AND trackId != NEW.trackId) BEGIN"
+                                  "    UPDATE libraryStatistics SET albumsCount = albumsCount + 1;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_albums_statistics_delete AFTER DELETE ON tracks_albums "
+                                  "WHEN NOT EXISTS (SELECT 1 FROM tracks_albums WHERE albumId = OLD.albumId) BEGIN"
+                                  "    UPDATE libraryStatistics SET albumsCount = albumsCount - 1;"
+                                  "END")
+                };
+
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 8: summaries of artists and albums for library pages.
+            // Triggers only mark artists and albums which tracks have changed,
+            // summaries are recomputed by LibraryUtils::updateSummaries() before
+            // transaction is committed
+            bool addSummaries(const QSqlDatabase& db, bool&)
+            {
+                static const std::vector<QString> queries{
+                    QLatin1String("CREATE TABLE artist_summary ("
+                                  "    artistId INTEGER PRIMARY KEY,"
+                                  "    albumsCount INTEGER NOT NULL,"
+                                  "    tracksCount INTEGER NOT NULL,"
+                                  "    duration INTEGER NOT NULL,"
+                                  "    mediaArt TEXT"
+                                  ")"),
+                    QLatin1String("CREATE TABLE album_summary ("
+                                  "    albumId INTEGER NOT NULL,"
+                                  "    artistId INTEGER NOT NULL,"
+                                  "    year INTEGER,"
+                                  "    tracksCount INTEGER NOT NULL,"
+                                  "    duration INTEGER NOT NULL,"
+                                  "    mediaArt TEXT,"
+                                  "    PRIMARY KEY (albumId, artistId)"
+                                  ")"),
+                    QLatin1String("CREATE INDEX album_summary_artistId ON album_summary (artistId)"),
+
+                    QLatin1String("CREATE TABLE summaries_dirty_artists (artistId INTEGER PRIMARY KEY)"),
+                    QLatin1String("CREATE TABLE summaries_dirty_albums (albumId INTEGER PRIMARY KEY)"),
+
+                    // Album count of artist depends on albums links, and artists of album on artists links
+                    QLatin1String("CREATE TRIGGER tracks_artists_summaries_insert AFTER INSERT ON tracks_artists BEGIN"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_artists VALUES (NEW.artistId);"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_albums SELECT albumId FROM tracks_albums WHERE trackId = NEW.trackId;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_artists_summaries_delete AFTER DELETE ON tracks_artists BEGIN"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_artists VALUES (OLD.artistId);"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_albums SELECT albumId FROM tracks_albums WHERE trackId = OLD.trackId;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_albums_summaries_insert AFTER INSERT ON tracks_albums BEGIN"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_albums VALUES (NEW.albumId);"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_artists SELECT artistId FROM tracks_artists WHERE trackId = NEW.trackId;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_albums_summaries_delete AFTER DELETE ON tracks_albums BEGIN"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_albums VALUES (OLD.albumId);"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_artists SELECT artistId FROM tracks_artists WHERE trackId = OLD.trackId;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_summaries_update AFTER UPDATE OF year, duration, mediaArt, mediaArtThumbnail ON tracks BEGIN"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_artists SELECT artistId FROM tracks_artists WHERE trackId = NEW.id;"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_albums SELECT albumId FROM tracks_albums WHERE trackId = NEW.id;"
+                                  "END"),
+
+                    // Summaries are computed after migration
+                    QLatin1String("INSERT INTO summaries_dirty_artists SELECT id FROM artists"),
+                    QLatin1String("INSERT INTO summaries_dirty_albums SELECT id FROM albums")
+                };
+
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 9: storage volumes of library directories.
+            // rootPath is mount point of volume when directory was last available
+            bool addVolumes(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("CREATE TABLE volumes ("
+                                              "    libraryDirectory TEXT PRIMARY KEY,"
+                                              "    rootPath TEXT NOT NULL"
+                                              ")"));
+            }
+
+            // Version 10: reference counts of media art and thumbnail files.
+            // Files with zero references are removed after library update
+            bool addMediaArtReferences(const QSqlDatabase& db, bool&)
+            {
+                const std::vector<QLatin1String> queries{
+                    QLatin1String("CREATE TABLE mediaArtFiles ("
+                                  "    filePath TEXT PRIMARY KEY,"
+                                  "    refCount INTEGER NOT NULL"
+                                  ")"),
+                    QLatin1String("INSERT INTO mediaArtFiles "
+                                  "SELECT filePath, COUNT(*) FROM ("
+                                  "    SELECT mediaArt AS filePath FROM tracks WHERE mediaArt != '' "
+                                  "    UNION ALL "
+                                  "    SELECT mediaArtThumbnail FROM tracks WHERE mediaArtThumbnail != ''"
+                                  ") GROUP BY filePath"),
+
+                    QLatin1String("CREATE TRIGGER tracks_mediaArt_insert AFTER INSERT ON tracks BEGIN"
+                                  "    INSERT OR IGNORE INTO mediaArtFiles SELECT NEW.mediaArt, 0 WHERE NEW.mediaArt != '';"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount + 1 WHERE filePath = NEW.mediaArt;"
+                                  "    INSERT OR IGNORE INTO mediaArtFiles SELECT NEW.mediaArtThumbnail, 0 WHERE NEW.mediaArtThumbnail != '';"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount + 1 WHERE filePath = NEW.mediaArtThumbnail;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_mediaArt_delete AFTER DELETE ON tracks BEGIN"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount - 1 WHERE filePath = OLD.mediaArt;"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount - 1 WHERE filePath = OLD.mediaArtThumbnail;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_mediaArt_update AFTER UPDATE OF mediaArt, mediaArtThumbnail ON tracks BEGIN"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount - 1 WHERE filePath = OLD.mediaArt;"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount - 1 WHERE filePath = OLD.mediaArtThumbnail;"
+                                  "    INSERT OR IGNORE INTO mediaArtFiles SELECT NEW.mediaArt, 0 WHERE NEW.mediaArt != '';"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount + 1 WHERE filePath = NEW.mediaArt;"
+                                  "    INSERT OR IGNORE INTO mediaArtFiles SELECT NEW.mediaArtThumbnail, 0 WHERE NEW.mediaArtThumbnail != '';"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount + 1 WHERE filePath = NEW.mediaArtThumbnail;"
+                                  "END")
+                };
+
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 11: cover images found in directories.
+            // mediaArt is empty if directory doesn't have it
+            bool addDirectoryMediaArt(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("CREATE TABLE directoryMediaArt ("
+                                              "    path TEXT PRIMARY KEY,"
+                                              "    modificationTime INTEGER NOT NULL,"
+                                              "    mediaArt TEXT NOT NULL"
+                                              ")"));
+            }
+
+            // Version 12: tags of files which were added to the queue but are not in the library.
+            // Rows with the lowest rowid are removed when there are too many of them
+            bool addExternalTracks(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("CREATE TABLE externalTracks ("
+                                              "    filePath TEXT PRIMARY KEY,"
+                                              "    modificationTime INTEGER NOT NULL,"
+                                              "    title TEXT NOT NULL,"
+                                              "    duration INTEGER NOT NULL,"
+                                              "    artist TEXT NOT NULL,"
+                                              "    album TEXT NOT NULL,"
+                                              "    mediaArt TEXT NOT NULL,"
+                                              "    hasEmbeddedMediaArt INTEGER NOT NULL"
+                                              ")"));
+            }
+
+            // Version 13: numbers of tracks in playlists, which are parsed again
+            // only when their files are changed
+            bool addPlaylists(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("CREATE TABLE playlists ("
+                                              "    filePath TEXT PRIMARY KEY,"
+                                              "    modificationTime INTEGER NOT NULL,"
+                                              "    size INTEGER NOT NULL,"
+                                              "    tracksCount INTEGER NOT NULL"
+                                              ")"));
+            }
+
+            // Version 14: entries of playlists, which are indexed together with their counts.
+            // Cached counts are removed so that all playlists are indexed again
+            bool addPlaylistEntries(const QSqlDatabase& db, bool&)
+            {
+                const std::vector<QLatin1String> queries{
+                    QLatin1String("DELETE FROM playlists"),
+                    QLatin1String("CREATE TABLE playlist_entries ("
+                                  "    playlistFilePath TEXT NOT NULL,"
+                                  "    position INTEGER NOT NULL,"
+                                  "    url TEXT NOT NULL,"
+                                  "    title TEXT NOT NULL,"
+                                  "    duration INTEGER NOT NULL,"
+                                  "    artist TEXT NOT NULL,"
+                                  "    album TEXT NOT NULL,"
+                                  "    PRIMARY KEY (playlistFilePath, position)"
+                                  ")"),
+                    QLatin1String("CREATE TRIGGER playlists_delete AFTER DELETE ON playlists BEGIN"
+                                  "    DELETE FROM playlist_entries WHERE playlistFilePath = OLD.filePath;"
+                                  "END")
+                };
+
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 15: precomputed sort keys (see LibraryUtils::sortKey()), so that
+            // ORDER BY doesn't use expressions and can be satisfied by indexes
+            bool addSortKeys(const QSqlDatabase& db, bool&)
+            {
+                static const std::vector<QString> alterQueries{
+                    QLatin1String("ALTER TABLE artists ADD COLUMN sortKey TEXT NOT NULL DEFAULT ''"),
+                    QLatin1String("ALTER TABLE albums ADD COLUMN sortKey TEXT NOT NULL DEFAULT ''"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN titleSortKey TEXT NOT NULL DEFAULT ''"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN discNumberSortKey TEXT NOT NULL DEFAULT ''")
+                };
+                for (const QString& query : alterQueries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+
+                struct SortKeyColumn
+                {
+                    QLatin1String table;
+                    QLatin1String column;
+                    QLatin1String sortKeyColumn;
+                };
+                static const std::vector<SortKeyColumn> columns{
+                    {QLatin1String("artists"), QLatin1String("title"), QLatin1String("sortKey")},
+                    {QLatin1String("albums"), QLatin1String("title"), QLatin1String("sortKey")},
+                    {QLatin1String("tracks"), QLatin1String("title"), QLatin1String("titleSortKey")},
+                    {QLatin1String("tracks"), QLatin1String("discNumber"), QLatin1String("discNumberSortKey")}
+                };
+                for (const SortKeyColumn& column : columns) {
+                    SqlQuery selectQuery(db);
+                    selectQuery.setForwardOnly(true);
+                    if (!selectQuery.exec(QString::fromLatin1("SELECT id, %1 FROM %2").arg(column.column, column.table))) {
+                        qWarning() << "failed to select" << column.column << "from" << column.table << selectQuery.lastError();
+                        return false;
+                    }
+                    SqlQuery updateQuery(db);
+                    updateQuery.prepare(QString::fromLatin1("UPDATE %1 SET %2 = ? WHERE id = ?").arg(column.table, column.sortKeyColumn));
+                    while (selectQuery.next()) {
+                        updateQuery.addBindValue(LibraryUtils::sortKey(selectQuery.value(1).toString()));
+                        updateQuery.addBindValue(selectQuery.value(0));
+                        if (!updateQuery.exec()) {
+                            qWarning() << "failed to update sort key" << updateQuery.lastError();
+                            return false;
+                        }
+                    }
+                }
+
+                static const std::vector<QString> indexQueries{
+                    QLatin1String("CREATE INDEX artists_sortKey ON artists (sortKey)"),
+                    QLatin1String("CREATE INDEX albums_sortKey ON albums (sortKey)"),
+                    QLatin1String("CREATE INDEX tracks_titleSortKey ON tracks (titleSortKey)")
+                };
+                for (const QString& query : indexQueries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 16: cost of last scan for each directory, time is in milliseconds
+            bool addScanStatistics(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("CREATE TABLE scanStatistics ("
+                                              "    directory TEXT PRIMARY KEY,"
+                                              "    examinedFiles INTEGER NOT NULL,"
+                                              "    parsedFiles INTEGER NOT NULL,"
+                                              "    bytesRead INTEGER NOT NULL,"
+                                              "    time INTEGER NOT NULL,"
+                                              "    errors INTEGER NOT NULL"
+                                              ")"));
+            }
+
+            // Version 17: files which parsing exceeded read budget, they are skipped until they change
+            bool addQuarantine(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("CREATE TABLE quarantinedFiles ("
+                                              "    filePath TEXT PRIMARY KEY,"
+                                              "    modificationTime INTEGER NOT NULL"
+                                              ")"));
+            }
+
+            // Version 18: size of file in bytes, together with modification time it is used
+            // to recognize moved and renamed files. Null for tracks added by older versions
+            bool addFileSize(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("ALTER TABLE tracks ADD COLUMN fileSize INTEGER"));
+            }
+
+            // Version 19: durations of MPEG files that were estimated by scan
+            // and are refined by LibraryUpdater::refineDurations()
+            bool addDurationEstimated(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("ALTER TABLE tracks ADD COLUMN durationEstimated INTEGER NOT NULL DEFAULT 0"));
+            }
+
+            // Version 20: thumbnails are packed into atlas files, see ThumbnailAtlasWriter.
+            // Thumbnail files made by older versions are removed after library update
+            bool addThumbnailAtlas(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("CREATE TABLE thumbnails ("
+                                              "    key TEXT PRIMARY KEY,"
+                                              "    url TEXT NOT NULL,"
+                                              "    atlas INTEGER NOT NULL,"
+                                              "    size INTEGER NOT NULL"
+                                              ")")) &&
+                       exec(db, QLatin1String("UPDATE tracks SET mediaArtThumbnail = NULL "
+                                              "WHERE mediaArtThumbnail LIKE '%/media-art/thumbnails/%.jpg'"));
+            }
+
+            // Version 21: thumbnails are served by ArtImageProvider, image://thumbnails/
+            // URLs are changed to image://art/thumbnails/. References in mediaArtFiles
+            // are moved by triggers, summaries are recomputed
+            bool moveThumbnailsToArtProvider(const QSqlDatabase& db, bool&)
+            {
+                const std::vector<QLatin1String> queries{
+                    QLatin1String("UPDATE thumbnails SET url = 'image://art/' || substr(url, 9)"),
+                    QLatin1String("UPDATE tracks SET mediaArtThumbnail = 'image://art/' || substr(mediaArtThumbnail, 9) "
+                                  "WHERE mediaArtThumbnail LIKE 'image://thumbnails/%'"),
+                    QLatin1String("DELETE FROM mediaArtFiles WHERE refCount <= 0")
+                };
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 22: play statistics written by PlayStatistics. Indexes on play count
+            // and last played time keep most played and recently played views cheap
+            bool addPlayStatistics(const QSqlDatabase& db, bool&)
+            {
+                const std::vector<QLatin1String> queries{
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN playCount INTEGER NOT NULL DEFAULT 0"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN skipCount INTEGER NOT NULL DEFAULT 0"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN lastPlayed INTEGER NOT NULL DEFAULT 0"),
+                    QLatin1String("CREATE INDEX tracks_playCount ON tracks(playCount) WHERE playCount > 0"),
+                    QLatin1String("CREATE INDEX tracks_lastPlayed ON tracks(lastPlayed) WHERE lastPlayed > 0")
+                };
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 23: rule based playlists, see smartplaylists.h. Members are kept in
+            // smartPlaylistTracks and re-evaluated only for tracks marked by triggers.
+            // Tracks added by older versions have unknown added time
+            bool addSmartPlaylists(const QSqlDatabase& db, bool&)
+            {
+                const std::vector<QLatin1String> queries{
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN addedTime INTEGER NOT NULL DEFAULT 0"),
+                    QLatin1String("CREATE TABLE smartPlaylists ("
+                                  "    id INTEGER PRIMARY KEY,"
+                                  "    name TEXT NOT NULL UNIQUE,"
+                                  "    rules TEXT NOT NULL"
+                                  ")"),
+                    QLatin1String("CREATE TABLE smartPlaylistTracks ("
+                                  "    playlistId INTEGER NOT NULL,"
+                                  "    trackId INTEGER NOT NULL,"
+                                  "    PRIMARY KEY (playlistId, trackId)"
+                                  ") WITHOUT ROWID"),
+                    QLatin1String("CREATE INDEX smartPlaylistTracks_trackId ON smartPlaylistTracks (trackId)"),
+                    QLatin1String("CREATE TABLE smartPlaylists_dirty_tracks (trackId INTEGER PRIMARY KEY)"),
+
+                    QLatin1String("CREATE TRIGGER smartPlaylists_delete AFTER DELETE ON smartPlaylists BEGIN"
+                                  "    DELETE FROM smartPlaylistTracks WHERE playlistId = OLD.id;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_smartPlaylists_delete AFTER DELETE ON tracks BEGIN"
+                                  "    DELETE FROM smartPlaylistTracks WHERE trackId = OLD.id;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_smartPlaylists_insert AFTER INSERT ON tracks BEGIN"
+                                  "    INSERT OR IGNORE INTO smartPlaylists_dirty_tracks VALUES (NEW.id);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_smartPlaylists_update AFTER UPDATE OF year, playCount, addedTime ON tracks BEGIN"
+                                  "    INSERT OR IGNORE INTO smartPlaylists_dirty_tracks VALUES (NEW.id);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_artists_smartPlaylists_insert AFTER INSERT ON tracks_artists BEGIN"
+                                  "    INSERT OR IGNORE INTO smartPlaylists_dirty_tracks VALUES (NEW.trackId);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_artists_smartPlaylists_delete AFTER DELETE ON tracks_artists BEGIN"
+                                  "    INSERT OR IGNORE INTO smartPlaylists_dirty_tracks VALUES (OLD.trackId);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_albums_smartPlaylists_insert AFTER INSERT ON tracks_albums BEGIN"
+                                  "    INSERT OR IGNORE INTO smartPlaylists_dirty_tracks VALUES (NEW.trackId);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_albums_smartPlaylists_delete AFTER DELETE ON tracks_albums BEGIN"
+                                  "    INSERT OR IGNORE INTO smartPlaylists_dirty_tracks VALUES (OLD.trackId);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_genres_smartPlaylists_insert AFTER INSERT ON tracks_genres BEGIN"
+                                  "    INSERT OR IGNORE INTO smartPlaylists_dirty_tracks VALUES (NEW.trackId);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER tracks_genres_smartPlaylists_delete AFTER DELETE ON tracks_genres BEGIN"
+                                  "    INSERT OR IGNORE INTO smartPlaylists_dirty_tracks VALUES (OLD.trackId);"
+                                  "END")
+                };
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 24: recently added tracks and albums are read by index range scan
+            // on added time, see RecentlyAddedModel. Album added time is time of its
+            // newest track, kept in album_summary by LibraryUtils::updateSummaries()
+            bool addRecentlyAdded(const QSqlDatabase& db, bool&)
+            {
+                const std::vector<QLatin1String> queries{
+                    QLatin1String("CREATE INDEX tracks_addedTime ON tracks(addedTime)"),
+                    QLatin1String("ALTER TABLE album_summary ADD COLUMN addedTime INTEGER NOT NULL DEFAULT 0"),
+                    QLatin1String("CREATE INDEX album_summary_addedTime ON album_summary(addedTime)")
+                };
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 25: audio format and ReplayGain, read by scan so that player and
+            // track info don't parse files of library tracks. Null for tracks added by
+            // older versions until they are changed, gains are also null if file doesn't have them
+            bool addAudioDetails(const QSqlDatabase& db, bool&)
+            {
+                const std::vector<QLatin1String> queries{
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN bitrate INTEGER"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN sampleRate INTEGER"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN channels INTEGER"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN replayGainTrack REAL"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN replayGainAlbum REAL"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN replayGainTrackPeak REAL"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN replayGainAlbumPeak REAL")
+                };
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 26: media art chosen by user for album of artist. It takes precedence
+            // over media art of tracks in album summary, so that tracks are not rewritten
+            bool addAlbumMediaArt(const QSqlDatabase& db, bool&)
+            {
+                const std::vector<QLatin1String> queries{
+                    QLatin1String("CREATE TABLE albumMediaArt ("
+                                  "    albumId INTEGER NOT NULL,"
+                                  "    artistId INTEGER NOT NULL,"
+                                  "    mediaArt TEXT NOT NULL,"
+                                  "    mediaArtThumbnail TEXT,"
+                                  "    PRIMARY KEY (albumId, artistId)"
+                                  ")"),
+
+                    QLatin1String("CREATE TRIGGER albumMediaArt_insert AFTER INSERT ON albumMediaArt BEGIN"
+                                  "    INSERT OR IGNORE INTO mediaArtFiles SELECT NEW.mediaArt, 0 WHERE NEW.mediaArt != '';"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount + 1 WHERE filePath = NEW.mediaArt;"
+                                  "    INSERT OR IGNORE INTO mediaArtFiles SELECT NEW.mediaArtThumbnail, 0 WHERE NEW.mediaArtThumbnail != '';"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount + 1 WHERE filePath = NEW.mediaArtThumbnail;"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_albums VALUES (NEW.albumId);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER albumMediaArt_delete AFTER DELETE ON albumMediaArt BEGIN"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount - 1 WHERE filePath = OLD.mediaArt;"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount - 1 WHERE filePath = OLD.mediaArtThumbnail;"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_albums VALUES (OLD.albumId);"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER albumMediaArt_update AFTER UPDATE OF mediaArt, mediaArtThumbnail ON albumMediaArt BEGIN"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount - 1 WHERE filePath = OLD.mediaArt;"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount - 1 WHERE filePath = OLD.mediaArtThumbnail;"
+                                  "    INSERT OR IGNORE INTO mediaArtFiles SELECT NEW.mediaArt, 0 WHERE NEW.mediaArt != '';"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount + 1 WHERE filePath = NEW.mediaArt;"
+                                  "    INSERT OR IGNORE INTO mediaArtFiles SELECT NEW.mediaArtThumbnail, 0 WHERE NEW.mediaArtThumbnail != '';"
+                                  "    UPDATE mediaArtFiles SET refCount = refCount + 1 WHERE filePath = NEW.mediaArtThumbnail;"
+                                  "    INSERT OR IGNORE INTO summaries_dirty_albums VALUES (NEW.albumId);"
+                                  "END"),
+
+                    // Removed when album or artist no longer has tracks
+                    QLatin1String("CREATE TRIGGER albums_albumMediaArt_delete AFTER DELETE ON albums BEGIN"
+                                  "    DELETE FROM albumMediaArt WHERE albumId = OLD.id;"
+                                  "END"),
+                    QLatin1String("CREATE TRIGGER artists_albumMediaArt_delete AFTER DELETE ON artists BEGIN"
+                                  "    DELETE FROM albumMediaArt WHERE artistId = OLD.id;"
+                                  "END")
+                };
+                for (const QString& query : queries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 27: artists and albums of track joined for display (see LibraryUtils::displayString()),
+            // so that readers don't join link tables and get a row per combination of them
+            bool addDisplayStrings(const QSqlDatabase& db, bool&)
+            {
+                static const std::vector<QString> alterQueries{
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN displayArtist TEXT NOT NULL DEFAULT ''"),
+                    QLatin1String("ALTER TABLE tracks ADD COLUMN displayAlbum TEXT NOT NULL DEFAULT ''")
+                };
+                for (const QString& query : alterQueries) {
+                    if (!exec(db, query)) {
+                        return false;
+                    }
+                }
+
+                struct DisplayColumn
+                {
+                    QLatin1String table;
+                    QLatin1String linkTable;
+                    QLatin1String idColumn;
+                    QLatin1String displayColumn;
+                };
+                static const std::vector<DisplayColumn> columns{
+                    {QLatin1String("artists"), QLatin1String("tracks_artists"), QLatin1String("artistId"), QLatin1String("displayArtist")},
+                    {QLatin1String("albums"), QLatin1String("tracks_albums"), QLatin1String("albumId"), QLatin1String("displayAlbum")}
+                };
+                for (const DisplayColumn& column : columns) {
+                    SqlQuery selectQuery(db);
+                    selectQuery.setForwardOnly(true);
+                    // Titles are in order in which they were linked by scan
+                    if (!selectQuery.exec(QString::fromLatin1("SELECT trackId, title FROM %1 JOIN %2 ON %2.id = %1.%3 "
+                                                              "ORDER BY trackId, %1.rowid").arg(column.linkTable, column.table, column.idColumn))) {
+                        qWarning() << "failed to select" << column.table << "of tracks" << selectQuery.lastError();
+                        return false;
+                    }
+                    SqlQuery updateQuery(db);
+                    updateQuery.prepare(QString::fromLatin1("UPDATE tracks SET %1 = ? WHERE id = ?").arg(column.displayColumn));
+
+                    QVariant trackId;
+                    QStringList titles;
+                    const auto update = [&]() -> bool {
+                        updateQuery.addBindValue(LibraryUtils::displayString(titles));
+                        updateQuery.addBindValue(trackId);
+                        if (!updateQuery.exec()) {
+                            qWarning() << "failed to update" << column.displayColumn << updateQuery.lastError();
+                            return false;
+                        }
+                        return true;
+                    };
+                    while (selectQuery.next()) {
+                        const QVariant id(selectQuery.value(0));
+                        if (id != trackId) {
+                            if (!titles.isEmpty() && !update()) {
+                                return false;
+                            }
+                            trackId = id;
+                            titles.clear();
+                        }
+                        titles.push_back(selectQuery.value(1).toString());
+                    }
+                    if (!titles.isEmpty() && !update()) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // Version 28: dominant colors of thumbnails, shown until they are decoded.
+            // NULL until computed by ThumbnailAtlasWriter::addMissingPlaceholders(),
+            // models find them by URL of media art
+            bool addThumbnailPlaceholders(const QSqlDatabase& db, bool&)
+            {
+                return exec(db, QLatin1String("ALTER TABLE thumbnails ADD COLUMN placeholder INTEGER")) &&
+                       exec(db, QLatin1String("CREATE INDEX thumbnails_url ON thumbnails (url)"));
+            }
+
+            // Append new migrations to the end, never change existing ones
+            const std::vector<Migration> migrations{createInitialSchema,
+                                                    normalizeSchema,
+                                                    addIndexes,
+                                                    addEmbeddedMediaArtHash,
+                                                    addMediaArtThumbnail,
+                                                    addSearchIndex,
+                                                    addStatistics,
+                                                    addSummaries,
+                                                    addVolumes,
+                                                    addMediaArtReferences,
+                                                    addDirectoryMediaArt,
+                                                    addExternalTracks,
+                                                    addPlaylists,
+                                                    addPlaylistEntries,
+                                                    addSortKeys,
+                                                    addScanStatistics,
+                                                    addQuarantine,
+                                                    addFileSize,
+                                                    addDurationEstimated,
+                                                    addThumbnailAtlas,
+                                                    moveThumbnailsToArtProvider,
+                                                    addPlayStatistics,
+                                                    addSmartPlaylists,
+                                                    addRecentlyAdded,
+                                                    addAudioDetails,
+                                                    addAlbumMediaArt,
+                                                    addDisplayStrings,
+                                                    addThumbnailPlaceholders};
+
+            int userVersion(const QSqlDatabase& db)
+            {
+                SqlQuery query(QLatin1String("PRAGMA user_version"), db);
+                if (query.next()) {
+                    return query.value(0).toInt();
+                }
+                qWarning() << "failed to get database version" << query.lastError();
+                return -1;
+            }
+
+            bool dropAllTables(const QSqlDatabase& db)
+            {
+                for (const QString& table : db.tables()) {
+                    // Shadow tables of search index are dropped together with it
+                    if (!exec(db, QString::fromLatin1("DROP TABLE IF EXISTS %1").arg(table))) {
+                        return false;
+                    }
+                }
+                return exec(db, QLatin1String("PRAGMA user_version = 0"));
+            }
+        }
+
+        int currentVersion()
+        {
+            return static_cast<int>(migrations.size());
+        }
+
+        bool migrate(QSqlDatabase& db, bool& tracksTableCreated)
+        {
+            int version = userVersion(db);
+            if (version < 0) {
+                return false;
+            }
+
+            if (version > currentVersion()) {
+                // Database was created by newer version of Unplayer
+                qWarning() << "unknown database version" << version << ", recreating database";
+                if (!dropAllTables(db)) {
+                    return false;
+                }
+                version = 0;
+            }
+
+            for (; version < currentVersion(); ++version) {
+                qDebug() << "migrating database from version" << version << "to" << version + 1;
+
+                db.transaction();
+                if (!migrations[version](db, tracksTableCreated) ||
+                        !exec(db, QString::fromLatin1("PRAGMA user_version = %1").arg(version + 1))) {
+                    qWarning() << "failed to migrate database to version" << version + 1;
+                    db.rollback();
+                    return false;
+                }
+                if (!db.commit()) {
+                    qWarning() << "failed to commit database migration" << db.lastError();
+                    return false;
+                }
+            }
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_LIBRARYMIGRATIONS_H
+#define UNPLAYER_LIBRARYMIGRATIONS_H
+
+class QSqlDatabase;
+
+namespace unplayer
+{
+    namespace librarymigrations
+    {
+        int currentVersion();
+
+        // Upgrades database schema to current version in place.
+        // Schema version is stored in PRAGMA user_version.
+        // tracksTableCreated is set to true if tracks table was (re)created and library should be scanned
+        bool migrate(QSqlDatabase& db, bool& tracksTableCreated);
+    }
+}
+
+#endif // UNPLAYER_LIBRARYMIGRATIONS_H
@@ -0,0 +1,288 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libraryreplica.h"
+
+#include <atomic>
+
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include <QAtomicInt>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QSqlError>
+#include <QThreadStorage>
+#include <QTimer>
+
+#include "libraryutils.h"
+#include "memorypressure.h"
+#include "sqlquery.h"
+#include "threadpools.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        LibraryReplica* instancePointer = nullptr;
+
+        // Generation of up to date replica, -1 if there is none
+        std::atomic_int currentGeneration(-1);
+        // Incremented on every change of database
+        std::atomic_int changesCounter(0);
+
+        // Changes are usually committed in batches
+        const int copyDelay = 2000;
+        // Database must not take more than this fraction of physical memory
+        const int physicalMemoryDivisor = 8;
+
+        QString replicaUri(int generation)
+        {
+            return QString::fromLatin1("file:unplayer-replica-%1?mode=memory&cache=shared").arg(generation);
+        }
+
+        bool fitsInMemory(const QString& databaseFilePath)
+        {
+            const qint64 size = QFileInfo(databaseFilePath).size() + QFileInfo(databaseFilePath + QLatin1String("-wal")).size();
+            const qint64 physicalMemory = static_cast<qint64>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE);
+            if (physicalMemory > 0 && size > physicalMemory / physicalMemoryDivisor) {
+                qDebug() << "library database is too large to be copied to memory:" << size << "bytes";
+                return false;
+            }
+            return true;
+        }
+
+        struct CopyResult
+        {
+            std::shared_ptr<sqlite3> holder;
+            qint64 elapsed;
+        };
+
+        CopyResult copyDatabase(const QString& databaseFilePath, int generation)
+        {
+            QElapsedTimer timer;
+            timer.start();
+
+            sqlite3* destination = nullptr;
+            const int destinationResult = sqlite3_open_v2(replicaUri(generation).toUtf8().constData(),
+                                                          &destination,
+                                                          SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI,
+                                                          nullptr);
+            // Handle is allocated even on error
+            std::shared_ptr<sqlite3> holder(destination, sqlite3_close);
+            if (destinationResult != SQLITE_OK) {
+                qWarning() << "failed to create in-memory database" << sqlite3_errmsg(destination);
+                return {nullptr, 0};
+            }
+
+            sqlite3* source = nullptr;
+            const int sourceResult = sqlite3_open_v2(QFile::encodeName(databaseFilePath).constData(), &source, SQLITE_OPEN_READONLY, nullptr);
+            const std::unique_ptr<sqlite3, int(*)(sqlite3*)> sourceHolder(source, sqlite3_close);
+            if (sourceResult != SQLITE_OK) {
+                qWarning() << "failed to open library database" << sqlite3_errmsg(source);
+                return {nullptr, 0};
+            }
+
+            // Source is read in one transaction, WAL mode lets library updater write meanwhile
+            sqlite3_backup* backup = sqlite3_backup_init(destination, "main", source, "main");
+            if (!backup) {
+                qWarning() << "failed to copy library database to memory" << sqlite3_errmsg(destination);
+                return {nullptr, 0};
+            }
+            const int stepResult = sqlite3_backup_step(backup, -1);
+            sqlite3_backup_finish(backup);
+            if (stepResult != SQLITE_DONE) {
+                qWarning() << "failed to copy library database to memory" << sqlite3_errstr(stepResult);
+                return {nullptr, 0};
+            }
+
+            return {std::move(holder), timer.elapsed()};
+        }
+
+        struct ThreadConnection
+        {
+            explicit ThreadConnection(const QString& connectionName, int generation)
+                : connectionName(connectionName),
+                  generation(generation)
+            {
+
+            }
+
+            ~ThreadConnection()
+            {
+                SqlQuery::clearCache(connectionName);
+                QSqlDatabase::removeDatabase(connectionName);
+            }
+
+            const QString connectionName;
+            const int generation;
+        };
+
+        QThreadStorage<ThreadConnection*> threadConnections;
+    }
+
+    LibraryReplica* LibraryReplica::instance()
+    {
+        return instancePointer;
+    }
+
+    LibraryReplica::LibraryReplica(const QString& databaseFilePath, QObject* parent)
+        : QObject(parent),
+          mDatabaseFilePath(databaseFilePath),
+          mTimer(new QTimer(this)),
+          mCopying(false),
+          mDropped(false),
+          mLastGeneration(-1)
+    {
+        instancePointer = this;
+
+        mTimer->setSingleShot(true);
+        mTimer->setInterval(copyDelay);
+        QObject::connect(mTimer, &QTimer::timeout, this, &LibraryReplica::copy);
+
+        QObject::connect(MemoryPressure::instance(), &MemoryPressure::trimRequested, this, [=](MemoryPressure::Level level) {
+            if (level == MemoryPressure::Level::Critical) {
+                drop();
+            }
+        });
+
+        mTimer->start(0);
+    }
+
+    LibraryReplica::~LibraryReplica()
+    {
+        instancePointer = nullptr;
+        currentGeneration = -1;
+    }
+
+    void LibraryReplica::invalidate()
+    {
+        ++changesCounter;
+        currentGeneration = -1;
+        if (instancePointer) {
+            QMetaObject::invokeMethod(instancePointer, "scheduleCopy", Qt::QueuedConnection);
+        }
+    }
+
+    QSqlDatabase LibraryReplica::database()
+    {
+        const int generation = currentGeneration;
+        if (threadConnections.hasLocalData()) {
+            const ThreadConnection* connection = threadConnections.localData();
+            if (connection && connection->generation == generation) {
+                return QSqlDatabase::database(connection->connectionName, false);
+            }
+            // Replica was copied again or dropped
+            threadConnections.setLocalData(nullptr);
+        }
+
+        if (generation == -1) {
+            return QSqlDatabase();
+        }
+
+        static QAtomicInt counter;
+        const QString connectionName(QString::fromLatin1("unplayer_replica_%1").arg(counter.fetchAndAddRelaxed(1)));
+        bool opened;
+        {
+            auto db = QSqlDatabase::addDatabase(LibraryUtils::databaseType, connectionName);
+            db.setDatabaseName(replicaUri(generation));
+            db.setConnectOptions(QLatin1String("QSQLITE_OPEN_URI;QSQLITE_OPEN_READONLY"));
+            opened = db.open();
+            if (!opened) {
+                qWarning() << "failed to open in-memory database" << db.lastError();
+            }
+        }
+        // Replica is released only after current generation is changed. If it is still the same,
+        // connection was opened to existing database and not to a new empty one
+        if (!opened || currentGeneration != generation) {
+            QSqlDatabase::removeDatabase(connectionName);
+            return QSqlDatabase();
+        }
+        threadConnections.setLocalData(new ThreadConnection(connectionName, generation));
+        return QSqlDatabase::database(connectionName, false);
+    }
+
+    void LibraryReplica::scheduleCopy()
+    {
+        // Replica is outdated already, memory is released when threads reconnect
+        mHolder.reset();
+        if (!mDropped) {
+            mTimer->start();
+        }
+    }
+
+    void LibraryReplica::copy()
+    {
+        if (mCopying || mDropped) {
+            return;
+        }
+        // Changes are committed in many transactions during update
+        if (LibraryUtils::instance()->isUpdating()) {
+            mTimer->start();
+            return;
+        }
+        if (!fitsInMemory(mDatabaseFilePath)) {
+            return;
+        }
+
+        mCopying = true;
+        const int changes = changesCounter;
+        const int generation = ++mLastGeneration;
+        const QString databaseFilePath(mDatabaseFilePath);
+
+        using Watcher = QFutureWatcher<CopyResult>;
+        auto watcher = new Watcher(this);
+        QObject::connect(watcher, &Watcher::finished, this, [=]() {
+            CopyResult result(watcher->result());
+            watcher->deleteLater();
+            mCopying = false;
+
+            if (!result.holder || mDropped) {
+                return;
+            }
+            if (changesCounter != changes) {
+                // Database was changed while it was being copied
+                mTimer->start();
+                return;
+            }
+            qDebug() << "library database copied to memory in" << result.elapsed << "ms";
+            currentGeneration = generation;
+            // Previous replica is released after new one becomes current
+            mHolder = std::move(result.holder);
+        });
+        watcher->setFuture(threadpools::run(threadpools::JobClass::Bulk, [databaseFilePath, generation]() {
+            return copyDatabase(databaseFilePath, generation);
+        }));
+    }
+
+    void LibraryReplica::drop()
+    {
+        if (mDropped) {
+            return;
+        }
+        qDebug() << "dropping in-memory copy of library database";
+        mDropped = true;
+        mTimer->stop();
+        currentGeneration = -1;
+        mHolder.reset();
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_LIBRARYREPLICA_H
+#define UNPLAYER_LIBRARYREPLICA_H
+
+#include <memory>
+
+#include <QObject>
+#include <QSqlDatabase>
+#include <QString>
+
+class QTimer;
+struct sqlite3;
+
+namespace unplayer
+{
+    // Copy of library database in memory, used by library models instead of database file
+    // when Settings::inMemoryLibrary() is enabled and database is small enough.
+    // Database is copied with SQLite backup API in background on startup and again
+    // after every change. Until copy is finished reads go to database file
+    class LibraryReplica final : public QObject
+    {
+        Q_OBJECT
+    public:
+        // Returns nullptr if replica is not created
+        static LibraryReplica* instance();
+
+        explicit LibraryReplica(const QString& databaseFilePath, QObject* parent);
+        ~LibraryReplica() override;
+
+        // Marks replica as outdated and starts copying database again.
+        // Must be called after changes are committed and before models are notified,
+        // can be called from any thread
+        static void invalidate();
+
+        // Read-only connection of calling thread to up to date replica,
+        // or invalid connection if there is none
+        static QSqlDatabase database();
+
+    private:
+        Q_INVOKABLE void scheduleCopy();
+        void copy();
+        // Memory is released when threads reconnect to database file
+        void drop();
+
+        const QString mDatabaseFilePath;
+        QTimer* mTimer;
+        bool mCopying;
+        bool mDropped;
+        int mLastGeneration;
+        // Keeps in-memory database alive, it is destroyed when last connection is closed
+        std::shared_ptr<sqlite3> mHolder;
+    };
+}
+
+#endif // UNPLAYER_LIBRARYREPLICA_H
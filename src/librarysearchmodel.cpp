@@ -0,0 +1,191 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "librarysearchmodel.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QRegularExpression>
+#include <QSqlQuery>
+
+#include "sqlquery.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        enum Field
+        {
+            FilePathField,
+            TitleField,
+            ArtistField,
+            AlbumField,
+            DurationField,
+            MediaArtField
+        };
+
+        // Search is used to find something quickly, don't load everything
+        const int maxResults = 500;
+
+        LibraryTrack trackFromQuery(const QSqlQuery& query)
+        {
+            const QString artist(query.value(ArtistField).toString());
+            const QString album(query.value(AlbumField).toString());
+            return {query.value(FilePathField).toString(),
+                    query.value(TitleField).toString(),
+                    artist.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : artist,
+                    album.isEmpty() ? qApp->translate("unplayer", "Unknown album") : album,
+                    query.value(DurationField).toInt(),
+                    query.value(MediaArtField).toString()};
+        }
+
+        QVariantList trackBindValues(const LibraryTrack& track)
+        {
+            return {track.filePath};
+        }
+
+        // Search index is FTS4 table if SQLite was built without FTS5
+        bool isFts5()
+        {
+            static const bool fts5 = []() {
+                SqlQuery query(QLatin1String("SELECT sql FROM sqlite_master WHERE name = 'tracks_search'"));
+                if (query.next()) {
+                    return query.value(0).toString().contains(QLatin1String("fts5"), Qt::CaseInsensitive);
+                }
+                qWarning() << "failed to get search index type";
+                return false;
+            }();
+            return fts5;
+        }
+
+        // Every word is matched as prefix of term, all words must match.
+        // Words are split the same way as by unicode61 tokenizer,
+        // so that user input can't contain query syntax
+        QString matchExpression(const QString& query, bool fts5)
+        {
+            static const QRegularExpression separators(QLatin1String("[^\\w]+"), QRegularExpression::UseUnicodePropertiesOption);
+            const QStringList words(query.split(separators, QString::SkipEmptyParts));
+
+            QStringList terms;
+            terms.reserve(words.size());
+            for (const QString& word : words) {
+                if (fts5) {
+                    terms.push_back(QString::fromLatin1("\"%1\"*").arg(word));
+                } else {
+                    // Uppercase words may be operators in FTS4
+                    terms.push_back(word.toLower() + QLatin1Char('*'));
+                }
+            }
+            return terms.join(QLatin1Char(' '));
+        }
+    }
+
+    QVariant LibrarySearchModel::data(const QModelIndex& index, int role) const
+    {
+        const LibraryTrack& track = mRows[index.row()];
+
+        switch (role) {
+        case FilePathRole:
+            return track.filePath;
+        case TitleRole:
+            return track.title;
+        case ArtistRole:
+            return track.artist;
+        case AlbumRole:
+            return track.album;
+        case DurationRole:
+            return track.duration;
+        default:
+            return QVariant();
+        }
+    }
+
+    const QString& LibrarySearchModel::query() const
+    {
+        return mQuery;
+    }
+
+    void LibrarySearchModel::setQuery(const QString& query)
+    {
+        if (query != mQuery) {
+            mQuery = query;
+            emit queryChanged();
+            execQuery();
+        }
+    }
+
+    TrackList LibrarySearchModel::getTracks(const std::vector<int>& indexes)
+    {
+        std::vector<LibraryTrack> tracks;
+        tracks.reserve(indexes.size());
+        for (int index : indexes) {
+            tracks.push_back(mRows[index]);
+        }
+        return TrackList(std::move(tracks));
+    }
+
+    LibraryTrack LibrarySearchModel::getTrack(int index)
+    {
+        return mRows[index];
+    }
+
+    void LibrarySearchModel::removeTrack(int index, bool deleteFile)
+    {
+        removeTracks({index}, deleteFile);
+    }
+
+    void LibrarySearchModel::removeTracks(const std::vector<int>& indexes, bool deleteFiles)
+    {
+        removeRows(indexes,
+                   deleteFiles,
+                   QLatin1String("SELECT tracks.id FROM query_keys "
+                                 "JOIN tracks ON tracks.filePath = query_keys.key0"),
+                   trackBindValues);
+    }
+
+    QHash<int, QByteArray> LibrarySearchModel::roleNames() const
+    {
+        return {{FilePathRole, "filePath"},
+                {TitleRole, "title"},
+                {ArtistRole, "artist"},
+                {AlbumRole, "album"},
+                {DurationRole, "duration"}};
+    }
+
+    void LibrarySearchModel::execQuery()
+    {
+        const bool fts5 = isFts5();
+        const QString match(matchExpression(mQuery, fts5));
+        if (match.isEmpty()) {
+            // Empty query string matches nothing
+            AsyncQueryModel::execQuery(QLatin1String("SELECT NULL LIMIT 0"), QVariantList(), trackFromQuery);
+            return;
+        }
+
+        // FTS4 doesn't have built-in ranking
+        AsyncQueryModel::execQuery(QString::fromLatin1("SELECT filePath, tracks_search.title, tracks_search.artist, tracks_search.album, duration, mediaArt FROM tracks_search "
+                                                       "JOIN tracks ON tracks.id = tracks_search.rowid "
+                                                       "WHERE tracks_search MATCH ? "
+                                                       "ORDER BY %1 "
+                                                       "LIMIT %2").arg(fts5 ? QLatin1String("rank") : QLatin1String("tracks_search.title"))
+                                                                  .arg(maxResults),
+                                   {match},
+                                   trackFromQuery);
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_LIBRARYSEARCHMODEL_H
+#define UNPLAYER_LIBRARYSEARCHMODEL_H
+
+#include <vector>
+
+#include "asyncquerymodel.h"
+#include "librarytrack.h"
+#include "tracklist.h"
+
+namespace unplayer
+{
+    // Searches titles, artists and albums of all tracks in the library
+    // using full-text search index. Words of query are matched as prefixes,
+    // best matches are first
+    class LibrarySearchModel : public AsyncQueryModel<LibraryTrack>
+    {
+        Q_OBJECT
+        Q_PROPERTY(QString query READ query WRITE setQuery NOTIFY queryChanged)
+    public:
+        enum Role
+        {
+            FilePathRole = Qt::UserRole,
+            TitleRole,
+            ArtistRole,
+            AlbumRole,
+            DurationRole
+        };
+        Q_ENUM(Role)
+
+        QVariant data(const QModelIndex& index, int role) const override;
+
+        const QString& query() const;
+        void setQuery(const QString& query);
+
+        Q_INVOKABLE unplayer::TrackList getTracks(const std::vector<int>& indexes);
+        Q_INVOKABLE unplayer::LibraryTrack getTrack(int index);
+
+        Q_INVOKABLE void removeTrack(int index, bool deleteFile);
+        Q_INVOKABLE void removeTracks(const std::vector<int>& indexes, bool deleteFiles);
+
+    protected:
+        QHash<int, QByteArray> roleNames() const override;
+
+    private:
+        void execQuery();
+
+        QString mQuery;
+    signals:
+        void queryChanged();
+    };
+}
+
+#endif // UNPLAYER_LIBRARYSEARCHMODEL_H
@@ -0,0 +1,132 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "libraryservice.h"
+
+#include <QDBusConnection>
+#include <QDBusConnectionInterface>
+#include <QDBusError>
+#include <QDBusReply>
+#include <QDebug>
+
+#include "librarychanges.h"
+#include "libraryutils.h"
+#include "settings.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        QStringList toStringList(const std::unordered_set<QString>& strings)
+        {
+            QStringList list;
+            list.reserve(static_cast<int>(strings.size()));
+            for (const QString& string : strings) {
+                list.push_back(string);
+            }
+            return list;
+        }
+    }
+
+    const QLatin1String LibraryService::serviceName("org.equeim.unplayer.Library");
+    const QLatin1String LibraryService::objectPath("/org/equeim/unplayer/library");
+    const QLatin1String LibraryService::interfaceName("org.equeim.unplayer.Library");
+
+    bool LibraryService::isAvailable()
+    {
+        QDBusConnectionInterface* interface = QDBusConnection::sessionBus().interface();
+        if (!interface) {
+            return false;
+        }
+        if (interface->isServiceRegistered(serviceName)) {
+            return true;
+        }
+        const QDBusReply<QStringList> activatable(interface->call(QLatin1String("ListActivatableNames")));
+        return activatable.isValid() && activatable.value().contains(serviceName);
+    }
+
+    LibraryService::LibraryService(QObject* parent)
+        : QObject(parent)
+    {
+        LibraryUtils* library = LibraryUtils::instance();
+        QObject::connect(library, &LibraryUtils::updatingChanged, this, [=]() {
+            emit updatingChanged(library->isUpdating());
+        });
+        QObject::connect(library, &LibraryUtils::scanProgressChanged, this, [=]() {
+            emit scanProgress(library->scanDiscoveredFiles(),
+                              library->scanProcessedFiles(),
+                              library->scanSkippedFiles(),
+                              library->scanDirectory());
+        });
+        QObject::connect(library, &LibraryUtils::libraryUpdateCommitted, this, &LibraryService::committed);
+        QObject::connect(library, &LibraryUtils::libraryChanged, this, &LibraryService::onLibraryChanged);
+    }
+
+    bool LibraryService::registerService()
+    {
+        QDBusConnection connection(QDBusConnection::sessionBus());
+        if (!connection.registerObject(objectPath, this, QDBusConnection::ExportAllSlots | QDBusConnection::ExportAllSignals)) {
+            qWarning() << "failed to register library D-Bus object" << connection.lastError();
+            return false;
+        }
+        if (!connection.registerService(serviceName)) {
+            qWarning() << "failed to register library D-Bus service" << connection.lastError();
+            return false;
+        }
+        return true;
+    }
+
+    bool LibraryService::isUpdating() const
+    {
+        return LibraryUtils::instance()->isUpdating();
+    }
+
+    void LibraryService::updateLibrary()
+    {
+        LibraryUtils::instance()->updateDatabase();
+    }
+
+    void LibraryService::importLibrary(const QString& directory, const QString& volumeRoot)
+    {
+        LibraryUtils::instance()->importLibrary(directory, volumeRoot);
+    }
+
+    void LibraryService::cancelUpdate()
+    {
+        LibraryUtils::instance()->cancelUpdate();
+    }
+
+    void LibraryService::prioritizeDirectory(const QString& directory)
+    {
+        LibraryUtils::instance()->prioritizeDirectory(directory);
+    }
+
+    void LibraryService::reloadSettings()
+    {
+        Settings::instance()->reloadLibrarySettings();
+    }
+
+    void LibraryService::onLibraryChanged(const LibraryChanges& changes)
+    {
+        emit libraryChanged(toStringList(changes.artists),
+                            toStringList(changes.albums),
+                            toStringList(changes.genres),
+                            changes.all);
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_LIBRARYSERVICE_H
+#define UNPLAYER_LIBRARYSERVICE_H
+
+#include <QObject>
+#include <QStringList>
+
+namespace unplayer
+{
+    struct LibraryChanges;
+
+    // org.equeim.unplayer.Library interface on /org/equeim/unplayer/library, exported by
+    // 'harbour-unplayer --library-service' which is started by systemd. Service owns library
+    // updates: it watches library directories while the app is closed, and the app
+    // forwards update requests to it and reloads library when it reports commits
+    class LibraryService final : public QObject
+    {
+        Q_OBJECT
+        Q_CLASSINFO("D-Bus Interface", "org.equeim.unplayer.Library")
+    public:
+        static const QLatin1String serviceName;
+        static const QLatin1String objectPath;
+        static const QLatin1String interfaceName;
+
+        // Returns true if service is running or can be activated over D-Bus
+        static bool isAvailable();
+
+        explicit LibraryService(QObject* parent);
+
+        // Registers object and service name, returns false if another instance is running
+        bool registerService();
+
+    public slots:
+        bool isUpdating() const;
+        void updateLibrary();
+        void importLibrary(const QString& directory, const QString& volumeRoot);
+        void cancelUpdate();
+        void prioritizeDirectory(const QString& directory);
+        // Called by the app after it has changed settings, before update is requested
+        void reloadSettings();
+
+    private:
+        void onLibraryChanged(const LibraryChanges& changes);
+
+    signals:
+        void updatingChanged(bool updating);
+        void scanProgress(int discoveredFiles, int processedFiles, int skippedFiles, const QString& directory);
+        // Library update has committed part of changes or has finished
+        void committed();
+        // Changed artists, albums and genres, see LibraryChanges
+        void libraryChanged(const QStringList& artists, const QStringList& albums, const QStringList& genres, bool all);
+    };
+}
+
+#endif // UNPLAYER_LIBRARYSERVICE_H
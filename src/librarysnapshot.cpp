@@ -0,0 +1,237 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "librarysnapshot.h"
+
+#include <functional>
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "libraryindex.h"
+#include "libraryutils.h"
+#include "settings.h"
+#include "threadpools.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        const quint32 snapshotMagic = 0x554e4c53; // "UNLS"
+        const quint32 snapshotVersion = 2;
+        // Enough to fill first screen of page
+        const int snapshotRowsCount = 30;
+
+        QString snapshotFilePath()
+        {
+            return QString::fromLatin1("%1/library-snapshot").arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+        }
+
+        QDataStream& operator<<(QDataStream& stream, const Artist& artist)
+        {
+            return stream << artist.artist
+                          << artist.displayedArtist
+                          << static_cast<qint32>(artist.albumsCount)
+                          << static_cast<qint32>(artist.tracksCount)
+                          << static_cast<qint32>(artist.duration)
+                          << artist.mediaArt
+                          << artist.mediaArtPlaceholder
+                          << artist.sortKey;
+        }
+
+        QDataStream& operator>>(QDataStream& stream, Artist& artist)
+        {
+            qint32 albumsCount;
+            qint32 tracksCount;
+            qint32 duration;
+            stream >> artist.artist >> artist.displayedArtist >> albumsCount >> tracksCount >> duration
+                   >> artist.mediaArt >> artist.mediaArtPlaceholder >> artist.sortKey;
+            artist.albumsCount = albumsCount;
+            artist.tracksCount = tracksCount;
+            artist.duration = duration;
+            return stream;
+        }
+
+        QDataStream& operator<<(QDataStream& stream, const Album& album)
+        {
+            return stream << album.artist
+                          << album.displayedArtist
+                          << album.album
+                          << album.displayedAlbum
+                          << static_cast<qint32>(album.year)
+                          << static_cast<qint32>(album.tracksCount)
+                          << static_cast<qint32>(album.duration)
+                          << album.mediaArt
+                          << album.mediaArtPlaceholder
+                          << album.artistSortKey
+                          << album.albumSortKey
+                          << static_cast<qint32>(album.yearSortKey);
+        }
+
+        QDataStream& operator>>(QDataStream& stream, Album& album)
+        {
+            qint32 year;
+            qint32 tracksCount;
+            qint32 duration;
+            qint32 yearSortKey;
+            stream >> album.artist >> album.displayedArtist >> album.album >> album.displayedAlbum
+                   >> year >> tracksCount >> duration >> album.mediaArt >> album.mediaArtPlaceholder
+                   >> album.artistSortKey >> album.albumSortKey >> yearSortKey;
+            album.year = year;
+            album.tracksCount = tracksCount;
+            album.duration = duration;
+            album.yearSortKey = yearSortKey;
+            return stream;
+        }
+
+        template<typename Row>
+        void writeRows(QDataStream& stream, const std::vector<Row>& rows)
+        {
+            stream << static_cast<qint32>(rows.size());
+            for (const Row& row : rows) {
+                stream << row;
+            }
+        }
+
+        template<typename Row>
+        bool readRows(QDataStream& stream, std::vector<Row>& rows)
+        {
+            qint32 count;
+            stream >> count;
+            if (stream.status() != QDataStream::Ok || count < 0 || count > snapshotRowsCount) {
+                return false;
+            }
+            rows.resize(count);
+            for (Row& row : rows) {
+                stream >> row;
+            }
+            return stream.status() == QDataStream::Ok;
+        }
+    }
+
+    const LibrarySnapshot& LibrarySnapshot::instance()
+    {
+        static const LibrarySnapshot snapshot([]() {
+            LibrarySnapshot snapshot;
+
+            QFile file(snapshotFilePath());
+            if (!file.open(QIODevice::ReadOnly)) {
+                return snapshot;
+            }
+
+            QDataStream stream(&file);
+            stream.setVersion(QDataStream::Qt_5_6);
+            quint32 magic;
+            quint32 version;
+            qint32 artistsCount;
+            qint32 albumsCount;
+            qint32 tracksCount;
+            qint32 tracksDuration;
+            qint32 albumsSortMode;
+            stream >> magic >> version;
+            if (stream.status() != QDataStream::Ok || magic != snapshotMagic || version != snapshotVersion) {
+                qWarning() << "library snapshot is invalid";
+                return snapshot;
+            }
+            stream >> artistsCount >> albumsCount >> tracksCount >> tracksDuration >> snapshot.mediaArt
+                   >> snapshot.artistsSortDescending
+                   >> albumsSortMode >> snapshot.albumsSortDescending;
+            if (stream.status() != QDataStream::Ok ||
+                    !readRows(stream, snapshot.artists) ||
+                    !readRows(stream, snapshot.albums)) {
+                qWarning() << "failed to read library snapshot";
+                return LibrarySnapshot();
+            }
+
+            snapshot.isLoaded = true;
+            snapshot.artistsCount = artistsCount;
+            snapshot.albumsCount = albumsCount;
+            snapshot.tracksCount = tracksCount;
+            snapshot.tracksDuration = tracksDuration;
+            snapshot.albumsSortMode = albumsSortMode;
+            return snapshot;
+        }());
+        return snapshot;
+    }
+
+    void LibrarySnapshot::save()
+    {
+        LibraryUtils* libraryUtils = LibraryUtils::instance();
+        if (!libraryUtils->isDatabaseInitialized()) {
+            return;
+        }
+
+        LibrarySnapshot snapshot;
+        snapshot.artistsCount = libraryUtils->artistsCount();
+        snapshot.albumsCount = libraryUtils->albumsCount();
+        snapshot.tracksCount = libraryUtils->tracksCount();
+        snapshot.tracksDuration = libraryUtils->tracksDuration();
+        snapshot.mediaArt = libraryUtils->randomMediaArt();
+        snapshot.artistsSortDescending = Settings::instance()->artistsSortDescending();
+        snapshot.albumsSortMode = Settings::instance()->allAlbumsSortMode(AlbumsModel::SortArtistYear);
+        snapshot.albumsSortDescending = Settings::instance()->allAlbumsSortDescending();
+
+        // FIXME: use init capture when moving to C++14
+        threadpools::run(threadpools::JobClass::Bulk, std::bind([](LibrarySnapshot& snapshot) {
+            const QSqlDatabase db(LibraryUtils::threadDatabase());
+            if (!db.isOpen()) {
+                return;
+            }
+            LibraryIndex::write(db);
+
+            snapshot.artists = ArtistsModel::queryFirstRows(db, snapshot.artistsSortDescending, snapshotRowsCount);
+            snapshot.albums = AlbumsModel::queryFirstRows(db,
+                                                          static_cast<AlbumsModel::SortMode>(snapshot.albumsSortMode),
+                                                          snapshot.albumsSortDescending,
+                                                          snapshotRowsCount);
+
+            const QString filePath(snapshotFilePath());
+            if (!QDir().mkpath(QFileInfo(filePath).path())) {
+                qWarning() << "failed to create directory for library snapshot";
+                return;
+            }
+            QSaveFile file(filePath);
+            if (!file.open(QIODevice::WriteOnly)) {
+                qWarning() << "failed to open library snapshot file" << file.errorString();
+                return;
+            }
+            QDataStream stream(&file);
+            stream.setVersion(QDataStream::Qt_5_6);
+            stream << snapshotMagic << snapshotVersion
+                   << static_cast<qint32>(snapshot.artistsCount)
+                   << static_cast<qint32>(snapshot.albumsCount)
+                   << static_cast<qint32>(snapshot.tracksCount)
+                   << static_cast<qint32>(snapshot.tracksDuration)
+                   << snapshot.mediaArt
+                   << snapshot.artistsSortDescending
+                   << static_cast<qint32>(snapshot.albumsSortMode)
+                   << snapshot.albumsSortDescending;
+            writeRows(stream, snapshot.artists);
+            writeRows(stream, snapshot.albums);
+            if (!file.commit()) {
+                qWarning() << "failed to save library snapshot" << file.errorString();
+            }
+        }, std::move(snapshot)));
+    }
+}
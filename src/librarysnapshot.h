@@ -0,0 +1,63 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_LIBRARYSNAPSHOT_H
+#define UNPLAYER_LIBRARYSNAPSHOT_H
+
+#include <vector>
+
+#include <QString>
+
+#include "albumsmodel.h"
+#include "artistsmodel.h"
+
+namespace unplayer
+{
+    // Library statistics and first rows of artists and all albums, saved
+    // after library is updated. On startup they are shown until database is opened
+    class LibrarySnapshot final
+    {
+    public:
+        // Snapshot saved on previous run, loaded on first call
+        static const LibrarySnapshot& instance();
+
+        // Saves current statistics and queries rows on worker thread
+        static void save();
+
+        bool isLoaded = false;
+
+        int artistsCount = 0;
+        int albumsCount = 0;
+        int tracksCount = 0;
+        int tracksDuration = 0;
+        QString mediaArt;
+
+        // Rows are used only if sort settings haven't changed
+        bool artistsSortDescending = false;
+        std::vector<Artist> artists;
+        int albumsSortMode = -1;
+        bool albumsSortDescending = false;
+        std::vector<Album> albums;
+
+    private:
+        LibrarySnapshot() = default;
+    };
+}
+
+#endif // UNPLAYER_LIBRARYSNAPSHOT_H
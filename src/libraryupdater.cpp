@@ -0,0 +1,2964 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libraryupdater.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <unordered_set>
+#include <vector>
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QImage>
+#include <QImageReader>
+#include <QMetaObject>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QStorageInfo>
+#include <QThread>
+#include <QThreadPool>
+#include <QTime>
+#include <QVariant>
+#include <QWaitCondition>
+#include <QtConcurrentRun>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+#include "directorymediaartcache.h"
+#include "fileutils.h"
+#include "librarychanges.h"
+#include "librarymigrations.h"
+#include "libraryutils.h"
+#include "perfcounters.h"
+#include "scanthrottle.h"
+#include "settings.h"
+#include "sqlitestatement.h"
+#include "sqlquery.h"
+#include "stdutils.h"
+#include "tagutils.h"
+#include "threadpools.h"
+#include "thumbnailatlas.h"
+#include "tracing.h"
+#include "utils.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        // Number of leading bytes of embedded media art that are compared first
+        const int fingerprintSize = 4096;
+        const std::size_t maxRecentMediaArtCount = 4;
+
+        // Written tracks are committed in batches so that they appear in the library
+        // while update is still running, and are kept if it is interrupted
+        const int commitBatchSize = 2000;
+        const qint64 commitInterval = 5000;
+
+        // MurmurHash64A by Austin Appleby (public domain)
+        quint64 murmurHash64(const char* data, int size)
+        {
+            const quint64 m = 0xc6a4a7935bd1e995ULL;
+            const int r = 47;
+
+            quint64 h = 0x8445d61a4e774912ULL ^ (static_cast<quint64>(size) * m);
+
+            const char* const end = data + (size / 8) * 8;
+            for (; data != end; data += 8) {
+                quint64 k;
+                std::memcpy(&k, data, sizeof(k));
+                k *= m;
+                k ^= k >> r;
+                k *= m;
+                h ^= k;
+                h *= m;
+            }
+
+            const auto tail = reinterpret_cast<const uchar*>(data);
+            switch (size & 7) {
+            case 7:
+                h ^= static_cast<quint64>(tail[6]) << 48;
+                // fall through
+            case 6:
+                h ^= static_cast<quint64>(tail[5]) << 40;
+                // fall through
+            case 5:
+                h ^= static_cast<quint64>(tail[4]) << 32;
+                // fall through
+            case 4:
+                h ^= static_cast<quint64>(tail[3]) << 24;
+                // fall through
+            case 3:
+                h ^= static_cast<quint64>(tail[2]) << 16;
+                // fall through
+            case 2:
+                h ^= static_cast<quint64>(tail[1]) << 8;
+                // fall through
+            case 1:
+                h ^= static_cast<quint64>(tail[0]);
+                h *= m;
+            }
+
+            h ^= h >> r;
+            h *= m;
+            h ^= h >> r;
+            return h;
+        }
+
+        // How many files can wait for writer per worker thread
+        const int pendingFilesPerThread = 16;
+
+        // Reading of files on network file systems mostly waits for round trips,
+        // so more of them are read concurrently than there are CPU cores
+        const int networkReaderThreadsCount = 8;
+
+        // Parsing of file is stopped when it takes longer or reads more, and file is quarantined
+        const qint64 maxFileReadTime = 10000;
+        const qint64 maxFileReadBytes = 64 * 1024 * 1024;
+
+        // How many files are stat'ed by one job when checking media art
+        const std::size_t existenceCheckBatchSize = 64;
+
+        // How many listed directories can wait for scanning thread
+        const std::size_t maxQueuedListings = 64;
+        const std::size_t maxHotDirectories = 8;
+
+        QString emptyIfNull(const QString& string)
+        {
+            if (string.isNull()) {
+                return QLatin1String("");
+            }
+            return string;
+        }
+
+        // SQLite limit of bound parameters in one statement
+        const int maxParametersCount = 999;
+
+        // Inserts rows with statement on SQLite handle, so that values of every file
+        // don't go through QVariant and Qt SQL driver
+        class RowInserter
+        {
+        public:
+            explicit RowInserter(const QSqlDatabase& db, const QString& table, const QStringList& columns)
+                : mStatement(db, QString::fromLatin1("INSERT OR IGNORE INTO %1 (%2) VALUES (?%3)")
+                                 .arg(table, columns.join(QLatin1String(", ")), QString(QLatin1String(", ?")).repeated(columns.size() - 1)))
+            {
+            }
+
+            template<typename... Values>
+            void addRow(const Values&... values)
+            {
+                bind(0, values...);
+                if (!mStatement.exec()) {
+                    qWarning() << "failed to insert row" << mStatement.lastError();
+                }
+            }
+
+        private:
+            void bind(int) {}
+
+            template<typename Value, typename... Values>
+            void bind(int index, const Value& value, const Values&... values)
+            {
+                mStatement.bind(index, value);
+                bind(index + 1, values...);
+            }
+
+            SqliteStatement mStatement;
+        };
+
+        // Writes tracks to the database.
+        // Statements are prepared once on SQLite handle of connection
+        class TracksWriter
+        {
+        public:
+            explicit TracksWriter(const QSqlDatabase& db)
+                : mDb(db),
+                  mInsertTracks(db, QLatin1String("tracks"), {QLatin1String("id"),
+                                                              QLatin1String("filePath"),
+                                                              QLatin1String("modificationTime"),
+                                                              QLatin1String("fileSize"),
+                                                              QLatin1String("title"),
+                                                              QLatin1String("year"),
+                                                              QLatin1String("trackNumber"),
+                                                              QLatin1String("discNumber"),
+                                                              QLatin1String("duration"),
+                                                              QLatin1String("durationEstimated"),
+                                                              QLatin1String("bitrate"),
+                                                              QLatin1String("sampleRate"),
+                                                              QLatin1String("channels"),
+                                                              QLatin1String("replayGainTrack"),
+                                                              QLatin1String("replayGainAlbum"),
+                                                              QLatin1String("replayGainTrackPeak"),
+                                                              QLatin1String("replayGainAlbumPeak"),
+                                                              QLatin1String("mediaArt"),
+                                                              QLatin1String("embeddedMediaArtHash"),
+                                                              QLatin1String("titleSortKey"),
+                                                              QLatin1String("discNumberSortKey"),
+                                                              QLatin1String("displayArtist"),
+                                                              QLatin1String("displayAlbum"),
+                                                              QLatin1String("addedTime")}),
+                  mInsertSearch(db, QLatin1String("tracks_search"), {QLatin1String("rowid"),
+                                                                     QLatin1String("title"),
+                                                                     QLatin1String("artist"),
+                                                                     QLatin1String("album")}),
+                  mUpdateTrackQuery(db, QStringLiteral("UPDATE tracks SET filePath = ?, modificationTime = ?, fileSize = ?, title = ?, year = ?, "
+                                                       "trackNumber = ?, discNumber = ?, duration = ?, durationEstimated = ?, bitrate = ?, "
+                                                       "sampleRate = ?, channels = ?, replayGainTrack = ?, replayGainAlbum = ?, "
+                                                       "replayGainTrackPeak = ?, replayGainAlbumPeak = ?, mediaArt = ?, "
+                                                       "embeddedMediaArtHash = ?, titleSortKey = ?, discNumberSortKey = ?, displayArtist = ?, "
+                                                       "displayAlbum = ?, mediaArtThumbnail = NULL WHERE id = ?")),
+                  mUpdateMediaArtQuery(db, QStringLiteral("UPDATE tracks SET mediaArt = ?, embeddedMediaArtHash = ?, mediaArtThumbnail = NULL WHERE id = ?")),
+                  mMoveTrackQuery(db, QStringLiteral("UPDATE tracks SET filePath = ? WHERE id = ?")),
+                  mUpdateFileSizeQuery(db, QStringLiteral("UPDATE tracks SET fileSize = ? WHERE id = ?")),
+                  mDeleteSearchQuery(db, QStringLiteral("DELETE FROM tracks_search WHERE rowid = ?")),
+                  mArtists(db, QLatin1String("artists"), QLatin1String("tracks_artists"), QLatin1String("artistId"), true),
+                  mAlbums(db, QLatin1String("albums"), QLatin1String("tracks_albums"), QLatin1String("albumId"), true),
+                  mGenres(db, QLatin1String("genres"), QLatin1String("tracks_genres"), QLatin1String("genreId"), false),
+                  mUncommittedCount(0)
+            {
+                mCommitTimer.start();
+            }
+
+            void updateTrackInDatabase(bool inDb,
+                                       int id,
+                                       const QFileInfo& fileInfo,
+                                       long long modificationTime,
+                                       qint64 fileSize,
+                                       const tagutils::Info& info,
+                                       const QString& mediaArt,
+                                       const QString& embeddedMediaArtHash)
+            {
+                const QString displayArtist(LibraryUtils::displayString(info.artists));
+                const QString displayAlbum(LibraryUtils::displayString(info.albums));
+
+                if (inDb) {
+                    // Previous artists, albums and genres of track
+                    mChanges.merge(LibraryChanges::forTracks(mDb, QString::number(id)));
+
+                    mUpdateTrackQuery.bind(0, fileInfo.filePath());
+                    mUpdateTrackQuery.bind(1, modificationTime);
+                    mUpdateTrackQuery.bind(2, static_cast<long long>(fileSize));
+                    mUpdateTrackQuery.bind(3, emptyIfNull(info.title));
+                    mUpdateTrackQuery.bind(4, info.year);
+                    mUpdateTrackQuery.bind(5, info.trackNumber);
+                    mUpdateTrackQuery.bind(6, emptyIfNull(info.discNumber));
+                    mUpdateTrackQuery.bind(7, info.duration);
+                    mUpdateTrackQuery.bind(8, info.durationEstimated);
+                    mUpdateTrackQuery.bind(9, info.bitrate);
+                    mUpdateTrackQuery.bind(10, info.sampleRate);
+                    mUpdateTrackQuery.bind(11, info.channels);
+                    mUpdateTrackQuery.bind(12, info.replayGainTrack);
+                    mUpdateTrackQuery.bind(13, info.replayGainAlbum);
+                    mUpdateTrackQuery.bind(14, info.replayGainTrackPeak);
+                    mUpdateTrackQuery.bind(15, info.replayGainAlbumPeak);
+                    mUpdateTrackQuery.bind(16, emptyIfNull(mediaArt));
+                    // Null if embedded media art was not read
+                    mUpdateTrackQuery.bind(17, embeddedMediaArtHash);
+                    mUpdateTrackQuery.bind(18, LibraryUtils::sortKey(info.title));
+                    mUpdateTrackQuery.bind(19, LibraryUtils::sortKey(info.discNumber));
+                    mUpdateTrackQuery.bind(20, displayArtist);
+                    mUpdateTrackQuery.bind(21, displayAlbum);
+                    mUpdateTrackQuery.bind(22, id);
+                    if (!mUpdateTrackQuery.exec()) {
+                        qWarning() << "failed to update track in the database" << mUpdateTrackQuery.lastError();
+                        return;
+                    }
+
+                    mArtists.unlink(id);
+                    mAlbums.unlink(id);
+                    mGenres.unlink(id);
+
+                    mDeleteSearchQuery.bind(0, id);
+                    if (!mDeleteSearchQuery.exec()) {
+                        qWarning() << "failed to remove track from search index" << mDeleteSearchQuery.lastError();
+                    }
+                } else {
+                    mInsertTracks.addRow(id,
+                                         fileInfo.filePath(),
+                                         modificationTime,
+                                         static_cast<long long>(fileSize),
+                                         emptyIfNull(info.title),
+                                         info.year,
+                                         info.trackNumber,
+                                         emptyIfNull(info.discNumber),
+                                         info.duration,
+                                         info.durationEstimated,
+                                         info.bitrate,
+                                         info.sampleRate,
+                                         info.channels,
+                                         info.replayGainTrack,
+                                         info.replayGainAlbum,
+                                         info.replayGainTrackPeak,
+                                         info.replayGainAlbumPeak,
+                                         emptyIfNull(mediaArt),
+                                         embeddedMediaArtHash,
+                                         LibraryUtils::sortKey(info.title),
+                                         LibraryUtils::sortKey(info.discNumber),
+                                         displayArtist,
+                                         displayAlbum,
+                                         QDateTime::currentMSecsSinceEpoch());
+                }
+
+                mArtists.link(id, info.artists);
+                mAlbums.link(id, info.albums);
+                mGenres.link(id, info.genres);
+                mChanges.addTrack(info.artists, info.albums, info.genres);
+
+                mInsertSearch.addRow(id,
+                                     emptyIfNull(info.title),
+                                     displayArtist,
+                                     displayAlbum);
+
+                ++mUncommittedCount;
+            }
+
+            void updateMediaArt(int id, const QString& mediaArt, const QString& embeddedMediaArtHash)
+            {
+                mUpdateMediaArtQuery.bind(0, emptyIfNull(mediaArt));
+                mUpdateMediaArtQuery.bind(1, embeddedMediaArtHash);
+                mUpdateMediaArtQuery.bind(2, id);
+                if (!mUpdateMediaArtQuery.exec()) {
+                    qWarning() << "failed to update media art" << mUpdateMediaArtQuery.lastError();
+                    return;
+                }
+                mChanges.merge(LibraryChanges::forTracks(mDb, QString::number(id)));
+                ++mUncommittedCount;
+            }
+
+            // Changes path of track which file was moved or renamed, tags are not read again
+            void moveTrack(int id, const QString& filePath)
+            {
+                mMoveTrackQuery.bind(0, filePath);
+                mMoveTrackQuery.bind(1, id);
+                if (!mMoveTrackQuery.exec()) {
+                    qWarning() << "failed to update path of moved track" << mMoveTrackQuery.lastError();
+                    return;
+                }
+                mChanges.merge(LibraryChanges::forTracks(mDb, QString::number(id)));
+                ++mUncommittedCount;
+            }
+
+            // Sets size of unchanged file of track that was added by older version
+            void updateFileSize(int id, qint64 fileSize)
+            {
+                mUpdateFileSizeQuery.bind(0, static_cast<long long>(fileSize));
+                mUpdateFileSizeQuery.bind(1, id);
+                if (!mUpdateFileSizeQuery.exec()) {
+                    qWarning() << "failed to update file size" << mUpdateFileSizeQuery.lastError();
+                    return;
+                }
+                ++mUncommittedCount;
+            }
+
+            void removeTracks(const std::vector<int>& ids)
+            {
+                if (ids.empty()) {
+                    return;
+                }
+                qDebug() << "removing" << ids.size() << "tracks from database";
+                QString idsString(QString::number(ids.front()));
+                for (std::size_t i = 1, max = ids.size(); i < max; ++i) {
+                    idsString.push_back(QLatin1Char(','));
+                    idsString.push_back(QString::number(ids[i]));
+                }
+                mChanges.merge(LibraryChanges::forTracks(mDb, idsString));
+                SqlQuery query(QString::fromLatin1("DELETE FROM tracks WHERE id IN (%1)").arg(idsString), mDb);
+                if (query.lastError().type() != QSqlError::NoError) {
+                    qWarning() << "failed to remove files from database" << query.lastError();
+                }
+            }
+
+            // Sends changes committed since last call to models
+            void notifyChanges()
+            {
+                LibraryUtils::notifyLibraryChanged(mChanges);
+                mChanges = LibraryChanges();
+            }
+
+            // True when batch of written tracks is full or enough time has passed
+            bool isCommitNeeded() const
+            {
+                return mUncommittedCount > 0 &&
+                       (mUncommittedCount >= commitBatchSize || mCommitTimer.elapsed() >= commitInterval);
+            }
+
+            // Commits written tracks and starts new transaction.
+            // Unused artists, albums and genres are removed only at the end of update
+            void commit()
+            {
+                LibraryUtils::updateSummaries(mDb);
+                QSqlDatabase db(mDb);
+                if (!db.commit()) {
+                    qWarning() << "failed to commit transaction" << db.lastError();
+                }
+                db.transaction();
+
+                mUncommittedCount = 0;
+                mCommitTimer.restart();
+                if (qApp) {
+                    QMetaObject::invokeMethod(LibraryUtils::instance(), "libraryUpdateCommitted", Qt::QueuedConnection);
+                }
+                notifyChanges();
+            }
+
+            // Removes artists, albums and genres that don't have tracks
+            void removeUnusedEntries()
+            {
+                for (Dictionary* dictionary : {&mArtists, &mAlbums, &mGenres}) {
+                    SqlQuery query(mDb);
+                    if (!query.exec(QString::fromLatin1("DELETE FROM %1 WHERE id NOT IN (SELECT %2 FROM %3)")
+                                    .arg(dictionary->table, dictionary->idColumn, dictionary->linkTable))) {
+                        qWarning() << "failed to remove unused entries from" << dictionary->table << query.lastError();
+                    }
+                    dictionary->ids.clear();
+                }
+            }
+
+        private:
+            struct Dictionary
+            {
+                Dictionary(const QSqlDatabase& db, const QString& table, const QString& linkTable, const QString& idColumn, bool hasSortKey)
+                    : table(table),
+                      linkTable(linkTable),
+                      idColumn(idColumn),
+                      hasSortKey(hasSortKey),
+                      links(db, linkTable, {QLatin1String("trackId"), idColumn}),
+                      insertQuery(db, hasSortKey ? QString::fromLatin1("INSERT OR IGNORE INTO %1 (title, sortKey) VALUES (?, ?)").arg(table)
+                                                 : QString::fromLatin1("INSERT OR IGNORE INTO %1 (title) VALUES (?)").arg(table)),
+                      selectQuery(db, QString::fromLatin1("SELECT id FROM %1 WHERE title = ?").arg(table)),
+                      unlinkQuery(db, QString::fromLatin1("DELETE FROM %1 WHERE trackId = ?").arg(linkTable))
+                {
+                }
+
+                int entryId(const QString& title)
+                {
+                    {
+                        const auto found(ids.find(title));
+                        if (found != ids.end()) {
+                            return found->second;
+                        }
+                    }
+
+                    int id = -1;
+                    insertQuery.bind(0, title);
+                    if (hasSortKey) {
+                        insertQuery.bind(1, LibraryUtils::sortKey(title));
+                    }
+                    if (!insertQuery.exec()) {
+                        qWarning() << "failed to insert in" << table << insertQuery.lastError();
+                        return -1;
+                    }
+                    if (insertQuery.changes() > 0) {
+                        id = static_cast<int>(insertQuery.lastInsertId());
+                    } else {
+                        // Already exists, possibly with different case
+                        selectQuery.bind(0, title);
+                        if (!selectQuery.next()) {
+                            qWarning() << "failed to get id from" << table << selectQuery.lastError();
+                            return -1;
+                        }
+                        id = selectQuery.intValue(0);
+                        selectQuery.reset();
+                    }
+
+                    ids.insert({title, id});
+                    return id;
+                }
+
+                void link(int trackId, const QStringList& titles)
+                {
+                    const auto linkOne = [&](const QString& title) {
+                        const int id = entryId(title);
+                        if (id != -1) {
+                            links.addRow(trackId, id);
+                        }
+                    };
+
+                    if (titles.isEmpty()) {
+                        linkOne(emptyIfNull(QString()));
+                    } else {
+                        for (const QString& title : titles) {
+                            linkOne(emptyIfNull(title));
+                        }
+                    }
+                }
+
+                void unlink(int trackId)
+                {
+                    unlinkQuery.bind(0, trackId);
+                    if (!unlinkQuery.exec()) {
+                        qWarning() << "failed to remove track from" << linkTable << unlinkQuery.lastError();
+                    }
+                }
+
+                const QString table;
+                const QString linkTable;
+                const QString idColumn;
+                const bool hasSortKey;
+                std::unordered_map<QString, int> ids;
+
+                RowInserter links;
+                SqliteStatement insertQuery;
+                SqliteStatement selectQuery;
+                SqliteStatement unlinkQuery;
+            };
+
+            const QSqlDatabase& mDb;
+            RowInserter mInsertTracks;
+            RowInserter mInsertSearch;
+            SqliteStatement mUpdateTrackQuery;
+            SqliteStatement mUpdateMediaArtQuery;
+            SqliteStatement mMoveTrackQuery;
+            SqliteStatement mUpdateFileSizeQuery;
+            SqliteStatement mDeleteSearchQuery;
+            Dictionary mArtists;
+            Dictionary mAlbums;
+            Dictionary mGenres;
+
+            int mUncommittedCount;
+            QElapsedTimer mCommitTimer;
+
+            LibraryChanges mChanges;
+        };
+
+        // Reads device and inode numbers of file with single stat().
+        // Returns false if file can't be stat'ed
+        bool fileId(const QString& path, std::pair<quint64, quint64>& id)
+        {
+#ifdef Q_OS_UNIX
+            struct stat info;
+            if (stat(QFile::encodeName(path).constData(), &info) != 0) {
+                return false;
+            }
+            id = {static_cast<quint64>(info.st_dev), static_cast<quint64>(info.st_ino)};
+            return true;
+#else
+            Q_UNUSED(path)
+            Q_UNUSED(id)
+            return false;
+#endif
+        }
+
+        // Inserts device and inode numbers of file. Returns false if they were already inserted.
+        // Files which can't be stat'ed are always new
+        template<typename FileIds>
+        bool insertFileId(FileIds& fileIds, const QString& path)
+        {
+            std::pair<quint64, quint64> id;
+            return !fileId(path, id) || fileIds.insert(id).second;
+        }
+
+        // Settings that affect which files are going to be added to the library
+        // and their media art. When they change, all directories should be scanned
+        QString scanSettingsString(bool preferDirectoryMediaArt, QStringList blacklistedDirectories)
+        {
+            blacklistedDirectories.sort();
+            return QString::fromLatin1("%1\n%2").arg(QLatin1String(preferDirectoryMediaArt ? "1" : "0"),
+                                                      blacklistedDirectories.join(QLatin1Char('\n')));
+        }
+
+        // Library directories which are on network file systems
+        std::vector<QString> networkDirectories(const QStringList& libraryDirectories)
+        {
+            std::vector<QString> directories;
+            for (const QString& directory : libraryDirectories) {
+                if (fileutils::isNetworkFileSystem(directory)) {
+                    directories.push_back(directory);
+                }
+            }
+            return directories;
+        }
+
+        // Directory examined by walker thread
+        struct DirectoryListing
+        {
+            QString path;
+            long long modificationTime;
+            // False if directory has not changed since last scan and files were not listed
+            bool listed;
+            bool noMedia;
+            std::vector<fileutils::FileEntry> entries;
+        };
+
+        // Passes listings from walker threads to scanning thread.
+        // Walkers wait when queue is full so that they don't get too far ahead
+        class DirectoryListingQueue
+        {
+        public:
+            explicit DirectoryListingQueue(int walkersCount)
+                : mRunningWalkers(walkersCount),
+                  mCancelled(false)
+            {
+            }
+
+            // Returns false if queue was cancelled
+            bool push(DirectoryListing&& listing)
+            {
+                const QMutexLocker locker(&mMutex);
+                while (!mCancelled && mListings.size() >= maxQueuedListings) {
+                    mNotFull.wait(&mMutex);
+                }
+                if (mCancelled) {
+                    return false;
+                }
+                mListings.push_back(std::move(listing));
+                mNotEmpty.wakeOne();
+                return true;
+            }
+
+            void walkerFinished()
+            {
+                const QMutexLocker locker(&mMutex);
+                --mRunningWalkers;
+                mNotEmpty.wakeOne();
+            }
+
+            // Returns false when all walkers have finished and queue is empty
+            bool pop(DirectoryListing& listing)
+            {
+                const QMutexLocker locker(&mMutex);
+                while (mListings.empty() && mRunningWalkers > 0) {
+                    mNotEmpty.wait(&mMutex);
+                }
+                if (mListings.empty()) {
+                    return false;
+                }
+                listing = std::move(mListings.front());
+                mListings.pop_front();
+                mNotFull.wakeOne();
+                return true;
+            }
+
+            // Wakes walkers and makes them stop
+            void cancel()
+            {
+                const QMutexLocker locker(&mMutex);
+                mCancelled = true;
+                mNotFull.wakeAll();
+            }
+
+        private:
+            QMutex mMutex;
+            QWaitCondition mNotEmpty;
+            QWaitCondition mNotFull;
+            std::deque<DirectoryListing> mListings;
+            int mRunningWalkers;
+            bool mCancelled;
+        };
+
+        // Sets values of files that exist to true. Files directly in the directory are found
+        // by listing it once, other files are stat'ed in batches by several threads
+        void checkFilesExistence(std::unordered_map<QString, bool>& files, const QString& directory, int threadsCount)
+        {
+            const QString prefix(directory + QLatin1Char('/'));
+            std::unordered_set<QString> directoryFiles;
+            for (const QString& fileName : QDir(directory).entryList(QDir::Files | QDir::Hidden)) {
+                directoryFiles.insert(prefix + fileName);
+            }
+
+            std::vector<std::pair<const QString, bool>*> otherFiles;
+            for (auto& i : files) {
+                if (i.first.startsWith(prefix) && i.first.indexOf(QLatin1Char('/'), prefix.size()) == -1) {
+                    i.second = directoryFiles.count(i.first) > 0;
+                } else {
+                    otherFiles.push_back(&i);
+                }
+            }
+            if (otherFiles.empty()) {
+                return;
+            }
+
+            QThreadPool workers;
+            workers.setMaxThreadCount(threadsCount);
+            std::vector<QFuture<void>> batches;
+            batches.reserve(otherFiles.size() / existenceCheckBatchSize + 1);
+            for (std::size_t first = 0, max = otherFiles.size(); first < max; first += existenceCheckBatchSize) {
+                const auto begin = otherFiles.begin() + static_cast<std::ptrdiff_t>(first);
+                const auto end = otherFiles.begin() + static_cast<std::ptrdiff_t>(std::min(first + existenceCheckBatchSize, max));
+                // Each job writes only to its own elements
+                batches.push_back(QtConcurrent::run(&workers, [begin, end]() {
+                    for (auto i = begin; i != end; ++i) {
+                        (*i)->second = QFile::exists((*i)->first);
+                    }
+                }));
+            }
+            for (QFuture<void>& batch : batches) {
+                batch.waitForFinished();
+            }
+        }
+
+        QString thumbnailKey(const QString& mediaArt, int size)
+        {
+            return QString::fromLatin1(QCryptographicHash::hash(QString::fromLatin1("%1\n%2\n%3")
+                                                                .arg(mediaArt)
+                                                                .arg(QFileInfo(mediaArt).lastModified().toMSecsSinceEpoch())
+                                                                .arg(size)
+                                                                .toUtf8(),
+                                                                QCryptographicHash::Md5).toHex());
+        }
+
+        struct Thumbnail
+        {
+            // Media art itself if it is small enough
+            QString filePath;
+            // JPEG data of downscaled media art
+            QByteArray data;
+            QRgb placeholder;
+        };
+
+        // Both filePath and data are empty on error
+        Thumbnail createThumbnail(const QString& mediaArt, int size)
+        {
+            QImageReader reader(mediaArt);
+            const QSize imageSize(reader.size());
+            if (imageSize.isValid() && (imageSize.width() <= size || imageSize.height() <= size)) {
+                return {mediaArt, QByteArray(), 0};
+            }
+
+            QImage image(Utils::readScaledImage(reader, imageSize, imageSize.scaled(size, size, Qt::KeepAspectRatioByExpanding)));
+            if (image.isNull()) {
+                qWarning() << "failed to read image" << mediaArt << reader.errorString();
+                return {};
+            }
+            if (image.width() > size && image.height() > size) {
+                image = image.scaled(size, size, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+            }
+
+            Thumbnail thumbnail{QString(), QByteArray(), thumbnailatlas::placeholder(image)};
+            QBuffer buffer(&thumbnail.data);
+            buffer.open(QIODevice::WriteOnly);
+            if (!image.save(&buffer, "JPEG", 90)) {
+                qWarning() << "failed to encode thumbnail of" << mediaArt;
+                return {};
+            }
+            return thumbnail;
+        }
+
+        // Downscales picture larger than maxResolution and re-encodes picture larger than
+        // maxFileSize bytes (0 means no limit). Returns empty array if data should be saved as is
+        QByteArray normalizeMediaArt(const QByteArray& data, int maxResolution, int maxFileSize)
+        {
+            QBuffer buffer;
+            buffer.setData(data);
+            buffer.open(QIODevice::ReadOnly);
+            QImageReader reader(&buffer);
+            const QSize imageSize(reader.size());
+
+            const bool tooLarge = maxResolution > 0 &&
+                                  imageSize.isValid() &&
+                                  (imageSize.width() > maxResolution || imageSize.height() > maxResolution);
+            if (!tooLarge && (maxFileSize <= 0 || data.size() <= maxFileSize)) {
+                return QByteArray();
+            }
+            QImage image(tooLarge ? Utils::readScaledImage(reader, imageSize, imageSize.scaled(maxResolution, maxResolution, Qt::KeepAspectRatio))
+                                  : reader.read());
+            if (image.isNull()) {
+                qWarning() << "failed to read embedded media art" << reader.errorString();
+                return QByteArray();
+            }
+            if (maxResolution > 0 && (image.width() > maxResolution || image.height() > maxResolution)) {
+                image = image.scaled(maxResolution, maxResolution, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            }
+            if (image.hasAlphaChannel()) {
+                // JPEG doesn't have transparency
+                QImage opaque(image.size(), QImage::Format_RGB32);
+                opaque.fill(Qt::white);
+                QPainter(&opaque).drawImage(0, 0, image);
+                image = opaque;
+            }
+
+            QByteArray normalized;
+            QBuffer output(&normalized);
+            output.open(QIODevice::WriteOnly);
+            if (!image.save(&output, "JPEG", 90)) {
+                qWarning() << "failed to encode embedded media art";
+                return QByteArray();
+            }
+            // Picture may already be compressed better
+            if (!tooLarge && normalized.size() >= data.size()) {
+                return QByteArray();
+            }
+            return normalized;
+        }
+
+        enum class FileState
+        {
+            New,
+            Changed,
+            Unchanged
+        };
+
+        // Created by directory walker
+        struct ScanTask
+        {
+            FileState state;
+            int id;
+            QFileInfo fileInfo;
+            long long modificationTime;
+
+            // Only for unchanged files
+            QString mediaArt;
+            bool mediaArtDeleted;
+            // Null if unknown (track was added by older version)
+            QString embeddedMediaArtHash;
+        };
+
+        // Created by tag reader worker
+        struct ScanResult
+        {
+            bool isAudio = false;
+            tagutils::Info info;
+
+            QString mediaArt;
+            QString embeddedMediaArtHash;
+            bool mediaArtChanged = false;
+            // Embedded media art should be extracted later by Unchanged task
+            bool mediaArtDeferred = false;
+            qint64 fileSize = 0;
+            // Audio file could not be parsed
+            bool parseError = false;
+            // Reading exceeded budget, file is not added to library
+            bool budgetExceeded = false;
+            // Nanoseconds spent in readTrack()
+            qint64 readTime = 0;
+        };
+
+        // Tracks from database that are checked by scan. Records are kept in one array,
+        // grouped by directory, and are found by directory and file name in open addressing
+        // table of indexes, so that scan of large library doesn't allocate a node per track
+        class TracksInDb final
+        {
+        public:
+            // Element of media art existence hash
+            using MediaArtFile = std::pair<const QString, bool>;
+
+            struct Record
+            {
+                int id;
+                // Index of directory, set by add()
+                int directory;
+                long long modificationTime;
+                // Zero if unknown
+                qint64 fileSize;
+                QString fileName;
+                // Null if track doesn't have media art
+                const MediaArtFile* mediaArt;
+                QString embeddedMediaArtHash;
+                bool seen;
+
+                bool isMediaArtDeleted() const
+                {
+                    return mediaArt && !mediaArt->second;
+                }
+            };
+
+            // Records of directory
+            class Range
+            {
+            public:
+                Range(Record* begin, Record* end)
+                    : mBegin(begin),
+                      mEnd(end)
+                {
+
+                }
+
+                Record* begin() const
+                {
+                    return mBegin;
+                }
+
+                Record* end() const
+                {
+                    return mEnd;
+                }
+
+                int size() const
+                {
+                    return static_cast<int>(mEnd - mBegin);
+                }
+
+            private:
+                Record* mBegin;
+                Record* mEnd;
+            };
+
+            void add(const QString& directoryPath, Record&& record)
+            {
+                const auto found(mDirectoryIndexes.find(directoryPath));
+                if (found == mDirectoryIndexes.end()) {
+                    record.directory = static_cast<int>(mDirectories.size());
+                    mDirectoryIndexes.insert({directoryPath, record.directory});
+                    mDirectories.push_back({directoryPath, 0, 0});
+                } else {
+                    record.directory = found->second;
+                }
+                mRecords.push_back(std::move(record));
+            }
+
+            // Must be called after all records are added, records are not moved after that
+            void finish()
+            {
+                // Counting sort by directory
+                std::vector<int> offsets(mDirectories.size() + 1, 0);
+                for (const Record& record : mRecords) {
+                    ++offsets[record.directory + 1];
+                }
+                for (std::size_t i = 0, max = mDirectories.size(); i < max; ++i) {
+                    offsets[i + 1] += offsets[i];
+                    mDirectories[i].first = offsets[i];
+                    mDirectories[i].count = offsets[i + 1] - offsets[i];
+                }
+                std::vector<Record> sorted(mRecords.size());
+                for (Record& record : mRecords) {
+                    sorted[offsets[record.directory]++] = std::move(record);
+                }
+                mRecords = std::move(sorted);
+                mRecords.shrink_to_fit();
+
+                // Load factor is at most 0.5
+                std::size_t capacity = 16;
+                while (capacity < mRecords.size() * 2) {
+                    capacity *= 2;
+                }
+                mSlots.assign(capacity, Slot{0, -1});
+                for (int i = 0, max = static_cast<int>(mRecords.size()); i < max; ++i) {
+                    const Record& record = mRecords[i];
+                    const uint hash = hashOf(record.directory, QStringRef(&record.fileName));
+                    std::size_t slot = hash & (capacity - 1);
+                    while (mSlots[slot].record != -1) {
+                        slot = (slot + 1) & (capacity - 1);
+                    }
+                    mSlots[slot] = {hash, i};
+                }
+            }
+
+            // Returns -1 if there are no tracks in directory
+            int directory(const QString& path) const
+            {
+                const auto found(mDirectoryIndexes.find(path));
+                return found == mDirectoryIndexes.end() ? -1 : found->second;
+            }
+
+            Range files(int directory)
+            {
+                if (directory == -1) {
+                    return {nullptr, nullptr};
+                }
+                Record* first = mRecords.data() + mDirectories[directory].first;
+                return {first, first + mDirectories[directory].count};
+            }
+
+            Record* find(int directory, const QStringRef& fileName)
+            {
+                if (directory == -1) {
+                    return nullptr;
+                }
+                const uint hash = hashOf(directory, fileName);
+                const std::size_t mask = mSlots.size() - 1;
+                for (std::size_t slot = hash & mask; mSlots[slot].record != -1; slot = (slot + 1) & mask) {
+                    if (mSlots[slot].hash == hash) {
+                        Record& record = mRecords[mSlots[slot].record];
+                        if (record.directory == directory && record.fileName == fileName) {
+                            return &record;
+                        }
+                    }
+                }
+                return nullptr;
+            }
+
+            QString filePath(const Record& record) const
+            {
+                return QString::fromLatin1("%1/%2").arg(mDirectories[record.directory].path, record.fileName);
+            }
+
+            std::vector<Record>& records()
+            {
+                return mRecords;
+            }
+
+            // Bytes used by records and indexes, without contents of strings
+            std::size_t memoryUsage() const
+            {
+                return mRecords.capacity() * sizeof(Record) +
+                       mSlots.capacity() * sizeof(Slot) +
+                       mDirectories.capacity() * sizeof(Directory);
+            }
+
+        private:
+            struct Directory
+            {
+                QString path;
+                int first;
+                int count;
+            };
+
+            struct Slot
+            {
+                uint hash;
+                // -1 if slot is empty
+                int record;
+            };
+
+            static uint hashOf(int directory, const QStringRef& fileName)
+            {
+                return qHash(fileName, static_cast<uint>(directory));
+            }
+
+            std::vector<Record> mRecords;
+            std::vector<Slot> mSlots;
+            std::vector<Directory> mDirectories;
+            FlatHashMap<QString, int> mDirectoryIndexes;
+        };
+
+        // Files which parsing exceeded read budget. They are skipped until their modification time changes
+        class Quarantine final
+        {
+        public:
+            explicit Quarantine(const QSqlDatabase& db)
+                : mInsertQuery(db),
+                  mDeleteQuery(db)
+            {
+                SqlQuery query(QLatin1String("SELECT filePath, modificationTime FROM quarantinedFiles"), db);
+                if (query.lastError().type() != QSqlError::NoError) {
+                    qWarning() << "failed to get quarantined files" << query.lastError();
+                }
+                while (query.next()) {
+                    mFiles.insert({query.value(0).toString(), query.value(1).toLongLong()});
+                }
+                if (!mFiles.empty()) {
+                    qDebug() << mFiles.size() << "files are quarantined";
+                }
+
+                mInsertQuery.prepare(QStringLiteral("INSERT OR REPLACE INTO quarantinedFiles (filePath, modificationTime) VALUES (?, ?)"));
+                mDeleteQuery.prepare(QStringLiteral("DELETE FROM quarantinedFiles WHERE filePath = ?"));
+            }
+
+            bool contains(const QString& filePath, long long modificationTime) const
+            {
+                const auto found(mFiles.find(filePath));
+                return found != mFiles.end() && found->second == modificationTime;
+            }
+
+            void add(const QString& filePath, long long modificationTime)
+            {
+                qWarning() << "reading of" << filePath << "exceeded budget, quarantining it";
+                mFiles[filePath] = modificationTime;
+                mInsertQuery.addBindValue(filePath);
+                mInsertQuery.addBindValue(modificationTime);
+                if (!mInsertQuery.exec()) {
+                    qWarning() << "failed to quarantine file" << mInsertQuery.lastError();
+                }
+            }
+
+            // Called when file was parsed successfully
+            void remove(const QString& filePath)
+            {
+                if (mFiles.erase(filePath) == 0) {
+                    return;
+                }
+                mDeleteQuery.addBindValue(filePath);
+                if (!mDeleteQuery.exec()) {
+                    qWarning() << "failed to remove file from quarantine" << mDeleteQuery.lastError();
+                }
+            }
+
+        private:
+            std::unordered_map<QString, long long> mFiles;
+            SqlQuery mInsertQuery;
+            SqlQuery mDeleteQuery;
+        };
+
+        // Cost of scanning files of directory
+        struct DirectoryScanStatistics
+        {
+            int examinedFiles = 0;
+            int parsedFiles = 0;
+            qint64 bytesRead = 0;
+            // Nanoseconds
+            qint64 time = 0;
+            int errors = 0;
+        };
+
+        // Replaces statistics of previous scan
+        void saveScanStatistics(const QSqlDatabase& db, const std::unordered_map<QString, DirectoryScanStatistics>& statistics)
+        {
+            SqlQuery query(db);
+            if (!query.exec(QLatin1String("DELETE FROM scanStatistics"))) {
+                qWarning() << "failed to clear scan statistics" << query.lastError();
+                return;
+            }
+
+            query.prepare(QStringLiteral("INSERT INTO scanStatistics (directory, examinedFiles, parsedFiles, bytesRead, time, errors) "
+                                         "VALUES (?, ?, ?, ?, ?, ?)"));
+            for (const auto& i : statistics) {
+                const DirectoryScanStatistics& directory = i.second;
+                query.addBindValue(i.first);
+                query.addBindValue(directory.examinedFiles);
+                query.addBindValue(directory.parsedFiles);
+                query.addBindValue(directory.bytesRead);
+                query.addBindValue(directory.time / 1000000);
+                query.addBindValue(directory.errors);
+                if (!query.exec()) {
+                    qWarning() << "failed to save scan statistics" << query.lastError();
+                    return;
+                }
+            }
+        }
+
+        // If deferEmbeddedMediaArt is true, pictures of new and changed files are not parsed
+        ScanResult readTrack(const ScanTask& task, MediaArtCache& mediaArtCache, bool preferDirectoryMediaArt, bool deferEmbeddedMediaArt)
+        {
+            UNPLAYER_TRACE("scan: read track");
+            perfcounters::add(perfcounters::FilesScanned);
+            QElapsedTimer timer;
+            timer.start();
+            tagutils::ReadBudget budget;
+            budget.maxTime = maxFileReadTime;
+            budget.maxBytes = maxFileReadBytes;
+            const QMimeDatabase mimeDb;
+            ScanResult result;
+
+            // Embedded media art is hashed and saved while TagLib file is open, without copying
+            QString embeddedMediaArt;
+            const auto saveEmbeddedMediaArt = [&](const QByteArray& data) {
+                result.embeddedMediaArtHash = mediaArtCache.embeddedMediaArtHash(data);
+                embeddedMediaArt = mediaArtCache.saveEmbeddedMediaArt(data, result.embeddedMediaArtHash);
+            };
+
+            // Pictures are not parsed if they would not be used.
+            // Embedded media art hash is left null then, so that it is read when settings change
+            const bool needsEmbeddedMediaArt = !preferDirectoryMediaArt || mediaArtCache.directoryMediaArt(task.fileInfo.path()).isEmpty();
+
+            if (task.state == FileState::Unchanged) {
+                // File is opened only if embedded media art is unknown or its file was deleted
+                result.embeddedMediaArtHash = task.embeddedMediaArtHash;
+                if (!result.embeddedMediaArtHash.isEmpty()) {
+                    embeddedMediaArt = mediaArtCache.embeddedMediaArtFile(result.embeddedMediaArtHash);
+                }
+                if (needsEmbeddedMediaArt &&
+                        (result.embeddedMediaArtHash.isNull() || (!result.embeddedMediaArtHash.isEmpty() && embeddedMediaArt.isEmpty()))) {
+                    result.embeddedMediaArtHash = QLatin1String("");
+                    tagutils::getTrackInfo(task.fileInfo,
+                                           audioTypeForFile(task.fileInfo, mimeDb),
+                                           tagutils::ReadProfile::MediaArtOnly,
+                                           saveEmbeddedMediaArt,
+                                           budget);
+                }
+
+                result.mediaArt = mediaArtCache.getTrackMediaArt(embeddedMediaArt, task.fileInfo, preferDirectoryMediaArt);
+                result.mediaArtChanged = result.mediaArt != task.mediaArt ||
+                                         (task.embeddedMediaArtHash.isNull() && !result.embeddedMediaArtHash.isNull());
+                result.readTime = timer.nsecsElapsed();
+                return result;
+            }
+
+            const MimeType mimeType = audioTypeForFile(task.fileInfo, mimeDb);
+            if (mimeType != MimeType::Other) {
+                result.isAudio = true;
+                result.fileSize = task.fileInfo.size();
+                const bool readMediaArt = needsEmbeddedMediaArt && !deferEmbeddedMediaArt;
+                if (readMediaArt) {
+                    result.embeddedMediaArtHash = QLatin1String("");
+                }
+                result.mediaArtDeferred = needsEmbeddedMediaArt && deferEmbeddedMediaArt;
+                result.info = tagutils::getTrackInfo(task.fileInfo,
+                                                     mimeType,
+                                                     readMediaArt ? tagutils::ReadProfile::Fast
+                                                                  : tagutils::ReadProfile::FastWithoutMediaArt,
+                                                     saveEmbeddedMediaArt,
+                                                     budget);
+                if (result.info.budgetExceeded) {
+                    result.isAudio = false;
+                    result.budgetExceeded = true;
+                }
+                result.parseError = !result.info.valid;
+                result.mediaArt = mediaArtCache.getTrackMediaArt(embeddedMediaArt, task.fileInfo, preferDirectoryMediaArt);
+            }
+
+            result.readTime = timer.nsecsElapsed();
+            return result;
+        }
+    }
+
+    MediaArtCache::MediaArtCache(const QString& mediaArtDirectory)
+        : mMediaArtDirectory(mediaArtDirectory),
+          mMaxResolution(Settings::instance()->embeddedMediaArtMaxResolution()),
+          mMaxFileSize(Settings::instance()->embeddedMediaArtMaxFileSize() * 1024)
+    {
+    }
+
+    void MediaArtCache::loadEmbeddedMediaArtFiles(const QSqlDatabase& db, const std::unordered_set<QString>& deletedFiles)
+    {
+        SqlQuery query(QLatin1String("SELECT filePath FROM mediaArtFiles"), db);
+        if (query.lastError().type() != QSqlError::NoError) {
+            qWarning() << "failed to get media art files from database" << query.lastError();
+            return;
+        }
+
+        const QString prefix(mMediaArtDirectory + QLatin1Char('/'));
+        QMutexLocker locker(&mEmbeddedMutex);
+        while (query.next()) {
+            const QString filePath(query.value(0).toString());
+            if (!filePath.startsWith(prefix) || contains(deletedFiles, filePath)) {
+                continue;
+            }
+            // Thumbnails are in subdirectory
+            const int slashIndex = filePath.lastIndexOf(QLatin1Char('/'));
+            if (slashIndex != prefix.size() - 1) {
+                continue;
+            }
+            const int index = filePath.indexOf(QStringLiteral("-embedded."), prefix.size());
+            if (index != -1) {
+                mEmbeddedFiles.insert({filePath.mid(prefix.size(), index - prefix.size()).toLatin1(), filePath});
+            }
+        }
+    }
+
+    QString MediaArtCache::embeddedMediaArtHash(const QByteArray& data)
+    {
+        if (data.isEmpty()) {
+            return QLatin1String("");
+        }
+
+        // Tracks of the same album usually have the same picture,
+        // compare it with recent pictures before hashing
+        const quint64 fingerprint = murmurHash64(data.constData(), std::min(data.size(), fingerprintSize));
+        {
+            QMutexLocker locker(&mRecentMutex);
+            for (const RecentMediaArt& recent : mRecentMediaArt) {
+                if (recent.data.size() == data.size() &&
+                        recent.fingerprint == fingerprint &&
+                        std::memcmp(recent.data.constData(), data.constData(), data.size()) == 0) {
+                    return recent.hash;
+                }
+            }
+        }
+
+        // Size and 64-bit hash, names of files extracted by older versions use MD5
+        const QString hash(QString::fromLatin1("%1%2")
+                           .arg(data.size(), 8, 16, QLatin1Char('0'))
+                           .arg(murmurHash64(data.constData(), data.size()), 16, 16, QLatin1Char('0')));
+
+        QMutexLocker locker(&mRecentMutex);
+        if (mRecentMediaArt.size() == maxRecentMediaArtCount) {
+            mRecentMediaArt.pop_front();
+        }
+        // data may point to TagLib buffer, make a deep copy
+        mRecentMediaArt.push_back({QByteArray(data.constData(), data.size()), fingerprint, hash});
+
+        return hash;
+    }
+
+    QString MediaArtCache::getTrackMediaArt(const QString& embeddedMediaArt,
+                                            const QFileInfo& fileInfo,
+                                            bool preferDirectoriesMediaArt)
+    {
+        if (preferDirectoriesMediaArt) {
+            const QString mediaArt(directoryMediaArt(fileInfo.path()));
+            if (mediaArt.isEmpty()) {
+                return embeddedMediaArt;
+            }
+            return mediaArt;
+        }
+        if (embeddedMediaArt.isEmpty()) {
+            return directoryMediaArt(fileInfo.path());
+        }
+        return embeddedMediaArt;
+    }
+
+    QString MediaArtCache::directoryMediaArt(const QString& directoryPath)
+    {
+        {
+            QMutexLocker locker(&mDirectoriesMutex);
+            const auto found(mDirectories.find(directoryPath));
+            if (found != mDirectories.end()) {
+                return found->second;
+            }
+        }
+
+        // Don't hold the lock while listing directory.
+        // Several workers may list the same directory, but result is the same
+        QString mediaArt(LibraryUtils::findMediaArtForDirectory(directoryPath));
+        if (!mediaArt.isEmpty()) {
+            const QString path(directoryPath + QLatin1Char('/'));
+            if (std::any_of(mNetworkDirectories.begin(), mNetworkDirectories.end(), [&](const QString& directory) {
+                return path.startsWith(directory);
+            })) {
+                const QString copy(copyDirectoryMediaArt(mediaArt));
+                if (!copy.isEmpty()) {
+                    mediaArt = copy;
+                }
+            }
+        }
+
+        QMutexLocker locker(&mDirectoriesMutex);
+        mDirectories.insert({directoryPath, mediaArt});
+        return mediaArt;
+    }
+
+    void MediaArtCache::setNetworkDirectories(std::vector<QString> directories)
+    {
+        mNetworkDirectories = std::move(directories);
+    }
+
+    QString MediaArtCache::copyDirectoryMediaArt(const QString& mediaArt)
+    {
+        // Name depends on modification time and size, so that changed file is copied again
+        const QFileInfo fileInfo(mediaArt);
+        const QByteArray key(QString::fromLatin1("%1\n%2\n%3")
+                             .arg(mediaArt)
+                             .arg(fileInfo.lastModified().toMSecsSinceEpoch())
+                             .arg(fileInfo.size())
+                             .toUtf8());
+        const QString filePath(QString::fromLatin1("%1/%2-directory.%3")
+                               .arg(mMediaArtDirectory)
+                               .arg(murmurHash64(key.constData(), key.size()), 16, 16, QLatin1Char('0'))
+                               .arg(fileInfo.suffix()));
+        if (QFileInfo::exists(filePath)) {
+            return filePath;
+        }
+
+        // Copied under temporary name so that other workers never see incomplete file
+        const QString temporaryFilePath(QString::fromLatin1("%1.%2.part").arg(filePath).arg(reinterpret_cast<quintptr>(QThread::currentThreadId())));
+        if (!QFile::copy(mediaArt, temporaryFilePath)) {
+            qWarning() << "failed to copy media art" << mediaArt;
+            QFile::remove(temporaryFilePath);
+            return QString();
+        }
+        if (!QFile::rename(temporaryFilePath, filePath)) {
+            QFile::remove(temporaryFilePath);
+            // Another worker has copied it first
+            return QFileInfo::exists(filePath) ? filePath : QString();
+        }
+
+        QMutexLocker locker(&mEmbeddedMutex);
+        mSavedFiles.push_back(filePath);
+        return filePath;
+    }
+
+    QString MediaArtCache::embeddedMediaArtFile(const QString& hash)
+    {
+        QMutexLocker locker(&mEmbeddedMutex);
+        const auto found(mEmbeddedFiles.find(hash.toLatin1()));
+        if (found != mEmbeddedFiles.end()) {
+            return found->second;
+        }
+        return QString();
+    }
+
+    QString MediaArtCache::saveEmbeddedMediaArt(const QByteArray& data, const QString& hash)
+    {
+        QByteArray key(hash.toLatin1());
+        {
+            QMutexLocker locker(&mEmbeddedMutex);
+            const auto found(mEmbeddedFiles.find(key));
+            if (found != mEmbeddedFiles.end()) {
+                return found->second;
+            }
+        }
+
+        // Pictures are normalized only once, hash is of original data
+        // so that tracks with the same picture find this file without decoding it
+        const QByteArray normalized(normalizeMediaArt(data, mMaxResolution, mMaxFileSize));
+        const QByteArray& saved = normalized.isEmpty() ? data : normalized;
+
+        const QString suffix(mMimeDb.mimeTypeForData(saved).preferredSuffix());
+        if (suffix.isEmpty()) {
+            return QString();
+        }
+
+        const QString filePath(QStringLiteral("%1/%2-embedded.%3")
+                               .arg(mMediaArtDirectory, QString::fromLatin1(key), suffix));
+
+        // Hold the lock while writing, so that two workers don't write the same file
+        QMutexLocker locker(&mEmbeddedMutex);
+        const auto found(mEmbeddedFiles.find(key));
+        if (found != mEmbeddedFiles.end()) {
+            return found->second;
+        }
+
+        QFile file(filePath);
+        if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            file.write(saved);
+            mEmbeddedFiles.insert({std::move(key), filePath});
+            mSavedFiles.push_back(filePath);
+            return filePath;
+        }
+
+        return QString();
+    }
+
+    std::vector<QString> MediaArtCache::takeSavedFiles()
+    {
+        QMutexLocker locker(&mEmbeddedMutex);
+        std::vector<QString> files;
+        files.swap(mSavedFiles);
+        return files;
+    }
+
+    QString ScanProgress::currentDirectory() const
+    {
+        const QMutexLocker locker(&mDirectoryMutex);
+        return mCurrentDirectory;
+    }
+
+    void ScanProgress::setCurrentDirectory(const QString& directory)
+    {
+        const QMutexLocker locker(&mDirectoryMutex);
+        mCurrentDirectory = directory;
+    }
+
+    void ScanProgress::addHotDirectory(const QString& directory)
+    {
+        const QMutexLocker locker(&mDirectoryMutex);
+        // Only the most recently opened directories matter
+        if (mHotDirectories.size() >= maxHotDirectories) {
+            mHotDirectories.erase(mHotDirectories.begin());
+        }
+        mHotDirectories.push_back(directory);
+    }
+
+    std::vector<QString> ScanProgress::takeHotDirectories()
+    {
+        const QMutexLocker locker(&mDirectoryMutex);
+        std::vector<QString> directories;
+        directories.swap(mHotDirectories);
+        return directories;
+    }
+
+    LibraryUpdater::LibraryUpdater(const QString& databaseFilePath,
+                                   const QString& mediaArtDirectory,
+                                   int thumbnailSize,
+                                   const std::shared_ptr<ScanProgress>& progress)
+        : mDatabaseFilePath(databaseFilePath),
+          mMediaArtDirectory(mediaArtDirectory),
+          mThumbnailSize(thumbnailSize),
+          mProgress(progress)
+    {
+    }
+
+    void LibraryUpdater::updatePaths(const QStringList& paths)
+    {
+        qDebug() << "start updating" << paths.size() << "paths";
+        UNPLAYER_TRACE("update paths");
+        const QTime time(QTime::currentTime());
+        {
+            auto db = LibraryUtils::threadDatabase(mDatabaseFilePath);
+            if (!db.isOpen()) {
+                return;
+            }
+            db.transaction();
+
+            if (!QDir().mkpath(mMediaArtDirectory)) {
+                qWarning() << "failed to create media art directory:" << mMediaArtDirectory;
+            }
+
+            loadDirectories();
+            loadVolumes(db);
+
+            int lastId = -1;
+            {
+                SqlQuery query(QLatin1String("SELECT MAX(id) FROM tracks"), db);
+                if (query.next() && !query.isNull(0)) {
+                    lastId = query.value(0).toInt();
+                }
+            }
+
+            MediaArtCache mediaArtCache(mMediaArtDirectory);
+            mediaArtCache.loadEmbeddedMediaArtFiles(db, {});
+            mediaArtCache.setNetworkDirectories(networkDirectories(mLibraryDirectories));
+            const bool preferDirectoryMediaArt = Settings::instance()->useDirectoryMediaArt();
+
+            std::vector<int> filesToRemove;
+            TracksWriter writer(db);
+            Quarantine quarantine(db);
+
+            for (QString path : paths) {
+                if (isStopped()) {
+                    qWarning() << "stop updating paths";
+                    break;
+                }
+
+                // .nomedia file affects the whole directory
+                if (path.endsWith(QLatin1String("/.nomedia"))) {
+                    path.chop(9);
+                    mNoMediaDirectories.erase(path);
+                }
+
+                const QFileInfo pathInfo(path);
+
+                // Tracks that are stored in the database for this path
+                struct TrackInDb
+                {
+                    int id;
+                    long long modificationTime;
+                };
+                std::unordered_map<QString, TrackInDb> tracksInDb;
+                {
+                    SqlQuery query(db);
+                    query.prepare(QStringLiteral("SELECT id, filePath, modificationTime FROM tracks "
+                                                 "WHERE filePath = ? OR (filePath > ? AND filePath < ?)"));
+                    query.addBindValue(path);
+                    // All paths that start with "path/"
+                    query.addBindValue(path + QLatin1Char('/'));
+                    query.addBindValue(path + QLatin1Char('0'));
+                    if (!query.exec()) {
+                        qWarning() << "failed to get files from database" << query.lastError();
+                        continue;
+                    }
+                    while (query.next()) {
+                        tracksInDb.insert({query.value(1).toString(), {query.value(0).toInt(), query.value(2).toLongLong()}});
+                    }
+                }
+
+                const auto updateFile = [&](const QFileInfo& fileInfo) {
+                    if (!fileInfo.isReadable()) {
+                        return;
+                    }
+
+                    const QString filePath(fileInfo.filePath());
+                    if (!isInLibrary(filePath) || isBlacklisted(filePath) || isNoMediaDirectory(fileInfo.path())) {
+                        return;
+                    }
+
+                    // Tracks of duplicate paths are removed as not found
+                    if (!visitFile(filePath)) {
+                        return;
+                    }
+
+                    const auto foundInDb(tracksInDb.find(filePath));
+                    if (foundInDb == tracksInDb.end()) {
+                        if (!contains(LibraryUtils::mimeTypesExtensions, fileInfo.suffix())) {
+                            return;
+                        }
+                        const long long modificationTime = fileInfo.lastModified().toMSecsSinceEpoch();
+                        ++mProgress->discoveredFiles;
+                        if (quarantine.contains(filePath, modificationTime)) {
+                            ++mProgress->skippedFiles;
+                            return;
+                        }
+                        const ScanResult result(readTrack({FileState::New, -1, fileInfo, modificationTime, QString(), false, QString()},
+                                                          mediaArtCache,
+                                                          preferDirectoryMediaArt,
+                                                          false));
+                        ++mProgress->processedFiles;
+                        mProgress->bytesRead += result.fileSize;
+                        if (result.budgetExceeded) {
+                            quarantine.add(filePath, modificationTime);
+                        } else {
+                            quarantine.remove(filePath);
+                        }
+                        if (result.isAudio) {
+                            writer.updateTrackInDatabase(false, ++lastId, fileInfo, modificationTime, result.fileSize, result.info, result.mediaArt, result.embeddedMediaArtHash);
+                        }
+                        return;
+                    }
+
+                    const TrackInDb track(foundInDb->second);
+                    tracksInDb.erase(foundInDb);
+
+                    ++mProgress->discoveredFiles;
+                    const long long modificationTime = fileInfo.lastModified().toMSecsSinceEpoch();
+                    if (modificationTime == track.modificationTime || quarantine.contains(filePath, modificationTime)) {
+                        ++mProgress->skippedFiles;
+                        return;
+                    }
+
+                    const ScanResult result(readTrack({FileState::Changed, track.id, fileInfo, modificationTime, QString(), false, QString()},
+                                                      mediaArtCache,
+                                                      preferDirectoryMediaArt,
+                                                      false));
+                    ++mProgress->processedFiles;
+                    mProgress->bytesRead += result.fileSize;
+                    if (result.budgetExceeded) {
+                        quarantine.add(filePath, modificationTime);
+                    } else {
+                        quarantine.remove(filePath);
+                    }
+                    if (result.isAudio) {
+                        writer.updateTrackInDatabase(true, track.id, fileInfo, modificationTime, result.fileSize, result.info, result.mediaArt, result.embeddedMediaArtHash);
+                    } else {
+                        filesToRemove.push_back(track.id);
+                    }
+                };
+
+                if (pathInfo.isDir()) {
+                    walkDirectories(path, [&](const QFileInfo& directoryInfo) {
+                        if (isStopped()) {
+                            return false;
+                        }
+                        mProgress->setCurrentDirectory(directoryInfo.filePath());
+                        const QFileInfoList entries(QDir(directoryInfo.filePath()).entryInfoList(QDir::Files));
+                        for (const QFileInfo& fileInfo : entries) {
+                            updateFile(fileInfo);
+                            if (writer.isCommitNeeded()) {
+                                writer.commit();
+                            }
+                        }
+                        return true;
+                    });
+                } else if (pathInfo.isFile()) {
+                    updateFile(pathInfo);
+                }
+
+                // Files that were not found, unless their volume is not mounted
+                for (const auto& i : tracksInDb) {
+                    if (!isOffline(i.first)) {
+                        filesToRemove.push_back(i.second.id);
+                    }
+                }
+            }
+
+            writer.removeTracks(filesToRemove);
+
+            updateThumbnails(db);
+            removeUnusedMediaArt(db, mediaArtCache.takeSavedFiles());
+            DirectoryMediaArtCache::instance().save(db);
+            writer.removeUnusedEntries();
+            LibraryUtils::updateSummaries(db);
+
+            db.commit();
+            writer.notifyChanges();
+        }
+        qDebug() << "end updating paths" << time.msecsTo(QTime::currentTime());
+    }
+
+    const QLatin1String LibraryUpdater::importVolumePlaceholder("${volume}");
+    const QLatin1String LibraryUpdater::importMediaArtPlaceholder("${mediaArt}");
+
+    void LibraryUpdater::importLibrary(const QString& importDirectory, const QString& volumeRoot)
+    {
+        qDebug() << "start importing library from" << importDirectory << "for volume" << volumeRoot;
+        UNPLAYER_TRACE("import library");
+        const QTime time(QTime::currentTime());
+
+        const QString importedFilePath(QString::fromLatin1("%1/library.sqlite").arg(importDirectory));
+        const QString importedMediaArtDirectory(QString::fromLatin1("%1/media-art").arg(importDirectory));
+        if (!QFileInfo(importedFilePath).isFile()) {
+            qWarning() << "imported database doesn't exist:" << importedFilePath;
+            return;
+        }
+
+        QString root(QDir::cleanPath(volumeRoot));
+        if (root.endsWith(QLatin1Char('/'))) {
+            root.chop(1);
+        }
+
+        auto db = LibraryUtils::threadDatabase(mDatabaseFilePath);
+        if (!db.isOpen()) {
+            return;
+        }
+
+        // Database can't be attached inside transaction
+        {
+            SqlQuery query(db);
+            query.prepare(QStringLiteral("ATTACH DATABASE ? AS imported"));
+            query.addBindValue(importedFilePath);
+            if (!query.exec()) {
+                qWarning() << "failed to attach imported database" << query.lastError();
+                return;
+            }
+        }
+        const auto detach = [&]() {
+            SqlQuery query(QLatin1String("DETACH DATABASE imported"), db);
+            if (query.lastError().type() != QSqlError::NoError) {
+                qWarning() << "failed to detach imported database" << query.lastError();
+            }
+        };
+
+        {
+            // Indexer should be built from the same version of Unplayer
+            SqlQuery query(QLatin1String("PRAGMA imported.user_version"), db);
+            const int version = query.next() ? query.value(0).toInt() : -1;
+            if (version != librarymigrations::currentVersion()) {
+                qWarning() << "imported database has version" << version << "instead of" << librarymigrations::currentVersion();
+                query.finish();
+                detach();
+                return;
+            }
+        }
+
+        {
+            db.transaction();
+
+            if (!QDir().mkpath(mMediaArtDirectory)) {
+                qWarning() << "failed to create media art directory:" << mMediaArtDirectory;
+            }
+
+            loadDirectories();
+
+            int lastId = -1;
+            std::unordered_set<QString> tracksInDb;
+            {
+                SqlQuery query(QLatin1String("SELECT id, filePath FROM tracks"), db);
+                while (query.next()) {
+                    lastId = std::max(lastId, query.value(0).toInt());
+                    tracksInDb.insert(query.value(1).toString());
+                }
+            }
+
+            // Titles of artists, albums and genres of imported tracks.
+            // Tracks without them are linked to empty string, it is linked again by TracksWriter
+            const auto loadTitles = [&](const QString& table, const QString& linkTable, const QString& idColumn) {
+                std::unordered_map<int, QStringList> titles;
+                SqlQuery query(QString::fromLatin1("SELECT links.trackId, entries.title FROM imported.%2 AS links "
+                                                   "JOIN imported.%1 AS entries ON entries.id = links.%3").arg(table, linkTable, idColumn), db);
+                if (query.lastError().type() != QSqlError::NoError) {
+                    qWarning() << "failed to get imported" << table << query.lastError();
+                }
+                while (query.next()) {
+                    const QString title(query.value(1).toString());
+                    if (!title.isEmpty()) {
+                        titles[query.value(0).toInt()].push_back(title);
+                    }
+                }
+                return titles;
+            };
+            const std::unordered_map<int, QStringList> artists(loadTitles(QLatin1String("artists"), QLatin1String("tracks_artists"), QLatin1String("artistId")));
+            const std::unordered_map<int, QStringList> albums(loadTitles(QLatin1String("albums"), QLatin1String("tracks_albums"), QLatin1String("albumId")));
+            const std::unordered_map<int, QStringList> genres(loadTitles(QLatin1String("genres"), QLatin1String("tracks_genres"), QLatin1String("genreId")));
+            const auto titlesOf = [](const std::unordered_map<int, QStringList>& titles, int id) {
+                const auto found(titles.find(id));
+                return found == titles.end() ? QStringList() : found->second;
+            };
+
+            // Embedded media art is copied to media art directory, only once for each file
+            std::unordered_map<QString, bool> copiedMediaArt;
+            const auto importMediaArt = [&](const QString& mediaArt) -> QString {
+                if (mediaArt.startsWith(importVolumePlaceholder)) {
+                    return root + mediaArt.mid(importVolumePlaceholder.size());
+                }
+                if (!mediaArt.startsWith(importMediaArtPlaceholder)) {
+                    return QString();
+                }
+                const QString fileName(mediaArt.mid(importMediaArtPlaceholder.size()));
+                const QString filePath(mMediaArtDirectory + fileName);
+                auto found(copiedMediaArt.find(fileName));
+                if (found == copiedMediaArt.end()) {
+                    const bool copied = QFileInfo::exists(filePath) || QFile::copy(importedMediaArtDirectory + fileName, filePath);
+                    if (!copied) {
+                        qWarning() << "failed to copy imported media art" << fileName;
+                    }
+                    found = copiedMediaArt.insert({fileName, copied}).first;
+                }
+                return found->second ? filePath : QString();
+            };
+
+            SqlQuery query(QLatin1String("SELECT id, filePath, modificationTime, fileSize, title, year, trackNumber, "
+                                         "discNumber, duration, mediaArt, embeddedMediaArtHash, durationEstimated, bitrate, sampleRate, "
+                                         "channels, replayGainTrack, replayGainAlbum, replayGainTrackPeak, replayGainAlbumPeak "
+                                         "FROM imported.tracks"), db);
+            if (query.lastError().type() != QSqlError::NoError) {
+                qWarning() << "failed to get imported tracks" << query.lastError();
+            }
+
+            TracksWriter writer(db);
+            int importedCount = 0;
+            int skippedCount = 0;
+            while (query.next()) {
+                if (isStopped()) {
+                    qWarning() << "stop importing library";
+                    break;
+                }
+
+                QString filePath(query.value(1).toString());
+                if (!filePath.startsWith(importVolumePlaceholder)) {
+                    ++skippedCount;
+                    continue;
+                }
+                filePath.replace(0, importVolumePlaceholder.size(), root);
+                // Tracks outside of library directories would be removed by next scan
+                if (tracksInDb.count(filePath) > 0 || !isInLibrary(filePath) || isBlacklisted(filePath)) {
+                    ++skippedCount;
+                    continue;
+                }
+
+                const int id = query.value(0).toInt();
+                tagutils::Info info;
+                info.title = query.value(4).toString();
+                info.artists = titlesOf(artists, id);
+                info.albums = titlesOf(albums, id);
+                info.year = query.value(5).toInt();
+                info.trackNumber = query.value(6).toInt();
+                info.genres = titlesOf(genres, id);
+                info.discNumber = query.value(7).toString();
+                info.duration = query.value(8).toInt();
+                info.durationEstimated = query.value(11).toBool();
+                info.bitrate = query.value(12).toInt();
+                info.sampleRate = query.value(13).toInt();
+                info.channels = query.value(14).toInt();
+                const auto gain = [&](int column) {
+                    return query.isNull(column) ? std::numeric_limits<double>::quiet_NaN() : query.value(column).toDouble();
+                };
+                info.replayGainTrack = gain(15);
+                info.replayGainAlbum = gain(16);
+                info.replayGainTrackPeak = gain(17);
+                info.replayGainAlbumPeak = gain(18);
+
+                long long modificationTime = query.value(2).toLongLong();
+#if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
+                // Modification times are compared with second precision here, see fileutils::listFiles()
+                modificationTime -= modificationTime % 1000;
+#endif
+
+                const QString mediaArt(query.value(9).toString());
+                const QString importedMediaArt(importMediaArt(mediaArt));
+                // If media art was not copied, scan will look for it again
+                QString embeddedMediaArtHash;
+                if (importedMediaArt.isEmpty() == mediaArt.isEmpty() && !query.isNull(10)) {
+                    embeddedMediaArtHash = emptyIfNull(query.value(10).toString());
+                }
+
+                writer.updateTrackInDatabase(false,
+                                             ++lastId,
+                                             QFileInfo(filePath),
+                                             modificationTime,
+                                             query.value(3).toLongLong(),
+                                             info,
+                                             importedMediaArt,
+                                             embeddedMediaArtHash);
+                ++importedCount;
+                if (writer.isCommitNeeded()) {
+                    writer.commit();
+                }
+            }
+            query.finish();
+            qDebug() << "imported" << importedCount << "tracks," << skippedCount << "were skipped";
+
+            writer.removeUnusedEntries();
+            LibraryUtils::updateSummaries(db);
+
+            db.commit();
+            writer.notifyChanges();
+        }
+
+        detach();
+        qDebug() << "end importing library" << time.msecsTo(QTime::currentTime());
+    }
+
+    void LibraryUpdater::loadDirectories()
+    {
+        const auto prepareDirs = [](QStringList&& dirs) {
+            dirs.removeDuplicates();
+            for (QString& dir : dirs) {
+                if (!dir.endsWith(QLatin1Char('/'))) {
+                    dir.push_back(QLatin1Char('/'));
+                }
+            }
+            return dirs;
+        };
+        mLibraryDirectories = prepareDirs(Settings::instance()->libraryDirectories());
+        mBlacklistedDirectories = prepareDirs(Settings::instance()->blacklistedDirectories());
+        mBlacklist.clear();
+        for (const QString& directory : mBlacklistedDirectories) {
+            mBlacklist.insert(directory);
+        }
+        mNoMediaDirectories.clear();
+        mVisitedDirectories.clear();
+        mVisitedFiles.clear();
+    }
+
+    bool LibraryUpdater::isInLibrary(const QString& path) const
+    {
+        for (const QString& directory : mLibraryDirectories) {
+            if (path.startsWith(directory)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool LibraryUpdater::isBlacklisted(const QString& path) const
+    {
+        return mBlacklist.containsPath(path);
+    }
+
+    bool LibraryUpdater::visitFile(const QString& filePath)
+    {
+        return insertFileId(mVisitedFiles, filePath);
+    }
+
+    bool LibraryUpdater::walkDirectories(const QString& directory,
+                                         const std::function<bool(const QFileInfo&)>& processDirectory,
+                                         const std::function<bool(const QFileInfo&, std::vector<QFileInfo>&)>& cachedSubdirectories)
+    {
+        std::vector<QFileInfo> pending{QFileInfo(directory)};
+        while (!pending.empty()) {
+            const QFileInfo directoryInfo(pending.back());
+            pending.pop_back();
+
+            const QString path(directoryInfo.filePath());
+            if (isBlacklisted(path + QLatin1Char('/'))) {
+                // Whole subtree is skipped without listing it
+                continue;
+            }
+            // Symlink loops and other paths to directories which were already walked
+            {
+                const QMutexLocker locker(&mWalkMutex);
+                if (!insertFileId(mVisitedDirectories, path)) {
+                    continue;
+                }
+            }
+
+            if (!processDirectory(directoryInfo)) {
+                return false;
+            }
+
+            std::vector<QFileInfo> cached;
+            if (cachedSubdirectories && cachedSubdirectories(directoryInfo, cached)) {
+                for (auto i = cached.rbegin(), end = cached.rend(); i != end; ++i) {
+                    pending.push_back(std::move(*i));
+                }
+                continue;
+            }
+
+            const QFileInfoList subdirectories(QDir(path).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot));
+            // Reversed so that subdirectories are processed in listing order
+            for (auto i = subdirectories.crbegin(), end = subdirectories.crend(); i != end; ++i) {
+                pending.push_back(*i);
+            }
+        }
+        return true;
+    }
+
+    void LibraryUpdater::loadVolumes(const QSqlDatabase& db)
+    {
+        mVolumes.clear();
+        mOfflineDirectories.clear();
+
+        SqlQuery query(QLatin1String("SELECT libraryDirectory, rootPath FROM volumes"), db);
+        if (query.lastError().type() != QSqlError::NoError) {
+            qWarning() << "failed to get volumes from database" << query.lastError();
+            return;
+        }
+
+        QStringList mountedRootPaths;
+        for (const QStorageInfo& storage : QStorageInfo::mountedVolumes()) {
+            if (storage.isValid() && storage.isReady()) {
+                mountedRootPaths.push_back(storage.rootPath());
+            }
+        }
+
+        while (query.next()) {
+            const QString directory(query.value(0).toString());
+            const QString rootPath(query.value(1).toString());
+            mVolumes.insert({directory, rootPath});
+            // If volume is mounted, directory was removed
+            if (mLibraryDirectories.contains(directory) &&
+                    !QFileInfo(directory).isDir() &&
+                    !mountedRootPaths.contains(rootPath)) {
+                qDebug() << "volume of library directory" << directory << "is not mounted, keeping its tracks";
+                mOfflineDirectories.push_back(directory);
+            }
+        }
+    }
+
+    void LibraryUpdater::saveVolumes(const QSqlDatabase& db)
+    {
+        SqlQuery query(db);
+        if (!query.exec(QLatin1String("DELETE FROM volumes"))) {
+            qWarning() << "failed to clear volumes table" << query.lastError();
+            return;
+        }
+
+        query.prepare(QStringLiteral("INSERT INTO volumes (libraryDirectory, rootPath) VALUES (?, ?)"));
+        for (const QString& directory : mLibraryDirectories) {
+            QString rootPath;
+            if (mOfflineDirectories.contains(directory)) {
+                rootPath = mVolumes[directory];
+            } else {
+                const QStorageInfo storage(directory);
+                if (!storage.isValid()) {
+                    continue;
+                }
+                rootPath = storage.rootPath();
+            }
+            query.addBindValue(directory);
+            query.addBindValue(rootPath);
+            if (!query.exec()) {
+                qWarning() << "failed to insert volume in the database" << query.lastError();
+            }
+        }
+    }
+
+    bool LibraryUpdater::isOffline(const QString& path) const
+    {
+        for (const QString& directory : mOfflineDirectories) {
+            if (path.startsWith(directory) || (path.size() == directory.size() - 1 && directory.startsWith(path))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    QString LibraryUpdater::addThumbnail(ThumbnailAtlasWriter& atlas, const QString& mediaArt, int size)
+    {
+        const QString key(thumbnailKey(mediaArt, size));
+        const QString existing(atlas.find(key));
+        if (!existing.isEmpty()) {
+            return existing;
+        }
+        const Thumbnail created(createThumbnail(mediaArt, size));
+        return created.data.isEmpty() ? created.filePath : atlas.add(key, created.data, created.placeholder);
+    }
+
+    void LibraryUpdater::updateThumbnails(const QSqlDatabase& db)
+    {
+        std::vector<QString> mediaArt;
+        {
+            SqlQuery query(QLatin1String("SELECT DISTINCT(mediaArt) FROM tracks WHERE mediaArt != '' AND mediaArtThumbnail IS NULL"), db);
+            while (query.next()) {
+                mediaArt.push_back(query.value(0).toString());
+            }
+        }
+
+        if (!mediaArt.empty()) {
+            qDebug() << "creating thumbnails for" << mediaArt.size() << "images";
+
+            ThumbnailAtlasWriter atlas(mMediaArtDirectory, db);
+
+            QThreadPool workers;
+            workers.setMaxThreadCount(Settings::instance()->libraryUpdateThreadsCount());
+
+            // Thumbnails that are already in atlas are not created again
+            std::vector<QString> keys;
+            std::vector<QString> existing;
+            std::vector<QFuture<Thumbnail>> thumbnails;
+            keys.reserve(mediaArt.size());
+            existing.reserve(mediaArt.size());
+            thumbnails.reserve(mediaArt.size());
+            for (const QString& filePath : mediaArt) {
+                keys.push_back(thumbnailKey(filePath, mThumbnailSize));
+                existing.push_back(atlas.find(keys.back()));
+                if (existing.back().isEmpty()) {
+                    thumbnails.push_back(QtConcurrent::run(&workers, createThumbnail, filePath, mThumbnailSize));
+                } else {
+                    thumbnails.push_back(QFuture<Thumbnail>());
+                }
+            }
+
+            SqlQuery query(db);
+            query.prepare(QStringLiteral("UPDATE tracks SET mediaArtThumbnail = ? WHERE mediaArt = ?"));
+            for (std::size_t i = 0, max = mediaArt.size(); i < max; ++i) {
+                QString thumbnail(existing[i]);
+                if (thumbnail.isEmpty()) {
+                    const Thumbnail created(thumbnails[i].result());
+                    thumbnail = created.data.isEmpty() ? created.filePath : atlas.add(keys[i], created.data, created.placeholder);
+                }
+                query.bindValue(0, emptyIfNull(thumbnail));
+                query.bindValue(1, mediaArt[i]);
+                if (!query.exec()) {
+                    qWarning() << "failed to update thumbnail" << query.lastError();
+                }
+            }
+        }
+    }
+
+    void LibraryUpdater::removeUnusedMediaArt(const QSqlDatabase& db, const std::vector<QString>& savedFiles)
+    {
+        if (!savedFiles.empty()) {
+            SqlQuery query(db);
+            query.prepare(QStringLiteral("INSERT OR IGNORE INTO mediaArtFiles (filePath, refCount) VALUES (?, 0)"));
+            for (const QString& filePath : savedFiles) {
+                query.bindValue(0, filePath);
+                if (!query.exec()) {
+                    qWarning() << "failed to insert media art file in the database" << query.lastError();
+                }
+            }
+        }
+
+        SqlQuery query(QLatin1String("SELECT filePath FROM mediaArtFiles WHERE refCount <= 0"), db);
+        if (query.lastError().type() != QSqlError::NoError) {
+            qWarning() << "failed to get unused media art from database" << query.lastError();
+            return;
+        }
+
+        // Directories media art is counted too, but only our own files are removed
+        const QString prefix(mMediaArtDirectory + QLatin1Char('/'));
+        int count = 0;
+        while (query.next()) {
+            const QString filePath(query.value(0).toString());
+            if (filePath.startsWith(prefix)) {
+                if (!QFile::remove(filePath) && QFile::exists(filePath)) {
+                    qWarning() << "failed to remove file:" << filePath;
+                }
+                ++count;
+            }
+        }
+        if (count > 0) {
+            qDebug() << "removed" << count << "unused media art files";
+        }
+
+        if (!query.exec(QLatin1String("DELETE FROM mediaArtFiles WHERE refCount <= 0"))) {
+            qWarning() << "failed to remove unused media art from database" << query.lastError();
+        }
+
+        ThumbnailAtlasWriter atlas(mMediaArtDirectory, db);
+        atlas.removeUnused();
+        atlas.addMissingPlaceholders();
+    }
+
+    LibraryChanges LibraryUpdater::refineDurations(const QSqlDatabase& db)
+    {
+        std::vector<std::pair<int, QString>> tracks;
+        {
+            SqlQuery query(QLatin1String("SELECT id, filePath FROM tracks WHERE durationEstimated = 1"), db);
+            if (query.lastError().type() != QSqlError::NoError) {
+                qWarning() << "failed to get tracks with estimated duration" << query.lastError();
+                return LibraryChanges();
+            }
+            while (query.next()) {
+                tracks.push_back({query.value(0).toInt(), query.value(1).toString()});
+            }
+        }
+
+        if (tracks.empty()) {
+            return LibraryChanges();
+        }
+
+        qDebug() << "refining durations of" << tracks.size() << "files";
+        UNPLAYER_TRACE("scan: refine durations");
+
+        SqlQuery query(db);
+        query.prepare(QStringLiteral("UPDATE tracks SET duration = ?, durationEstimated = 0 WHERE id = ?"));
+        QStringList ids;
+        for (const auto& track : tracks) {
+            if (isStopped()) {
+                // The rest is refined on next scan
+                qWarning() << "stop refining durations";
+                break;
+            }
+            const int duration = tagutils::getExactMpegDuration(track.second);
+            if (duration < 0) {
+                continue;
+            }
+            query.bindValue(0, duration);
+            query.bindValue(1, track.first);
+            if (!query.exec()) {
+                qWarning() << "failed to update duration" << query.lastError();
+                continue;
+            }
+            ids.push_back(QString::number(track.first));
+        }
+
+        if (ids.isEmpty()) {
+            return LibraryChanges();
+        }
+        LibraryUtils::updateSummaries(db);
+        return LibraryChanges::forTracks(db, ids.join(QLatin1Char(',')));
+    }
+
+    bool LibraryUpdater::isNoMediaDirectory(const QString& directory)
+    {
+        {
+            const QMutexLocker locker(&mWalkMutex);
+            const auto found(mNoMediaDirectories.find(directory));
+            if (found != mNoMediaDirectories.end()) {
+                return found->second;
+            }
+        }
+        const bool noMedia = QFileInfo(directory + QStringLiteral("/.nomedia")).isFile();
+        const QMutexLocker locker(&mWalkMutex);
+        mNoMediaDirectories.insert({directory, noMedia});
+        return noMedia;
+    }
+
+    bool LibraryUpdater::isStopped() const
+    {
+        return !qApp || mProgress->cancelled;
+    }
+
+    void LibraryUpdater::run()
+    {
+        qDebug() << "start scanning files";
+        const QTime time(QTime::currentTime());
+        {
+            UNPLAYER_TRACE("scan");
+
+            // Open database
+            auto db = LibraryUtils::threadDatabase(mDatabaseFilePath);
+            if (!db.isOpen()) {
+                return;
+            }
+            db.transaction();
+
+            // Create media art directory
+            if (!QDir().mkpath(mMediaArtDirectory)) {
+                qWarning() << "failed to create media art directory:" << mMediaArtDirectory;
+            }
+
+            loadDirectories();
+            loadVolumes(db);
+
+            // Files from database that were not found on disk will be removed
+            TracksInDb tracksInDb;
+            int lastId = -1;
+
+            // Media art files of tracks and whether they exist.
+            // Tracks point to its elements, which are not moved by rehashing
+            std::unordered_map<QString, bool> mediaArtExistanceHash;
+            int deletedMediaArtCount = 0;
+
+            std::vector<int> filesToRemove;
+            TracksWriter writer(db);
+            Quarantine quarantine(db);
+
+            {
+                UNPLAYER_TRACE("scan: load tracks");
+                SqlQuery query(QLatin1String("SELECT id, filePath, modificationTime, mediaArt, embeddedMediaArtHash, fileSize FROM tracks ORDER BY id"), db);
+                if (query.lastError().type() != QSqlError::NoError) {
+                    qWarning() << "failed to get files from database" << query.lastError();
+                    db.rollback();
+                    return;
+                }
+
+                while (query.next()) {
+                    const int id(query.value(0).toInt());
+                    const QString filePath(query.value(1).toString());
+
+                    lastId = id;
+
+                    // Tracks on volume that is not mounted are left as they are
+                    if (isOffline(filePath)) {
+                        continue;
+                    }
+
+                    // Existence of file is checked when walking directories
+                    if (!isInLibrary(filePath) || isBlacklisted(filePath)) {
+                        filesToRemove.push_back(id);
+                        continue;
+                    }
+
+                    const QString mediaArt(query.value(3).toString());
+                    const TracksInDb::MediaArtFile* mediaArtFile = nullptr;
+                    if (!mediaArt.isEmpty()) {
+                        mediaArtFile = &*mediaArtExistanceHash.insert({mediaArt, false}).first;
+                    }
+
+                    const int slashIndex = filePath.lastIndexOf(QLatin1Char('/'));
+                    tracksInDb.add(filePath.left(slashIndex), {id,
+                                                               -1,
+                                                               query.value(2).toLongLong(),
+                                                               query.value(5).toLongLong(),
+                                                               filePath.mid(slashIndex + 1),
+                                                               mediaArtFile,
+                                                               query.isNull(4) ? QString() : emptyIfNull(query.value(4).toString()),
+                                                               false});
+                }
+                tracksInDb.finish();
+                qDebug() << "loaded" << tracksInDb.records().size() << "tracks from database," << tracksInDb.memoryUsage() / 1024 << "KiB of records";
+            }
+
+            {
+                UNPLAYER_TRACE("scan: check media art");
+                checkFilesExistence(mediaArtExistanceHash, mMediaArtDirectory, Settings::instance()->libraryUpdateThreadsCount());
+                for (const auto& i : mediaArtExistanceHash) {
+                    if (!i.second) {
+                        ++deletedMediaArtCount;
+                    }
+                }
+            }
+
+            // Tracks keyed by modification time, to find those which files were moved or renamed.
+            // Records of tracksInDb are not moved after it is filled
+            struct MoveCandidate
+            {
+                QString filePath;
+                TracksInDb::Record* file;
+            };
+            std::unordered_multimap<long long, MoveCandidate> moveCandidates;
+            for (TracksInDb::Record& file : tracksInDb.records()) {
+                if (file.fileSize > 0) {
+                    moveCandidates.insert({file.modificationTime, {tracksInDb.filePath(file), &file}});
+                }
+            }
+            int movedFiles = 0;
+
+            const bool preferDirectoryMediaArt = Settings::instance()->useDirectoryMediaArt();
+
+            // Modification times of directories from previous scan.
+            // If settings that affect the result of scan have changed, scan everything
+            std::unordered_map<QString, long long> directoriesInDb;
+            // Whether directories table has all subdirectories of walked directories,
+            // i.e. previous scan was not interrupted
+            bool directoriesComplete = false;
+            const QString scanSettings(scanSettingsString(preferDirectoryMediaArt, mBlacklistedDirectories));
+            const QString lastScanSettings([&]() {
+                SqlQuery query(QLatin1String("SELECT value FROM libraryState WHERE key = 'scanSettings'"), db);
+                if (query.next()) {
+                    return query.value(0).toString();
+                }
+                return QString();
+            }());
+            if (lastScanSettings == scanSettings) {
+                SqlQuery query(QLatin1String("SELECT path, modificationTime FROM directories"), db);
+                if (query.lastError().type() == QSqlError::NoError) {
+                    while (query.next()) {
+                        directoriesInDb.insert({query.value(0).toString(), query.value(1).toLongLong()});
+                    }
+                } else {
+                    qWarning() << "failed to get directories from database" << query.lastError();
+                }
+                directoriesComplete = SqlQuery(QLatin1String("SELECT 1 FROM libraryState WHERE key = 'directoriesComplete'"), db).next();
+            }
+
+            // Directories on network file systems which haven't changed are not listed,
+            // their subdirectories are taken from previous scan
+            const std::vector<QString> networkLibraryDirectories(networkDirectories(mLibraryDirectories));
+            std::unordered_map<QString, std::vector<QString>> subdirectoriesInDb;
+            if (!networkLibraryDirectories.empty() && directoriesComplete) {
+                for (const auto& i : directoriesInDb) {
+                    const int index = i.first.lastIndexOf(QLatin1Char('/'));
+                    if (index > 0) {
+                        subdirectoriesInDb[i.first.left(index)].push_back(i.first);
+                    }
+                }
+                for (auto& i : subdirectoriesInDb) {
+                    std::sort(i.second.begin(), i.second.end());
+                }
+            }
+            std::unordered_map<QString, long long> directories;
+            // Keep directories on volume that is not mounted so that they are not listed when it comes back
+            for (const auto& i : directoriesInDb) {
+                if (isOffline(i.first)) {
+                    directories.insert(i);
+                }
+            }
+
+            const auto removeTracks = [&]() {
+                writer.removeTracks(filesToRemove);
+                filesToRemove.clear();
+            };
+
+            // Walked directories which files may still be waiting to be written.
+            // When all files of directory are written, it is saved on checkpoint
+            // so that scan that was interrupted doesn't list it again
+            struct WalkedDirectory
+            {
+                QString path;
+                long long modificationTime;
+                std::size_t enqueuedFiles;
+            };
+            std::deque<WalkedDirectory> walkedDirectories;
+            std::size_t enqueuedFiles = 0;
+            std::size_t writtenFiles = 0;
+            bool scanSettingsSaved = false;
+
+            // Saves progress of scan together with written tracks
+            const auto checkpoint = [&]() {
+                SqlQuery query(db);
+                if (!scanSettingsSaved) {
+                    // Directories of previous scan are not valid for current settings
+                    if (lastScanSettings != scanSettings && !query.exec(QLatin1String("DELETE FROM directories"))) {
+                        qWarning() << "failed to clear directories table" << query.lastError();
+                    }
+                    // Subdirectories of directories written here may be not written yet
+                    if (!query.exec(QLatin1String("DELETE FROM libraryState WHERE key = 'directoriesComplete'"))) {
+                        qWarning() << "failed to save scan state" << query.lastError();
+                    }
+                    query.prepare(QStringLiteral("INSERT OR REPLACE INTO libraryState (key, value) VALUES ('scanSettings', ?)"));
+                    query.addBindValue(scanSettings);
+                    if (!query.exec()) {
+                        qWarning() << "failed to save scan settings" << query.lastError();
+                    }
+                    scanSettingsSaved = true;
+                }
+
+                query.prepare(QStringLiteral("INSERT OR REPLACE INTO directories (path, modificationTime) VALUES (?, ?)"));
+                while (!walkedDirectories.empty() && walkedDirectories.front().enqueuedFiles <= writtenFiles) {
+                    const WalkedDirectory& directory = walkedDirectories.front();
+                    query.addBindValue(directory.path);
+                    query.addBindValue(directory.modificationTime);
+                    if (!query.exec()) {
+                        qWarning() << "failed to insert directory in the database" << query.lastError();
+                    }
+
+                    // Files that were not found in directory. Resumed scan
+                    // will not list it and would consider them present
+                    for (TracksInDb::Record& file : tracksInDb.files(tracksInDb.directory(directory.path))) {
+                        if (!file.seen) {
+                            file.seen = true;
+                            filesToRemove.push_back(file.id);
+                        }
+                    }
+
+                    walkedDirectories.pop_front();
+                }
+
+                removeTracks();
+                writer.commit();
+            };
+
+            MediaArtCache mediaArtCache(mMediaArtDirectory);
+            {
+                // Deleted embedded media art is extracted again
+                std::unordered_set<QString> deletedMediaArt;
+                for (const auto& i : mediaArtExistanceHash) {
+                    if (!i.second) {
+                        deletedMediaArt.insert(i.first);
+                    }
+                }
+                mediaArtCache.loadEmbeddedMediaArtFiles(db, deletedMediaArt);
+            }
+            mediaArtCache.setNetworkDirectories(networkLibraryDirectories);
+
+            // Tag reader workers
+            QThreadPool workers;
+            if (networkLibraryDirectories.empty()) {
+                workers.setMaxThreadCount(Settings::instance()->libraryUpdateThreadsCount());
+            } else {
+                workers.setMaxThreadCount(std::max(Settings::instance()->libraryUpdateThreadsCount(), networkReaderThreadsCount));
+            }
+            const std::size_t maxPendingFiles = workers.maxThreadCount() * pendingFilesPerThread;
+            qDebug() << "using" << workers.maxThreadCount() << "threads to extract tags";
+
+            // Files are written in the same order as they were found
+            std::deque<std::pair<ScanTask, QFuture<ScanResult>>> pendingFiles;
+
+            // Tags are written first, media art is extracted when all directories are walked
+            std::vector<ScanTask> deferredFiles;
+
+            std::unordered_map<QString, DirectoryScanStatistics> directoryStatistics;
+
+            const auto writeFile = [&]() {
+                auto& pending = pendingFiles.front();
+                const ScanTask& task = pending.first;
+                const ScanResult result(pending.second.result());
+
+                DirectoryScanStatistics& statistics = directoryStatistics[task.fileInfo.path()];
+                statistics.time += result.readTime;
+                statistics.bytesRead += result.fileSize;
+                if (result.parseError) {
+                    ++statistics.errors;
+                    qWarning() << "failed to parse file" << task.fileInfo.filePath();
+                }
+
+                if (task.state != FileState::Unchanged) {
+                    ++mProgress->processedFiles;
+                    ++statistics.parsedFiles;
+                    if (result.budgetExceeded) {
+                        quarantine.add(task.fileInfo.filePath(), task.modificationTime);
+                    } else {
+                        quarantine.remove(task.fileInfo.filePath());
+                    }
+                }
+                mProgress->bytesRead += result.fileSize;
+
+                switch (task.state) {
+                case FileState::New:
+                    if (result.isAudio) {
+                        writer.updateTrackInDatabase(false, ++lastId, task.fileInfo, task.modificationTime, result.fileSize, result.info, result.mediaArt, result.embeddedMediaArtHash);
+                        if (result.mediaArtDeferred) {
+                            deferredFiles.push_back({FileState::Unchanged, lastId, task.fileInfo, task.modificationTime, result.mediaArt, false, QString()});
+                        }
+                    }
+                    break;
+                case FileState::Changed:
+                    if (result.isAudio) {
+                        writer.updateTrackInDatabase(true, task.id, task.fileInfo, task.modificationTime, result.fileSize, result.info, result.mediaArt, result.embeddedMediaArtHash);
+                        if (result.mediaArtDeferred) {
+                            deferredFiles.push_back({FileState::Unchanged, task.id, task.fileInfo, task.modificationTime, result.mediaArt, false, QString()});
+                        }
+                    } else {
+                        filesToRemove.push_back(task.id);
+                    }
+                    break;
+                case FileState::Unchanged:
+                    if (result.mediaArtChanged) {
+                        writer.updateMediaArt(task.id, result.mediaArt, result.embeddedMediaArtHash);
+                    }
+                    break;
+                }
+
+                pendingFiles.pop_front();
+                ++writtenFiles;
+                if (writer.isCommitNeeded()) {
+                    checkpoint();
+                }
+            };
+
+            const auto enqueueFile = [&](ScanTask&& task) {
+                while (pendingFiles.size() >= maxPendingFiles) {
+                    writeFile();
+                }
+                // Backs off while music is playing or on battery with display off
+                ScanThrottle::throttle();
+                // FIXME: use init capture when we switch to C++14
+                const QFuture<ScanResult> future(QtConcurrent::run(&workers, std::bind(readTrack,
+                                                                                       task,
+                                                                                       std::ref(mediaArtCache),
+                                                                                       preferDirectoryMediaArt,
+                                                                                       true)));
+                pendingFiles.emplace_back(std::move(task), future);
+                ++enqueuedFiles;
+            };
+
+            const auto writeAllFiles = [&]() {
+                while (!pendingFiles.empty()) {
+                    writeFile();
+                }
+            };
+
+            const auto processUnchangedFile = [&](const QFileInfo& fileInfo, const TracksInDb::Record& file) {
+                const int id = file.id;
+                const bool deleted = file.isMediaArtDeleted();
+                const QString mediaArt(file.mediaArt && !deleted ? file.mediaArt->first : QString());
+
+                const bool embeddedOrManual = mediaArt.startsWith(mMediaArtDirectory);
+                const bool embedded = embeddedOrManual && mediaArt.contains(QStringLiteral("-embedded"));
+                // Local copy of media art of directory on network file system
+                const bool copied = embeddedOrManual && mediaArt.contains(QStringLiteral("-directory"));
+                const bool manual = embeddedOrManual && !embedded && !copied;
+
+                if (manual) {
+                    return;
+                }
+
+                if (!embedded || preferDirectoryMediaArt) {
+                    deferredFiles.push_back({FileState::Unchanged, id, fileInfo, file.modificationTime, mediaArt, deleted, file.embeddedMediaArtHash});
+                }
+            };
+
+            // Returns track which file has the same size and modification time as new file,
+            // was not found yet and doesn't exist at its path anymore.
+            // If there are several such tracks, one with the same file name is preferred
+            const auto findMovedFile = [&](const fileutils::FileEntry& entry) -> TracksInDb::Record* {
+                const QString fileName(entry.filePath.mid(entry.filePath.lastIndexOf(QLatin1Char('/'))));
+                TracksInDb::Record* moved = nullptr;
+                bool ambiguous = false;
+                const auto range(moveCandidates.equal_range(entry.modificationTime));
+                for (auto i = range.first; i != range.second; ++i) {
+                    const MoveCandidate& candidate = i->second;
+                    if (candidate.file->seen || candidate.file->fileSize != entry.size || QFileInfo::exists(candidate.filePath)) {
+                        continue;
+                    }
+                    if (candidate.filePath.endsWith(fileName)) {
+                        return candidate.file;
+                    }
+                    ambiguous = moved != nullptr;
+                    moved = candidate.file;
+                }
+                return ambiguous ? nullptr : moved;
+            };
+
+            // Only files with these suffixes are listed
+            FlatHashSet<QByteArray> suffixes;
+            for (const QString& suffix : LibraryUtils::mimeTypesExtensions) {
+                suffixes.insert(QFile::encodeName(suffix));
+            }
+
+            // directoryInDb is index of entry's directory in tracksInDb, or -1
+            const auto processFile = [&](const fileutils::FileEntry& entry,
+                                         bool noMedia,
+                                         int directoryInDb) {
+                const QString& filePath = entry.filePath;
+
+                // Another path to file that was already processed.
+                // If it is in database, it is removed as not found
+                if (entry.inode != 0 && !mVisitedFiles.insert({entry.device, entry.inode}).second) {
+                    return;
+                }
+
+                TracksInDb::Record* fileInDb = tracksInDb.find(directoryInDb, filePath.midRef(filePath.lastIndexOf(QLatin1Char('/')) + 1));
+
+                // Not stat'ed again, QFileInfo is used only by tag reader workers
+                const QFileInfo fileInfo(filePath);
+
+                if (!fileInDb) {
+                    // File is not in database
+
+                    if (noMedia) {
+                        return;
+                    }
+
+                    ++mProgress->discoveredFiles;
+                    if (quarantine.contains(filePath, entry.modificationTime)) {
+                        ++mProgress->skippedFiles;
+                        return;
+                    }
+
+                    TracksInDb::Record* moved = findMovedFile(entry);
+                    if (moved) {
+                        // Old path of file is not removed from tracksInDb,
+                        // it is marked as seen so that track is not removed
+                        moved->seen = true;
+                        writer.moveTrack(moved->id, filePath);
+                        ++movedFiles;
+                        ++mProgress->skippedFiles;
+                        // Directory media art may be different in new directory
+                        processUnchangedFile(fileInfo, *moved);
+                        return;
+                    }
+
+                    enqueueFile({FileState::New, -1, fileInfo, entry.modificationTime, QString(), false, QString()});
+                } else {
+                    // File is in database
+
+                    if (noMedia) {
+                        return;
+                    }
+
+                    TracksInDb::Record& file = *fileInDb;
+                    file.seen = true;
+                    ++mProgress->discoveredFiles;
+
+                    if (entry.modificationTime == file.modificationTime) {
+                        // File has not changed
+                        ++mProgress->skippedFiles;
+                        if (file.fileSize != entry.size) {
+                            file.fileSize = entry.size;
+                            writer.updateFileSize(file.id, entry.size);
+                        }
+                        processUnchangedFile(fileInfo, file);
+                    } else if (quarantine.contains(filePath, entry.modificationTime)) {
+                        ++mProgress->skippedFiles;
+                    } else {
+                        // File has changed
+                        enqueueFile({FileState::Changed, file.id, fileInfo, entry.modificationTime, QString(), false, QString()});
+                    }
+                }
+            };
+
+            // Does all I/O of directory except reading of tags
+            const auto makeListing = [&](const QFileInfo& directoryInfo) {
+                DirectoryListing listing;
+                listing.path = directoryInfo.filePath();
+                listing.modificationTime = directoryInfo.lastModified().toMSecsSinceEpoch();
+                const auto foundInDb(directoriesInDb.find(listing.path));
+                listing.listed = foundInDb == directoriesInDb.end() || foundInDb->second != listing.modificationTime;
+                listing.noMedia = false;
+                if (listing.listed) {
+                    listing.noMedia = isNoMediaDirectory(listing.path);
+                    listing.entries = fileutils::listFiles(listing.path, suffixes);
+                }
+                return listing;
+            };
+
+            // Directories that were listed out of order because user opened them.
+            // Guarded by mWalkMutex
+            std::unordered_set<QString> hotDirectories;
+
+            // Called on walker threads. Returns false if scan should be stopped
+            const auto listDirectory = [&](const QFileInfo& directoryInfo, DirectoryListingQueue& queue) {
+                if (isStopped()) {
+                    return false;
+                }
+                {
+                    // Subdirectories are still walked
+                    const QMutexLocker locker(&mWalkMutex);
+                    if (!hotDirectories.empty() && hotDirectories.count(directoryInfo.filePath()) > 0) {
+                        return true;
+                    }
+                }
+                return queue.push(makeListing(directoryInfo));
+            };
+
+            const auto processDirectory = [&](const DirectoryListing& listing) {
+                const QString& directory = listing.path;
+                mProgress->setCurrentDirectory(directory);
+                const long long modificationTime = listing.modificationTime;
+                directories.insert({directory, modificationTime});
+
+                const int directoryInDb = tracksInDb.directory(directory);
+
+                if (!listing.listed) {
+                    // No files were added, removed or renamed, don't list directory
+                    const TracksInDb::Range directoryFiles(tracksInDb.files(directoryInDb));
+                    mProgress->discoveredFiles += directoryFiles.size();
+                    mProgress->skippedFiles += directoryFiles.size();
+                    for (TracksInDb::Record& file : directoryFiles) {
+                        file.seen = true;
+                        // Only try to find media art again if it was deleted,
+                        // or if its extraction was interrupted
+                        if (file.isMediaArtDeleted() ||
+                                (file.embeddedMediaArtHash.isNull() && (!preferDirectoryMediaArt || !file.mediaArt))) {
+                            processUnchangedFile(QFileInfo(tracksInDb.filePath(file)), file);
+                        }
+                    }
+                    walkedDirectories.push_back({directory, modificationTime, enqueuedFiles});
+                    return;
+                }
+
+                directoryStatistics[directory].examinedFiles += static_cast<int>(listing.entries.size());
+                for (const fileutils::FileEntry& entry : listing.entries) {
+                    processFile(entry, listing.noMedia, directoryInDb);
+                }
+                walkedDirectories.push_back({directory, modificationTime, enqueuedFiles});
+            };
+
+            // Lists directories that user has opened before queued listings,
+            // unless walkers have already reached them
+            const auto processHotDirectories = [&]() {
+                for (const QString& directory : mProgress->takeHotDirectories()) {
+                    if (!isInLibrary(directory + QLatin1Char('/')) || isBlacklisted(directory + QLatin1Char('/'))) {
+                        continue;
+                    }
+                    {
+                        const QMutexLocker locker(&mWalkMutex);
+                        std::pair<quint64, quint64> id;
+                        if (!fileId(directory, id) || mVisitedDirectories.count(id) > 0 || !hotDirectories.insert(directory).second) {
+                            continue;
+                        }
+                    }
+                    qDebug() << "scanning opened directory first" << directory;
+                    processDirectory(makeListing(QFileInfo(directory)));
+                }
+            };
+
+            // Library directories on each volume are walked by separate thread,
+            // so that listing of one device doesn't wait for another.
+            // Files are processed and written by this thread in the order they arrive
+            const auto walk = [&]() {
+                UNPLAYER_TRACE("scan: walk directories");
+
+                struct Volume
+                {
+                    QByteArray device;
+                    QStringList topLevelDirectories;
+                    bool network;
+                };
+                std::vector<Volume> volumes;
+                for (QString topLevelDirectory : mLibraryDirectories) {
+                    const bool network = contains(networkLibraryDirectories, topLevelDirectory);
+                    topLevelDirectory.chop(1);
+                    if (!QFileInfo(topLevelDirectory).isDir()) {
+                        continue;
+                    }
+                    const QByteArray device(QStorageInfo(topLevelDirectory).device());
+                    const auto found(std::find_if(volumes.begin(), volumes.end(), [&](const Volume& volume) {
+                        return volume.device == device;
+                    }));
+                    if (found == volumes.end()) {
+                        volumes.push_back({device, {topLevelDirectory}, network});
+                    } else {
+                        found->topLevelDirectories.push_back(topLevelDirectory);
+                    }
+                }
+                if (volumes.empty()) {
+                    return true;
+                }
+                if (volumes.size() > 1) {
+                    qDebug() << "walking" << volumes.size() << "volumes concurrently";
+                }
+
+                DirectoryListingQueue queue(static_cast<int>(volumes.size()));
+                QThreadPool walkers;
+                walkers.setMaxThreadCount(static_cast<int>(volumes.size()));
+                // Returns subdirectories of directory from previous scan if directory
+                // hasn't changed since then. Only they are stat'ed, instead of listing
+                // all entries of directory over network
+                const std::function<bool(const QFileInfo&, std::vector<QFileInfo>&)> cachedSubdirectories = [&](const QFileInfo& directoryInfo, std::vector<QFileInfo>& subdirectories) {
+                    const QString path(directoryInfo.filePath());
+                    const auto foundInDb(directoriesInDb.find(path));
+                    if (foundInDb == directoriesInDb.end() || foundInDb->second != directoryInfo.lastModified().toMSecsSinceEpoch()) {
+                        return false;
+                    }
+                    const auto found(subdirectoriesInDb.find(path));
+                    if (found != subdirectoriesInDb.end()) {
+                        for (const QString& subdirectory : found->second) {
+                            QFileInfo subdirectoryInfo(subdirectory);
+                            if (subdirectoryInfo.isDir()) {
+                                subdirectories.push_back(std::move(subdirectoryInfo));
+                            }
+                        }
+                    }
+                    return true;
+                };
+
+                for (const Volume& volume : volumes) {
+                    const QStringList topLevelDirectories(volume.topLevelDirectories);
+                    const bool network = volume.network && !subdirectoriesInDb.empty();
+                    QtConcurrent::run(&walkers, [&, topLevelDirectories, network]() {
+                        threadpools::setCurrentThreadClass(threadpools::JobClass::Scan);
+                        const auto process = [&](const QFileInfo& directoryInfo) {
+                            return listDirectory(directoryInfo, queue);
+                        };
+                        for (const QString& directory : topLevelDirectories) {
+                            if (!walkDirectories(directory, process, network ? cachedSubdirectories : nullptr)) {
+                                break;
+                            }
+                        }
+                        queue.walkerFinished();
+                    });
+                }
+
+                DirectoryListing listing;
+                while (!isStopped() && queue.pop(listing)) {
+                    processHotDirectories();
+                    processDirectory(listing);
+                }
+                queue.cancel();
+                walkers.waitForDone();
+                return !isStopped();
+            };
+
+            if (!walk()) {
+                qWarning() << "stop scanning files";
+                writeAllFiles();
+                checkpoint();
+                db.commit();
+                return;
+            }
+
+            writeAllFiles();
+
+            if (movedFiles > 0) {
+                qDebug() << "found" << movedFiles << "moved files";
+            }
+
+            for (const TracksInDb::Record& file : tracksInDb.records()) {
+                if (!file.seen) {
+                    filesToRemove.push_back(file.id);
+                }
+            }
+
+            {
+                SqlQuery query(QLatin1String("DELETE FROM directories"), db);
+                if (query.lastError().type() != QSqlError::NoError) {
+                    qWarning() << "failed to clear directories table" << query.lastError();
+                }
+
+                query.prepare(QStringLiteral("INSERT INTO directories (path, modificationTime) VALUES (?, ?)"));
+                for (const auto& i : directories) {
+                    query.addBindValue(i.first);
+                    query.addBindValue(i.second);
+                    if (!query.exec()) {
+                        qWarning() << "failed to insert directory in the database" << query.lastError();
+                    }
+                }
+
+                query.prepare(QStringLiteral("INSERT OR REPLACE INTO libraryState (key, value) VALUES ('scanSettings', ?)"));
+                query.addBindValue(scanSettings);
+                if (!query.exec()) {
+                    qWarning() << "failed to save scan settings" << query.lastError();
+                }
+
+                if (!query.exec(QLatin1String("INSERT OR REPLACE INTO libraryState (key, value) VALUES ('directoriesComplete', '1')"))) {
+                    qWarning() << "failed to save scan state" << query.lastError();
+                }
+            }
+
+            saveVolumes(db);
+
+            removeTracks();
+
+            if (deletedMediaArtCount > 0) {
+                std::vector<QString> deletedMediaArt;
+                deletedMediaArt.reserve(deletedMediaArtCount);
+                for (const auto& i : mediaArtExistanceHash) {
+                    if (!i.second) {
+                        deletedMediaArt.push_back(i.first);
+                    }
+                }
+
+                for (int i = 0, max = deletedMediaArt.size(); i < max; i += maxParametersCount) {
+                    const int count = [&]() -> int {
+                        const int left = max - i;
+                        if (left > maxParametersCount) {
+                            return maxParametersCount;
+                        }
+                        return left;
+                    }();
+
+                    QString queryString(QLatin1String("UPDATE tracks SET mediaArt = '', mediaArtThumbnail = NULL WHERE mediaArt IN (?"));
+                    queryString.reserve(queryString.size() + (count - 1) * 2 + 1);
+                    for (int j = 1; j < count; ++j) {
+                        queryString.push_back(QStringLiteral(",?"));
+                    }
+                    queryString.push_back(QLatin1Char(')'));
+
+                    SqlQuery query(db);
+                    query.prepare(queryString);
+                    for (int j = i, max = i + count; j < max; ++j) {
+                        query.addBindValue(deletedMediaArt[j]);
+                    }
+
+                    if (!query.exec()) {
+                        qWarning() << "failed to remove media art from database" << query.lastError();
+                    }
+                }
+            }
+
+            // Tags of all files are committed, library can be used while media art is extracted
+            walkedDirectories.clear();
+            writer.commit();
+            if (!deferredFiles.empty()) {
+                qDebug() << "extracting media art of" << deferredFiles.size() << "files";
+                UNPLAYER_TRACE("scan: extract media art");
+                for (ScanTask& task : deferredFiles) {
+                    if (isStopped()) {
+                        // Tracks which media art was not extracted are processed on next scan
+                        qWarning() << "stop extracting media art";
+                        writeAllFiles();
+                        checkpoint();
+                        db.commit();
+                        return;
+                    }
+                    enqueueFile(std::move(task));
+                }
+                writeAllFiles();
+                deferredFiles.clear();
+            }
+
+            {
+                UNPLAYER_TRACE("scan: finish");
+                saveScanStatistics(db, directoryStatistics);
+                updateThumbnails(db);
+                removeUnusedMediaArt(db, mediaArtCache.takeSavedFiles());
+                DirectoryMediaArtCache::instance().save(db);
+                writer.removeUnusedEntries();
+                LibraryUtils::updateSummaries(db);
+
+                db.commit();
+            }
+            writer.notifyChanges();
+
+            // Library is complete, exact durations are filled in the background
+            if (Settings::instance()->refineDurations() && !isStopped()) {
+                db.transaction();
+                const LibraryChanges changes(refineDurations(db));
+                db.commit();
+                if (!changes.isEmpty()) {
+                    LibraryUtils::notifyLibraryChanged(changes);
+                }
+            }
+        }
+        qDebug() << "end scanning files" << time.msecsTo(QTime::currentTime())
+                 << "discovered" << mProgress->discoveredFiles.load()
+                 << "processed" << mProgress->processedFiles.load()
+                 << "skipped" << mProgress->skippedFiles.load()
+                 << "bytes read" << mProgress->bytesRead.load();
+    }
+}
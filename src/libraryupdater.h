@@ -0,0 +1,231 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_LIBRARYUPDATER_H
+#define UNPLAYER_LIBRARYUPDATER_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <QByteArray>
+#include <QMimeDatabase>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+#include "directorytrie.h"
+#include "stdutils.h"
+
+class QFileInfo;
+class QSqlDatabase;
+
+namespace unplayer
+{
+    struct LibraryChanges;
+    class ThumbnailAtlasWriter;
+
+    // Thread-safe cache of media art files, shared by tag reader workers
+    class MediaArtCache final
+    {
+    public:
+        explicit MediaArtCache(const QString& mediaArtDirectory);
+
+        // Loads already extracted embedded media art from database,
+        // except files which are known to be deleted
+        void loadEmbeddedMediaArtFiles(const QSqlDatabase& db, const std::unordered_set<QString>& deletedFiles);
+
+        // Hash of embedded media art data which is stored in the database,
+        // empty string if data is empty
+        QString embeddedMediaArtHash(const QByteArray& data);
+
+        QString getTrackMediaArt(const QString& embeddedMediaArt,
+                                 const QFileInfo& fileInfo,
+                                 bool preferDirectoriesMediaArt);
+        QString directoryMediaArt(const QString& directoryPath);
+
+        // Media art of directories on network file systems is copied to media art directory,
+        // so that it is not read over network every time it is shown.
+        // Directories should end with '/'
+        void setNetworkDirectories(std::vector<QString> directories);
+
+        // Returns path of existing embedded media art file, or empty string
+        QString embeddedMediaArtFile(const QString& hash);
+        // Oversized pictures are downscaled and re-encoded to JPEG before saving
+        QString saveEmbeddedMediaArt(const QByteArray& data, const QString& hash);
+
+        // Returns files written by saveEmbeddedMediaArt() and local copies
+        // of directories media art since last call
+        std::vector<QString> takeSavedFiles();
+
+    private:
+        QString copyDirectoryMediaArt(const QString& mediaArt);
+
+        const QString mMediaArtDirectory;
+        const QMimeDatabase mMimeDb;
+        // See Settings::embeddedMediaArtMaxResolution()
+        const int mMaxResolution;
+        const int mMaxFileSize;
+
+        QMutex mDirectoriesMutex;
+        std::unordered_map<QString, QString> mDirectories;
+        std::vector<QString> mNetworkDirectories;
+
+        QMutex mEmbeddedMutex;
+        std::unordered_map<QByteArray, QString> mEmbeddedFiles;
+        std::vector<QString> mSavedFiles;
+
+        struct RecentMediaArt
+        {
+            QByteArray data;
+            quint64 fingerprint;
+            QString hash;
+        };
+        QMutex mRecentMutex;
+        std::deque<RecentMediaArt> mRecentMediaArt;
+    };
+
+    // Progress of library update, written by LibraryUpdater and read on main thread
+    class ScanProgress final
+    {
+    public:
+        // Audio files found in library directories
+        std::atomic<int> discoveredFiles{0};
+        // Files which tags were read
+        std::atomic<int> processedFiles{0};
+        // Files that haven't changed since last scan
+        std::atomic<int> skippedFiles{0};
+        std::atomic<qint64> bytesRead{0};
+
+        // Update stops after current batch of files is written
+        std::atomic_bool cancelled{false};
+
+        QString currentDirectory() const;
+        void setCurrentDirectory(const QString& directory);
+
+        // Directories that user is browsing, full scan lists them before
+        // directories that walkers haven't reached yet
+        void addHotDirectory(const QString& directory);
+        std::vector<QString> takeHotDirectories();
+
+    private:
+        mutable QMutex mDirectoryMutex;
+        QString mCurrentDirectory;
+        std::vector<QString> mHotDirectories;
+    };
+
+    // Scans library directories and updates database.
+    // Directory walking and database writes are done on the calling thread,
+    // tags are extracted by a pool of worker threads.
+    class LibraryUpdater final
+    {
+    public:
+        explicit LibraryUpdater(const QString& databaseFilePath,
+                                const QString& mediaArtDirectory,
+                                int thumbnailSize,
+                                const std::shared_ptr<ScanProgress>& progress);
+
+        // Scans all library directories. Files in directories which modification
+        // time has not changed since last scan are not listed and stat'ed
+        void run();
+
+        // Updates only given files and directories (recursively)
+        void updatePaths(const QStringList& paths);
+
+        // Adds tracks from database made by unplayer-indexer for volume which is now
+        // mounted at volumeRoot. Tracks that are already in library are kept,
+        // run() should be called afterwards to pick up changes made since indexing
+        void importLibrary(const QString& importDirectory, const QString& volumeRoot);
+
+        // Paths in database made by unplayer-indexer start with these instead of
+        // mount point of indexed volume and media art directory of indexer
+        static const QLatin1String importVolumePlaceholder;
+        static const QLatin1String importMediaArtPlaceholder;
+
+        // Returns URL of downscaled copy of media art in atlas, media art itself if it is small
+        // enough, or empty string on error. Thumbnail that is already in atlas is not created again
+        static QString addThumbnail(ThumbnailAtlasWriter& atlas, const QString& mediaArt, int size);
+
+    private:
+        void loadDirectories();
+        bool isInLibrary(const QString& path) const;
+        bool isBlacklisted(const QString& path) const;
+
+        // Calls processDirectory for directory and its subdirectories, following symlinks.
+        // Blacklisted and already visited directories are not entered. Returns false
+        // if processDirectory returned false, which stops walking.
+        // If cachedSubdirectories is set and returns true, subdirectories it has filled
+        // are walked instead of listing directory
+        bool walkDirectories(const QString& directory,
+                             const std::function<bool(const QFileInfo&)>& processDirectory,
+                             const std::function<bool(const QFileInfo&, std::vector<QFileInfo>&)>& cachedSubdirectories = nullptr);
+        // Returns false if the same file was already visited using different path
+        // (through symlink, bind mount or hard link)
+        bool visitFile(const QString& filePath);
+        bool isNoMediaDirectory(const QString& directory);
+        // Returns true if app is shutting down or update was cancelled
+        bool isStopped() const;
+
+        // Finds library directories on volumes which are not mounted now.
+        // Tracks in them are kept in database until volume is mounted again
+        void loadVolumes(const QSqlDatabase& db);
+        void saveVolumes(const QSqlDatabase& db);
+        bool isOffline(const QString& path) const;
+
+        // Creates downscaled copies of media art which doesn't have them yet in thumbnail atlas
+        void updateThumbnails(const QSqlDatabase& db);
+
+        // Removes files in media art directory which are not referenced by tracks.
+        // savedFiles are new files that may have not been referenced at all
+        void removeUnusedMediaArt(const QSqlDatabase& db, const std::vector<QString>& savedFiles);
+
+        // Counts frames of MPEG files which duration was estimated by scan, see Settings::refineDurations()
+        LibraryChanges refineDurations(const QSqlDatabase& db);
+
+        const QString mDatabaseFilePath;
+        const QString mMediaArtDirectory;
+        const int mThumbnailSize;
+        const std::shared_ptr<ScanProgress> mProgress;
+
+        QStringList mLibraryDirectories;
+        QStringList mBlacklistedDirectories;
+        DirectoryTrie mBlacklist;
+
+        // Device and inode numbers of directories and files visited during update
+        using FileIds = std::set<std::pair<quint64, quint64>>;
+        FileIds mVisitedDirectories;
+        FileIds mVisitedFiles;
+
+        std::unordered_map<QString, bool> mNoMediaDirectories;
+        // Guards mVisitedDirectories and mNoMediaDirectories, directories
+        // on different volumes are walked by separate threads
+        QMutex mWalkMutex;
+
+        // Mount points of volumes of library directories from last scan
+        std::unordered_map<QString, QString> mVolumes;
+        QStringList mOfflineDirectories;
+    };
+}
+
+#endif // UNPLAYER_LIBRARYUPDATER_H
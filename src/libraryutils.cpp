@@ -18,39 +18,59 @@
 
 #include "libraryutils.h"
 
+#include <algorithm>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <utility>
 
-#include <QCoreApplication>
-#include <QCryptographicHash>
+#include <QAtomicInt>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
 #include <QDateTime>
 #include <QDebug>
 #include <QDir>
-#include <QDirIterator>
 #include <QFile>
 #include <QFileInfo>
 #include <QFutureWatcher>
+#include <QGuiApplication>
 #include <QMimeDatabase>
-#include <QRegularExpression>
 #include <QQmlEngine>
+#include <QScreen>
 #include <QSqlDatabase>
 #include <QSqlError>
-#include <QSqlRecord>
 #include <QSqlQuery>
 #include <QStandardPaths>
+#include <QThreadStorage>
+#include <QTimer>
 #include <QUuid>
-#include <QtConcurrentRun>
 
+#include "artimageprovider.h"
+#include "directorymediaartcache.h"
+#include "jobmanager.h"
+#include "libraryindex.h"
+#include "librarymaintenance.h"
+#include "librarymigrations.h"
+#include "libraryreplica.h"
+#include "libraryservice.h"
+#include "librarysnapshot.h"
+#include "libraryupdater.h"
+#include "librarywatcher.h"
 #include "settings.h"
+#include "smartplaylists.h"
+#include "sqlquery.h"
 #include "stdutils.h"
-#include "tagutils.h"
+#include "threadpools.h"
+#include "thumbnailatlas.h"
+#include "tracing.h"
+#include "utils.h"
 
 namespace unplayer
 {
     namespace
     {
-        const QString rescanConnectionName(QLatin1String("unplayer_rescan"));
-
         const QLatin1String flacMimeType("audio/flac");
 
         const QLatin1String mp4MimeType("audio/mp4");
@@ -69,80 +89,87 @@ namespace unplayer
         const QLatin1String wavMimeType("audio/x-wav");
         const QLatin1String wavpackMimeType("audio/x-wavpack");
 
+        // Removes connection of thread when thread finishes
+        class ThreadDatabase final
+        {
+        public:
+            explicit ThreadDatabase(const QString& connectionName)
+                : connectionName(connectionName)
+            {
 
-        std::unique_ptr<LibraryUtils> instancePointer;
+            }
 
-        QString emptyIfNull(const QString& string)
-        {
-            if (string.isNull()) {
-                return QString();
+            ~ThreadDatabase()
+            {
+                SqlQuery::clearCache(connectionName);
+                QSqlDatabase::removeDatabase(connectionName);
             }
-            return string;
-        }
 
+            const QString connectionName;
+        };
 
-        void updateTrackInDatabase(const QSqlDatabase& db,
-                                   bool inDb,
-                                   int id,
-                                   const QFileInfo& fileInfo,
-                                   const tagutils::Info& info,
-                                   const QString& mediaArt)
+        QThreadStorage<ThreadDatabase*> threadDatabases;
+
+        // Picks media art of track in given scope without sorting all its tracks.
+        // Random id is chosen between the lowest and the highest id of tracks in scope
+        // (which are found using index), and the first track with media art starting
+        // from it is selected. linkTable is table with idColumn column and condition
+        // selects scope from it, from is FROM clause that joins it with tracks table
+        QString randomMediaArtInScope(const QString& linkTable,
+                                      const QString& idColumn,
+                                      const QString& from,
+                                      const QString& condition,
+                                      const QVariantList& bindValues)
         {
-            if (inDb) {
-                QSqlQuery query(db);
-                query.prepare(QStringLiteral("DELETE FROM tracks WHERE id = ?"));
-                query.addBindValue(id);
-                if (!query.exec()) {
-                    qWarning() << "failed to remove track from database" << query.lastQuery();
+            SqlQuery boundsQuery;
+            boundsQuery.prepareCached(QString::fromLatin1("SELECT (SELECT MIN(%1) FROM %2 WHERE %3), (SELECT MAX(%1) FROM %2 WHERE %3)")
+                                .arg(idColumn, linkTable, condition));
+            for (int i = 0; i < 2; ++i) {
+                for (const QVariant& value : bindValues) {
+                    boundsQuery.addBindValue(value);
                 }
             }
-
-            const auto forEachOrOnce = [](const QStringList& strings, const std::function<void(const QString&)>& exec) {
-                if (strings.empty()) {
-                    exec(QString());
-                } else {
-                    for (const QString& string : strings) {
-                        exec(string);
-                    }
+            LibraryUtils::explainQuery(boundsQuery);
+            if (!boundsQuery.exec() || !boundsQuery.next()) {
+                qWarning() << "failed to get tracks ids range" << boundsQuery.lastError();
+                return QString();
+            }
+            if (boundsQuery.isNull(0)) {
+                // No tracks
+                return QString();
+            }
+            const int minId = boundsQuery.value(0).toInt();
+            const int maxId = boundsQuery.value(1).toInt();
+
+            // Unary plus prevents using index on mediaArt, which would require sorting
+            SqlQuery query;
+            query.prepareCached(QString::fromLatin1("SELECT COALESCE(NULLIF(mediaArtThumbnail, ''), mediaArt) FROM %1 "
+                                                    "WHERE %2 AND %3 >= ? AND +mediaArt != '' "
+                                                    "ORDER BY %3 LIMIT 1").arg(from, condition, idColumn));
+
+            const int randomId = minId + qrand() % (maxId - minId + 1);
+            for (int startId : {randomId, minId}) {
+                for (const QVariant& value : bindValues) {
+                    query.addBindValue(value);
                 }
-            };
-
-            QSqlQuery query(db);
-            query.prepare([&]() {
-                QString queryString(QStringLiteral("INSERT INTO tracks (id, modificationTime, year, trackNumber, duration, filePath, title, artist, album, discNumber, genre, mediaArt) "
-                                                   "VALUES "));
-                const auto sizeOrOne = [](const QStringList& strings) {
-                    return strings.empty() ? 1 : strings.size();
-                };
-                const int count = sizeOrOne(info.artists) * sizeOrOne(info.albums) * sizeOrOne(info.genres);
-                for (int i = 0; i < count; ++i) {
-                    queryString.push_back(QStringLiteral("(%1, %2, %3, %4, %5, ?, ?, ?, ?, ?, ?, ?)"));
-                    if (i != (count - 1)) {
-                        queryString.push_back(QLatin1Char(','));
-                    }
+                query.addBindValue(startId);
+                LibraryUtils::explainQuery(query);
+                if (!query.exec()) {
+                    qWarning() << "failed to get random media art" << query.lastError();
+                    return QString();
+                }
+                if (query.next()) {
+                    return ArtImageProvider::url(query.value(0).toString());
+                }
+                if (startId == minId) {
+                    break;
                 }
-                queryString = queryString.arg(id).arg(fileInfo.lastModified().toMSecsSinceEpoch()).arg(info.year).arg(info.trackNumber).arg(info.duration);
-                return queryString;
-            }());
-
-            forEachOrOnce(info.artists, [&](const QString& artist) {
-                forEachOrOnce(info.albums, [&](const QString& album) {
-                    forEachOrOnce(info.genres, [&](const QString& genre) {
-                        query.addBindValue(fileInfo.filePath());
-                        query.addBindValue(info.title);
-                        query.addBindValue(emptyIfNull(artist));
-                        query.addBindValue(emptyIfNull(album));
-                        query.addBindValue(emptyIfNull(info.discNumber));
-                        query.addBindValue(emptyIfNull(genre));
-                        query.addBindValue(emptyIfNull(mediaArt));
-                    });
-                });
-            });
-
-            if (!query.exec()) {
-                qWarning() << "failed to insert track in the database" << query.lastError();
             }
+            return QString();
         }
+
+
+        std::unique_ptr<LibraryUtils> instancePointer;
     }
 
     MimeType mimeTypeFromString(const QString& string)
@@ -169,7 +196,49 @@ namespace unplayer
         return found->second;
     }
 
-    const std::unordered_set<QString> LibraryUtils::mimeTypesExtensions{QLatin1String("flac"),
+    MimeType audioTypeForFile(const QFileInfo& fileInfo, const QMimeDatabase& mimeDb)
+    {
+        struct SuffixType
+        {
+            const char* suffix;
+            MimeType type;
+        };
+        // Few entries, linear search is faster than hashing suffix
+        static const SuffixType types[]{
+            {"flac", MimeType::Flac},
+
+            {"m4a", MimeType::Mp4},
+            {"f4a", MimeType::Mp4},
+            {"m4b", MimeType::Mp4b},
+            {"f4b", MimeType::Mp4b},
+
+            {"mp3", MimeType::Mpeg},
+            {"mpga", MimeType::Mpeg},
+
+            {"opus", MimeType::OpusOgg},
+
+            {"ape", MimeType::Ape},
+
+            {"wav", MimeType::Wav},
+            {"wv", MimeType::Wavpack},
+            {"wvp", MimeType::Wavpack}
+        };
+
+        // Suffix is compared in place, without creating QString for it
+        const QString filePath(fileInfo.filePath());
+        const int dotIndex = filePath.lastIndexOf(QLatin1Char('.'));
+        if (dotIndex != -1 && filePath.indexOf(QLatin1Char('/'), dotIndex) == -1) {
+            const QStringRef suffix(filePath.midRef(dotIndex + 1));
+            for (const SuffixType& type : types) {
+                if (suffix.compare(QLatin1String(type.suffix), Qt::CaseInsensitive) == 0) {
+                    return type.type;
+                }
+            }
+        }
+        return mimeTypeFromString(mimeDb.mimeTypeForFile(fileInfo, QMimeDatabase::MatchContent).name());
+    }
+
+    const FlatHashSet<QString> LibraryUtils::mimeTypesExtensions{QLatin1String("flac"),
                                                                         QLatin1String("aac"),
 
                                                                         QLatin1String("m4a"),
@@ -192,7 +261,7 @@ namespace unplayer
                                                                         QLatin1String("wv"),
                                                                         QLatin1String("wvp")};
 
-    const std::unordered_set<QString> LibraryUtils::mimeTypesByContent{flacMimeType,
+    const FlatHashSet<QString> LibraryUtils::mimeTypesByContent{flacMimeType,
                                                                        mp4MimeType,
                                                                        mp4bMimeType,
                                                                        mpegMimeType,
@@ -204,7 +273,7 @@ namespace unplayer
                                                                        wavMimeType,
                                                                        wavpackMimeType};
 
-    const std::unordered_set<QString> LibraryUtils::videoMimeTypesExtensions{QLatin1String("mp4"),
+    const FlatHashSet<QString> LibraryUtils::videoMimeTypesExtensions{QLatin1String("mp4"),
                                                                              QLatin1String("m4v"),
                                                                              QLatin1String("f4v"),
                                                                              QLatin1String("lrv"),
@@ -220,6 +289,10 @@ namespace unplayer
                                                                              QLatin1String("ogv")};
 
     const QString LibraryUtils::databaseType(QLatin1String("QSQLITE"));
+    const QLatin1String LibraryUtils::emptySortKey("2");
+
+    bool LibraryUtils::explainQueries = false;
+    bool LibraryUtils::serviceMode = false;
 
     LibraryUtils* LibraryUtils::instance()
     {
@@ -235,6 +308,63 @@ namespace unplayer
         return mDatabaseFilePath;
     }
 
+    const QString& LibraryUtils::mediaArtDirectory() const
+    {
+        return mMediaArtDirectory;
+    }
+
+    void LibraryUtils::configureDatabase(const QSqlDatabase& db)
+    {
+        // Commits in WAL mode are durable after power loss only with synchronous=FULL,
+        // but database stays consistent and can be rebuilt by rescanning
+        const QLatin1String pragmas[] = {QLatin1String("PRAGMA synchronous = NORMAL"),
+                                         QLatin1String("PRAGMA cache_size = -8192"),
+                                         QLatin1String("PRAGMA mmap_size = 67108864"),
+                                         QLatin1String("PRAGMA temp_store = MEMORY")};
+        SqlQuery query(db);
+        for (const QLatin1String& pragma : pragmas) {
+            if (!query.exec(pragma)) {
+                qWarning() << "failed to set" << pragma << query.lastError();
+            }
+        }
+    }
+
+    QSqlDatabase LibraryUtils::threadDatabase(const QString& databaseFilePath)
+    {
+        if (!threadDatabases.hasLocalData()) {
+            static QAtomicInt counter;
+            const QString connectionName(QString::fromLatin1("unplayer_thread_%1").arg(counter.fetchAndAddRelaxed(1)));
+            auto db = QSqlDatabase::addDatabase(databaseType, connectionName);
+            db.setDatabaseName(databaseFilePath);
+            threadDatabases.setLocalData(new ThreadDatabase(connectionName));
+        }
+
+        QSqlDatabase db(QSqlDatabase::database(threadDatabases.localData()->connectionName, false));
+        if (!db.isOpen()) {
+            // Retry if previous attempt failed
+            if (db.open()) {
+                configureDatabase(db);
+            } else {
+                qWarning() << "failed to open database" << db.lastError();
+            }
+        }
+        return db;
+    }
+
+    QSqlDatabase LibraryUtils::threadDatabase()
+    {
+        return threadDatabase(instance()->databaseFilePath());
+    }
+
+    QSqlDatabase LibraryUtils::readDatabase()
+    {
+        const QSqlDatabase replica(LibraryReplica::database());
+        if (replica.isOpen()) {
+            return replica;
+        }
+        return threadDatabase();
+    }
+
     QString LibraryUtils::findMediaArtForDirectory(std::unordered_map<QString, QString>& mediaArtHash, const QString& directoryPath)
     {
         {
@@ -244,559 +374,951 @@ namespace unplayer
             }
         }
 
-        const QDir dir(directoryPath);
-        const QStringList found(dir.entryList(QDir::Files | QDir::Readable)
-                                .filter(QRegularExpression(QStringLiteral("^(albumart.*|cover|folder|front)\\.(jpeg|jpg|png)$"),
-                                                           QRegularExpression::CaseInsensitiveOption)));
-        if (found.isEmpty()) {
-            mediaArtHash.insert({directoryPath, QString()});
-            return QString();
-        }
-
-        const QString mediaArt(dir.filePath(found.first()));
+        const QString mediaArt(findMediaArtForDirectory(directoryPath));
         mediaArtHash.insert({directoryPath, mediaArt});
         return mediaArt;
     }
 
-    void LibraryUtils::initDatabase()
+    void LibraryUtils::explainQuery(const QSqlQuery& query, const QSqlDatabase& db)
     {
-        qDebug() << "init db";
-
-        const QString dataDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation));
-        if (!QDir().mkpath(dataDir)) {
-            qWarning() << "failed to create data directory";
+        if (!explainQueries) {
             return;
         }
 
-        auto db = QSqlDatabase::addDatabase(databaseType);
-        db.setDatabaseName(mDatabaseFilePath);
-        if (!db.open()) {
-            qWarning() << "failed to open database:" << db.lastError();
-            return;
+        bool fullScan = false;
+        const QStringList plan(SqlQuery::queryPlan(query, db, &fullScan));
+        if (fullScan) {
+            qWarning() << "query does not use index:" << query.lastQuery() << plan;
+        } else {
+            qDebug() << "query plan:" << query.lastQuery() << plan;
         }
+    }
 
-        bool createTable = !db.tables().contains(QLatin1String("tracks"));
-        if (!createTable) {
-            static const std::vector<QString> fields{QLatin1String("id"),
-                                                     QLatin1String("filePath"),
-                                                     QLatin1String("modificationTime"),
-                                                     QLatin1String("title"),
-                                                     QLatin1String("artist"),
-                                                     QLatin1String("album"),
-                                                     QLatin1String("year"),
-                                                     QLatin1String("trackNumber"),
-                                                     QLatin1String("discNumber"),
-                                                     QLatin1String("genre"),
-                                                     QLatin1String("duration"),
-                                                     QLatin1String("mediaArt")};
-
-            const QSqlRecord record(db.record(QLatin1String("tracks")));
-            if (record.count() == static_cast<int>(fields.size())) {
-                for (int i = 0, max = record.count(); i < max; ++i) {
-                    if (!contains(fields, record.fieldName(i))) {
-                        createTable = true;
-                    }
-                }
-            } else {
-                createTable = true;
+    void LibraryUtils::dumpQueryStatistics()
+    {
+        SqlQuery::dumpStatistics();
+    }
+
+    void LibraryUtils::explainQuery(const QSqlQuery& query)
+    {
+        explainQuery(query, QSqlDatabase::database());
+    }
+
+    QString LibraryUtils::findMediaArtForDirectory(const QString& directoryPath)
+    {
+        return DirectoryMediaArtCache::instance().mediaArt(directoryPath);
+    }
+
+    bool LibraryUtils::updateSummaries(const QSqlDatabase& db)
+    {
+        static const std::vector<QString> queries{
+            QLatin1String("DELETE FROM artist_summary WHERE artistId IN (SELECT artistId FROM summaries_dirty_artists)"),
+            QLatin1String("INSERT INTO artist_summary (artistId, albumsCount, tracksCount, duration, mediaArt) "
+                          "SELECT tracks_artists.artistId, COUNT(DISTINCT(tracks_albums.albumId)), COUNT(*), SUM(duration), "
+                          "MAX(NULLIF(COALESCE(NULLIF(mediaArtThumbnail, ''), mediaArt), '')) "
+                          "FROM summaries_dirty_artists "
+                          "JOIN tracks_artists ON tracks_artists.artistId = summaries_dirty_artists.artistId "
+                          "JOIN tracks_albums ON tracks_albums.trackId = tracks_artists.trackId "
+                          "JOIN tracks ON tracks.id = tracks_artists.trackId "
+                          "GROUP BY tracks_artists.artistId"),
+            QLatin1String("DELETE FROM summaries_dirty_artists"),
+
+            QLatin1String("DELETE FROM album_summary WHERE albumId IN (SELECT albumId FROM summaries_dirty_albums)"),
+            // Media art chosen by user takes precedence over media art of tracks
+            QLatin1String("INSERT INTO album_summary (albumId, artistId, year, tracksCount, duration, mediaArt, addedTime) "
+                          "SELECT tracks_albums.albumId, tracks_artists.artistId, MAX(year), COUNT(*), SUM(duration), "
+                          "COALESCE(MAX(COALESCE(NULLIF(albumMediaArt.mediaArtThumbnail, ''), albumMediaArt.mediaArt)), "
+                          "         MAX(NULLIF(COALESCE(NULLIF(tracks.mediaArtThumbnail, ''), tracks.mediaArt), ''))), MAX(addedTime) "
+                          "FROM summaries_dirty_albums "
+                          "JOIN tracks_albums ON tracks_albums.albumId = summaries_dirty_albums.albumId "
+                          "JOIN tracks_artists ON tracks_artists.trackId = tracks_albums.trackId "
+                          "JOIN tracks ON tracks.id = tracks_albums.trackId "
+                          "LEFT JOIN albumMediaArt ON albumMediaArt.albumId = tracks_albums.albumId AND albumMediaArt.artistId = tracks_artists.artistId "
+                          "GROUP BY tracks_albums.albumId, tracks_artists.artistId"),
+            QLatin1String("DELETE FROM summaries_dirty_albums")
+        };
+
+        for (const QString& queryString : queries) {
+            SqlQuery query(db);
+            if (!query.exec(queryString)) {
+                qWarning() << "failed to update summaries" << query.lastError();
+                return false;
             }
+        }
+        return smartplaylists::updateTracks(db);
+    }
 
-            if (createTable) {
-                QSqlQuery query(QLatin1String("DROP TABLE tracks"));
-                if (query.lastError().type() != QSqlError::NoError) {
-                    qWarning() << "failed to remove table:" << query.lastError();
-                }
+    void LibraryUtils::notifyLibraryChanged(const LibraryChanges& changes)
+    {
+        if (changes.isEmpty() || !qApp) {
+            return;
+        }
+        LibraryReplica::invalidate();
+        QMetaObject::invokeMethod(instance(), "libraryChanged", Qt::QueuedConnection, Q_ARG(unplayer::LibraryChanges, changes));
+    }
+
+    bool LibraryUtils::insertQueryKeys(const QSqlDatabase& db, const std::vector<QVariantList>& keys)
+    {
+        SqlQuery query(db);
+        if (!query.exec(QLatin1String("CREATE TEMP TABLE IF NOT EXISTS query_keys (position INTEGER PRIMARY KEY, key0, key1)")) ||
+                !query.exec(QLatin1String("DELETE FROM query_keys"))) {
+            qWarning() << "failed to create keys table" << query.lastError();
+            return false;
+        }
+
+        query.prepare(QLatin1String("INSERT INTO query_keys (position, key0, key1) VALUES (?, ?, ?)"));
+        for (int i = 0, max = keys.size(); i < max; ++i) {
+            const QVariantList& key = keys[i];
+            query.bindValue(0, i);
+            query.bindValue(1, key.value(0));
+            query.bindValue(2, key.value(1));
+            if (!query.exec()) {
+                qWarning() << "failed to insert keys" << query.lastError();
+                return false;
             }
         }
 
-        if (createTable) {
-            QSqlQuery query(QLatin1String("CREATE TABLE tracks ("
-                                          "    id INTEGER,"
-                                          "    filePath TEXT,"
-                                          "    modificationTime INTEGER,"
-                                          "    title TEXT COLLATE NOCASE,"
-                                          "    artist TEXT COLLATE NOCASE,"
-                                          "    album TEXT COLLATE NOCASE,"
-                                          "    year INTEGER,"
-                                          "    trackNumber INTEGER,"
-                                          "    discNumber TEXT,"
-                                          "    genre TEXT,"
-                                          "    duration INTEGER,"
-                                          "    mediaArt TEXT"
-                                          ")"));
-            if (query.lastError().type() != QSqlError::NoError) {
-                qWarning() << "failed to create table:" << query.lastError();
-                return;
+        return true;
+    }
+
+    std::unordered_map<QString, LibraryTrackMetadata> LibraryUtils::getTracksMetadata(const QSqlDatabase& db, const std::vector<QString>& filePaths)
+    {
+        std::unordered_map<QString, LibraryTrackMetadata> tracks;
+        if (filePaths.empty()) {
+            return tracks;
+        }
+
+        std::vector<QVariantList> keys;
+        keys.reserve(filePaths.size());
+        for (const QString& filePath : filePaths) {
+            keys.push_back({filePath});
+        }
+
+        QSqlDatabase database(db);
+        database.transaction();
+
+        if (!insertQueryKeys(db, keys)) {
+            database.rollback();
+            return tracks;
+        }
+
+        SqlQuery query(db);
+        query.setForwardOnly(true);
+        // Rows of the same track are adjacent
+        // One row per track, duplicate file paths are ignored by insert()
+        query.prepare(QLatin1String("SELECT filePath, title, duration, "
+                                    "COALESCE((SELECT albumMediaArt.mediaArt FROM tracks_albums "
+                                    "          JOIN tracks_artists ON tracks_artists.trackId = tracks_albums.trackId "
+                                    "          JOIN albumMediaArt ON albumMediaArt.albumId = tracks_albums.albumId AND albumMediaArt.artistId = tracks_artists.artistId "
+                                    "          WHERE tracks_albums.trackId = tracks.id LIMIT 1), mediaArt), "
+                                    "modificationTime, displayArtist, displayAlbum FROM query_keys "
+                                    "JOIN tracks ON tracks.filePath = query_keys.key0"));
+        explainQuery(query, db);
+        if (query.exec()) {
+            tracks.reserve(filePaths.size());
+            while (query.next()) {
+                tracks.insert({query.value(0).toString(),
+                               LibraryTrackMetadata{query.value(1).toString(),
+                                                    query.value(5).toString(),
+                                                    query.value(6).toString(),
+                                                    query.value(2).toInt(),
+                                                    query.value(3).toString(),
+                                                    query.value(4).toLongLong()}});
             }
+        } else {
+            qWarning() << "failed to get tracks from database" << query.lastError();
+        }
+        query.finish();
+
+        // Keys are not needed after query
+        database.rollback();
+
+        return tracks;
+    }
 
-            mCreatedTable = true;
+    bool LibraryUtils::getAudioDetails(const QSqlDatabase& db, const QString& filePath, LibraryAudioDetails& details)
+    {
+        SqlQuery query(db);
+        query.setForwardOnly(true);
+        query.prepareCached(QLatin1String("SELECT bitrate, sampleRate, channels, replayGainTrack, replayGainAlbum, "
+                                          "replayGainTrackPeak, replayGainAlbumPeak FROM tracks WHERE filePath = ?"));
+        query.addBindValue(filePath);
+        explainQuery(query, db);
+        if (!query.exec()) {
+            qWarning() << "failed to get audio details from database" << query.lastError();
+            return false;
+        }
+        if (!query.next() || query.isNull(0)) {
+            return false;
         }
 
-        mDatabaseInitialized = true;
+        const auto nanIfNull = [&](int column) {
+            return query.isNull(column) ? std::numeric_limits<double>::quiet_NaN() : query.value(column).toDouble();
+        };
+        details.bitrate = query.value(0).toInt();
+        details.sampleRate = query.value(1).toInt();
+        details.channels = query.value(2).toInt();
+        details.replayGainTrack = nanIfNull(3);
+        details.replayGainAlbum = nanIfNull(4);
+        details.replayGainTrackPeak = nanIfNull(5);
+        details.replayGainAlbumPeak = nanIfNull(6);
+        return true;
     }
 
-    void LibraryUtils::updateDatabase()
+    QString LibraryUtils::displayString(const QStringList& titles)
     {
-        if (mUpdating) {
-            return;
+        QStringList unique;
+        unique.reserve(titles.size());
+        for (const QString& title : titles) {
+            if (!title.isEmpty() && !unique.contains(title)) {
+                unique.push_back(title);
+            }
         }
+        return unique.join(QLatin1String(", "));
+    }
 
-        mUpdating = true;
-        emit updatingChanged();
+    QString LibraryUtils::sortKey(const QString& string)
+    {
+        if (string.isEmpty()) {
+            return emptySortKey;
+        }
 
-        const QFuture<void> future(QtConcurrent::run([=]() {
-            qDebug() << "start scanning files";
-            const QTime time(QTime::currentTime());
-            {
-                // Open database
-                auto db = QSqlDatabase::addDatabase(databaseType, rescanConnectionName);
-                db.setDatabaseName(mDatabaseFilePath);
-                if (!db.open()) {
-                    QSqlDatabase::removeDatabase(rescanConnectionName);
-                    qWarning() << "failed to open database" << db.lastError();
-                    return;
-                }
-                db.transaction();
+        const QString normalized(string.normalized(QString::NormalizationForm_KD).toCaseFolded());
+        const auto isDigit = [](QChar c) {
+            return c >= QLatin1Char('0') && c <= QLatin1Char('9');
+        };
 
-                // Create media art directory
-                if (!QDir().mkpath(mMediaArtDirectory)) {
-                    qWarning() << "failed to create media art directory:" << mMediaArtDirectory;
+        // Keys of non-empty strings start with '1'
+        QString key(QLatin1String("1"));
+        key.reserve(normalized.size() + 8);
+        for (int i = 0, size = normalized.size(); i < size;) {
+            const QChar c(normalized[i]);
+            if (c.isMark()) {
+                // Accents are separated from letters by decomposition
+                ++i;
+            } else if (isDigit(c)) {
+                // Leading zeros are removed and number of digits is prepended,
+                // so that shorter numbers are before longer ones
+                int end = i;
+                while (end < size && isDigit(normalized[end])) {
+                    ++end;
+                }
+                while (i < end - 1 && normalized[i] == QLatin1Char('0')) {
+                    ++i;
                 }
+                key.append(QString::number(std::min(end - i, 99)).rightJustified(2, QLatin1Char('0')));
+                key.append(normalized.midRef(i, end - i));
+                i = end;
+            } else {
+                key.append(c);
+                ++i;
+            }
+        }
+        return key;
+    }
 
-                // Library directories
-                const auto prepareDirs = [](QStringList&& dirs) {
-                    dirs.removeDuplicates();
-                    for (QString& dir : dirs) {
-                        if (!dir.endsWith(QLatin1Char('/'))) {
-                            dir.push_back(QLatin1Char('/'));
-                        }
-                    }
-                    return dirs;
-                };
-                const QStringList libraryDirectories(prepareDirs(Settings::instance()->libraryDirectories()));
-
-                const QStringList blacklistedDirectories(prepareDirs(Settings::instance()->blacklistedDirectories()));
-                const auto isBlacklisted = [&blacklistedDirectories](const QString& path) {
-                    for (const QString& directory : blacklistedDirectories) {
-                        if (path.startsWith(directory)) {
-                            return true;
-                        }
-                    }
-                    return false;
-                };
-
-                std::unordered_map<QString, bool> noMediaDirectories;
-                const auto isNoMediaDirectory = [&noMediaDirectories](const QString& directory) {
-                    {
-                        const auto found(noMediaDirectories.find(directory));
-                        if (found != noMediaDirectories.end()) {
-                            return found->second;
-                        }
+    int LibraryUtils::intSortKey(const QVariant& value)
+    {
+        return value.isNull() ? std::numeric_limits<int>::min() : value.toInt();
+    }
+
+    namespace
+    {
+        struct DatabaseMigrationResult
+        {
+            bool migrated;
+            bool createdTable;
+        };
+
+        // Migrates database on its own connection, which is removed after that
+        DatabaseMigrationResult migrateDatabase(const QString& databaseFilePath)
+        {
+            DatabaseMigrationResult result{false, false};
+
+            const QString dataDir(QStandardPaths::writableLocation(QStandardPaths::DataLocation));
+            if (!QDir().mkpath(dataDir)) {
+                qWarning() << "failed to create data directory";
+                return result;
+            }
+
+            const QString connectionName(QLatin1String("unplayer_migration"));
+            {
+                auto db = QSqlDatabase::addDatabase(LibraryUtils::databaseType, connectionName);
+                db.setDatabaseName(databaseFilePath);
+                if (db.open()) {
+                    // WAL mode is persistent. Readers are not blocked by the writer,
+                    // so that pages can load tracks while library is being updated
+                    SqlQuery query(db);
+                    if (!query.exec(QLatin1String("PRAGMA journal_mode = WAL"))) {
+                        qWarning() << "failed to enable WAL mode" << query.lastError();
                     }
-                    const bool noMedia = QFileInfo(directory + QStringLiteral("/.nomedia")).isFile();
-                    noMediaDirectories.insert({directory, noMedia});
-                    return noMedia;
-                };
-
-                std::unordered_map<QString, int> files;
-                int lastId = -1;
-                std::unordered_map<int, long long> modificationTimeHash;
-                std::unordered_map<int, QString> mediaArtHash;
-
-                std::unordered_map<QString, bool> mediaArtExistanceHash;
-                int deletedMediaArtCount = 0;
-
-                std::vector<int> filesToRemove;
-
-                {
-                    QSqlQuery query(QLatin1String("SELECT id, filePath, modificationTime, mediaArt FROM tracks GROUP BY id ORDER BY id"), db);
-                    if (query.lastError().type() != QSqlError::NoError) {
-                        qWarning() << "failed to get files from database" << query.lastError();
-                        return;
+                    query.finish();
+                    LibraryUtils::configureDatabase(db);
+
+                    if (librarymigrations::migrate(db, result.createdTable)) {
+                        // Summaries of entries marked by migrations
+                        db.transaction();
+                        LibraryUtils::updateSummaries(db);
+                        db.commit();
+                        // Existing database is rewritten once, free pages are returned
+                        // to file system by LibraryMaintenance after that
+                        LibraryMaintenance::enableIncrementalVacuum(db);
+                        result.migrated = true;
+                    } else {
+                        qWarning() << "failed to migrate database";
                     }
+                } else {
+                    qWarning() << "failed to open database:" << db.lastError();
+                }
+            }
+            QSqlDatabase::removeDatabase(connectionName);
 
-                    while (query.next()) {
-                        const int id(query.value(0).toInt());
-                        const QString filePath(query.value(1).toString());
-                        const QFileInfo fileInfo(filePath);
-
-                        lastId = id;
-
-                        bool remove = false;
-                        if (!fileInfo.exists() || fileInfo.isDir() || !fileInfo.isReadable()) {
-                            remove = true;
-                        } else {
-                            remove = true;
-                            for (const QString& directory : libraryDirectories) {
-                                if (filePath.startsWith(directory)) {
-                                    remove = false;
-                                    break;
-                                }
-                            }
-                            if (!remove) {
-                                remove = isBlacklisted(filePath);
-                            }
-                            if (!remove) {
-                                remove = isNoMediaDirectory(fileInfo.absolutePath());
-                            }
-                        }
-
-                        if (remove) {
-                            filesToRemove.push_back(id);
-                        } else {
-                            files.insert({filePath, id});
-                            modificationTimeHash.insert({id, query.value(2).toLongLong()});
-
-                            const QString mediaArt(query.value(3).toString());
-                            if (mediaArt.isEmpty()) {
-                                mediaArtHash.insert({id, mediaArt});
-                            } else {
-                                // if media art is not empty but file doesn't exist, do not insert it in mediaArtHash
-                                const auto found(mediaArtExistanceHash.find(mediaArt));
-                                if (found == mediaArtExistanceHash.end()) {
-                                    if (QFile::exists(mediaArt)) {
-                                        mediaArtExistanceHash.insert({mediaArt, true});
-                                        mediaArtHash.insert({id, mediaArt});
-                                    } else {
-                                        mediaArtExistanceHash.insert({mediaArt, false});
-                                        ++deletedMediaArtCount;
-                                    }
-                                } else if (found->second) {
-                                    mediaArtHash.insert({id, mediaArt});
-                                }
-                            }
-                        }
-                    }
+            return result;
+        }
+
+        // Deleting all tracks row by row runs triggers for each of them, so triggers are
+        // dropped while library tables are cleared and created again in the same transaction.
+        // Tables without triggers are truncated by SQLite at once
+        bool clearLibrary(const QSqlDatabase& db)
+        {
+            SqlQuery triggersQuery(db);
+            if (!triggersQuery.exec(QLatin1String("SELECT name, sql FROM sqlite_master WHERE type = 'trigger'"))) {
+                qWarning() << "failed to get triggers" << triggersQuery.lastError();
+                return false;
+            }
+            std::vector<std::pair<QString, QString>> triggers;
+            while (triggersQuery.next()) {
+                triggers.emplace_back(triggersQuery.value(0).toString(), triggersQuery.value(1).toString());
+            }
+            triggersQuery.finish();
+
+            SqlQuery query(db);
+            for (const auto& trigger : triggers) {
+                if (!query.exec(QString::fromLatin1("DROP TRIGGER %1").arg(trigger.first))) {
+                    qWarning() << "failed to drop trigger" << query.lastError();
+                    return false;
                 }
+            }
 
-                std::unordered_map<QByteArray, QString> embeddedMediaArtFiles;
-                {
-                    const QFileInfoList files(QDir(mMediaArtDirectory).entryInfoList({QLatin1String("*-embedded.*")}, QDir::Files));
-                    embeddedMediaArtFiles.reserve(files.size());
-                    for (const QFileInfo& info : files) {
-                        const QString baseName(info.baseName());
-                        const int index = baseName.indexOf(QStringLiteral("-embedded"));
-                        embeddedMediaArtFiles.insert({baseName.left(index).toLatin1(), info.filePath()});
-                    }
+            for (const QLatin1String& table : {QLatin1String("tracks_search"),
+                                               QLatin1String("tracks_artists"),
+                                               QLatin1String("tracks_albums"),
+                                               QLatin1String("tracks_genres"),
+                                               QLatin1String("tracks"),
+                                               QLatin1String("artists"),
+                                               QLatin1String("albums"),
+                                               QLatin1String("genres"),
+                                               QLatin1String("directories"),
+                                               QLatin1String("volumes"),
+                                               QLatin1String("mediaArtFiles"),
+                                               QLatin1String("thumbnails"),
+                                               QLatin1String("directoryMediaArt"),
+                                               QLatin1String("albumMediaArt"),
+                                               QLatin1String("artist_summary"),
+                                               QLatin1String("album_summary"),
+                                               QLatin1String("summaries_dirty_artists"),
+                                               QLatin1String("summaries_dirty_albums"),
+                                               QLatin1String("smartPlaylistTracks"),
+                                               QLatin1String("smartPlaylists_dirty_tracks")}) {
+                if (!query.exec(QString::fromLatin1("DELETE FROM %1").arg(table))) {
+                    qWarning() << "failed to clear table" << table << query.lastError();
+                    return false;
                 }
+            }
+            if (!query.exec(QLatin1String("UPDATE libraryStatistics SET artistsCount = 0, albumsCount = 0, tracksCount = 0, tracksDuration = 0"))) {
+                qWarning() << "failed to reset statistics" << query.lastError();
+                return false;
+            }
 
-                std::unordered_map<QString, QString> mediaArtDirectoriesHash;
-                const QMimeDatabase mimeDb;
-                const bool preferDirectoryMediaArt = Settings::instance()->useDirectoryMediaArt();
-
-                for (const QString& topLevelDirectory : libraryDirectories) {
-                    QDirIterator iterator(topLevelDirectory, QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
-                    while (iterator.hasNext()) {
-                        if (!qApp) {
-                            qWarning() << "app shutdown, stop updating";
-                            db.commit();
-                            return;
-                        }
-
-                        iterator.next();
-                        const QString filePath(iterator.filePath());
-                        const QFileInfo fileInfo(iterator.fileInfo());
-
-                        if (fileInfo.isDir()) {
-                            continue;
-                        }
-
-                        if (!fileInfo.isReadable()) {
-                            continue;
-                        }
-
-                        const auto foundInDb(files.find(filePath));
-
-                        if (foundInDb == files.end()) {
-                            // File is not in database
-
-                            if (isNoMediaDirectory(fileInfo.path())) {
-                                continue;
-                            }
-
-                            if (isBlacklisted(filePath)) {
-                                continue;
-                            }
-
-                            if (contains(mimeTypesExtensions, fileInfo.suffix())) {
-                                const QString mimeType(mimeDb.mimeTypeForFile(filePath, QMimeDatabase::MatchContent).name());
-                                if (contains(mimeTypesByContent, mimeType)) {
-                                    const tagutils::Info trackInfo(tagutils::getTrackInfo(fileInfo, mimeType));
-                                    updateTrackInDatabase(db,
-                                                          false,
-                                                          ++lastId,
-                                                          fileInfo,
-                                                          trackInfo,
-                                                          getTrackMediaArt(trackInfo.mediaArtData,
-                                                                           embeddedMediaArtFiles,
-                                                                           fileInfo,
-                                                                           mediaArtDirectoriesHash,
-                                                                           preferDirectoryMediaArt));
-                                }
-                            }
-                        } else {
-                            // File is in database
-
-                            const int id = foundInDb->second;
-
-                            const long long modificationTime = fileInfo.lastModified().toMSecsSinceEpoch();
-                            if (modificationTime == modificationTimeHash[id]) {
-                                // File has not changed
-
-                                QString mediaArt;
-                                bool deleted = false;
-                                {
-                                    const auto found(mediaArtHash.find(id));
-                                    if (found == mediaArtHash.end()) {
-                                        deleted = true;
-                                    } else {
-                                        mediaArt = found->second;
-                                    }
-                                }
-
-                                const bool embeddedOrManual = mediaArt.startsWith(mMediaArtDirectory);
-                                const bool embedded = embeddedOrManual && mediaArt.contains(QStringLiteral("-embedded"));
-                                const bool manual = embeddedOrManual && !embedded;
-
-                                if (manual) {
-                                    continue;
-                                }
-
-                                if (!embedded || preferDirectoryMediaArt) {
-                                    const QByteArray mediaArtData([&]() {
-                                        // if media art was empty or embedded, we don't need to extract embedded
-                                        if ((!deleted && mediaArt.isEmpty()) || embedded) {
-                                            return QByteArray();
-                                        }
-                                        return tagutils::getTrackInfo(fileInfo,
-                                                                      mimeDb.mimeTypeForFile(filePath,
-                                                                                             QMimeDatabase::MatchContent).name()).mediaArtData;
-                                    }());
-
-                                    const QString newMediaArt(getTrackMediaArt(mediaArtData,
-                                                                               embeddedMediaArtFiles,
-                                                                               fileInfo,
-                                                                               mediaArtDirectoriesHash,
-                                                                               preferDirectoryMediaArt));
-                                    // if media art was embedded and new is empty, do nothing
-                                    if (!(embedded && newMediaArt.isEmpty()) && newMediaArt != mediaArt) {
-                                        QSqlQuery query(db);
-                                        query.prepare(QStringLiteral("UPDATE tracks SET mediaArt = ? WHERE id = ?"));
-                                        query.addBindValue(emptyIfNull(newMediaArt));
-                                        query.addBindValue(id);
-                                        if (!query.exec()) {
-                                            qWarning() << query.lastError();
-                                        }
-                                    }
-                                }
-                            } else {
-                                // File has changed
-                                const QString mimeType(mimeDb.mimeTypeForFile(filePath, QMimeDatabase::MatchContent).name());
-                                if (contains(mimeTypesByContent, mimeType)) {
-                                    const tagutils::Info trackInfo(tagutils::getTrackInfo(fileInfo, mimeType));
-                                    updateTrackInDatabase(db,
-                                                          true,
-                                                          id,
-                                                          fileInfo,
-                                                          trackInfo,
-                                                          getTrackMediaArt(trackInfo.mediaArtData,
-                                                                           embeddedMediaArtFiles,
-                                                                           fileInfo,
-                                                                           mediaArtDirectoriesHash,
-                                                                           preferDirectoryMediaArt));
-                                } else {
-                                    filesToRemove.push_back(id);
-                                }
-                            }
-                        }
-                    }
+            for (const auto& trigger : triggers) {
+                if (!query.exec(trigger.second)) {
+                    qWarning() << "failed to create trigger" << trigger.first << query.lastError();
+                    return false;
                 }
+            }
+            return true;
+        }
 
-                if (!filesToRemove.empty()) {
-                    qDebug() << "removing" << filesToRemove.size() << "tracks from database";
-                    QString queryString(QLatin1String("DELETE FROM tracks WHERE id IN ("));
-                    queryString.push_back(QString::number(filesToRemove.front()));
-                    for (std::size_t i = 1, max = filesToRemove.size(); i < max; ++i) {
-                        queryString.push_back(QLatin1Char(','));
-                        queryString.push_back(QString::number(filesToRemove[i]));
-                    }
-                    queryString.push_back(QLatin1Char(')'));
-                    QSqlQuery query(queryString, db);
-                    if (query.lastError().type() != QSqlError::NoError) {
-                        qWarning() << "failed to remove files from database" << query.lastError();
-                    }
+        const QLatin1String removedMediaArtSuffix(".removed-");
+
+        // Media art directories renamed by resetDatabase() that were not removed
+        // because application was closed
+        void removeStaleMediaArtDirectories(const QString& mediaArtDirectory)
+        {
+            const QFileInfo info(mediaArtDirectory);
+            const QDir parent(info.path());
+            for (const QString& name : parent.entryList({info.fileName() + removedMediaArtSuffix + QLatin1Char('*')}, QDir::Dirs | QDir::NoDotAndDotDot)) {
+                if (!QDir(parent.filePath(name)).removeRecursively()) {
+                    qWarning() << "failed to remove old media art directory" << name;
                 }
+            }
+        }
+    }
 
-                if (deletedMediaArtCount > 0) {
-                    std::vector<QString> deletedMediaArt;
-                    deletedMediaArt.reserve(deletedMediaArtCount);
-                    for (const auto& i : mediaArtExistanceHash) {
-                        if (!i.second) {
-                            deletedMediaArt.push_back(i.first);
-                        }
-                    }
+    void LibraryUtils::initDatabase()
+    {
+        qDebug() << "init db";
 
-                    const int maxParametersCount = 999;
-                    for (int i = 0, max = deletedMediaArt.size(); i < max; i += maxParametersCount) {
-                        const int count = [&]() -> int {
-                            const int left = max - i;
-                            if (left > maxParametersCount) {
-                                return maxParametersCount;
-                            }
-                            return left;
-                        }();
-
-                        QString queryString(QLatin1String("UPDATE tracks SET mediaArt = '' WHERE mediaArt IN (?"));
-                        queryString.reserve(queryString.size() + (count - 1) * 2 + 1);
-                        for (int j = 1; j < count; ++j) {
-                            queryString.push_back(QStringLiteral(",?"));
-                        }
-                        queryString.push_back(QLatin1Char(')'));
-
-                        QSqlQuery query(db);
-                        query.prepare(queryString);
-                        for (int j = i, max = i + count; j < max; ++j) {
-                            query.addBindValue(deletedMediaArt[j]);
-                        }
-
-                        if (!query.exec()) {
-                            qWarning() << "failed to remove media art from database" << query.lastError();
-                        }
-                    }
+        mInitializingDatabase = true;
+
+        // Migrations can take long time, database is opened on main thread when they are done
+        using FutureWatcher = QFutureWatcher<DatabaseMigrationResult>;
+        auto watcher = new FutureWatcher(this);
+        QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
+            const DatabaseMigrationResult result(watcher->result());
+            watcher->deleteLater();
+
+            mInitializingDatabase = false;
+            mCreatedTable = result.createdTable;
+            if (result.migrated) {
+                auto db = QSqlDatabase::addDatabase(databaseType);
+                db.setDatabaseName(mDatabaseFilePath);
+                if (db.open()) {
+                    configureDatabase(db);
+                    mDatabaseInitialized = true;
+                } else {
+                    qWarning() << "failed to open database:" << db.lastError();
                 }
+            }
+            Utils::reportStartupPhase("database initialized");
+            emit databaseInitializedChanged();
 
-                std::unordered_set<QString> allMediaArt;
-                {
-                    QSqlQuery query(QLatin1String("SELECT DISTINCT(mediaArt) FROM tracks WHERE mediaArt != ''"), db);
-                    if (query.lastError().type() == QSqlError::NoError) {
-                        if (query.last()) {
-                            if (query.at() > 0) {
-                                allMediaArt.reserve(query.at() + 1);
-                            }
-                            query.seek(QSql::BeforeFirstRow);
-                            while (query.next()) {
-                                allMediaArt.insert(query.value(0).toString());
-                            }
-                        }
-                    }
+            if (mDatabaseInitialized) {
+                emit databaseChanged();
+                if (!LibrarySnapshot::instance().isLoaded) {
+                    Utils::reportStartupPhase("library counts");
+                }
+                if (!LibrarySnapshot::instance().isLoaded || !LibraryIndex::current()) {
+                    LibrarySnapshot::save();
                 }
 
-                {
-                    const QFileInfoList files(QDir(mMediaArtDirectory).entryInfoList(QDir::Files));
-                    for (const QFileInfo& info : files) {
-                        if (!contains(allMediaArt, info.filePath())) {
-                            if (!QFile::remove(info.filePath())) {
-                                qWarning() << "failed to remove file:" << info.filePath();
-                            }
-                        }
-                    }
+                if (!serviceMode && LibraryService::isAvailable()) {
+                    connectToService();
+                } else {
+                    mLibraryWatcher = new LibraryWatcher(this);
+                    QObject::connect(mLibraryWatcher, &LibraryWatcher::pathsChanged, this, &LibraryUtils::updateDatabaseForPaths);
+                    QObject::connect(Settings::instance(), &Settings::libraryDirectoriesChanged, this, &LibraryUtils::watchLibraryDirectories);
+                    QObject::connect(Settings::instance(), &Settings::blacklistedDirectoriesChanged, this, &LibraryUtils::watchLibraryDirectories);
+                    watchLibraryDirectories();
+
+                    mMaintenance = new LibraryMaintenance(mDatabaseFilePath, mMediaArtDirectory, this);
+                    QObject::connect(this, &LibraryUtils::libraryUpdateCommitted, mMaintenance, &LibraryMaintenance::schedule);
+                    QObject::connect(this, &LibraryUtils::libraryChanged, mMaintenance, &LibraryMaintenance::schedule);
+                    mMaintenance->schedule();
+                }
+
+                if (Settings::instance()->inMemoryLibrary()) {
+                    new LibraryReplica(mDatabaseFilePath, this);
                 }
 
-                db.commit();
+                threadpools::run(threadpools::JobClass::Bulk, std::bind(removeStaleMediaArtDirectories, mMediaArtDirectory));
             }
-            QSqlDatabase::removeDatabase(rescanConnectionName);
-            qDebug() << "end scanning files" << time.msecsTo(QTime::currentTime());
+        });
+        watcher->setFuture(threadpools::run(threadpools::JobClass::Bulk, std::bind(migrateDatabase, mDatabaseFilePath)));
+    }
+
+    void LibraryUtils::updateDatabase()
+    {
+        if (mUseService) {
+            // Service may have missed changes of settings
+            reloadServiceSettings();
+            callService(QLatin1String("updateLibrary"));
+            return;
+        }
+
+        if (mUpdating) {
+            return;
+        }
+
+        mUpdating = true;
+        emit updatingChanged();
+
+        // Full update will pick up all changes
+        mPendingPaths.clear();
+
+        // Wait until paths update is finished
+        if (!mUpdatingPaths) {
+            startUpdatingDatabase();
+        }
+    }
+
+    void LibraryUtils::updateDatabaseForPaths(const QStringList& paths)
+    {
+        for (const QString& path : paths) {
+            mPendingPaths.insert(QDir::cleanPath(path));
+        }
+
+        if (!mUpdating && !mUpdatingPaths) {
+            startUpdatingPaths();
+        }
+    }
+
+    void LibraryUtils::importLibrary(const QString& directory, const QString& volumeRoot)
+    {
+        if (mUseService) {
+            reloadServiceSettings();
+            callService(QLatin1String("importLibrary"), {directory, volumeRoot});
+            return;
+        }
+
+        if (mUpdating) {
+            qWarning() << "library can't be imported while it is updating";
+            return;
+        }
+        mImportDirectory = directory;
+        mImportVolumeRoot = volumeRoot;
+        updateDatabase();
+    }
+
+    void LibraryUtils::startUpdatingDatabase()
+    {
+        // Updates are already run one after another, job is started right away
+        JobManager::instance()->add(this, JobManager::Type::UpdateLibrary, threadpools::JobClass::Scan, [=](int job) {
+            runDatabaseUpdate(job);
+        });
+    }
+
+    void LibraryUtils::runDatabaseUpdate(int job)
+    {
+        const QString databaseFilePath(mDatabaseFilePath);
+        const QString mediaArtDirectory(mMediaArtDirectory);
+        const int thumbnailSize = mThumbnailSize;
+        const QString importDirectory(mImportDirectory);
+        const QString importVolumeRoot(mImportVolumeRoot);
+        mImportDirectory.clear();
+        mImportVolumeRoot.clear();
+        startScanProgress(job);
+        const std::shared_ptr<ScanProgress> progress(mScanProgress);
+        const QFuture<void> future(threadpools::run(threadpools::JobClass::Scan, [databaseFilePath, mediaArtDirectory, thumbnailSize, importDirectory, importVolumeRoot, progress]() {
+            LibraryUpdater updater(databaseFilePath, mediaArtDirectory, thumbnailSize, progress);
+            if (!importDirectory.isEmpty()) {
+                updater.importLibrary(importDirectory, importVolumeRoot);
+            }
+            updater.run();
         }));
 
         auto watcher = new QFutureWatcher<void>(this);
         QObject::connect(watcher, &QFutureWatcher<void>::finished, this, [=]() {
+            finishScanProgress();
             mUpdating = false;
+            if (!progress->cancelled) {
+                Settings::instance()->setLastFullLibraryUpdate(QDateTime::currentMSecsSinceEpoch());
+            }
             emit updatingChanged();
-            emit databaseChanged();
+            emit libraryUpdateCommitted();
+            LibrarySnapshot::save();
+            watcher->deleteLater();
+            JobManager::instance()->finish(job);
+
+            // Changes that were made during update
+            if (!mPendingPaths.empty()) {
+                startUpdatingPaths();
+            }
         });
         watcher->setFuture(future);
     }
 
-    void LibraryUtils::resetDatabase()
+    void LibraryUtils::startUpdatingPaths()
+    {
+        JobManager::instance()->add(this, JobManager::Type::UpdateLibrary, threadpools::JobClass::Scan, [=](int job) {
+            runPathsUpdate(job);
+        });
+    }
+
+    void LibraryUtils::runPathsUpdate(int job)
+    {
+        mUpdatingPaths = true;
+
+        QStringList paths;
+        paths.reserve(mPendingPaths.size());
+        for (const QString& path : mPendingPaths) {
+            paths.push_back(path);
+        }
+        mPendingPaths.clear();
+
+        const QString databaseFilePath(mDatabaseFilePath);
+        const QString mediaArtDirectory(mMediaArtDirectory);
+        const int thumbnailSize = mThumbnailSize;
+        startScanProgress(job);
+        const std::shared_ptr<ScanProgress> progress(mScanProgress);
+        const QFuture<void> future(threadpools::run(threadpools::JobClass::Scan, [databaseFilePath, mediaArtDirectory, thumbnailSize, paths, progress]() {
+            LibraryUpdater(databaseFilePath, mediaArtDirectory, thumbnailSize, progress).updatePaths(paths);
+        }));
+
+        auto watcher = new QFutureWatcher<void>(this);
+        QObject::connect(watcher, &QFutureWatcher<void>::finished, this, [=]() {
+            finishScanProgress();
+            mUpdatingPaths = false;
+            emit libraryUpdateCommitted();
+            LibrarySnapshot::save();
+            watcher->deleteLater();
+            JobManager::instance()->finish(job);
+
+            if (mUpdating) {
+                startUpdatingDatabase();
+            } else if (!mPendingPaths.empty()) {
+                startUpdatingPaths();
+            }
+        });
+        watcher->setFuture(future);
+    }
+
+    void LibraryUtils::updateStatistics()
     {
-        QSqlQuery query(QLatin1String("DELETE from tracks"));
-        if (query.lastError().type() != QSqlError::NoError) {
-            qWarning() << "failed to reset database";
+        UNPLAYER_TRACE("LibraryUtils::updateStatistics");
+        if (!mDatabaseInitialized) {
+            return;
         }
-        if (!QDir(mMediaArtDirectory).removeRecursively()) {
-            qWarning() << "failed to remove media art directory";
+
+        SqlQuery query(QLatin1String("SELECT artistsCount, albumsCount, tracksCount, tracksDuration FROM libraryStatistics"));
+        if (query.next()) {
+            mArtistsCount = query.value(0).toInt();
+            mAlbumsCount = query.value(1).toInt();
+            mTracksCount = query.value(2).toInt();
+            mTracksDuration = query.value(3).toInt();
+        } else {
+            qWarning() << "failed to get library statistics" << query.lastError();
         }
-        emit databaseChanged();
     }
 
-    bool LibraryUtils::isDatabaseInitialized()
+    void LibraryUtils::startScanProgress(int job)
     {
-        return mDatabaseInitialized;
+        mScanJob = job;
+        JobManager::instance()->setCancelFunction(job, [=]() {
+            cancelUpdate();
+        });
+        mScanProgress = std::make_shared<ScanProgress>();
+        mScanTime.start();
+        updateScanProgress();
+        mScanProgressTimer->start();
     }
 
-    bool LibraryUtils::isCreatedTable()
+    void LibraryUtils::updateScanProgress()
     {
-        return mCreatedTable;
+        if (!mScanProgress) {
+            return;
+        }
+
+        mScanDiscoveredFiles = mScanProgress->discoveredFiles;
+        mScanProcessedFiles = mScanProgress->processedFiles;
+        mScanSkippedFiles = mScanProgress->skippedFiles;
+        mScanBytesRead = mScanProgress->bytesRead;
+        mScanDirectory = mScanProgress->currentDirectory();
+
+        const qint64 elapsed = mScanTime.elapsed();
+        mScanDuration = elapsed;
+        mScanFilesPerSecond = (elapsed > 0) ? (mScanProcessedFiles * 1000.0 / elapsed) : 0.0;
+        const int remaining = mScanDiscoveredFiles - mScanSkippedFiles - mScanProcessedFiles;
+        mScanEta = (mScanFilesPerSecond > 0.0) ? static_cast<int>(std::max(remaining, 0) / mScanFilesPerSecond) : -1;
+
+        JobManager::instance()->reportProgress(mScanJob, mScanProcessedFiles + mScanSkippedFiles, mScanDiscoveredFiles);
+
+        emit scanProgressChanged();
     }
 
-    bool LibraryUtils::isUpdating()
+    void LibraryUtils::finishScanProgress()
     {
-        return mUpdating;
+        mScanProgressTimer->stop();
+        updateScanProgress();
+        qDebug() << "scanned" << mScanProcessedFiles << "files," << mScanFilesPerSecond << "files per second";
+        mScanProgress.reset();
+        mScanJob = 0;
     }
 
-    int LibraryUtils::artistsCount()
+    void LibraryUtils::prioritizeDirectory(const QString& directory)
     {
-        if (!mDatabaseInitialized) {
-            return 0;
+        if (mUseService) {
+            if (mUpdating) {
+                callService(QLatin1String("prioritizeDirectory"), {QDir::cleanPath(directory)});
+            }
+            return;
         }
-
-        QSqlQuery query(QLatin1String("SELECT COUNT(DISTINCT(artist)) FROM tracks"));
-        if (query.next()) {
-            return query.value(0).toInt();
+        if (mScanProgress) {
+            mScanProgress->addHotDirectory(QDir::cleanPath(directory));
         }
-        return 0;
     }
 
-    int LibraryUtils::albumsCount()
+    void LibraryUtils::runMaintenance()
     {
-        if (!mDatabaseInitialized) {
-            return 0;
+        if (mMaintenance) {
+            mMaintenance->runNow();
         }
+    }
 
-        QSqlQuery query(QLatin1String("SELECT COUNT(DISTINCT(album)) FROM tracks"));
-        if (query.next()) {
-            return query.value(0).toInt();
+    void LibraryUtils::cancelUpdate()
+    {
+        if (mUseService) {
+            callService(QLatin1String("cancelUpdate"));
+            return;
+        }
+        if (!mScanProgress) {
+            return;
+        }
+        qDebug() << "cancelling library update";
+        mScanProgress->cancelled = true;
+        mPendingPaths.clear();
+        // Full update that is waiting for paths update is not started
+        if (mUpdatingPaths && mUpdating) {
+            mUpdating = false;
+            emit updatingChanged();
         }
-        return 0;
     }
 
-    int LibraryUtils::tracksCount()
+    void LibraryUtils::connectToService()
     {
-        if (!mDatabaseInitialized) {
-            return 0;
-        }
+        qDebug() << "library is updated by service";
+        mUseService = true;
+
+        QDBusConnection connection(QDBusConnection::sessionBus());
+        const auto connectSignal = [&](const char* name, const char* slot) {
+            if (!connection.connect(LibraryService::serviceName, LibraryService::objectPath, LibraryService::interfaceName,
+                                    QLatin1String(name), this, slot)) {
+                qWarning() << "failed to connect to library service signal" << name << connection.lastError();
+            }
+        };
+        connectSignal("updatingChanged", SLOT(onServiceUpdatingChanged(bool)));
+        connectSignal("scanProgress", SLOT(onServiceScanProgress(int,int,int,QString)));
+        connectSignal("committed", SIGNAL(libraryUpdateCommitted()));
+        connectSignal("libraryChanged", SLOT(onServiceLibraryChanged(QStringList,QStringList,QStringList,bool)));
+
+        // Service watches new directories
+        QObject::connect(Settings::instance(), &Settings::libraryDirectoriesChanged, this, &LibraryUtils::reloadServiceSettings);
+        QObject::connect(Settings::instance(), &Settings::blacklistedDirectoriesChanged, this, &LibraryUtils::reloadServiceSettings);
+
+        // Activates service if it is not running
+        auto watcher = new QDBusPendingCallWatcher(connection.asyncCall(QDBusMessage::createMethodCall(LibraryService::serviceName,
+                                                                                                      LibraryService::objectPath,
+                                                                                                      LibraryService::interfaceName,
+                                                                                                      QLatin1String("isUpdating"))),
+                                                   this);
+        QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this, [=]() {
+            const QDBusPendingReply<bool> reply(*watcher);
+            watcher->deleteLater();
+            if (reply.isError()) {
+                qWarning() << "failed to start library service" << reply.error();
+            } else {
+                onServiceUpdatingChanged(reply.value());
+            }
+        });
+    }
 
-        QSqlQuery query(QLatin1String("SELECT COUNT(DISTINCT(id)) FROM tracks"));
-        if (query.next()) {
-            return query.value(0).toInt();
+    void LibraryUtils::callService(const QString& method, const QVariantList& arguments)
+    {
+        QDBusMessage message(QDBusMessage::createMethodCall(LibraryService::serviceName,
+                                                            LibraryService::objectPath,
+                                                            LibraryService::interfaceName,
+                                                            method));
+        message.setArguments(arguments);
+        QDBusConnection::sessionBus().asyncCall(message);
+    }
+
+    void LibraryUtils::reloadServiceSettings()
+    {
+        // Settings are written to file later, service must read new ones
+        Settings::instance()->sync();
+        callService(QLatin1String("reloadSettings"));
+    }
+
+    void LibraryUtils::onServiceUpdatingChanged(bool updating)
+    {
+        if (updating == mUpdating) {
+            return;
+        }
+        mUpdating = updating;
+        if (updating) {
+            mScanTime.start();
+            mScanDiscoveredFiles = 0;
+            mScanProcessedFiles = 0;
+            mScanSkippedFiles = 0;
+            mScanDirectory.clear();
+        } else {
+            mScanDuration = mScanTime.elapsed();
         }
-        return 0;
+        emit updatingChanged();
     }
 
-    int LibraryUtils::tracksDuration()
+    void LibraryUtils::onServiceScanProgress(int discoveredFiles, int processedFiles, int skippedFiles, const QString& directory)
     {
-        if (!mDatabaseInitialized) {
-            return 0;
+        mScanDiscoveredFiles = discoveredFiles;
+        mScanProcessedFiles = processedFiles;
+        mScanSkippedFiles = skippedFiles;
+        mScanDirectory = directory;
+
+        // Service may have started scanning before the app
+        const qint64 elapsed = mScanTime.isValid() ? mScanTime.elapsed() : 0;
+        mScanDuration = elapsed;
+        mScanFilesPerSecond = (elapsed > 0) ? (mScanProcessedFiles * 1000.0 / elapsed) : 0.0;
+        const int remaining = mScanDiscoveredFiles - mScanSkippedFiles - mScanProcessedFiles;
+        mScanEta = (mScanFilesPerSecond > 0.0) ? static_cast<int>(std::max(remaining, 0) / mScanFilesPerSecond) : -1;
+
+        emit scanProgressChanged();
+    }
+
+    void LibraryUtils::onServiceLibraryChanged(const QStringList& artists, const QStringList& albums, const QStringList& genres, bool all)
+    {
+        LibraryChanges changes;
+        changes.artists.insert(artists.begin(), artists.end());
+        changes.albums.insert(albums.begin(), albums.end());
+        changes.genres.insert(genres.begin(), genres.end());
+        changes.all = all;
+        if (!changes.isEmpty()) {
+            emit libraryChanged(changes);
         }
+    }
 
-        QSqlQuery query(QLatin1String("SELECT SUM(duration) FROM (SELECT duration from tracks GROUP BY id)"));
-        if (query.next()) {
-            return query.value(0).toInt();
+    void LibraryUtils::watchLibraryDirectories()
+    {
+        mLibraryWatcher->setDirectories(Settings::instance()->libraryDirectories(),
+                                        Settings::instance()->blacklistedDirectories());
+    }
+
+    void LibraryUtils::resetDatabase()
+    {
+        if (mResettingDatabase) {
+            return;
         }
-        return 0;
+        mResettingDatabase = true;
+        cancelUpdate();
+
+        // Runs after running update because scan pool has one thread
+        const QString databaseFilePath(mDatabaseFilePath);
+        auto watcher = new QFutureWatcher<bool>(this);
+        QObject::connect(watcher, &QFutureWatcher<bool>::finished, this, [=]() {
+            const bool cleared = watcher->result();
+            watcher->deleteLater();
+            mResettingDatabase = false;
+            if (!cleared) {
+                return;
+            }
+
+            // Renaming is atomic, so new media art is never saved to directory that is being removed
+            const QString removedDirectory(mMediaArtDirectory + removedMediaArtSuffix + QString::number(QDateTime::currentMSecsSinceEpoch()));
+            if (QDir().rename(mMediaArtDirectory, removedDirectory)) {
+                threadpools::run(threadpools::JobClass::Bulk, [removedDirectory]() {
+                    if (!QDir(removedDirectory).removeRecursively()) {
+                        qWarning() << "failed to remove media art directory";
+                    }
+                });
+            } else if (QFileInfo::exists(mMediaArtDirectory)) {
+                qWarning() << "failed to rename media art directory";
+            }
+
+            DirectoryMediaArtCache::instance().clear();
+            emit databaseChanged();
+            emit libraryChanged(LibraryChanges::everything());
+            LibrarySnapshot::save();
+        });
+        watcher->setFuture(threadpools::run(threadpools::JobClass::Scan, [databaseFilePath]() -> bool {
+            QSqlDatabase db(threadDatabase(databaseFilePath));
+            if (!db.transaction()) {
+                qWarning() << "failed to start transaction" << db.lastError();
+                return false;
+            }
+            if (!clearLibrary(db) || !db.commit()) {
+                qWarning() << "failed to reset database" << db.lastError();
+                db.rollback();
+                return false;
+            }
+            return true;
+        }));
+    }
+
+    bool LibraryUtils::isInitializingDatabase()
+    {
+        return mInitializingDatabase;
+    }
+
+    bool LibraryUtils::isDatabaseInitialized()
+    {
+        return mDatabaseInitialized;
+    }
+
+    bool LibraryUtils::isCreatedTable()
+    {
+        return mCreatedTable;
+    }
+
+    bool LibraryUtils::hasSnapshot()
+    {
+        return LibrarySnapshot::instance().isLoaded;
+    }
+
+    bool LibraryUtils::isUpdating()
+    {
+        return mUpdating;
+    }
+
+    int LibraryUtils::scanDiscoveredFiles() const
+    {
+        return mScanDiscoveredFiles;
+    }
+
+    int LibraryUtils::scanProcessedFiles() const
+    {
+        return mScanProcessedFiles;
+    }
+
+    int LibraryUtils::scanSkippedFiles() const
+    {
+        return mScanSkippedFiles;
+    }
+
+    qint64 LibraryUtils::scanBytesRead() const
+    {
+        return mScanBytesRead;
+    }
+
+    const QString& LibraryUtils::scanDirectory() const
+    {
+        return mScanDirectory;
+    }
+
+    double LibraryUtils::scanFilesPerSecond() const
+    {
+        return mScanFilesPerSecond;
+    }
+
+    qint64 LibraryUtils::scanDuration() const
+    {
+        return mScanDuration;
+    }
+
+    int LibraryUtils::scanEta() const
+    {
+        return mScanEta;
+    }
+
+    int LibraryUtils::artistsCount()
+    {
+        return mArtistsCount;
+    }
+
+    int LibraryUtils::albumsCount()
+    {
+        return mAlbumsCount;
+    }
+
+    int LibraryUtils::tracksCount()
+    {
+        return mTracksCount;
+    }
+
+    int LibraryUtils::tracksDuration()
+    {
+        return mTracksDuration;
     }
 
     QString LibraryUtils::randomMediaArt()
     {
         if (!mDatabaseInitialized) {
-            return QString();
+            return LibrarySnapshot::instance().mediaArt;
         }
 
-        QSqlQuery query(QLatin1String("SELECT mediaArt FROM tracks WHERE mediaArt != '' GROUP BY mediaArt ORDER BY RANDOM() LIMIT 1"));
-        if (query.next()) {
-            return query.value(0).toString();
-        }
-        return QString();
+        return randomMediaArtInScope(QLatin1String("tracks"),
+                                     QLatin1String("id"),
+                                     QLatin1String("tracks"),
+                                     QLatin1String("1"),
+                                     QVariantList());
     }
 
     QString LibraryUtils::randomMediaArtForArtist(const QString& artist)
@@ -805,17 +1327,11 @@ namespace unplayer
             return QString();
         }
 
-        QSqlQuery query;
-        query.prepare(QLatin1String("SELECT mediaArt FROM tracks "
-                                    "WHERE mediaArt != '' AND artist = ? "
-                                    "GROUP BY mediaArt "
-                                    "ORDER BY RANDOM() LIMIT 1"));
-        query.addBindValue(artist);
-        query.exec();
-        if (query.next()) {
-            return query.value(0).toString();
-        }
-        return QString();
+        return randomMediaArtInScope(QLatin1String("tracks_artists"),
+                                     QLatin1String("trackId"),
+                                     QLatin1String("tracks_artists JOIN tracks ON tracks.id = tracks_artists.trackId"),
+                                     QLatin1String("artistId = (SELECT id FROM artists WHERE title = ?)"),
+                                     {artist});
     }
 
     QString LibraryUtils::randomMediaArtForAlbum(const QString& artist, const QString& album)
@@ -824,18 +1340,13 @@ namespace unplayer
             return QString();
         }
 
-        QSqlQuery query;
-        query.prepare(QLatin1String("SELECT mediaArt FROM tracks "
-                                    "WHERE mediaArt != '' AND artist = ? AND album = ? "
-                                    "GROUP BY mediaArt "
-                                    "ORDER BY RANDOM() LIMIT 1"));
-        query.addBindValue(artist);
-        query.addBindValue(album);
-        query.exec();
-        if (query.next()) {
-            return query.value(0).toString();
-        }
-        return QString();
+        return randomMediaArtInScope(QLatin1String("tracks_albums"),
+                                     QLatin1String("trackId"),
+                                     QLatin1String("tracks_albums JOIN tracks ON tracks.id = tracks_albums.trackId"),
+                                     QLatin1String("albumId = (SELECT id FROM albums WHERE title = ?) "
+                                                   "AND trackId IN (SELECT trackId FROM tracks_artists "
+                                                   "                WHERE artistId = (SELECT id FROM artists WHERE title = ?))"),
+                                     {album, artist});
     }
 
     QString LibraryUtils::randomMediaArtForGenre(const QString& genre)
@@ -844,109 +1355,136 @@ namespace unplayer
             return QString();
         }
 
-        QSqlQuery query;
-        query.prepare(QLatin1String("SELECT mediaArt FROM tracks "
-                                    "WHERE mediaArt != '' AND genre = ? "
-                                    "GROUP BY mediaArt "
-                                    "ORDER BY RANDOM() LIMIT 1"));
-        query.addBindValue(genre);
-        query.exec();
-        if (query.next()) {
-            return query.value(0).toString();
-        }
-        return QString();
+        return randomMediaArtInScope(QLatin1String("tracks_genres"),
+                                     QLatin1String("trackId"),
+                                     QLatin1String("tracks_genres JOIN tracks ON tracks.id = tracks_genres.trackId"),
+                                     QLatin1String("genreId = (SELECT id FROM genres WHERE title = ?)"),
+                                     {genre});
     }
 
     void LibraryUtils::setMediaArt(const QString& artist, const QString& album, const QString& mediaArt)
     {
-        if (!QDir().mkpath(mMediaArtDirectory)) {
-            qWarning() << "failed to create media art directory:" << mMediaArtDirectory;
-            return;
-        }
+        const QString mediaArtDirectory(mMediaArtDirectory);
+        const int thumbnailSize = mThumbnailSize;
+        // Runs on Scan pool since it writes to thumbnail atlas, after library update if it is running
+        const QFuture<bool> future(threadpools::run(threadpools::JobClass::Scan, [=]() -> bool {
+            if (!QDir().mkpath(mediaArtDirectory)) {
+                qWarning() << "failed to create media art directory:" << mediaArtDirectory;
+                return false;
+            }
 
-        QString id(QUuid::createUuid().toString());
-        id.remove(0, 1);
-        id.chop(1);
+            QString id(QUuid::createUuid().toString());
+            id.remove(0, 1);
+            id.chop(1);
 
-        const QString newFilePath(QString::fromLatin1("%1/%2.%3")
-                                  .arg(mMediaArtDirectory, id, QFileInfo(mediaArt).suffix()));
+            const QString newFilePath(QString::fromLatin1("%1/%2.%3")
+                                      .arg(mediaArtDirectory, id, QFileInfo(mediaArt).suffix()));
 
-        if (!QFile::copy(mediaArt, newFilePath)) {
-            qWarning() << "failed to copy file from" << mediaArt << "to" << newFilePath;
-            return;
-        }
+            if (!QFile::copy(mediaArt, newFilePath)) {
+                qWarning() << "failed to copy file from" << mediaArt << "to" << newFilePath;
+                return false;
+            }
 
-        QSqlQuery query;
-        query.prepare(QLatin1String("UPDATE tracks SET mediaArt = ? WHERE artist = ? AND album = ?"));
-        query.addBindValue(newFilePath);
-        query.addBindValue(artist);
-        query.addBindValue(album);
-        if (query.exec()) {
-            emit mediaArtChanged();
-        } else {
-            qWarning() << "failed to update media art in the database:" << query.lastError();
-        }
+            QSqlDatabase db(threadDatabase());
+            if (!db.isOpen()) {
+                return false;
+            }
+            db.transaction();
+
+            ThumbnailAtlasWriter atlas(mediaArtDirectory, db);
+            const QString thumbnail(LibraryUpdater::addThumbnail(atlas, newFilePath, thumbnailSize));
+
+            // Previous media art of album is unreferenced by trigger and removed after next library update.
+            // Not INSERT OR REPLACE, which doesn't fire delete trigger
+            SqlQuery deleteQuery(db);
+            deleteQuery.prepare(QStringLiteral("DELETE FROM albumMediaArt "
+                                               "WHERE albumId = (SELECT id FROM albums WHERE title = ?) "
+                                               "AND artistId = (SELECT id FROM artists WHERE title = ?)"));
+            deleteQuery.addBindValue(album);
+            deleteQuery.addBindValue(artist);
+            SqlQuery query(db);
+            query.prepare(QStringLiteral("INSERT INTO albumMediaArt (albumId, artistId, mediaArt, mediaArtThumbnail) "
+                                         "SELECT albums.id, artists.id, ?, ? FROM albums, artists "
+                                         "WHERE albums.title = ? AND artists.title = ?"));
+            query.addBindValue(newFilePath);
+            query.addBindValue(thumbnail);
+            query.addBindValue(album);
+            query.addBindValue(artist);
+            if (!deleteQuery.exec() || !query.exec() || !updateSummaries(db)) {
+                qWarning() << "failed to update media art in the database:" << deleteQuery.lastError() << query.lastError();
+                db.rollback();
+                QFile::remove(newFilePath);
+                return false;
+            }
+            return db.commit();
+        }));
+
+        auto watcher = new QFutureWatcher<bool>(this);
+        QObject::connect(watcher, &QFutureWatcher<bool>::finished, this, [=]() {
+            if (watcher->result()) {
+                LibraryChanges changes;
+                changes.addTrack({artist}, {album}, QStringList());
+                notifyLibraryChanged(changes);
+                emit albumMediaArtChanged(artist, album);
+            }
+            watcher->deleteLater();
+        });
+        watcher->setFuture(future);
     }
 
     LibraryUtils::LibraryUtils()
-        : mDatabaseInitialized(false),
+        : mInitializingDatabase(false),
+          mDatabaseInitialized(false),
           mCreatedTable(false),
           mUpdating(false),
+          mUpdatingPaths(false),
+          mLibraryWatcher(nullptr),
+          mMaintenance(nullptr),
+          mResettingDatabase(false),
+          mUseService(false),
+          mScanJob(0),
+          mScanProgressTimer(new QTimer(this)),
+          mScanDiscoveredFiles(0),
+          mScanProcessedFiles(0),
+          mScanSkippedFiles(0),
+          mScanBytesRead(0),
+          mScanFilesPerSecond(0.0),
+          mScanDuration(0),
+          mScanEta(-1),
           mDatabaseFilePath(QString::fromLatin1("%1/library.sqlite").arg(QStandardPaths::writableLocation(QStandardPaths::DataLocation))),
-          mMediaArtDirectory(QString::fromLatin1("%1/media-art").arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)))
+          mMediaArtDirectory(QString::fromLatin1("%1/media-art").arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))),
+          mThumbnailSize(256),
+          mArtistsCount(0),
+          mAlbumsCount(0),
+          mTracksCount(0),
+          mTracksDuration(0)
     {
-        initDatabase();
-        QObject::connect(this, &LibraryUtils::databaseChanged, this, &LibraryUtils::mediaArtChanged);
-    }
-
-    QString LibraryUtils::getTrackMediaArt(const QByteArray& embeddedMediaArtData,
-                                           std::unordered_map<QByteArray, QString>& embeddedMediaArtFiles,
-                                           const QFileInfo& fileInfo,
-                                           std::unordered_map<QString, QString>& mediaArtDirectories,
-                                           bool preferDirectoriesMediaArt)
-    {
-        QString mediaArt;
-        if (preferDirectoriesMediaArt) {
-            mediaArt = findMediaArtForDirectory(mediaArtDirectories, fileInfo.path());
-            if (mediaArt.isEmpty()) {
-                if (!embeddedMediaArtData.isEmpty()) {
-                    mediaArt = saveEmbeddedMediaArt(embeddedMediaArtData, embeddedMediaArtFiles);
-                }
-            }
-        } else {
-            if (embeddedMediaArtData.isEmpty()) {
-                mediaArt = findMediaArtForDirectory(mediaArtDirectories, fileInfo.path());
-            } else {
-                mediaArt = saveEmbeddedMediaArt(embeddedMediaArtData, embeddedMediaArtFiles);
-            }
+        // Media art in list items and page headers is smaller than a third of screen width
+        if (const QScreen* screen = QGuiApplication::primaryScreen()) {
+            const QSize screenSize(screen->size());
+            mThumbnailSize = std::max(128, std::min(screenSize.width(), screenSize.height()) / 3);
         }
-        return mediaArt;
-    }
 
-    QString LibraryUtils::saveEmbeddedMediaArt(const QByteArray& data, std::unordered_map<QByteArray, QString>& embeddedMediaArtFiles)
-    {
-        QByteArray md5(QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex());
-        {
-            const auto found(embeddedMediaArtFiles.find(md5));
-            if (found != embeddedMediaArtFiles.end()) {
-                return found->second;
-            }
-        }
+        mScanProgressTimer->setInterval(500);
+        QObject::connect(mScanProgressTimer, &QTimer::timeout, this, &LibraryUtils::updateScanProgress);
 
-        const QString suffix(mMimeDb.mimeTypeForData(data).preferredSuffix());
-        if (suffix.isEmpty()) {
-            return QString();
+        const LibrarySnapshot& snapshot = LibrarySnapshot::instance();
+        mArtistsCount = snapshot.artistsCount;
+        mAlbumsCount = snapshot.albumsCount;
+        mTracksCount = snapshot.tracksCount;
+        mTracksDuration = snapshot.tracksDuration;
+        if (snapshot.isLoaded) {
+            Utils::reportStartupPhase("library counts");
         }
 
-        const QString filePath(QStringLiteral("%1/%2-embedded.%3")
-                               .arg(mMediaArtDirectory, QString::fromLatin1(md5), suffix));
-        QFile file(filePath);
-        if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-            file.write(data);
-            embeddedMediaArtFiles.insert({std::move(md5), filePath});
-            return filePath;
-        }
+        // Connect before anyone else so that models that reload don't read outdated in-memory copy,
+        // and statistics are updated when they are read
+        QObject::connect(this, &LibraryUtils::databaseChanged, &LibraryReplica::invalidate);
+        QObject::connect(this, &LibraryUtils::libraryChanged, &LibraryReplica::invalidate);
+        QObject::connect(this, &LibraryUtils::databaseChanged, this, &LibraryUtils::updateStatistics);
+        QObject::connect(this, &LibraryUtils::databaseChanged, this, &LibraryUtils::mediaArtChanged);
+        QObject::connect(this, &LibraryUtils::libraryUpdateCommitted, this, &LibraryUtils::databaseChanged);
 
-        return QString();
+        initDatabase();
     }
 }
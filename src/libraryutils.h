@@ -19,23 +19,33 @@
 #ifndef UNPLAYER_LIBRARYUTILS_H
 #define UNPLAYER_LIBRARYUTILS_H
 
+#include <limits>
+#include <memory>
 #include <vector>
 
-#include <QMimeDatabase>
+#include <QElapsedTimer>
 #include <QObject>
+#include <QStringList>
+#include <QVariantList>
 
 #include <unordered_map>
 #include <unordered_set>
 
+#include "flathash.h"
+#include "librarychanges.h"
+#include "stdutils.h"
+
 class QFileInfo;
+class QMimeDatabase;
 class QSqlDatabase;
+class QSqlQuery;
+class QTimer;
 
 namespace unplayer
 {
-    namespace tagutils
-    {
-        struct Info;
-    }
+    class LibraryMaintenance;
+    class LibraryWatcher;
+    class ScanProgress;
 
     enum class MimeType
     {
@@ -55,36 +65,169 @@ namespace unplayer
 
     MimeType mimeTypeFromString(const QString& string);
 
+    // Returns type of audio file, MimeType::Other if tags of file can't be read.
+    // Unambiguous extensions are trusted, file contents are read only for
+    // containers that can hold different codecs (ogg, mka) and unknown extensions
+    MimeType audioTypeForFile(const QFileInfo& fileInfo, const QMimeDatabase& mimeDb);
+
+    // Track from library database, see LibraryUtils::getTracksMetadata()
+    struct LibraryTrackMetadata
+    {
+        QString title;
+        // See LibraryUtils::displayString(), empty if track doesn't have artists or albums
+        QString artist;
+        QString album;
+        int duration;
+        QString mediaArt;
+        long long modificationTime;
+    };
+
+    // Audio format and ReplayGain stored by scan, see LibraryUtils::getAudioDetails()
+    struct LibraryAudioDetails
+    {
+        // Kilobits per second
+        int bitrate = 0;
+        int sampleRate = 0;
+        int channels = 0;
+        // dB and peak amplitude, NaN if file doesn't have them
+        double replayGainTrack = std::numeric_limits<double>::quiet_NaN();
+        double replayGainAlbum = std::numeric_limits<double>::quiet_NaN();
+        double replayGainTrackPeak = std::numeric_limits<double>::quiet_NaN();
+        double replayGainAlbumPeak = std::numeric_limits<double>::quiet_NaN();
+    };
+
     class LibraryUtils final : public QObject
     {
         Q_OBJECT
-        Q_PROPERTY(bool databaseInitialized READ isDatabaseInitialized CONSTANT)
-        Q_PROPERTY(bool createdTable READ isCreatedTable CONSTANT)
+        Q_PROPERTY(bool initializingDatabase READ isInitializingDatabase NOTIFY databaseInitializedChanged)
+        Q_PROPERTY(bool databaseInitialized READ isDatabaseInitialized NOTIFY databaseInitializedChanged)
+        Q_PROPERTY(bool createdTable READ isCreatedTable NOTIFY databaseInitializedChanged)
+        Q_PROPERTY(bool hasSnapshot READ hasSnapshot CONSTANT)
         Q_PROPERTY(bool updating READ isUpdating NOTIFY updatingChanged)
+
+        // Progress of running update, updated twice a second
+        Q_PROPERTY(int scanDiscoveredFiles READ scanDiscoveredFiles NOTIFY scanProgressChanged)
+        Q_PROPERTY(int scanProcessedFiles READ scanProcessedFiles NOTIFY scanProgressChanged)
+        Q_PROPERTY(int scanSkippedFiles READ scanSkippedFiles NOTIFY scanProgressChanged)
+        Q_PROPERTY(qint64 scanBytesRead READ scanBytesRead NOTIFY scanProgressChanged)
+        Q_PROPERTY(QString scanDirectory READ scanDirectory NOTIFY scanProgressChanged)
+        Q_PROPERTY(double scanFilesPerSecond READ scanFilesPerSecond NOTIFY scanProgressChanged)
+        Q_PROPERTY(int scanEta READ scanEta NOTIFY scanProgressChanged)
         Q_PROPERTY(int artistsCount READ artistsCount NOTIFY databaseChanged)
         Q_PROPERTY(int albumsCount READ albumsCount NOTIFY databaseChanged)
         Q_PROPERTY(int tracksCount READ tracksCount NOTIFY databaseChanged)
         Q_PROPERTY(int tracksDuration READ tracksDuration NOTIFY databaseChanged)
         Q_PROPERTY(QString randomMediaArt READ randomMediaArt NOTIFY mediaArtChanged)
     public:
-        static const std::unordered_set<QString> mimeTypesExtensions;
-        static const std::unordered_set<QString> mimeTypesByContent;
-        static const std::unordered_set<QString> videoMimeTypesExtensions;
+        static const FlatHashSet<QString> mimeTypesExtensions;
+        static const FlatHashSet<QString> mimeTypesByContent;
+        static const FlatHashSet<QString> videoMimeTypesExtensions;
         static const QString databaseType;
         static LibraryUtils* instance();
 
         const QString& databaseFilePath();
+        const QString& mediaArtDirectory() const;
 
+        // Sets connection pragmas tuned for concurrent access from several threads
+        static void configureDatabase(const QSqlDatabase& db);
+        // Returns connection to library database owned by calling thread.
+        // It is opened on first call and kept until thread finishes, so that
+        // jobs of thread pool reuse it. Check isOpen() of returned connection
+        static QSqlDatabase threadDatabase(const QString& databaseFilePath);
+        static QSqlDatabase threadDatabase();
+        // Connection for read-only queries of library models: in-memory copy of database
+        // if it is enabled and up to date (see LibraryReplica), otherwise threadDatabase()
+        static QSqlDatabase readDatabase();
+
+        // Directory is listed only if it has changed since it was last listed,
+        // see DirectoryMediaArtCache
         static QString findMediaArtForDirectory(std::unordered_map<QString, QString>& mediaArtHash, const QString& directoryPath);
+        static QString findMediaArtForDirectory(const QString& directoryPath);
+
+        // Enabled with --explain-queries command line option
+        static bool explainQueries;
+        // Set by --library-service. Otherwise library updates are forwarded to
+        // LibraryService if it is installed, and library directories are not watched
+        static bool serviceMode;
+        // Logs query plan of prepared query, warns if query scans table without using index.
+        // Does nothing if explainQueries is false
+        static void explainQuery(const QSqlQuery& query, const QSqlDatabase& db);
+        static void explainQuery(const QSqlQuery& query);
+
+        // Recomputes summaries of artists and albums which tracks were changed, and smart playlists.
+        // Must be called in the same transaction that changed them
+        static bool updateSummaries(const QSqlDatabase& db);
 
+        // Emits libraryChanged() on main thread, can be called from any thread.
+        // Does nothing if changes are empty
+        static void notifyLibraryChanged(const LibraryChanges& changes);
+
+        // Fills temporary table query_keys (columns position, key0 and key1)
+        // with keys, so that they can be joined in one query. Must be called in transaction
+        static bool insertQueryKeys(const QSqlDatabase& db, const std::vector<QVariantList>& keys);
+
+        // Returns tracks with given file paths that are in library, using one query.
+        // Can be called from any thread with its own connection, must not be called in transaction
+        static std::unordered_map<QString, LibraryTrackMetadata> getTracksMetadata(const QSqlDatabase& db, const std::vector<QString>& filePaths);
+
+        // Returns false if track is not in library or it was added by older version
+        // which didn't store audio details. Can be called from any thread with its own connection
+        static bool getAudioDetails(const QSqlDatabase& db, const QString& filePath, LibraryAudioDetails& details);
+
+        // Sort key of title of track, artist or album, stored in sort key columns
+        // which are compared with BINARY collation. Case and accents are ignored,
+        // numbers are compared by value, empty strings are after other ones
+        // (their key is emptySortKey)
+        static QString sortKey(const QString& string);
+        static const QLatin1String emptySortKey;
+
+        // Artists or albums of track joined for display, without duplicates and empty titles.
+        // Stored by scan in displayArtist and displayAlbum columns. It is empty
+        // if track doesn't have them, readers show translated "Unknown artist" instead
+        static QString displayString(const QStringList& titles);
+        // NULL is less than any number, like in ORDER BY
+        static int intSortKey(const QVariant& value);
+
+        // Starts migrating database in background, databaseInitializedChanged() is emitted when it is done
         void initDatabase();
         Q_INVOKABLE void updateDatabase();
+        // Updates only given files and directories (recursively), including removed ones.
+        // Paths outside of library directories are ignored
+        Q_INVOKABLE void updateDatabaseForPaths(const QStringList& paths);
+        // Adds tracks from directory made by unplayer-indexer for volume mounted at volumeRoot,
+        // then updates library so that only files changed since indexing are read
+        Q_INVOKABLE void importLibrary(const QString& directory, const QString& volumeRoot);
+        // Clears library in background, media art directory is removed after that
         Q_INVOKABLE void resetDatabase();
+        // Stops running update after current batch of files is written.
+        // Interrupted scan is resumed by next update
+        Q_INVOKABLE void cancelUpdate();
+        // Runs queued library maintenance without waiting for device to be charging
+        Q_INVOKABLE void runMaintenance();
+        // Directory that user is looking at is scanned before others by running full update.
+        // Does nothing if library is not being updated
+        void prioritizeDirectory(const QString& directory);
+        // Logs execution statistics of all queries, called over D-Bus
+        Q_INVOKABLE void dumpQueryStatistics();
 
+        bool isInitializingDatabase();
         bool isDatabaseInitialized();
         bool isCreatedTable();
+        // Library snapshot from previous run is shown until database is opened
+        bool hasSnapshot();
         bool isUpdating();
 
+        int scanDiscoveredFiles() const;
+        int scanProcessedFiles() const;
+        int scanSkippedFiles() const;
+        qint64 scanBytesRead() const;
+        const QString& scanDirectory() const;
+        double scanFilesPerSecond() const;
+        // Duration of running or last scan in milliseconds
+        qint64 scanDuration() const;
+        // Estimated seconds until files that were discovered so far are processed, -1 if unknown
+        int scanEta() const;
+
         int artistsCount();
         int albumsCount();
         int tracksCount();
@@ -94,28 +237,83 @@ namespace unplayer
         Q_INVOKABLE QString randomMediaArtForAlbum(const QString& artist, const QString& album);
         Q_INVOKABLE QString randomMediaArtForGenre(const QString& genre);
 
+        // Copies image to media art directory and creates its thumbnail in background,
+        // then saves it as media art of album of artist. Tracks are not changed
         Q_INVOKABLE void setMediaArt(const QString& artist, const QString& album, const QString& mediaArt);
     private:
         LibraryUtils();
 
-        QString getTrackMediaArt(const QByteArray& embeddedMediaArtData,
-                                 std::unordered_map<QByteArray, QString>& embeddedMediaArtFiles,
-                                 const QFileInfo& fileInfo,
-                                 std::unordered_map<QString, QString>& mediaArtDirectories,
-                                 bool preferDirectoriesMediaArt);
-        QString saveEmbeddedMediaArt(const QByteArray& data, std::unordered_map<QByteArray, QString>& embeddedMediaArtFiles);
+        // Updates are run as jobs of JobManager
+        void startUpdatingDatabase();
+        void runDatabaseUpdate(int job);
+        void startUpdatingPaths();
+        void runPathsUpdate(int job);
+        void watchLibraryDirectories();
+        void updateStatistics();
+        void startScanProgress(int job);
+        void updateScanProgress();
+        void finishScanProgress();
+
+        void connectToService();
+        void callService(const QString& method, const QVariantList& arguments = QVariantList());
+        void reloadServiceSettings();
 
+        bool mInitializingDatabase;
         bool mDatabaseInitialized;
         bool mCreatedTable;
         bool mUpdating;
+        bool mUpdatingPaths;
+        std::unordered_set<QString> mPendingPaths;
+        // Imported before next full update
+        QString mImportDirectory;
+        QString mImportVolumeRoot;
+        LibraryWatcher* mLibraryWatcher;
+        LibraryMaintenance* mMaintenance;
+        bool mResettingDatabase;
+        // Library is updated by LibraryService
+        bool mUseService;
+
+        std::shared_ptr<ScanProgress> mScanProgress;
+        int mScanJob;
+        QTimer* mScanProgressTimer;
+        QElapsedTimer mScanTime;
+        int mScanDiscoveredFiles;
+        int mScanProcessedFiles;
+        int mScanSkippedFiles;
+        qint64 mScanBytesRead;
+        QString mScanDirectory;
+        double mScanFilesPerSecond;
+        qint64 mScanDuration;
+        int mScanEta;
 
         QString mDatabaseFilePath;
         QString mMediaArtDirectory;
-        QMimeDatabase mMimeDb;
+        int mThumbnailSize;
+
+        int mArtistsCount;
+        int mAlbumsCount;
+        int mTracksCount;
+        int mTracksDuration;
+
+    private slots:
+        void onServiceUpdatingChanged(bool updating);
+        void onServiceScanProgress(int discoveredFiles, int processedFiles, int skippedFiles, const QString& directory);
+        void onServiceLibraryChanged(const QStringList& artists, const QStringList& albums, const QStringList& genres, bool all);
+
     signals:
+        void databaseInitializedChanged();
         void updatingChanged();
         void databaseChanged();
+        // Emitted when library updater has committed part of changes and when it has finished.
+        // databaseChanged() is emitted as well
+        void libraryUpdateCommitted();
+        void scanProgressChanged();
+        // Emitted after changes are committed, models that show affected
+        // artists, albums and genres update their rows
+        void libraryChanged(const unplayer::LibraryChanges& changes);
         void mediaArtChanged();
+        // Emitted when media art chosen by user for album of artist is saved
+        void albumMediaArtChanged(const QString& artist, const QString& album);
     };
 }
 
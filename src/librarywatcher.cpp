@@ -0,0 +1,342 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "librarywatcher.h"
+
+#include <cerrno>
+#include <functional>
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QFutureWatcher>
+#include <QSocketNotifier>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "threadpools.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        // Wait until changes stop coming, but no longer than maxDebounceTime
+        const int debounceInterval = 3000;
+        const int maxDebounceTime = 30000;
+
+#ifdef Q_OS_LINUX
+        const uint32_t inotifyMask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+#endif
+
+        bool isBlacklisted(const QString& path, const QStringList& blacklistedDirectories)
+        {
+            for (const QString& directory : blacklistedDirectories) {
+                if (path == directory || path.startsWith(directory + QLatin1Char('/'))) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        QStringList listDirectories(const QStringList& topLevelDirectories, const QStringList& blacklistedDirectories)
+        {
+            QStringList directories;
+            for (const QString& topLevelDirectory : topLevelDirectories) {
+                if (!QFileInfo(topLevelDirectory).isDir() || isBlacklisted(topLevelDirectory, blacklistedDirectories)) {
+                    continue;
+                }
+                // Blacklisted directories are not entered
+                QStringList pending{topLevelDirectory};
+                std::unordered_set<QString> visitedLinks;
+                while (!pending.isEmpty()) {
+                    const QString directory(pending.takeLast());
+                    directories.push_back(directory);
+                    const QFileInfoList subdirectories(QDir(directory).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot));
+                    for (const QFileInfo& info : subdirectories) {
+                        if (isBlacklisted(info.filePath(), blacklistedDirectories)) {
+                            continue;
+                        }
+                        if (info.isSymLink() && !visitedLinks.insert(info.canonicalFilePath()).second) {
+                            continue;
+                        }
+                        pending.push_back(info.filePath());
+                    }
+                }
+            }
+            directories.removeDuplicates();
+            return directories;
+        }
+
+        QStringList cleanPaths(const QStringList& paths)
+        {
+            QStringList cleaned;
+            cleaned.reserve(paths.size());
+            for (const QString& path : paths) {
+                cleaned.push_back(QDir::cleanPath(path));
+            }
+            cleaned.removeDuplicates();
+            return cleaned;
+        }
+    }
+
+    LibraryWatcher::LibraryWatcher(QObject* parent)
+        : QObject(parent),
+          mInotifyFd(-1),
+          mInotifyNotifier(nullptr),
+          mInotifyLimitReached(false),
+          mFallbackWatcher(nullptr),
+          mGeneration(0)
+    {
+        mDebounceTimer.setSingleShot(true);
+        mDebounceTimer.setInterval(debounceInterval);
+        QObject::connect(&mDebounceTimer, &QTimer::timeout, this, &LibraryWatcher::emitChangedPaths);
+
+#ifdef Q_OS_LINUX
+        mInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (mInotifyFd != -1) {
+            mInotifyNotifier = new QSocketNotifier(mInotifyFd, QSocketNotifier::Read, this);
+            QObject::connect(mInotifyNotifier, &QSocketNotifier::activated, this, &LibraryWatcher::readInotifyEvents);
+            return;
+        }
+        qWarning() << "failed to initialize inotify, falling back to QFileSystemWatcher";
+#endif
+
+        mFallbackWatcher = new QFileSystemWatcher(this);
+        QObject::connect(mFallbackWatcher, &QFileSystemWatcher::directoryChanged, this, [=](const QString& directory) {
+            if (QFileInfo(directory).isDir()) {
+                // Watch new subdirectories
+                addWatches(listDirectories({directory}, mBlacklistedDirectories));
+            }
+            addChangedPath(directory);
+        });
+    }
+
+    LibraryWatcher::~LibraryWatcher()
+    {
+#ifdef Q_OS_LINUX
+        if (mInotifyFd != -1) {
+            close(mInotifyFd);
+        }
+#endif
+    }
+
+    void LibraryWatcher::setDirectories(const QStringList& directories, const QStringList& blacklistedDirectories)
+    {
+        removeAllWatches();
+
+        mDirectories = cleanPaths(directories);
+        mBlacklistedDirectories = cleanPaths(blacklistedDirectories);
+        ++mGeneration;
+
+        // Listing all directories is slow, do it in background
+        const int generation = mGeneration;
+        const QStringList topLevelDirectories(mDirectories);
+        const QStringList blacklisted(mBlacklistedDirectories);
+        auto watcher = new QFutureWatcher<QStringList>(this);
+        QObject::connect(watcher, &QFutureWatcher<QStringList>::finished, this, [=]() {
+            if (generation == mGeneration) {
+                const QStringList directories(watcher->result());
+                addWatches(directories);
+                qDebug() << "watching" << directories.size() << "library directories";
+            }
+            watcher->deleteLater();
+        });
+        watcher->setFuture(threadpools::run(threadpools::JobClass::Scan, std::bind(listDirectories, topLevelDirectories, blacklisted)));
+    }
+
+    void LibraryWatcher::addWatches(const QStringList& directories)
+    {
+        if (mFallbackWatcher) {
+            QStringList newDirectories;
+            const QStringList watched(mFallbackWatcher->directories());
+            for (const QString& directory : directories) {
+                if (!watched.contains(directory)) {
+                    newDirectories.push_back(directory);
+                }
+            }
+            if (!newDirectories.isEmpty()) {
+                mFallbackWatcher->addPaths(newDirectories);
+            }
+            return;
+        }
+
+        for (const QString& directory : directories) {
+            addWatch(directory);
+        }
+    }
+
+    void LibraryWatcher::addWatch(const QString& directory)
+    {
+#ifdef Q_OS_LINUX
+        if (mInotifyLimitReached) {
+            return;
+        }
+        const int wd = inotify_add_watch(mInotifyFd, QFile::encodeName(directory).constData(), inotifyMask);
+        if (wd == -1) {
+            if (errno == ENOSPC) {
+                qWarning() << "inotify watches limit reached, some directories will not be watched";
+                mInotifyLimitReached = true;
+            } else {
+                qWarning() << "failed to watch directory" << directory;
+            }
+            return;
+        }
+        // inotify returns the same descriptor if directory is already watched
+        mInotifyWatches[wd] = directory;
+#else
+        Q_UNUSED(directory)
+#endif
+    }
+
+    void LibraryWatcher::removeWatches(const QString& directory)
+    {
+        const QString prefix(directory + QLatin1Char('/'));
+        if (mFallbackWatcher) {
+            QStringList removed;
+            for (const QString& watched : mFallbackWatcher->directories()) {
+                if (watched == directory || watched.startsWith(prefix)) {
+                    removed.push_back(watched);
+                }
+            }
+            if (!removed.isEmpty()) {
+                mFallbackWatcher->removePaths(removed);
+            }
+            return;
+        }
+
+#ifdef Q_OS_LINUX
+        for (auto i = mInotifyWatches.begin(), end = mInotifyWatches.end(); i != end;) {
+            if (i->second == directory || i->second.startsWith(prefix)) {
+                inotify_rm_watch(mInotifyFd, i->first);
+                i = mInotifyWatches.erase(i);
+            } else {
+                ++i;
+            }
+        }
+#endif
+    }
+
+    void LibraryWatcher::removeAllWatches()
+    {
+        if (mFallbackWatcher) {
+            const QStringList directories(mFallbackWatcher->directories());
+            if (!directories.isEmpty()) {
+                mFallbackWatcher->removePaths(directories);
+            }
+            return;
+        }
+
+#ifdef Q_OS_LINUX
+        for (const auto& watch : mInotifyWatches) {
+            inotify_rm_watch(mInotifyFd, watch.first);
+        }
+        mInotifyWatches.clear();
+        mInotifyLimitReached = false;
+#endif
+    }
+
+    void LibraryWatcher::readInotifyEvents()
+    {
+#ifdef Q_OS_LINUX
+        alignas(inotify_event) char buffer[4096];
+        while (true) {
+            const ssize_t length = read(mInotifyFd, buffer, sizeof(buffer));
+            if (length <= 0) {
+                break;
+            }
+
+            for (const char* pointer = buffer; pointer < buffer + length;) {
+                const auto event = reinterpret_cast<const inotify_event*>(pointer);
+                pointer += sizeof(inotify_event) + event->len;
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    qWarning() << "inotify queue overflow, updating all library directories";
+                    for (const QString& directory : mDirectories) {
+                        addChangedPath(directory);
+                    }
+                    continue;
+                }
+
+                const auto found(mInotifyWatches.find(event->wd));
+                if (found == mInotifyWatches.end()) {
+                    continue;
+                }
+
+                if (event->mask & IN_IGNORED) {
+                    mInotifyWatches.erase(found);
+                    continue;
+                }
+
+                const QString path(event->len > 0 ? QString::fromLatin1("%1/%2").arg(found->second, QFile::decodeName(event->name))
+                                                  : found->second);
+
+                if (event->mask & IN_ISDIR) {
+                    if (event->mask & IN_MOVED_FROM) {
+                        removeWatches(path);
+                    } else if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                        addWatches(listDirectories({path}, mBlacklistedDirectories));
+                    }
+                } else if (event->mask & IN_CREATE) {
+                    // Wait for IN_CLOSE_WRITE
+                    continue;
+                }
+
+                addChangedPath(path);
+            }
+        }
+#endif
+    }
+
+    void LibraryWatcher::addChangedPath(const QString& path)
+    {
+        if (isBlacklisted(path, mBlacklistedDirectories)) {
+            return;
+        }
+
+        if (mChangedPaths.empty()) {
+            mFirstChangeTimer.start();
+        }
+        mChangedPaths.insert(path);
+
+        if (mFirstChangeTimer.elapsed() < maxDebounceTime || !mDebounceTimer.isActive()) {
+            mDebounceTimer.start();
+        }
+    }
+
+    void LibraryWatcher::emitChangedPaths()
+    {
+        if (mChangedPaths.empty()) {
+            return;
+        }
+
+        QStringList paths;
+        paths.reserve(mChangedPaths.size());
+        for (const QString& path : mChangedPaths) {
+            paths.push_back(path);
+        }
+        mChangedPaths.clear();
+
+        qDebug() << "library paths changed:" << paths.size();
+        emit pathsChanged(paths);
+    }
+}
@@ -0,0 +1,80 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_LIBRARYWATCHER_H
+#define UNPLAYER_LIBRARYWATCHER_H
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QStringList>
+#include <QTimer>
+
+#include "stdutils.h"
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+
+namespace unplayer
+{
+    // Watches library directories and reports changed files and directories.
+    // Uses inotify on Linux, QFileSystemWatcher otherwise.
+    class LibraryWatcher final : public QObject
+    {
+        Q_OBJECT
+    public:
+        explicit LibraryWatcher(QObject* parent = nullptr);
+        ~LibraryWatcher() override;
+
+        void setDirectories(const QStringList& directories, const QStringList& blacklistedDirectories);
+
+    private:
+        void addWatches(const QStringList& directories);
+        void addWatch(const QString& directory);
+        void removeWatches(const QString& directory);
+        void removeAllWatches();
+
+        void readInotifyEvents();
+
+        void addChangedPath(const QString& path);
+        void emitChangedPaths();
+
+        QStringList mDirectories;
+        QStringList mBlacklistedDirectories;
+
+        int mInotifyFd;
+        QSocketNotifier* mInotifyNotifier;
+        std::unordered_map<int, QString> mInotifyWatches;
+        bool mInotifyLimitReached;
+
+        QFileSystemWatcher* mFallbackWatcher;
+
+        std::unordered_set<QString> mChangedPaths;
+        QTimer mDebounceTimer;
+        QElapsedTimer mFirstChangeTimer;
+
+        // Increased on every setDirectories() call to discard stale directory listings
+        int mGeneration;
+    signals:
+        void pathsChanged(const QStringList& paths);
+    };
+}
+
+#endif // UNPLAYER_LIBRARYWATCHER_H
@@ -16,62 +16,369 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <memory>
 
 #include <QCommandLineParser>
+#include <QCoreApplication>
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
 #include <QDBusMessage>
+#include <QDebug>
+#include <QFileInfo>
 #include <QGuiApplication>
 #include <QQuickView>
 #include <QQmlContext>
 #include <QQmlEngine>
+#include <QSqlError>
+#include <QTextStream>
 #include <qqml.h>
 
 #include <sailfishapp.h>
 
+#include "artimageprovider.h"
+#include "directorylistingcache.h"
+#include "libraryservice.h"
 #include "libraryutils.h"
+#include "memorypressure.h"
+#include "perfcounters.h"
 #include "player.h"
 #include "queue.h"
+#include "queuedbusservice.h"
 #include "settings.h"
+#include "sqlquery.h"
+#include "stallwatchdog.h"
+#include "tracing.h"
 #include "utils.h"
 
 using namespace unplayer;
 
-int main(int argc, char* argv[])
+namespace
 {
-    const std::unique_ptr<QGuiApplication> app(SailfishApp::application(argc, argv));
-    app->setApplicationVersion(QLatin1String(UNPLAYER_VERSION));
+    const QLatin1String serviceName("org.equeim.unplayer");
+
+    struct CommandLine
+    {
+        QCommandLineParser parser;
+        QCommandLineOption explainQueriesOption;
+        QCommandLineOption importOption;
+        QCommandLineOption libraryServiceOption;
+        QCommandLineOption profileStartupOption;
+        QCommandLineOption scanOption;
+        QCommandLineOption slowQueryThresholdOption;
+        QCommandLineOption stallThresholdOption;
+        QCommandLineOption statsOption;
+        QCommandLineOption volumeOption;
+
+        explicit CommandLine(const QCoreApplication* app)
+            : explainQueriesOption(QLatin1String("explain-queries"),
+                                   QLatin1String("Log query plans of library queries and warn about queries not using indexes")),
+              importOption(QLatin1String("import"),
+                           QLatin1String("Add tracks from directory made by unplayer-indexer before scanning, implies --scan"),
+                           QLatin1String("directory")),
+              libraryServiceOption(QLatin1String("library-service"),
+                                   QLatin1String("Run library update service without window, started by systemd")),
+              profileStartupOption(QLatin1String("profile-startup"),
+                                   QLatin1String("Log time of startup phases")),
+              scanOption(QLatin1String("scan"),
+                         QLatin1String("Update library without showing window, print summary and exit")),
+              slowQueryThresholdOption(QLatin1String("slow-query-threshold"),
+                                       QLatin1String("Log library queries that take longer than given time with their plans, 0 disables logging"),
+                                       QLatin1String("milliseconds"),
+                                       QLatin1String("100")),
+              stallThresholdOption(QLatin1String("stall-threshold"),
+                                   QLatin1String("Log when main thread doesn't process events for longer than given time"),
+                                   QLatin1String("milliseconds")),
+              statsOption(QLatin1String("stats"),
+                          QLatin1String("Print library, directory and query statistics after --scan")),
+              volumeOption(QLatin1String("volume"),
+                           QLatin1String("Mount point of volume indexed for --import, SD card by default"),
+                           QLatin1String("path"))
+        {
+            parser.addPositionalArgument(QLatin1String("files"), QLatin1String("Music files"));
+            parser.addOption(explainQueriesOption);
+            parser.addOption(importOption);
+            parser.addOption(libraryServiceOption);
+            parser.addOption(profileStartupOption);
+            parser.addOption(scanOption);
+            parser.addOption(slowQueryThresholdOption);
+            parser.addOption(stallThresholdOption);
+            parser.addOption(statsOption);
+            parser.addOption(volumeOption);
+            parser.addHelpOption();
+            parser.addVersionOption();
+            parser.process(*app);
+        }
+
+        bool isScan() const
+        {
+            return parser.isSet(scanOption) || parser.isSet(importOption);
+        }
 
-    QCommandLineParser parser;
-    parser.addPositionalArgument(QLatin1String("files"), QLatin1String("Music files"));
-    parser.addHelpOption();
-    parser.addVersionOption();
-    parser.process(app->arguments());
+        bool isLibraryService() const
+        {
+            return parser.isSet(libraryServiceOption);
+        }
+    };
 
-    const QDBusConnection connection(QDBusConnection::sessionBus());
-    if (connection.interface()->isServiceRegistered(QLatin1String("org.equeim.unplayer"))) {
-        QDBusMessage message(QDBusMessage::createMethodCall(QLatin1String("org.equeim.unplayer"),
+    // Calls method of already running instance, returns false if there is none
+    bool forwardToRunningInstance(const QString& method, const QVariantList& arguments)
+    {
+        const QDBusConnection connection(QDBusConnection::sessionBus());
+        if (!connection.isConnected() || !connection.interface()->isServiceRegistered(serviceName)) {
+            return false;
+        }
+        QDBusMessage message(QDBusMessage::createMethodCall(serviceName,
                                                             QLatin1String("/org/equeim/unplayer"),
-                                                            QLatin1String("org.equeim.unplayer"),
-                                                            QLatin1String("addTracksToQueue")));
-        message.setArguments({Utils::parseArguments(parser.positionalArguments())});
+                                                            serviceName,
+                                                            method));
+        message.setArguments(arguments);
         connection.call(message);
+        return true;
+    }
+
+    // Forwards command line to already running instance. Returns true if
+    // there is one and this instance should exit
+    bool forwardCommandLine(const CommandLine& commandLine)
+    {
+        if (commandLine.isScan()) {
+            // Two instances should not update the same database
+            if (commandLine.parser.isSet(commandLine.importOption)) {
+                if (forwardToRunningInstance(QLatin1String("importLibrary"), {QFileInfo(commandLine.parser.value(commandLine.importOption)).absoluteFilePath(),
+                                                                              commandLine.parser.value(commandLine.volumeOption)})) {
+                    qDebug() << "library import was started in running instance";
+                    return true;
+                }
+            } else if (forwardToRunningInstance(QLatin1String("updateLibrary"), {})) {
+                qDebug() << "library update was started in running instance";
+                return true;
+            }
+            return false;
+        }
+        return !commandLine.isLibraryService() &&
+               forwardToRunningInstance(QLatin1String("addTracksToQueue"),
+                                        {Utils::parseArguments(commandLine.parser.positionalArguments())});
+    }
+
+    void printScanSummary(bool stats)
+    {
+        LibraryUtils* library = LibraryUtils::instance();
+        QTextStream out(stdout);
+
+        const qint64 duration = library->scanDuration();
+        const qint64 bytesRead = library->scanBytesRead();
+        out << "scanned " << library->scanProcessedFiles() << " files, "
+            << library->scanSkippedFiles() << " of " << library->scanDiscoveredFiles() << " files were unchanged\n";
+        out << "time: " << duration << " ms, "
+            << library->scanFilesPerSecond() << " files/s, "
+            << Utils::formatByteSize(bytesRead) << " read";
+        if (duration > 0) {
+            out << " (" << Utils::formatByteSize(bytesRead * 1000.0 / duration) << "/s)";
+        }
+        out << '\n';
+
+        if (!stats) {
+            return;
+        }
+
+        out << "\nlibrary: " << library->tracksCount() << " tracks, "
+            << library->artistsCount() << " artists, "
+            << library->albumsCount() << " albums\n";
+
+        out << "\nslowest directories:\n";
+        SqlQuery query(QLatin1String("SELECT directory, examinedFiles, parsedFiles, bytesRead, time, errors "
+                                     "FROM scanStatistics ORDER BY time DESC LIMIT 10"));
+        if (query.lastError().type() != QSqlError::NoError) {
+            qWarning() << "failed to get scan statistics" << query.lastError();
+        }
+        while (query.next()) {
+            out << "  " << query.value(4).toLongLong() << " ms, "
+                << query.value(2).toInt() << " of " << query.value(1).toInt() << " files parsed, "
+                << Utils::formatByteSize(query.value(3).toLongLong()) << " read, "
+                << query.value(5).toInt() << " errors: "
+                << query.value(0).toString() << '\n';
+        }
+        query.finish();
+
+        out << "\nslowest queries:\n";
+        const std::vector<SqlQuery::Statistics> statistics(SqlQuery::statistics());
+        for (std::size_t i = 0, max = std::min(statistics.size(), std::size_t(10)); i < max; ++i) {
+            const SqlQuery::Statistics& entry = statistics[i];
+            out << "  " << entry.total / 1000000 << " ms total, "
+                << entry.max / 1000000 << " ms max, "
+                << entry.executions << " executions, "
+                << entry.rows << " rows: "
+                << entry.query << '\n';
+        }
+    }
+
+    // Updates library without creating window or player and returns exit code.
+    // If importDirectory is not empty, library made by unplayer-indexer is imported first
+    int scanLibrary(QCoreApplication& app, bool stats, const QString& importDirectory, const QString& volumeRoot)
+    {
+        LibraryUtils* library = LibraryUtils::instance();
+        QObject::connect(library, &LibraryUtils::databaseInitializedChanged, &app, [&app, library, importDirectory, volumeRoot]() {
+            if (library->isInitializingDatabase()) {
+                return;
+            }
+            if (library->isDatabaseInitialized()) {
+                if (importDirectory.isEmpty()) {
+                    library->updateDatabase();
+                } else {
+                    library->importLibrary(importDirectory, volumeRoot);
+                }
+            } else {
+                qWarning() << "failed to open database";
+                app.exit(1);
+            }
+        });
+        // Queued so that statistics are updated first
+        QObject::connect(library, &LibraryUtils::updatingChanged, &app, [&app, library, stats]() {
+            if (!library->isUpdating()) {
+                printScanSummary(stats);
+                app.quit();
+            }
+        }, Qt::QueuedConnection);
+        return app.exec();
+    }
+
+    // Exports LibraryService until session ends. Library is updated on start,
+    // so that changes made while service was not running are picked up,
+    // then library directories are watched
+    int runLibraryService(QCoreApplication& app)
+    {
+        LibraryUtils::serviceMode = true;
+        LibraryUtils* library = LibraryUtils::instance();
+        auto service = new LibraryService(&app);
+        new PerfCountersDBusService(&app);
+        QObject::connect(library, &LibraryUtils::databaseInitializedChanged, &app, [&app, library, service]() {
+            if (library->isInitializingDatabase()) {
+                return;
+            }
+            if (!library->isDatabaseInitialized()) {
+                qWarning() << "failed to open database";
+                app.exit(1);
+                return;
+            }
+            if (!service->registerService()) {
+                app.exit(1);
+                return;
+            }
+            if (Settings::instance()->hasLibraryDirectories()) {
+                library->updateDatabase();
+            }
+        });
+        return app.exec();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Utils::startupTimer.start();
+    tracing::init();
+
+    const std::unique_ptr<QGuiApplication> app(SailfishApp::application(argc, argv));
+    app->setApplicationVersion(QLatin1String(UNPLAYER_VERSION));
+
+    const CommandLine commandLine(app.get());
+    // Checked before anything else is created
+    if (forwardCommandLine(commandLine)) {
         return 0;
     }
+    Utils::profileStartup = commandLine.parser.isSet(commandLine.profileStartupOption);
+    Utils::reportStartupPhase("application created");
+
+    LibraryUtils::explainQueries = commandLine.parser.isSet(commandLine.explainQueriesOption);
+    SqlQuery::slowQueryThreshold = commandLine.parser.value(commandLine.slowQueryThresholdOption).toInt();
+
+    std::unique_ptr<StallWatchdog> watchdog;
+    const int stallThreshold = commandLine.parser.value(commandLine.stallThresholdOption).toInt();
+    if (stallThreshold > 0) {
+        watchdog.reset(new StallWatchdog(stallThreshold));
+        watchdog->start();
+    }
 
-    const std::unique_ptr<QQuickView> view(SailfishApp::createView());
+    if (commandLine.isLibraryService()) {
+        const int result = runLibraryService(*app);
+        tracing::finish();
+        return result;
+    }
+
+    if (commandLine.isScan()) {
+        QString importDirectory;
+        QString volumeRoot;
+        if (commandLine.parser.isSet(commandLine.importOption)) {
+            importDirectory = QFileInfo(commandLine.parser.value(commandLine.importOption)).absoluteFilePath();
+            volumeRoot = commandLine.parser.value(commandLine.volumeOption);
+            if (volumeRoot.isEmpty()) {
+                volumeRoot = Utils::sdcardPath(true);
+                if (volumeRoot.isEmpty()) {
+                    qWarning() << "SD card is not mounted, use --volume";
+                    return 1;
+                }
+            }
+        }
+        const int result = scanLibrary(*app, commandLine.parser.isSet(commandLine.statsOption), importDirectory, volumeRoot);
+        tracing::finish();
+        return result;
+    }
+
+    const std::unique_ptr<QQuickView> view([]() {
+        UNPLAYER_TRACE("startup: create view");
+        return SailfishApp::createView();
+    }());
+
+    view->rootContext()->setContextProperty(QLatin1String("commandLineArguments"), Utils::parseArguments(commandLine.parser.positionalArguments()));
 
-    view->rootContext()->setContextProperty(QLatin1String("commandLineArguments"), Utils::parseArguments(parser.positionalArguments()));
+    {
+        UNPLAYER_TRACE("startup: create singletons");
+        Settings::instance();
+        LibraryUtils::instance();
+        Utils::registerTypes();
+    }
 
-    Settings::instance();
-    LibraryUtils::instance();
-    Utils::registerTypes();
+    new QueueDBusService(Player::instance()->queue(), app.get());
+    new PerfCountersDBusService(app.get());
 
     view->engine()->addImageProvider(QueueImageProvider::providerId, new QueueImageProvider(Player::instance()->queue()));
+    view->engine()->addImageProvider(ArtImageProvider::providerId, new ArtImageProvider(LibraryUtils::instance()->mediaArtDirectory()));
+
+    // Warning level drops what can be recreated cheaply, critical level drops everything
+    // that is not visible. Library query caches are trimmed by AsyncQueryModel itself
+    QObject::connect(MemoryPressure::instance(), &MemoryPressure::trimRequested, view.get(), [&view](MemoryPressure::Level level) {
+        ArtImageProvider::instance()->trimCache(level);
+        QueueImageProvider::instance()->trimCache(level);
+        DirectoryListingCache::instance().clear();
+        view->engine()->trimComponentCache();
+        if (level == MemoryPressure::Level::Critical) {
+            Player::instance()->queue()->unloadMediaArt();
+            view->releaseResources();
+            view->engine()->collectGarbage();
+            if (LibraryUtils::instance()->isDatabaseInitialized()) {
+                SqlQuery query(QLatin1String("PRAGMA shrink_memory"));
+                if (query.lastError().type() != QSqlError::NoError) {
+                    qWarning() << "failed to shrink database memory" << query.lastError();
+                }
+            }
+        }
+    });
 
-    view->setSource(SailfishApp::pathTo(QLatin1String("qml/main.qml")));
+    {
+        UNPLAYER_TRACE("startup: load QML");
+        view->setSource(SailfishApp::pathTo(QLatin1String("qml/main.qml")));
+    }
+    Utils::reportStartupPhase("QML loaded");
     view->show();
 
-    return app->exec();
+    if (Utils::profileStartup) {
+        auto connection = std::make_shared<QMetaObject::Connection>();
+        *connection = QObject::connect(view.get(), &QQuickWindow::frameSwapped, view.get(), [connection]() {
+            Utils::reportStartupPhase("first frame");
+            QObject::disconnect(*connection);
+        }, Qt::QueuedConnection);
+    }
+
+    const int result = app->exec();
+    tracing::finish();
+    return result;
 }
@@ -0,0 +1,95 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "memorypressure.h"
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusPendingCall>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDebug>
+
+namespace unplayer
+{
+    namespace
+    {
+        MemoryPressure* instancePointer = nullptr;
+
+        const QLatin1String mceService("com.nokia.mce");
+        const QLatin1String mceRequestPath("/com/nokia/mce/request");
+        const QLatin1String mceRequestInterface("com.nokia.mce.request");
+        const QLatin1String mceSignalPath("/com/nokia/mce/signal");
+        const QLatin1String mceSignalInterface("com.nokia.mce.signal");
+    }
+
+    MemoryPressure* MemoryPressure::instance()
+    {
+        if (!instancePointer) {
+            instancePointer = new MemoryPressure(qApp);
+        }
+        return instancePointer;
+    }
+
+    MemoryPressure::Level MemoryPressure::level() const
+    {
+        return mLevel;
+    }
+
+    MemoryPressure::MemoryPressure(QObject* parent)
+        : QObject(parent),
+          mLevel(Level::Normal)
+    {
+        QDBusConnection bus(QDBusConnection::systemBus());
+        bus.connect(mceService, mceSignalPath, mceSignalInterface, QLatin1String("sig_memory_level_ind"),
+                    this, SLOT(onMemoryLevelChanged(QString)));
+
+        const QDBusMessage message(QDBusMessage::createMethodCall(mceService, mceRequestPath, mceRequestInterface,
+                                                                  QLatin1String("get_memory_level")));
+        auto watcher = new QDBusPendingCallWatcher(bus.asyncCall(message), this);
+        QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this, [=]() {
+            const QDBusPendingReply<QString> reply(*watcher);
+            if (reply.isValid()) {
+                onMemoryLevelChanged(reply.value());
+            } else {
+                qDebug() << "failed to get memory level from MCE:" << reply.error().message();
+            }
+            watcher->deleteLater();
+        });
+    }
+
+    void MemoryPressure::onMemoryLevelChanged(const QString& level)
+    {
+        Level newLevel = Level::Normal;
+        if (level == QLatin1String("warning")) {
+            newLevel = Level::Warning;
+        } else if (level == QLatin1String("critical")) {
+            newLevel = Level::Critical;
+        }
+
+        if (newLevel == mLevel) {
+            return;
+        }
+        qDebug() << "memory level changed to" << level;
+        mLevel = newLevel;
+        if (mLevel != Level::Normal) {
+            emit trimRequested(mLevel);
+        }
+    }
+}
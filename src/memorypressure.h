@@ -0,0 +1,60 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_MEMORYPRESSURE_H
+#define UNPLAYER_MEMORYPRESSURE_H
+
+#include <QObject>
+
+namespace unplayer
+{
+    // Tracks memory level reported by MCE on Sailfish OS and asks caches to release memory.
+    // If MCE is not available memory level is always normal
+    class MemoryPressure final : public QObject
+    {
+        Q_OBJECT
+    public:
+        enum class Level
+        {
+            Normal,
+            // Caches drop everything except what is visible or about to be shown
+            Warning,
+            // Caches are cleared
+            Critical
+        };
+
+        static MemoryPressure* instance();
+
+        Level level() const;
+
+    private:
+        explicit MemoryPressure(QObject* parent);
+
+        Level mLevel;
+
+    private slots:
+        void onMemoryLevelChanged(const QString& level);
+
+    signals:
+        // Emitted on main thread when memory level rises above normal, and again
+        // on every change while it stays above normal
+        void trimRequested(unplayer::MemoryPressure::Level level);
+    };
+}
+
+#endif // UNPLAYER_MEMORYPRESSURE_H
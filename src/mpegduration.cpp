@@ -0,0 +1,398 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mpegduration.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <tbytevector.h>
+#include <tiostream.h>
+
+namespace unplayer
+{
+    namespace mpegduration
+    {
+        namespace
+        {
+            const unsigned int headerSize = 4;
+            // Frames are searched this far from expected position
+            const long long maxSyncDistance = 64 * 1024;
+            const unsigned int syncBlockSize = 4096;
+            // Enough for Xing header with LAME tag
+            const unsigned int vbrHeaderMaxSize = 512;
+            const int sampledPositionsCount = 3;
+            const int framesPerSample = 32;
+
+            enum class Version
+            {
+                Mpeg1,
+                Mpeg2,
+                Mpeg25
+            };
+
+            struct FrameHeader
+            {
+                Version version;
+                int layer;
+                // Kilobits per second
+                int bitrate;
+                int sampleRate;
+                int samplesPerFrame;
+                // Bytes, including header
+                int frameSize;
+                bool mono;
+            };
+
+            // Index is bitrate bits of header, 0 means free format which is not supported
+            const int bitrates[5][15] = {
+                // MPEG-1 Layer I
+                {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+                // MPEG-1 Layer II
+                {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+                // MPEG-1 Layer III
+                {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+                // MPEG-2/2.5 Layer I
+                {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+                // MPEG-2/2.5 Layer II and III
+                {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}
+            };
+
+            const int sampleRates[3] = {44100, 48000, 32000};
+
+            TagLib::ByteVector readAt(TagLib::IOStream* stream, long long offset, unsigned long length)
+            {
+                stream->seek(static_cast<long>(offset));
+                return stream->readBlock(length);
+            }
+
+            const unsigned char* bytesAt(const TagLib::ByteVector& data, unsigned int offset)
+            {
+                return reinterpret_cast<const unsigned char*>(data.data()) + offset;
+            }
+
+            bool parseHeader(const TagLib::ByteVector& data, unsigned int offset, FrameHeader& header)
+            {
+                if (data.size() < offset + headerSize) {
+                    return false;
+                }
+
+                const unsigned char* bytes = bytesAt(data, offset);
+                if (bytes[0] != 0xFF || (bytes[1] & 0xE0) != 0xE0) {
+                    return false;
+                }
+
+                const int versionBits = (bytes[1] >> 3) & 0x03;
+                const int layerBits = (bytes[1] >> 1) & 0x03;
+                const int bitrateIndex = bytes[2] >> 4;
+                const int sampleRateIndex = (bytes[2] >> 2) & 0x03;
+                if (versionBits == 1 || layerBits == 0 || bitrateIndex == 0 || bitrateIndex == 15 || sampleRateIndex == 3) {
+                    return false;
+                }
+
+                switch (versionBits) {
+                case 3:
+                    header.version = Version::Mpeg1;
+                    header.sampleRate = sampleRates[sampleRateIndex];
+                    break;
+                case 2:
+                    header.version = Version::Mpeg2;
+                    header.sampleRate = sampleRates[sampleRateIndex] / 2;
+                    break;
+                default:
+                    header.version = Version::Mpeg25;
+                    header.sampleRate = sampleRates[sampleRateIndex] / 4;
+                }
+
+                header.layer = 4 - layerBits;
+                if (header.version == Version::Mpeg1) {
+                    header.bitrate = bitrates[header.layer - 1][bitrateIndex];
+                } else {
+                    header.bitrate = bitrates[header.layer == 1 ? 3 : 4][bitrateIndex];
+                }
+
+                const int padding = (bytes[2] >> 1) & 0x01;
+                if (header.layer == 1) {
+                    header.samplesPerFrame = 384;
+                    header.frameSize = (12000 * header.bitrate / header.sampleRate + padding) * 4;
+                } else {
+                    header.samplesPerFrame = (header.layer == 3 && header.version != Version::Mpeg1) ? 576 : 1152;
+                    header.frameSize = header.samplesPerFrame / 8 * 1000 * header.bitrate / header.sampleRate + padding;
+                }
+
+                header.mono = (bytes[3] >> 6) == 3;
+
+                return true;
+            }
+
+            bool isSameStream(const FrameHeader& first, const FrameHeader& second)
+            {
+                return first.version == second.version &&
+                       first.layer == second.layer &&
+                       first.sampleRate == second.sampleRate;
+            }
+
+            // Skips ID3v2 tag
+            long long audioStart(TagLib::IOStream* stream)
+            {
+                const TagLib::ByteVector data(readAt(stream, 0, 10));
+                if (data.size() < 10 || !data.startsWith("ID3")) {
+                    return 0;
+                }
+                // Size is a synchsafe integer and doesn't include header and footer
+                const unsigned char* size = bytesAt(data, 6);
+                long long start = ((size[0] & 0x7F) << 21) | ((size[1] & 0x7F) << 14) | ((size[2] & 0x7F) << 7) | (size[3] & 0x7F);
+                start += 10;
+                if (data[5] & 0x10) {
+                    start += 10;
+                }
+                return start;
+            }
+
+            // Skips ID3v1 and APE tags
+            long long audioEnd(TagLib::IOStream* stream, long long start)
+            {
+                long long end = stream->length();
+                if (end - start >= 128 && readAt(stream, end - 128, 3) == "TAG") {
+                    end -= 128;
+                }
+                if (end - start >= 32) {
+                    const TagLib::ByteVector footer(readAt(stream, end - 32, 32));
+                    if (footer.size() == 32 && footer.startsWith("APETAGEX")) {
+                        // Size includes footer but not header
+                        long long size = footer.toUInt(12, false);
+                        if (footer.toUInt(20, false) & 0x80000000) {
+                            size += 32;
+                        }
+                        end = std::max(start, end - size);
+                    }
+                }
+                return end;
+            }
+
+            // Finds frame at or after offset. Next frame must belong to the same stream
+            // so that random sync bytes in tags or garbage are not mistaken for frame
+            bool findFrame(TagLib::IOStream* stream, long long offset, long long end, long long& frameOffset, FrameHeader& header)
+            {
+                const long long limit = std::min(end, offset + maxSyncDistance);
+                for (; offset + headerSize <= limit; offset += syncBlockSize) {
+                    const TagLib::ByteVector data(readAt(stream, offset, syncBlockSize + headerSize - 1));
+                    for (unsigned int i = 0; i + headerSize <= data.size() && offset + i < limit; ++i) {
+                        if (!parseHeader(data, i, header)) {
+                            continue;
+                        }
+                        const long long nextOffset = offset + i + header.frameSize;
+                        FrameHeader next;
+                        if (nextOffset + headerSize > end ||
+                                (parseHeader(readAt(stream, nextOffset, headerSize), 0, next) && isSameStream(header, next))) {
+                            frameOffset = offset + i;
+                            return true;
+                        }
+                    }
+                    if (data.size() < syncBlockSize) {
+                        break;
+                    }
+                }
+                return false;
+            }
+
+            // Reads number of samples and optionally size of stream from Xing/Info or VBRI header
+            // of the first frame. Returns false if there is no such header or it doesn't have frames count
+            bool readVbrHeader(TagLib::IOStream* stream, long long frameOffset, const FrameHeader& header, long long& samples, long long& bytes)
+            {
+                const TagLib::ByteVector frame(readAt(stream, frameOffset, std::min(static_cast<unsigned int>(header.frameSize), vbrHeaderMaxSize)));
+
+                // Xing header is placed after side information
+                const unsigned int xingOffset = headerSize + ((header.version == Version::Mpeg1) ? (header.mono ? 17 : 32)
+                                                                                                  : (header.mono ? 9 : 17));
+                if (frame.containsAt("Xing", xingOffset) || frame.containsAt("Info", xingOffset)) {
+                    if (frame.size() < xingOffset + 12) {
+                        return false;
+                    }
+                    const unsigned int flags = frame.toUInt(xingOffset + 4);
+                    if (!(flags & 0x01)) {
+                        return false;
+                    }
+                    unsigned int position = xingOffset + 8;
+                    const long long frames = frame.toUInt(position);
+                    position += 4;
+                    if (flags & 0x02) {
+                        if (frame.size() >= position + 4) {
+                            bytes = frame.toUInt(position);
+                        }
+                        position += 4;
+                    }
+                    // TOC
+                    if (flags & 0x04) {
+                        position += 100;
+                    }
+                    // Quality
+                    if (flags & 0x08) {
+                        position += 4;
+                    }
+
+                    samples = frames * header.samplesPerFrame;
+
+                    // LAME tag starts with encoder version, 12-bit encoder delay
+                    // and padding are stored at offset 21. FFmpeg writes it too
+                    if (frame.size() >= position + 24 &&
+                            (frame.containsAt("LAME", position) || frame.containsAt("Lavc", position) || frame.containsAt("Lavf", position))) {
+                        const unsigned char* lame = bytesAt(frame, position + 21);
+                        const int delay = (lame[0] << 4) | (lame[1] >> 4);
+                        const int padding = ((lame[1] & 0x0F) << 8) | lame[2];
+                        if (delay + padding < samples) {
+                            samples -= delay + padding;
+                        }
+                    }
+
+                    return frames > 0;
+                }
+
+                // VBRI header is always 32 bytes after frame header
+                const unsigned int vbriOffset = headerSize + 32;
+                if (frame.containsAt("VBRI", vbriOffset) && frame.size() >= vbriOffset + 18) {
+                    bytes = frame.toUInt(vbriOffset + 10);
+                    const long long frames = frame.toUInt(vbriOffset + 14);
+                    samples = frames * header.samplesPerFrame;
+                    return frames > 0;
+                }
+
+                return false;
+            }
+
+            int toInt(double value)
+            {
+                return static_cast<int>(std::lround(value));
+            }
+
+            // Bitrate in kilobits per second from size in bytes
+            int bitrate(long long bytes, double seconds)
+            {
+                return seconds > 0 ? toInt(bytes * 8 / seconds / 1000) : 0;
+            }
+        }
+
+        Duration read(TagLib::IOStream* stream, long long tagLength)
+        {
+            Duration result;
+
+            const long long start = audioStart(stream);
+            const long long end = audioEnd(stream, start);
+            long long firstOffset = 0;
+            FrameHeader first;
+            if (!findFrame(stream, start, end, firstOffset, first)) {
+                return result;
+            }
+            result.valid = true;
+            result.sampleRate = first.sampleRate;
+            result.channels = first.mono ? 1 : 2;
+
+            long long samples = 0;
+            long long bytes = 0;
+            if (readVbrHeader(stream, firstOffset, first, samples, bytes)) {
+                const double seconds = static_cast<double>(samples) / first.sampleRate;
+                result.duration = toInt(seconds);
+                result.bitrate = bitrate(bytes > 0 ? bytes : end - firstOffset, seconds);
+                result.exact = true;
+                return result;
+            }
+
+            if (tagLength > 0) {
+                const double seconds = tagLength / 1000.0;
+                result.duration = toInt(seconds);
+                result.bitrate = bitrate(end - firstOffset, seconds);
+                return result;
+            }
+
+            long long sampledBytes = 0;
+            int sampledFrames = 0;
+            bool constantBitrate = true;
+            for (int i = 0; i < sampledPositionsCount; ++i) {
+                long long offset = firstOffset;
+                FrameHeader header(first);
+                if (i > 0 && !findFrame(stream, firstOffset + (end - firstOffset) * i / sampledPositionsCount, end, offset, header)) {
+                    continue;
+                }
+                for (int j = 0; j < framesPerSample; ++j) {
+                    sampledBytes += header.frameSize;
+                    ++sampledFrames;
+                    if (header.bitrate != first.bitrate) {
+                        constantBitrate = false;
+                    }
+                    offset += header.frameSize;
+                    if (offset + headerSize > end ||
+                            !parseHeader(readAt(stream, offset, headerSize), 0, header) ||
+                            !isSameStream(first, header)) {
+                        break;
+                    }
+                }
+            }
+
+            const double frames = (end - firstOffset) / (static_cast<double>(sampledBytes) / sampledFrames);
+            const double seconds = frames * first.samplesPerFrame / first.sampleRate;
+            result.duration = toInt(seconds);
+            result.bitrate = constantBitrate ? first.bitrate : bitrate(end - firstOffset, seconds);
+            // If all sampled frames have the same bitrate, stream is CBR and extrapolation is exact
+            result.exact = constantBitrate;
+            return result;
+        }
+
+        Duration count(TagLib::IOStream* stream)
+        {
+            Duration result;
+
+            const long long start = audioStart(stream);
+            const long long end = audioEnd(stream, start);
+            long long offset = 0;
+            FrameHeader first;
+            if (!findFrame(stream, start, end, offset, first)) {
+                return result;
+            }
+            result.valid = true;
+            result.sampleRate = first.sampleRate;
+            result.channels = first.mono ? 1 : 2;
+
+            const long long firstOffset = offset;
+
+            // Frame with Xing or VBRI header doesn't contain audio
+            long long samples = 0;
+            long long bytes = 0;
+            if (readVbrHeader(stream, offset, first, samples, bytes)) {
+                offset += first.frameSize;
+            }
+
+            long long frames = 0;
+            FrameHeader header(first);
+            while (offset + headerSize <= end) {
+                if (parseHeader(readAt(stream, offset, headerSize), 0, header) && isSameStream(first, header)) {
+                    ++frames;
+                    offset += header.frameSize;
+                } else if (!findFrame(stream, offset + 1, end, offset, header)) {
+                    break;
+                }
+            }
+
+            const double seconds = static_cast<double>(frames * first.samplesPerFrame) / first.sampleRate;
+            result.duration = toInt(seconds);
+            result.bitrate = bitrate(end - firstOffset, seconds);
+            result.exact = true;
+            return result;
+        }
+    }
+}
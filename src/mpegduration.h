@@ -0,0 +1,59 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_MPEGDURATION_H
+#define UNPLAYER_MPEGDURATION_H
+
+namespace TagLib
+{
+    class IOStream;
+}
+
+namespace unplayer
+{
+    namespace mpegduration
+    {
+        struct Duration
+        {
+            // Seconds
+            int duration = 0;
+            // Kilobits per second
+            int bitrate = 0;
+            // Taken from the first frame
+            int sampleRate = 0;
+            int channels = 0;
+            // False if stream doesn't have MPEG audio frames
+            bool valid = false;
+            // False if duration was extrapolated from sampled frames or taken from TLEN frame
+            bool exact = false;
+        };
+
+        // Reads duration from Xing/Info (with LAME encoder delay and padding) or VBRI header
+        // of the first frame. If there is no such header, tagLength (milliseconds from
+        // ID3v2 TLEN frame, 0 if there is none) is used. Otherwise sizes of a few frames
+        // at the start, the middle and the end of stream are sampled and duration is extrapolated
+        // from stream size. Only a few kilobytes are read
+        Duration read(TagLib::IOStream* stream, long long tagLength);
+
+        // Counts all frames of stream, reads the whole file
+        Duration count(TagLib::IOStream* stream);
+    }
+}
+
+#endif // UNPLAYER_MPEGDURATION_H
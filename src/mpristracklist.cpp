@@ -0,0 +1,202 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mpristracklist.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include <QDBusMetaType>
+
+#include <Mpris>
+#include <MprisPlayer>
+
+#include "queue.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        // Tracks before current one in Tracks property
+        const int windowBefore = 50;
+        const int windowSize = 500;
+        const int maxMetadataTracks = 100;
+
+        const QDBusObjectPath noTrack(QLatin1String("/org/mpris/MediaPlayer2/TrackList/NoTrack"));
+    }
+
+    QVariantMap MprisTrackList::trackMetadata(const QueueTrack& track)
+    {
+        return {{Mpris::metadataToString(Mpris::TrackId), track.trackId},
+                {Mpris::metadataToString(Mpris::Title), track.title},
+                {Mpris::metadataToString(Mpris::Length), track.duration * 1000000LL},
+                {Mpris::metadataToString(Mpris::Artist), track.artist},
+                {Mpris::metadataToString(Mpris::Album), track.album}};
+    }
+
+    MprisTrackList::MprisTrackList(Queue* queue, MprisPlayer* mpris)
+        : QDBusAbstractAdaptor(mpris),
+          mQueue(queue),
+          mWindowFirst(0),
+          mTracksChanged(false)
+    {
+        qDBusRegisterMetaType<QList<QVariantMap>>();
+
+        mpris->setHasTrackList(true);
+
+        mReplaceTimer.setSingleShot(true);
+        mReplaceTimer.setInterval(0);
+        QObject::connect(&mReplaceTimer, &QTimer::timeout, this, &MprisTrackList::replace);
+
+        const auto tracksChanged = [=]() {
+            mTracksChanged = true;
+            scheduleReplace();
+        };
+        QObject::connect(mQueue, &Queue::tracksAdded, this, tracksChanged);
+        QObject::connect(mQueue, &Queue::tracksInserted, this, tracksChanged);
+        QObject::connect(mQueue, &Queue::tracksMoved, this, tracksChanged);
+        QObject::connect(mQueue, &Queue::tracksRemoved, this, tracksChanged);
+        QObject::connect(mQueue, &Queue::cleared, this, tracksChanged);
+
+        // Window follows current track
+        QObject::connect(mQueue, &Queue::currentIndexChanged, this, [=]() {
+            if (windowFirst() != mWindowFirst) {
+                scheduleReplace();
+            }
+        });
+
+        QObject::connect(mQueue, &Queue::trackChanged, this, [=](int index) {
+            if (mReplaceTimer.isActive()) {
+                return;
+            }
+            const int first = windowFirst();
+            if (index >= first && index < first + windowSize) {
+                const QueueTrack& track = *mQueue->tracks()[index];
+                emit TrackMetadataChanged(QDBusObjectPath(track.trackId), trackMetadata(track));
+            }
+        });
+    }
+
+    QList<QDBusObjectPath> MprisTrackList::tracks() const
+    {
+        const auto& tracks = mQueue->tracks();
+        const int first = windowFirst();
+        const int last = std::min(first + windowSize, static_cast<int>(tracks.size()));
+        QList<QDBusObjectPath> ids;
+        ids.reserve(last - first);
+        for (int i = first; i < last; ++i) {
+            ids.push_back(QDBusObjectPath(tracks[i]->trackId));
+        }
+        return ids;
+    }
+
+    bool MprisTrackList::canEditTracks() const
+    {
+        return false;
+    }
+
+    QList<QVariantMap> MprisTrackList::GetTracksMetadata(const QList<QDBusObjectPath>& trackIds) const
+    {
+        // Positions of requested tracks in result
+        std::unordered_map<QString, int> positions;
+        const int count = std::min(trackIds.size(), maxMetadataTracks);
+        positions.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            positions.insert({trackIds[i].path(), i});
+        }
+
+        std::vector<const QueueTrack*> found(count, nullptr);
+        std::size_t left = positions.size();
+        const auto& tracks = mQueue->tracks();
+        // Requested tracks are most likely in window
+        const int first = windowFirst();
+        for (std::size_t i = 0, max = tracks.size(); i < max && left > 0; ++i) {
+            const QueueTrack* track = tracks[(first + i) % max].get();
+            const auto position(positions.find(track->trackId));
+            if (position != positions.end()) {
+                found[position->second] = track;
+                positions.erase(position);
+                --left;
+            }
+        }
+
+        QList<QVariantMap> metadata;
+        metadata.reserve(count);
+        for (const QueueTrack* track : found) {
+            if (track) {
+                metadata.push_back(trackMetadata(*track));
+            }
+        }
+        return metadata;
+    }
+
+    void MprisTrackList::AddTrack(const QString&, const QDBusObjectPath&, bool)
+    {
+
+    }
+
+    void MprisTrackList::RemoveTrack(const QDBusObjectPath&)
+    {
+
+    }
+
+    void MprisTrackList::GoTo(const QDBusObjectPath& trackId)
+    {
+        const auto& tracks = mQueue->tracks();
+        const QString id(trackId.path());
+        const auto found(std::find_if(tracks.begin(), tracks.end(), [&id](const std::shared_ptr<QueueTrack>& track) {
+            return track->trackId == id;
+        }));
+        if (found == tracks.end()) {
+            return;
+        }
+        mQueue->setCurrentIndex(found - tracks.begin());
+        emit mQueue->currentTrackChanged();
+        if (mQueue->isShuffle()) {
+            mQueue->resetShuffleOrder();
+        }
+    }
+
+    int MprisTrackList::windowFirst() const
+    {
+        const int count = mQueue->tracks().size();
+        const int current = std::max(mQueue->currentIndex(), 0);
+        return std::max(std::min(current - windowBefore, count - windowSize), 0);
+    }
+
+    void MprisTrackList::scheduleReplace()
+    {
+        if (!mReplaceTimer.isActive()) {
+            mReplaceTimer.start();
+        }
+    }
+
+    void MprisTrackList::replace()
+    {
+        const int first = windowFirst();
+        if (!mTracksChanged && first == mWindowFirst) {
+            return;
+        }
+        mTracksChanged = false;
+        mWindowFirst = first;
+
+        const int current = mQueue->currentIndex();
+        emit TrackListReplaced(tracks(), current == -1 ? noTrack : QDBusObjectPath(mQueue->tracks()[current]->trackId));
+    }
+}
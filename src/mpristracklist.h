@@ -0,0 +1,80 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_MPRISTRACKLIST_H
+#define UNPLAYER_MPRISTRACKLIST_H
+
+#include <QDBusAbstractAdaptor>
+#include <QDBusObjectPath>
+#include <QList>
+#include <QTimer>
+#include <QVariantMap>
+
+class MprisPlayer;
+
+namespace unplayer
+{
+    class Queue;
+    struct QueueTrack;
+
+    // org.mpris.MediaPlayer2.TrackList interface, added to object of MprisPlayer.
+    // Tracks property lists only a window of queue around current track, and
+    // metadata is returned for limited number of tracks per call.
+    // Changes of queue are coalesced into one TrackListReplaced signal
+    // per event loop iteration, TrackAdded and TrackRemoved are not emitted
+    class MprisTrackList final : public QDBusAbstractAdaptor
+    {
+        Q_OBJECT
+        Q_CLASSINFO("D-Bus Interface", "org.mpris.MediaPlayer2.TrackList")
+        Q_PROPERTY(QList<QDBusObjectPath> Tracks READ tracks)
+        Q_PROPERTY(bool CanEditTracks READ canEditTracks)
+    public:
+        static QVariantMap trackMetadata(const QueueTrack& track);
+
+        explicit MprisTrackList(Queue* queue, MprisPlayer* mpris);
+
+        QList<QDBusObjectPath> tracks() const;
+        bool canEditTracks() const;
+
+    public slots:
+        QList<QVariantMap> GetTracksMetadata(const QList<QDBusObjectPath>& trackIds) const;
+        // Do nothing since CanEditTracks is false
+        void AddTrack(const QString& uri, const QDBusObjectPath& afterTrack, bool setAsCurrent);
+        void RemoveTrack(const QDBusObjectPath& trackId);
+        void GoTo(const QDBusObjectPath& trackId);
+
+    private:
+        int windowFirst() const;
+        void scheduleReplace();
+        void replace();
+
+        Queue* mQueue;
+        QTimer mReplaceTimer;
+        // Window that was last announced with TrackListReplaced
+        int mWindowFirst;
+        bool mTracksChanged;
+
+    signals:
+        void TrackListReplaced(const QList<QDBusObjectPath>& tracks, const QDBusObjectPath& currentTrack);
+        void TrackAdded(const QVariantMap& metadata, const QDBusObjectPath& afterTrack);
+        void TrackRemoved(const QDBusObjectPath& trackId);
+        void TrackMetadataChanged(const QDBusObjectPath& trackId, const QVariantMap& metadata);
+    };
+}
+
+#endif // UNPLAYER_MPRISTRACKLIST_H
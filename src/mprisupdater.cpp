@@ -0,0 +1,164 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mprisupdater.h"
+
+#include <cstdlib>
+
+#include <MprisPlayer>
+
+namespace unplayer
+{
+    namespace
+    {
+        const qint64 positionCommitInterval = 5000;
+        // Difference from extrapolated position after which position
+        // is committed immediately (seeking)
+        const qint64 positionJumpThreshold = 1500;
+    }
+
+    MprisUpdater::MprisUpdater(MprisPlayer* mpris, QObject* parent)
+        : QObject(parent),
+          mMpris(mpris),
+          mCanControlTrack(mpris->canPlay()),
+          mCanControlTrackChanged(false),
+          mMetadataChanged(false),
+          mPlaybackStatus(mpris->playbackStatus()),
+          mPlaybackStatusChanged(false),
+          mLoopStatus(mpris->loopStatus()),
+          mLoopStatusChanged(false),
+          mShuffle(mpris->shuffle()),
+          mShuffleChanged(false),
+          mPosition(0),
+          mCommittedPosition(0)
+    {
+        mCommitTimer.setSingleShot(true);
+        mCommitTimer.setInterval(0);
+        QObject::connect(&mCommitTimer, &QTimer::timeout, this, &MprisUpdater::commit);
+    }
+
+    void MprisUpdater::setCanControlTrack(bool can)
+    {
+        mCanControlTrack = can;
+        mCanControlTrackChanged = true;
+        scheduleCommit();
+    }
+
+    void MprisUpdater::setMetadata(const QVariantMap& metadata)
+    {
+        mMetadata = metadata;
+        mMetadataChanged = true;
+        scheduleCommit();
+    }
+
+    void MprisUpdater::setPlaybackStatus(Mpris::PlaybackStatus status)
+    {
+        mPlaybackStatus = status;
+        mPlaybackStatusChanged = true;
+        scheduleCommit();
+    }
+
+    void MprisUpdater::setLoopStatus(Mpris::LoopStatus status)
+    {
+        mLoopStatus = status;
+        mLoopStatusChanged = true;
+        scheduleCommit();
+    }
+
+    void MprisUpdater::setShuffle(bool shuffle)
+    {
+        mShuffle = shuffle;
+        mShuffleChanged = true;
+        scheduleCommit();
+    }
+
+    void MprisUpdater::setPosition(qint64 position)
+    {
+        mPosition = position;
+
+        if (!mPositionCommitTimer.isValid()) {
+            commitPosition();
+            return;
+        }
+
+        const qint64 elapsed = mPositionCommitTimer.elapsed();
+        const qint64 expected = mMpris->playbackStatus() == Mpris::Playing ? mCommittedPosition + elapsed
+                                                                           : mCommittedPosition;
+        if (elapsed >= positionCommitInterval || std::abs(position - expected) > positionJumpThreshold) {
+            commitPosition();
+        }
+    }
+
+    void MprisUpdater::scheduleCommit()
+    {
+        if (!mCommitTimer.isActive()) {
+            mCommitTimer.start();
+        }
+    }
+
+    void MprisUpdater::commit()
+    {
+        if (mCanControlTrackChanged) {
+            mCanControlTrackChanged = false;
+            if (mCanControlTrack != mMpris->canPlay()) {
+                mMpris->setCanPlay(mCanControlTrack);
+                mMpris->setCanPause(mCanControlTrack);
+                mMpris->setCanGoNext(mCanControlTrack);
+                mMpris->setCanGoPrevious(mCanControlTrack);
+                mMpris->setCanSeek(mCanControlTrack);
+            }
+        }
+
+        if (mMetadataChanged) {
+            mMetadataChanged = false;
+            if (mMetadata != mMpris->metadata()) {
+                mMpris->setMetadata(mMetadata);
+            }
+        }
+
+        if (mPlaybackStatusChanged) {
+            mPlaybackStatusChanged = false;
+            if (mPlaybackStatus != mMpris->playbackStatus()) {
+                // Clients extrapolate position from the moment status changes
+                commitPosition();
+                mMpris->setPlaybackStatus(mPlaybackStatus);
+            }
+        }
+
+        if (mLoopStatusChanged) {
+            mLoopStatusChanged = false;
+            if (mLoopStatus != mMpris->loopStatus()) {
+                mMpris->setLoopStatus(mLoopStatus);
+            }
+        }
+
+        if (mShuffleChanged) {
+            mShuffleChanged = false;
+            if (mShuffle != mMpris->shuffle()) {
+                mMpris->setShuffle(mShuffle);
+            }
+        }
+    }
+
+    void MprisUpdater::commitPosition()
+    {
+        mMpris->setPosition(mPosition * 1000);
+        mCommittedPosition = mPosition;
+        mPositionCommitTimer.start();
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_MPRISUPDATER_H
+#define UNPLAYER_MPRISUPDATER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+#include <QVariantMap>
+
+#include <Mpris>
+
+class MprisPlayer;
+
+namespace unplayer
+{
+    // Collects MPRIS property changes and applies them once per event loop
+    // iteration, so that intermediate states (e.g. when queue is replaced)
+    // and values that didn't change don't generate D-Bus signals.
+    // Position is updated only periodically or when it jumps, since
+    // clients extrapolate it from playback status
+    class MprisUpdater final : public QObject
+    {
+        Q_OBJECT
+    public:
+        explicit MprisUpdater(MprisPlayer* mpris, QObject* parent = nullptr);
+
+        // canPlay, canPause, canGoNext, canGoPrevious and canSeek
+        void setCanControlTrack(bool can);
+        void setMetadata(const QVariantMap& metadata);
+        void setPlaybackStatus(Mpris::PlaybackStatus status);
+        void setLoopStatus(Mpris::LoopStatus status);
+        void setShuffle(bool shuffle);
+
+        // In milliseconds
+        void setPosition(qint64 position);
+
+    private:
+        void scheduleCommit();
+        void commit();
+        void commitPosition();
+
+        MprisPlayer* mMpris;
+        QTimer mCommitTimer;
+
+        bool mCanControlTrack;
+        bool mCanControlTrackChanged;
+        QVariantMap mMetadata;
+        bool mMetadataChanged;
+        Mpris::PlaybackStatus mPlaybackStatus;
+        bool mPlaybackStatusChanged;
+        Mpris::LoopStatus mLoopStatus;
+        bool mLoopStatusChanged;
+        bool mShuffle;
+        bool mShuffleChanged;
+
+        qint64 mPosition;
+        qint64 mCommittedPosition;
+        QElapsedTimer mPositionCommitTimer;
+    };
+}
+
+#endif // UNPLAYER_MPRISUPDATER_H
@@ -0,0 +1,96 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "perfcounters.h"
+
+#include <QDBusConnection>
+#include <QDBusError>
+#include <QDebug>
+
+namespace unplayer
+{
+    namespace perfcounters
+    {
+        namespace
+        {
+            // Same order as Counter
+            const char* const names[CountersCount] = {
+                "filesScanned",
+                "tagLibOpens",
+                "sqlQueries",
+                "sqlQueriesTimeNs",
+                "sqlStatementCacheHits",
+                "sqlStatementCacheMisses",
+                "artCacheHits",
+                "artCacheMisses",
+                "directoryListingCacheHits",
+                "directoryListingCacheMisses",
+                "directoryMediaArtCacheHits",
+                "directoryMediaArtCacheMisses",
+                "trackCacheHits",
+                "trackCacheMisses",
+                "queueOperations",
+                "imageDecodes",
+                "imageDecodesTimeNs"
+            };
+        }
+
+        std::atomic<qint64> counters[CountersCount];
+
+        QVariantMap values()
+        {
+            QVariantMap values;
+            for (int i = 0; i < CountersCount; ++i) {
+                values.insert(QLatin1String(names[i]), counters[i].load(std::memory_order_relaxed));
+            }
+            return values;
+        }
+
+        void reset()
+        {
+            for (std::atomic<qint64>& counter : counters) {
+                counter.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    namespace
+    {
+        const QLatin1String objectPath("/org/equeim/unplayer/counters");
+    }
+
+    PerfCountersDBusService::PerfCountersDBusService(QObject* parent)
+        : QObject(parent)
+    {
+        if (!QDBusConnection::sessionBus().registerObject(objectPath, this, QDBusConnection::ExportAllSlots)) {
+            qWarning() << "failed to register performance counters D-Bus object" << QDBusConnection::sessionBus().lastError();
+        }
+    }
+
+    QVariantMap PerfCountersDBusService::counters() const
+    {
+        return perfcounters::values();
+    }
+
+    void PerfCountersDBusService::reset()
+    {
+        qDebug() << "resetting performance counters";
+        perfcounters::reset();
+    }
+}
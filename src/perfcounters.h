@@ -0,0 +1,85 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_PERFCOUNTERS_H
+#define UNPLAYER_PERFCOUNTERS_H
+
+#include <atomic>
+
+#include <QObject>
+#include <QVariantMap>
+
+namespace unplayer
+{
+    // Process-wide counters of hot paths, always enabled. Incrementing one is
+    // a relaxed atomic add, so they can be used in release builds on devices
+    namespace perfcounters
+    {
+        enum Counter
+        {
+            FilesScanned,
+            TagLibOpens,
+            SqlQueries,
+            // Nanoseconds
+            SqlQueriesTime,
+            SqlStatementCacheHits,
+            SqlStatementCacheMisses,
+            ArtCacheHits,
+            ArtCacheMisses,
+            DirectoryListingCacheHits,
+            DirectoryListingCacheMisses,
+            DirectoryMediaArtCacheHits,
+            DirectoryMediaArtCacheMisses,
+            TrackCacheHits,
+            TrackCacheMisses,
+            QueueOperations,
+            ImageDecodes,
+            // Nanoseconds
+            ImageDecodesTime,
+            CountersCount
+        };
+
+        extern std::atomic<qint64> counters[CountersCount];
+
+        inline void add(Counter counter, qint64 value = 1)
+        {
+            counters[counter].fetch_add(value, std::memory_order_relaxed);
+        }
+
+        // Counter names mapped to values
+        QVariantMap values();
+        void reset();
+    }
+
+    // org.equeim.unplayer.PerformanceCounters interface on /org/equeim/unplayer/counters,
+    // exported by both the app and library service
+    class PerfCountersDBusService final : public QObject
+    {
+        Q_OBJECT
+        Q_CLASSINFO("D-Bus Interface", "org.equeim.unplayer.PerformanceCounters")
+    public:
+        explicit PerfCountersDBusService(QObject* parent);
+
+    public slots:
+        QVariantMap counters() const;
+        void reset();
+    };
+}
+
+#endif // UNPLAYER_PERFCOUNTERS_H
@@ -18,14 +18,30 @@
 
 #include "player.h"
 
+#include <algorithm>
+#include <functional>
+#include <memory>
+
 #include <QCoreApplication>
 #include <QDebug>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QSqlDatabase>
+#include <QTimer>
 #include <QUrl>
 
 #include <MprisPlayer>
 
+#include "fileutils.h"
+#include "mpristracklist.h"
+#include "mprisupdater.h"
+#include "playstatistics.h"
 #include "queue.h"
+#include "scanthrottle.h"
 #include "settings.h"
+#include "threadpools.h"
+#include "trackcache.h"
+#include "utils.h"
 
 namespace unplayer
 {
@@ -33,6 +49,29 @@ namespace unplayer
     {
         Player* instancePointer = nullptr;
 
+        const int positionSaveInterval = 10000;
+
+        // Position notify intervals. Nobody sees position when display is off,
+        // it is only needed for prefetching next track then. MPRIS clients
+        // extrapolate it and are notified about seeking anyway
+        const int visiblePositionInterval = 1000;
+        const int displayOffPositionInterval = 10000;
+
+#ifdef UNPLAYER_GSTREAMER
+        // Audio sink buffer, bigger one lets CPU sleep longer when display is off
+        const int visibleSinkBufferTime = 200;
+        const int displayOffSinkBufferTime = 2000;
+#endif
+
+        // Next track is prefetched close to the end of current one, so that
+        // its pages are not evicted before they are needed. Short tracks are
+        // played for a while before that, so that prefetch doesn't compete
+        // with opening current track
+        const qint64 minimumPrefetchPosition = 5000;
+
+        // Previous restarts current track after this position
+        const qint64 previousRestartPosition = 3000;
+
         Mpris::LoopStatus loopStatus(Queue::RepeatMode mode) {
             switch (mode) {
             case Queue::NoRepeat:
@@ -78,16 +117,24 @@ namespace unplayer
         return mQueue;
     }
 
+    const LibraryAudioDetails& Player::audioDetails() const
+    {
+        return mAudioDetails;
+    }
+
+    void Player::previous()
+    {
+        if (state() != StoppedState && isSeekable() && position() > previousRestartPosition) {
+            setPosition(0);
+            return;
+        }
+        mQueue->previous();
+    }
+
     void Player::saveState() const
     {
-        QStringList tracks;
-        tracks.reserve(mQueue->tracks().size());
-        for (const auto& track : mQueue->tracks()) {
-            tracks.push_back(track->url.toString());
-        }
-        Settings::instance()->savePlayerState(tracks,
-                                              mQueue->currentIndex(),
-                                              mQueue->isShuffle(),
+        mQueue->saveSnapshot();
+        Settings::instance()->savePlayerState(mQueue->isShuffle(),
                                               mQueue->repeatMode(),
                                               position());
     }
@@ -97,11 +144,144 @@ namespace unplayer
         mRestoringState = true;
         mQueue->setShuffle(Settings::instance()->shuffle());
         mQueue->setRepeatMode(Settings::instance()->repeatMode());
-        mQueue->addTracksFromUrls(Settings::instance()->queueTracks(), true, Settings::instance()->queuePosition());
+        if (mQueue->restoreSnapshot()) {
+            Utils::reportStartupPhase("queue restored");
+        } else {
+            // Start journal
+            mQueue->saveSnapshot();
+            // Queue saved by older version
+            mQueue->addTracksFromUrls(Settings::instance()->queueTracks(), true, Settings::instance()->queuePosition());
+            if (mQueue->isAddingTracks()) {
+                auto connection = std::make_shared<QMetaObject::Connection>();
+                *connection = QObject::connect(mQueue, &Queue::addingTracksChanged, this, [=]() {
+                    if (!mQueue->isAddingTracks()) {
+                        Utils::reportStartupPhase("queue restored");
+                        QObject::disconnect(*connection);
+                    }
+                });
+            }
+        }
     }
 
+    void Player::prefetchNextTrack()
+    {
+        const Settings* settings = Settings::instance();
+        if (!settings->prefetchNextTrack()) {
+            return;
+        }
+
+        const qint64 duration = this->duration();
+        const qint64 position = this->position();
+        if (duration <= 0 ||
+                position < std::min(minimumPrefetchPosition, duration / 2) ||
+                duration - position > settings->prefetchTime() * 1000) {
+            return;
+        }
+
+        const int index = mQueue->nextIndexOnEos();
+        if (index == -1 || index == mQueue->currentIndex()) {
+            return;
+        }
+
+        const QString& filePath = mQueue->tracks()[index]->filePath;
+        if (filePath.isEmpty()) {
+            return;
+        }
+
+        if (filePath == mPrefetchedFilePath) {
+            return;
+        }
+        mPrefetchedFilePath = filePath;
+
+        // Local copy is opened instead if track is cached
+        const QString cachedFilePath(TrackCache::instance().cachedFilePath(filePath));
+        threadpools::run(threadpools::JobClass::Bulk, std::bind(fileutils::prefetchFile,
+                                                                cachedFilePath.isEmpty() ? filePath : cachedFilePath,
+                                                                static_cast<qint64>(settings->prefetchSize()) * 1024 * 1024));
+    }
+
+    void Player::loadAudioDetails(const QString& filePath)
+    {
+        if (filePath == mAudioDetailsFilePath) {
+            return;
+        }
+        mAudioDetailsFilePath = filePath;
+
+        if (mAudioDetails.bitrate != 0) {
+            mAudioDetails = LibraryAudioDetails();
+            emit audioDetailsChanged();
+        }
+
+        if (filePath.isEmpty() || !LibraryUtils::instance()->isDatabaseInitialized()) {
+            return;
+        }
+
+        auto future = threadpools::run(threadpools::JobClass::Interactive, [filePath]() {
+            LibraryAudioDetails details;
+            const QSqlDatabase db(LibraryUtils::readDatabase());
+            if (db.isOpen()) {
+                LibraryUtils::getAudioDetails(db, filePath, details);
+            }
+            return details;
+        });
+
+        using FutureWatcher = QFutureWatcher<LibraryAudioDetails>;
+        auto watcher = new FutureWatcher(this);
+        QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
+            watcher->deleteLater();
+            if (filePath == mAudioDetailsFilePath) {
+                mAudioDetails = watcher->result();
+                emit audioDetailsChanged();
+            }
+        });
+        watcher->setFuture(future);
+    }
+
+    void Player::cacheUpcomingTracks()
+    {
+        const Settings* settings = Settings::instance();
+        const qint64 maxSize = static_cast<qint64>(settings->trackCacheSize()) * 1024 * 1024;
+        if (maxSize == 0) {
+            return;
+        }
+
+        QStringList filePaths;
+        for (int index : mQueue->upcomingIndexes(settings->trackCacheTracksCount())) {
+            const QString& filePath = mQueue->tracks()[index]->filePath;
+            if (!filePath.isEmpty()) {
+                filePaths.push_back(filePath);
+            }
+        }
+        TrackCache::instance().cacheFiles(filePaths, maxSize);
+    }
+
+#ifdef UNPLAYER_GSTREAMER
+    void Player::updateNextMedia()
+    {
+        // Current track is queued again when it is repeated, so that short loops are gapless
+        const int index = mQueue->nextIndexOnEos();
+        if (index == -1) {
+            setNextMedia(QUrl());
+            return;
+        }
+        const QueueTrack* track = mQueue->tracks()[index].get();
+        if (track->isLocalFile()) {
+            const QString cachedFilePath(TrackCache::instance().cachedFilePath(track->filePath));
+            if (!cachedFilePath.isEmpty()) {
+                setNextMedia(QUrl::fromLocalFile(cachedFilePath));
+                return;
+            }
+            if (!QFileInfo(track->filePath).isReadable()) {
+                setNextMedia(QUrl());
+                return;
+            }
+        }
+        setNextMedia(track->url());
+    }
+#endif
+
     Player::Player(QObject* parent)
-        : QMediaPlayer(parent),
+        : PlayerEngine(parent),
           mQueue(new Queue(this)),
           mSettingNewTrack(false),
           mRestoringState(false)
@@ -111,13 +291,23 @@ namespace unplayer
         mpris->setCanControl(true);
 
         mpris->setLoopStatus(loopStatus(mQueue->repeatMode()));
+        mpris->setShuffle(mQueue->isShuffle());
+
+        auto mprisUpdater = new MprisUpdater(mpris, this);
+        new MprisTrackList(mQueue, mpris);
+
         QObject::connect(mQueue, &Queue::repeatModeChanged, this, [=]() {
-            mpris->setLoopStatus(loopStatus(mQueue->repeatMode()));
+            mprisUpdater->setLoopStatus(loopStatus(mQueue->repeatMode()));
         });
-
-        mpris->setShuffle(mQueue->isShuffle());
         QObject::connect(mQueue, &Queue::shuffleChanged, this, [=]() {
-            mpris->setShuffle(mQueue->isShuffle());
+            mprisUpdater->setShuffle(mQueue->isShuffle());
+        });
+
+        // Position is written to queue journal periodically while playing
+        auto positionTimer = new QTimer(this);
+        positionTimer->setInterval(positionSaveInterval);
+        QObject::connect(positionTimer, &QTimer::timeout, this, [=]() {
+            mQueue->writePlayerPosition(position());
         });
 
         QObject::connect(this, &Player::stateChanged, this, [=](State newState) {
@@ -125,6 +315,13 @@ namespace unplayer
                 return;
             }
 
+            if (newState == PlayingState) {
+                positionTimer->start();
+            } else {
+                positionTimer->stop();
+                mQueue->writePlayerPosition(position());
+            }
+
             static State oldState = StoppedState;
             if (newState != oldState) {
                 if (newState == PlayingState || oldState == PlayingState) {
@@ -134,19 +331,45 @@ namespace unplayer
 
                 switch (newState) {
                 case StoppedState:
-                    mpris->setPlaybackStatus(Mpris::Stopped);
+                    mprisUpdater->setPlaybackStatus(Mpris::Stopped);
                     break;
                 case PlayingState:
-                    mpris->setPlaybackStatus(Mpris::Playing);
+                    mprisUpdater->setPlaybackStatus(Mpris::Playing);
                     break;
                 case PausedState:
-                    mpris->setPlaybackStatus(Mpris::Paused);
+                    mprisUpdater->setPlaybackStatus(Mpris::Paused);
                 }
             }
         });
 
+        QObject::connect(this, &Player::playingChanged, this, [=]() {
+            ScanThrottle::instance()->setPlaybackActive(isPlaying());
+        });
+
+        const auto updateNotifyInterval = [=]() {
+            if (ScanThrottle::instance()->isDisplayOff()) {
+                setNotifyInterval(displayOffPositionInterval);
+#ifdef UNPLAYER_GSTREAMER
+                setSinkBufferTime(displayOffSinkBufferTime);
+#endif
+            } else {
+                setNotifyInterval(visiblePositionInterval);
+#ifdef UNPLAYER_GSTREAMER
+                setSinkBufferTime(visibleSinkBufferTime);
+#endif
+                // Position in UI may be stale by up to slow interval
+                emit positionChanged(position());
+            }
+        };
+        updateNotifyInterval();
+        QObject::connect(ScanThrottle::instance(), &ScanThrottle::displayOffChanged, this, updateNotifyInterval);
+
         QObject::connect(this, &Player::mediaStatusChanged, this, [=](MediaStatus status) {
             if (status == EndOfMedia) {
+                if (!mStatisticsFilePath.isEmpty()) {
+                    PlayStatistics::instance()->recordPlayed(mStatisticsFilePath);
+                    mStatisticsFilePath.clear();
+                }
                 mQueue->nextOnEos();
             } else if (status == InvalidMedia) {
                 qWarning() << error() << errorString();
@@ -154,50 +377,115 @@ namespace unplayer
         });
 
         QObject::connect(this, &Player::positionChanged, this, [=](qint64 position) {
-            mpris->setPosition(position * 1000);
+            mprisUpdater->setPosition(position);
+            // Queue order may have changed since last check, prefetchNextTrack()
+            // skips track that is already prefetched
+            if (state() == PlayingState) {
+                prefetchNextTrack();
+            }
         });
 
         QObject::connect(mQueue, &Queue::currentTrackChanged, this, [=]() {
+            // Track that is left before its end counts as played if half of it was played
+            if (!mStatisticsFilePath.isEmpty()) {
+                const qint64 duration = this->duration();
+                const qint64 position = this->position();
+                if (duration > 0 && position >= duration / 2) {
+                    PlayStatistics::instance()->recordPlayed(mStatisticsFilePath);
+                } else if (position > 0) {
+                    PlayStatistics::instance()->recordSkipped(mStatisticsFilePath);
+                }
+                mStatisticsFilePath.clear();
+            }
+
             if (mQueue->currentIndex() == -1) {
-                setMedia(QMediaContent());
-
-                mpris->setCanPlay(false);
-                mpris->setCanPause(false);
-                mpris->setCanGoNext(false);
-                mpris->setCanGoPrevious(false);
-                mpris->setCanSeek(false);
-                mpris->setMetadata(QVariantMap());
+                setMedia({});
+                mMediaTrackId.clear();
+                loadAudioDetails(QString());
+
+                mprisUpdater->setCanControlTrack(false);
+                mprisUpdater->setMetadata(QVariantMap());
             } else {
                 const QueueTrack* track = mQueue->tracks().at(mQueue->currentIndex()).get();
+                const QString cachedFilePath(track->isLocalFile() ? TrackCache::instance().cachedFilePath(track->filePath) : QString());
+
+                // Files are not checked when tracks are added to queue.
+                // Cached copy is played even if network is not available now
+                if (track->isLocalFile() && cachedFilePath.isEmpty() && !QFileInfo(track->filePath).isReadable()) {
+                    qWarning() << "file" << track->filePath << "is not readable, skipping";
+                    setMedia({});
+                    mMediaTrackId.clear();
+                    // Removed later to not change queue while it emits signals
+                    const QString trackId(track->trackId);
+                    QTimer::singleShot(0, mQueue, [=]() {
+                        mQueue->removeTrackWithId(trackId);
+                    });
+                    return;
+                }
 
-                mSettingNewTrack = true;
-                setMedia(track->url);
-                mSettingNewTrack = false;
+                if (track->trackId == mMediaTrackId && mediaStatus() != InvalidMedia) {
+                    // Same track is played again from loaded media instead of opening
+                    // file again. Playbin has already started it if it was queued
+                    // as next media, then it is still playing
+                    if (state() != PlayingState || mediaStatus() != EndOfMedia) {
+                        setPosition(0);
+                        play();
+                    }
+                } else {
+                    mSettingNewTrack = true;
+                    setMedia(cachedFilePath.isEmpty() ? track->url() : QUrl::fromLocalFile(cachedFilePath));
+                    mSettingNewTrack = false;
+                    mMediaTrackId = track->trackId;
+                }
+                if (track->isLocalFile()) {
+                    mStatisticsFilePath = track->filePath;
+                }
+                loadAudioDetails(track->filePath);
 
                 if (mRestoringState) {
-                    setPosition(Settings::instance()->playerPosition());
+                    // Position in journal is newer if application was not closed properly
+                    const long long position = mQueue->restoredPlayerPosition();
+                    setPosition(position >= 0 ? position : Settings::instance()->playerPosition());
                     mRestoringState = false;
-                } else {
+                } else if (state() != PlayingState) {
                     play();
                 }
 
-                mpris->setCanPlay(true);
-                mpris->setCanPause(true);
-                mpris->setCanGoNext(true);
-                mpris->setCanGoPrevious(true);
-                mpris->setCanSeek(true);
-                mpris->setMetadata({{Mpris::metadataToString(Mpris::TrackId), track->trackId},
-                                    {Mpris::metadataToString(Mpris::Title), track->title},
-                                    {Mpris::metadataToString(Mpris::Length), track->duration * 1000000LL},
-                                    {Mpris::metadataToString(Mpris::Artist), track->artist},
-                                    {Mpris::metadataToString(Mpris::Album), track->album}});
+                mprisUpdater->setCanControlTrack(true);
+                mprisUpdater->setMetadata(MprisTrackList::trackMetadata(*track));
             }
         });
 
+        // Started after current track is opened, so that copying doesn't compete with it
+        QObject::connect(mQueue, &Queue::currentTrackChanged, this, &Player::cacheUpcomingTracks);
+        for (const auto signal : {&Queue::shuffleChanged,
+                                  &Queue::repeatModeChanged,
+                                  &Queue::tracksAdded,
+                                  &Queue::tracksInserted,
+                                  &Queue::tracksMoved,
+                                  &Queue::tracksRemoved,
+                                  &Queue::cleared}) {
+            QObject::connect(mQueue, signal, this, &Player::cacheUpcomingTracks);
+        }
+
+#ifdef UNPLAYER_GSTREAMER
+        // Called after new track is set, so that it doesn't replace next media
+        QObject::connect(mQueue, &Queue::currentTrackChanged, this, &Player::updateNextMedia);
+        for (const auto signal : {&Queue::shuffleChanged,
+                                  &Queue::repeatModeChanged,
+                                  &Queue::tracksAdded,
+                                  &Queue::tracksInserted,
+                                  &Queue::tracksMoved,
+                                  &Queue::tracksRemoved,
+                                  &Queue::cleared}) {
+            QObject::connect(mQueue, signal, this, &Player::updateNextMedia);
+        }
+#endif
+
         QObject::connect(mpris, &MprisPlayer::playRequested, this, &Player::play);
         QObject::connect(mpris, &MprisPlayer::pauseRequested, this, &Player::pause);
         QObject::connect(mpris, &MprisPlayer::nextRequested, mQueue, &Queue::next);
-        QObject::connect(mpris, &MprisPlayer::previousRequested, mQueue, &Queue::previous);
+        QObject::connect(mpris, &MprisPlayer::previousRequested, this, &Player::previous);
         QObject::connect(mpris, &MprisPlayer::setPositionRequested, this, [=](const QDBusObjectPath& trackId, qint64 position) {
             if (state() != StoppedState &&
                     mQueue->currentIndex() != -1 &&
@@ -19,13 +19,25 @@
 #ifndef UNPLAYER_PLAYER_H
 #define UNPLAYER_PLAYER_H
 
+#ifdef UNPLAYER_GSTREAMER
+#include "gstplayer.h"
+#else
 #include <QMediaPlayer>
+#endif
+
+#include "libraryutils.h"
 
 namespace unplayer
 {
     class Queue;
 
-    class Player final : public QMediaPlayer
+#ifdef UNPLAYER_GSTREAMER
+    using PlayerEngine = GstPlayer;
+#else
+    using PlayerEngine = QMediaPlayer;
+#endif
+
+    class Player final : public PlayerEngine
     {
         Q_OBJECT
         Q_PROPERTY(bool playing READ isPlaying NOTIFY playingChanged)
@@ -36,19 +48,51 @@ namespace unplayer
         bool isPlaying() const;
         Queue* queue() const;
 
+        // Format and ReplayGain of current track stored by library scan. Loaded in background
+        // when track changes, default-constructed if track is not in library
+        const LibraryAudioDetails& audioDetails() const;
+
+        // Restarts current track if it has been playing for a few seconds,
+        // otherwise switches to previous track
+        Q_INVOKABLE void previous();
+
         Q_INVOKABLE void saveState() const;
         Q_INVOKABLE void restoreState();
 
     private:
         Player(QObject* parent);
 
+        // Makes next track cached by the system so that switching to it
+        // doesn't wait for storage. Called on position changes, does nothing
+        // until current track is close to its end
+        void prefetchNextTrack();
+        void loadAudioDetails(const QString& filePath);
+        // Copies upcoming tracks to TrackCache
+        void cacheUpcomingTracks();
+#ifdef UNPLAYER_GSTREAMER
+        // Gives track that will be played after current one to playbin
+        void updateNextMedia();
+#endif
+
         Queue* mQueue;
         bool mSettingNewTrack;
+        // Track that is set as media. When it becomes current again (repeat or
+        // previous in queue with one track) it is replayed from the beginning
+        QString mMediaTrackId;
 
         bool mRestoringState;
 
+        QString mPrefetchedFilePath;
+
+        // Current track, until it is recorded in PlayStatistics
+        QString mStatisticsFilePath;
+
+        LibraryAudioDetails mAudioDetails;
+        QString mAudioDetailsFilePath;
+
     signals:
         void playingChanged();
+        void audioDetailsChanged();
     };
 }
 
@@ -22,18 +22,32 @@
 #include <unordered_map>
 
 #include <QFileInfo>
+#include <QFutureInterface>
 #include <QFutureWatcher>
 #include <QSqlDatabase>
-#include <QSqlError>
-#include <QSqlQuery>
-#include <QtConcurrentRun>
 
+#include "batchesrunnable.h"
 #include "libraryutils.h"
 #include "playlistutils.h"
 #include "stdutils.h"
+#include "threadpools.h"
 
 namespace unplayer
 {
+    namespace
+    {
+        // First batch is small so that playlist is shown quickly
+        const std::size_t firstEntriesBatchSize = 100;
+        const std::size_t entriesBatchSize = 2000;
+        const std::size_t metadataBatchSize = 1000;
+
+        using PlaylistFutureInterface = QFutureInterface<PlaylistBatch>;
+        using PlaylistFutureWatcher = QFutureWatcher<PlaylistBatch>;
+
+        // Reports batches of entries and their metadata
+        using PlaylistRunnable = BatchesRunnable<PlaylistBatch>;
+    }
+
     QVariant PlaylistModel::data(const QModelIndex& index, int role) const
     {
         const PlaylistTrack& track = mTracks[index.row()];
@@ -87,23 +101,29 @@ namespace unplayer
     {
         mFilePath = filePath;
 
+        mLoad.cancel();
+
+        if (!mTracks.empty()) {
+            beginResetModel();
+            mTracks.clear();
+            endResetModel();
+        }
+
         if (mLoaded) {
             mLoaded = false;
             emit loadedChanged();
         }
 
-        auto future = QtConcurrent::run([filePath]() {
-            std::vector<PlaylistTrack> tracks(PlaylistUtils::parsePlaylist(filePath));
+        auto runnable = new PlaylistRunnable([filePath](PlaylistFutureInterface& futureInterface) {
+            std::vector<PlaylistTrack> tracks(PlaylistUtils::loadPlaylist(filePath));
 
-            std::vector<QString> tracksToQuery;
-            tracksToQuery.reserve(tracks.size());
-            std::unordered_map<QString, PlaylistTrack*> tracksMap;
-            tracksMap.reserve(tracks.size());
-            for (PlaylistTrack& track : tracks) {
+            // Entries are shown with file names until library is queried
+            std::vector<int> localTracks;
+            localTracks.reserve(tracks.size());
+            for (int i = 0, max = tracks.size(); i < max; ++i) {
+                PlaylistTrack& track = tracks[i];
                 if (track.url.isLocalFile()) {
-                    QString filePath(track.url.path());
-                    tracksToQuery.push_back(filePath);
-                    tracksMap.insert({std::move(filePath), &track});
+                    localTracks.push_back(i);
                 }
 
                 if (track.title.isEmpty()) {
@@ -115,105 +135,75 @@ namespace unplayer
                 }
             }
 
-            const QString dbConnectionName(QLatin1String("playlistmodel"));
+            std::size_t batchSize = firstEntriesBatchSize;
+            for (std::size_t i = 0, max = tracks.size(); i < max; i += batchSize, batchSize = entriesBatchSize) {
+                if (futureInterface.isCanceled()) {
+                    return;
+                }
+                const auto first(tracks.begin() + i);
+                futureInterface.reportResult(PlaylistBatch{true,
+                                                           {},
+                                                           std::vector<PlaylistTrack>(first, first + std::min(batchSize, max - i))});
+            }
+
+            // Tracks of smart playlists are loaded with their metadata
+            if (PlaylistUtils::isSmartPlaylist(filePath)) {
+                return;
+            }
 
-            {
-                auto db = QSqlDatabase::addDatabase(LibraryUtils::databaseType, dbConnectionName);
-                db.setDatabaseName(LibraryUtils::instance()->databaseFilePath());
-                if (!db.open()) {
-                    qWarning() << "failed to open database" << db.lastError();
+            const QSqlDatabase db(LibraryUtils::threadDatabase());
+            if (!db.isOpen()) {
+                return;
+            }
+
+            for (std::size_t i = 0, max = localTracks.size(); i < max; i += metadataBatchSize) {
+                if (futureInterface.isCanceled()) {
+                    return;
                 }
-                db.transaction();
-
-                const int maxParametersCount = 999;
-                for (int i = 0, max = tracksToQuery.size(); i < max; i += maxParametersCount) {
-                    const int count = [&]() -> int {
-                        const int left = max - i;
-                        if (left > maxParametersCount) {
-                            return maxParametersCount;
-                        }
-                        return left;
-                    }();
-
-                    QString queryString(QLatin1String("SELECT filePath, title, artist, album, duration FROM tracks WHERE filePath IN (?"));
-                    queryString.reserve(queryString.size() + (count - 1) * 2 + 1);
-                    for (int j = 1; j < count; ++j) {
-                        queryString.push_back(QStringLiteral(",?"));
-                    }
-                    queryString.push_back(QLatin1Char(')'));
 
-                    QSqlQuery query(db);
-                    query.prepare(queryString);
-                    for (int j = i, max = i + count; j < max; ++j) {
-                        query.addBindValue(tracksToQuery[j]);
-                    }
+                const std::size_t count = std::min(metadataBatchSize, max - i);
+                std::vector<QString> filePaths;
+                filePaths.reserve(count);
+                for (std::size_t j = i; j < i + count; ++j) {
+                    filePaths.push_back(tracks[localTracks[j]].url.path());
+                }
 
-                    if (query.exec()) {
-                        QString previousFilePath;
-                        QString title;
-                        QStringList artists;
-                        QStringList albums;
-                        int duration;
-
-                        const auto tracksMapEnd(tracksMap.end());
-                        const auto fill = [&]() {
-                            const auto found(tracksMap.find(previousFilePath));
-                            if (found != tracksMapEnd) {
-                                PlaylistTrack* track = found->second;
-                                track->title = std::move(title);
-                                artists.removeDuplicates();
-                                track->artist = artists.join(QStringLiteral(", "));
-                                albums.removeDuplicates();
-                                track->album = albums.join(QStringLiteral(", "));
-                                track->duration = duration;
-                            }
-                        };
-
-
-                        while (query.next()) {
-                            QString filePath(query.value(0).toString());
-
-                            if (filePath != previousFilePath) {
-                                if (!previousFilePath.isEmpty()) {
-                                    fill();
-                                }
-
-                                title = query.value(1).toString();
-                                artists.clear();
-                                albums.clear();
-                                duration = query.value(4).toInt();
-                            }
-
-                            artists.push_back(query.value(2).toString());
-                            albums.push_back(query.value(3).toString());
-
-                            previousFilePath = std::move(filePath);
-                        }
-
-                        if (query.previous()) {
-                            fill();
-                        }
+                const std::unordered_map<QString, LibraryTrackMetadata> metadata(LibraryUtils::getTracksMetadata(db, filePaths));
+                PlaylistBatch batch{false, {}, {}};
+                const auto end(metadata.end());
+                for (std::size_t j = i; j < i + count; ++j) {
+                    const int index = localTracks[j];
+                    const auto found(metadata.find(filePaths[j - i]));
+                    if (found != end) {
+                        const LibraryTrackMetadata& libraryTrack = found->second;
+                        PlaylistTrack track(tracks[index]);
+                        track.title = libraryTrack.title;
+                        track.artist = libraryTrack.artist;
+                        track.album = libraryTrack.album;
+                        track.duration = libraryTrack.duration;
+                        batch.indexes.push_back(index);
+                        batch.tracks.push_back(std::move(track));
                     }
                 }
-
-                db.commit();
+                futureInterface.reportResult(std::move(batch));
             }
-            QSqlDatabase::removeDatabase(dbConnectionName);
-
-            return tracks;
         });
 
-        using FutureWatcher = QFutureWatcher<std::vector<PlaylistTrack>>;
-        auto watcher = new FutureWatcher(this);
-        QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
-            auto tracks(watcher->result());
-            beginInsertRows(QModelIndex(), 0, tracks.size() - 1);
-            mTracks = std::move(tracks);
-            endInsertRows();
-            mLoaded = true;
-            emit loadedChanged();
+        auto watcher = new PlaylistFutureWatcher(this);
+        const int generation = mLoad.start(watcher);
+        QObject::connect(watcher, &PlaylistFutureWatcher::resultsReadyAt, this, [=](int beginIndex, int endIndex) {
+            for (int i = beginIndex; i < endIndex; ++i) {
+                addBatch(watcher->resultAt(i));
+            }
+        });
+        QObject::connect(watcher, &PlaylistFutureWatcher::finished, this, [=]() {
+            setLoaded();
+            mLoad.finish(generation);
+            watcher->deleteLater();
         });
-        watcher->setFuture(future);
+        watcher->setFuture(runnable->future());
+
+        threadpools::start(threadpools::JobClass::Interactive, runnable);
     }
 
     QStringList PlaylistModel::getTracks(const std::vector<int>& indexes)
@@ -226,8 +216,57 @@ namespace unplayer
         return tracks;
     }
 
+    void PlaylistModel::addBatch(const PlaylistBatch& batch)
+    {
+        if (batch.entries) {
+            beginInsertRows(QModelIndex(), mTracks.size(), mTracks.size() + batch.tracks.size() - 1);
+            mTracks.insert(mTracks.end(), batch.tracks.begin(), batch.tracks.end());
+            endInsertRows();
+            return;
+        }
+
+        // All entries are reported before metadata
+        setLoaded();
+
+        int first = -1;
+        int last = -1;
+        for (std::size_t i = 0, max = batch.indexes.size(); i < max; ++i) {
+            const int index = batch.indexes[i];
+            // Tracks may have been removed while metadata was loaded
+            if (index >= static_cast<int>(mTracks.size()) || mTracks[index].url != batch.tracks[i].url) {
+                continue;
+            }
+            mTracks[index] = batch.tracks[i];
+            if (first == -1) {
+                first = index;
+            }
+            last = index;
+        }
+        if (first != -1) {
+            emit dataChanged(this->index(first), this->index(last));
+        }
+    }
+
+    void PlaylistModel::setLoaded()
+    {
+        if (!mLoaded) {
+            mLoaded = true;
+            emit loadedChanged();
+        }
+    }
+
     void PlaylistModel::removeTrack(int index)
     {
+        // Tracks of smart playlists are selected by its rules
+        if (PlaylistUtils::isSmartPlaylist(mFilePath)) {
+            return;
+        }
+
+        // Playlist would be saved without entries that are not loaded yet
+        if (!mLoaded) {
+            return;
+        }
+
         beginRemoveRows(QModelIndex(), index, index);
         mTracks.erase(mTracks.begin() + index);
         endRemoveRows();
@@ -236,6 +275,15 @@ namespace unplayer
 
     void PlaylistModel::removeTracks(std::vector<int> indexes)
     {
+        // Tracks of smart playlists are selected by its rules
+        if (PlaylistUtils::isSmartPlaylist(mFilePath)) {
+            return;
+        }
+
+        if (!mLoaded) {
+            return;
+        }
+
         std::sort(indexes.begin(), indexes.end(), std::greater<int>());
         for (int index : indexes) {
             beginRemoveRows(QModelIndex(), index, index);
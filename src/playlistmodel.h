@@ -22,10 +22,20 @@
 #include <vector>
 #include <QAbstractListModel>
 
+#include "latestload.h"
 #include "playlistutils.h"
 
 namespace unplayer
 {
+    // Batch of playlist entries or of metadata of entries loaded from library
+    struct PlaylistBatch
+    {
+        bool entries;
+        // Indexes of tracks which metadata was loaded
+        std::vector<int> indexes;
+        std::vector<PlaylistTrack> tracks;
+    };
+
     class PlaylistModel : public QAbstractListModel
     {
         Q_OBJECT
@@ -59,9 +69,13 @@ namespace unplayer
         QHash<int, QByteArray> roleNames() const override;
 
     private:
+        void addBatch(const PlaylistBatch& batch);
+        void setLoaded();
+
         bool mLoaded = false;
         std::vector<PlaylistTrack> mTracks;
         QString mFilePath;
+        LatestLoad mLoad{this};
 
     signals:
         void loadedChanged();
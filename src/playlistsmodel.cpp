@@ -18,16 +18,117 @@
 
 #include "playlistsmodel.h"
 
+#include <algorithm>
+#include <unordered_map>
+
+#include <QDateTime>
+#include <QDebug>
 #include <QDir>
 #include <QFileInfo>
 #include <QFutureWatcher>
-#include <QtConcurrentRun>
+#include <QSqlDatabase>
+#include <QSqlError>
 
+#include "libraryutils.h"
 #include "playlistutils.h"
+#include "playstatistics.h"
+#include "smartplaylists.h"
+#include "sqlquery.h"
 #include "stdutils.h"
+#include "threadpools.h"
 
 namespace unplayer
 {
+    namespace
+    {
+        struct CachedPlaylist
+        {
+            long long modificationTime;
+            qint64 size;
+            int tracksCount;
+            // Playlist file still exists
+            bool used;
+        };
+
+        std::unordered_map<QString, CachedPlaylist> loadCachedPlaylists(const QSqlDatabase& db)
+        {
+            std::unordered_map<QString, CachedPlaylist> playlists;
+            if (!db.isOpen()) {
+                return playlists;
+            }
+
+            SqlQuery query(db);
+            query.setForwardOnly(true);
+            if (query.exec(QLatin1String("SELECT filePath, modificationTime, size, tracksCount FROM playlists"))) {
+                while (query.next()) {
+                    playlists.insert({query.value(0).toString(),
+                                      CachedPlaylist{query.value(1).toLongLong(),
+                                                     query.value(2).toLongLong(),
+                                                     query.value(3).toInt(),
+                                                     false}});
+                }
+            } else {
+                qWarning() << "failed to get cached playlists" << query.lastError();
+            }
+            return playlists;
+        }
+
+        // Removes indexes of playlists which files were removed
+        void removeUnusedPlaylists(QSqlDatabase& db, const std::unordered_map<QString, CachedPlaylist>& playlists)
+        {
+            if (!db.isOpen()) {
+                return;
+            }
+
+            db.transaction();
+
+            // Entries are removed by trigger
+            SqlQuery query(db);
+            query.prepare(QLatin1String("DELETE FROM playlists WHERE filePath = ?"));
+            for (const auto& playlist : playlists) {
+                if (!playlist.second.used) {
+                    query.bindValue(0, playlist.first);
+                    if (!query.exec()) {
+                        qWarning() << "failed to remove cached playlist" << query.lastError();
+                    }
+                }
+            }
+
+            db.commit();
+        }
+
+        // Returns -1 if playlist file doesn't exist
+        int indexedTracksCount(const QSqlDatabase& db, const QFileInfo& fileInfo)
+        {
+            if (!fileInfo.exists()) {
+                if (db.isOpen()) {
+                    SqlQuery query(db);
+                    query.prepare(QLatin1String("DELETE FROM playlists WHERE filePath = ?"));
+                    query.addBindValue(fileInfo.filePath());
+                    if (!query.exec()) {
+                        qWarning() << "failed to remove cached playlist" << query.lastError();
+                    }
+                }
+                return -1;
+            }
+
+            if (!db.isOpen()) {
+                return PlaylistUtils::getPlaylistTracksCount(fileInfo.filePath());
+            }
+
+            SqlQuery query(db);
+            query.prepare(QLatin1String("SELECT modificationTime, size, tracksCount FROM playlists WHERE filePath = ?"));
+            query.addBindValue(fileInfo.filePath());
+            if (query.exec() && query.next() &&
+                    query.value(0).toLongLong() == fileInfo.lastModified().toMSecsSinceEpoch() &&
+                    query.value(1).toLongLong() == fileInfo.size()) {
+                return query.value(2).toInt();
+            }
+            query.finish();
+            return PlaylistUtils::indexPlaylist(db, fileInfo);
+        }
+    }
+
     bool PlaylistsModelItem::operator==(const PlaylistsModelItem& other) const
     {
         return (other.filePath == filePath);
@@ -37,6 +138,10 @@ namespace unplayer
     {
         update();
         QObject::connect(PlaylistUtils::instance(), &PlaylistUtils::playlistsChanged, this, &PlaylistsModel::update);
+        QObject::connect(PlaylistUtils::instance(), &PlaylistUtils::playlistChanged, this, &PlaylistsModel::updatePlaylist);
+        // Tracks counts of smart playlists
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::databaseChanged, this, &PlaylistsModel::update);
+        QObject::connect(PlayStatistics::instance(), &PlayStatistics::statisticsChanged, this, &PlaylistsModel::update);
     }
 
     QVariant PlaylistsModel::data(const QModelIndex& index, int role) const
@@ -87,16 +192,54 @@ namespace unplayer
 
     void PlaylistsModel::update()
     {
-        auto future = QtConcurrent::run([]() {
+        auto future = threadpools::run(threadpools::JobClass::Interactive, []() {
             std::vector<PlaylistsModelItem> playlists;
             const QList<QFileInfo> files(QDir(PlaylistUtils::instance()->playlistsDirectoryPath())
                                          .entryInfoList(PlaylistUtils::playlistsNameFilters, QDir::Files));
+
+            auto db = LibraryUtils::threadDatabase();
+            std::unordered_map<QString, CachedPlaylist> cached(loadCachedPlaylists(db));
+
             playlists.reserve(files.size());
             for (const QFileInfo& fileInfo : files) {
+                int tracksCount;
+                const auto found(cached.find(fileInfo.filePath()));
+                if (found != cached.end() &&
+                        found->second.modificationTime == fileInfo.lastModified().toMSecsSinceEpoch() &&
+                        found->second.size == fileInfo.size()) {
+                    tracksCount = found->second.tracksCount;
+                    found->second.used = true;
+                } else {
+                    if (db.isOpen()) {
+                        tracksCount = PlaylistUtils::indexPlaylist(db, fileInfo);
+                    } else {
+                        tracksCount = PlaylistUtils::getPlaylistTracksCount(fileInfo.filePath());
+                    }
+                    if (found != cached.end()) {
+                        found->second.used = true;
+                    }
+                }
+
                 playlists.push_back(PlaylistsModelItem{fileInfo.filePath(),
                                                        fileInfo.completeBaseName(),
-                                                       PlaylistUtils::getPlaylistTracksCount(fileInfo.filePath())});
+                                                       tracksCount});
+            }
+
+            const bool hasUnused = std::any_of(cached.begin(), cached.end(), [](const std::pair<const QString, CachedPlaylist>& playlist) {
+                return !playlist.second.used;
+            });
+            if (hasUnused) {
+                removeUnusedPlaylists(db, cached);
+            }
+
+            if (db.isOpen()) {
+                for (smartplaylists::Playlist& playlist : smartplaylists::playlists(db)) {
+                    playlists.push_back(PlaylistsModelItem{std::move(playlist.filePath),
+                                                           std::move(playlist.name),
+                                                           playlist.tracksCount});
+                }
             }
+
             return playlists;
         });
 
@@ -130,4 +273,37 @@ namespace unplayer
         });
         watcher->setFuture(future);
     }
+
+    void PlaylistsModel::updatePlaylist(const QString& filePath)
+    {
+        auto future = threadpools::run(threadpools::JobClass::Interactive, [filePath]() {
+            return indexedTracksCount(LibraryUtils::threadDatabase(), QFileInfo(filePath));
+        });
+
+        auto watcher = new QFutureWatcher<int>(this);
+        QObject::connect(watcher, &QFutureWatcher<int>::finished, this, [=]() {
+            const int tracksCount = watcher->result();
+            watcher->deleteLater();
+
+            const auto found(std::find_if(mPlaylists.begin(), mPlaylists.end(), [&](const PlaylistsModelItem& playlist) {
+                return playlist.filePath == filePath;
+            }));
+            const int row = found - mPlaylists.begin();
+            if (tracksCount == -1) {
+                if (found != mPlaylists.end()) {
+                    beginRemoveRows(QModelIndex(), row, row);
+                    mPlaylists.erase(found);
+                    endRemoveRows();
+                }
+            } else if (found == mPlaylists.end()) {
+                beginInsertRows(QModelIndex(), row, row);
+                mPlaylists.push_back(PlaylistsModelItem{filePath, QFileInfo(filePath).completeBaseName(), tracksCount});
+                endInsertRows();
+            } else {
+                found->tracksCount = tracksCount;
+                emit dataChanged(index(row), index(row), {TracksCountRole});
+            }
+        });
+        watcher->setFuture(future);
+    }
 }
@@ -58,6 +58,8 @@ namespace unplayer
 
     private:
         void update();
+        // Updates, adds or removes row of playlist file
+        void updatePlaylist(const QString& filePath);
 
         std::vector<PlaylistsModelItem> mPlaylists;
     };
@@ -19,23 +19,36 @@
 #include "playlistutils.h"
 
 #include <algorithm>
+#include <cstring>
+#include <functional>
 #include <iterator>
+#include <limits>
+#include <unordered_map>
 
 #include <QCoreApplication>
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QFutureWatcher>
 #include <QRegularExpression>
+#include <QSaveFile>
 #include <QSqlDatabase>
-#include <QSqlQuery>
 #include <QSqlError>
 #include <QStandardPaths>
 #include <QStringBuilder>
 #include <QTextStream>
 #include <QUrl>
 
+#include "jobmanager.h"
+#include "libraryreplica.h"
 #include "libraryutils.h"
+#include "smartplaylists.h"
+#include "sqlquery.h"
+#include "threadpools.h"
+#include "tracing.h"
+#include "unicode.h"
 
 namespace unplayer
 {
@@ -52,7 +65,7 @@ namespace unplayer
 
         const QLatin1String plsExtension("pls");
 
-        const std::unordered_set<QString> m3uExtensions{QLatin1String("m3u"),
+        const FlatHashSet<QString> m3uExtensions{QLatin1String("m3u"),
                                                         QLatin1String("m3u8"),
                                                         QLatin1String("vlc")};
 
@@ -88,98 +101,270 @@ namespace unplayer
             }
         }
 
-        namespace pls
+        // Slice of mapped playlist file
+        struct Line
         {
-            void parse(std::vector<PlaylistTrack>& tracks, QTextStream& stream, const QString& filePath, QDir& playlistFileDir)
+            const char* data;
+            int size;
+
+            bool isEmpty() const
+            {
+                return size == 0;
+            }
+
+            bool startsWith(const QLatin1String& prefix) const
+            {
+                return size >= prefix.size() && std::memcmp(data, prefix.data(), prefix.size()) == 0;
+            }
+
+            bool startsWith(char c) const
             {
-                const QString firstNotEmpty([&stream]() {
-                    while (!stream.atEnd()) {
-                        const QString line(stream.readLine().trimmed());
-                        if (!line.isEmpty() && !line.startsWith(QLatin1Char(';')) && !line.startsWith(QLatin1Char('#'))) {
-                            return line;
+                return size > 0 && *data == c;
+            }
+
+            bool operator==(const QLatin1String& string) const
+            {
+                return size == string.size() && std::memcmp(data, string.data(), size) == 0;
+            }
+
+            int indexOf(char c, int from = 0) const
+            {
+                if (from >= size) {
+                    return -1;
+                }
+                const auto found = static_cast<const char*>(std::memchr(data + from, c, size - from));
+                return found ? static_cast<int>(found - data) : -1;
+            }
+
+            Line mid(int position, int length = -1) const
+            {
+                if (length < 0 || position + length > size) {
+                    length = size - position;
+                }
+                return Line{data + position, length}.trimmed();
+            }
+
+            Line trimmed() const
+            {
+                const char* begin = data;
+                const char* end = data + size;
+                while (begin < end && isSpace(*begin)) {
+                    ++begin;
+                }
+                while (end > begin && isSpace(*(end - 1))) {
+                    --end;
+                }
+                return {begin, static_cast<int>(end - begin)};
+            }
+
+            int toInt(bool* ok = nullptr) const
+            {
+                const char* position = data;
+                const char* end = data + size;
+                const bool negative = (position < end && *position == '-');
+                if (negative || (position < end && *position == '+')) {
+                    ++position;
+                }
+                if (position == end) {
+                    if (ok) {
+                        *ok = false;
+                    }
+                    return 0;
+                }
+                // Magnitude of INT_MIN is greater than INT_MAX by one
+                const long long limit = static_cast<long long>(std::numeric_limits<int>::max()) + (negative ? 1 : 0);
+                long long number = 0;
+                for (; position < end; ++position) {
+                    if (*position >= '0' && *position <= '9') {
+                        number = number * 10 + (*position - '0');
+                    }
+                    if (*position < '0' || *position > '9' || number > limit) {
+                        if (ok) {
+                            *ok = false;
                         }
+                        return 0;
                     }
-                    return QString();
-                }());
+                }
+                if (ok) {
+                    *ok = true;
+                }
+                return static_cast<int>(negative ? -number : number);
+            }
 
-                if (firstNotEmpty != QLatin1String("[playlist]")) {
-                    qWarning() << filePath << "is not a PLS playlist";
+            QString toString() const
+            {
+                return unicode::fromUtf8(data, size);
+            }
+
+            static bool isSpace(char c)
+            {
+                return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+            }
+        };
+
+        // Reads lines of UTF-8 playlist file without creating strings for them.
+        // File is mapped to memory, or read at once if it can't be mapped
+        class PlaylistFile
+        {
+        public:
+            explicit PlaylistFile(const QString& filePath)
+                : mFile(filePath),
+                  mPosition(nullptr),
+                  mEnd(nullptr)
+            {
+                if (!mFile.open(QIODevice::ReadOnly)) {
+                    qWarning() << "error opening playlist file:" << filePath << mFile.error() << mFile.errorString();
                     return;
                 }
 
-                enum class Key
+                const qint64 size = mFile.size();
+                if (size > 0) {
+                    if (const uchar* data = mFile.map(0, size)) {
+                        mPosition = reinterpret_cast<const char*>(data);
+                        mEnd = mPosition + size;
+                    } else {
+                        mData = mFile.readAll();
+                        mPosition = mData.constData();
+                        mEnd = mPosition + mData.size();
+                    }
+                }
+
+                // Skip UTF-8 BOM
+                if (mEnd - mPosition >= 3 && std::memcmp(mPosition, "\xEF\xBB\xBF", 3) == 0) {
+                    mPosition += 3;
+                }
+            }
+
+            bool isOpen() const
+            {
+                return mFile.isOpen();
+            }
+
+            // Returns trimmed line, or false if there are no more lines
+            bool readLine(Line& line)
+            {
+                if (mPosition >= mEnd) {
+                    return false;
+                }
+                const auto newline = static_cast<const char*>(std::memchr(mPosition, '\n', mEnd - mPosition));
+                const char* lineEnd = newline ? newline : mEnd;
+                line = Line{mPosition, static_cast<int>(lineEnd - mPosition)}.trimmed();
+                mPosition = newline ? newline + 1 : mEnd;
+                return true;
+            }
+
+        private:
+            QFile mFile;
+            QByteArray mData;
+            const char* mPosition;
+            const char* mEnd;
+        };
+
+        namespace pls
+        {
+            const QLatin1String fileKey("File");
+            const QLatin1String titleKey("Title");
+            const QLatin1String lengthKey("Length");
+
+            // Parses number of key in "<key><number>=<value>" line, returns index of '=' or -1
+            int parseKeyNumber(const Line& line, const QLatin1String& key, int& number)
+            {
+                if (!line.startsWith(key)) {
+                    return -1;
+                }
+                const int equalsIndex = line.indexOf('=', key.size());
+                if (equalsIndex == -1) {
+                    return -1;
+                }
+                bool ok;
+                number = line.mid(key.size(), equalsIndex - key.size()).toInt(&ok);
+                return ok ? equalsIndex : -1;
+            }
+
+            // Entries can be in any order, their numbers define order of tracks
+            template<typename T>
+            class Entries
+            {
+            public:
+                explicit Entries(const T& initial)
+                    : mInitial(initial),
+                      mSorted(true)
                 {
-                    File,
-                    Title,
-                    Length,
-                    Unknown
-                };
 
-                std::map<int, PlaylistTrack> tracksMap;
+                }
 
-                while (!stream.atEnd()) {
-                    const QString line(stream.readLine().trimmed());
+                T& entry(int number)
+                {
+                    if (!mEntries.empty() && mEntries.back().first == number) {
+                        return mEntries.back().second;
+                    }
+                    const auto found(mIndexes.find(number));
+                    if (found != mIndexes.end()) {
+                        return mEntries[found->second].second;
+                    }
+                    if (!mEntries.empty() && number < mEntries.back().first) {
+                        mSorted = false;
+                    }
+                    mIndexes.insert({number, mEntries.size()});
+                    mEntries.emplace_back(number, mInitial);
+                    return mEntries.back().second;
+                }
 
-                    const Key keyType = [&line] {
-                        if (line.startsWith(QStringLiteral("File"))) {
-                            return Key::File;
-                        }
-                        if (line.startsWith(QStringLiteral("Title"))) {
-                            return Key::Title;
-                        }
-                        if (line.startsWith(QStringLiteral("Length"))) {
-                            return Key::Length;
-                        }
-                        return Key::Unknown;
-                    }();
-
-                    if (keyType != Key::Unknown) {
-                        const int numberIndex = [&keyType]() {
-                            switch (keyType) {
-                            case Key::File:
-                                return 4;
-                            case Key::Title:
-                                return 5;
-                            case Key::Length:
-                                return 6;
-                            default:
-                                return 0;
-                            }
-                        }();
-                        const int equalsIndex = line.indexOf(QLatin1Char('='));
-                        if (equalsIndex != -1) {
-                            bool ok;
-                            const int number = line.midRef(numberIndex, equalsIndex - numberIndex).toInt(&ok);
-
-                            if (ok) {
-                                PlaylistTrack& track = [&number, &tracksMap]() {
-                                    const auto found(tracksMap.find(number));
-                                    if (found == tracksMap.end()) {
-                                        PlaylistTrack track;
-                                        track.duration = -1;
-                                        return tracksMap.insert({number, std::move(track)}).first;
-                                    }
-                                    return found;
-                                }()->second;
-
-                                const QStringRef value(line.midRef(equalsIndex + 1).trimmed());
-                                switch (keyType) {
-                                case Key::File:
-                                    track.url = urlFromString(value.toString(), playlistFileDir);
-                                    break;
-                                case Key::Title:
-                                    track.title = value.toString();
-                                    break;
-                                case Key::Length:
-                                    track.duration = value.toInt();
-                                    break;
-                                }
-                            }
-                        }
+                std::vector<std::pair<int, T>>& sorted()
+                {
+                    if (!mSorted) {
+                        std::sort(mEntries.begin(), mEntries.end(), [](const std::pair<int, T>& first, const std::pair<int, T>& second) {
+                            return first.first < second.first;
+                        });
+                        mSorted = true;
                     }
+                    return mEntries;
+                }
+
+                std::size_t size() const
+                {
+                    return mEntries.size();
                 }
-                tracks.reserve(tracksMap.size());
-                for (auto& i : tracksMap) {
+
+            private:
+                const T mInitial;
+                std::vector<std::pair<int, T>> mEntries;
+                FlatHashMap<int, std::size_t> mIndexes;
+                bool mSorted;
+            };
+
+            void parse(std::vector<PlaylistTrack>& tracks, PlaylistFile& file, const QString& filePath, const QDir& playlistFileDir)
+            {
+                Line line;
+                bool isPlaylist = false;
+                while (file.readLine(line)) {
+                    if (!line.isEmpty() && !line.startsWith(';') && !line.startsWith('#')) {
+                        isPlaylist = (line == QLatin1String("[playlist]"));
+                        break;
+                    }
+                }
+
+                if (!isPlaylist) {
+                    qWarning() << filePath << "is not a PLS playlist";
+                    return;
+                }
+
+                Entries<PlaylistTrack> entries(PlaylistTrack{QUrl(), QString(), -1, QString(), QString()});
+
+                while (file.readLine(line)) {
+                    int number;
+                    int equalsIndex;
+                    if ((equalsIndex = parseKeyNumber(line, fileKey, number)) != -1) {
+                        entries.entry(number).url = urlFromString(line.mid(equalsIndex + 1).toString(), playlistFileDir);
+                    } else if ((equalsIndex = parseKeyNumber(line, titleKey, number)) != -1) {
+                        entries.entry(number).title = line.mid(equalsIndex + 1).toString();
+                    } else if ((equalsIndex = parseKeyNumber(line, lengthKey, number)) != -1) {
+                        entries.entry(number).duration = line.mid(equalsIndex + 1).toInt();
+                    }
+                }
+
+                tracks.reserve(entries.size());
+                for (auto& i : entries.sorted()) {
                     if (!i.second.url.isEmpty()) {
                         if (i.second.title.isEmpty()) {
                             setTitleFromUrl(i.second);
@@ -189,45 +374,34 @@ namespace unplayer
                 }
             }
 
-            void getTrackUrls(QStringList& tracks, QTextStream& stream, QDir& playlistFileDir)
+            void getTrackUrls(QStringList& tracks, PlaylistFile& file, const QDir& playlistFileDir)
             {
-                std::map<int, QString> tracksMap;
-                while (!stream.atEnd()) {
-                    const QString line(stream.readLine().trimmed());
-                    if (line.startsWith(QStringLiteral("File"))) {
-                        const int equalsIndex = line.indexOf(QLatin1Char('='));
-                        if (equalsIndex != -1) {
-                            bool ok;
-                            const int number = line.midRef(4, equalsIndex - 4).toInt(&ok);
-                            if (ok) {
-                                const QUrl url(urlFromString(line.midRef(equalsIndex + 1).trimmed().toString(), playlistFileDir));
-                                if (!url.isEmpty()) {
-                                    tracksMap.insert({number, url.toString()});
-                                }
-                            }
+                Entries<QString> entries{QString()};
+                Line line;
+                while (file.readLine(line)) {
+                    int number;
+                    const int equalsIndex = parseKeyNumber(line, fileKey, number);
+                    if (equalsIndex != -1) {
+                        const QUrl url(urlFromString(line.mid(equalsIndex + 1).toString(), playlistFileDir));
+                        if (!url.isEmpty()) {
+                            entries.entry(number) = url.toString();
                         }
                     }
                 }
-                tracks.reserve(tracksMap.size());
-                for (auto& i : tracksMap) {
+                tracks.reserve(entries.size());
+                for (auto& i : entries.sorted()) {
                     tracks.push_back(std::move(i.second));
                 }
             }
 
-            int getTracksCount(QTextStream& stream)
+            int getTracksCount(PlaylistFile& file)
             {
-                std::unordered_set<int> files;
-                while (!stream.atEnd()) {
-                    const QString line(stream.readLine().trimmed());
-                    if (line.startsWith(QStringLiteral("File"))) {
-                        const int equalsIndex = line.indexOf(QLatin1Char('='));
-                        if (equalsIndex != -1) {
-                            bool ok;
-                            const int number = line.midRef(4, equalsIndex - 4).toInt(&ok);
-                            if (ok) {
-                                files.insert(number);
-                            }
-                        }
+                FlatHashSet<int> files;
+                Line line;
+                while (file.readLine(line)) {
+                    int number;
+                    if (parseKeyNumber(line, fileKey, number) != -1) {
+                        files.insert(number);
                     }
                 }
                 return files.size();
@@ -235,7 +409,7 @@ namespace unplayer
 
             void save(QTextStream& stream, const std::vector<PlaylistTrack>& tracks)
             {
-                stream << "[playlist]" << endl;
+                stream << "[playlist]\n";
 
                 for (int i = 0, max = tracks.size(); i < max; ++i) {
                     const PlaylistTrack& track = tracks[i];
@@ -246,25 +420,29 @@ namespace unplayer
                     } else {
                         stream << track.url.toString();
                     }
-                    stream << endl;
-                    stream << "Title" << number << '=' << track.title << endl;
+                    stream << '\n';
+                    stream << "Title" << number << '=' << track.title << '\n';
                     if (track.duration != -1) {
-                        stream << "Length" << number << '=' << track.duration << endl;
+                        stream << "Length" << number << '=' << track.duration << '\n';
                     }
                 }
 
-                stream << "NumberOfEntries=" << tracks.size() << endl;
+                stream << "NumberOfEntries=" << tracks.size() << '\n';
             }
         }
 
         namespace m3u
         {
-            void parse(std::vector<PlaylistTrack>& tracks, QTextStream& stream, QDir& playlistFileDir)
+            const QLatin1String extinfPrefix("#EXTINF:");
+
+            void parse(std::vector<PlaylistTrack>& tracks, PlaylistFile& file, const QDir& playlistFileDir)
             {
-                while (!stream.atEnd()) {
-                    const QString line(stream.readLine().trimmed());
-                    if (line.startsWith(QStringLiteral("#EXTINF:"))) {
-                        QUrl url(urlFromString(stream.readLine().trimmed(), playlistFileDir));
+                Line line;
+                while (file.readLine(line)) {
+                    if (line.startsWith(extinfPrefix)) {
+                        Line urlLine{nullptr, 0};
+                        file.readLine(urlLine);
+                        QUrl url(urlFromString(urlLine.toString(), playlistFileDir));
                         if (url.isEmpty()) {
                             continue;
                         }
@@ -272,31 +450,31 @@ namespace unplayer
                         PlaylistTrack track{std::move(url)};
                         track.duration = -1;
 
-                        const int durationIndex = 8;
-                        const int commaIndex = line.indexOf(QLatin1Char(','), durationIndex);
+                        const int durationIndex = extinfPrefix.size();
+                        const int commaIndex = line.indexOf(',', durationIndex);
                         if (commaIndex == -1) {
                             setTitleFromUrl(track);
                             continue;
                         }
-                        const QStringRef durationRef(line.midRef(durationIndex, commaIndex - durationIndex));
-                        if (!durationRef.isEmpty()) {
-                            const int duration = durationRef.toInt();
-                            if (duration != -1) {
-                                track.duration = duration;
+                        const Line duration(line.mid(durationIndex, commaIndex - durationIndex));
+                        if (!duration.isEmpty()) {
+                            const int value = duration.toInt();
+                            if (value != -1) {
+                                track.duration = value;
                             }
                         }
 
-                        const int hyphenIndex = line.indexOf(QLatin1Char('-'), commaIndex + 1);
+                        const int hyphenIndex = line.indexOf('-', commaIndex + 1);
                         if (hyphenIndex == -1) {
-                            track.title = line.midRef(commaIndex + 1).trimmed().toString();
+                            track.title = line.mid(commaIndex + 1).toString();
                         } else {
-                            track.artist = line.midRef(commaIndex + 1, hyphenIndex - commaIndex - 1).trimmed().toString();
-                            track.title = line.midRef(hyphenIndex + 1).trimmed().toString();
+                            track.artist = line.mid(commaIndex + 1, hyphenIndex - commaIndex - 1).toString();
+                            track.title = line.mid(hyphenIndex + 1).toString();
                         }
 
                         tracks.push_back(std::move(track));
-                    } else if (!line.startsWith(QLatin1Char('#')) && !line.isEmpty()) {
-                        QUrl url(urlFromString(line, playlistFileDir));
+                    } else if (!line.startsWith('#') && !line.isEmpty()) {
+                        QUrl url(urlFromString(line.toString(), playlistFileDir));
                         if (!url.isEmpty()) {
                             PlaylistTrack track{std::move(url)};
                             track.duration = -1;
@@ -306,12 +484,12 @@ namespace unplayer
                 }
             }
 
-            void getTrackUrls(QStringList& tracks, QTextStream& stream, QDir& playlistFileDir)
+            void getTrackUrls(QStringList& tracks, PlaylistFile& file, const QDir& playlistFileDir)
             {
-                while (!stream.atEnd()) {
-                    const QString line(stream.readLine().trimmed());
-                    if (!line.isEmpty() && !line.startsWith(QLatin1Char('#'))) {
-                        const QUrl url(urlFromString(line, playlistFileDir));
+                Line line;
+                while (file.readLine(line)) {
+                    if (!line.isEmpty() && !line.startsWith('#')) {
+                        const QUrl url(urlFromString(line.toString(), playlistFileDir));
                         if (!url.isEmpty()) {
                             tracks.push_back(url.toString());
                         }
@@ -319,79 +497,154 @@ namespace unplayer
                 }
             }
 
-            int getTracksCount(QTextStream& stream)
+            int getTracksCount(PlaylistFile& file)
             {
                 int count = 0;
-                while (!stream.atEnd()) {
-                    const QString line(stream.readLine().trimmed());
-                    if (!line.isEmpty() && !line.startsWith(QLatin1Char('#'))) {
+                Line line;
+                while (file.readLine(line)) {
+                    if (!line.isEmpty() && !line.startsWith('#')) {
                         ++count;
                     }
                 }
                 return count;
             }
 
-            void save(QTextStream& stream, const std::vector<PlaylistTrack>& tracks)
+            const QLatin1String header("#EXTM3U");
+
+            void writeTrack(QTextStream& stream, const PlaylistTrack& track)
             {
-                stream << "#EXTM3U" << endl;
-                for (const PlaylistTrack& track : tracks) {
-                    if (!track.title.isEmpty()) {
-                        stream << endl;
-                        stream << "#EXTINF:" << track.duration << ", ";
-                        if (track.artist.isEmpty()) {
-                            stream << track.title;
-                        } else {
-                            stream << track.artist << " - " << track.title << endl;
-                        }
-                    }
-                    if (track.url.isLocalFile()) {
-                        stream << track.url.path();
+                if (!track.title.isEmpty()) {
+                    stream << '\n';
+                    stream << extinfPrefix << track.duration << ", ";
+                    if (track.artist.isEmpty()) {
+                        stream << track.title;
                     } else {
-                        stream << track.url.toString();
+                        stream << track.artist << " - " << track.title;
                     }
-                    stream << endl;
+                    stream << '\n';
+                }
+                if (track.url.isLocalFile()) {
+                    stream << track.url.path();
+                } else {
+                    stream << track.url.toString();
                 }
+                stream << '\n';
             }
-        }
 
-        PlaylistTrack trackFromUrlString(const QString& urlString)
-        {
-            int duration = -1;
-            QString artist;
-            QString album;
-            QString title;
+            void save(QTextStream& stream, const std::vector<PlaylistTrack>& tracks)
+            {
+                stream << header << '\n';
+                for (const PlaylistTrack& track : tracks) {
+                    writeTrack(stream, track);
+                }
+            }
 
-            const QUrl url(urlString);
-            if (url.isRelative() || url.isLocalFile()) {
-                QSqlQuery query;
-                query.prepare(QLatin1String("SELECT title, duration, artist, album FROM tracks WHERE filePath = ?"));
-                query.addBindValue(url.path());
-                if (query.exec()) {
-                    if (query.next()) {
-                        title = query.value(0).toString();
-                        duration = query.value(1).toInt();
-                        artist = query.value(2).toString();
-                        album = query.value(3).toString();
+            // Appends tracks to the end of existing file without rewriting it
+            bool append(const QString& filePath, const std::vector<PlaylistTrack>& tracks)
+            {
+                QFile file(filePath);
+                if (!file.open(QIODevice::ReadWrite)) {
+                    qWarning() << "error opening playlist file:" << filePath << file.error() << file.errorString();
+                    return false;
+                }
+
+                const qint64 size = file.size();
+                bool endsWithNewLine = true;
+                if (size > 0) {
+                    char last = '\n';
+                    if (!file.seek(size - 1) || !file.getChar(&last)) {
+                        qWarning() << "error reading playlist file:" << filePath << file.error() << file.errorString();
+                        return false;
                     }
-                } else {
-                    qWarning() << "failed to get track from database:" << query.lastError();
+                    endsWithNewLine = (last == '\n');
                 }
-            }
+                if (!file.seek(size)) {
+                    qWarning() << "error seeking playlist file:" << filePath << file.error() << file.errorString();
+                    return false;
+                }
+
+                QTextStream stream(&file);
+                stream.setCodec("UTF-8");
+                if (size == 0) {
+                    stream << header << '\n';
+                } else if (!endsWithNewLine) {
+                    stream << '\n';
+                }
+                for (const PlaylistTrack& track : tracks) {
+                    writeTrack(stream, track);
+                }
+                stream.flush();
 
-            return PlaylistTrack{url,
-                                 title,
-                                 duration,
-                                 artist,
-                                 album};
+                if (stream.status() != QTextStream::Ok) {
+                    qWarning() << "error writing playlist file:" << filePath << file.error() << file.errorString();
+                    return false;
+                }
+                return true;
+            }
         }
 
-        std::vector<PlaylistTrack> tracksFromUrls(const QStringList& trackUrls)
+        // Local files are looked up in library in batches, progress is reported after each of them
+        const int tracksBatchSize = 500;
+
+        // Called from worker thread, resolves local files with one query per batch
+        std::vector<PlaylistTrack> tracksFromUrls(const QStringList& trackUrls, const PlaylistUtils::ProgressCallback& progress)
         {
+            UNPLAYER_TRACE("playlist: tracks from urls");
             std::vector<PlaylistTrack> tracks;
             tracks.reserve(trackUrls.size());
+
+            bool hasLocalFiles = false;
             for (const QString& urlString : trackUrls) {
-                tracks.push_back(trackFromUrlString(urlString));
+                const QUrl url(urlString);
+                if (url.isRelative() || url.isLocalFile()) {
+                    hasLocalFiles = true;
+                }
+                tracks.push_back(PlaylistTrack{url, QString(), -1, QString(), QString()});
             }
+
+            if (!hasLocalFiles) {
+                return tracks;
+            }
+
+            const QSqlDatabase db(LibraryUtils::threadDatabase());
+            if (!db.isOpen()) {
+                return tracks;
+            }
+
+            const int total = tracks.size();
+            for (int first = 0; first < total; first += tracksBatchSize) {
+                const auto batchBegin(tracks.begin() + first);
+                const auto batchEnd(tracks.begin() + std::min(first + tracksBatchSize, total));
+
+                std::vector<QString> filePaths;
+                for (auto i = batchBegin; i != batchEnd; ++i) {
+                    if (i->url.isRelative() || i->url.isLocalFile()) {
+                        filePaths.push_back(i->url.path());
+                    }
+                }
+                if (filePaths.empty()) {
+                    continue;
+                }
+
+                const std::unordered_map<QString, LibraryTrackMetadata> metadata(LibraryUtils::getTracksMetadata(db, filePaths));
+                const auto end(metadata.end());
+                for (auto i = batchBegin; i != batchEnd; ++i) {
+                    PlaylistTrack& track = *i;
+                    if (track.url.isRelative() || track.url.isLocalFile()) {
+                        const auto found(metadata.find(track.url.path()));
+                        if (found != end) {
+                            const LibraryTrackMetadata& libraryTrack = found->second;
+                            track.title = libraryTrack.title;
+                            track.duration = libraryTrack.duration;
+                            track.artist = libraryTrack.artist;
+                            track.album = libraryTrack.album;
+                        }
+                    }
+                }
+
+                progress(static_cast<int>(batchEnd - tracks.begin()), total);
+            }
+
             return tracks;
         }
 
@@ -408,9 +661,97 @@ namespace unplayer
             }
             return tracks;
         }
+
+        bool isPlaylistIndexed(const QSqlDatabase& db, const QFileInfo& fileInfo)
+        {
+            SqlQuery query(db);
+            query.prepare(QLatin1String("SELECT modificationTime, size FROM playlists WHERE filePath = ?"));
+            query.addBindValue(fileInfo.filePath());
+            if (!query.exec()) {
+                qWarning() << "failed to get indexed playlist" << query.lastError();
+                return false;
+            }
+            return query.next() &&
+                   query.value(0).toLongLong() == fileInfo.lastModified().toMSecsSinceEpoch() &&
+                   query.value(1).toLongLong() == fileInfo.size();
+        }
+
+        void savePlaylistIndex(const QSqlDatabase& db, const QFileInfo& fileInfo, const std::vector<PlaylistTrack>& tracks)
+        {
+            QSqlDatabase database(db);
+            database.transaction();
+
+            const QString filePath(fileInfo.filePath());
+
+            // Entries are removed by trigger
+            SqlQuery query(db);
+            query.prepare(QLatin1String("DELETE FROM playlists WHERE filePath = ?"));
+            query.addBindValue(filePath);
+            if (!query.exec()) {
+                qWarning() << "failed to remove playlist index" << query.lastError();
+                database.rollback();
+                return;
+            }
+
+            query.prepare(QLatin1String("INSERT INTO playlists (filePath, modificationTime, size, tracksCount) VALUES (?, ?, ?, ?)"));
+            query.addBindValue(filePath);
+            query.addBindValue(fileInfo.lastModified().toMSecsSinceEpoch());
+            query.addBindValue(fileInfo.size());
+            query.addBindValue(static_cast<int>(tracks.size()));
+            if (!query.exec()) {
+                qWarning() << "failed to index playlist" << query.lastError();
+                database.rollback();
+                return;
+            }
+
+            query.prepare(QLatin1String("INSERT INTO playlist_entries (playlistFilePath, position, url, title, duration, artist, album) VALUES (?, ?, ?, ?, ?, ?, ?)"));
+            for (int i = 0, max = tracks.size(); i < max; ++i) {
+                const PlaylistTrack& track = tracks[i];
+                query.bindValue(0, filePath);
+                query.bindValue(1, i);
+                query.bindValue(2, track.url.toString(QUrl::FullyEncoded));
+                query.bindValue(3, track.title);
+                query.bindValue(4, track.duration);
+                query.bindValue(5, track.artist);
+                query.bindValue(6, track.album);
+                if (!query.exec()) {
+                    qWarning() << "failed to index playlist entry" << query.lastError();
+                    database.rollback();
+                    return;
+                }
+            }
+
+            database.commit();
+        }
+
+        // Runs function in transaction on thread's own connection
+        bool changeSmartPlaylists(const std::function<bool(const QSqlDatabase&)>& function)
+        {
+            const QSqlDatabase db(LibraryUtils::threadDatabase());
+            if (!db.isOpen() || !db.transaction()) {
+                qWarning() << "failed to start transaction" << db.lastError();
+                return false;
+            }
+            if (!function(db)) {
+                db.rollback();
+                return false;
+            }
+            db.commit();
+            LibraryReplica::invalidate();
+            return true;
+        }
+
+        PlaylistUtils::JobResult writeResult(const QString& filePath, bool written)
+        {
+            PlaylistUtils::JobResult result{written, {}, false};
+            if (written) {
+                result.changedPlaylists.push_back(filePath);
+            }
+            return result;
+        }
     }
 
-    const std::unordered_set<QString> PlaylistUtils::playlistsExtensions([]() {
+    const FlatHashSet<QString> PlaylistUtils::playlistsExtensions([]() {
         auto extensions(m3uExtensions);
         extensions.insert(plsExtension);
         return extensions;
@@ -444,20 +785,29 @@ namespace unplayer
         return QDir(mPlaylistsDirectoryPath).entryList(playlistsNameFilters, QDir::Files).size();
     }
 
-    void PlaylistUtils::savePlaylist(const QString& filePath, const std::vector<PlaylistTrack> &tracks)
+    int PlaylistUtils::savePlaylist(const QString& filePath, const std::vector<PlaylistTrack>& tracks)
+    {
+        return startJob([=](const ProgressCallback&) {
+            return writeResult(filePath, writePlaylist(filePath, tracks));
+        });
+    }
+
+    bool PlaylistUtils::writePlaylist(const QString& filePath, const std::vector<PlaylistTrack>& tracks)
     {
-        if (!QDir().mkpath(mPlaylistsDirectoryPath)) {
+        if (!QDir().mkpath(QFileInfo(filePath).path())) {
             qWarning() << "failed to create playlists directory";
-            return;
+            return false;
         }
 
-        QFile file(filePath);
+        // Write to temporary file and replace playlist only when everything is written
+        QSaveFile file(filePath);
         if (!file.open(QIODevice::WriteOnly)) {
             qWarning() << "error opening playlist file:" << filePath << file.error() << file.errorString();
-            return;
+            return false;
         }
 
         QTextStream stream(&file);
+        stream.setCodec("UTF-8");
 
         switch (playlistTypeFromExtension(QFileInfo(filePath).suffix())) {
         case PlaylistType::Pls:
@@ -474,86 +824,141 @@ namespace unplayer
             break;
         }
 
-        emit playlistsChanged();
+        stream.flush();
+        if (stream.status() != QTextStream::Ok || !file.commit()) {
+            qWarning() << "error writing playlist file:" << filePath << file.error() << file.errorString();
+            return false;
+        }
+
+        return true;
     }
 
-    void PlaylistUtils::newPlaylistFromFilesystem(const QString& name, const QStringList& trackUrls)
+    int PlaylistUtils::newPlaylistFromFilesystem(const QString& name, const QStringList& trackUrls)
     {
-        newPlaylist(name, tracksFromUrls(trackUrls));
+        const QString filePath(newPlaylistFilePath(name));
+        return startJob([=](const ProgressCallback& progress) {
+            return writeResult(filePath, writePlaylist(filePath, tracksFromUrls(trackUrls, progress)));
+        });
     }
 
-    void PlaylistUtils::newPlaylistFromLibrary(const QString& name, const std::vector<LibraryTrack>& libraryTracks)
+    int PlaylistUtils::newPlaylistFromLibrary(const QString& name, const TrackList& libraryTracks)
     {
-        newPlaylist(name, tracksFromTracks(libraryTracks));
+        const QString filePath(newPlaylistFilePath(name));
+        const std::vector<LibraryTrack> tracks(libraryTracks.tracks());
+        return startJob([=](const ProgressCallback&) {
+            return writeResult(filePath, writePlaylist(filePath, tracksFromTracks(tracks)));
+        });
     }
 
-    void PlaylistUtils::newPlaylistFromLibrary(const QString& name, const LibraryTrack& libraryTracks)
+    int PlaylistUtils::newPlaylistFromLibrary(const QString& name, const LibraryTrack& libraryTrack)
     {
-        newPlaylist(name, tracksFromTracks({libraryTracks}));
+        const QString filePath(newPlaylistFilePath(name));
+        return startJob([=](const ProgressCallback&) {
+            return writeResult(filePath, writePlaylist(filePath, tracksFromTracks({libraryTrack})));
+        });
     }
 
-    void PlaylistUtils::addTracksToPlaylistFromFilesystem(const QString& filePath, const QStringList& trackUrls)
+    int PlaylistUtils::addTracksToPlaylistFromFilesystem(const QString& filePath, const QStringList& trackUrls)
     {
-        addTracksToPlaylist(filePath, tracksFromUrls(trackUrls));
+        return startJob([=](const ProgressCallback& progress) {
+            return writeResult(filePath, addTracksToPlaylist(filePath, tracksFromUrls(trackUrls, progress)));
+        });
     }
 
-    void PlaylistUtils::addTracksToPlaylistFromLibrary(const QString& filePath, const std::vector<LibraryTrack>& libraryTracks)
+    int PlaylistUtils::addTracksToPlaylistFromLibrary(const QString& filePath, const TrackList& libraryTracks)
     {
-        addTracksToPlaylist(filePath, tracksFromTracks(libraryTracks));
+        const std::vector<LibraryTrack> tracks(libraryTracks.tracks());
+        return startJob([=](const ProgressCallback&) {
+            return writeResult(filePath, addTracksToPlaylist(filePath, tracksFromTracks(tracks)));
+        });
     }
 
-    void PlaylistUtils::addTracksToPlaylistFromLibrary(const QString& filePath, const LibraryTrack& libraryTrack)
+    int PlaylistUtils::addTracksToPlaylistFromLibrary(const QString& filePath, const LibraryTrack& libraryTrack)
     {
-        addTracksToPlaylist(filePath, tracksFromTracks({libraryTrack}));
+        return startJob([=](const ProgressCallback&) {
+            return writeResult(filePath, addTracksToPlaylist(filePath, tracksFromTracks({libraryTrack})));
+        });
     }
 
-    void PlaylistUtils::removePlaylist(const QString& filePath)
+    int PlaylistUtils::newSmartPlaylist(const QString& name, const QString& rules)
     {
-        if (QFile::remove(filePath)) {
-            emit playlistsChanged();
-        } else {
-            qWarning() << "failed to remove playlist:" << filePath;
+        if (!smartplaylists::isValidRules(rules)) {
+            qWarning() << "invalid smart playlist rules" << rules;
+            return -1;
         }
+        return startJob([=](const ProgressCallback&) {
+            const bool created = changeSmartPlaylists([&](const QSqlDatabase& db) {
+                return smartplaylists::create(db, name, rules) != -1;
+            });
+            return JobResult{created, {}, created};
+        });
     }
 
-    void PlaylistUtils::removePlaylists(const std::vector<QString>& playlists)
+    bool PlaylistUtils::isSmartPlaylist(const QString& filePath)
     {
-        bool removed = false;
-        for (const QString& filePath : playlists) {
-            if (QFile::remove(filePath)) {
-                removed = true;
-            } else {
-                qWarning() << "failed to remove playlist:" << filePath;
+        return smartplaylists::isSmartPlaylist(filePath);
+    }
+
+    int PlaylistUtils::removePlaylist(const QString& filePath)
+    {
+        return removePlaylists({filePath});
+    }
+
+    int PlaylistUtils::removePlaylists(const std::vector<QString>& playlists)
+    {
+        return startJob([=](const ProgressCallback& progress) {
+            JobResult result{true, {}, false};
+            std::vector<int> smartPlaylists;
+            for (int i = 0, max = playlists.size(); i < max; ++i) {
+                const QString& filePath = playlists[i];
+                if (smartplaylists::isSmartPlaylist(filePath)) {
+                    smartPlaylists.push_back(smartplaylists::idFromFilePath(filePath));
+                } else if (QFile::remove(filePath)) {
+                    result.changedPlaylists.push_back(filePath);
+                } else {
+                    qWarning() << "failed to remove playlist:" << filePath;
+                    result.succeeded = false;
+                }
+                progress(i + 1, max);
             }
-        }
-        if (removed) {
-            emit playlistsChanged();
-        }
+            if (!smartPlaylists.empty()) {
+                result.smartPlaylistsChanged = changeSmartPlaylists([&](const QSqlDatabase& db) -> bool {
+                    for (int id : smartPlaylists) {
+                        if (!smartplaylists::remove(db, id)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                });
+                if (!result.smartPlaylistsChanged) {
+                    result.succeeded = false;
+                }
+            }
+            return result;
+        });
     }
 
     std::vector<PlaylistTrack> PlaylistUtils::parsePlaylist(const QString& filePath)
     {
+        UNPLAYER_TRACE("playlist: parse");
         std::vector<PlaylistTrack> tracks;
         const QFileInfo fileInfo(filePath);
-        QDir playlistFileDir(fileInfo.path());
+        const QDir playlistFileDir(fileInfo.path());
 
-        QFile file(filePath);
-        if (!file.open(QIODevice::ReadOnly)) {
-            qWarning() << "error opening playlist file:" << filePath << file.error() << file.errorString();
+        PlaylistFile file(filePath);
+        if (!file.isOpen()) {
             return tracks;
         }
 
-        QTextStream stream(&file);
-
         switch (playlistTypeFromExtension(fileInfo.suffix())) {
         case PlaylistType::Pls:
         {
-            pls::parse(tracks, stream, filePath, playlistFileDir);
+            pls::parse(tracks, file, filePath, playlistFileDir);
             break;
         }
         case PlaylistType::M3u:
         {
-            m3u::parse(tracks, stream, playlistFileDir);
+            m3u::parse(tracks, file, playlistFileDir);
             break;
         }
         case PlaylistType::Other:
@@ -566,25 +971,33 @@ namespace unplayer
     QStringList PlaylistUtils::getPlaylistTracks(const QString& filePath)
     {
         QStringList tracks;
-        QDir playlistFileDir(QFileInfo(filePath).path());
+        const QFileInfo fileInfo(filePath);
 
-        QFile file(filePath);
-        if (!file.open(QIODevice::ReadOnly)) {
-            qWarning() << "error opening playlist file:" << filePath << file.error() << file.errorString();
+        if (smartplaylists::isSmartPlaylist(filePath) || fileInfo.absolutePath() == instance()->playlistsDirectoryPath()) {
+            const std::vector<PlaylistTrack> playlistTracks(loadPlaylist(filePath));
+            tracks.reserve(playlistTracks.size());
+            for (const PlaylistTrack& track : playlistTracks) {
+                tracks.push_back(track.url.toString());
+            }
             return tracks;
         }
 
-        QTextStream stream(&file);
+        const QDir playlistFileDir(fileInfo.path());
 
-        switch (playlistTypeFromExtension(QFileInfo(filePath).suffix())) {
+        PlaylistFile file(filePath);
+        if (!file.isOpen()) {
+            return tracks;
+        }
+
+        switch (playlistTypeFromExtension(fileInfo.suffix())) {
         case PlaylistType::Pls:
         {
-            pls::getTrackUrls(tracks, stream, playlistFileDir);
+            pls::getTrackUrls(tracks, file, playlistFileDir);
             break;
         }
         case PlaylistType::M3u:
         {
-            m3u::getTrackUrls(tracks, stream, playlistFileDir);
+            m3u::getTrackUrls(tracks, file, playlistFileDir);
             break;
         }
         case PlaylistType::Other:
@@ -596,28 +1009,80 @@ namespace unplayer
 
     int PlaylistUtils::getPlaylistTracksCount(const QString& filePath)
     {
-        QFile file(filePath);
-        if (!file.open(QIODevice::ReadOnly)) {
-            qWarning() << "error opening playlist file:" << filePath << file.error() << file.errorString();
+        PlaylistFile file(filePath);
+        if (!file.isOpen()) {
             return 0;
         }
 
-        QTextStream stream(&file);
-
         switch (playlistTypeFromExtension(QFileInfo(filePath).suffix())) {
         case PlaylistType::Pls:
         {
-            return pls::getTracksCount(stream);
+            return pls::getTracksCount(file);
         }
         case PlaylistType::M3u:
         {
-            return m3u::getTracksCount(stream);
+            return m3u::getTracksCount(file);
         }
         default:
             return 0;
         }
     }
 
+    std::vector<PlaylistTrack> PlaylistUtils::loadPlaylist(const QString& filePath)
+    {
+        UNPLAYER_TRACE("playlist: load");
+        if (smartplaylists::isSmartPlaylist(filePath)) {
+            const QSqlDatabase db(LibraryUtils::threadDatabase());
+            if (!db.isOpen()) {
+                return {};
+            }
+            return smartplaylists::tracks(db, smartplaylists::idFromFilePath(filePath));
+        }
+
+        const QFileInfo fileInfo(filePath);
+        if (fileInfo.absolutePath() != instance()->playlistsDirectoryPath()) {
+            return parsePlaylist(filePath);
+        }
+
+        const QSqlDatabase db(LibraryUtils::threadDatabase());
+        if (!db.isOpen()) {
+            return parsePlaylist(filePath);
+        }
+
+        if (!isPlaylistIndexed(db, fileInfo)) {
+            std::vector<PlaylistTrack> tracks(parsePlaylist(filePath));
+            savePlaylistIndex(db, fileInfo, tracks);
+            return tracks;
+        }
+
+        std::vector<PlaylistTrack> tracks;
+        SqlQuery query(db);
+        query.setForwardOnly(true);
+        query.prepare(QLatin1String("SELECT url, title, duration, artist, album FROM playlist_entries "
+                                    "WHERE playlistFilePath = ? ORDER BY position"));
+        query.addBindValue(fileInfo.filePath());
+        LibraryUtils::explainQuery(query, db);
+        if (!query.exec()) {
+            qWarning() << "failed to get playlist entries" << query.lastError();
+            return parsePlaylist(filePath);
+        }
+        while (query.next()) {
+            tracks.push_back(PlaylistTrack{QUrl(query.value(0).toString()),
+                                           query.value(1).toString(),
+                                           query.value(2).toInt(),
+                                           query.value(3).toString(),
+                                           query.value(4).toString()});
+        }
+        return tracks;
+    }
+
+    int PlaylistUtils::indexPlaylist(const QSqlDatabase& db, const QFileInfo& fileInfo)
+    {
+        const std::vector<PlaylistTrack> tracks(parsePlaylist(fileInfo.filePath()));
+        savePlaylistIndex(db, fileInfo, tracks);
+        return tracks.size();
+    }
+
     PlaylistUtils::PlaylistUtils(QObject* parent)
         : QObject(parent),
           mPlaylistsDirectoryPath(QString::fromLatin1("%1/playlists").arg(QStandardPaths::writableLocation(QStandardPaths::MusicLocation)))
@@ -625,15 +1090,56 @@ namespace unplayer
 
     }
 
-    void PlaylistUtils::newPlaylist(const QString& name, const std::vector<PlaylistTrack>& tracks)
+    QString PlaylistUtils::newPlaylistFilePath(const QString& name) const
     {
-        savePlaylist(QString::fromLatin1("%1/%2.%3").arg(mPlaylistsDirectoryPath, name, plsExtension), tracks);
+        return QString::fromLatin1("%1/%2.%3").arg(mPlaylistsDirectoryPath, name, plsExtension);
     }
 
-    void PlaylistUtils::addTracksToPlaylist(const QString& filePath, std::vector<PlaylistTrack>&& tracks)
+    bool PlaylistUtils::addTracksToPlaylist(const QString& filePath, std::vector<PlaylistTrack>&& tracks)
     {
+        if (playlistTypeFromExtension(QFileInfo(filePath).suffix()) == PlaylistType::M3u) {
+            return m3u::append(filePath, tracks);
+        }
+
+        // Entries in pls files are numbered and followed by their count, so it is rewritten
         std::vector<PlaylistTrack> playlistTracks(parsePlaylist(filePath));
-        playlistTracks.insert(playlistTracks.begin(), std::make_move_iterator(tracks.begin()), std::make_move_iterator(tracks.end()));
-        savePlaylist(filePath, playlistTracks);
+        playlistTracks.insert(playlistTracks.end(), std::make_move_iterator(tracks.begin()), std::make_move_iterator(tracks.end()));
+        return writePlaylist(filePath, playlistTracks);
+    }
+
+    int PlaylistUtils::startJob(const JobFunction& function)
+    {
+        return JobManager::instance()->add(this, JobManager::Type::WritePlaylist, threadpools::JobClass::Bulk, [=](int id) {
+            runJob(id, function);
+        });
+    }
+
+    void PlaylistUtils::runJob(int id, const JobFunction& function)
+    {
+        using FutureWatcher = QFutureWatcher<JobResult>;
+        auto watcher = new FutureWatcher(this);
+        QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
+            const JobResult result(watcher->result());
+            watcher->deleteLater();
+
+            for (const QString& filePath : result.changedPlaylists) {
+                emit playlistChanged(filePath);
+            }
+            if (!result.changedPlaylists.empty()) {
+                emit playlistsCountChanged();
+            }
+            if (result.smartPlaylistsChanged) {
+                emit playlistsChanged();
+            }
+            emit jobFinished(id, result.succeeded);
+
+            JobManager::instance()->finish(id);
+        });
+        watcher->setFuture(threadpools::run(threadpools::JobClass::Bulk, [=]() {
+            return function([=](int processed, int total) {
+                QMetaObject::invokeMethod(this, "jobProgress", Qt::QueuedConnection, Q_ARG(int, id), Q_ARG(int, processed), Q_ARG(int, total));
+                JobManager::instance()->reportProgress(id, processed, total);
+            });
+        }));
     }
 }
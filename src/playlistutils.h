@@ -19,16 +19,22 @@
 #ifndef UNPLAYER_PLAYLISTUTILS_H
 #define UNPLAYER_PLAYLISTUTILS_H
 
+#include <functional>
 #include <memory>
+#include <utility>
 #include <vector>
-#include <unordered_set>
 
 #include <QObject>
 #include <QStringList>
 #include <QUrl>
 
+#include "flathash.h"
 #include "librarytrack.h"
 #include "stdutils.h"
+#include "tracklist.h"
+
+class QFileInfo;
+class QSqlDatabase;
 
 namespace unplayer
 {
@@ -44,42 +50,82 @@ namespace unplayer
     class PlaylistUtils final : public QObject
     {
         Q_OBJECT
-        Q_PROPERTY(int playlistsCount READ playlistsCount NOTIFY playlistsChanged)
+        Q_PROPERTY(int playlistsCount READ playlistsCount NOTIFY playlistsCountChanged)
     public:
         static const QStringList playlistsNameFilters;
-        static const std::unordered_set<QString> playlistsExtensions;
+        static const FlatHashSet<QString> playlistsExtensions;
 
         static PlaylistUtils* instance();
 
         const QString& playlistsDirectoryPath();
         int playlistsCount();
 
-        void savePlaylist(const QString& filePath, const std::vector<PlaylistTrack>& tracks);
+        // Playlists are changed by jobs of JobManager which are run on worker thread one after another,
+        // in the order they were started. Methods that start a job return its id,
+        // which is passed to jobProgress() and jobFinished()
+
+        int savePlaylist(const QString& filePath, const std::vector<PlaylistTrack>& tracks);
+        // Writes playlist file, can be called from any thread
+        static bool writePlaylist(const QString& filePath, const std::vector<PlaylistTrack>& tracks);
+
+        Q_INVOKABLE int newPlaylistFromFilesystem(const QString& name, const QStringList& trackUrls);
+        Q_INVOKABLE int newPlaylistFromLibrary(const QString& name, const unplayer::TrackList& libraryTracks);
+        Q_INVOKABLE int newPlaylistFromLibrary(const QString& name, const unplayer::LibraryTrack& libraryTrack);
+
+        Q_INVOKABLE int addTracksToPlaylistFromFilesystem(const QString& filePath, const QStringList& trackUrls);
+        Q_INVOKABLE int addTracksToPlaylistFromLibrary(const QString& filePath, const unplayer::TrackList& libraryTracks);
+        Q_INVOKABLE int addTracksToPlaylistFromLibrary(const QString& filePath, const unplayer::LibraryTrack& libraryTrack);
 
-        Q_INVOKABLE void newPlaylistFromFilesystem(const QString& name, const QStringList& trackUrls);
-        Q_INVOKABLE void newPlaylistFromLibrary(const QString& name, const std::vector<unplayer::LibraryTrack>& libraryTracks);
-        Q_INVOKABLE void newPlaylistFromLibrary(const QString& name, const unplayer::LibraryTrack& libraryTrack);
+        // Rules are described in smartplaylists.h. Returns -1 if rules are invalid
+        Q_INVOKABLE int newSmartPlaylist(const QString& name, const QString& rules);
+        Q_INVOKABLE static bool isSmartPlaylist(const QString& filePath);
 
-        Q_INVOKABLE void addTracksToPlaylistFromFilesystem(const QString& filePath, const QStringList& trackUrls);
-        Q_INVOKABLE void addTracksToPlaylistFromLibrary(const QString& filePath, const std::vector<unplayer::LibraryTrack>& libraryTracks);
-        Q_INVOKABLE void addTracksToPlaylistFromLibrary(const QString& filePath, const unplayer::LibraryTrack& libraryTrack);
+        Q_INVOKABLE int removePlaylist(const QString& filePath);
+        int removePlaylists(const std::vector<QString>& playlists);
 
-        Q_INVOKABLE void removePlaylist(const QString& filePath);
+        // Called from worker thread with number of processed tracks or playlists
+        using ProgressCallback = std::function<void(int processed, int total)>;
 
-        void removePlaylists(const std::vector<QString>& playlists);
+        struct JobResult
+        {
+            bool succeeded;
+            // Playlist files that were written or removed
+            std::vector<QString> changedPlaylists;
+            bool smartPlaylistsChanged;
+        };
 
         static std::vector<PlaylistTrack> parsePlaylist(const QString& filePath);
         Q_INVOKABLE static QStringList getPlaylistTracks(const QString& filePath);
         static int getPlaylistTracksCount(const QString& filePath);
+
+        // Playlists in playlists directory are indexed in database, and their files
+        // are parsed again only when modification time or size changes.
+        // Connection of calling thread is used
+
+        // Returns tracks from index, other playlists are parsed
+        static std::vector<PlaylistTrack> loadPlaylist(const QString& filePath);
+        // Parses playlist and replaces its index, returns number of tracks
+        static int indexPlaylist(const QSqlDatabase& db, const QFileInfo& fileInfo);
     private:
         explicit PlaylistUtils(QObject* parent);
 
-        void newPlaylist(const QString& name, const std::vector<PlaylistTrack>& tracks);
-        void addTracksToPlaylist(const QString& filePath, std::vector<PlaylistTrack>&& tracks);
+        QString newPlaylistFilePath(const QString& name) const;
+        static bool addTracksToPlaylist(const QString& filePath, std::vector<PlaylistTrack>&& tracks);
+
+        using JobFunction = std::function<JobResult(const ProgressCallback&)>;
+        int startJob(const JobFunction& function);
+        void runJob(int id, const JobFunction& function);
 
         QString mPlaylistsDirectoryPath;
     signals:
+        // Smart playlists were changed, all playlists are reloaded
         void playlistsChanged();
+        // Playlist file was written or removed
+        void playlistChanged(const QString& filePath);
+        void playlistsCountChanged();
+
+        void jobProgress(int job, int processed, int total);
+        void jobFinished(int job, bool succeeded);
     };
 }
 
@@ -0,0 +1,180 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "playstatistics.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QFutureWatcher>
+#include <QSqlDatabase>
+#include <QSqlError>
+
+#include "libraryreplica.h"
+#include "libraryutils.h"
+#include "sqlquery.h"
+#include "threadpools.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        const int flushInterval = 60000;
+        const std::size_t ringSize = 64;
+
+        PlayStatistics* instancePointer = nullptr;
+    }
+
+    PlayStatistics* PlayStatistics::instance()
+    {
+        if (!instancePointer) {
+            instancePointer = new PlayStatistics(qApp);
+        }
+        return instancePointer;
+    }
+
+    void PlayStatistics::recordPlayed(const QString& filePath)
+    {
+        record(filePath, false);
+    }
+
+    void PlayStatistics::recordSkipped(const QString& filePath)
+    {
+        record(filePath, true);
+    }
+
+    PlayStatistics::PlayStatistics(QObject* parent)
+        : QObject(parent),
+          mEvents(ringSize),
+          mFirst(0),
+          mCount(0)
+    {
+        mFlushTimer.setSingleShot(true);
+        mFlushTimer.setInterval(flushInterval);
+        QObject::connect(&mFlushTimer, &QTimer::timeout, this, &PlayStatistics::flush);
+
+        // Events are written on main thread when application exits
+        QObject::connect(qApp, &QCoreApplication::aboutToQuit, this, [=]() {
+            mFlushTimer.stop();
+            mFlushFuture.waitForFinished();
+            if (mCount > 0 && LibraryUtils::instance()->isDatabaseInitialized()) {
+                write(QSqlDatabase::database(), takeEvents());
+            }
+        });
+    }
+
+    bool PlayStatistics::write(QSqlDatabase db, const std::vector<Event>& events)
+    {
+        if (!db.isOpen()) {
+            return false;
+        }
+
+        if (!db.transaction()) {
+            qWarning() << "failed to begin transaction" << db.lastError();
+            return false;
+        }
+
+        SqlQuery playedQuery(db);
+        playedQuery.prepare(QLatin1String("UPDATE tracks SET playCount = playCount + 1, lastPlayed = ? WHERE filePath = ?"));
+        SqlQuery skippedQuery(db);
+        skippedQuery.prepare(QLatin1String("UPDATE tracks SET skipCount = skipCount + 1 WHERE filePath = ?"));
+
+        for (const Event& event : events) {
+            bool ok;
+            if (event.skipped) {
+                skippedQuery.addBindValue(event.filePath);
+                ok = skippedQuery.exec();
+            } else {
+                playedQuery.addBindValue(event.time);
+                playedQuery.addBindValue(event.filePath);
+                ok = playedQuery.exec();
+            }
+            if (!ok) {
+                qWarning() << "failed to write play statistics" << (event.skipped ? skippedQuery : playedQuery).lastError();
+                db.rollback();
+                return false;
+            }
+        }
+
+        // Smart playlists with play count rules
+        LibraryUtils::updateSummaries(db);
+
+        if (!db.commit()) {
+            qWarning() << "failed to commit play statistics" << db.lastError();
+            return false;
+        }
+        LibraryReplica::invalidate();
+        return true;
+    }
+
+    void PlayStatistics::record(const QString& filePath, bool skipped)
+    {
+        if (mCount == mEvents.size()) {
+            mFirst = (mFirst + 1) % mEvents.size();
+            --mCount;
+        }
+        mEvents[(mFirst + mCount) % mEvents.size()] = {filePath, QDateTime::currentMSecsSinceEpoch(), skipped};
+        ++mCount;
+
+        if (mCount == mEvents.size()) {
+            flush();
+        } else if (!mFlushTimer.isActive()) {
+            mFlushTimer.start();
+        }
+    }
+
+    std::vector<PlayStatistics::Event> PlayStatistics::takeEvents()
+    {
+        std::vector<Event> events;
+        events.reserve(mCount);
+        for (std::size_t i = 0; i < mCount; ++i) {
+            events.push_back(std::move(mEvents[(mFirst + i) % mEvents.size()]));
+        }
+        mFirst = 0;
+        mCount = 0;
+        return events;
+    }
+
+    void PlayStatistics::flush()
+    {
+        if (mCount == 0 || mFlushFuture.isRunning()) {
+            return;
+        }
+        if (!LibraryUtils::instance()->isDatabaseInitialized()) {
+            mFlushTimer.start();
+            return;
+        }
+
+        const std::vector<Event> events(takeEvents());
+        auto watcher = new QFutureWatcher<bool>(this);
+        QObject::connect(watcher, &QFutureWatcher<bool>::finished, this, [=]() {
+            if (watcher->result()) {
+                emit statisticsChanged();
+            }
+            watcher->deleteLater();
+            if (mCount > 0 && !mFlushTimer.isActive()) {
+                mFlushTimer.start();
+            }
+        });
+        mFlushFuture = threadpools::run(threadpools::JobClass::Bulk, [events]() {
+            return write(LibraryUtils::threadDatabase(), events);
+        });
+        watcher->setFuture(mFlushFuture);
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_PLAYSTATISTICS_H
+#define UNPLAYER_PLAYSTATISTICS_H
+
+#include <vector>
+
+#include <QFuture>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+class QSqlDatabase;
+
+namespace unplayer
+{
+    // Play counts, skip counts and last played times of library tracks.
+    // Events are kept in memory and written to database in one transaction
+    // on Bulk thread pool every minute, so that playback doesn't wait for SQLite
+    class PlayStatistics final : public QObject
+    {
+        Q_OBJECT
+    public:
+        static PlayStatistics* instance();
+
+        void recordPlayed(const QString& filePath);
+        void recordSkipped(const QString& filePath);
+
+    private:
+        struct Event
+        {
+            QString filePath;
+            // Milliseconds since epoch
+            long long time;
+            bool skipped;
+        };
+
+        explicit PlayStatistics(QObject* parent);
+
+        static bool write(QSqlDatabase db, const std::vector<Event>& events);
+
+        void record(const QString& filePath, bool skipped);
+        std::vector<Event> takeEvents();
+        void flush();
+
+        // Ring buffer, when it is full while previous events are being written
+        // the oldest event is dropped
+        std::vector<Event> mEvents;
+        std::size_t mFirst;
+        std::size_t mCount;
+
+        QTimer mFlushTimer;
+        QFuture<bool> mFlushFuture;
+
+    signals:
+        // Emitted when recorded events have been written to database
+        void statisticsChanged();
+    };
+}
+
+#endif // UNPLAYER_PLAYSTATISTICS_H
@@ -20,33 +20,59 @@
 
 #include <algorithm>
 #include <functional>
+#include <memory>
+#include <numeric>
+#include <random>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include <QAtomicInt>
+#include <QBuffer>
+#include <QCollator>
 #include <QCoreApplication>
+#include <QDataStream>
 #include <QDateTime>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
 #include <QFileInfo>
+#include <QFutureInterface>
 #include <QFutureWatcher>
+#include <QImageReader>
 #include <QMimeDatabase>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSaveFile>
 #include <QSqlError>
-#include <QSqlQuery>
 #include <QSqlDatabase>
+#include <QStandardPaths>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
 #include <QUrl>
-#include <QUuid>
 #include <QtConcurrentRun>
 
+#include "artimageprovider.h"
+#include "batchesrunnable.h"
+#include "fileutils.h"
+#include "flathash.h"
+#include "jobmanager.h"
 #include "libraryutils.h"
+#include "perfcounters.h"
 #include "playlistutils.h"
 #include "settings.h"
+#include "sqlquery.h"
 #include "stdutils.h"
 #include "tagutils.h"
+#include "threadpools.h"
+#include "tracing.h"
+#include "utils.h"
 
 namespace unplayer
 {
     namespace
     {
-        const QString dbConnectionName(QLatin1String("unplayer_queue"));
-
         void seedPRNG()
         {
             static bool didSeedPRNG = false;
@@ -56,12 +82,12 @@ namespace unplayer
             }
         }
 
+        // Ids are only needed to be unique while application is running,
+        // they are also used as MPRIS track object paths
         QString createTrackId()
         {
-            QString id(QLatin1String("/"));
-            id += QUuid::createUuid().toString().remove(0, 1).remove(QLatin1Char('-'));
-            id.chop(1);
-            return id;
+            static QAtomicInt counter;
+            return QLatin1Char('/') + QString::number(counter.fetchAndAddRelaxed(1));
         }
 
         long long toMsecsSinceEpoch(const QDateTime& date)
@@ -71,6 +97,768 @@ namespace unplayer
             }
             return -1;
         }
+
+        std::shared_ptr<QueueTrack> makeTrack(const QString& filePath,
+                                              QString&& title,
+                                              int duration,
+                                              QString&& artist,
+                                              QString&& album,
+                                              QString&& mediaArtFilePath,
+                                              QByteArray&& mediaArtData,
+                                              long long modificationTime)
+        {
+            // Display strings are empty if track doesn't have artists or albums
+            if (artist.isEmpty()) {
+                artist = qApp->translate("unplayer", "Unknown artist");
+            }
+            if (album.isEmpty()) {
+                album = qApp->translate("unplayer", "Unknown album");
+            }
+
+            return std::make_shared<QueueTrack>(createTrackId(),
+                                                filePath,
+                                                std::move(title),
+                                                duration,
+                                                std::move(artist),
+                                                std::move(album),
+                                                std::move(mediaArtFilePath),
+                                                std::move(mediaArtData),
+                                                modificationTime);
+        }
+
+        // Takes strings from libraryTrack
+        std::shared_ptr<QueueTrack> makeLibraryTrack(LibraryTrack& libraryTrack)
+        {
+            return std::make_shared<QueueTrack>(createTrackId(),
+                                                libraryTrack.filePath,
+                                                std::move(libraryTrack.title),
+                                                libraryTrack.duration,
+                                                std::move(libraryTrack.artist),
+                                                std::move(libraryTrack.album),
+                                                std::move(libraryTrack.mediaArtPath),
+                                                QByteArray(),
+                                                -1);
+        }
+
+        std::vector<qint64> queryTracksIds(const QSqlDatabase& db, const QString& artist, const QString& genre)
+        {
+            QString queryString;
+            if (artist.isEmpty() && genre.isEmpty()) {
+                queryString = QLatin1String("SELECT id FROM tracks");
+            } else {
+                QStringList selects;
+                if (!artist.isEmpty()) {
+                    selects.push_back(QLatin1String("SELECT trackId FROM tracks_artists "
+                                                    "JOIN artists ON artists.id = tracks_artists.artistId "
+                                                    "WHERE artists.title = ?"));
+                }
+                if (!genre.isEmpty()) {
+                    selects.push_back(QLatin1String("SELECT trackId FROM tracks_genres "
+                                                    "JOIN genres ON genres.id = tracks_genres.genreId "
+                                                    "WHERE genres.title = ?"));
+                }
+                queryString = selects.join(QLatin1String(" INTERSECT "));
+            }
+
+            std::vector<qint64> ids;
+            SqlQuery query(db);
+            query.prepare(queryString);
+            if (!artist.isEmpty()) {
+                query.addBindValue(artist);
+            }
+            if (!genre.isEmpty()) {
+                query.addBindValue(genre);
+            }
+            LibraryUtils::explainQuery(query, db);
+            if (!query.exec()) {
+                qWarning() << "failed to query tracks ids" << query.lastError();
+                return ids;
+            }
+            while (query.next()) {
+                ids.push_back(query.value(0).toLongLong());
+            }
+            return ids;
+        }
+
+        // Tracks are returned in order of ids
+        std::vector<std::shared_ptr<QueueTrack>> queryTracksByIds(const QSqlDatabase& db, const qint64* ids, std::size_t count)
+        {
+            QStringList idStrings;
+            idStrings.reserve(count);
+            for (std::size_t i = 0; i < count; ++i) {
+                idStrings.push_back(QString::number(ids[i]));
+            }
+
+            SqlQuery query(db);
+            // One row per track
+            query.prepare(QString::fromLatin1("SELECT id, filePath, title, duration, "
+                                              "COALESCE((SELECT albumMediaArt.mediaArt FROM tracks_albums "
+                                              "          JOIN tracks_artists ON tracks_artists.trackId = tracks_albums.trackId "
+                                              "          JOIN albumMediaArt ON albumMediaArt.albumId = tracks_albums.albumId AND albumMediaArt.artistId = tracks_artists.artistId "
+                                              "          WHERE tracks_albums.trackId = tracks.id LIMIT 1), mediaArt), "
+                                              "displayArtist, displayAlbum FROM tracks "
+                                              "WHERE id IN (%1)").arg(idStrings.join(QLatin1Char(','))));
+            if (!query.exec()) {
+                qWarning() << "failed to query tracks" << query.lastError();
+                return {};
+            }
+
+            struct Metadata
+            {
+                QString filePath;
+                QString title;
+                int duration;
+                QString mediaArt;
+                QString artist;
+                QString album;
+            };
+            std::unordered_map<qint64, Metadata> metadata;
+            metadata.reserve(count);
+            while (query.next()) {
+                metadata.insert({query.value(0).toLongLong(), Metadata{query.value(1).toString(),
+                                                                       query.value(2).toString(),
+                                                                       query.value(3).toInt(),
+                                                                       query.value(4).toString(),
+                                                                       query.value(5).toString(),
+                                                                       query.value(6).toString()}});
+            }
+
+            std::vector<std::shared_ptr<QueueTrack>> tracks;
+            tracks.reserve(count);
+            const auto end(metadata.end());
+            for (std::size_t i = 0; i < count; ++i) {
+                const auto found(metadata.find(ids[i]));
+                if (found == end) {
+                    // Removed from library
+                    continue;
+                }
+                Metadata& track = found->second;
+                tracks.push_back(makeTrack(track.filePath,
+                                           std::move(track.title),
+                                           track.duration,
+                                           std::move(track.artist),
+                                           std::move(track.album),
+                                           std::move(track.mediaArt),
+                                           QByteArray(),
+                                           -1));
+            }
+            return tracks;
+        }
+
+        // Reads tags of local file which is not in the library
+        std::shared_ptr<QueueTrack> readTrack(const QString& filePath, const QFileInfo& fileInfo, bool preferDirectoryMediaArt)
+        {
+            const QMimeDatabase mimeDb;
+            QString mediaArtFilePath;
+            if (preferDirectoryMediaArt) {
+                mediaArtFilePath = LibraryUtils::findMediaArtForDirectory(fileInfo.path());
+            }
+            // Embedded media art is not needed if directory has it
+            tagutils::Info info(tagutils::getTrackInfo(fileInfo,
+                                                       audioTypeForFile(fileInfo, mimeDb),
+                                                       mediaArtFilePath.isEmpty() ? tagutils::ReadProfile::Fast
+                                                                                  : tagutils::ReadProfile::FastWithoutMediaArt));
+            QByteArray mediaArtData;
+            if (preferDirectoryMediaArt) {
+                if (mediaArtFilePath.isEmpty()) {
+                    mediaArtData = std::move(info.mediaArtData);
+                }
+            } else {
+                if (info.mediaArtData.isEmpty()) {
+                    mediaArtFilePath = LibraryUtils::findMediaArtForDirectory(fileInfo.path());
+                } else {
+                    mediaArtData = std::move(info.mediaArtData);
+                }
+            }
+            return makeTrack(filePath,
+                             std::move(info.title),
+                             info.duration,
+                             LibraryUtils::displayString(info.artists),
+                             LibraryUtils::displayString(info.albums),
+                             std::move(mediaArtFilePath),
+                             std::move(mediaArtData),
+                             toMsecsSinceEpoch(fileInfo.lastModified()));
+        }
+
+        // Compares without creating QUrl for local track
+        bool hasUrl(const QueueTrack& track, const QUrl& url)
+        {
+            if (url.isLocalFile()) {
+                return track.filePath == url.path();
+            }
+            return !track.isLocalFile() && track.remoteUrl == url;
+        }
+
+        // Track that is set as current may be given by URL of directory that contains it
+        bool isSetAsCurrent(const QueueTrack& track, const QUrl& url)
+        {
+            if (hasUrl(track, url)) {
+                return true;
+            }
+            if (!url.isLocalFile() || !track.isLocalFile()) {
+                return false;
+            }
+            QString directory(url.path());
+            if (!directory.endsWith(QLatin1Char('/'))) {
+                directory += QLatin1Char('/');
+            }
+            return track.filePath.startsWith(directory);
+        }
+
+        // Lists directory tree that is added to queue, with the same suffix filtering as
+        // library scan. Subdirectories are listed in parallel ahead of consumer, files
+        // are reported depth-first in natural order of paths, like file manager shows them
+        class DirectoryTreeWalker final
+        {
+        public:
+            DirectoryTreeWalker()
+            {
+                for (const QString& suffix : LibraryUtils::mimeTypesExtensions) {
+                    mSuffixes.insert(QFile::encodeName(suffix));
+                }
+                mCollator.setNumericMode(true);
+                mCollator.setCaseSensitivity(Qt::CaseInsensitive);
+                mWorkers.setMaxThreadCount(std::max(QThread::idealThreadCount(), 2));
+            }
+
+            ~DirectoryTreeWalker()
+            {
+                mWorkers.clear();
+                mWorkers.waitForDone();
+            }
+
+            DirectoryTreeWalker(const DirectoryTreeWalker&) = delete;
+            DirectoryTreeWalker& operator=(const DirectoryTreeWalker&) = delete;
+
+            void walk(const QString& directory, const std::function<void(const QString& filePath)>& function)
+            {
+                walk(list(QDir::cleanPath(directory)), function);
+            }
+
+        private:
+            struct Listing
+            {
+                // Empty if directory doesn't exist
+                QString canonicalPath;
+                QStringList files;
+                QStringList subdirectories;
+            };
+
+            QFuture<Listing> list(const QString& directory)
+            {
+                const FlatHashSet<QByteArray>& suffixes = mSuffixes;
+                return QtConcurrent::run(&mWorkers, [directory, &suffixes]() {
+                    threadpools::setCurrentThreadClass(threadpools::JobClass::Bulk);
+                    Listing listing;
+                    listing.canonicalPath = QFileInfo(directory).canonicalFilePath();
+                    if (listing.canonicalPath.isEmpty()) {
+                        return listing;
+                    }
+                    for (fileutils::FileEntry& entry : fileutils::listFiles(directory, suffixes)) {
+                        listing.files.push_back(std::move(entry.filePath));
+                    }
+                    for (const QString& name : QDir(directory).entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+                        listing.subdirectories.push_back(directory + QLatin1Char('/') + name);
+                    }
+                    return listing;
+                });
+            }
+
+            void walk(QFuture<Listing> future, const std::function<void(const QString&)>& function)
+            {
+                Listing listing(future.result());
+                // Symlink loops
+                if (listing.canonicalPath.isEmpty() || !mVisited.insert(listing.canonicalPath).second) {
+                    return;
+                }
+
+                // Only siblings of directories on current path are listed ahead
+                std::sort(listing.subdirectories.begin(), listing.subdirectories.end(), mCollator);
+                std::vector<QFuture<Listing>> subdirectories;
+                subdirectories.reserve(listing.subdirectories.size());
+                for (const QString& subdirectory : listing.subdirectories) {
+                    subdirectories.push_back(list(subdirectory));
+                }
+
+                std::sort(listing.files.begin(), listing.files.end(), mCollator);
+                for (const QString& filePath : listing.files) {
+                    function(filePath);
+                }
+
+                for (const QFuture<Listing>& subdirectory : subdirectories) {
+                    walk(subdirectory, function);
+                }
+            }
+
+            FlatHashSet<QByteArray> mSuffixes;
+            QCollator mCollator;
+            QThreadPool mWorkers;
+            std::unordered_set<QString> mVisited;
+        };
+
+        QByteArray readEmbeddedMediaArt(const QFileInfo& fileInfo)
+        {
+            const QMimeDatabase mimeDb;
+            return tagutils::getTrackInfo(fileInfo, audioTypeForFile(fileInfo, mimeDb), tagutils::ReadProfile::MediaArtOnly).mediaArtData;
+        }
+
+        const int externalTracksCacheSize = 2000;
+
+        // Fills tracks at indexes, which are local files that are not in the library.
+        // Tags are taken from externalTracks table if file was not modified,
+        // other files are read in parallel and saved there
+        void readExternalTracks(std::vector<std::shared_ptr<QueueTrack>>& tracks,
+                                const std::vector<std::size_t>& indexes,
+                                bool preferDirectoryMediaArt)
+        {
+            if (indexes.empty()) {
+                return;
+            }
+
+            auto db = LibraryUtils::threadDatabase();
+
+            std::vector<std::size_t> tracksToRead;
+            std::vector<std::size_t> mediaArtToRead;
+            {
+                SqlQuery query(db);
+                query.prepareCached(QStringLiteral("SELECT modificationTime, title, duration, artist, album, mediaArt, hasEmbeddedMediaArt "
+                                                   "FROM externalTracks WHERE filePath = ?"));
+                for (std::size_t index : indexes) {
+                    QueueTrack& track = *tracks[index];
+                    const QFileInfo fileInfo(track.filePath);
+                    const long long modificationTime = toMsecsSinceEpoch(fileInfo.lastModified());
+                    query.bindValue(0, fileInfo.filePath());
+                    if (modificationTime == -1 || !query.exec() || !query.next() || query.value(0).toLongLong() != modificationTime) {
+                        tracksToRead.push_back(index);
+                        continue;
+                    }
+
+                    const QString mediaArtFilePath(query.value(5).toString());
+                    if (!mediaArtFilePath.isEmpty() && !QFileInfo::exists(mediaArtFilePath)) {
+                        tracksToRead.push_back(index);
+                        continue;
+                    }
+
+                    track.modificationTime = modificationTime;
+                    track.title = query.value(1).toString();
+                    track.duration = query.value(2).toInt();
+                    track.artist = query.value(3).toString();
+                    track.album = query.value(4).toString();
+                    track.mediaArtFilePath = mediaArtFilePath;
+                    if (query.value(6).toBool()) {
+                        // Embedded media art is not stored, only pictures are parsed
+                        mediaArtToRead.push_back(index);
+                    }
+                }
+            }
+
+            {
+                QThreadPool workers;
+                workers.setMaxThreadCount(Settings::instance()->libraryUpdateThreadsCount());
+
+                std::vector<QFuture<std::shared_ptr<QueueTrack>>> readTracks;
+                readTracks.reserve(tracksToRead.size());
+                for (std::size_t index : tracksToRead) {
+                    const QString& filePath = tracks[index]->filePath;
+                    readTracks.push_back(QtConcurrent::run(&workers, std::bind(readTrack, filePath, QFileInfo(filePath), preferDirectoryMediaArt)));
+                }
+
+                std::vector<QFuture<QByteArray>> readMediaArt;
+                readMediaArt.reserve(mediaArtToRead.size());
+                for (std::size_t index : mediaArtToRead) {
+                    readMediaArt.push_back(QtConcurrent::run(&workers, std::bind(readEmbeddedMediaArt, QFileInfo(tracks[index]->filePath))));
+                }
+
+                // Results are put in place of their tracks, so that order is preserved
+                for (std::size_t i = 0, max = tracksToRead.size(); i < max; ++i) {
+                    tracks[tracksToRead[i]] = readTracks[i].result();
+                }
+                for (std::size_t i = 0, max = mediaArtToRead.size(); i < max; ++i) {
+                    tracks[mediaArtToRead[i]]->mediaArtData = readMediaArt[i].result();
+                }
+            }
+
+            if (tracksToRead.empty()) {
+                return;
+            }
+
+            db.transaction();
+            SqlQuery query(db);
+            query.prepare(QStringLiteral("INSERT OR REPLACE INTO externalTracks "
+                                         "(filePath, modificationTime, title, duration, artist, album, mediaArt, hasEmbeddedMediaArt) "
+                                         "VALUES (?, ?, ?, ?, ?, ?, ?, ?)"));
+            for (std::size_t index : tracksToRead) {
+                const QueueTrack& track = *tracks[index];
+                if (track.modificationTime == -1) {
+                    continue;
+                }
+                query.bindValue(0, track.filePath);
+                query.bindValue(1, track.modificationTime);
+                query.bindValue(2, track.title.isNull() ? QLatin1String("") : track.title);
+                query.bindValue(3, track.duration);
+                query.bindValue(4, track.artist.isNull() ? QLatin1String("") : track.artist);
+                query.bindValue(5, track.album.isNull() ? QLatin1String("") : track.album);
+                query.bindValue(6, track.mediaArtFilePath.isNull() ? QLatin1String("") : track.mediaArtFilePath);
+                query.bindValue(7, track.hasEmbeddedMediaArt());
+                if (!query.exec()) {
+                    qWarning() << "failed to save tags of file" << track.filePath << query.lastError();
+                }
+            }
+            if (!query.exec(QString::fromLatin1("DELETE FROM externalTracks WHERE rowid <= (SELECT MAX(rowid) FROM externalTracks) - %1")
+                            .arg(externalTracksCacheSize))) {
+                qWarning() << "failed to remove old tags of files" << query.lastError();
+            }
+            db.commit();
+        }
+
+        const quint32 snapshotMagic = 0x554e5051; // "UNPQ"
+        // Version 2 adds journal id
+        const quint32 snapshotVersion = 2;
+
+        const quint32 journalMagic = 0x554e514a; // "UNQJ"
+        const quint32 journalVersion = 1;
+        // Journal is compacted into snapshot when it has this many records
+        const int journalMaxRecords = 1000;
+
+        QString snapshotFilePath()
+        {
+            return QString::fromLatin1("%1/queue").arg(QStandardPaths::writableLocation(QStandardPaths::DataLocation));
+        }
+
+        QString journalFilePath()
+        {
+            return QString::fromLatin1("%1/queue-journal").arg(QStandardPaths::writableLocation(QStandardPaths::DataLocation));
+        }
+
+        void writeSnapshotTrack(QDataStream& stream, const QueueTrack& track)
+        {
+            stream << track.urlString()
+                   << track.title
+                   << track.artist
+                   << track.album
+                   << track.mediaArtFilePath
+                   << static_cast<qint32>(track.duration)
+                   << static_cast<qint64>(track.modificationTime)
+                   << track.hasEmbeddedMediaArt();
+        }
+
+        struct SnapshotTrack
+        {
+            std::shared_ptr<QueueTrack> track;
+            bool hasEmbeddedMediaArt;
+        };
+
+        bool readSnapshotTrack(QDataStream& stream, SnapshotTrack& snapshotTrack)
+        {
+            QString url;
+            QString title;
+            QString artist;
+            QString album;
+            QString mediaArtFilePath;
+            qint32 duration;
+            qint64 modificationTime;
+            stream >> url >> title >> artist >> album >> mediaArtFilePath >> duration >> modificationTime >> snapshotTrack.hasEmbeddedMediaArt;
+            if (stream.status() != QDataStream::Ok) {
+                return false;
+            }
+            snapshotTrack.track = std::make_shared<QueueTrack>(createTrackId(),
+                                                               QUrl(url),
+                                                               title,
+                                                               duration,
+                                                               artist,
+                                                               album,
+                                                               mediaArtFilePath,
+                                                               QByteArray(),
+                                                               modificationTime);
+            return true;
+        }
+
+        // Copied from QueueTrack, since tracks can be changed while they are checked
+        struct RestoredTrack
+        {
+            QString trackId;
+            QString filePath;
+            long long modificationTime;
+            QString mediaArtFilePath;
+            bool hasEmbeddedMediaArt;
+        };
+
+        // First batch is small so that playback can start quickly
+        const std::size_t firstTracksBatchSize = 50;
+        const std::size_t tracksBatchSize = 1000;
+
+        using TracksBatch = std::vector<std::shared_ptr<QueueTrack>>;
+        using TracksFutureInterface = QFutureInterface<TracksBatch>;
+        using TracksFutureWatcher = QFutureWatcher<TracksBatch>;
+        using TracksRunnable = BatchesRunnable<TracksBatch>;
+
+        const int imageCacheMaxSize = 16 * 1024 * 1024;
+
+        class QueueImageResponse final : public QQuickImageResponse, public QRunnable
+        {
+        public:
+            explicit QueueImageResponse(QueueImageProvider* provider, const QString& id, const QSize& requestedSize)
+                : mProvider(provider),
+                  mId(id),
+                  mRequestedSize(requestedSize)
+            {
+                // Deleted by QML engine
+                setAutoDelete(false);
+            }
+
+            QQuickTextureFactory* textureFactory() const override
+            {
+                return QQuickTextureFactory::textureFactoryForImage(mImage);
+            }
+
+            void run() override
+            {
+                mImage = mProvider->image(mId, mRequestedSize);
+                emit finished();
+            }
+
+        private:
+            QueueImageProvider* mProvider;
+            QString mId;
+            QSize mRequestedSize;
+            QImage mImage;
+        };
+
+        class QueueImagePrefetchRunnable final : public QRunnable
+        {
+        public:
+            explicit QueueImagePrefetchRunnable(QueueImageProvider* provider, const QString& id, const QSize& requestedSize)
+                : mProvider(provider),
+                  mId(id),
+                  mRequestedSize(requestedSize)
+            {
+
+            }
+
+            void run() override
+            {
+                mProvider->image(mId, mRequestedSize);
+            }
+
+        private:
+            QueueImageProvider* mProvider;
+            QString mId;
+            QSize mRequestedSize;
+        };
+
+        QueueImageProvider* queueImageProviderInstance = nullptr;
+    }
+
+    enum class QueueJournalRecord : quint8
+    {
+        TracksAdded,
+        TracksRemoved,
+        Cleared,
+        CurrentIndex,
+        TrackChanged,
+        PlayerPosition,
+        TracksInserted,
+        TracksMoved
+    };
+
+    namespace
+    {
+        bool isValidMove(int first, int last, int destination, int count)
+        {
+            return first >= 0 && first <= last && last < count &&
+                   destination >= 0 && destination <= count &&
+                   (destination < first || destination > last + 1);
+        }
+
+        template<typename T>
+        void moveRange(std::vector<T>& vector, int first, int last, int destination)
+        {
+            if (destination < first) {
+                std::rotate(vector.begin() + destination, vector.begin() + first, vector.begin() + last + 1);
+            } else {
+                std::rotate(vector.begin() + first, vector.begin() + last + 1, vector.begin() + destination);
+            }
+        }
+
+        // New index of track after moveRange()
+        int movedIndex(int index, int first, int last, int destination)
+        {
+            const int count = last - first + 1;
+            if (destination < first) {
+                if (index >= first && index <= last) {
+                    return index - (first - destination);
+                }
+                if (index >= destination && index < first) {
+                    return index + count;
+                }
+            } else {
+                if (index >= first && index <= last) {
+                    return index + (destination - last - 1);
+                }
+                if (index > last && index < destination) {
+                    return index - count;
+                }
+            }
+            return index;
+        }
+
+        // Applies changes from journal to tracks restored from snapshot.
+        // Incomplete record at the end is ignored. Returns number of applied records
+        int replayJournal(quint32 journalId,
+                          std::vector<SnapshotTrack>& tracks,
+                          int& currentIndex,
+                          bool& tracksChanged,
+                          long long& playerPosition)
+        {
+            QFile file(journalFilePath());
+            if (!file.open(QIODevice::ReadOnly)) {
+                return -1;
+            }
+
+            QDataStream stream(&file);
+            stream.setVersion(QDataStream::Qt_5_6);
+
+            quint32 magic;
+            quint32 version;
+            quint32 id;
+            stream >> magic >> version >> id;
+            if (stream.status() != QDataStream::Ok || magic != journalMagic || version != journalVersion || id != journalId) {
+                qWarning() << "queue journal does not match snapshot";
+                return -1;
+            }
+
+            int records = 0;
+            while (!stream.atEnd()) {
+                quint8 type;
+                stream >> type;
+                switch (static_cast<QueueJournalRecord>(type)) {
+                case QueueJournalRecord::TracksAdded:
+                {
+                    qint32 count;
+                    stream >> count;
+                    std::vector<SnapshotTrack> added;
+                    for (qint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+                        SnapshotTrack track;
+                        if (readSnapshotTrack(stream, track)) {
+                            added.push_back(std::move(track));
+                        }
+                    }
+                    if (stream.status() == QDataStream::Ok) {
+                        tracks.insert(tracks.end(), std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+                        tracksChanged = true;
+                    }
+                    break;
+                }
+                case QueueJournalRecord::TracksRemoved:
+                {
+                    qint32 first;
+                    qint32 last;
+                    stream >> first >> last;
+                    if (stream.status() == QDataStream::Ok && first >= 0 && first <= last && last < static_cast<qint32>(tracks.size())) {
+                        tracks.erase(tracks.begin() + first, tracks.begin() + last + 1);
+                        tracksChanged = true;
+                    }
+                    break;
+                }
+                case QueueJournalRecord::Cleared:
+                    tracks.clear();
+                    tracksChanged = true;
+                    break;
+                case QueueJournalRecord::CurrentIndex:
+                {
+                    qint32 index;
+                    stream >> index;
+                    if (stream.status() == QDataStream::Ok) {
+                        currentIndex = index;
+                    }
+                    break;
+                }
+                case QueueJournalRecord::TrackChanged:
+                {
+                    qint32 index;
+                    stream >> index;
+                    SnapshotTrack track;
+                    if (readSnapshotTrack(stream, track) && index >= 0 && index < static_cast<qint32>(tracks.size())) {
+                        tracks[index] = std::move(track);
+                    }
+                    break;
+                }
+                case QueueJournalRecord::PlayerPosition:
+                {
+                    qint64 position;
+                    stream >> position;
+                    if (stream.status() == QDataStream::Ok) {
+                        playerPosition = position;
+                    }
+                    break;
+                }
+                case QueueJournalRecord::TracksInserted:
+                {
+                    qint32 first;
+                    qint32 count;
+                    stream >> first >> count;
+                    std::vector<SnapshotTrack> inserted;
+                    for (qint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+                        SnapshotTrack track;
+                        if (readSnapshotTrack(stream, track)) {
+                            inserted.push_back(std::move(track));
+                        }
+                    }
+                    if (stream.status() == QDataStream::Ok && first >= 0 && first <= static_cast<qint32>(tracks.size())) {
+                        tracks.insert(tracks.begin() + first, std::make_move_iterator(inserted.begin()), std::make_move_iterator(inserted.end()));
+                        tracksChanged = true;
+                    }
+                    break;
+                }
+                case QueueJournalRecord::TracksMoved:
+                {
+                    qint32 first;
+                    qint32 last;
+                    qint32 destination;
+                    stream >> first >> last >> destination;
+                    if (stream.status() == QDataStream::Ok && isValidMove(first, last, destination, tracks.size())) {
+                        moveRange(tracks, first, last, destination);
+                        tracksChanged = true;
+                    }
+                    break;
+                }
+                default:
+                    qWarning() << "unknown queue journal record" << type;
+                    stream.setStatus(QDataStream::ReadCorruptData);
+                }
+
+                if (stream.status() != QDataStream::Ok) {
+                    qWarning() << "queue journal is truncated";
+                    break;
+                }
+                ++records;
+            }
+
+            return records;
+        }
+    }
+
+    QueueTrack::QueueTrack(const QString& trackId,
+                           const QString& filePath,
+                           const QString& title,
+                           int duration,
+                           const QString& artist,
+                           const QString& album,
+                           const QString& mediaArtFilePath,
+                           const QByteArray& mediaArtData,
+                           long long modificationTime)
+        : trackId(trackId),
+          filePath(filePath),
+          title(title),
+          duration(duration),
+          artist(artist),
+          album(album),
+          mediaArtFilePath(mediaArtFilePath),
+          mediaArtData(mediaArtData),
+          mediaArtUnloaded(false),
+          modificationTime(modificationTime)
+    {
+
     }
 
     QueueTrack::QueueTrack(const QString& trackId,
@@ -83,845 +871,1954 @@ namespace unplayer
                            const QByteArray& mediaArtData,
                            long long modificationTime)
         : trackId(trackId),
-          url(url),
+          filePath(url.isLocalFile() ? url.path() : QString()),
+          remoteUrl(url.isLocalFile() ? QUrl() : url),
           title(title),
           duration(duration),
           artist(artist),
           album(album),
           mediaArtFilePath(mediaArtFilePath),
+          mediaArtData(mediaArtData),
+          mediaArtUnloaded(false),
           modificationTime(modificationTime)
     {
-        mediaArtPixmap.loadFromData(mediaArtData);
+
     }
 
-    Queue::Queue(QObject* parent)
-        : QObject(parent),
-          mCurrentIndex(-1),
-          mShuffle(false),
-          mRepeatMode(NoRepeat),
-          mAddingTracks(false)
+    bool QueueTrack::hasEmbeddedMediaArt() const
+    {
+        return !mediaArtData.isEmpty() || mediaArtUnloaded;
+    }
+
+    QUrl QueueTrack::url() const
+    {
+        if (isLocalFile()) {
+            return QUrl::fromLocalFile(filePath);
+        }
+        return remoteUrl;
+    }
+
+    QString QueueTrack::urlString() const
+    {
+        if (isLocalFile()) {
+            return QUrl::fromLocalFile(filePath).toString();
+        }
+        return remoteUrl.toString();
+    }
+
+    Queue::Queue(QObject* parent)
+        : QObject(parent),
+          mTotalDuration(0),
+          mLocalTracksCount(0),
+          mPlayOrderDurations(1, 0),
+          mPlayOrderDurationsValid(true),
+          mCurrentIndex(-1),
+          mShuffle(false),
+          mRepeatMode(NoRepeat),
+          mAddingTracks(false),
+          mAddingTracksJob(0),
+          mUpdatingMediaArt(false),
+          mMediaArtUpdateQueued(false),
+          mJournalId(0),
+          mJournalRecords(0),
+          mRestoredPlayerPosition(-1)
     {
         seedPRNG();
-        QObject::connect(LibraryUtils::instance(), &LibraryUtils::mediaArtChanged, this, [=]() {
-            QSqlDatabase::database().transaction();
-            for (const std::shared_ptr<QueueTrack>& track : mTracks) {
-                if (track->url.isLocalFile()) {
-                    const QString filePath(track->url.path());
-                    QSqlQuery query;
-                    query.prepare(QStringLiteral("SELECT mediaArt FROM tracks WHERE filePath = ?"));
-                    query.addBindValue(filePath);
-                    if (query.exec()) {
-                        if (query.next()) {
-                            track->mediaArtFilePath = query.value(0).toString();
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::mediaArtChanged, this, [this]() {
+            updateMediaArt();
+        });
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::albumMediaArtChanged, this, [this](const QString&, const QString& album) {
+            updateMediaArt(album);
+        });
+        QObject::connect(this, &Queue::currentTrackChanged, this, &Queue::mediaArtChanged);
+        QObject::connect(this, &Queue::currentIndexChanged, this, &Queue::statisticsChanged);
+    }
+
+    const std::vector<std::shared_ptr<QueueTrack>>& Queue::tracks() const
+    {
+        return mTracks;
+    }
+
+    int Queue::currentIndex() const
+    {
+        return mCurrentIndex;
+    }
+
+    void Queue::setCurrentIndex(int index)
+    {
+        if (index != mCurrentIndex) {
+            mCurrentIndex = index;
+            writeJournalRecord(QueueJournalRecord::CurrentIndex, [=](QDataStream& stream) {
+                stream << static_cast<qint32>(index);
+            });
+            emit currentIndexChanged();
+        }
+    }
+
+    QUrl Queue::currentUrl() const
+    {
+        if (mCurrentIndex >= 0) {
+            return mTracks[mCurrentIndex]->url();
+        }
+        return QUrl();
+    }
+
+    bool Queue::isCurrentLocalFile() const
+    {
+        if (mCurrentIndex >= 0) {
+            return mTracks[mCurrentIndex]->isLocalFile();
+        }
+        return false;
+    }
+
+    QString Queue::currentFilePath() const
+    {
+        if (mCurrentIndex >= 0) {
+            return mTracks[mCurrentIndex]->filePath;
+        }
+        return QString();
+    }
+
+    QString Queue::currentTitle() const
+    {
+        if (mCurrentIndex >= 0) {
+            return mTracks[mCurrentIndex]->title;
+        }
+        return QString();
+    }
+
+    QString Queue::currentArtist() const
+    {
+        if (mCurrentIndex >= 0) {
+            return mTracks[mCurrentIndex]->artist;
+        }
+        return QString();
+    }
+
+    QString Queue::currentAlbum() const
+    {
+        if (mCurrentIndex >= 0) {
+            return mTracks[mCurrentIndex]->album;
+        }
+        return QString();
+    }
+
+    QString Queue::currentMediaArt() const
+    {
+        if (mCurrentIndex >= 0) {
+            return mediaArtUrl(mTracks[mCurrentIndex].get());
+        }
+        return QString();
+    }
+
+    void Queue::prefetchMediaArt(const QSize& size) const
+    {
+        ArtImageProvider* artProvider = ArtImageProvider::instance();
+        QueueImageProvider* queueProvider = QueueImageProvider::instance();
+        const QString queuePrefix(QString::fromLatin1("image://%1/").arg(QueueImageProvider::providerId));
+        for (int index : neighbourIndexes()) {
+            const QString url(mediaArtUrl(mTracks[index].get()));
+            if (url.startsWith(queuePrefix)) {
+                if (queueProvider) {
+                    queueProvider->prefetch(url.mid(queuePrefix.size()), size);
+                }
+            } else if (!url.isEmpty() && artProvider) {
+                artProvider->prefetch({url}, size);
+            }
+        }
+    }
+
+    std::vector<int> Queue::neighbourIndexes() const
+    {
+        std::vector<int> indexes;
+        if (mCurrentIndex == -1) {
+            return indexes;
+        }
+
+        const int count = static_cast<int>(mTracks.size());
+        if (mShuffle) {
+            // Shuffle order is reset after the last track, next one is not known yet
+            const int position = mShufflePositions[mCurrentIndex];
+            if (position + 1 < count) {
+                indexes.push_back(mShuffleOrder[position + 1]);
+            }
+            indexes.push_back(position == 0 ? mShuffleOrder.back() : mShuffleOrder[position - 1]);
+        } else {
+            indexes.push_back((mCurrentIndex + 1) % count);
+            indexes.push_back((mCurrentIndex + count - 1) % count);
+        }
+        indexes.erase(std::remove(indexes.begin(), indexes.end(), mCurrentIndex), indexes.end());
+        return indexes;
+    }
+
+    QString Queue::mediaArtUrl(const QueueTrack* track) const
+    {
+        if (track->isLocalFile()) {
+            if (!track->mediaArtFilePath.isEmpty()) {
+                return ArtImageProvider::url(track->mediaArtFilePath);
+            }
+            if (track->hasEmbeddedMediaArt()) {
+                // Track id starts with '/'
+                return QString::fromLatin1("image://%1%2").arg(QueueImageProvider::providerId, track->trackId);
+            }
+        }
+        return QString();
+    }
+
+    QByteArray Queue::trackMediaArt(const QString& trackId) const
+    {
+        QString unloadedFilePath;
+        {
+            const QMutexLocker locker(&mTracksMediaArtMutex);
+            const auto found(mTracksMediaArt.find(trackId));
+            if (found != mTracksMediaArt.end()) {
+                return found->second;
+            }
+            const auto unloaded(mUnloadedMediaArt.find(trackId));
+            if (unloaded == mUnloadedMediaArt.end()) {
+                return QByteArray();
+            }
+            unloadedFilePath = unloaded->second;
+        }
+        // Not kept in memory, decoded image is cached by QueueImageProvider
+        return readEmbeddedMediaArt(QFileInfo(unloadedFilePath));
+    }
+
+    qint64 Queue::memoryUsage() const
+    {
+        // Implicitly shared strings and media art are counted for every track
+        qint64 size = mTracks.capacity() * sizeof(std::shared_ptr<QueueTrack>);
+        for (const std::shared_ptr<QueueTrack>& track : mTracks) {
+            size += sizeof(QueueTrack);
+            for (const QString* string : {&track->trackId, &track->filePath, &track->title, &track->artist, &track->album, &track->mediaArtFilePath}) {
+                size += string->capacity() * sizeof(QChar);
+            }
+            size += track->remoteUrl.toString().size() * sizeof(QChar);
+            size += track->mediaArtData.capacity();
+        }
+        size += (mShuffleOrder.capacity() + mShufflePositions.capacity() + mRestoredShuffleOrder.capacity()) * sizeof(int);
+        return size;
+    }
+
+    void Queue::unloadMediaArt()
+    {
+        std::vector<int> keep(neighbourIndexes());
+        keep.push_back(mCurrentIndex);
+
+        int unloaded = 0;
+        const QMutexLocker locker(&mTracksMediaArtMutex);
+        for (int i = 0, max = mTracks.size(); i < max; ++i) {
+            QueueTrack* track = mTracks[i].get();
+            if (track->mediaArtData.isEmpty() || std::find(keep.begin(), keep.end(), i) != keep.end()) {
+                continue;
+            }
+            track->mediaArtData = QByteArray();
+            track->mediaArtUnloaded = true;
+            mTracksMediaArt.erase(track->trackId);
+            mUnloadedMediaArt.insert({track->trackId, track->filePath});
+            ++unloaded;
+        }
+        if (unloaded > 0) {
+            qDebug() << "unloaded embedded media art of" << unloaded << "tracks";
+        }
+    }
+
+    int Queue::totalDuration() const
+    {
+        return mTotalDuration;
+    }
+
+    int Queue::remainingDuration() const
+    {
+        if (mCurrentIndex == -1) {
+            return mTotalDuration;
+        }
+
+        if (!mPlayOrderDurationsValid) {
+            mPlayOrderDurations.resize(mTracks.size() + 1);
+            int sum = 0;
+            for (int position = 0, max = mTracks.size(); position < max; ++position) {
+                mPlayOrderDurations[position] = sum;
+                const int index = mShuffle ? mShuffleOrder[position] : position;
+                sum += std::max(mTracks[index]->duration, 0);
+            }
+            mPlayOrderDurations.back() = sum;
+            mPlayOrderDurationsValid = true;
+        }
+
+        const int position = mShuffle ? mShufflePositions[mCurrentIndex] : mCurrentIndex;
+        return mTotalDuration - mPlayOrderDurations[position + 1];
+    }
+
+    int Queue::localTracksCount() const
+    {
+        return mLocalTracksCount;
+    }
+
+    int Queue::remoteTracksCount() const
+    {
+        return static_cast<int>(mTracks.size()) - mLocalTracksCount;
+    }
+
+    bool Queue::isShuffle() const
+    {
+        return mShuffle;
+    }
+
+    void Queue::setShuffle(bool shuffle)
+    {
+        if (shuffle != mShuffle) {
+            mShuffle = shuffle;
+            if (mShuffle) {
+                resetShuffleOrder();
+            } else {
+                mShuffleOrder.clear();
+                mShufflePositions.clear();
+                mPlayOrderDurationsValid = false;
+            }
+            emit shuffleChanged();
+            emit statisticsChanged();
+        }
+    }
+
+    const std::vector<int>& Queue::shuffleOrder() const
+    {
+        return mShuffleOrder;
+    }
+
+    Queue::RepeatMode Queue::repeatMode() const
+    {
+        return mRepeatMode;
+    }
+
+    void Queue::changeRepeatMode()
+    {
+        switch (mRepeatMode) {
+        case NoRepeat:
+            mRepeatMode = RepeatAll;
+            break;
+        case RepeatAll:
+            mRepeatMode = RepeatOne;
+            if (mShuffle) {
+                resetShuffleOrder();
+            }
+            break;
+        case RepeatOne:
+            mRepeatMode = NoRepeat;
+        }
+        emit repeatModeChanged();
+    }
+
+    void Queue::setRepeatMode(int mode)
+    {
+        mRepeatMode = static_cast<RepeatMode>(mode);
+        emit repeatModeChanged();
+    }
+
+    bool Queue::isAddingTracks() const
+    {
+        return mAddingTracks;
+    }
+
+    void Queue::addTracksFromUrls(const QStringList& trackUrls, bool clearQueue, int setAsCurrent)
+    {
+        if (trackUrls.empty()) {
+            return;
+        }
+        addTracksJob([=](int job) {
+            startAddingTracksFromUrls(job, trackUrls, clearQueue, setAsCurrent);
+        }, clearQueue);
+    }
+
+    void Queue::startAddingTracksFromUrls(int job, const QStringList& trackUrls, bool clearQueue, int setAsCurrent)
+    {
+        startAddingTracks(job);
+
+        std::vector<std::shared_ptr<QueueTrack>> oldTracks;
+        oldTracks.reserve(mTracks.size());
+
+        if (clearQueue) {
+            emit aboutToBeCleared();
+            for (auto& track : mTracks) {
+                if (track->modificationTime > 0) {
+                    oldTracks.push_back(std::move(track));
+                }
+            }
+            clear(false);
+        } else {
+            for (const auto& track : mTracks) {
+                if (track->modificationTime > 0) {
+                    oldTracks.push_back(track);
+                }
+            }
+        }
+
+        const QUrl setAsCurrentUrl([&]() {
+            if (setAsCurrent < 0 || setAsCurrent >= trackUrls.size()) {
+                return QUrl();
+            }
+            const QString urlString(trackUrls[setAsCurrent]);
+            QUrl url(urlString);
+            if (url.isRelative()) {
+                url = QUrl::fromLocalFile(urlString);
+            }
+            return url;
+        }());
+
+        // FIXME: use capture initializers on C++14
+        auto runnable = new TracksRunnable(std::bind([](QStringList& trackUrls, std::vector<std::shared_ptr<QueueTrack>>& oldTracks, int setAsCurrent, TracksFutureInterface& futureInterface) {
+            UNPLAYER_TRACE("queue: add tracks");
+            QTime time;
+            time.start();
+
+            std::vector<QUrl> existingTracks;
+            existingTracks.reserve(trackUrls.size());
+            std::vector<QString> tracksToQuery;
+            tracksToQuery.reserve(trackUrls.size());
+
+            FlatHashMap<QUrl, std::shared_ptr<QueueTrack>> tracksMap;
+
+            // Tracks that can be reused if their files were not modified
+            FlatHashMap<QUrl, std::shared_ptr<QueueTrack>> oldTracksMap;
+            oldTracksMap.reserve(oldTracks.size());
+            for (auto& track : oldTracks) {
+                const QUrl url(track->url());
+                oldTracksMap.insert({url, std::move(track)});
+            }
+            oldTracks.clear();
+
+            struct TrackHandler
+            {
+                FlatHashMap<QUrl, std::shared_ptr<QueueTrack>>& oldTracks;
+
+                FlatHashMap<QUrl, std::shared_ptr<QueueTrack>>& tracksMap;
+
+                std::vector<QUrl>& existingTracks;
+                std::vector<QString>& tracksToQuery;
+
+                FlatHashSet<QString> playlists;
+
+                std::unique_ptr<DirectoryTreeWalker> walker;
+                // Called after each file of directory is processed
+                std::function<void()> directoryFileProcessed;
+
+                void processTrack(const QUrl& url)
+                {
+                    if (url.isLocalFile()) {
+                        // Existence of files is checked when their tags are read or
+                        // compared with library, missing files are skipped by Player
+                        const QFileInfo fileInfo(url.path());
+                        const QString suffix(fileInfo.suffix());
+                        // Only paths without audio suffixes are stat'ed
+                        if (!contains(LibraryUtils::mimeTypesExtensions, suffix) &&
+                                !contains(PlaylistUtils::playlistsExtensions, suffix) &&
+                                fileInfo.isDir()) {
+                            if (!walker) {
+                                walker.reset(new DirectoryTreeWalker());
+                            }
+                            walker->walk(fileInfo.absoluteFilePath(), [this](const QString& filePath) {
+                                processTrack(QUrl::fromLocalFile(filePath));
+                                directoryFileProcessed();
+                            });
+                        } else if (contains(PlaylistUtils::playlistsExtensions, suffix) &&
+                                !contains(playlists, fileInfo.absoluteFilePath())) {
+                            playlists.insert(fileInfo.absoluteFilePath());
+                            std::vector<PlaylistTrack> playlistTracks(PlaylistUtils::loadPlaylist(url.path()));
+                            existingTracks.reserve(existingTracks.size() + playlistTracks.size());
+                            tracksToQuery.reserve(tracksToQuery.size() + playlistTracks.size());
+                            for (const PlaylistTrack& playlistTrack : playlistTracks) {
+                                if (playlistTrack.url.isLocalFile()) {
+                                    processTrack(playlistTrack.url);
+                                } else {
+                                    existingTracks.push_back(playlistTrack.url);
+                                    tracksMap.insert({playlistTrack.url, std::make_shared<QueueTrack>(createTrackId(),
+                                                                                                      playlistTrack.url,
+                                                                                                      playlistTrack.title,
+                                                                                                      playlistTrack.duration,
+                                                                                                      playlistTrack.artist,
+                                                                                                      QString(),
+                                                                                                      QString(),
+                                                                                                      QByteArray(),
+                                                                                                      -1)});
+                                }
+                            }
+                        } else {
+                            if (!contains(tracksMap, url)) {
+                                const auto found(oldTracks.find(url));
+                                if (found != oldTracks.end() &&
+                                        found->second->modificationTime == toMsecsSinceEpoch(fileInfo.lastModified())) {
+                                    tracksMap.insert({url, std::move(found->second)});
+                                    oldTracks.erase(found);
+                                } else {
+                                    tracksToQuery.push_back(url.path());
+                                }
+                                existingTracks.push_back(std::move(url));
+                            }
+                        }
+                    } else {
+                        existingTracks.push_back(std::move(url));
+                    }
+                }
+            };
+
+            TrackHandler handler{oldTracksMap,
+                                 tracksMap,
+                                 existingTracks,
+                                 tracksToQuery};
+
+            const bool preferDirectoryMediaArt = Settings::instance()->useDirectoryMediaArt();
+
+            // Resolves tracks listed since previous batch and reports them
+            const auto reportBatch = [&]() {
+                if (existingTracks.empty()) {
+                    return;
+                }
+
+                const QSqlDatabase db(LibraryUtils::threadDatabase());
+                if (db.isOpen()) {
+                    std::unordered_map<QString, LibraryTrackMetadata> metadata(LibraryUtils::getTracksMetadata(db, tracksToQuery));
+                    for (auto& found : metadata) {
+                        LibraryTrackMetadata& track = found.second;
+                        const QFileInfo info(found.first);
+                        if (info.isFile() && info.isReadable() && track.modificationTime == toMsecsSinceEpoch(info.lastModified())) {
+                            tracksMap.insert({QUrl::fromLocalFile(found.first), makeTrack(found.first,
+                                                             std::move(track.title),
+                                                             track.duration,
+                                                             std::move(track.artist),
+                                                             std::move(track.album),
+                                                             std::move(track.mediaArt),
+                                                             QByteArray(),
+                                                             track.modificationTime)});
+                        }
+                    }
+                }
+
+                std::vector<std::shared_ptr<QueueTrack>> newTracks;
+                newTracks.reserve(existingTracks.size());
+                std::vector<std::size_t> externalTracks;
+                const auto tracksMapEnd(tracksMap.end());
+                for (QUrl& url : existingTracks) {
+                    const auto found = tracksMap.find(url);
+                    if (found == tracksMapEnd) {
+                        if (url.isLocalFile()) {
+                            // Filled by readExternalTracks()
+                            externalTracks.push_back(newTracks.size());
+                            newTracks.push_back(std::make_shared<QueueTrack>(createTrackId(),
+                                                                             url,
+                                                                             QString(),
+                                                                             -1,
+                                                                             QString(),
+                                                                             QString(),
+                                                                             QString(),
+                                                                             QByteArray(),
+                                                                             -1));
+                        } else {
+                            newTracks.push_back(std::make_shared<QueueTrack>(createTrackId(),
+                                                                             url,
+                                                                             url.toString(),
+                                                                             -1,
+                                                                             QString(),
+                                                                             QString(),
+                                                                             QString(),
+                                                                             QByteArray(),
+                                                                             -1));
                         }
                     } else {
-                        qWarning() << "failed to get media art from database for track:" << filePath;
+                        newTracks.push_back(std::make_shared<QueueTrack>(*(found->second.get())));
+                        newTracks.back()->trackId = createTrackId();
                     }
                 }
+
+                readExternalTracks(newTracks, externalTracks, preferDirectoryMediaArt);
+
+                for (const std::shared_ptr<QueueTrack>& track : newTracks) {
+                    if (track->title.isEmpty()) {
+                        if (track->isLocalFile()) {
+                            track->title = QFileInfo(track->filePath).fileName();
+                        } else {
+                            track->title = track->remoteUrl.toString();
+                        }
+                    }
+                }
+
+                futureInterface.reportResult(newTracks);
+
+                existingTracks.clear();
+                tracksToQuery.clear();
+                tracksMap.clear();
+            };
+
+            // First batch ends with track that will be set as current,
+            // so that it can be played before the rest of tracks is processed
+            std::size_t batchSize = firstTracksBatchSize;
+            int urlIndex = 0;
+            handler.directoryFileProcessed = [&]() {
+                if (urlIndex >= setAsCurrent && existingTracks.size() >= batchSize) {
+                    reportBatch();
+                    batchSize = tracksBatchSize;
+                }
+            };
+            for (int i = 0, max = trackUrls.size(); i < max; ++i) {
+                const QString& urlString = trackUrls[i];
+                const QUrl url([&urlString]() {
+                    if (urlString.startsWith(QLatin1Char('/'))) {
+                        return QUrl::fromLocalFile(urlString);
+                    }
+                    return QUrl(urlString);
+                }());
+                urlIndex = i;
+                if (i == setAsCurrent) {
+                    // If it is directory, batch ends with its first file
+                    batchSize = 1;
+                }
+                if (!url.isRelative()) {
+                    handler.processTrack(url);
+                }
+                if (i >= setAsCurrent && (i == setAsCurrent || existingTracks.size() >= batchSize)) {
+                    reportBatch();
+                    batchSize = tracksBatchSize;
+                }
+            }
+            reportBatch();
+
+            qDebug() << "processed" << trackUrls.size() << "queue tracks in" << time.elapsed() << "ms";
+        }, trackUrls, std::move(oldTracks), setAsCurrentUrl.isEmpty() ? -1 : setAsCurrent, std::placeholders::_1));
+
+        const int firstIndex = mTracks.size();
+        auto watcher = new TracksFutureWatcher(this);
+        QObject::connect(watcher, &TracksFutureWatcher::resultsReadyAt, this, [=](int beginIndex, int endIndex) {
+            for (int i = beginIndex; i < endIndex; ++i) {
+                addTracksBatch(watcher->resultAt(i), firstIndex, setAsCurrent, setAsCurrentUrl);
             }
-            QSqlDatabase::database().commit();
-            emit mediaArtChanged();
         });
-        QObject::connect(this, &Queue::currentTrackChanged, this, &Queue::mediaArtChanged);
+        QObject::connect(watcher, &TracksFutureWatcher::finished, this, [=]() {
+            finishAddingTracks();
+            watcher->deleteLater();
+        });
+        watcher->setFuture(runnable->future());
+
+        threadpools::start(threadpools::JobClass::Bulk, runnable);
     }
 
-    const std::vector<std::shared_ptr<QueueTrack>>& Queue::tracks() const
+    void Queue::addTrackFromUrl(const QString& trackUrl)
     {
-        return mTracks;
+        addTracksFromUrls({trackUrl});
+    }
+
+    void Queue::addTracksFromLibrary(const TrackList& libraryTracks, bool clearQueue, int setAsCurrent)
+    {
+        if (libraryTracks.isEmpty()) {
+            return;
+        }
+        addTracksJob([=](int job) {
+            startAddingTracksFromLibrary(job, libraryTracks, clearQueue, setAsCurrent);
+        }, clearQueue);
+    }
+
+    void Queue::startAddingTracksFromLibrary(int job, const TrackList& libraryTracks, bool clearQueue, int setAsCurrent)
+    {
+        startAddingTracks(job);
+
+        if (clearQueue) {
+            clear();
+        }
+
+        const QUrl setAsCurrentUrl([&]() {
+            if (setAsCurrent < 0 || setAsCurrent >= libraryTracks.size()) {
+                return QUrl();
+            }
+            return QUrl::fromLocalFile(libraryTracks.filePath(setAsCurrent));
+        }());
+
+        // FIXME: use capture initializers on C++14
+        auto runnable = new TracksRunnable(std::bind([](const TrackList& trackList, int setAsCurrent, TracksFutureInterface& futureInterface) {
+            std::vector<LibraryTrack> libraryTracks(trackList.tracks());
+
+            std::vector<std::shared_ptr<QueueTrack>> newTracks;
+            std::size_t batchSize = firstTracksBatchSize;
+            newTracks.reserve(batchSize);
+
+            for (int i = 0, max = libraryTracks.size(); i < max; ++i) {
+                // Files are not checked here, library was scanned recently.
+                // Missing files are removed by removeMissingTracks() or skipped by Player
+                newTracks.push_back(makeLibraryTrack(libraryTracks[i]));
+
+                // First batch ends with track that will be set as current
+                if (i >= setAsCurrent && (i == setAsCurrent || newTracks.size() >= batchSize)) {
+                    futureInterface.reportResult(newTracks);
+                    newTracks.clear();
+                    batchSize = tracksBatchSize;
+                    newTracks.reserve(batchSize);
+                }
+            }
+
+            if (!newTracks.empty()) {
+                futureInterface.reportResult(newTracks);
+            }
+        }, libraryTracks, setAsCurrentUrl.isEmpty() ? -1 : setAsCurrent, std::placeholders::_1));
+
+        const int firstIndex = mTracks.size();
+        const auto addedTracks = std::make_shared<std::vector<std::pair<QString, QString>>>();
+        addedTracks->reserve(libraryTracks.size());
+        auto watcher = new TracksFutureWatcher(this);
+        QObject::connect(watcher, &TracksFutureWatcher::resultsReadyAt, this, [=](int beginIndex, int endIndex) {
+            for (int i = beginIndex; i < endIndex; ++i) {
+                TracksBatch batch(watcher->resultAt(i));
+                for (const std::shared_ptr<QueueTrack>& track : batch) {
+                    addedTracks->push_back({track->trackId, track->filePath});
+                }
+                addTracksBatch(std::move(batch), firstIndex, setAsCurrent, setAsCurrentUrl);
+            }
+        });
+        QObject::connect(watcher, &TracksFutureWatcher::finished, this, [=]() {
+            finishAddingTracks();
+            removeMissingTracks(std::move(*addedTracks));
+            watcher->deleteLater();
+        });
+        watcher->setFuture(runnable->future());
+
+        threadpools::start(threadpools::JobClass::Bulk, runnable);
+    }
+
+    void Queue::addTrackFromLibrary(const LibraryTrack& libraryTrack, bool clearQueue, int setAsCurrent)
+    {
+        addTracksFromLibrary(TrackList(std::vector<LibraryTrack>{libraryTrack}), clearQueue, setAsCurrent);
+    }
+
+    void Queue::insertTracksFromLibrary(const TrackList& libraryTracks)
+    {
+        if (libraryTracks.isEmpty()) {
+            return;
+        }
+
+        // Indexes of tracks change while they are added in batches
+        if (mTracks.empty() || mAddingTracks) {
+            addTracksFromLibrary(libraryTracks);
+            return;
+        }
+
+        std::vector<LibraryTrack> tracks(libraryTracks.tracks());
+        const int first = mCurrentIndex + 1;
+        const int count = tracks.size();
+
+        emit tracksAboutToBeInserted(first, first + count - 1);
+
+        std::vector<std::shared_ptr<QueueTrack>> newTracks;
+        newTracks.reserve(count);
+        for (LibraryTrack& track : tracks) {
+            newTracks.push_back(makeLibraryTrack(track));
+            addToStatistics(*newTracks.back());
+        }
+        mTracks.insert(mTracks.begin() + first, std::make_move_iterator(newTracks.begin()), std::make_move_iterator(newTracks.end()));
+
+        if (mShuffle) {
+            insertToShuffleOrder(first, count);
+        } else {
+            mPlayOrderDurationsValid = false;
+        }
+
+        writeJournalRecord(QueueJournalRecord::TracksInserted, [=](QDataStream& stream) {
+            stream << static_cast<qint32>(first) << static_cast<qint32>(count);
+            for (int i = first, max = first + count; i < max; ++i) {
+                writeSnapshotTrack(stream, *mTracks[i]);
+            }
+        });
+
+        emit tracksInserted();
+
+        if (mCurrentIndex == -1) {
+            setCurrentIndex(0);
+            if (mShuffle) {
+                moveToShuffleFront(mCurrentIndex);
+            }
+            emit currentTrackChanged();
+        }
+        emit statisticsChanged();
+    }
+
+    void Queue::insertTrackFromLibrary(const LibraryTrack& libraryTrack)
+    {
+        insertTracksFromLibrary(TrackList(std::vector<LibraryTrack>{libraryTrack}));
+    }
+
+    void Queue::addShuffledLibraryTracks(const QString& artist, const QString& genre)
+    {
+        addTracksJob([=](int job) {
+            startAddingShuffledLibraryTracks(job, artist, genre);
+        }, true);
+    }
+
+    void Queue::startAddingShuffledLibraryTracks(int job, const QString& artist, const QString& genre)
+    {
+        startAddingTracks(job);
+
+        clear();
+
+        auto runnable = new TracksRunnable([=](TracksFutureInterface& futureInterface) {
+            QTime time;
+            time.start();
+
+            const QSqlDatabase db(LibraryUtils::readDatabase());
+            if (!db.isOpen()) {
+                qWarning() << "failed to open database" << db.lastError();
+                return;
+            }
+
+            std::vector<qint64> ids(queryTracksIds(db, artist, genre));
+            std::mt19937 random(std::random_device{}());
+            std::shuffle(ids.begin(), ids.end(), random);
+
+            std::size_t batchSize = firstTracksBatchSize;
+            for (std::size_t first = 0, count = ids.size(); first < count; first += batchSize) {
+                if (first > 0) {
+                    batchSize = tracksBatchSize;
+                }
+                futureInterface.reportResult(queryTracksByIds(db, ids.data() + first, std::min(batchSize, count - first)));
+                if (first == 0) {
+                    qDebug() << "first shuffled tracks are loaded in" << time.elapsed() << "ms";
+                }
+            }
+
+            qDebug() << "loaded" << ids.size() << "shuffled tracks in" << time.elapsed() << "ms";
+        });
+
+        const auto addedTracks = std::make_shared<std::vector<std::pair<QString, QString>>>();
+        auto watcher = new TracksFutureWatcher(this);
+        QObject::connect(watcher, &TracksFutureWatcher::resultsReadyAt, this, [=](int beginIndex, int endIndex) {
+            for (int i = beginIndex; i < endIndex; ++i) {
+                TracksBatch batch(watcher->resultAt(i));
+                for (const std::shared_ptr<QueueTrack>& track : batch) {
+                    addedTracks->push_back({track->trackId, track->filePath});
+                }
+                addTracksBatch(std::move(batch), 0, -1, QUrl());
+            }
+        });
+        QObject::connect(watcher, &TracksFutureWatcher::finished, this, [=]() {
+            finishAddingTracks();
+            removeMissingTracks(std::move(*addedTracks));
+            watcher->deleteLater();
+        });
+        watcher->setFuture(runnable->future());
+
+        threadpools::start(threadpools::JobClass::Interactive, runnable);
+    }
+
+    void Queue::moveTracks(int first, int last, int destination)
+    {
+        if (mAddingTracks || !isValidMove(first, last, destination, mTracks.size())) {
+            return;
+        }
+
+        perfcounters::add(perfcounters::QueueOperations);
+        emit tracksAboutToBeMoved(first, last, destination);
+
+        moveRange(mTracks, first, last, destination);
+        if (mShuffle) {
+            // Play order doesn't change
+            for (int position = 0, max = mShuffleOrder.size(); position < max; ++position) {
+                const int index = movedIndex(mShuffleOrder[position], first, last, destination);
+                mShuffleOrder[position] = index;
+                mShufflePositions[index] = position;
+            }
+        } else {
+            mPlayOrderDurationsValid = false;
+        }
+
+        writeJournalRecord(QueueJournalRecord::TracksMoved, [=](QDataStream& stream) {
+            stream << static_cast<qint32>(first) << static_cast<qint32>(last) << static_cast<qint32>(destination);
+        });
+
+        emit tracksMoved();
+
+        if (mCurrentIndex != -1) {
+            setCurrentIndex(movedIndex(mCurrentIndex, first, last, destination));
+        }
+        emit statisticsChanged();
+    }
+
+    void Queue::moveTrackAfterCurrent(int index)
+    {
+        moveTracksAfterCurrent(index, index);
+    }
+
+    void Queue::moveTracksAfterCurrent(int first, int last)
+    {
+        if (mCurrentIndex == -1 || (mCurrentIndex >= first && mCurrentIndex <= last)) {
+            return;
+        }
+
+        if (mShuffle) {
+            // Indexes of moved tracks stay the same until moveTracks()
+            const int nextPosition = mShufflePositions[mCurrentIndex] + 1;
+            std::vector<int> order;
+            order.reserve(mShuffleOrder.size());
+            for (int position = 0; position < nextPosition; ++position) {
+                const int index = mShuffleOrder[position];
+                if (index < first || index > last) {
+                    order.push_back(index);
+                }
+            }
+            for (int index = first; index <= last; ++index) {
+                order.push_back(index);
+            }
+            for (int position = nextPosition, max = mShuffleOrder.size(); position < max; ++position) {
+                const int index = mShuffleOrder[position];
+                if (index < first || index > last) {
+                    order.push_back(index);
+                }
+            }
+            mShuffleOrder = std::move(order);
+            for (int position = 0, max = mShuffleOrder.size(); position < max; ++position) {
+                mShufflePositions[mShuffleOrder[position]] = position;
+            }
+            mPlayOrderDurationsValid = false;
+        }
+
+        moveTracks(first, last, mCurrentIndex + 1);
+    }
+
+    LibraryTrack Queue::getTrack(int index)
+    {
+        const QueueTrack* track = mTracks[index].get();
+        return {track->urlString(),
+                track->title,
+                track->artist,
+                track->album,
+                track->duration,
+                track->mediaArtFilePath};
+    }
+
+    TrackList Queue::getTracks(const std::vector<int>& indexes)
+    {
+        std::vector<LibraryTrack> tracks;
+        tracks.reserve(indexes.size());
+        for (int index : indexes) {
+            tracks.push_back(getTrack(index));
+        }
+        return TrackList(std::move(tracks));
+    }
+
+    void Queue::removeTrack(int index)
+    {
+        removeTracks({index});
+    }
+
+    void Queue::removeTrackWithId(const QString& trackId)
+    {
+        const auto found(std::find_if(mTracks.begin(), mTracks.end(), [&trackId](const std::shared_ptr<QueueTrack>& track) {
+            return track->trackId == trackId;
+        }));
+        if (found != mTracks.end()) {
+            removeTrack(found - mTracks.begin());
+        }
+    }
+
+    void Queue::removeTracks(std::vector<int> indexes)
+    {
+        if (indexes.empty()) {
+            return;
+        }
+
+        perfcounters::add(perfcounters::QueueOperations);
+        std::sort(indexes.begin(), indexes.end());
+        indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+
+        for (int index : indexes) {
+            removeTrackMediaArt(mTracks[index].get());
+            removeFromStatistics(*mTracks[index]);
+        }
+
+        // Remove contiguous ranges starting from the end,
+        // so that indexes of remaining ranges don't change
+        for (auto last = indexes.crbegin(), end = indexes.crend(); last != end;) {
+            auto first = last;
+            auto next = last + 1;
+            while (next != end && *next == *first - 1) {
+                first = next;
+                ++next;
+            }
+
+            emit tracksAboutToBeRemoved(*first, *last);
+            mTracks.erase(mTracks.begin() + *first, mTracks.begin() + *last + 1);
+            writeJournalRecord(QueueJournalRecord::TracksRemoved, [=](QDataStream& stream) {
+                stream << static_cast<qint32>(*first) << static_cast<qint32>(*last);
+            });
+            emit tracksRemoved();
+
+            last = next;
+        }
+
+        if (mShuffle) {
+            removeFromShuffleOrder(indexes);
+        } else {
+            mPlayOrderDurationsValid = false;
+        }
+
+        const auto current(std::lower_bound(indexes.cbegin(), indexes.cend(), mCurrentIndex));
+        const int newIndex = mCurrentIndex - static_cast<int>(current - indexes.cbegin());
+        if (current != indexes.cend() && *current == mCurrentIndex) {
+            // Next track becomes current
+            mCurrentIndex = std::min(newIndex, static_cast<int>(mTracks.size()) - 1);
+            writeJournalRecord(QueueJournalRecord::CurrentIndex, [=](QDataStream& stream) {
+                stream << static_cast<qint32>(mCurrentIndex);
+            });
+            emit currentIndexChanged();
+            emit currentTrackChanged();
+        } else {
+            setCurrentIndex(newIndex);
+        }
+        emit statisticsChanged();
     }
 
-    int Queue::currentIndex() const
+    void Queue::clear(bool emitAbout)
     {
-        return mCurrentIndex;
+        perfcounters::add(perfcounters::QueueOperations);
+        if (emitAbout) {
+            emit aboutToBeCleared();
+        }
+        mTracks.clear();
+        mShuffleOrder.clear();
+        mShufflePositions.clear();
+        mTotalDuration = 0;
+        mLocalTracksCount = 0;
+        mPlayOrderDurations.assign(1, 0);
+        mPlayOrderDurationsValid = true;
+        {
+            const QMutexLocker locker(&mTracksMediaArtMutex);
+            mTracksMediaArt.clear();
+            mUnloadedMediaArt.clear();
+        }
+        writeJournalRecord(QueueJournalRecord::Cleared);
+        emit cleared();
+        setCurrentIndex(-1);
+        emit currentTrackChanged();
+        emit statisticsChanged();
     }
 
-    void Queue::setCurrentIndex(int index)
+    void Queue::next()
     {
-        if (index != mCurrentIndex) {
-            mCurrentIndex = index;
-            emit currentIndexChanged();
+        if (mShuffle) {
+            int position = mShufflePositions[mCurrentIndex] + 1;
+            if (position == static_cast<int>(mShuffleOrder.size())) {
+                resetShuffleOrder();
+                position = mShuffleOrder.size() > 1 ? 1 : 0;
+            }
+            setCurrentIndex(mShuffleOrder[position]);
+        } else {
+            if (mCurrentIndex == static_cast<int>(mTracks.size() - 1)) {
+                setCurrentIndex(0);
+            } else {
+                setCurrentIndex(mCurrentIndex + 1);
+            }
         }
+
+        emit currentTrackChanged();
     }
 
-    QUrl Queue::currentUrl() const
+    void Queue::nextOnEos()
     {
-        if (mCurrentIndex >= 0) {
-            return mTracks[mCurrentIndex]->url;
+        if (mRepeatMode == RepeatOne) {
+            emit currentTrackChanged();
+            return;
         }
-        return QUrl();
-    }
 
-    bool Queue::isCurrentLocalFile() const
-    {
-        if (mCurrentIndex >= 0) {
-            return mTracks[mCurrentIndex]->url.isLocalFile();
+        if (mShuffle) {
+            int position = mShufflePositions[mCurrentIndex] + 1;
+            if (position == static_cast<int>(mShuffleOrder.size())) {
+                if (mRepeatMode == RepeatAll) {
+                    resetShuffleOrder();
+                    position = mShuffleOrder.size() > 1 ? 1 : 0;
+                } else {
+                    return;
+                }
+            }
+            setCurrentIndex(mShuffleOrder[position]);
+        } else {
+            if (mCurrentIndex == static_cast<int>(mTracks.size() - 1)) {
+                if (mRepeatMode == RepeatAll) {
+                    setCurrentIndex(0);
+                } else {
+                    return;
+                }
+            } else {
+                setCurrentIndex(mCurrentIndex + 1);
+            }
         }
-        return false;
+
+        emit currentTrackChanged();
     }
 
-    QString Queue::currentFilePath() const
+    int Queue::nextIndexOnEos() const
     {
-        if (mCurrentIndex >= 0) {
-            const QUrl& url = mTracks[mCurrentIndex]->url;
-            if (url.isLocalFile()) {
-                return url.path();
+        if (mCurrentIndex == -1) {
+            return -1;
+        }
+
+        if (mRepeatMode == RepeatOne) {
+            return mCurrentIndex;
+        }
+
+        if (mShuffle) {
+            const int position = mShufflePositions[mCurrentIndex] + 1;
+            if (position == static_cast<int>(mShuffleOrder.size())) {
+                return -1;
             }
+            return mShuffleOrder[position];
         }
-        return QString();
+
+        if (mCurrentIndex == static_cast<int>(mTracks.size() - 1)) {
+            return mRepeatMode == RepeatAll ? 0 : -1;
+        }
+        return mCurrentIndex + 1;
     }
 
-    QString Queue::currentTitle() const
+    std::vector<int> Queue::upcomingIndexes(int count) const
     {
-        if (mCurrentIndex >= 0) {
-            return mTracks[mCurrentIndex]->title;
+        std::vector<int> indexes;
+        if (mCurrentIndex == -1 || mRepeatMode == RepeatOne) {
+            return indexes;
         }
-        return QString();
+
+        if (mShuffle) {
+            const int end = std::min(mShufflePositions[mCurrentIndex] + 1 + count, static_cast<int>(mShuffleOrder.size()));
+            for (int position = mShufflePositions[mCurrentIndex] + 1; position < end; ++position) {
+                indexes.push_back(mShuffleOrder[position]);
+            }
+            return indexes;
+        }
+
+        const int tracksCount = static_cast<int>(mTracks.size());
+        for (int index = mCurrentIndex + 1; static_cast<int>(indexes.size()) < count; ++index) {
+            if (index == tracksCount) {
+                if (mRepeatMode != RepeatAll) {
+                    break;
+                }
+                index = 0;
+            }
+            if (index == mCurrentIndex) {
+                break;
+            }
+            indexes.push_back(index);
+        }
+        return indexes;
     }
 
-    QString Queue::currentArtist() const
+    void Queue::previous()
     {
-        if (mCurrentIndex >= 0) {
-            return mTracks[mCurrentIndex]->artist;
+        if (mShuffle) {
+            const int position = mShufflePositions[mCurrentIndex];
+            if (position == 0) {
+                setCurrentIndex(mShuffleOrder.back());
+            } else {
+                setCurrentIndex(mShuffleOrder[position - 1]);
+            }
+        } else if (mCurrentIndex == 0) {
+            setCurrentIndex(mTracks.size() - 1);
+        } else {
+            setCurrentIndex(mCurrentIndex - 1);
         }
-        return QString();
+
+        emit currentTrackChanged();
     }
 
-    QString Queue::currentAlbum() const
+    void Queue::setCurrentToFirstIfNeeded()
     {
-        if (mCurrentIndex >= 0) {
-            return mTracks[mCurrentIndex]->album;
+        if (mCurrentIndex == -1) {
+            setCurrentIndex(0);
+            emit currentTrackChanged();
         }
-        return QString();
     }
 
-    QString Queue::currentMediaArt() const
+    void Queue::resetShuffleOrder()
     {
+        mShuffleOrder.clear();
+        mShufflePositions.clear();
+        addToShuffleOrder(0);
         if (mCurrentIndex >= 0) {
-            const QueueTrack* track = mTracks[mCurrentIndex].get();
-            if (track->url.isLocalFile()) {
-                if (!track->mediaArtFilePath.isEmpty()) {
-                    return track->mediaArtFilePath;
-                }
-                if (!track->mediaArtPixmap.isNull()) {
-                    return QString::fromLatin1("image://%1/%2").arg(QueueImageProvider::providerId, track->url.toString());
-                }
-            }
+            moveToShuffleFront(mCurrentIndex);
         }
-        return QString();
+        emit statisticsChanged();
     }
 
-    bool Queue::isShuffle() const
+    void Queue::addToShuffleOrder(int firstIndex)
     {
-        return mShuffle;
+        // Inside-out Fisher-Yates, new tracks are shuffled with tracks
+        // that are not played yet
+        const int first = (mCurrentIndex >= 0 && mCurrentIndex < firstIndex) ? mShufflePositions[mCurrentIndex] + 1 : 0;
+        const int count = mTracks.size();
+        mShuffleOrder.reserve(count);
+        mShufflePositions.resize(count);
+        for (int index = firstIndex; index < count; ++index) {
+            const int position = mShuffleOrder.size();
+            const int swapPosition = first + qrand() % (position - first + 1);
+            mShuffleOrder.push_back(index);
+            if (swapPosition != position) {
+                const int swapIndex = mShuffleOrder[swapPosition];
+                mShuffleOrder[swapPosition] = index;
+                mShuffleOrder[position] = swapIndex;
+                mShufflePositions[swapIndex] = position;
+            }
+            mShufflePositions[index] = swapPosition;
+        }
+        mPlayOrderDurationsValid = false;
     }
 
-    void Queue::setShuffle(bool shuffle)
+    void Queue::insertToShuffleOrder(int first, int count)
     {
-        if (shuffle != mShuffle) {
-            mShuffle = shuffle;
-            emit shuffleChanged();
-            if (!mShuffle) {
-                resetNotPlayedTracks();
+        const int position = mCurrentIndex >= 0 ? mShufflePositions[mCurrentIndex] + 1 : 0;
+        for (int& index : mShuffleOrder) {
+            if (index >= first) {
+                index += count;
             }
         }
+        std::vector<int> inserted(count);
+        std::iota(inserted.begin(), inserted.end(), first);
+        mShuffleOrder.insert(mShuffleOrder.begin() + position, inserted.begin(), inserted.end());
+        mShufflePositions.resize(mShuffleOrder.size());
+        for (int i = 0, max = mShuffleOrder.size(); i < max; ++i) {
+            mShufflePositions[mShuffleOrder[i]] = i;
+        }
+        mPlayOrderDurationsValid = false;
     }
 
-    Queue::RepeatMode Queue::repeatMode() const
+    void Queue::removeFromShuffleOrder(const std::vector<int>& indexes)
     {
-        return mRepeatMode;
-    }
+        // Maps old indexes to new ones, -1 for removed tracks
+        std::vector<int> newIndexes(mShuffleOrder.size(), 0);
+        for (int index : indexes) {
+            newIndexes[index] = -1;
+        }
+        int removed = 0;
+        for (int index = 0, max = newIndexes.size(); index < max; ++index) {
+            if (newIndexes[index] == -1) {
+                ++removed;
+            } else {
+                newIndexes[index] = index - removed;
+            }
+        }
 
-    void Queue::changeRepeatMode()
-    {
-        switch (mRepeatMode) {
-        case NoRepeat:
-            mRepeatMode = RepeatAll;
-            break;
-        case RepeatAll:
-            mRepeatMode = RepeatOne;
-            if (mShuffle) {
-                resetNotPlayedTracks();
+        int position = 0;
+        for (int index : mShuffleOrder) {
+            const int newIndex = newIndexes[index];
+            if (newIndex != -1) {
+                mShuffleOrder[position] = newIndex;
+                mShufflePositions[newIndex] = position;
+                ++position;
             }
-            break;
-        case RepeatOne:
-            mRepeatMode = NoRepeat;
         }
-        emit repeatModeChanged();
+        mShuffleOrder.resize(position);
+        mShufflePositions.resize(position);
+        mPlayOrderDurationsValid = false;
     }
 
-    void Queue::setRepeatMode(int mode)
+    void Queue::moveToShuffleFront(int index)
     {
-        mRepeatMode = static_cast<RepeatMode>(mode);
-        emit repeatModeChanged();
+        const int position = mShufflePositions[index];
+        const int frontIndex = mShuffleOrder.front();
+        mShuffleOrder[position] = frontIndex;
+        mShufflePositions[frontIndex] = position;
+        mShuffleOrder.front() = index;
+        mShufflePositions[index] = 0;
+        mPlayOrderDurationsValid = false;
     }
 
-    bool Queue::isAddingTracks() const
+    void Queue::addToStatistics(const QueueTrack& track)
     {
-        return mAddingTracks;
+        mTotalDuration += std::max(track.duration, 0);
+        if (track.isLocalFile()) {
+            ++mLocalTracksCount;
+        }
     }
 
-    void Queue::addTracksFromUrls(const QStringList& trackUrls, bool clearQueue, int setAsCurrent)
+    void Queue::removeFromStatistics(const QueueTrack& track)
     {
-        if (mAddingTracks) {
-            return;
+        mTotalDuration -= std::max(track.duration, 0);
+        if (track.isLocalFile()) {
+            --mLocalTracksCount;
         }
+    }
 
-        if (trackUrls.empty()) {
+    void Queue::saveSnapshot()
+    {
+        const QString filePath(snapshotFilePath());
+        QSaveFile file(filePath);
+        if (!file.open(QIODevice::WriteOnly)) {
+            qWarning() << "failed to open queue snapshot file" << filePath << file.errorString();
             return;
         }
 
-        mAddingTracks = true;
-        emit addingTracksChanged();
+        QDataStream stream(&file);
+        stream.setVersion(QDataStream::Qt_5_6);
 
-        std::vector<std::shared_ptr<QueueTrack>> oldTracks;
-        oldTracks.reserve(mTracks.size());
+        // Journal of previous snapshot must not be replayed on this one
+        const quint32 journalId = mJournalId + 1;
 
-        if (clearQueue) {
-            emit aboutToBeCleared();
-            for (auto& track : mTracks) {
-                if (track->modificationTime > 0) {
-                    oldTracks.push_back(std::move(track));
-                }
-            }
-            clear(false);
-        } else {
-            for (const auto& track : mTracks) {
-                if (track->modificationTime > 0) {
-                    oldTracks.push_back(track);
-                }
-            }
+        stream << snapshotMagic << snapshotVersion << journalId;
+        stream << static_cast<qint32>(mCurrentIndex) << static_cast<qint32>(mTracks.size());
+        for (const auto& track : mTracks) {
+            writeSnapshotTrack(stream, *track);
+        }
+        stream << static_cast<qint32>(mShuffleOrder.size());
+        for (int index : mShuffleOrder) {
+            stream << static_cast<qint32>(index);
         }
 
-        const QUrl setAsCurrentUrl([&]() {
-            if (setAsCurrent < 0 || setAsCurrent >= trackUrls.size()) {
-                return QUrl();
-            }
-            const QString urlString(trackUrls[setAsCurrent]);
-            QUrl url(urlString);
-            if (url.isRelative()) {
-                url = QUrl::fromLocalFile(urlString);
-            }
-            return url;
-        }());
-
-        // FIXME: use capture initializers on C++14
-        auto future = QtConcurrent::run(std::bind([](QStringList& trackUrls, std::vector<std::shared_ptr<QueueTrack>>& oldTracks) {
-            QTime time;
-            time.start();
-
-            std::vector<std::shared_ptr<QueueTrack>> newTracks;
-
-            std::vector<QUrl> existingTracks;
-            existingTracks.reserve(trackUrls.size());
-            std::vector<QString> tracksToQuery;
-            tracksToQuery.reserve(trackUrls.size());
-
-            std::unordered_map<QUrl, std::shared_ptr<QueueTrack>> tracksMap;
-
-            struct TrackHandler
-            {
-                std::vector<std::shared_ptr<QueueTrack>>& oldTracks;
-                const std::vector<std::shared_ptr<QueueTrack>>::iterator oldTracksBegin;
-                std::vector<std::shared_ptr<QueueTrack>>::iterator oldTracksEnd;
+        if (!file.commit()) {
+            qWarning() << "failed to save queue snapshot" << file.errorString();
+            return;
+        }
 
-                std::unordered_map<QUrl, std::shared_ptr<QueueTrack>>& tracksMap;
-                std::unordered_map<QUrl, std::shared_ptr<QueueTrack>>::iterator tracksMapEnd;
+        mJournalId = journalId;
+        openJournal(false);
+    }
 
-                std::vector<QUrl>& existingTracks;
-                std::vector<QString>& tracksToQuery;
+    long long Queue::restoredPlayerPosition() const
+    {
+        return mRestoredPlayerPosition;
+    }
 
-                std::unordered_set<QString> playlists;
+    void Queue::writePlayerPosition(long long position)
+    {
+        writeJournalRecord(QueueJournalRecord::PlayerPosition, [=](QDataStream& stream) {
+            stream << static_cast<qint64>(position);
+        });
+    }
 
-                void processTrack(const QUrl& url)
-                {
-                    if (url.isLocalFile()) {
-                        const QFileInfo fileInfo(url.path());
-                        if (fileInfo.isFile() && fileInfo.isReadable()) {
-                            if (contains(PlaylistUtils::playlistsExtensions, fileInfo.suffix()) &&
-                                    !contains(playlists, fileInfo.absoluteFilePath())) {
-                                playlists.insert(fileInfo.absoluteFilePath());
-                                std::vector<PlaylistTrack> playlistTracks(PlaylistUtils::parsePlaylist(url.path()));
-                                existingTracks.reserve(existingTracks.size() + playlistTracks.size());
-                                tracksToQuery.reserve(tracksToQuery.size() + playlistTracks.size());
-                                for (const PlaylistTrack& playlistTrack : playlistTracks) {
-                                    if (playlistTrack.url.isLocalFile()) {
-                                        processTrack(playlistTrack.url);
-                                    } else {
-                                        existingTracks.push_back(playlistTrack.url);
-                                        tracksMap.insert({playlistTrack.url, std::make_shared<QueueTrack>(createTrackId(),
-                                                                                                          playlistTrack.url,
-                                                                                                          playlistTrack.title,
-                                                                                                          playlistTrack.duration,
-                                                                                                          playlistTrack.artist,
-                                                                                                          QString(),
-                                                                                                          QString(),
-                                                                                                          QByteArray(),
-                                                                                                          -1)});
-                                    }
-                                }
-                            } else {
-                                if (tracksMap.find(url) == tracksMapEnd) {
-                                    const auto modificationTime = toMsecsSinceEpoch(fileInfo.lastModified());
-                                    auto found(std::find_if(oldTracksBegin, oldTracksEnd, [&url, &modificationTime](const std::shared_ptr<QueueTrack>& track) {
-                                        return track->url == url && track->modificationTime == modificationTime;
-                                    }));
-                                    if (found == oldTracks.end()) {
-                                        tracksToQuery.push_back(url.path());
-                                    } else {
-                                        tracksMap.insert({url, std::move(*found)});
-                                        tracksMapEnd = tracksMap.end();
-                                        oldTracks.erase(found);
-                                        oldTracksEnd = oldTracks.end();
-                                    }
-                                    existingTracks.push_back(std::move(url));
-                                }
-                            }
-                        } else {
-                            qWarning() << "file" << fileInfo.filePath() << "is not readable";
-                        }
-                    } else {
-                        existingTracks.push_back(std::move(url));
-                    }
-                }
-            };
+    bool Queue::restoreSnapshot()
+    {
+        if (mAddingTracks) {
+            return false;
+        }
 
-            {
-                TrackHandler handler{oldTracks,
-                                     oldTracks.begin(),
-                                     oldTracks.end(),
-                                     tracksMap,
-                                     tracksMap.end(),
-                                     existingTracks,
-                                     tracksToQuery};
-                for (QString& urlString : trackUrls) {
-                    const QUrl url([&urlString]() {
-                        if (urlString.startsWith(QLatin1Char('/'))) {
-                            return QUrl::fromLocalFile(urlString);
-                        }
-                        return QUrl(urlString);
-                    }());
-                    if (!url.isRelative()) {
-                        handler.processTrack(url);
-                    }
-                }
-            }
+        mJournal.close();
 
-            const auto makeTrack = [](const QUrl& url,
-                                      QString&& title,
-                                      int duration,
-                                      QStringList&& artists,
-                                      QStringList&& albums,
-                                      QString&& mediaArtFilePath,
-                                      QByteArray&& mediaArtData,
-                                      long long modificationTime) {
-                QString artist;
-                artists.removeDuplicates();
-                if (artists.isEmpty()) {
-                    artist = qApp->translate("unplayer", "Unknown artist");
-                } else {
-                    artist = artists.join(QLatin1String(", "));
-                }
+        UNPLAYER_TRACE("queue: restore snapshot");
+        QTime time;
+        time.start();
 
-                QString album;
-                albums.removeDuplicates();
-                if (albums.isEmpty()) {
-                    album = qApp->translate("unplayer", "Unknown artist");
-                } else {
-                    album = albums.join(QLatin1String(", "));
-                }
-
-                return std::make_shared<QueueTrack>(createTrackId(),
-                                                    url,
-                                                    std::move(title),
-                                                    duration,
-                                                    std::move(artist),
-                                                    std::move(album),
-                                                    std::move(mediaArtFilePath),
-                                                    std::move(mediaArtData),
-                                                    modificationTime);
-            };
+        QFile file(snapshotFilePath());
+        if (!file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
 
-            {
-                auto db = QSqlDatabase::addDatabase(LibraryUtils::databaseType, dbConnectionName);
-                db.setDatabaseName(LibraryUtils::instance()->databaseFilePath());
-                if (!db.open()) {
-                    qWarning() << "failed to open database" << db.lastError();
-                }
+        const qint64 size = file.size();
+        const uchar* data = file.map(0, size);
+        if (!data) {
+            qWarning() << "failed to map queue snapshot file" << file.errorString();
+            return false;
+        }
 
-                db.transaction();
+        const QByteArray bytes(QByteArray::fromRawData(reinterpret_cast<const char*>(data), size));
+        QDataStream stream(bytes);
+        stream.setVersion(QDataStream::Qt_5_6);
 
-                const int maxParametersCount = 999;
-                for (int i = 0, max = tracksToQuery.size(); i < max; i += maxParametersCount) {
-                    const int count = [&]() -> int {
-                        const int left = max - i;
-                        if (left > maxParametersCount) {
-                            return maxParametersCount;
-                        }
-                        return left;
-                    }();
-                    QString queryString(QLatin1String("SELECT filePath, modificationTime, title, artist, album, duration, mediaArt FROM tracks WHERE filePath IN (?"));
-                    queryString.reserve(queryString.size() + (count - 1) * 2 + 1);
-                    for (int j = 1; j < count; ++j) {
-                        queryString.push_back(QStringLiteral(",?"));
-                    }
-                    queryString.push_back(QLatin1Char(')'));
+        quint32 magic;
+        quint32 version;
+        stream >> magic >> version;
+        quint32 journalId = 0;
+        if (version >= 2) {
+            stream >> journalId;
+        }
+        qint32 currentIndex;
+        qint32 count;
+        stream >> currentIndex >> count;
+        if (stream.status() != QDataStream::Ok || magic != snapshotMagic || version > snapshotVersion || count < 0) {
+            qWarning() << "queue snapshot is invalid";
+            return false;
+        }
 
-                    QSqlQuery query(db);
-                    query.prepare(queryString);
-                    for (int j = i, max = i + count; j < max; ++j) {
-                        query.addBindValue(tracksToQuery[j]);
-                    }
+        std::vector<SnapshotTrack> snapshotTracks;
+        // Each track takes at least 33 bytes
+        snapshotTracks.reserve(std::min(static_cast<qint64>(count), size / 33));
 
+        for (qint32 i = 0; i < count; ++i) {
+            SnapshotTrack track;
+            if (!readSnapshotTrack(stream, track)) {
+                qWarning() << "queue snapshot is truncated";
+                return false;
+            }
+            snapshotTracks.push_back(std::move(track));
+        }
 
-                    if (query.exec()) {
-                        QString previousFilePath;
-                        QString title;
-                        int duration;
-                        QStringList artists;
-                        QStringList albums;
-                        QString mediaArtFilePath;
-                        long long modificationTime;
-                        bool shouldInsert = false;
-
-                        const auto insert = [&]() {
-                            const QUrl url(QUrl::fromLocalFile(previousFilePath));
-                            tracksMap.insert({url, makeTrack(url,
-                                                             std::move(title),
-                                                             duration,
-                                                             std::move(artists),
-                                                             std::move(albums),
-                                                             std::move(mediaArtFilePath),
-                                                             QByteArray(),
-                                                             modificationTime)});
-                        };
+        qint32 shuffleOrderSize;
+        stream >> shuffleOrderSize;
+        std::vector<int> shuffleOrder;
+        if (stream.status() == QDataStream::Ok && shuffleOrderSize == count) {
+            shuffleOrder.reserve(shuffleOrderSize);
+            for (qint32 i = 0; i < shuffleOrderSize; ++i) {
+                qint32 index;
+                stream >> index;
+                shuffleOrder.push_back(index);
+            }
+            if (stream.status() != QDataStream::Ok) {
+                shuffleOrder.clear();
+            }
+        }
 
-                        while (query.next()) {
-                            QString filePath(query.value(0).toString());
+        bool tracksChanged = false;
+        const int journalRecords = replayJournal(journalId, snapshotTracks, currentIndex, tracksChanged, mRestoredPlayerPosition);
+        if (tracksChanged) {
+            // Shuffle order is not journaled
+            shuffleOrder.clear();
+        }
 
-                            if (filePath != previousFilePath) {
-                                // insert previous
-                                if (!previousFilePath.isEmpty() && shouldInsert) {
-                                    insert();
-                                }
+        std::vector<std::shared_ptr<QueueTrack>> tracks;
+        tracks.reserve(snapshotTracks.size());
+        std::vector<RestoredTrack> restoredTracks;
+        for (SnapshotTrack& snapshotTrack : snapshotTracks) {
+            const QueueTrack* track = snapshotTrack.track.get();
+            if (track->isLocalFile()) {
+                restoredTracks.push_back({track->trackId,
+                                          track->filePath,
+                                          track->modificationTime,
+                                          track->mediaArtFilePath,
+                                          snapshotTrack.hasEmbeddedMediaArt});
+            }
+            tracks.push_back(std::move(snapshotTrack.track));
+        }
 
-                                const QFileInfo info(filePath);
-                                shouldInsert = info.isFile() && info.isReadable() && (query.value(1).toLongLong() == toMsecsSinceEpoch(info.lastModified()));
+        mJournalId = journalId;
 
-                                if (shouldInsert) {
-                                    title = query.value(2).toString();
-                                    duration = query.value(4).toInt();
-                                    artists.clear();
-                                    albums.clear();
-                                    mediaArtFilePath = query.value(6).toString();
-                                    modificationTime = query.value(1).toLongLong();
-                                }
-                            }
+        if (tracks.empty()) {
+            continueJournal(journalRecords);
+            return true;
+        }
 
-                            if (shouldInsert) {
-                                artists.push_back(query.value(3).toString());
-                                albums.push_back(query.value(4).toString());
-                            }
+        if (!mTracks.empty()) {
+            clear();
+        }
 
-                            previousFilePath = std::move(filePath);
-                        }
+        const int restoredCount = tracks.size();
+        const QUrl currentUrl(currentIndex >= 0 && currentIndex < restoredCount ? tracks[currentIndex]->url() : QUrl());
+        mRestoredShuffleOrder = std::move(shuffleOrder);
+        mAddingTracks = true;
+        emit addingTracksChanged();
+        addTracksBatch(std::move(tracks), 0, currentIndex, currentUrl);
+        finishAddingTracks();
 
-                        if (shouldInsert && query.previous()) {
-                            // insert last
-                            insert();
-                        }
-                    } else {
-                        qWarning() << query.lastError();
-                    }
-                }
+        // Restored tracks are already in snapshot and journal
+        continueJournal(journalRecords);
 
-                db.commit();
-            }
-            QSqlDatabase::removeDatabase(dbConnectionName);
+        qDebug() << "restored" << restoredCount << "queue tracks from snapshot in" << time.elapsed() << "ms";
 
-            const QMimeDatabase mimeDb;
+        // Check that files still exist and were not modified, and read embedded media art
+        // FIXME: use init capture when we switch to C++14
+        auto future = threadpools::run(threadpools::JobClass::Bulk, std::bind([](std::vector<RestoredTrack>& restoredTracks) {
+            std::vector<std::pair<QString, std::shared_ptr<QueueTrack>>> changedTracks;
 
-            std::unordered_map<QString, QString> mediaArtDirectoriesHash;
             const bool preferDirectoryMediaArt = Settings::instance()->useDirectoryMediaArt();
 
-            newTracks.reserve(existingTracks.size());
-            const auto tracksMapEnd(tracksMap.end());
-            for (QUrl& url : existingTracks) {
-                const auto found = tracksMap.find(url);
-                if (found == tracksMapEnd) {
-                    if (url.isLocalFile()) {
-                        const QString filePath(url.path());
-                        const QFileInfo fileInfo(filePath);
-                        tagutils::Info info(tagutils::getTrackInfo(filePath, mimeDb.mimeTypeForFile(filePath, QMimeDatabase::MatchContent).name()));
-                        QString mediaArtFilePath;
-                        QByteArray mediaArtData;
-                        if (preferDirectoryMediaArt) {
-                            mediaArtFilePath = LibraryUtils::findMediaArtForDirectory(mediaArtDirectoriesHash, fileInfo.path());
-                            if (mediaArtFilePath.isEmpty()) {
-                                mediaArtData = std::move(info.mediaArtData);
-                            }
-                        } else {
-                            if (info.mediaArtData.isEmpty()) {
-                                mediaArtFilePath = LibraryUtils::findMediaArtForDirectory(mediaArtDirectoriesHash, fileInfo.path());
-                            } else {
-                                mediaArtData = std::move(info.mediaArtData);
-                            }
-                        }
-                        newTracks.push_back(makeTrack(std::move(url),
-                                                      std::move(info.title),
-                                                      info.duration,
-                                                      std::move(info.artists),
-                                                      std::move(info.albums),
-                                                      std::move(mediaArtFilePath),
-                                                      std::move(mediaArtData),
-                                                      toMsecsSinceEpoch(fileInfo.lastModified())));
-                    } else {
-                        newTracks.push_back(std::make_shared<QueueTrack>(createTrackId(),
-                                                                         url,
-                                                                         url.toString(),
-                                                                         -1,
-                                                                         QString(),
-                                                                         QString(),
-                                                                         QString(),
-                                                                         QByteArray(),
-                                                                         -1));
-                    }
-                } else {
-                    newTracks.push_back(std::make_shared<QueueTrack>(*(found->second.get())));
-                }
-
-                QueueTrack* track = newTracks.back().get();
-                if (track->title.isEmpty()) {
-                    if (track->url.isLocalFile()) {
-                        track->title = QFileInfo(track->url.path()).fileName();
-                    } else {
-                        track->title = track->url.toString();
+            for (const RestoredTrack& track : restoredTracks) {
+                const QFileInfo fileInfo(track.filePath);
+                if (!fileInfo.isFile() || !fileInfo.isReadable()) {
+                    qWarning() << "file" << fileInfo.filePath() << "is not readable";
+                    changedTracks.push_back({track.trackId, nullptr});
+                } else if (track.hasEmbeddedMediaArt ||
+                           toMsecsSinceEpoch(fileInfo.lastModified()) != track.modificationTime ||
+                           (!track.mediaArtFilePath.isEmpty() && !QFileInfo::exists(track.mediaArtFilePath))) {
+                    auto newTrack(readTrack(track.filePath, fileInfo, preferDirectoryMediaArt));
+                    if (newTrack->title.isEmpty()) {
+                        newTrack->title = fileInfo.fileName();
                     }
+                    changedTracks.push_back({track.trackId, std::move(newTrack)});
                 }
             }
 
-            return newTracks;
-        }, trackUrls, std::move(oldTracks)));
+            return changedTracks;
+        }, std::move(restoredTracks)));
 
-        using FutureWatcher = QFutureWatcher<std::vector<std::shared_ptr<QueueTrack>>>;
+        using FutureWatcher = QFutureWatcher<std::vector<std::pair<QString, std::shared_ptr<QueueTrack>>>>;
         auto watcher = new FutureWatcher(this);
         QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
-            addingTracksCallback(watcher->result(), setAsCurrent, setAsCurrentUrl);
+            replaceTracks(watcher->result());
+            watcher->deleteLater();
         });
         watcher->setFuture(future);
+
+        return true;
     }
 
-    void Queue::addTrackFromUrl(const QString& trackUrl)
+    void Queue::openJournal(bool append)
     {
-        addTracksFromUrls({trackUrl});
+        mJournal.close();
+        mJournalRecords = 0;
+        mJournal.setFileName(journalFilePath());
+        if (!mJournal.open(append ? QIODevice::Append : (QIODevice::WriteOnly | QIODevice::Truncate))) {
+            qWarning() << "failed to open queue journal" << mJournal.fileName() << mJournal.errorString();
+            return;
+        }
+
+        if (!append) {
+            QDataStream stream(&mJournal);
+            stream.setVersion(QDataStream::Qt_5_6);
+            stream << journalMagic << journalVersion << mJournalId;
+            if (!mJournal.flush()) {
+                qWarning() << "failed to write queue journal" << mJournal.errorString();
+                mJournal.close();
+            }
+        }
     }
 
-    void Queue::addTracksFromLibrary(const std::vector<LibraryTrack>& libraryTracks, bool clearQueue, int setAsCurrent)
+    void Queue::continueJournal(int records)
     {
-        if (mAddingTracks) {
-            return;
+        if (records >= journalMaxRecords) {
+            saveSnapshot();
+        } else if (records >= 0) {
+            openJournal(true);
+            mJournalRecords = records;
+        } else {
+            openJournal(false);
         }
+    }
 
-        if (libraryTracks.empty()) {
+    void Queue::writeJournalRecord(QueueJournalRecord type, const std::function<void(QDataStream&)>& writePayload)
+    {
+        if (!mJournal.isOpen()) {
             return;
         }
 
-        mAddingTracks = true;
-        emit addingTracksChanged();
+        QByteArray record;
+        {
+            QDataStream stream(&record, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_5_6);
+            stream << static_cast<quint8>(type);
+            if (writePayload) {
+                writePayload(stream);
+            }
+        }
 
-        if (clearQueue) {
-            clear();
+        // Record is written at once so that it is not lost if application crashes
+        if (mJournal.write(record) != record.size() || !mJournal.flush()) {
+            qWarning() << "failed to write queue journal" << mJournal.errorString();
+            mJournal.close();
+            return;
         }
 
-        const QUrl setAsCurrentUrl([&]() {
-            if (setAsCurrent < 0 || setAsCurrent >= libraryTracks.size()) {
-                return QUrl();
-            }
-            return QUrl::fromLocalFile(libraryTracks[setAsCurrent].filePath);
-        }());
+        ++mJournalRecords;
+        if (mJournalRecords == journalMaxRecords) {
+            // Record can be written in the middle of change, compact when it is finished
+            QTimer::singleShot(0, this, [=]() {
+                saveSnapshot();
+            });
+        }
+    }
 
-        // FIXME: use capture initializers on C++14
-        auto future = QtConcurrent::run(std::bind([](std::vector<LibraryTrack>& libraryTracks) {
-            std::vector<std::shared_ptr<QueueTrack>> newTracks;
-            newTracks.reserve(libraryTracks.size());
+    void Queue::reset()
+    {
+        clear();
+        setCurrentIndex(-1);
+        emit currentTrackChanged();
+    }
 
-            for (auto& libraryTrack : libraryTracks) {
-                QString& filePath = libraryTrack.filePath;
+    void Queue::addTracksBatch(std::vector<std::shared_ptr<QueueTrack>>&& tracks, int firstIndex, int setAsCurrent, const QUrl& setAsCurrentUrl)
+    {
+        if (tracks.empty()) {
+            return;
+        }
 
-                const QFileInfo info(filePath);
+        perfcounters::add(perfcounters::QueueOperations);
+        emit tracksAboutToBeAdded(tracks.size());
 
-                if (!info.isFile()) {
-                    qWarning() << "file" << filePath << "does not exist or not a file";
-                    continue;
-                }
+        const int batchFirstIndex = mTracks.size();
+        setAsCurrent += firstIndex;
 
-                if (!info.isReadable()) {
-                    qWarning() << "file" << filePath << "is not readable";
-                    continue;
+        mTracks.reserve(mTracks.size() + tracks.size());
+        {
+            const QMutexLocker locker(&mTracksMediaArtMutex);
+            for (auto& track : tracks) {
+                if (!track->mediaArtData.isEmpty()) {
+                    mTracksMediaArt.insert({track->trackId, track->mediaArtData});
                 }
-
-                newTracks.push_back(std::make_shared<QueueTrack>(createTrackId(),
-                                                                 QUrl::fromLocalFile(libraryTrack.filePath),
-                                                                 std::move(libraryTrack.title),
-                                                                 libraryTrack.duration,
-                                                                 std::move(libraryTrack.artist),
-                                                                 std::move(libraryTrack.album),
-                                                                 std::move(libraryTrack.mediaArtPath),
-                                                                 QByteArray(),
-                                                                 -1));
+                addToStatistics(*track);
+                if (!mShuffle && mPlayOrderDurationsValid) {
+                    mPlayOrderDurations.push_back(mPlayOrderDurations.back() + std::max(track->duration, 0));
+                }
+                mTracks.push_back(std::move(track));
             }
+        }
 
-            return newTracks;
-        }, libraryTracks));
+        bool restoredShuffleOrder = false;
+        if (mShuffle) {
+            if (batchFirstIndex == 0 && mRestoredShuffleOrder.size() == mTracks.size()) {
+                mShufflePositions.assign(mTracks.size(), -1);
+                restoredShuffleOrder = true;
+                for (int position = 0, max = mRestoredShuffleOrder.size(); position < max; ++position) {
+                    const int index = mRestoredShuffleOrder[position];
+                    if (index < 0 || index >= max || mShufflePositions[index] != -1) {
+                        qWarning() << "restored shuffle order is invalid";
+                        restoredShuffleOrder = false;
+                        break;
+                    }
+                    mShufflePositions[index] = position;
+                }
+                if (restoredShuffleOrder) {
+                    mShuffleOrder = std::move(mRestoredShuffleOrder);
+                    mPlayOrderDurationsValid = false;
+                } else {
+                    mShufflePositions.clear();
+                }
+            }
+            if (!restoredShuffleOrder) {
+                addToShuffleOrder(batchFirstIndex);
+            }
+        }
+        mRestoredShuffleOrder.clear();
 
-        using FutureWatcher = QFutureWatcher<std::vector<std::shared_ptr<QueueTrack>>>;
-        auto watcher = new FutureWatcher(this);
-        QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
-            addingTracksCallback(watcher->result(), setAsCurrent, setAsCurrentUrl);
+        writeJournalRecord(QueueJournalRecord::TracksAdded, [=](QDataStream& stream) {
+            stream << static_cast<qint32>(mTracks.size() - batchFirstIndex);
+            for (int i = batchFirstIndex, max = mTracks.size(); i < max; ++i) {
+                writeSnapshotTrack(stream, *mTracks[i]);
+            }
         });
-        watcher->setFuture(future);
-    }
 
-    void Queue::addTrackFromLibrary(const LibraryTrack& libraryTrack, bool clearQueue, int setAsCurrent)
-    {
-        addTracksFromLibrary({libraryTrack}, clearQueue, setAsCurrent);
+        emit tracksAdded();
+
+        if (mCurrentIndex == -1) {
+            // Current track may be in one of the next batches
+            int index = -1;
+            if (setAsCurrentUrl.isEmpty()) {
+                index = 0;
+            } else if (setAsCurrent >= batchFirstIndex && setAsCurrent < mTracks.size() &&
+                       hasUrl(*mTracks[setAsCurrent], setAsCurrentUrl)) {
+                index = setAsCurrent;
+            } else {
+                const auto found(std::find_if(mTracks.begin() + batchFirstIndex, mTracks.end(), [&setAsCurrentUrl](const std::shared_ptr<QueueTrack>& track) {
+                    return isSetAsCurrent(*track, setAsCurrentUrl);
+                }));
+                if (found != mTracks.end()) {
+                    index = found - mTracks.begin();
+                }
+            }
+            if (index != -1) {
+                setCurrentIndex(index);
+                if (mShuffle && !restoredShuffleOrder) {
+                    moveToShuffleFront(mCurrentIndex);
+                }
+                emit currentTrackChanged();
+            }
+        }
+        emit statisticsChanged();
     }
 
-    LibraryTrack Queue::getTrack(int index)
+    void Queue::addTracksJob(const std::function<void(int)>& start, bool clearQueue)
     {
-        const QueueTrack* track = mTracks[index].get();
-        return {track->url.toString(),
-                track->title,
-                track->artist,
-                track->album,
-                track->duration,
-                track->mediaArtFilePath};
+        // Tracks that are waiting to be added would be cleared by this job
+        JobManager::instance()->add(this,
+                                    JobManager::Type::AddTracksToQueue,
+                                    threadpools::JobClass::Bulk,
+                                    start,
+                                    JobManager::NormalPriority,
+                                    clearQueue ? JobManager::Coalescing::ReplacePending : JobManager::Coalescing::Queue);
     }
 
-    std::vector<LibraryTrack> Queue::getTracks(const std::vector<int>& indexes)
+    void Queue::startAddingTracks(int job)
     {
-        std::vector<LibraryTrack> tracks;
-        tracks.reserve(indexes.size());
-        for (int index : indexes) {
-            tracks.push_back(getTrack(index));
+        mAddingTracksJob = job;
+        // Still true if previous job has just finished
+        if (!mAddingTracks) {
+            mAddingTracks = true;
+            emit addingTracksChanged();
         }
-        return tracks;
     }
 
-    void Queue::removeTrack(int index)
+    void Queue::finishAddingTracks()
     {
-        const std::shared_ptr<QueueTrack> current(mTracks[mCurrentIndex]);
-
-        emit trackAboutToBeRemoved(index);
-
-        erase_one(mNotPlayedTracks, mTracks[index].get());
-        mTracks.erase(mTracks.begin() + index);
-
-        emit trackRemoved();
-
-        if (index == mCurrentIndex) {
-            if (mCurrentIndex >= static_cast<int>(mTracks.size())) {
-                setCurrentIndex(static_cast<int>(mTracks.size() - 1));
-            } else {
-                emit currentIndexChanged();
+        if (mCurrentIndex == -1 && !mTracks.empty()) {
+            // Track that should have been set as current was not found
+            setCurrentIndex(0);
+            if (mShuffle) {
+                moveToShuffleFront(mCurrentIndex);
+                emit statisticsChanged();
             }
             emit currentTrackChanged();
-        } else {
-            setCurrentIndex(index_of(mTracks, current));
+        }
+
+        if (mAddingTracksJob != 0) {
+            const int job = mAddingTracksJob;
+            mAddingTracksJob = 0;
+            // Starts next pending job, which sets mAddingTracksJob again
+            JobManager::instance()->finish(job);
+        }
+        if (mAddingTracksJob == 0) {
+            mAddingTracks = false;
+            emit addingTracksChanged();
         }
     }
 
-    void Queue::removeTracks(std::vector<int> indexes)
+    void Queue::removeTrackMediaArt(const QueueTrack* track)
     {
-        const std::shared_ptr<QueueTrack> current(mTracks[mCurrentIndex]);
+        if (track->hasEmbeddedMediaArt()) {
+            const QMutexLocker locker(&mTracksMediaArtMutex);
+            mTracksMediaArt.erase(track->trackId);
+            mUnloadedMediaArt.erase(track->trackId);
+        }
+    }
 
-        std::sort(indexes.begin(), indexes.end(), std::greater<int>());
-        for (int index : indexes) {
-            emit trackAboutToBeRemoved(index);
-            erase_one(mNotPlayedTracks, mTracks[index].get());
-            mTracks.erase(mTracks.begin() + index);
-            emit trackRemoved();
+    void Queue::removeMissingTracks(std::vector<std::pair<QString, QString>>&& tracks)
+    {
+        if (tracks.empty()) {
+            return;
         }
 
-        if (contains(indexes, mCurrentIndex)) {
-            if (mCurrentIndex >= static_cast<int>(mTracks.size())) {
-                setCurrentIndex(mTracks.size() - 1);
+        // FIXME: use init capture when we switch to C++14
+        auto future = threadpools::run(threadpools::JobClass::Bulk, std::bind([](std::vector<std::pair<QString, QString>>& tracks) {
+            std::vector<std::pair<QString, std::shared_ptr<QueueTrack>>> missingTracks;
+            for (const auto& track : tracks) {
+                const QFileInfo fileInfo(track.second);
+                if (!fileInfo.isFile() || !fileInfo.isReadable()) {
+                    qWarning() << "file" << track.second << "is not readable";
+                    missingTracks.push_back({track.first, nullptr});
+                }
             }
-            emit currentTrackChanged();
-        } else {
-            setCurrentIndex(index_of(mTracks, current));
-        }
+            return missingTracks;
+        }, std::move(tracks)));
+
+        using FutureWatcher = QFutureWatcher<std::vector<std::pair<QString, std::shared_ptr<QueueTrack>>>>;
+        auto watcher = new FutureWatcher(this);
+        QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
+            replaceTracks(watcher->result());
+            watcher->deleteLater();
+        });
+        watcher->setFuture(future);
     }
 
-    void Queue::clear(bool emitAbout)
+    void Queue::replaceTracks(std::vector<std::pair<QString, std::shared_ptr<QueueTrack>>>&& tracks)
     {
-        if (emitAbout) {
-            emit aboutToBeCleared();
+        if (tracks.empty()) {
+            return;
         }
-        mTracks.clear();
-        mNotPlayedTracks.clear();
-        emit cleared();
-        setCurrentIndex(-1);
-        emit currentTrackChanged();
-    }
 
-    void Queue::next()
-    {
-        if (mShuffle) {
-            if (mNotPlayedTracks.size() == 1) {
-                resetNotPlayedTracks();
+        std::unordered_map<QString, int> indexes;
+        indexes.reserve(mTracks.size());
+        for (int i = 0, max = mTracks.size(); i < max; ++i) {
+            indexes.insert({mTracks[i]->trackId, i});
+        }
+
+        std::vector<int> removed;
+        for (auto& track : tracks) {
+            const auto found(indexes.find(track.first));
+            if (found == indexes.end()) {
+                // Already removed
+                continue;
             }
-            erase_one(mNotPlayedTracks, mTracks[mCurrentIndex].get());
-            mTracks.erase(mTracks.begin() + mCurrentIndex);
-            setCurrentIndex(index_of(mTracks, mNotPlayedTracks[qrand() % mNotPlayedTracks.size()]));
-        } else {
-            if (mCurrentIndex == static_cast<int>(mTracks.size() - 1)) {
-                setCurrentIndex(0);
-            } else {
-                setCurrentIndex(mCurrentIndex + 1);
+
+            const int index = found->second;
+            if (!track.second) {
+                removed.push_back(index);
+                continue;
+            }
+
+            removeTrackMediaArt(mTracks[index].get());
+            removeFromStatistics(*mTracks[index]);
+            addToStatistics(*track.second);
+            if (track.second->duration != mTracks[index]->duration) {
+                mPlayOrderDurationsValid = false;
+            }
+            track.second->trackId = track.first;
+            if (!track.second->mediaArtData.isEmpty()) {
+                const QMutexLocker locker(&mTracksMediaArtMutex);
+                mTracksMediaArt.insert({track.first, track.second->mediaArtData});
+            }
+            mTracks[index] = std::move(track.second);
+            writeJournalRecord(QueueJournalRecord::TrackChanged, [=](QDataStream& stream) {
+                stream << static_cast<qint32>(index);
+                writeSnapshotTrack(stream, *mTracks[index]);
+            });
+
+            emit trackChanged(index);
+            if (index == mCurrentIndex) {
+                emit mediaArtChanged();
             }
         }
 
-        emit currentTrackChanged();
+        emit statisticsChanged();
+        removeTracks(std::move(removed));
     }
 
-    void Queue::nextOnEos()
+    void Queue::updateMediaArt(const QString& album)
     {
-        if (mRepeatMode == RepeatOne) {
-            emit currentTrackChanged();
+        if (mUpdatingMediaArt) {
+            mMediaArtUpdateQueued = true;
             return;
         }
 
-        if (mShuffle) {
-            const std::shared_ptr<QueueTrack>& track = mTracks[mCurrentIndex];
-            erase_one(mNotPlayedTracks, track.get());
-            if (mNotPlayedTracks.empty()) {
-                if (mRepeatMode == RepeatAll) {
-                    resetNotPlayedTracks();
-                    erase_one(mNotPlayedTracks, track.get());
+        std::vector<QString> filePaths;
+        for (const auto& track : mTracks) {
+            // Album field of track may list several albums
+            if (track->isLocalFile() && (album.isNull() || track->album.contains(album, Qt::CaseInsensitive))) {
+                filePaths.push_back(track->filePath);
+            }
+        }
+
+        if (filePaths.empty()) {
+            return;
+        }
+
+        mUpdatingMediaArt = true;
+
+        // FIXME: use init capture when we switch to C++14
+        auto future = threadpools::run(threadpools::JobClass::Interactive, std::bind([](std::vector<QString>& filePaths) {
+            std::unordered_map<QString, QString> mediaArt;
+            {
+                const QSqlDatabase db(LibraryUtils::threadDatabase());
+                if (db.isOpen()) {
+                    const std::unordered_map<QString, LibraryTrackMetadata> tracks(LibraryUtils::getTracksMetadata(db, filePaths));
+                    mediaArt.reserve(tracks.size());
+                    for (const auto& track : tracks) {
+                        mediaArt.insert({track.first, track.second.mediaArt});
+                    }
                 } else {
-                    return;
+                    qWarning() << "failed to open database" << db.lastError();
                 }
             }
-            setCurrentIndex(index_of(mTracks, mNotPlayedTracks[qrand() % mNotPlayedTracks.size()]));
-        } else {
-            if (mCurrentIndex == static_cast<int>(mTracks.size() - 1)) {
-                if (mRepeatMode == RepeatAll) {
-                    setCurrentIndex(0);
-                } else {
-                    return;
+            return mediaArt;
+        }, std::move(filePaths)));
+
+        using FutureWatcher = QFutureWatcher<std::unordered_map<QString, QString>>;
+        auto watcher = new FutureWatcher(this);
+        QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
+            mUpdatingMediaArt = false;
+
+            const std::unordered_map<QString, QString> mediaArt(watcher->result());
+            const auto end(mediaArt.end());
+            bool currentChanged = false;
+            for (int i = 0, max = mTracks.size(); i < max; ++i) {
+                QueueTrack* track = mTracks[i].get();
+                if (track->isLocalFile()) {
+                    const auto found(mediaArt.find(track->filePath));
+                    if (found != end && found->second != track->mediaArtFilePath) {
+                        track->mediaArtFilePath = found->second;
+                        if (i == mCurrentIndex) {
+                            currentChanged = true;
+                        }
+                    }
                 }
-            } else {
-                setCurrentIndex(mCurrentIndex + 1);
             }
-        }
+            if (currentChanged) {
+                emit mediaArtChanged();
+            }
 
-        emit currentTrackChanged();
-    }
+            watcher->deleteLater();
 
-    void Queue::previous()
-    {
-        if (mShuffle) {
-            return;
-        }
+            if (mMediaArtUpdateQueued) {
+                mMediaArtUpdateQueued = false;
+                updateMediaArt();
+            }
+        });
+        watcher->setFuture(future);
+    }
 
-        if (mCurrentIndex == 0) {
-            setCurrentIndex(mTracks.size() - 1);
-        } else {
-            setCurrentIndex(mCurrentIndex - 1);
-        }
+    const QString QueueImageProvider::providerId(QLatin1String("queue"));
 
-        emit currentTrackChanged();
+    QueueImageProvider* QueueImageProvider::instance()
+    {
+        return queueImageProviderInstance;
     }
 
-    void Queue::setCurrentToFirstIfNeeded()
+    QueueImageProvider::QueueImageProvider(const Queue* queue)
+        : mQueue(queue),
+          mCacheSize(0),
+          mCacheHits(0),
+          mCacheMisses(0)
     {
-        if (mCurrentIndex == -1) {
-            setCurrentIndex(0);
-            emit currentTrackChanged();
-        }
+        queueImageProviderInstance = this;
     }
 
-    void Queue::resetNotPlayedTracks()
+    QueueImageProvider::~QueueImageProvider()
     {
-        mNotPlayedTracks.clear();
-        mNotPlayedTracks.reserve(mTracks.size());
-        for (const auto& track : mTracks) {
-            mNotPlayedTracks.push_back(track.get());
+        if (queueImageProviderInstance == this) {
+            queueImageProviderInstance = nullptr;
         }
+        mThreadPool.clear();
+        mThreadPool.waitForDone();
     }
 
-    void Queue::reset()
+    QQuickImageResponse* QueueImageProvider::requestImageResponse(const QString& id, const QSize& requestedSize)
     {
-        clear();
-        setCurrentIndex(-1);
-        emit currentTrackChanged();
+        auto response = new QueueImageResponse(this, id, requestedSize);
+        mThreadPool.start(response);
+        return response;
     }
 
-    void Queue::addingTracksCallback(std::vector<std::shared_ptr<QueueTrack>>&& tracks, int setAsCurrent, const QUrl& setAsCurrentUrl)
+    QImage QueueImageProvider::image(const QString& id, const QSize& requestedSize)
     {
-        emit tracksAboutToBeAdded(tracks.size());
+        // Id is a track id without leading '/'
+        QByteArray data(mQueue->trackMediaArt(QLatin1Char('/') + id));
+        if (data.isEmpty()) {
+            return QImage();
+        }
 
-        setAsCurrent += mTracks.size();
+        QBuffer buffer(&data);
+        QImageReader reader(&buffer);
 
-        mNotPlayedTracks.reserve(mNotPlayedTracks.size() + tracks.size());
-        mTracks.reserve(mTracks.size() + tracks.size());
-        for (auto& track : tracks) {
-            mNotPlayedTracks.push_back(track.get());
-            mTracks.push_back(std::move(track));
+        const QSize imageSize(reader.size());
+        QSize size(imageSize);
+        // Unset dimension of requested size may be either 0 or -1
+        if ((requestedSize.width() > 0 || requestedSize.height() > 0) && size.isValid()) {
+            QSize newSize(requestedSize);
+            if (newSize.width() <= 0) {
+                newSize.setWidth(size.width());
+            }
+            if (newSize.height() <= 0) {
+                newSize.setHeight(size.height());
+            }
+            size.scale(newSize, Qt::KeepAspectRatio);
         }
-        emit tracksAdded();
 
-        if (mCurrentIndex == -1 && !mTracks.empty()) {
-            if (setAsCurrent < 0 || setAsCurrent >= mTracks.size()) {
-                setCurrentIndex(0);
-            } else {
-                if (mTracks[setAsCurrent]->url == setAsCurrentUrl) {
-                    setCurrentIndex(setAsCurrent);
-                } else {
-                    const auto found(std::find_if(mTracks.begin(), mTracks.end(), [&setAsCurrentUrl](const std::shared_ptr<QueueTrack>& track) {
-                        return track->url == setAsCurrentUrl;
-                    }));
-                    if (found == mTracks.end()) {
-                        setCurrentIndex(0);
-                    } else {
-                        setCurrentIndex(found - mTracks.begin());
-                    }
-                }
+        const QString key(QString::fromLatin1("%1@%2x%3").arg(id).arg(size.width()).arg(size.height()));
+        {
+            const QMutexLocker locker(&mCacheMutex);
+            const auto found(mCacheIndex.find(key));
+            if (found != mCacheIndex.end()) {
+                ++mCacheHits;
+                mCache.splice(mCache.begin(), mCache, found->second);
+                return found->second->second;
             }
-            emit currentTrackChanged();
+            ++mCacheMisses;
         }
 
-        mAddingTracks = false;
-        emit addingTracksChanged();
+        // Decode directly to requested size, full-size image is never kept in memory
+        const QImage image(Utils::readScaledImage(reader, imageSize, size));
+        if (image.isNull()) {
+            qWarning() << "failed to decode media art:" << reader.errorString();
+            return image;
+        }
+
+        const QMutexLocker locker(&mCacheMutex);
+        if (mCacheIndex.find(key) == mCacheIndex.end() && image.byteCount() <= imageCacheMaxSize) {
+            mCache.emplace_front(key, image);
+            mCacheIndex.insert({key, mCache.begin()});
+            mCacheSize += image.byteCount();
+            evict(imageCacheMaxSize);
+        }
+        return image;
     }
 
-    const QString QueueImageProvider::providerId(QLatin1String("queue"));
+    void QueueImageProvider::prefetch(const QString& id, const QSize& requestedSize)
+    {
+        // Requests from QML have priority 0 and are started first
+        mThreadPool.start(new QueueImagePrefetchRunnable(this, id, requestedSize), -1);
+    }
 
-    QueueImageProvider::QueueImageProvider(const Queue* queue)
-        : QQuickImageProvider(QQuickImageProvider::Pixmap),
-          mQueue(queue)
+    void QueueImageProvider::trimCache(MemoryPressure::Level level)
     {
+        const QMutexLocker locker(&mCacheMutex);
+        evict(level == MemoryPressure::Level::Critical ? 0 : imageCacheMaxSize / 4);
+    }
 
+    QueueImageProvider::CacheStatistics QueueImageProvider::cacheStatistics()
+    {
+        const QMutexLocker locker(&mCacheMutex);
+        return {static_cast<int>(mCache.size()), mCacheSize, mCacheHits, mCacheMisses};
     }
 
-    QPixmap QueueImageProvider::requestPixmap(const QString& id, QSize*, const QSize& requestedSize)
+    void QueueImageProvider::evict(int maxSize)
     {
-        for (const auto& track : mQueue->tracks()) {
-            if (track->url.toString() == id) {
-                const QPixmap& pixmap = track->mediaArtPixmap;
-                if (requestedSize.isValid()) {
-                    QSize newSize(requestedSize);
-                    if (newSize.width() == 0) {
-                        newSize.setWidth(pixmap.width());
-                    }
-                    if (newSize.height() == 0) {
-                        newSize.setHeight(pixmap.height());
-                    }
-                    return pixmap.scaled(newSize, Qt::KeepAspectRatio);
-                }
-                return pixmap;
-            }
+        while (mCacheSize > maxSize) {
+            const auto& last = mCache.back();
+            mCacheSize -= last.second.byteCount();
+            mCacheIndex.erase(last.first);
+            mCache.pop_back();
         }
-        return QPixmap();
     }
 }
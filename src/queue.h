@@ -19,20 +19,45 @@
 #ifndef UNPLAYER_QUEUE_H
 #define UNPLAYER_QUEUE_H
 
+#include <functional>
+#include <list>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
+#include <QByteArray>
+#include <QFile>
+#include <QImage>
+#include <QMutex>
 #include <QObject>
 #include <QQuickImageProvider>
 #include <QStringList>
+#include <QThreadPool>
 #include <QUrl>
 
 #include "librarytrack.h"
+#include "memorypressure.h"
+#include "stdutils.h"
+#include "tracklist.h"
+
+class QDataStream;
 
 namespace unplayer
 {
     struct QueueTrack
     {
+        // Local file
+        explicit QueueTrack(const QString& trackId,
+                            const QString& filePath,
+                            const QString& title,
+                            int duration,
+                            const QString& artist,
+                            const QString& album,
+                            const QString& mediaArtFilePath,
+                            const QByteArray& mediaArtData,
+                            long long modificationTime);
+
+        // Local file or remote URL
         explicit QueueTrack(const QString& trackId,
                             const QUrl& url,
                             const QString& title,
@@ -42,20 +67,39 @@ namespace unplayer
                             const QString& mediaArtFilePath,
                             const QByteArray& mediaArtData,
                             long long modificationTime);
+
+        // True if track has embedded media art, even if it is unloaded
+        bool hasEmbeddedMediaArt() const;
+
+        bool isLocalFile() const { return !filePath.isEmpty(); }
+        // Created on each call, use filePath for local files when possible
+        QUrl url() const;
+        QString urlString() const;
+
         QString trackId;
 
-        QUrl url;
+        // Local files are stored as paths that share data with library's tracks,
+        // URL is kept only for remote tracks
+        QString filePath;
+        QUrl remoteUrl;
+
         QString title;
         int duration;
         QString artist;
         QString album;
 
         QString mediaArtFilePath;
-        QPixmap mediaArtPixmap;
+        // Compressed embedded media art, decoded by QueueImageProvider on demand
+        QByteArray mediaArtData;
+        // Set when mediaArtData was dropped on memory pressure, it is read from file again when needed
+        bool mediaArtUnloaded;
 
         long long modificationTime;
     };
 
+    // Type of record in queue journal
+    enum class QueueJournalRecord : quint8;
+
     class Queue final : public QObject
     {
         Q_OBJECT
@@ -74,6 +118,11 @@ namespace unplayer
         Q_PROPERTY(RepeatMode repeatMode READ repeatMode NOTIFY repeatModeChanged)
 
         Q_PROPERTY(bool addingTracks READ isAddingTracks NOTIFY addingTracksChanged)
+
+        Q_PROPERTY(int totalDuration READ totalDuration NOTIFY statisticsChanged)
+        Q_PROPERTY(int remainingDuration READ remainingDuration NOTIFY statisticsChanged)
+        Q_PROPERTY(int localTracksCount READ localTracksCount NOTIFY statisticsChanged)
+        Q_PROPERTY(int remoteTracksCount READ remoteTracksCount NOTIFY statisticsChanged)
     public:
         enum RepeatMode
         {
@@ -98,48 +147,182 @@ namespace unplayer
         QString currentAlbum() const;
         QString currentMediaArt() const;
 
+        // Decodes media art of tracks that next() and previous() would make current,
+        // so that it is shown from memory. size is sourceSize of Image that shows current media art
+        Q_INVOKABLE void prefetchMediaArt(const QSize& size) const;
+
+        // Compressed embedded media art of track with given id, thread-safe
+        QByteArray trackMediaArt(const QString& trackId) const;
+        // Approximate size of tracks in memory, in bytes
+        qint64 memoryUsage() const;
+        // Drops embedded media art of all tracks except current one and its neighbours
+        void unloadMediaArt();
+
+        // Sum of known durations of all tracks, in seconds
+        int totalDuration() const;
+        // Duration of tracks that will be played after current one, in play order.
+        // Duration of all tracks if there is no current track
+        int remainingDuration() const;
+        int localTracksCount() const;
+        int remoteTracksCount() const;
+
         bool isShuffle() const;
         void setShuffle(bool shuffle);
 
+        // Permutation of tracks indexes, tracks after current one are not played yet
+        const std::vector<int>& shuffleOrder() const;
+
         RepeatMode repeatMode() const;
         Q_INVOKABLE void changeRepeatMode();
         void setRepeatMode(int mode);
 
+        // True while tracks are being added or waiting to be added.
+        // Additions are run one after another as jobs of JobManager,
+        // addition that clears queue drops the ones that are waiting
         bool isAddingTracks() const;
 
+        // URLs may be of files, playlists or directories, which are added recursively.
+        // If setAsCurrent is index of directory, its first file becomes current track
         Q_INVOKABLE void addTracksFromUrls(const QStringList& trackUrls, bool clearQueue = false, int setAsCurrent = -1);
         Q_INVOKABLE void addTrackFromUrl(const QString& trackUrl);
-        Q_INVOKABLE void addTracksFromLibrary(const std::vector<unplayer::LibraryTrack>& libraryTracks, bool clearQueue = false, int setAsCurrent = -1);
+        Q_INVOKABLE void addTracksFromLibrary(const unplayer::TrackList& libraryTracks, bool clearQueue = false, int setAsCurrent = -1);
         Q_INVOKABLE void addTrackFromLibrary(const unplayer::LibraryTrack& libraryTrack, bool clearQueue = false, int setAsCurrent = -1);
+        // Inserts tracks after current one, they are played next in shuffle mode too
+        Q_INVOKABLE void insertTracksFromLibrary(const unplayer::TrackList& libraryTracks);
+        Q_INVOKABLE void insertTrackFromLibrary(const unplayer::LibraryTrack& libraryTrack);
+
+        // Replaces queue with all library tracks in random order, optionally only tracks
+        // of artist and/or genre. Only track ids are loaded from database at first,
+        // metadata is loaded for batches of them while they are added
+        Q_INVOKABLE void addShuffledLibraryTracks(const QString& artist = QString(), const QString& genre = QString());
+
+        // Moves tracks from first to last before track at destination, like QAbstractItemModel::moveRows()
+        Q_INVOKABLE void moveTracks(int first, int last, int destination);
+        // Moved tracks are played next in shuffle mode too
+        Q_INVOKABLE void moveTrackAfterCurrent(int index);
+        void moveTracksAfterCurrent(int first, int last);
 
         Q_INVOKABLE unplayer::LibraryTrack getTrack(int index);
-        Q_INVOKABLE std::vector<unplayer::LibraryTrack> getTracks(const std::vector<int>& indexes);
+        Q_INVOKABLE unplayer::TrackList getTracks(const std::vector<int>& indexes);
 
         Q_INVOKABLE void removeTrack(int index);
+        // Removes track if it is still in queue
+        void removeTrackWithId(const QString& trackId);
         Q_INVOKABLE void removeTracks(std::vector<int> indexes);
         Q_INVOKABLE void clear(bool emitAbout = true);
 
         Q_INVOKABLE void next();
         void nextOnEos();
+        // Index of track that nextOnEos() will set as current, or -1 if playback
+        // will stop or shuffle order will be reset
+        int nextIndexOnEos() const;
+        // Indexes of at most count tracks that will be played after current one,
+        // in order. Empty when current track is repeated
+        std::vector<int> upcomingIndexes(int count) const;
         Q_INVOKABLE void previous();
 
         Q_INVOKABLE void setCurrentToFirstIfNeeded();
-        Q_INVOKABLE void resetNotPlayedTracks();
+        // Shuffles all tracks, current track becomes first
+        Q_INVOKABLE void resetShuffleOrder();
+
+        // Saves tracks, current index and shuffle order to binary file.
+        // Changes made after that are appended to journal, which is replayed on restore
+        void saveSnapshot();
+        // Restores queue saved by saveSnapshot(). Tracks are added immediately,
+        // their files are checked in background. Returns false if there is no valid snapshot
+        bool restoreSnapshot();
+
+        // Player position from journal, -1 if it was not written after last snapshot
+        long long restoredPlayerPosition() const;
+        void writePlayerPosition(long long position);
 
     private:
         void reset();
 
-        void addingTracksCallback(std::vector<std::shared_ptr<QueueTrack>>&& tracks, int setAsCurrent, const QUrl& setAsCurrentUrl);
+        void addToShuffleOrder(int firstIndex);
+        // Shifts indexes of tracks after first and puts inserted tracks after current one
+        void insertToShuffleOrder(int first, int count);
+        void removeFromShuffleOrder(const std::vector<int>& indexes);
+        void moveToShuffleFront(int index);
+
+        void addToStatistics(const QueueTrack& track);
+        void removeFromStatistics(const QueueTrack& track);
+
+        // Appends batch of tracks while they are being added. firstIndex is index of
+        // first track of the whole addition, setAsCurrent is relative to it
+        void addTracksBatch(std::vector<std::shared_ptr<QueueTrack>>&& tracks, int firstIndex, int setAsCurrent, const QUrl& setAsCurrentUrl);
+        void addTracksJob(const std::function<void(int job)>& start, bool clearQueue);
+        void startAddingTracks(int job);
+        void startAddingTracksFromUrls(int job, const QStringList& trackUrls, bool clearQueue, int setAsCurrent);
+        void startAddingTracksFromLibrary(int job, const unplayer::TrackList& libraryTracks, bool clearQueue, int setAsCurrent);
+        void startAddingShuffledLibraryTracks(int job, const QString& artist, const QString& genre);
+        void finishAddingTracks();
+
+        void removeTrackMediaArt(const QueueTrack* track);
+        QString mediaArtUrl(const QueueTrack* track) const;
+        // Indexes of tracks that next() and previous() would make current
+        std::vector<int> neighbourIndexes() const;
+
+        // Truncates journal and writes its header if append is false
+        void openJournal(bool append);
+        // Appends to journal after restoring snapshot, records is number of replayed records
+        // or -1 if journal doesn't belong to snapshot
+        void continueJournal(int records);
+        void writeJournalRecord(QueueJournalRecord type, const std::function<void(QDataStream&)>& writePayload = {});
+
+        // Updates media art of library tracks in background, only of tracks
+        // which album contains given one if it is not null
+        void updateMediaArt(const QString& album = QString());
+
+        // Removes tracks whose files don't exist anymore, in background.
+        // Pairs are track ids and file paths
+        void removeMissingTracks(std::vector<std::pair<QString, QString>>&& tracks);
+
+        // Replaces tracks with the same ids, tracks without replacement are removed
+        void replaceTracks(std::vector<std::pair<QString, std::shared_ptr<QueueTrack>>>&& tracks);
 
     private:
         std::vector<std::shared_ptr<QueueTrack>> mTracks;
-        std::vector<const QueueTrack*> mNotPlayedTracks;
+
+        // Tracks indexes in shuffle order and position of each track in it,
+        // empty when shuffle is disabled
+        std::vector<int> mShuffleOrder;
+        std::vector<int> mShufflePositions;
+        // Used instead of new permutation when tracks are added to empty queue,
+        // if number of tracks matches
+        std::vector<int> mRestoredShuffleOrder;
+
+        // Tracks with embedded media art, accessed from QueueImageProvider threads
+        mutable QMutex mTracksMediaArtMutex;
+        std::unordered_map<QString, QByteArray> mTracksMediaArt;
+        // File paths of tracks with unloaded media art
+        std::unordered_map<QString, QString> mUnloadedMediaArt;
+
+        // Updated when tracks are added, removed or replaced instead of
+        // iterating over all tracks when they are read
+        int mTotalDuration;
+        int mLocalTracksCount;
+        // Sums of durations of tracks before each position in play order. They are rebuilt
+        // when remainingDuration() is read after play order has changed, and extended
+        // when tracks are appended without shuffle
+        mutable std::vector<int> mPlayOrderDurations;
+        mutable bool mPlayOrderDurationsValid;
 
         int mCurrentIndex;
         bool mShuffle;
         RepeatMode mRepeatMode;
 
         bool mAddingTracks;
+        // Running job of JobManager, 0 when tracks are restored from snapshot
+        int mAddingTracksJob;
+
+        bool mUpdatingMediaArt;
+        bool mMediaArtUpdateQueued;
+
+        QFile mJournal;
+        quint32 mJournalId;
+        int mJournalRecords;
+        long long mRestoredPlayerPosition;
     signals:
         void currentTrackChanged();
 
@@ -152,25 +335,72 @@ namespace unplayer
         void tracksAboutToBeAdded(int count);
         void tracksAdded();
 
-        void trackAboutToBeRemoved(int index);
-        void trackRemoved();
+        void tracksAboutToBeInserted(int first, int last);
+        void tracksInserted();
+
+        void tracksAboutToBeMoved(int first, int last, int destination);
+        void tracksMoved();
+
+        void trackChanged(int index);
+
+        // Emitted for each contiguous range of removed tracks
+        void tracksAboutToBeRemoved(int first, int last);
+        void tracksRemoved();
 
         void aboutToBeCleared();
         void cleared();
 
         void addingTracksChanged();
+
+        void statisticsChanged();
     };
 
-    class QueueImageProvider final : public QQuickImageProvider
+    // Decodes and scales images on its own thread pool and keeps
+    // recently requested images in memory
+    class QueueImageProvider final : public QQuickAsyncImageProvider
     {
     public:
         static const QString providerId;
+        // Provider added to QML engine, or nullptr
+        static QueueImageProvider* instance();
+
         explicit QueueImageProvider(const Queue* queue);
+        ~QueueImageProvider() override;
         QueueImageProvider(const QueueImageProvider& other) = delete;
         QueueImageProvider& operator=(const QueueImageProvider& other) = delete;
-        QPixmap requestPixmap(const QString& id, QSize*, const QSize& requestedSize) override;
+        QQuickImageResponse* requestImageResponse(const QString& id, const QSize& requestedSize) override;
+
+        // Thread-safe
+        QImage image(const QString& id, const QSize& requestedSize);
+        // Decodes image with lower priority than requests from QML if it is not in memory yet
+        void prefetch(const QString& id, const QSize& requestedSize);
+        // Drops least recently used images, all of them on critical memory level
+        void trimCache(MemoryPressure::Level level);
+
+        struct CacheStatistics
+        {
+            int images;
+            int bytes;
+            qint64 hits;
+            qint64 misses;
+        };
+        CacheStatistics cacheStatistics();
+
     private:
+        // Must be called with mCacheMutex locked
+        void evict(int maxSize);
+
         const Queue* mQueue;
+        QThreadPool mThreadPool;
+
+        // Most recently used images are at the front
+        using CacheList = std::list<std::pair<QString, QImage>>;
+        QMutex mCacheMutex;
+        CacheList mCache;
+        std::unordered_map<QString, CacheList::iterator> mCacheIndex;
+        int mCacheSize;
+        qint64 mCacheHits;
+        qint64 mCacheMisses;
     };
 }
 
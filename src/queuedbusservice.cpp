@@ -0,0 +1,230 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "queuedbusservice.h"
+
+#include <algorithm>
+
+#include <unistd.h>
+
+#include <QDBusConnection>
+#include <QDBusError>
+#include <QDebug>
+#include <QFile>
+#include <QFutureWatcher>
+#include <QTextStream>
+
+#include "queue.h"
+#include "threadpools.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        const QLatin1String objectPath("/org/equeim/unplayer/queue");
+
+        // Takes ownership of fd
+        QStringList readTracks(int fd)
+        {
+            QStringList tracks;
+            QFile file;
+            if (!file.open(fd, QIODevice::ReadOnly, QFileDevice::AutoCloseHandle)) {
+                qWarning() << "failed to open file descriptor" << file.errorString();
+                close(fd);
+                return tracks;
+            }
+            QTextStream stream(&file);
+            stream.setCodec("UTF-8");
+            QString line;
+            while (stream.readLineInto(&line)) {
+                if (!line.isEmpty()) {
+                    tracks.push_back(line);
+                }
+            }
+            return tracks;
+        }
+    }
+
+    QueueDBusService::QueueDBusService(Queue* queue, QObject* parent)
+        : QObject(parent),
+          mQueue(queue),
+          mLastJobId(0),
+          mRunningJobId(0),
+          mRunningJobMode(Mode::Append),
+          mRunningJobFirstIndex(0)
+    {
+        QObject::connect(mQueue, &Queue::tracksAdded, this, [=]() {
+            if (mRunningJobId != 0) {
+                emit jobProgress(mRunningJobId, mQueue->tracks().size() - mRunningJobFirstIndex);
+            }
+        });
+        QObject::connect(mQueue, &Queue::addingTracksChanged, this, &QueueDBusService::onAddingTracksChanged);
+
+        if (!QDBusConnection::sessionBus().registerObject(objectPath, this, QDBusConnection::ExportAllSlots | QDBusConnection::ExportAllSignals)) {
+            qWarning() << "failed to register queue D-Bus object" << QDBusConnection::sessionBus().lastError();
+        }
+    }
+
+    uint QueueDBusService::createJob(const QString& mode)
+    {
+        Job job{Mode::Append, QStringList(), 0, false};
+        if (mode == QLatin1String("playNext")) {
+            job.mode = Mode::PlayNext;
+        } else if (mode == QLatin1String("replace")) {
+            job.mode = Mode::Replace;
+        } else if (mode != QLatin1String("append")) {
+            qWarning() << "invalid queue job mode" << mode;
+            return 0;
+        }
+
+        ++mLastJobId;
+        if (mLastJobId == 0) {
+            ++mLastJobId;
+        }
+        mJobs.insert({mLastJobId, std::move(job)});
+        return mLastJobId;
+    }
+
+    bool QueueDBusService::addTracks(uint jobId, const QStringList& tracks)
+    {
+        Job* job = uncommittedJob(jobId);
+        if (!job) {
+            return false;
+        }
+        job->tracks.append(tracks);
+        return true;
+    }
+
+    bool QueueDBusService::addTracksFromFile(uint jobId, const QDBusUnixFileDescriptor& fd)
+    {
+        Job* job = uncommittedJob(jobId);
+        if (!job || !fd.isValid()) {
+            return false;
+        }
+
+        // QDBusUnixFileDescriptor closes its descriptor
+        const int ownFd = dup(fd.fileDescriptor());
+        if (ownFd == -1) {
+            qWarning() << "failed to duplicate file descriptor";
+            return false;
+        }
+
+        ++job->pendingFiles;
+        auto watcher = new QFutureWatcher<QStringList>(this);
+        QObject::connect(watcher, &QFutureWatcher<QStringList>::finished, this, [=]() {
+            const auto found(mJobs.find(jobId));
+            // Job may be cancelled
+            if (found != mJobs.end()) {
+                Job& job = found->second;
+                job.tracks.append(watcher->result());
+                --job.pendingFiles;
+                if (job.committed && job.pendingFiles == 0) {
+                    startNextJob();
+                }
+            }
+            watcher->deleteLater();
+        });
+        watcher->setFuture(threadpools::run(threadpools::JobClass::Bulk, [ownFd]() {
+            return readTracks(ownFd);
+        }));
+
+        return true;
+    }
+
+    bool QueueDBusService::commitJob(uint jobId)
+    {
+        Job* job = uncommittedJob(jobId);
+        if (!job) {
+            return false;
+        }
+        job->committed = true;
+        mCommittedJobs.push_back(jobId);
+        startNextJob();
+        return true;
+    }
+
+    void QueueDBusService::cancelJob(uint jobId)
+    {
+        // Running job can't be cancelled, its tracks are being added already
+        if (jobId == mRunningJobId) {
+            return;
+        }
+        if (mJobs.erase(jobId) > 0) {
+            const auto found(std::find(mCommittedJobs.begin(), mCommittedJobs.end(), jobId));
+            if (found != mCommittedJobs.end()) {
+                mCommittedJobs.erase(found);
+            }
+            emit jobFinished(jobId, -1);
+            startNextJob();
+        }
+    }
+
+    QueueDBusService::Job* QueueDBusService::uncommittedJob(uint jobId)
+    {
+        const auto found(mJobs.find(jobId));
+        if (found == mJobs.end() || found->second.committed) {
+            return nullptr;
+        }
+        return &found->second;
+    }
+
+    void QueueDBusService::startNextJob()
+    {
+        // Queue adds tracks from one source at a time
+        while (mRunningJobId == 0 && !mCommittedJobs.empty() && !mQueue->isAddingTracks()) {
+            const uint jobId = mCommittedJobs.front();
+            const auto found(mJobs.find(jobId));
+            if (found->second.pendingFiles > 0) {
+                return;
+            }
+            mCommittedJobs.pop_front();
+
+            const Job job(std::move(found->second));
+            mJobs.erase(found);
+
+            if (job.tracks.isEmpty()) {
+                emit jobFinished(jobId, 0);
+                continue;
+            }
+
+            mRunningJobId = jobId;
+            mRunningJobMode = job.mode;
+            mRunningJobFirstIndex = (job.mode == Mode::Replace) ? 0 : mQueue->tracks().size();
+            mQueue->addTracksFromUrls(job.tracks, job.mode == Mode::Replace);
+        }
+    }
+
+    void QueueDBusService::onAddingTracksChanged()
+    {
+        if (mQueue->isAddingTracks()) {
+            return;
+        }
+
+        if (mRunningJobId != 0) {
+            const int count = mQueue->tracks().size();
+            if (mRunningJobMode == Mode::PlayNext && count > mRunningJobFirstIndex) {
+                mQueue->moveTracksAfterCurrent(mRunningJobFirstIndex, count - 1);
+            }
+            const uint jobId = mRunningJobId;
+            mRunningJobId = 0;
+            emit jobFinished(jobId, count - mRunningJobFirstIndex);
+        }
+
+        startNextJob();
+    }
+}
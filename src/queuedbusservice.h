@@ -0,0 +1,91 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_QUEUEDBUSSERVICE_H
+#define UNPLAYER_QUEUEDBUSSERVICE_H
+
+#include <deque>
+#include <unordered_map>
+
+#include <QDBusUnixFileDescriptor>
+#include <QObject>
+#include <QStringList>
+
+namespace unplayer
+{
+    class Queue;
+
+    // org.equeim.unplayer.Queue interface on /org/equeim/unplayer/queue.
+    // Tracks are submitted to a job in chunks or as file descriptor with newline
+    // separated paths or URLs, so that large lists don't hit message size limits.
+    // Calls return immediately, jobs are added to queue one after another
+    class QueueDBusService final : public QObject
+    {
+        Q_OBJECT
+        Q_CLASSINFO("D-Bus Interface", "org.equeim.unplayer.Queue")
+    public:
+        explicit QueueDBusService(Queue* queue, QObject* parent);
+
+    public slots:
+        // mode is "append", "playNext" or "replace". Returns job id, 0 if mode is invalid
+        uint createJob(const QString& mode);
+        // Return false if job doesn't exist or was already committed
+        bool addTracks(uint jobId, const QStringList& tracks);
+        bool addTracksFromFile(uint jobId, const QDBusUnixFileDescriptor& fd);
+        // Job is started when its files are read and previous jobs are finished
+        bool commitJob(uint jobId);
+        void cancelJob(uint jobId);
+
+    private:
+        enum class Mode
+        {
+            Append,
+            PlayNext,
+            Replace
+        };
+
+        struct Job
+        {
+            Mode mode;
+            QStringList tracks;
+            int pendingFiles;
+            bool committed;
+        };
+
+        Job* uncommittedJob(uint jobId);
+        void startNextJob();
+        void onAddingTracksChanged();
+
+        Queue* mQueue;
+
+        std::unordered_map<uint, Job> mJobs;
+        uint mLastJobId;
+        // Committed jobs in order
+        std::deque<uint> mCommittedJobs;
+
+        uint mRunningJobId;
+        Mode mRunningJobMode;
+        int mRunningJobFirstIndex;
+    signals:
+        void jobProgress(uint jobId, int addedTracks);
+        // addedTracks is -1 if job was cancelled
+        void jobFinished(uint jobId, int addedTracks);
+    };
+}
+
+#endif // UNPLAYER_QUEUEDBUSSERVICE_H
@@ -30,11 +30,11 @@ namespace unplayer
 
         switch (role) {
         case UrlRole:
-            return track->url;
+            return track->url();
         case IsLocalFileRole:
-            return track->url.isLocalFile();
+            return track->isLocalFile();
         case FilePathRole:
-            return track->url.path();
+            return track->filePath;
         case TitleRole:
             return track->title;
         case ArtistRole:
@@ -70,19 +70,40 @@ namespace unplayer
         mQueue = queue;
 
         QObject::connect(mQueue, &Queue::tracksAboutToBeAdded, this, [=](int count) {
-            const int fisrt = rowCount();
-            beginInsertRows(QModelIndex(), fisrt, fisrt + count);
+            const int first = rowCount();
+            beginInsertRows(QModelIndex(), first, first + count - 1);
         });
 
         QObject::connect(mQueue, &Queue::tracksAdded, this, [=]() {
             endInsertRows();
         });
 
-        QObject::connect(mQueue, &Queue::trackAboutToBeRemoved, this, [=](int index) {
-            beginRemoveRows(QModelIndex(), index, index);
+        QObject::connect(mQueue, &Queue::tracksAboutToBeInserted, this, [=](int first, int last) {
+            beginInsertRows(QModelIndex(), first, last);
         });
 
-        QObject::connect(mQueue, &Queue::trackRemoved, this, [=]() {
+        QObject::connect(mQueue, &Queue::tracksInserted, this, [=]() {
+            endInsertRows();
+        });
+
+        QObject::connect(mQueue, &Queue::tracksAboutToBeMoved, this, [=](int first, int last, int destination) {
+            beginMoveRows(QModelIndex(), first, last, QModelIndex(), destination);
+        });
+
+        QObject::connect(mQueue, &Queue::tracksMoved, this, [=]() {
+            endMoveRows();
+        });
+
+        QObject::connect(mQueue, &Queue::trackChanged, this, [=](int index) {
+            const QModelIndex modelIndex(this->index(index));
+            emit dataChanged(modelIndex, modelIndex);
+        });
+
+        QObject::connect(mQueue, &Queue::tracksAboutToBeRemoved, this, [=](int first, int last) {
+            beginRemoveRows(QModelIndex(), first, last);
+        });
+
+        QObject::connect(mQueue, &Queue::tracksRemoved, this, [=]() {
             endRemoveRows();
         });
 
@@ -0,0 +1,125 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "recentlyaddedalbumsmodel.h"
+
+#include <QColor>
+#include <QCoreApplication>
+
+#include "artimageprovider.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        enum Field
+        {
+            AddedTimeField,
+            RowIdField,
+            ArtistField,
+            AlbumField,
+            YearField,
+            TracksCountField,
+            DurationField,
+            MediaArtField,
+            MediaArtPlaceholderField
+        };
+
+        // Rows are not sorted in memory, sort keys are not loaded
+        Album albumFromQuery(const QSqlQuery& query)
+        {
+            const QString artist(query.value(ArtistField).toString());
+            const QString album(query.value(AlbumField).toString());
+            const QVariant year(query.value(YearField));
+            return {artist,
+                    artist.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : artist,
+                    album,
+                    album.isEmpty() ? qApp->translate("unplayer", "Unknown album") : album,
+                    year.toInt(),
+                    query.value(TracksCountField).toInt(),
+                    query.value(DurationField).toInt(),
+                    query.value(MediaArtField).toString(),
+                    query.value(MediaArtPlaceholderField).toUInt(),
+                    QByteArray(),
+                    QByteArray(),
+                    LibraryUtils::intSortKey(year)};
+        }
+    }
+
+    // Album appears once for each of its artists, like in AlbumsModel
+    RecentlyAddedAlbumsModel::RecentlyAddedAlbumsModel(QObject* parent)
+        : RecentlyAddedModel(QLatin1String("album_summary"),
+                             QLatin1String("SELECT album_summary.addedTime, album_summary.rowid, artists.title, albums.title, "
+                                           "year, tracksCount, duration, mediaArt, COALESCE(thumbnails.placeholder, 0) FROM album_summary "
+                                           "JOIN albums ON albums.id = album_summary.albumId "
+                                           "JOIN artists ON artists.id = album_summary.artistId "
+                                           "LEFT JOIN thumbnails ON thumbnails.url = album_summary.mediaArt "
+                                           "%1 ORDER BY album_summary.addedTime DESC, album_summary.rowid DESC LIMIT ?"),
+                             albumFromQuery,
+                             parent)
+    {
+
+    }
+
+    QVariant RecentlyAddedAlbumsModel::data(const QModelIndex& index, int role) const
+    {
+        const Album& album = mRows[index.row()];
+        switch (role) {
+        case AlbumsModel::ArtistRole:
+            return album.artist;
+        case AlbumsModel::DisplayedArtistRole:
+            return album.displayedArtist;
+        case AlbumsModel::UnknownArtistRole:
+            return album.artist.isEmpty();
+        case AlbumsModel::AlbumRole:
+            return album.album;
+        case AlbumsModel::DisplayedAlbumRole:
+            return album.displayedAlbum;
+        case AlbumsModel::UnknownAlbumRole:
+            return album.album.isEmpty();
+        case AlbumsModel::YearRole:
+            return album.year;
+        case AlbumsModel::TracksCountRole:
+            return album.tracksCount;
+        case AlbumsModel::DurationRole:
+            return album.duration;
+        case AlbumsModel::MediaArtRole:
+            return ArtImageProvider::url(album.mediaArt);
+        case AlbumsModel::MediaArtPlaceholderRole:
+            return QColor::fromRgba(album.mediaArtPlaceholder);
+        default:
+            return QVariant();
+        }
+    }
+
+    QHash<int, QByteArray> RecentlyAddedAlbumsModel::roleNames() const
+    {
+        return {{AlbumsModel::ArtistRole, "artist"},
+                {AlbumsModel::DisplayedArtistRole, "displayedArtist"},
+                {AlbumsModel::UnknownArtistRole, "unknownArtist"},
+                {AlbumsModel::AlbumRole, "album"},
+                {AlbumsModel::DisplayedAlbumRole, "displayedAlbum"},
+                {AlbumsModel::UnknownAlbumRole, "unknownAlbum"},
+                {AlbumsModel::YearRole, "year"},
+                {AlbumsModel::TracksCountRole, "tracksCount"},
+                {AlbumsModel::DurationRole, "duration"},
+                {AlbumsModel::MediaArtRole, "mediaArt"},
+                {AlbumsModel::MediaArtPlaceholderRole, "mediaArtPlaceholder"}};
+    }
+}
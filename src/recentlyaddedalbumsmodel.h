@@ -0,0 +1,43 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_RECENTLYADDEDALBUMSMODEL_H
+#define UNPLAYER_RECENTLYADDEDALBUMSMODEL_H
+
+#include "albumsmodel.h"
+#include "recentlyaddedmodel.h"
+
+namespace unplayer
+{
+    // Albums in order of their newest tracks, newest first.
+    // Roles are the same as in AlbumsModel
+    class RecentlyAddedAlbumsModel final : public RecentlyAddedModel<Album>
+    {
+        Q_OBJECT
+    public:
+        explicit RecentlyAddedAlbumsModel(QObject* parent = nullptr);
+
+        QVariant data(const QModelIndex& index, int role) const override;
+
+    protected:
+        QHash<int, QByteArray> roleNames() const override;
+    };
+}
+
+#endif // UNPLAYER_RECENTLYADDEDALBUMSMODEL_H
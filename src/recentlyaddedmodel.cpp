@@ -0,0 +1,55 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "recentlyaddedmodel.h"
+
+namespace unplayer
+{
+    const int AbstractRecentlyAddedModel::pageSize;
+
+    bool AbstractRecentlyAddedModel::isLoading() const
+    {
+        return mLoading;
+    }
+
+    AbstractRecentlyAddedModel::AbstractRecentlyAddedModel(QObject* parent)
+        : QAbstractListModel(parent),
+          mLoading(false)
+    {
+
+    }
+
+    QString AbstractRecentlyAddedModel::pageQueryString(const QString& queryString, const QString& table, bool first)
+    {
+        if (first) {
+            return queryString.arg(QString());
+        }
+        // Row values comparison is not used since it's not supported by older SQLite versions.
+        // Index range is bounded by the first term, the second one skips rows with the same time
+        return queryString.arg(QString::fromLatin1("WHERE %1.addedTime <= ? AND (%1.addedTime < ? OR %1.rowid < ?)").arg(table));
+    }
+
+    void AbstractRecentlyAddedModel::setLoading(bool loading)
+    {
+        if (loading != mLoading) {
+            mLoading = loading;
+            emit loadingChanged();
+        }
+    }
+}
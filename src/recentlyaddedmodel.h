@@ -0,0 +1,210 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_RECENTLYADDEDMODEL_H
+#define UNPLAYER_RECENTLYADDEDMODEL_H
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#include <QAbstractListModel>
+#include <QDebug>
+#include <QFutureWatcher>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include "latestload.h"
+#include "libraryutils.h"
+#include "sqlquery.h"
+#include "threadpools.h"
+
+namespace unplayer
+{
+    // Non-template part of RecentlyAddedModel
+    class AbstractRecentlyAddedModel : public QAbstractListModel
+    {
+        Q_OBJECT
+        Q_PROPERTY(bool loading READ isLoading NOTIFY loadingChanged)
+    public:
+        bool isLoading() const;
+
+    protected:
+        explicit AbstractRecentlyAddedModel(QObject* parent = nullptr);
+
+        static const int pageSize = 100;
+
+        // Position of last loaded row in order of added time
+        struct Cursor
+        {
+            long long addedTime;
+            long long rowId;
+        };
+
+        // Replaces %1 in query string with condition on table that selects rows
+        // after cursor, or removes it for the first page
+        static QString pageQueryString(const QString& queryString, const QString& table, bool first);
+
+        void setLoading(bool loading);
+
+    private:
+        bool mLoading;
+
+    signals:
+        void loadingChanged();
+    };
+
+    // Model of newest rows of indexed table, loaded by pages when view scrolls to the end.
+    // Pages are selected with keyset condition on (addedTime, rowid) instead of OFFSET,
+    // so each one is read by index range scan on added time regardless of library size
+    template<typename Row>
+    class RecentlyAddedModel : public AbstractRecentlyAddedModel
+    {
+    public:
+        int rowCount(const QModelIndex& parent = QModelIndex()) const override
+        {
+            return parent.isValid() ? 0 : static_cast<int>(mRows.size());
+        }
+
+        bool canFetchMore(const QModelIndex& parent) const override
+        {
+            return !parent.isValid() && !mAtEnd && !mLoad.isRunning();
+        }
+
+        void fetchMore(const QModelIndex& parent) override
+        {
+            if (canFetchMore(parent)) {
+                loadPage(false, pageSize);
+            }
+        }
+
+    protected:
+        using RowFromQuery = Row (*)(const QSqlQuery& query);
+
+        // queryString selects addedTime and rowid of table as first two columns, has %1
+        // in place of WHERE clause, and ends with "ORDER BY addedTime DESC, rowid DESC LIMIT ?"
+        explicit RecentlyAddedModel(const QString& table, const QString& queryString, RowFromQuery rowFromQuery, QObject* parent = nullptr)
+            : AbstractRecentlyAddedModel(parent),
+              mTable(table),
+              mQueryString(queryString),
+              mRowFromQuery(rowFromQuery),
+              mCursor{0, 0},
+              mAtEnd(false),
+              mLoad(this)
+        {
+            if (LibraryUtils::instance()->isDatabaseInitialized()) {
+                reload();
+            }
+            QObject::connect(LibraryUtils::instance(), &LibraryUtils::databaseInitializedChanged, this, [this]() {
+                if (LibraryUtils::instance()->isDatabaseInitialized()) {
+                    reload();
+                }
+            });
+            // New tracks are at the top, so already loaded rows are replaced
+            QObject::connect(LibraryUtils::instance(), &LibraryUtils::libraryChanged, this, [this]() {
+                reload();
+            });
+        }
+
+        // Loads as many newest rows as there are now, at least one page
+        void reload()
+        {
+            loadPage(true, std::max(static_cast<int>(mRows.size()), static_cast<int>(pageSize)));
+        }
+
+        std::vector<Row> mRows;
+
+    private:
+        struct Page
+        {
+            std::vector<Row> rows;
+            Cursor cursor;
+        };
+
+        void loadPage(bool first, int count)
+        {
+            const QString queryString(pageQueryString(mQueryString, mTable, first));
+            const Cursor cursor(mCursor);
+            const RowFromQuery rowFromQuery = mRowFromQuery;
+
+            auto future = threadpools::run(threadpools::JobClass::Interactive, [=]() -> Page {
+                Page page{{}, cursor};
+                const QSqlDatabase db(LibraryUtils::readDatabase());
+                if (!db.isOpen()) {
+                    return page;
+                }
+
+                SqlQuery query(db);
+                query.prepareCached(queryString);
+                if (!first) {
+                    query.addBindValue(cursor.addedTime);
+                    query.addBindValue(cursor.addedTime);
+                    query.addBindValue(cursor.rowId);
+                }
+                query.addBindValue(count);
+                LibraryUtils::explainQuery(query, db);
+                if (!query.exec()) {
+                    qWarning() << "failed to query recently added rows" << query.lastError();
+                    return page;
+                }
+
+                page.rows.reserve(count);
+                while (query.next()) {
+                    page.cursor = {query.value(0).toLongLong(), query.value(1).toLongLong()};
+                    page.rows.push_back(rowFromQuery(query));
+                }
+                return page;
+            });
+
+            using Watcher = QFutureWatcher<Page>;
+            auto watcher = new Watcher(this);
+            const int generation = mLoad.start(watcher);
+            setLoading(true);
+            QObject::connect(watcher, &Watcher::finished, this, [=]() {
+                mLoad.finish(generation);
+                watcher->deleteLater();
+
+                Page page(watcher->result());
+                mAtEnd = (static_cast<int>(page.rows.size()) < count);
+                mCursor = page.cursor;
+                if (first) {
+                    beginResetModel();
+                    mRows = std::move(page.rows);
+                    endResetModel();
+                } else if (!page.rows.empty()) {
+                    beginInsertRows(QModelIndex(), mRows.size(), mRows.size() + page.rows.size() - 1);
+                    mRows.insert(mRows.end(), std::make_move_iterator(page.rows.begin()), std::make_move_iterator(page.rows.end()));
+                    endInsertRows();
+                }
+                setLoading(false);
+            });
+            watcher->setFuture(future);
+        }
+
+        const QString mTable;
+        const QString mQueryString;
+        const RowFromQuery mRowFromQuery;
+        Cursor mCursor;
+        bool mAtEnd;
+        LatestLoad mLoad;
+    };
+}
+
+#endif // UNPLAYER_RECENTLYADDEDMODEL_H
@@ -0,0 +1,101 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "recentlyaddedtracksmodel.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        enum Field
+        {
+            AddedTimeField,
+            RowIdField,
+            FilePathField,
+            TitleField,
+            DurationField,
+            MediaArtField,
+            ArtistField,
+            AlbumField
+        };
+
+        LibraryTrack trackFromQuery(const QSqlQuery& query)
+        {
+            return {query.value(FilePathField).toString(),
+                    query.value(TitleField).toString(),
+                    query.value(ArtistField).toString(),
+                    query.value(AlbumField).toString(),
+                    query.value(DurationField).toInt(),
+                    query.value(MediaArtField).toString()};
+        }
+    }
+
+    // Track is shown once with all its artists and albums
+    RecentlyAddedTracksModel::RecentlyAddedTracksModel(QObject* parent)
+        : RecentlyAddedModel(QLatin1String("tracks"),
+                             QLatin1String("SELECT addedTime, id, filePath, title, duration, mediaArt, "
+                                           "(SELECT group_concat(artists.title, ', ') FROM tracks_artists "
+                                           " JOIN artists ON artists.id = tracks_artists.artistId WHERE tracks_artists.trackId = tracks.id), "
+                                           "(SELECT group_concat(albums.title, ', ') FROM tracks_albums "
+                                           " JOIN albums ON albums.id = tracks_albums.albumId WHERE tracks_albums.trackId = tracks.id) "
+                                           "FROM tracks %1 ORDER BY addedTime DESC, id DESC LIMIT ?"),
+                             trackFromQuery,
+                             parent)
+    {
+
+    }
+
+    QVariant RecentlyAddedTracksModel::data(const QModelIndex& index, int role) const
+    {
+        const LibraryTrack& track = mRows[index.row()];
+        switch (role) {
+        case FilePathRole:
+            return track.filePath;
+        case TitleRole:
+            return track.title;
+        case ArtistRole:
+            return track.artist;
+        case AlbumRole:
+            return track.album;
+        case DurationRole:
+            return track.duration;
+        default:
+            return QVariant();
+        }
+    }
+
+    TrackList RecentlyAddedTracksModel::getTracks() const
+    {
+        return TrackList(std::vector<LibraryTrack>(mRows));
+    }
+
+    LibraryTrack RecentlyAddedTracksModel::getTrack(int index) const
+    {
+        return mRows[index];
+    }
+
+    QHash<int, QByteArray> RecentlyAddedTracksModel::roleNames() const
+    {
+        return {{FilePathRole, "filePath"},
+                {TitleRole, "title"},
+                {ArtistRole, "artist"},
+                {AlbumRole, "album"},
+                {DurationRole, "duration"}};
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_RECENTLYADDEDTRACKSMODEL_H
+#define UNPLAYER_RECENTLYADDEDTRACKSMODEL_H
+
+#include "librarytrack.h"
+#include "recentlyaddedmodel.h"
+#include "tracklist.h"
+
+namespace unplayer
+{
+    // Tracks in order they were added to library, newest first
+    class RecentlyAddedTracksModel final : public RecentlyAddedModel<LibraryTrack>
+    {
+        Q_OBJECT
+    public:
+        enum Role
+        {
+            FilePathRole = Qt::UserRole,
+            TitleRole,
+            ArtistRole,
+            AlbumRole,
+            DurationRole
+        };
+        Q_ENUM(Role)
+
+        explicit RecentlyAddedTracksModel(QObject* parent = nullptr);
+
+        QVariant data(const QModelIndex& index, int role) const override;
+
+        // All loaded tracks
+        Q_INVOKABLE unplayer::TrackList getTracks() const;
+        Q_INVOKABLE unplayer::LibraryTrack getTrack(int index) const;
+
+    protected:
+        QHash<int, QByteArray> roleNames() const override;
+    };
+}
+
+#endif // UNPLAYER_RECENTLYADDEDTRACKSMODEL_H
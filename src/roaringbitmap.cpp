@@ -0,0 +1,398 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "roaringbitmap.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include <QtAlgorithms>
+
+namespace unplayer
+{
+    namespace
+    {
+        const int maxArraySize = 4096;
+        const std::size_t bitsetSize = 65536 / 64;
+
+        // Binary search in larger array is faster than merging when arrays differ that much in size
+        const std::size_t gallopRatio = 32;
+
+        template<typename Function>
+        void forEachCommonValue(const std::vector<quint16>& first, const std::vector<quint16>& second, Function function)
+        {
+            const std::vector<quint16>& smaller = first.size() <= second.size() ? first : second;
+            const std::vector<quint16>& larger = first.size() <= second.size() ? second : first;
+            if (smaller.size() * gallopRatio < larger.size()) {
+                auto from = larger.begin();
+                for (quint16 value : smaller) {
+                    from = std::lower_bound(from, larger.end(), value);
+                    if (from == larger.end()) {
+                        break;
+                    }
+                    if (*from == value) {
+                        function(value);
+                    }
+                }
+                return;
+            }
+
+            auto i = first.begin();
+            auto j = second.begin();
+            while (i != first.end() && j != second.end()) {
+                if (*i < *j) {
+                    ++i;
+                } else if (*j < *i) {
+                    ++j;
+                } else {
+                    function(*i);
+                    ++i;
+                    ++j;
+                }
+            }
+        }
+
+        int bitsetCardinality(const std::vector<quint64>& bitset)
+        {
+            int cardinality = 0;
+            for (quint64 word : bitset) {
+                cardinality += static_cast<int>(qPopulationCount(word));
+            }
+            return cardinality;
+        }
+
+        inline void setBit(std::vector<quint64>& bitset, quint16 value)
+        {
+            bitset[value / 64] |= (quint64(1) << (value % 64));
+        }
+
+        inline bool testBit(const std::vector<quint64>& bitset, quint16 value)
+        {
+            return (bitset[value / 64] & (quint64(1) << (value % 64))) != 0;
+        }
+    }
+
+    RoaringBitmap RoaringBitmap::range(quint32 count)
+    {
+        RoaringBitmap bitmap;
+        for (quint32 value = 0; value < count; ++value) {
+            bitmap.append(value);
+        }
+        return bitmap;
+    }
+
+    RoaringBitmap RoaringBitmap::intersected(const RoaringBitmap& first, const RoaringBitmap& second)
+    {
+        RoaringBitmap result;
+        auto i = first.mContainers.begin();
+        auto j = second.mContainers.begin();
+        while (i != first.mContainers.end() && j != second.mContainers.end()) {
+            if (i->key < j->key) {
+                ++i;
+            } else if (j->key < i->key) {
+                ++j;
+            } else {
+                Container container(intersected(*i, *j));
+                if (container.cardinality != 0) {
+                    result.mContainers.push_back(std::move(container));
+                }
+                ++i;
+                ++j;
+            }
+        }
+        return result;
+    }
+
+    RoaringBitmap RoaringBitmap::united(const RoaringBitmap& first, const RoaringBitmap& second)
+    {
+        RoaringBitmap result;
+        auto i = first.mContainers.begin();
+        auto j = second.mContainers.begin();
+        while (i != first.mContainers.end() || j != second.mContainers.end()) {
+            if (j == second.mContainers.end() || (i != first.mContainers.end() && i->key < j->key)) {
+                result.mContainers.push_back(*i);
+                ++i;
+            } else if (i == first.mContainers.end() || j->key < i->key) {
+                result.mContainers.push_back(*j);
+                ++j;
+            } else {
+                result.mContainers.push_back(united(*i, *j));
+                ++i;
+                ++j;
+            }
+        }
+        return result;
+    }
+
+    RoaringBitmap RoaringBitmap::subtracted(const RoaringBitmap& first, const RoaringBitmap& second)
+    {
+        RoaringBitmap result;
+        auto j = second.mContainers.begin();
+        for (const Container& container : first.mContainers) {
+            while (j != second.mContainers.end() && j->key < container.key) {
+                ++j;
+            }
+            if (j == second.mContainers.end() || j->key != container.key) {
+                result.mContainers.push_back(container);
+                continue;
+            }
+            Container difference(subtracted(container, *j));
+            if (difference.cardinality != 0) {
+                result.mContainers.push_back(std::move(difference));
+            }
+        }
+        return result;
+    }
+
+    int RoaringBitmap::intersectionCount(const RoaringBitmap& first, const RoaringBitmap& second)
+    {
+        int count = 0;
+        auto i = first.mContainers.begin();
+        auto j = second.mContainers.begin();
+        while (i != first.mContainers.end() && j != second.mContainers.end()) {
+            if (i->key < j->key) {
+                ++i;
+            } else if (j->key < i->key) {
+                ++j;
+            } else {
+                count += intersectionCount(*i, *j);
+                ++i;
+                ++j;
+            }
+        }
+        return count;
+    }
+
+    void RoaringBitmap::append(quint32 value)
+    {
+        const auto key = static_cast<quint16>(value >> 16);
+        const auto low = static_cast<quint16>(value & 0xFFFF);
+        if (mContainers.empty() || mContainers.back().key != key) {
+            mContainers.push_back({key, 0, {}, {}});
+        }
+        Container& container = mContainers.back();
+        if (container.isBitset()) {
+            setBit(container.bitset, low);
+        } else {
+            container.array.push_back(low);
+        }
+        ++container.cardinality;
+        if (container.cardinality == maxArraySize + 1) {
+            container.optimize();
+        }
+    }
+
+    bool RoaringBitmap::contains(quint32 value) const
+    {
+        const auto key = static_cast<quint16>(value >> 16);
+        const auto found = std::lower_bound(mContainers.begin(), mContainers.end(), key, [](const Container& container, quint16 key) {
+            return container.key < key;
+        });
+        return found != mContainers.end() && found->key == key && found->contains(static_cast<quint16>(value & 0xFFFF));
+    }
+
+    bool RoaringBitmap::isEmpty() const
+    {
+        return mContainers.empty();
+    }
+
+    int RoaringBitmap::cardinality() const
+    {
+        int cardinality = 0;
+        for (const Container& container : mContainers) {
+            cardinality += container.cardinality;
+        }
+        return cardinality;
+    }
+
+    std::vector<quint32> RoaringBitmap::values() const
+    {
+        std::vector<quint32> values;
+        values.reserve(static_cast<std::size_t>(cardinality()));
+        for (const Container& container : mContainers) {
+            const quint32 high = quint32(container.key) << 16;
+            if (container.isBitset()) {
+                for (std::size_t word = 0; word < bitsetSize; ++word) {
+                    quint64 bits = container.bitset[word];
+                    while (bits != 0) {
+                        // Index of lowest set bit
+                        const quint32 bit = qPopulationCount((bits & (~bits + 1)) - 1);
+                        values.push_back(high | quint32(word * 64 + bit));
+                        bits &= bits - 1;
+                    }
+                }
+            } else {
+                for (quint16 low : container.array) {
+                    values.push_back(high | low);
+                }
+            }
+        }
+        return values;
+    }
+
+    std::size_t RoaringBitmap::memoryUsage() const
+    {
+        std::size_t size = sizeof(RoaringBitmap) + mContainers.capacity() * sizeof(Container);
+        for (const Container& container : mContainers) {
+            size += container.array.capacity() * sizeof(quint16) + container.bitset.capacity() * sizeof(quint64);
+        }
+        return size;
+    }
+
+    bool RoaringBitmap::Container::isBitset() const
+    {
+        return !bitset.empty();
+    }
+
+    bool RoaringBitmap::Container::contains(quint16 value) const
+    {
+        if (isBitset()) {
+            return testBit(bitset, value);
+        }
+        return std::binary_search(array.begin(), array.end(), value);
+    }
+
+    void RoaringBitmap::Container::optimize()
+    {
+        if (isBitset()) {
+            if (cardinality <= maxArraySize) {
+                array.reserve(static_cast<std::size_t>(cardinality));
+                for (int value = 0; value < 65536; ++value) {
+                    if (testBit(bitset, static_cast<quint16>(value))) {
+                        array.push_back(static_cast<quint16>(value));
+                    }
+                }
+                std::vector<quint64>().swap(bitset);
+            }
+        } else if (cardinality > maxArraySize) {
+            bitset.assign(bitsetSize, 0);
+            for (quint16 value : array) {
+                setBit(bitset, value);
+            }
+            std::vector<quint16>().swap(array);
+        }
+    }
+
+    RoaringBitmap::Container RoaringBitmap::intersected(const Container& first, const Container& second)
+    {
+        Container result{first.key, 0, {}, {}};
+        if (first.isBitset() && second.isBitset()) {
+            result.bitset.resize(bitsetSize);
+            for (std::size_t i = 0; i < bitsetSize; ++i) {
+                result.bitset[i] = first.bitset[i] & second.bitset[i];
+            }
+            result.cardinality = bitsetCardinality(result.bitset);
+            result.optimize();
+        } else if (first.isBitset() || second.isBitset()) {
+            const Container& array = first.isBitset() ? second : first;
+            const Container& bitset = first.isBitset() ? first : second;
+            for (quint16 value : array.array) {
+                if (testBit(bitset.bitset, value)) {
+                    result.array.push_back(value);
+                }
+            }
+            result.cardinality = static_cast<int>(result.array.size());
+        } else {
+            forEachCommonValue(first.array, second.array, [&](quint16 value) {
+                result.array.push_back(value);
+            });
+            result.cardinality = static_cast<int>(result.array.size());
+        }
+        return result;
+    }
+
+    RoaringBitmap::Container RoaringBitmap::united(const Container& first, const Container& second)
+    {
+        Container result{first.key, 0, {}, {}};
+        if (!first.isBitset() && !second.isBitset()) {
+            result.array.reserve(first.array.size() + second.array.size());
+            std::set_union(first.array.begin(), first.array.end(),
+                           second.array.begin(), second.array.end(),
+                           std::back_inserter(result.array));
+            result.cardinality = static_cast<int>(result.array.size());
+            result.optimize();
+            return result;
+        }
+
+        const Container& bitset = first.isBitset() ? first : second;
+        const Container& other = first.isBitset() ? second : first;
+        result.bitset = bitset.bitset;
+        if (other.isBitset()) {
+            for (std::size_t i = 0; i < bitsetSize; ++i) {
+                result.bitset[i] |= other.bitset[i];
+            }
+        } else {
+            for (quint16 value : other.array) {
+                setBit(result.bitset, value);
+            }
+        }
+        result.cardinality = bitsetCardinality(result.bitset);
+        return result;
+    }
+
+    RoaringBitmap::Container RoaringBitmap::subtracted(const Container& first, const Container& second)
+    {
+        Container result{first.key, 0, {}, {}};
+        if (first.isBitset()) {
+            result.bitset = first.bitset;
+            if (second.isBitset()) {
+                for (std::size_t i = 0; i < bitsetSize; ++i) {
+                    result.bitset[i] &= ~second.bitset[i];
+                }
+            } else {
+                for (quint16 value : second.array) {
+                    result.bitset[value / 64] &= ~(quint64(1) << (value % 64));
+                }
+            }
+            result.cardinality = bitsetCardinality(result.bitset);
+            result.optimize();
+        } else {
+            for (quint16 value : first.array) {
+                if (!second.contains(value)) {
+                    result.array.push_back(value);
+                }
+            }
+            result.cardinality = static_cast<int>(result.array.size());
+        }
+        return result;
+    }
+
+    int RoaringBitmap::intersectionCount(const Container& first, const Container& second)
+    {
+        int count = 0;
+        if (first.isBitset() && second.isBitset()) {
+            for (std::size_t i = 0; i < bitsetSize; ++i) {
+                count += static_cast<int>(qPopulationCount(first.bitset[i] & second.bitset[i]));
+            }
+        } else if (first.isBitset() || second.isBitset()) {
+            const Container& array = first.isBitset() ? second : first;
+            const Container& bitset = first.isBitset() ? first : second;
+            for (quint16 value : array.array) {
+                if (testBit(bitset.bitset, value)) {
+                    ++count;
+                }
+            }
+        } else {
+            forEachCommonValue(first.array, second.array, [&](quint16) {
+                ++count;
+            });
+        }
+        return count;
+    }
+}
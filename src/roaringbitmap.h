@@ -0,0 +1,82 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_ROARINGBITMAP_H
+#define UNPLAYER_ROARINGBITMAP_H
+
+#include <cstddef>
+#include <vector>
+
+#include <QtGlobal>
+
+namespace unplayer
+{
+    // Compressed set of 32-bit integers in the manner of Roaring bitmaps.
+    // Values are split into chunks by their high 16 bits, chunk with at most
+    // 4096 values is a sorted array of low bits and denser one is a 65536-bit bitset,
+    // so that set operations never take more than 8 KiB per chunk
+    class RoaringBitmap final
+    {
+    public:
+        // Bitmap of values in [0, count)
+        static RoaringBitmap range(quint32 count);
+
+        static RoaringBitmap intersected(const RoaringBitmap& first, const RoaringBitmap& second);
+        static RoaringBitmap united(const RoaringBitmap& first, const RoaringBitmap& second);
+        // Values of first that are not in second
+        static RoaringBitmap subtracted(const RoaringBitmap& first, const RoaringBitmap& second);
+        // Same as intersected(first, second).cardinality(), without building intersection
+        static int intersectionCount(const RoaringBitmap& first, const RoaringBitmap& second);
+
+        // Values must be appended in ascending order
+        void append(quint32 value);
+
+        bool contains(quint32 value) const;
+        bool isEmpty() const;
+        int cardinality() const;
+
+        // Values in ascending order
+        std::vector<quint32> values() const;
+        std::size_t memoryUsage() const;
+
+    private:
+        struct Container
+        {
+            quint16 key;
+            int cardinality;
+            // Only one of them is used, bitset is not empty when container is dense
+            std::vector<quint16> array;
+            std::vector<quint64> bitset;
+
+            bool isBitset() const;
+            bool contains(quint16 value) const;
+            // Converts to bitset or array depending on cardinality
+            void optimize();
+        };
+
+        static Container intersected(const Container& first, const Container& second);
+        static Container united(const Container& first, const Container& second);
+        static Container subtracted(const Container& first, const Container& second);
+        static int intersectionCount(const Container& first, const Container& second);
+
+        std::vector<Container> mContainers;
+    };
+}
+
+#endif // UNPLAYER_ROARINGBITMAP_H
@@ -0,0 +1,144 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scanthrottle.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDBusPendingCall>
+#include <QDBusPendingCallWatcher>
+#include <QDBusPendingReply>
+#include <QDebug>
+#include <QThread>
+
+namespace unplayer
+{
+    namespace
+    {
+        ScanThrottle* instancePointer = nullptr;
+
+        // Delays per file in milliseconds
+        const int playbackDelay = 20;
+        const int batteryDelay = 100;
+
+        QAtomicInt currentDelay(0);
+
+        const QLatin1String mceService("com.nokia.mce");
+        const QLatin1String mceRequestPath("/com/nokia/mce/request");
+        const QLatin1String mceRequestInterface("com.nokia.mce.request");
+        const QLatin1String mceSignalPath("/com/nokia/mce/signal");
+        const QLatin1String mceSignalInterface("com.nokia.mce.signal");
+    }
+
+    ScanThrottle* ScanThrottle::instance()
+    {
+        if (!instancePointer) {
+            instancePointer = new ScanThrottle(qApp);
+        }
+        return instancePointer;
+    }
+
+    void ScanThrottle::setPlaybackActive(bool active)
+    {
+        mPlaybackActive = active;
+        updateDelay();
+    }
+
+    bool ScanThrottle::isDisplayOff() const
+    {
+        return mDisplayOff;
+    }
+
+    bool ScanThrottle::isCharging() const
+    {
+        return !mOnBattery;
+    }
+
+    void ScanThrottle::throttle()
+    {
+        const int delay = currentDelay.load();
+        if (delay > 0) {
+            QThread::msleep(delay);
+        }
+    }
+
+    ScanThrottle::ScanThrottle(QObject* parent)
+        : QObject(parent),
+          mPlaybackActive(false),
+          mDisplayOff(false),
+          mOnBattery(false)
+    {
+        // Display and charger state are provided by MCE on Sailfish OS.
+        // If it is not available device is assumed to be charging with display on
+        QDBusConnection bus(QDBusConnection::systemBus());
+        bus.connect(mceService, mceSignalPath, mceSignalInterface, QLatin1String("display_status_ind"),
+                    this, SLOT(onDisplayStatusChanged(QString)));
+        bus.connect(mceService, mceSignalPath, mceSignalInterface, QLatin1String("charger_state_ind"),
+                    this, SLOT(onChargerStateChanged(QString)));
+        watchMce(QLatin1String("get_display_status"), &ScanThrottle::onDisplayStatusChanged);
+        watchMce(QLatin1String("get_charger_state"), &ScanThrottle::onChargerStateChanged);
+    }
+
+    void ScanThrottle::watchMce(const QString& request, void (ScanThrottle::*handler)(const QString&))
+    {
+        const QDBusMessage message(QDBusMessage::createMethodCall(mceService, mceRequestPath, mceRequestInterface, request));
+        auto watcher = new QDBusPendingCallWatcher(QDBusConnection::systemBus().asyncCall(message), this);
+        QObject::connect(watcher, &QDBusPendingCallWatcher::finished, this, [=]() {
+            const QDBusPendingReply<QString> reply(*watcher);
+            if (reply.isValid()) {
+                (this->*handler)(reply.value());
+            } else {
+                qDebug() << "failed to get state from MCE:" << reply.error().message();
+            }
+            watcher->deleteLater();
+        });
+    }
+
+    void ScanThrottle::updateDelay()
+    {
+        int delay = 0;
+        if (mOnBattery && mDisplayOff) {
+            delay = batteryDelay;
+        } else if (mPlaybackActive) {
+            delay = playbackDelay;
+        }
+        currentDelay.store(delay);
+    }
+
+    void ScanThrottle::onDisplayStatusChanged(const QString& status)
+    {
+        const bool displayOff = (status == QLatin1String("off"));
+        if (displayOff != mDisplayOff) {
+            mDisplayOff = displayOff;
+            updateDelay();
+            emit displayOffChanged();
+        }
+    }
+
+    void ScanThrottle::onChargerStateChanged(const QString& state)
+    {
+        const bool onBattery = (state == QLatin1String("off"));
+        if (onBattery != mOnBattery) {
+            mOnBattery = onBattery;
+            updateDelay();
+            emit chargingChanged();
+        }
+    }
+}
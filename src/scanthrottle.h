@@ -0,0 +1,62 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_SCANTHROTTLE_H
+#define UNPLAYER_SCANTHROTTLE_H
+
+#include <QObject>
+
+namespace unplayer
+{
+    // Slows down library scanning when it may affect playback or battery life.
+    // State is tracked on main thread, throttle() may be called from any thread
+    class ScanThrottle final : public QObject
+    {
+        Q_OBJECT
+    public:
+        static ScanThrottle* instance();
+
+        void setPlaybackActive(bool active);
+        bool isDisplayOff() const;
+        bool isCharging() const;
+
+        // Sleeps for delay appropriate for current state, called by library updater
+        // before processing every file
+        static void throttle();
+
+    private:
+        explicit ScanThrottle(QObject* parent);
+        // Requests initial state
+        void watchMce(const QString& request, void (ScanThrottle::*handler)(const QString&));
+        void updateDelay();
+
+        bool mPlaybackActive;
+        bool mDisplayOff;
+        bool mOnBattery;
+
+    private slots:
+        void onDisplayStatusChanged(const QString& status);
+        void onChargerStateChanged(const QString& state);
+
+    signals:
+        void displayOffChanged();
+        void chargingChanged();
+    };
+}
+
+#endif // UNPLAYER_SCANTHROTTLE_H
@@ -0,0 +1,125 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "sectionsmodel.h"
+
+#include <algorithm>
+
+namespace unplayer
+{
+    SectionsModel::SectionsModel(QObject* parent)
+        : QAbstractListModel(parent)
+    {
+
+    }
+
+    int SectionsModel::rowCount(const QModelIndex&) const
+    {
+        return mSections.size();
+    }
+
+    QVariant SectionsModel::data(const QModelIndex& index, int role) const
+    {
+        const Section& section = mSections[index.row()];
+        switch (role) {
+        case SectionRole:
+            return section.section;
+        case FirstRowRole:
+            return section.firstRow;
+        default:
+            return QVariant();
+        }
+    }
+
+    int SectionsModel::firstRow(const QString& section) const
+    {
+        const auto found(std::find_if(mSections.begin(), mSections.end(), [&](const Section& s) {
+            return s.section == section;
+        }));
+        return (found == mSections.end()) ? -1 : found->firstRow;
+    }
+
+    void SectionsModel::updateOnRowsChanged(const QAbstractItemModel* model, const std::function<void()>& update)
+    {
+        QObject::connect(model, &QAbstractItemModel::modelReset, this, update);
+        QObject::connect(model, &QAbstractItemModel::rowsInserted, this, update);
+        QObject::connect(model, &QAbstractItemModel::rowsRemoved, this, update);
+        QObject::connect(model, &QAbstractItemModel::layoutChanged, this, update);
+    }
+
+    void SectionsModel::update(int rowCount, const std::function<QByteArray(int row)>& sortKey)
+    {
+        std::vector<Section> sections;
+        QString previous;
+        for (int i = 0; i < rowCount; ++i) {
+            QString s(section(sortKey(i)));
+            if (s == previous) {
+                continue;
+            }
+            previous = s;
+            // Characters that are not letters are not adjacent in sort order
+            const bool seen = std::any_of(sections.begin(), sections.end(), [&](const Section& other) {
+                return other.section == s;
+            });
+            if (!seen) {
+                sections.push_back({std::move(s), i});
+            }
+        }
+        setSections(std::move(sections));
+    }
+
+    void SectionsModel::clear()
+    {
+        setSections({});
+    }
+
+    QString SectionsModel::section(const QByteArray& sortKey)
+    {
+        // Keys of non-empty strings start with '1'
+        if (sortKey.size() < 2 || sortKey[0] != '1') {
+            return QString(QLatin1Char('?'));
+        }
+
+        // UTF-8 is at most 4 bytes for one character
+        const QString first(QString::fromUtf8(sortKey.constData() + 1, std::min(sortKey.size() - 1, 4)));
+        if (first.isEmpty() || !first[0].isLetter()) {
+            return QString(QLatin1Char('#'));
+        }
+        return QString(first[0]).toUpper();
+    }
+
+    QHash<int, QByteArray> SectionsModel::roleNames() const
+    {
+        return {{SectionRole, "section"},
+                {FirstRowRole, "firstRow"}};
+    }
+
+    void SectionsModel::setSections(std::vector<Section>&& sections)
+    {
+        const bool same = (sections.size() == mSections.size()) &&
+                std::equal(sections.begin(), sections.end(), mSections.begin(), [](const Section& first, const Section& second) {
+                    return first.section == second.section && first.firstRow == second.firstRow;
+                });
+        if (!same) {
+            beginResetModel();
+            mSections = std::move(sections);
+            endResetModel();
+        }
+    }
+}
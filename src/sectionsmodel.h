@@ -0,0 +1,78 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_SECTIONSMODEL_H
+#define UNPLAYER_SECTIONSMODEL_H
+
+#include <functional>
+#include <vector>
+
+#include <QAbstractListModel>
+
+namespace unplayer
+{
+    // First letters of rows of library model sorted by sort keys of
+    // LibraryUtils::sortKey(), and first row of each of them
+    class SectionsModel final : public QAbstractListModel
+    {
+        Q_OBJECT
+    public:
+        enum Role
+        {
+            SectionRole = Qt::UserRole,
+            FirstRowRole
+        };
+        Q_ENUM(Role)
+
+        explicit SectionsModel(QObject* parent = nullptr);
+
+        int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+        QVariant data(const QModelIndex& index, int role) const override;
+
+        // Returns -1 if there are no rows in section
+        Q_INVOKABLE int firstRow(const QString& section) const;
+
+        // Calls update when rows of model are loaded, removed or reordered
+        void updateOnRowsChanged(const QAbstractItemModel* model, const std::function<void()>& update);
+
+        // Rows must be ordered by sortKey
+        void update(int rowCount, const std::function<QByteArray(int row)>& sortKey);
+        void clear();
+
+        // Uppercase first letter, '#' for digits and other characters
+        // and '?' for empty strings
+        static QString section(const QByteArray& sortKey);
+
+    protected:
+        QHash<int, QByteArray> roleNames() const override;
+
+    private:
+        struct Section
+        {
+            QString section;
+            int firstRow;
+        };
+
+        void setSections(std::vector<Section>&& sections);
+
+        std::vector<Section> mSections;
+    };
+}
+
+#endif // UNPLAYER_SECTIONSMODEL_H
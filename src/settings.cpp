@@ -18,10 +18,15 @@
 
 #include "settings.h"
 
+#include <algorithm>
+
 #include <QCoreApplication>
+#include <QDebug>
 #include <QSettings>
 #include <QStandardPaths>
+#include <QThread>
 
+#include "threadpools.h"
 #include "utils.h"
 
 namespace unplayer
@@ -35,6 +40,18 @@ namespace unplayer
         const QString useDirectoryMediaArtKey(QLatin1String("useDirectoryMediaArt"));
         const QString restorePlayerStateKey(QLatin1String("restorePlayerState"));
         const QString showVideoFilesKey(QLatin1String("showVideoFiles"));
+        const QString browseLibraryDirectoriesKey(QLatin1String("browseLibraryDirectories"));
+        const QString prefetchNextTrackKey(QLatin1String("prefetchNextTrack"));
+        const QString prefetchSizeKey(QLatin1String("prefetchSize"));
+        const QString prefetchTimeKey(QLatin1String("prefetchTime"));
+        const QString trackCacheSizeKey(QLatin1String("trackCacheSize"));
+        const QString trackCacheTracksCountKey(QLatin1String("trackCacheTracksCount"));
+        const QString libraryUpdateThreadsCountKey(QLatin1String("libraryUpdateThreadsCount"));
+        const QString refineDurationsKey(QLatin1String("refineDurations"));
+        const QString inMemoryLibraryKey(QLatin1String("inMemoryLibrary"));
+        const QString deferLibraryMaintenanceKey(QLatin1String("deferLibraryMaintenance"));
+        const QString embeddedMediaArtMaxResolutionKey(QLatin1String("embeddedMediaArtMaxResolution"));
+        const QString embeddedMediaArtMaxFileSizeKey(QLatin1String("embeddedMediaArtMaxFileSize"));
 
         const QString artistsSortDescendingKey(QLatin1String("artistsSortDescending"));
 
@@ -62,10 +79,82 @@ namespace unplayer
         const QString shuffleKey(QLatin1String("state/shuffle"));
         const QString repeatModeKey(QLatin1String("state/repeatMode"));
         const QString playerPositionKey(QLatin1String("state/playerPosition"));
+        const QString lastFullLibraryUpdateKey(QLatin1String("state/lastFullLibraryUpdate"));
+
+        // Changes made during this interval are written at once
+        const int flushInterval = 1000;
 
         Settings* instancePointer = nullptr;
+
+        void writeSettings(const std::unordered_map<QString, QVariant>& writes)
+        {
+            QSettings settings;
+            for (const auto& i : writes) {
+                if (i.second.isValid()) {
+                    settings.setValue(i.first, i.second);
+                } else {
+                    settings.remove(i.first);
+                }
+            }
+            settings.sync();
+            if (settings.status() != QSettings::NoError) {
+                qWarning() << "failed to write settings" << settings.status();
+            }
+        }
     }
 
+    // Sort modes are -1 when they are not set
+    struct Settings::Values
+    {
+        QStringList libraryDirectories;
+        bool openLibraryOnStartup;
+        QStringList blacklistedDirectories;
+        QString defaultDirectory;
+        bool useDirectoryMediaArt;
+        bool restorePlayerState;
+        bool showVideoFiles;
+        bool browseLibraryDirectories;
+        bool prefetchNextTrack;
+        int prefetchSize;
+        int prefetchTime;
+        int trackCacheSize;
+        int trackCacheTracksCount;
+        int libraryUpdateThreadsCount;
+        bool refineDurations;
+        bool inMemoryLibrary;
+        bool deferLibraryMaintenance;
+        int embeddedMediaArtMaxResolution;
+        int embeddedMediaArtMaxFileSize;
+
+        bool artistsSortDescending;
+
+        bool albumsSortDescending;
+        int albumsSortMode;
+
+        bool allAlbumsSortDescending;
+        int allAlbumsSortMode;
+
+        bool albumTracksSortDescending;
+        int albumTracksSortMode;
+
+        bool artistTracksSortDescending;
+        int artistTracksSortMode;
+        int artistTracksInsideAlbumSortMode;
+
+        bool allTracksSortDescending;
+        int allTracksSortMode;
+        int allTracksInsideAlbumSortMode;
+
+        bool genresSortDescending;
+
+        QStringList queueTracks;
+        int queuePosition;
+        bool shuffle;
+        int repeatMode;
+        long long playerPosition;
+        long long lastFullLibraryUpdate;
+    };
+
     Settings* Settings::instance()
     {
         if (!instancePointer) {
@@ -74,239 +163,574 @@ namespace unplayer
         return instancePointer;
     }
 
+    template<typename T>
+    bool Settings::update(T Values::*field, const T& value, const QString& key)
+    {
+        const std::shared_ptr<const Values> current(values());
+        if ((*current).*field == value) {
+            return false;
+        }
+        const auto updated(std::make_shared<Values>(*current));
+        (*updated).*field = value;
+        {
+            const QMutexLocker locker(&mValuesMutex);
+            mValues = updated;
+        }
+        write(key, QVariant::fromValue(value));
+        return true;
+    }
+
     bool Settings::hasLibraryDirectories() const
     {
-        return !mSettings->value(libraryDirectoriesKey).toStringList().isEmpty();
+        return !values()->libraryDirectories.isEmpty();
     }
 
     QStringList Settings::libraryDirectories() const
     {
-        return mSettings->value(libraryDirectoriesKey).toStringList();
+        return values()->libraryDirectories;
     }
 
     void Settings::setLibraryDirectories(const QStringList& directories)
     {
-        mSettings->setValue(libraryDirectoriesKey, directories);
-        emit libraryDirectoriesChanged();
+        if (update(&Values::libraryDirectories, directories, libraryDirectoriesKey)) {
+            emit libraryDirectoriesChanged();
+        }
     }
 
     bool Settings::openLibraryOnStartup() const
     {
-        return mSettings->value(openLibraryOnStartupKey, false).toBool();
+        return values()->openLibraryOnStartup;
     }
 
     void Settings::setOpenLibraryOnStartup(bool open)
     {
-        mSettings->setValue(openLibraryOnStartupKey, open);
+        if (update(&Values::openLibraryOnStartup, open, openLibraryOnStartupKey)) {
+            emit openLibraryOnStartupChanged();
+        }
     }
 
     QStringList Settings::blacklistedDirectories() const
     {
-        return mSettings->value(blacklistedDirectoriesKey).toStringList();
+        return values()->blacklistedDirectories;
     }
 
     void Settings::setBlacklistedDirectories(const QStringList& directories)
     {
-        mSettings->setValue(blacklistedDirectoriesKey, directories);
+        if (update(&Values::blacklistedDirectories, directories, blacklistedDirectoriesKey)) {
+            emit blacklistedDirectoriesChanged();
+        }
     }
 
     QString Settings::defaultDirectory() const
     {
-        return mSettings->value(defaultDirectoryKey, QStandardPaths::writableLocation(QStandardPaths::HomeLocation)).toString();
+        return values()->defaultDirectory;
     }
 
     void Settings::setDefaultDirectory(const QString& directory)
     {
-        mSettings->setValue(defaultDirectoryKey, directory);
+        if (update(&Values::defaultDirectory, directory, defaultDirectoryKey)) {
+            emit defaultDirectoryChanged();
+        }
     }
 
     bool Settings::useDirectoryMediaArt() const
     {
-        return mSettings->value(useDirectoryMediaArtKey, false).toBool();
+        return values()->useDirectoryMediaArt;
     }
 
     void Settings::setUseDirectoryMediaArt(bool use)
     {
-        mSettings->setValue(useDirectoryMediaArtKey, use);
+        if (update(&Values::useDirectoryMediaArt, use, useDirectoryMediaArtKey)) {
+            emit useDirectoryMediaArtChanged();
+        }
     }
 
     bool Settings::restorePlayerState() const
     {
-        return mSettings->value(restorePlayerStateKey, true).toBool();
+        return values()->restorePlayerState;
     }
 
     void Settings::setRestorePlayerState(bool restore)
     {
-        mSettings->setValue(restorePlayerStateKey, restore);
+        if (update(&Values::restorePlayerState, restore, restorePlayerStateKey)) {
+            emit restorePlayerStateChanged();
+        }
     }
 
     bool Settings::showVideoFiles() const
     {
-        return mSettings->value(showVideoFilesKey, false).toBool();
+        return values()->showVideoFiles;
     }
 
     void Settings::setShowVideoFiles(bool show)
     {
-        mSettings->setValue(showVideoFilesKey, show);
+        if (update(&Values::showVideoFiles, show, showVideoFilesKey)) {
+            emit showVideoFilesChanged();
+        }
+    }
+
+    bool Settings::browseLibraryDirectories() const
+    {
+        return values()->browseLibraryDirectories;
+    }
+
+    void Settings::setBrowseLibraryDirectories(bool browse)
+    {
+        if (update(&Values::browseLibraryDirectories, browse, browseLibraryDirectoriesKey)) {
+            emit browseLibraryDirectoriesChanged();
+        }
+    }
+
+    bool Settings::prefetchNextTrack() const
+    {
+        return values()->prefetchNextTrack;
+    }
+
+    void Settings::setPrefetchNextTrack(bool prefetch)
+    {
+        if (update(&Values::prefetchNextTrack, prefetch, prefetchNextTrackKey)) {
+            emit prefetchNextTrackChanged();
+        }
+    }
+
+    int Settings::prefetchSize() const
+    {
+        return std::max(values()->prefetchSize, 1);
+    }
+
+    void Settings::setPrefetchSize(int size)
+    {
+        if (update(&Values::prefetchSize, size, prefetchSizeKey)) {
+            emit prefetchSizeChanged();
+        }
+    }
+
+    int Settings::prefetchTime() const
+    {
+        return std::max(values()->prefetchTime, 0);
+    }
+
+    void Settings::setPrefetchTime(int seconds)
+    {
+        update(&Values::prefetchTime, seconds, prefetchTimeKey);
+    }
+
+    int Settings::trackCacheSize() const
+    {
+        return std::max(values()->trackCacheSize, 0);
+    }
+
+    void Settings::setTrackCacheSize(int size)
+    {
+        if (update(&Values::trackCacheSize, size, trackCacheSizeKey)) {
+            emit trackCacheSizeChanged();
+        }
+    }
+
+    int Settings::trackCacheTracksCount() const
+    {
+        return std::max(values()->trackCacheTracksCount, 1);
+    }
+
+    void Settings::setTrackCacheTracksCount(int count)
+    {
+        update(&Values::trackCacheTracksCount, count, trackCacheTracksCountKey);
+    }
+
+    int Settings::libraryUpdateThreadsCount() const
+    {
+        const int count = values()->libraryUpdateThreadsCount;
+        if (count > 0) {
+            return count;
+        }
+        return std::max(QThread::idealThreadCount(), 1);
+    }
+
+    void Settings::setLibraryUpdateThreadsCount(int count)
+    {
+        update(&Values::libraryUpdateThreadsCount, count, libraryUpdateThreadsCountKey);
+    }
+
+    bool Settings::refineDurations() const
+    {
+        return values()->refineDurations;
+    }
+
+    void Settings::setRefineDurations(bool refine)
+    {
+        if (update(&Values::refineDurations, refine, refineDurationsKey)) {
+            emit refineDurationsChanged();
+        }
+    }
+
+    bool Settings::inMemoryLibrary() const
+    {
+        return values()->inMemoryLibrary;
+    }
+
+    void Settings::setInMemoryLibrary(bool inMemory)
+    {
+        if (update(&Values::inMemoryLibrary, inMemory, inMemoryLibraryKey)) {
+            emit inMemoryLibraryChanged();
+        }
+    }
+
+    bool Settings::deferLibraryMaintenance() const
+    {
+        return values()->deferLibraryMaintenance;
+    }
+
+    void Settings::setDeferLibraryMaintenance(bool defer)
+    {
+        if (update(&Values::deferLibraryMaintenance, defer, deferLibraryMaintenanceKey)) {
+            emit deferLibraryMaintenanceChanged();
+        }
+    }
+
+    long long Settings::lastFullLibraryUpdate() const
+    {
+        return values()->lastFullLibraryUpdate;
+    }
+
+    void Settings::setLastFullLibraryUpdate(long long time)
+    {
+        update(&Values::lastFullLibraryUpdate, time, lastFullLibraryUpdateKey);
+    }
+
+    int Settings::embeddedMediaArtMaxResolution() const
+    {
+        return values()->embeddedMediaArtMaxResolution;
+    }
+
+    void Settings::setEmbeddedMediaArtMaxResolution(int resolution)
+    {
+        update(&Values::embeddedMediaArtMaxResolution, resolution, embeddedMediaArtMaxResolutionKey);
+    }
+
+    int Settings::embeddedMediaArtMaxFileSize() const
+    {
+        return values()->embeddedMediaArtMaxFileSize;
+    }
+
+    void Settings::setEmbeddedMediaArtMaxFileSize(int size)
+    {
+        update(&Values::embeddedMediaArtMaxFileSize, size, embeddedMediaArtMaxFileSizeKey);
     }
 
     bool Settings::artistsSortDescending() const
     {
-        return mSettings->value(artistsSortDescendingKey, false).toBool();
+        return values()->artistsSortDescending;
     }
 
     void Settings::setArtistsSortDescending(bool descending)
     {
-        mSettings->setValue(artistsSortDescendingKey, descending);
+        update(&Values::artistsSortDescending, descending, artistsSortDescendingKey);
     }
 
     bool Settings::albumsSortDescending() const
     {
-        return mSettings->value(albumsSortDescendingKey, false).toBool();
+        return values()->albumsSortDescending;
     }
 
     int Settings::albumsSortMode(int defaultMode) const
     {
-        return mSettings->value(albumsSortModeKey, defaultMode).toInt();
+        const int mode = values()->albumsSortMode;
+        return mode == -1 ? defaultMode : mode;
     }
 
     void Settings::setAlbumsSortSettings(bool descending, int sortMode)
     {
-        mSettings->setValue(albumsSortDescendingKey, descending);
-        mSettings->setValue(albumsSortModeKey, sortMode);
+        update(&Values::albumsSortDescending, descending, albumsSortDescendingKey);
+        update(&Values::albumsSortMode, sortMode, albumsSortModeKey);
     }
 
     bool Settings::allAlbumsSortDescending() const
     {
-        return mSettings->value(allAlbumsSortDescendingKey, false).toBool();
+        return values()->allAlbumsSortDescending;
     }
 
     int Settings::allAlbumsSortMode(int defaultMode) const
     {
-        return mSettings->value(allAlbumsSortModeKey, defaultMode).toInt();
+        const int mode = values()->allAlbumsSortMode;
+        return mode == -1 ? defaultMode : mode;
     }
 
     void Settings::setAllAlbumsSortSettings(bool descending, int sortMode)
     {
-        mSettings->setValue(allAlbumsSortDescendingKey, descending);
-        mSettings->setValue(allAlbumsSortModeKey, sortMode);
+        update(&Values::allAlbumsSortDescending, descending, allAlbumsSortDescendingKey);
+        update(&Values::allAlbumsSortMode, sortMode, allAlbumsSortModeKey);
     }
 
     bool Settings::albumTracksSortDescending() const
     {
-        return mSettings->value(albumTracksSortDescendingKey, false).toBool();
+        return values()->albumTracksSortDescending;
     }
 
     int Settings::albumTracksSortMode(int defaultMode) const
     {
-        return mSettings->value(albumTracksSortModeKey, defaultMode).toInt();
+        const int mode = values()->albumTracksSortMode;
+        return mode == -1 ? defaultMode : mode;
     }
 
     void Settings::setAlbumTracksSortSettings(bool descending, int sortMode)
     {
-        mSettings->setValue(albumTracksSortDescendingKey, descending);
-        mSettings->setValue(albumTracksSortModeKey, sortMode);
+        update(&Values::albumTracksSortDescending, descending, albumTracksSortDescendingKey);
+        update(&Values::albumTracksSortMode, sortMode, albumTracksSortModeKey);
     }
 
     bool Settings::artistTracksSortDescending() const
     {
-        return mSettings->value(artistTracksSortDescendingKey, false).toBool();
+        return values()->artistTracksSortDescending;
     }
 
     int Settings::artistTracksSortMode(int defaultMode) const
     {
-        return mSettings->value(artistTracksSortModeKey, defaultMode).toInt();
+        const int mode = values()->artistTracksSortMode;
+        return mode == -1 ? defaultMode : mode;
     }
 
     int Settings::artistTracksInsideAlbumSortMode(int defaultMode) const
     {
-        return mSettings->value(artistTracksInsideAlbumSortModeKey, defaultMode).toInt();
+        const int mode = values()->artistTracksInsideAlbumSortMode;
+        return mode == -1 ? defaultMode : mode;
     }
 
     void Settings::setArtistTracksSortSettings(bool descending, int sortMode, int insideAlbumSortMode)
     {
-        mSettings->setValue(artistTracksSortDescendingKey, descending);
-        mSettings->setValue(artistTracksSortModeKey, sortMode);
-        mSettings->setValue(artistTracksInsideAlbumSortModeKey, insideAlbumSortMode);
+        update(&Values::artistTracksSortDescending, descending, artistTracksSortDescendingKey);
+        update(&Values::artistTracksSortMode, sortMode, artistTracksSortModeKey);
+        update(&Values::artistTracksInsideAlbumSortMode, insideAlbumSortMode, artistTracksInsideAlbumSortModeKey);
     }
 
     bool Settings::allTracksSortDescending() const
     {
-        return mSettings->value(allTracksSortDescendingKey, false).toBool();
+        return values()->allTracksSortDescending;
     }
 
     int Settings::allTracksSortMode(int defaultMode) const
     {
-        return mSettings->value(allTracksSortModeKey, defaultMode).toInt();
+        const int mode = values()->allTracksSortMode;
+        return mode == -1 ? defaultMode : mode;
     }
 
     int Settings::allTracksInsideAlbumSortMode(int defaultMode) const
     {
-        return mSettings->value(allTracksInsideAlbumSortModeKey, defaultMode).toInt();
+        const int mode = values()->allTracksInsideAlbumSortMode;
+        return mode == -1 ? defaultMode : mode;
     }
 
     void Settings::setAllTracksSortSettings(bool descending, int sortMode, int insideAlbumSortMode)
     {
-        mSettings->setValue(allTracksSortDescendingKey, descending);
-        mSettings->setValue(allTracksSortModeKey, sortMode);
-        mSettings->setValue(allTracksInsideAlbumSortModeKey, insideAlbumSortMode);
+        update(&Values::allTracksSortDescending, descending, allTracksSortDescendingKey);
+        update(&Values::allTracksSortMode, sortMode, allTracksSortModeKey);
+        update(&Values::allTracksInsideAlbumSortMode, insideAlbumSortMode, allTracksInsideAlbumSortModeKey);
     }
 
     bool Settings::genresSortDescending() const
     {
-        return mSettings->value(genresSortDescendingKey, false).toBool();
+        return values()->genresSortDescending;
     }
 
     void Settings::setGenresSortDescending(bool descending)
     {
-        mSettings->setValue(genresSortDescendingKey, descending);
+        update(&Values::genresSortDescending, descending, genresSortDescendingKey);
     }
 
     QStringList Settings::queueTracks() const
     {
-        return mSettings->value(queueTracksKey).toStringList();
+        return values()->queueTracks;
     }
 
     int Settings::queuePosition() const
     {
-        return mSettings->value(queuePositionKey).toInt();
+        return values()->queuePosition;
     }
 
     bool Settings::shuffle() const
     {
-        return mSettings->value(shuffleKey).toBool();
+        return values()->shuffle;
     }
 
     int Settings::repeatMode() const
     {
-        return mSettings->value(repeatModeKey).toInt();
+        return values()->repeatMode;
     }
 
     long long Settings::playerPosition() const
     {
-        return mSettings->value(playerPositionKey).toLongLong();
+        return values()->playerPosition;
     }
 
-    void Settings::savePlayerState(const QStringList& tracks, int queuePosition, bool shuffle, int repeatMode, long long playerPosition)
+    void Settings::savePlayerState(bool shuffle, int repeatMode, long long playerPosition)
     {
-        mSettings->setValue(queueTracksKey, tracks);
-        mSettings->setValue(queuePositionKey, queuePosition);
-        mSettings->setValue(shuffleKey, shuffle);
-        mSettings->setValue(repeatModeKey, repeatMode);
-        mSettings->setValue(playerPositionKey, playerPosition);
+        // Keys of old versions are removed
+        update(&Values::queueTracks, QStringList(), queueTracksKey);
+        write(queueTracksKey, QVariant());
+        update(&Values::queuePosition, 0, queuePositionKey);
+        write(queuePositionKey, QVariant());
+        update(&Values::shuffle, shuffle, shuffleKey);
+        update(&Values::repeatMode, repeatMode, repeatModeKey);
+        update(&Values::playerPosition, playerPosition, playerPositionKey);
+    }
+
+    void Settings::sync()
+    {
+        mFlushTimer.stop();
+        mFlushFuture.waitForFinished();
+        if (!mPendingWrites.empty()) {
+            writeSettings(mPendingWrites);
+            mPendingWrites.clear();
+        }
+    }
+
+    void Settings::reloadLibrarySettings()
+    {
+        QSettings settings;
+        settings.sync();
+
+        const std::shared_ptr<const Values> current(values());
+        const auto updated(std::make_shared<Values>(*current));
+        updated->libraryDirectories = settings.value(libraryDirectoriesKey, current->libraryDirectories).toStringList();
+        updated->blacklistedDirectories = settings.value(blacklistedDirectoriesKey, current->blacklistedDirectories).toStringList();
+        updated->useDirectoryMediaArt = settings.value(useDirectoryMediaArtKey, current->useDirectoryMediaArt).toBool();
+        updated->libraryUpdateThreadsCount = settings.value(libraryUpdateThreadsCountKey, current->libraryUpdateThreadsCount).toInt();
+        updated->refineDurations = settings.value(refineDurationsKey, current->refineDurations).toBool();
+        updated->deferLibraryMaintenance = settings.value(deferLibraryMaintenanceKey, current->deferLibraryMaintenance).toBool();
+        updated->embeddedMediaArtMaxResolution = settings.value(embeddedMediaArtMaxResolutionKey, current->embeddedMediaArtMaxResolution).toInt();
+        updated->embeddedMediaArtMaxFileSize = settings.value(embeddedMediaArtMaxFileSizeKey, current->embeddedMediaArtMaxFileSize).toInt();
+        {
+            const QMutexLocker locker(&mValuesMutex);
+            mValues = updated;
+        }
+
+        if (updated->libraryDirectories != current->libraryDirectories) {
+            emit libraryDirectoriesChanged();
+        }
+        if (updated->blacklistedDirectories != current->blacklistedDirectories) {
+            emit blacklistedDirectoriesChanged();
+        }
+        if (updated->useDirectoryMediaArt != current->useDirectoryMediaArt) {
+            emit useDirectoryMediaArtChanged();
+        }
+        if (updated->refineDurations != current->refineDurations) {
+            emit refineDurationsChanged();
+        }
+        if (updated->deferLibraryMaintenance != current->deferLibraryMaintenance) {
+            emit deferLibraryMaintenanceChanged();
+        }
     }
 
     Settings::Settings(QObject* parent)
-        : QObject(parent),
-          mSettings(new QSettings(this))
-    {
-        if (!mSettings->contains(libraryDirectoriesKey)) {
-            QStringList directories{QStandardPaths::writableLocation(QStandardPaths::MusicLocation)};
-            const QString sdcardPath(Utils::sdcardPath(true));
-            if (!sdcardPath.isEmpty()) {
-                directories.append(sdcardPath);
+        : QObject(parent)
+    {
+        mFlushTimer.setSingleShot(true);
+        mFlushTimer.setInterval(flushInterval);
+        QObject::connect(&mFlushTimer, &QTimer::timeout, this, &Settings::flush);
+
+        {
+            const QSettings settings;
+            const auto values(std::make_shared<Values>());
+            values->libraryDirectories = settings.value(libraryDirectoriesKey).toStringList();
+            values->openLibraryOnStartup = settings.value(openLibraryOnStartupKey, false).toBool();
+            values->blacklistedDirectories = settings.value(blacklistedDirectoriesKey).toStringList();
+            values->defaultDirectory = settings.value(defaultDirectoryKey, QStandardPaths::writableLocation(QStandardPaths::HomeLocation)).toString();
+            values->useDirectoryMediaArt = settings.value(useDirectoryMediaArtKey, false).toBool();
+            values->restorePlayerState = settings.value(restorePlayerStateKey, true).toBool();
+            values->showVideoFiles = settings.value(showVideoFilesKey, false).toBool();
+            values->browseLibraryDirectories = settings.value(browseLibraryDirectoriesKey, false).toBool();
+            values->prefetchNextTrack = settings.value(prefetchNextTrackKey, true).toBool();
+            values->prefetchSize = settings.value(prefetchSizeKey, 4).toInt();
+            values->prefetchTime = settings.value(prefetchTimeKey, 30).toInt();
+            values->trackCacheSize = settings.value(trackCacheSizeKey, 256).toInt();
+            values->trackCacheTracksCount = settings.value(trackCacheTracksCountKey, 3).toInt();
+            values->libraryUpdateThreadsCount = settings.value(libraryUpdateThreadsCountKey, 0).toInt();
+            values->refineDurations = settings.value(refineDurationsKey, false).toBool();
+            values->inMemoryLibrary = settings.value(inMemoryLibraryKey, false).toBool();
+            values->deferLibraryMaintenance = settings.value(deferLibraryMaintenanceKey, true).toBool();
+            values->embeddedMediaArtMaxResolution = settings.value(embeddedMediaArtMaxResolutionKey, 1024).toInt();
+            values->embeddedMediaArtMaxFileSize = settings.value(embeddedMediaArtMaxFileSizeKey, 512).toInt();
+
+            values->artistsSortDescending = settings.value(artistsSortDescendingKey, false).toBool();
+
+            values->albumsSortDescending = settings.value(albumsSortDescendingKey, false).toBool();
+            values->albumsSortMode = settings.value(albumsSortModeKey, -1).toInt();
+
+            values->allAlbumsSortDescending = settings.value(allAlbumsSortDescendingKey, false).toBool();
+            values->allAlbumsSortMode = settings.value(allAlbumsSortModeKey, -1).toInt();
+
+            values->albumTracksSortDescending = settings.value(albumTracksSortDescendingKey, false).toBool();
+            values->albumTracksSortMode = settings.value(albumTracksSortModeKey, -1).toInt();
+
+            values->artistTracksSortDescending = settings.value(artistTracksSortDescendingKey, false).toBool();
+            values->artistTracksSortMode = settings.value(artistTracksSortModeKey, -1).toInt();
+            values->artistTracksInsideAlbumSortMode = settings.value(artistTracksInsideAlbumSortModeKey, -1).toInt();
+
+            values->allTracksSortDescending = settings.value(allTracksSortDescendingKey, false).toBool();
+            values->allTracksSortMode = settings.value(allTracksSortModeKey, -1).toInt();
+            values->allTracksInsideAlbumSortMode = settings.value(allTracksInsideAlbumSortModeKey, -1).toInt();
+
+            values->genresSortDescending = settings.value(genresSortDescendingKey, false).toBool();
+
+            values->queueTracks = settings.value(queueTracksKey).toStringList();
+            values->queuePosition = settings.value(queuePositionKey).toInt();
+            values->shuffle = settings.value(shuffleKey).toBool();
+            values->repeatMode = settings.value(repeatModeKey).toInt();
+            values->playerPosition = settings.value(playerPositionKey).toLongLong();
+            values->lastFullLibraryUpdate = settings.value(lastFullLibraryUpdateKey).toLongLong();
+
+            if (!settings.contains(libraryDirectoriesKey)) {
+                values->libraryDirectories.push_back(QStandardPaths::writableLocation(QStandardPaths::MusicLocation));
+                const QString sdcardPath(Utils::sdcardPath(true));
+                if (!sdcardPath.isEmpty()) {
+                    values->libraryDirectories.push_back(sdcardPath);
+                }
+                write(libraryDirectoriesKey, values->libraryDirectories);
             }
-            setLibraryDirectories(directories);
+
+            mValues = values;
+        }
+    }
+
+    Settings::~Settings()
+    {
+        // Player state is saved when QML is destroyed right before this
+        mFlushFuture.waitForFinished();
+        if (!mPendingWrites.empty()) {
+            writeSettings(mPendingWrites);
         }
     }
+
+    std::shared_ptr<const Settings::Values> Settings::values() const
+    {
+        const QMutexLocker locker(&mValuesMutex);
+        return mValues;
+    }
+
+    void Settings::write(const QString& key, const QVariant& value)
+    {
+        mPendingWrites[key] = value;
+        // Timer is not restarted so that changes don't wait forever
+        if (!mFlushTimer.isActive()) {
+            mFlushTimer.start();
+        }
+    }
+
+    void Settings::flush()
+    {
+        if (mPendingWrites.empty()) {
+            return;
+        }
+
+        // Writes are done one after another so that older values don't overwrite newer ones
+        if (mFlushFuture.isRunning()) {
+            mFlushTimer.start();
+            return;
+        }
+
+        std::unordered_map<QString, QVariant> writes;
+        writes.swap(mPendingWrites);
+        mFlushFuture = threadpools::run(threadpools::JobClass::Bulk, [writes]() {
+            writeSettings(writes);
+        });
+    }
 }
@@ -19,21 +19,40 @@
 #ifndef UNPLAYER_SETTINGS_H
 #define UNPLAYER_SETTINGS_H
 
+#include <memory>
+#include <unordered_map>
+
+#include <QFuture>
+#include <QMutex>
 #include <QObject>
+#include <QStringList>
+#include <QTimer>
+#include <QVariant>
 
-class QSettings;
+#include "stdutils.h"
 
 namespace unplayer
 {
+    // Settings are read from QSettings once on startup into a snapshot, getters
+    // only read its fields and can be called from any thread. Setters must be called
+    // from main thread, they replace the snapshot and write changed keys to QSettings
+    // file on a worker thread a moment later, several changes at once
     class Settings final : public QObject
     {
         Q_OBJECT
         Q_PROPERTY(bool hasLibraryDirectories READ hasLibraryDirectories NOTIFY libraryDirectoriesChanged)
-        Q_PROPERTY(bool openLibraryOnStartup READ openLibraryOnStartup WRITE setOpenLibraryOnStartup)
-        Q_PROPERTY(QString defaultDirectory READ defaultDirectory WRITE setDefaultDirectory)
-        Q_PROPERTY(bool useDirectoryMediaArt READ useDirectoryMediaArt WRITE setUseDirectoryMediaArt)
-        Q_PROPERTY(bool restorePlayerState READ restorePlayerState WRITE setRestorePlayerState)
-        Q_PROPERTY(bool showVideoFiles READ showVideoFiles WRITE setShowVideoFiles)
+        Q_PROPERTY(bool openLibraryOnStartup READ openLibraryOnStartup WRITE setOpenLibraryOnStartup NOTIFY openLibraryOnStartupChanged)
+        Q_PROPERTY(QString defaultDirectory READ defaultDirectory WRITE setDefaultDirectory NOTIFY defaultDirectoryChanged)
+        Q_PROPERTY(bool useDirectoryMediaArt READ useDirectoryMediaArt WRITE setUseDirectoryMediaArt NOTIFY useDirectoryMediaArtChanged)
+        Q_PROPERTY(bool restorePlayerState READ restorePlayerState WRITE setRestorePlayerState NOTIFY restorePlayerStateChanged)
+        Q_PROPERTY(bool showVideoFiles READ showVideoFiles WRITE setShowVideoFiles NOTIFY showVideoFilesChanged)
+        Q_PROPERTY(bool browseLibraryDirectories READ browseLibraryDirectories WRITE setBrowseLibraryDirectories NOTIFY browseLibraryDirectoriesChanged)
+        Q_PROPERTY(bool prefetchNextTrack READ prefetchNextTrack WRITE setPrefetchNextTrack NOTIFY prefetchNextTrackChanged)
+        Q_PROPERTY(int prefetchSize READ prefetchSize WRITE setPrefetchSize NOTIFY prefetchSizeChanged)
+        Q_PROPERTY(int trackCacheSize READ trackCacheSize WRITE setTrackCacheSize NOTIFY trackCacheSizeChanged)
+        Q_PROPERTY(bool refineDurations READ refineDurations WRITE setRefineDurations NOTIFY refineDurationsChanged)
+        Q_PROPERTY(bool inMemoryLibrary READ inMemoryLibrary WRITE setInMemoryLibrary NOTIFY inMemoryLibraryChanged)
+        Q_PROPERTY(bool deferLibraryMaintenance READ deferLibraryMaintenance WRITE setDeferLibraryMaintenance NOTIFY deferLibraryMaintenanceChanged)
     public:
         static Settings* instance();
 
@@ -60,6 +79,62 @@ namespace unplayer
         bool showVideoFiles() const;
         void setShowVideoFiles(bool show);
 
+        // Directories in library are listed from database instead of file system,
+        // see DirectoryTracksModel
+        bool browseLibraryDirectories() const;
+        void setBrowseLibraryDirectories(bool browse);
+
+        // Next track in queue is read ahead when current one has less than
+        // prefetchTime seconds left
+        bool prefetchNextTrack() const;
+        void setPrefetchNextTrack(bool prefetch);
+
+        // In megabytes
+        int prefetchSize() const;
+        void setPrefetchSize(int size);
+
+        int prefetchTime() const;
+        void setPrefetchTime(int seconds);
+
+        // Upcoming tracks on network file systems and memory cards are copied
+        // to local cache, see TrackCache. In megabytes, 0 disables the cache
+        int trackCacheSize() const;
+        void setTrackCacheSize(int size);
+
+        // How many upcoming tracks are cached
+        int trackCacheTracksCount() const;
+        void setTrackCacheTracksCount(int count);
+
+        int libraryUpdateThreadsCount() const;
+        void setLibraryUpdateThreadsCount(int count);
+
+        // Estimated durations of MPEG files are replaced with exact ones after scan,
+        // whole files are read
+        bool refineDurations() const;
+        void setRefineDurations(bool refine);
+
+        // Library database is copied to memory on startup, see LibraryReplica
+        bool inMemoryLibrary() const;
+        void setInMemoryLibrary(bool inMemory);
+
+        // Heavy library maintenance runs only while device is charging and idle, see LibraryMaintenance
+        bool deferLibraryMaintenance() const;
+        void setDeferLibraryMaintenance(bool defer);
+
+        // Time when full library update was finished, in milliseconds since epoch
+        long long lastFullLibraryUpdate() const;
+        void setLastFullLibraryUpdate(long long time);
+
+        // Embedded media art larger than this is downscaled when it is extracted,
+        // in pixels, 0 means no limit
+        int embeddedMediaArtMaxResolution() const;
+        void setEmbeddedMediaArtMaxResolution(int resolution);
+
+        // Embedded media art larger than this is re-encoded to JPEG,
+        // in kilobytes, 0 means no limit
+        int embeddedMediaArtMaxFileSize() const;
+        void setEmbeddedMediaArtMaxFileSize(int size);
+
         bool artistsSortDescending() const;
         void setArtistsSortDescending(bool descending);
 
@@ -88,18 +163,58 @@ namespace unplayer
         bool genresSortDescending() const;
         void setGenresSortDescending(bool descending);
 
+        // Queue is saved by Queue::saveSnapshot(), these are used only
+        // to restore queue saved by older version
         QStringList queueTracks() const;
         int queuePosition() const;
+
         bool shuffle() const;
         int repeatMode() const;
         long long playerPosition() const;
-        void savePlayerState(const QStringList& tracks, int queuePosition, bool shuffle, int repeatMode, long long playerPosition);
+        void savePlayerState(bool shuffle, int repeatMode, long long playerPosition);
+
+        // Writes changes that are not written yet before returning,
+        // so that another process reads them
+        void sync();
+        // Reads settings that affect library update from file again,
+        // after they were changed by another process
+        void reloadLibrarySettings();
     private:
-        explicit Settings(QObject* parent);
+        struct Values;
 
-        QSettings* mSettings;
+        explicit Settings(QObject* parent);
+        ~Settings() override;
+
+        std::shared_ptr<const Values> values() const;
+        // Returns true if value was changed
+        template<typename T>
+        bool update(T Values::*field, const T& value, const QString& key);
+        // Invalid value removes key
+        void write(const QString& key, const QVariant& value);
+        void flush();
+
+        mutable QMutex mValuesMutex;
+        std::shared_ptr<const Values> mValues;
+
+        // Keys that are not written yet
+        std::unordered_map<QString, QVariant> mPendingWrites;
+        QTimer mFlushTimer;
+        QFuture<void> mFlushFuture;
     signals:
         void libraryDirectoriesChanged();
+        void blacklistedDirectoriesChanged();
+        void openLibraryOnStartupChanged();
+        void defaultDirectoryChanged();
+        void useDirectoryMediaArtChanged();
+        void restorePlayerStateChanged();
+        void showVideoFilesChanged();
+        void browseLibraryDirectoriesChanged();
+        void prefetchNextTrackChanged();
+        void prefetchSizeChanged();
+        void trackCacheSizeChanged();
+        void refineDurationsChanged();
+        void inMemoryLibraryChanged();
+        void deferLibraryMaintenanceChanged();
     };
 }
 
@@ -0,0 +1,327 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "smartplaylists.h"
+
+#include <algorithm>
+
+#include <QDateTime>
+#include <QDebug>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QStringList>
+#include <QUrl>
+#include <QVariantList>
+
+#include "libraryutils.h"
+#include "sqlquery.h"
+
+namespace unplayer
+{
+    namespace smartplaylists
+    {
+        namespace
+        {
+            const QLatin1String filePathPrefix("smartplaylist:");
+            const long long msecsInDay = 24 * 60 * 60 * 1000LL;
+
+            // WHERE clause over tracks table
+            struct Condition
+            {
+                QString sql;
+                QVariantList values;
+                // Tracks added before this time leave playlist, 0 if there is no such rule
+                long long addedAfter;
+            };
+
+            bool compile(const QString& rules, Condition& condition)
+            {
+                const QJsonDocument document(QJsonDocument::fromJson(rules.toUtf8()));
+                if (!document.isArray()) {
+                    return false;
+                }
+
+                condition.addedAfter = 0;
+                QStringList parts;
+                for (const QJsonValue& value : document.array()) {
+                    const QJsonObject rule(value.toObject());
+                    const QString field(rule.value(QLatin1String("field")).toString());
+                    const QString op(rule.value(QLatin1String("operator")).toString());
+                    const QJsonValue ruleValue(rule.value(QLatin1String("value")));
+
+                    if (field == QLatin1String("artist") || field == QLatin1String("album") || field == QLatin1String("genre")) {
+                        if (op != QLatin1String("=") && op != QLatin1String("!=")) {
+                            return false;
+                        }
+                        // Titles are compared ignoring case by column collation
+                        parts.push_back(QString::fromLatin1("tracks.id %1 (SELECT trackId FROM tracks_%2s "
+                                                            "JOIN %2s ON %2s.id = tracks_%2s.%2Id WHERE %2s.title = ?)")
+                                        .arg((op == QLatin1String("=")) ? QLatin1String("IN") : QLatin1String("NOT IN"), field));
+                        condition.values.push_back(ruleValue.toString());
+                    } else if (field == QLatin1String("year") || field == QLatin1String("playCount")) {
+                        if (op != QLatin1String("=") && op != QLatin1String("!=") &&
+                                op != QLatin1String("<") && op != QLatin1String(">")) {
+                            return false;
+                        }
+                        parts.push_back(QString::fromLatin1("tracks.%1 %2 ?").arg(field, op));
+                        condition.values.push_back(ruleValue.toInt());
+                    } else if (field == QLatin1String("addedWithinDays")) {
+                        const long long addedAfter = QDateTime::currentMSecsSinceEpoch() - ruleValue.toInt() * msecsInDay;
+                        condition.addedAfter = std::max(condition.addedAfter, addedAfter);
+                        parts.push_back(QLatin1String("tracks.addedTime >= ?"));
+                        condition.values.push_back(addedAfter);
+                    } else {
+                        return false;
+                    }
+                }
+
+                condition.sql = parts.isEmpty() ? QString(QLatin1String("1")) : parts.join(QLatin1String(" AND "));
+                return true;
+            }
+
+            bool exec(SqlQuery& query, const QString& what)
+            {
+                LibraryUtils::explainQuery(query);
+                if (!query.exec()) {
+                    qWarning() << "failed to" << what << query.lastError();
+                    return false;
+                }
+                return true;
+            }
+
+            // Returns false on error, missing playlist is not an error
+            bool loadRules(const QSqlDatabase& db, int id, QString& rules)
+            {
+                SqlQuery query(db);
+                query.prepareCached(QLatin1String("SELECT rules FROM smartPlaylists WHERE id = ?"));
+                query.addBindValue(id);
+                if (!exec(query, QLatin1String("get rules of smart playlist"))) {
+                    return false;
+                }
+                if (query.next()) {
+                    rules = query.value(0).toString();
+                }
+                return true;
+            }
+
+            // Removes tracks that have left time window since they were added to playlist.
+            // Only tracks of playlist are checked
+            void removeExpiredTracks(const QSqlDatabase& db, int id, const Condition& condition)
+            {
+                if (condition.addedAfter == 0) {
+                    return;
+                }
+                SqlQuery query(db);
+                query.prepare(QLatin1String("DELETE FROM smartPlaylistTracks WHERE playlistId = ? AND "
+                                            "(SELECT addedTime FROM tracks WHERE tracks.id = trackId) < ?"));
+                query.addBindValue(id);
+                query.addBindValue(condition.addedAfter);
+                exec(query, QLatin1String("remove expired tracks of smart playlist"));
+            }
+        }
+
+        QString filePath(int id)
+        {
+            return filePathPrefix + QString::number(id);
+        }
+
+        bool isSmartPlaylist(const QString& filePath)
+        {
+            return filePath.startsWith(filePathPrefix);
+        }
+
+        int idFromFilePath(const QString& filePath)
+        {
+            return filePath.midRef(filePathPrefix.size()).toInt();
+        }
+
+        bool isValidRules(const QString& rules)
+        {
+            Condition condition;
+            return compile(rules, condition);
+        }
+
+        std::vector<Playlist> playlists(const QSqlDatabase& db)
+        {
+            std::vector<Playlist> playlists;
+
+            SqlQuery query(db);
+            if (!query.exec(QLatin1String("SELECT id, name, rules FROM smartPlaylists ORDER BY name"))) {
+                qWarning() << "failed to get smart playlists" << query.lastError();
+                return playlists;
+            }
+            std::vector<std::pair<int, QString>> rules;
+            while (query.next()) {
+                const int id = query.value(0).toInt();
+                playlists.push_back({filePath(id), query.value(1).toString(), 0});
+                rules.emplace_back(id, query.value(2).toString());
+            }
+            query.finish();
+
+            for (std::size_t i = 0, max = playlists.size(); i < max; ++i) {
+                Condition condition;
+                if (compile(rules[i].second, condition)) {
+                    removeExpiredTracks(db, rules[i].first, condition);
+                }
+
+                // Counted using primary key
+                query.prepareCached(QLatin1String("SELECT COUNT(*) FROM smartPlaylistTracks WHERE playlistId = ?"));
+                query.addBindValue(rules[i].first);
+                if (exec(query, QLatin1String("count tracks of smart playlist")) && query.next()) {
+                    playlists[i].tracksCount = query.value(0).toInt();
+                }
+            }
+
+            return playlists;
+        }
+
+        int create(const QSqlDatabase& db, const QString& name, const QString& rules)
+        {
+            Condition condition;
+            if (!compile(rules, condition)) {
+                qWarning() << "invalid smart playlist rules" << rules;
+                return -1;
+            }
+
+            SqlQuery query(db);
+            query.prepare(QLatin1String("INSERT INTO smartPlaylists (name, rules) VALUES (?, ?)"));
+            query.addBindValue(name);
+            query.addBindValue(rules);
+            if (!exec(query, QLatin1String("add smart playlist"))) {
+                return -1;
+            }
+            const int id = query.lastInsertId().toInt();
+
+            query.prepare(QString::fromLatin1("INSERT INTO smartPlaylistTracks (playlistId, trackId) SELECT ?, id FROM tracks WHERE %1")
+                          .arg(condition.sql));
+            query.addBindValue(id);
+            for (const QVariant& value : condition.values) {
+                query.addBindValue(value);
+            }
+            if (!exec(query, QLatin1String("select tracks of smart playlist"))) {
+                return -1;
+            }
+            return id;
+        }
+
+        bool remove(const QSqlDatabase& db, int id)
+        {
+            // Tracks are removed by trigger
+            SqlQuery query(db);
+            query.prepare(QLatin1String("DELETE FROM smartPlaylists WHERE id = ?"));
+            query.addBindValue(id);
+            return exec(query, QLatin1String("remove smart playlist"));
+        }
+
+        bool updateTracks(const QSqlDatabase& db)
+        {
+            SqlQuery query(QLatin1String("SELECT 1 FROM smartPlaylists_dirty_tracks LIMIT 1"), db);
+            if (query.lastError().type() != QSqlError::NoError) {
+                qWarning() << "failed to get changed tracks" << query.lastError();
+                return false;
+            }
+            if (!query.next()) {
+                return true;
+            }
+            query.finish();
+
+            std::vector<std::pair<int, QString>> playlists;
+            if (!query.exec(QLatin1String("SELECT id, rules FROM smartPlaylists"))) {
+                qWarning() << "failed to get smart playlists" << query.lastError();
+                return false;
+            }
+            while (query.next()) {
+                playlists.emplace_back(query.value(0).toInt(), query.value(1).toString());
+            }
+            query.finish();
+
+            for (const auto& playlist : playlists) {
+                Condition condition;
+                if (!compile(playlist.second, condition)) {
+                    qWarning() << "invalid smart playlist rules" << playlist.second;
+                    continue;
+                }
+
+                query.prepareCached(QLatin1String("DELETE FROM smartPlaylistTracks WHERE playlistId = ? "
+                                                  "AND trackId IN (SELECT trackId FROM smartPlaylists_dirty_tracks)"));
+                query.addBindValue(playlist.first);
+                if (!exec(query, QLatin1String("remove changed tracks from smart playlist"))) {
+                    return false;
+                }
+
+                query.prepare(QString::fromLatin1("INSERT OR IGNORE INTO smartPlaylistTracks (playlistId, trackId) "
+                                                  "SELECT ?, tracks.id FROM smartPlaylists_dirty_tracks "
+                                                  "JOIN tracks ON tracks.id = smartPlaylists_dirty_tracks.trackId "
+                                                  "WHERE %1").arg(condition.sql));
+                query.addBindValue(playlist.first);
+                for (const QVariant& value : condition.values) {
+                    query.addBindValue(value);
+                }
+                if (!exec(query, QLatin1String("add changed tracks to smart playlist"))) {
+                    return false;
+                }
+            }
+
+            if (!query.exec(QLatin1String("DELETE FROM smartPlaylists_dirty_tracks"))) {
+                qWarning() << "failed to clear changed tracks" << query.lastError();
+                return false;
+            }
+            return true;
+        }
+
+        std::vector<PlaylistTrack> tracks(const QSqlDatabase& db, int id)
+        {
+            std::vector<PlaylistTrack> tracks;
+
+            QString rules;
+            if (!loadRules(db, id, rules)) {
+                return tracks;
+            }
+            Condition condition;
+            if (compile(rules, condition)) {
+                removeExpiredTracks(db, id, condition);
+            }
+
+            // Tracks are read in primary key order, without sorting
+            SqlQuery query(db);
+            query.prepareCached(QLatin1String("SELECT filePath, tracks.title, duration, "
+                                              "(SELECT group_concat(artists.title, ', ') FROM tracks_artists "
+                                              " JOIN artists ON artists.id = tracks_artists.artistId WHERE tracks_artists.trackId = tracks.id), "
+                                              "(SELECT group_concat(albums.title, ', ') FROM tracks_albums "
+                                              " JOIN albums ON albums.id = tracks_albums.albumId WHERE tracks_albums.trackId = tracks.id) "
+                                              "FROM smartPlaylistTracks JOIN tracks ON tracks.id = smartPlaylistTracks.trackId "
+                                              "WHERE playlistId = ? ORDER BY trackId"));
+            query.addBindValue(id);
+            if (!exec(query, QLatin1String("get tracks of smart playlist"))) {
+                return tracks;
+            }
+            while (query.next()) {
+                tracks.push_back(PlaylistTrack{QUrl::fromLocalFile(query.value(0).toString()),
+                                               query.value(1).toString(),
+                                               query.value(2).toInt(),
+                                               query.value(3).toString(),
+                                               query.value(4).toString()});
+            }
+            return tracks;
+        }
+    }
+}
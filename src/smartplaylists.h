@@ -0,0 +1,74 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_SMARTPLAYLISTS_H
+#define UNPLAYER_SMARTPLAYLISTS_H
+
+#include <vector>
+
+#include <QString>
+
+#include "playlistutils.h"
+
+class QSqlDatabase;
+
+namespace unplayer
+{
+    // Playlists defined by rules over library tracks. Their tracks are stored in
+    // smartPlaylistTracks table, which is updated only for tracks that were added
+    // or changed, so opening playlist doesn't evaluate its rules.
+    //
+    // Rules are JSON array of {"field": ..., "operator": ..., "value": ...} objects,
+    // track must match all of them:
+    //   artist, album, genre: "=" or "!=" title
+    //   year, playCount: "=", "!=", "<" or ">" number
+    //   addedWithinDays: number of days, operator is not used
+    //
+    // Smart playlists are shown with playlist files in PlaylistsModel,
+    // with file path made by filePath()
+    namespace smartplaylists
+    {
+        QString filePath(int id);
+        bool isSmartPlaylist(const QString& filePath);
+        int idFromFilePath(const QString& filePath);
+
+        bool isValidRules(const QString& rules);
+
+        struct Playlist
+        {
+            QString filePath;
+            QString name;
+            int tracksCount;
+        };
+        std::vector<Playlist> playlists(const QSqlDatabase& db);
+
+        // Returns id of new playlist, or -1 on error. Tracks are selected with full query once
+        int create(const QSqlDatabase& db, const QString& name, const QString& rules);
+        bool remove(const QSqlDatabase& db, int id);
+
+        // Evaluates rules for tracks marked by triggers since last call.
+        // Called by LibraryUtils::updateSummaries() before changes are committed
+        bool updateTracks(const QSqlDatabase& db);
+
+        // Tracks in order they were added to library, with their metadata
+        std::vector<PlaylistTrack> tracks(const QSqlDatabase& db, int id);
+    }
+}
+
+#endif // UNPLAYER_SMARTPLAYLISTS_H
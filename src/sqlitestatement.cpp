@@ -0,0 +1,200 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sqlitestatement.h"
+
+#include <cmath>
+
+#include <sqlite3.h>
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSqlDatabase>
+#include <QSqlDriver>
+#include <QVariant>
+
+#include "perfcounters.h"
+#include "unicode.h"
+
+namespace unplayer
+{
+    sqlite3* SqliteStatement::handle(const QSqlDatabase& db)
+    {
+        if (!db.isOpen()) {
+            return nullptr;
+        }
+        const QVariant handle(db.driver()->handle());
+        if (!handle.isValid() || qstrcmp(handle.typeName(), "sqlite3*") != 0) {
+            qWarning() << "connection is not SQLite";
+            return nullptr;
+        }
+        return *static_cast<sqlite3* const*>(handle.constData());
+    }
+
+    SqliteStatement::SqliteStatement(const QSqlDatabase& db, const QString& query)
+        : mHandle(handle(db)),
+          mStatement(nullptr)
+    {
+        if (!mHandle) {
+            return;
+        }
+        if (sqlite3_prepare16_v2(mHandle, query.utf16(), query.size() * static_cast<int>(sizeof(QChar)), &mStatement, nullptr) != SQLITE_OK) {
+            qWarning() << "failed to prepare statement" << query << lastError();
+            sqlite3_finalize(mStatement);
+            mStatement = nullptr;
+        }
+    }
+
+    SqliteStatement::~SqliteStatement()
+    {
+        sqlite3_finalize(mStatement);
+    }
+
+    bool SqliteStatement::isValid() const
+    {
+        return mStatement;
+    }
+
+    void SqliteStatement::bind(int index, int value)
+    {
+        sqlite3_bind_int(mStatement, index + 1, value);
+    }
+
+    void SqliteStatement::bind(int index, long long value)
+    {
+        sqlite3_bind_int64(mStatement, index + 1, value);
+    }
+
+    void SqliteStatement::bind(int index, bool value)
+    {
+        sqlite3_bind_int(mStatement, index + 1, value ? 1 : 0);
+    }
+
+    void SqliteStatement::bind(int index, double value)
+    {
+        if (std::isnan(value)) {
+            bindNull(index);
+            return;
+        }
+        sqlite3_bind_double(mStatement, index + 1, value);
+    }
+
+    void SqliteStatement::bind(int index, const QString& value)
+    {
+        if (value.isNull()) {
+            bindNull(index);
+            return;
+        }
+        // Implicitly shared, data stays valid until reset()
+        mBoundStrings.push_back(value);
+        const QString& bound = mBoundStrings.back();
+        sqlite3_bind_text16(mStatement, index + 1, bound.utf16(), bound.size() * static_cast<int>(sizeof(QChar)), SQLITE_STATIC);
+    }
+
+    void SqliteStatement::bindNull(int index)
+    {
+        sqlite3_bind_null(mStatement, index + 1);
+    }
+
+    bool SqliteStatement::exec()
+    {
+        if (!mStatement) {
+            return false;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        const int result = sqlite3_step(mStatement);
+        perfcounters::add(perfcounters::SqlQueries);
+        perfcounters::add(perfcounters::SqlQueriesTime, timer.nsecsElapsed());
+        reset();
+        return result == SQLITE_DONE || result == SQLITE_ROW;
+    }
+
+    bool SqliteStatement::next()
+    {
+        if (!mStatement) {
+            return false;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        const int result = sqlite3_step(mStatement);
+        perfcounters::add(perfcounters::SqlQueriesTime, timer.nsecsElapsed());
+        if (result == SQLITE_ROW) {
+            return true;
+        }
+        // Query is counted once, when its rows are exhausted
+        perfcounters::add(perfcounters::SqlQueries);
+        if (result != SQLITE_DONE) {
+            qWarning() << "failed to execute statement" << lastError();
+        }
+        reset();
+        return false;
+    }
+
+    void SqliteStatement::reset()
+    {
+        if (!mStatement) {
+            return;
+        }
+        sqlite3_reset(mStatement);
+        // Bound strings must not be used after they are released
+        sqlite3_clear_bindings(mStatement);
+        mBoundStrings.clear();
+    }
+
+    bool SqliteStatement::isNull(int column) const
+    {
+        return sqlite3_column_type(mStatement, column) == SQLITE_NULL;
+    }
+
+    int SqliteStatement::intValue(int column) const
+    {
+        return sqlite3_column_int(mStatement, column);
+    }
+
+    long long SqliteStatement::longLongValue(int column) const
+    {
+        return sqlite3_column_int64(mStatement, column);
+    }
+
+    QString SqliteStatement::stringValue(int column) const
+    {
+        // Database is UTF-8, text is converted by us instead of SQLite's byte by byte decoder
+        const unsigned char* text = sqlite3_column_text(mStatement, column);
+        if (!text) {
+            return QString();
+        }
+        // Size must be taken after text is converted
+        return unicode::fromUtf8(reinterpret_cast<const char*>(text), sqlite3_column_bytes(mStatement, column));
+    }
+
+    int SqliteStatement::changes() const
+    {
+        return mHandle ? sqlite3_changes(mHandle) : 0;
+    }
+
+    long long SqliteStatement::lastInsertId() const
+    {
+        return mHandle ? sqlite3_last_insert_rowid(mHandle) : -1;
+    }
+
+    QString SqliteStatement::lastError() const
+    {
+        return mHandle ? QString::fromUtf8(sqlite3_errmsg(mHandle)) : QString(QLatin1String("no connection"));
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_SQLITESTATEMENT_H
+#define UNPLAYER_SQLITESTATEMENT_H
+
+#include <vector>
+
+#include <QString>
+
+class QSqlDatabase;
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace unplayer
+{
+    // Prepared statement on SQLite handle of Qt connection, for loops that execute
+    // statement for every track. Values are bound and read without QVariant and strings
+    // are passed to SQLite as UTF-16 without copying. Statement takes part in transaction
+    // of connection. Use SqlQuery everywhere else
+    class SqliteStatement final
+    {
+    public:
+        // Returns handle of open connection of Qt SQLite driver, or nullptr
+        static sqlite3* handle(const QSqlDatabase& db);
+
+        explicit SqliteStatement(const QSqlDatabase& db, const QString& query);
+        ~SqliteStatement();
+        SqliteStatement(const SqliteStatement&) = delete;
+        SqliteStatement& operator=(const SqliteStatement&) = delete;
+
+        bool isValid() const;
+
+        // Indexes start from 0, like in QSqlQuery
+        void bind(int index, int value);
+        void bind(int index, long long value);
+        void bind(int index, bool value);
+        // NaN is bound as NULL
+        void bind(int index, double value);
+        // Null string is bound as NULL. String is kept until statement is reset
+        void bind(int index, const QString& value);
+        void bindNull(int index);
+
+        // Executes statement that doesn't return rows and resets it
+        bool exec();
+        // Executes statement or steps to next row. Statement is reset when there are no more rows
+        bool next();
+        void reset();
+
+        bool isNull(int column) const;
+        int intValue(int column) const;
+        long long longLongValue(int column) const;
+        QString stringValue(int column) const;
+
+        // Rows changed by last execution
+        int changes() const;
+        long long lastInsertId() const;
+        QString lastError() const;
+
+    private:
+        sqlite3* mHandle;
+        sqlite3_stmt* mStatement;
+        std::vector<QString> mBoundStrings;
+    };
+}
+
+#endif // UNPLAYER_SQLITESTATEMENT_H
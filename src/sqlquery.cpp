@@ -0,0 +1,296 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "sqlquery.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QThreadStorage>
+
+#include "perfcounters.h"
+#include "stdutils.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        std::mutex statisticsMutex;
+        // Query field is not used
+        std::unordered_map<QString, SqlQuery::Statistics> queriesStatistics;
+
+        // Cached statements of thread, keyed by connection name and simplified query.
+        // Statement is taken out of cache while SqlQuery uses it
+        struct StatementCache
+        {
+            std::unordered_map<QString, QSqlQuery> statements;
+        };
+        QThreadStorage<StatementCache*> statementCaches;
+
+        // Thread uses a handful of distinct queries, cache is dropped
+        // when it grows past that (e.g. filters of search)
+        const std::size_t statementCacheMaxSize = 64;
+
+        QString cacheKey(const QSqlDatabase& db, const QString& query)
+        {
+            return db.connectionName() + QLatin1Char('\n') + query.simplified();
+        }
+
+        double toMsecs(qint64 nsecs)
+        {
+            return nsecs / 1000000.0;
+        }
+    }
+
+    std::atomic_int SqlQuery::slowQueryThreshold(0);
+
+    std::vector<SqlQuery::Statistics> SqlQuery::statistics()
+    {
+        std::vector<Statistics> queries;
+        {
+            const std::lock_guard<std::mutex> lock(statisticsMutex);
+            queries.reserve(queriesStatistics.size());
+            for (const auto& i : queriesStatistics) {
+                queries.push_back(i.second);
+                queries.back().query = i.first;
+            }
+        }
+        std::sort(queries.begin(), queries.end(), [](const Statistics& first, const Statistics& second) {
+            return first.total > second.total;
+        });
+        return queries;
+    }
+
+    void SqlQuery::dumpStatistics()
+    {
+        const std::vector<Statistics> queries(statistics());
+        qDebug() << "statistics of" << queries.size() << "queries:";
+        for (const Statistics& s : queries) {
+            qDebug().nospace() << "total " << toMsecs(s.total)
+                               << " ms, executions " << s.executions
+                               << ", mean " << toMsecs(s.total / s.executions)
+                               << " ms, max " << toMsecs(s.max)
+                               << " ms, rows " << s.rows
+                               << ": " << s.query;
+        }
+    }
+
+    QStringList SqlQuery::queryPlan(const QSqlQuery& query, const QSqlDatabase& db, bool* fullScan)
+    {
+        QStringList plan;
+        if (fullScan) {
+            *fullScan = false;
+        }
+
+        QSqlQuery explain(db);
+        explain.prepare(QLatin1String("EXPLAIN QUERY PLAN ") + query.lastQuery());
+        for (int i = 0, max = query.boundValues().size(); i < max; ++i) {
+            explain.addBindValue(query.boundValue(i));
+        }
+        if (!explain.exec()) {
+            qWarning() << "failed to explain query" << query.lastQuery() << explain.lastError();
+            return plan;
+        }
+
+        while (explain.next()) {
+            // Description is the last column
+            const QString detail(explain.value(explain.record().count() - 1).toString());
+            if (fullScan && detail.startsWith(QLatin1String("SCAN")) && !detail.contains(QLatin1String("INDEX"))) {
+                *fullScan = true;
+            }
+            plan.push_back(detail);
+        }
+        return plan;
+    }
+
+    void SqlQuery::clearCache(const QString& connectionName)
+    {
+        if (!statementCaches.hasLocalData()) {
+            return;
+        }
+        const QString prefix(connectionName + QLatin1Char('\n'));
+        auto& statements = statementCaches.localData()->statements;
+        for (auto i = statements.begin(); i != statements.end();) {
+            if (i->first.startsWith(prefix)) {
+                i = statements.erase(i);
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    SqlQuery::SqlQuery()
+        : SqlQuery(QSqlDatabase::database())
+    {
+    }
+
+    SqlQuery::SqlQuery(const QSqlDatabase& db)
+        : QSqlQuery(db),
+          mDb(db)
+    {
+        // Scrollable query keeps copy of every fetched row until it is finished
+        setForwardOnly(true);
+    }
+
+    SqlQuery::SqlQuery(const QString& query, const QSqlDatabase& db)
+        : SqlQuery(db.isValid() ? db : QSqlDatabase::database())
+    {
+        if (!query.isEmpty()) {
+            exec(query);
+        }
+    }
+
+    SqlQuery::~SqlQuery()
+    {
+        release();
+        end();
+    }
+
+    bool SqlQuery::prepare(const QString& query)
+    {
+        release();
+        return QSqlQuery::prepare(query);
+    }
+
+    bool SqlQuery::prepareCached(const QString& query)
+    {
+        release();
+        end();
+
+        QString key(cacheKey(mDb, query));
+        if (statementCaches.hasLocalData()) {
+            auto& statements = statementCaches.localData()->statements;
+            const auto found(statements.find(key));
+            if (found != statements.end()) {
+                perfcounters::add(perfcounters::SqlStatementCacheHits);
+                QSqlQuery::operator=(found->second);
+                statements.erase(found);
+                mCacheKey = std::move(key);
+                return true;
+            }
+        }
+
+        perfcounters::add(perfcounters::SqlStatementCacheMisses);
+        if (!QSqlQuery::prepare(query)) {
+            return false;
+        }
+        mCacheKey = std::move(key);
+        return true;
+    }
+
+    bool SqlQuery::exec()
+    {
+        begin();
+        const bool ok = QSqlQuery::exec();
+        mElapsed += mTimer.nsecsElapsed();
+        return ok;
+    }
+
+    bool SqlQuery::exec(const QString& query)
+    {
+        release();
+        begin();
+        const bool ok = QSqlQuery::exec(query);
+        mElapsed += mTimer.nsecsElapsed();
+        return ok;
+    }
+
+    bool SqlQuery::next()
+    {
+        mTimer.start();
+        const bool ok = QSqlQuery::next();
+        mElapsed += mTimer.nsecsElapsed();
+        if (ok) {
+            ++mRows;
+        }
+        return ok;
+    }
+
+    void SqlQuery::finish()
+    {
+        end();
+        QSqlQuery::finish();
+    }
+
+    void SqlQuery::release()
+    {
+        if (mCacheKey.isEmpty()) {
+            return;
+        }
+        end();
+        // Finished statement doesn't keep read transaction open
+        QSqlQuery::finish();
+
+        if (!statementCaches.hasLocalData()) {
+            statementCaches.setLocalData(new StatementCache());
+        }
+        auto& statements = statementCaches.localData()->statements;
+        if (statements.size() >= statementCacheMaxSize) {
+            statements.clear();
+        }
+        // If another SqlQuery has already returned the same statement, this one is dropped
+        statements.emplace(mCacheKey, static_cast<const QSqlQuery&>(*this));
+        mCacheKey.clear();
+    }
+
+    void SqlQuery::begin()
+    {
+        end();
+        mExecuted = true;
+        mElapsed = 0;
+        mRows = 0;
+        mTimer.start();
+    }
+
+    void SqlQuery::end()
+    {
+        if (!mExecuted) {
+            return;
+        }
+        mExecuted = false;
+
+        perfcounters::add(perfcounters::SqlQueries);
+        perfcounters::add(perfcounters::SqlQueriesTime, mElapsed);
+
+        {
+            const std::lock_guard<std::mutex> lock(statisticsMutex);
+            auto found(queriesStatistics.find(lastQuery()));
+            if (found == queriesStatistics.end()) {
+                queriesStatistics.insert({lastQuery(), {QString(), 1, mRows, mElapsed, mElapsed}});
+            } else {
+                Statistics& s = found->second;
+                ++s.executions;
+                s.rows += mRows;
+                s.total += mElapsed;
+                s.max = std::max(s.max, mElapsed);
+            }
+        }
+
+        const int threshold = slowQueryThreshold.load(std::memory_order_relaxed);
+        if (threshold > 0 && mElapsed >= threshold * 1000000ll) {
+            qWarning().nospace() << "slow query took " << toMsecs(mElapsed) << " ms and returned " << mRows << " rows: "
+                                 << lastQuery() << ", plan: " << queryPlan(*this, mDb);
+        }
+    }
+}
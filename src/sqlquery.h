@@ -0,0 +1,105 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_SQLQUERY_H
+#define UNPLAYER_SQLQUERY_H
+
+#include <atomic>
+#include <vector>
+
+#include <QElapsedTimer>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QStringList>
+
+namespace unplayer
+{
+    // QSqlQuery that records time spent in exec() and next() and number of fetched rows.
+    // Execution is recorded when query is executed again, finished or destroyed,
+    // statistics are aggregated by query string.
+    // Methods hide ones of QSqlQuery, so calls must be made through SqlQuery.
+    // Queries are forward only, rows are read with next()
+    //
+    // Statements prepared with prepareCached() are kept per thread and connection when
+    // SqlQuery is destroyed, and are taken from there instead of being prepared again
+    class SqlQuery final : public QSqlQuery
+    {
+    public:
+        // Executions that take longer are logged with query plan, 0 disables logging
+        static std::atomic_int slowQueryThreshold;
+
+        struct Statistics
+        {
+            QString query;
+            int executions;
+            int rows;
+            // Nanoseconds
+            qint64 total;
+            qint64 max;
+        };
+
+        // Aggregated statistics of all queries, slowest first
+        static std::vector<Statistics> statistics();
+        // Logs statistics()
+        static void dumpStatistics();
+
+        // Returns details of EXPLAIN QUERY PLAN for prepared query,
+        // fullScan is set if any table is scanned without index
+        static QStringList queryPlan(const QSqlQuery& query, const QSqlDatabase& db, bool* fullScan = nullptr);
+
+        // Drops cached statements of connection on current thread.
+        // Must be called before connection is removed
+        static void clearCache(const QString& connectionName);
+
+        SqlQuery();
+        explicit SqlQuery(const QSqlDatabase& db);
+        // Executes query immediately, like QSqlQuery
+        SqlQuery(const QString& query, const QSqlDatabase& db = QSqlDatabase());
+        ~SqlQuery();
+
+        SqlQuery(const SqlQuery&) = delete;
+        SqlQuery& operator=(const SqlQuery&) = delete;
+
+        bool prepare(const QString& query);
+        // Like prepare(), but reuses statement of previous SqlQuery with the same query
+        // and connection on this thread. All values must be bound again before exec()
+        bool prepareCached(const QString& query);
+
+        bool exec();
+        bool exec(const QString& query);
+        bool next();
+        void finish();
+
+    private:
+        void begin();
+        void end();
+        // Returns cached statement to cache
+        void release();
+
+        QSqlDatabase mDb;
+        // Empty if statement is not cached
+        QString mCacheKey;
+        QElapsedTimer mTimer;
+        qint64 mElapsed = 0;
+        int mRows = 0;
+        bool mExecuted = false;
+    };
+}
+
+#endif // UNPLAYER_SQLQUERY_H
@@ -0,0 +1,79 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "stallwatchdog.h"
+
+#include <algorithm>
+
+#include <QDebug>
+
+#include "tracing.h"
+
+namespace unplayer
+{
+    StallWatchdog::StallWatchdog(int threshold, QObject* parent)
+        : QThread(parent),
+          mThreshold(threshold),
+          mInterval(std::max(threshold / 4, 10)),
+          mLastHeartbeat(0),
+          mStopped(false)
+    {
+        mClock.start();
+        tracing::trackMainThread = true;
+
+        mHeartbeatTimer.setInterval(mInterval);
+        QObject::connect(&mHeartbeatTimer, &QTimer::timeout, this, [=]() {
+            mLastHeartbeat = mClock.elapsed();
+        });
+        mHeartbeatTimer.start();
+    }
+
+    StallWatchdog::~StallWatchdog()
+    {
+        mStopped = true;
+        wait();
+        tracing::trackMainThread = false;
+    }
+
+    void StallWatchdog::run()
+    {
+        bool stalled = false;
+        qint64 stallBegin = 0;
+        while (!mStopped) {
+            msleep(mInterval);
+
+            const qint64 lastHeartbeat = mLastHeartbeat;
+            const qint64 sinceHeartbeat = mClock.elapsed() - lastHeartbeat;
+            // Heartbeat is expected every interval
+            if (sinceHeartbeat > mThreshold + mInterval) {
+                if (!stalled) {
+                    stalled = true;
+                    stallBegin = lastHeartbeat;
+                    const char* span = tracing::mainThreadSpan;
+                    qWarning().nospace() << "main thread is stalled for " << sinceHeartbeat << " ms in "
+                                         << (span ? span : "untraced code");
+                    tracing::mark("main thread stall");
+                }
+            } else if (stalled) {
+                stalled = false;
+                qWarning() << "main thread resumed after" << (lastHeartbeat - stallBegin) << "ms";
+            }
+        }
+    }
+}
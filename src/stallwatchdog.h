@@ -0,0 +1,54 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_STALLWATCHDOG_H
+#define UNPLAYER_STALLWATCHDOG_H
+
+#include <atomic>
+
+#include <QElapsedTimer>
+#include <QThread>
+#include <QTimer>
+
+namespace unplayer
+{
+    // Detects when main thread doesn't process events for longer than threshold.
+    // Main thread timer updates heartbeat, watchdog thread checks it and logs
+    // stall with innermost traced span of main thread
+    class StallWatchdog final : public QThread
+    {
+    public:
+        // threshold is in milliseconds
+        explicit StallWatchdog(int threshold, QObject* parent = nullptr);
+        ~StallWatchdog() override;
+
+    protected:
+        void run() override;
+
+    private:
+        const int mThreshold;
+        const int mInterval;
+        QElapsedTimer mClock;
+        QTimer mHeartbeatTimer;
+        std::atomic<qint64> mLastHeartbeat;
+        std::atomic_bool mStopped;
+    };
+}
+
+#endif // UNPLAYER_STALLWATCHDOG_H
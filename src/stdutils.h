@@ -61,7 +61,7 @@ namespace unplayer
     template<class C, class V>
     inline auto contains_impl(const C& container, const V& value, int) -> decltype(container.find(value), true)
     {
-        return container.find(value) != end(container);
+        return container.find(value) != container.end();
     }
 
     template<class C, class V>
@@ -18,6 +18,10 @@
 
 #include "tagutils.h"
 
+#include <algorithm>
+
+#include <QElapsedTimer>
+#include <QFile>
 #include <QFileInfo>
 
 #include <apefile.h>
@@ -25,21 +29,224 @@
 #include <attachedpictureframe.h>
 #include <fileref.h>
 #include <flacfile.h>
+#include <infotag.h>
+#include <id3v2framefactory.h>
+#include <id3v1tag.h>
 #include <id3v2tag.h>
 #include <mp4file.h>
 #include <mpegfile.h>
 #include <oggflacfile.h>
 #include <opusfile.h>
+#include <tiostream.h>
 #include <tpropertymap.h>
 #include <vorbisfile.h>
+#include <wavfile.h>
+#include <wavpackfile.h>
 #include <xiphcomment.h>
 
+#include "mpegduration.h"
+#include "perfcounters.h"
+#include "unicode.h"
+
 namespace unplayer
 {
     namespace tagutils
     {
         namespace
         {
+            const long long streamChunkSize = 128 * 1024;
+            const long long streamChunkAlignment = 4096;
+
+            // Tracks reads of one file against its budget
+            class BudgetState final
+            {
+            public:
+                explicit BudgetState(const ReadBudget& budget)
+                    : mBudget(budget),
+                      mRead(0),
+                      mExceeded(false)
+                {
+                    mTimer.start();
+                }
+
+                // Returns false if reading size bytes from disk would exceed the budget
+                bool consume(long long size)
+                {
+                    if (mExceeded) {
+                        return false;
+                    }
+                    mRead += size;
+                    if ((mBudget.maxBytes > 0 && mRead > mBudget.maxBytes) ||
+                            (mBudget.maxTime > 0 && mTimer.elapsed() > mBudget.maxTime)) {
+                        mExceeded = true;
+                    }
+                    return !mExceeded;
+                }
+
+                bool isExceeded() const
+                {
+                    return mExceeded;
+                }
+
+            private:
+                const ReadBudget& mBudget;
+                QElapsedTimer mTimer;
+                long long mRead;
+                bool mExceeded;
+            };
+
+            // Read-only stream that reads file in large aligned chunks.
+            // TagLib parsers make many small reads around the start and the end of file,
+            // which are slow on SD cards and network mounts
+            class ChunkedFileStream final : public TagLib::IOStream
+            {
+            public:
+                explicit ChunkedFileStream(const QString& filePath, BudgetState& budget)
+                    : mBudget(budget),
+                      mFile(filePath),
+                      mName(filePath.toUtf8()),
+                      mPosition(0),
+                      mLength(0)
+                {
+                    if (mFile.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+                        mLength = mFile.size();
+                    }
+                }
+
+                TagLib::FileName name() const override
+                {
+                    return mName.constData();
+                }
+
+                TagLib::ByteVector readBlock(unsigned long length) override
+                {
+                    if (!isOpen() || mPosition >= mLength || length == 0 || mBudget.isExceeded()) {
+                        return TagLib::ByteVector();
+                    }
+
+                    const long long size = std::min(static_cast<long long>(length), mLength - mPosition);
+
+                    // Large blocks (pictures) are read directly
+                    if (size > streamChunkSize) {
+                        if (!mBudget.consume(size)) {
+                            return TagLib::ByteVector();
+                        }
+                        TagLib::ByteVector data(static_cast<unsigned int>(size), 0);
+                        const long long read = mFile.seek(mPosition) ? mFile.read(data.data(), size) : -1;
+                        if (read <= 0) {
+                            return TagLib::ByteVector();
+                        }
+                        data.resize(static_cast<unsigned int>(read));
+                        mPosition += read;
+                        return data;
+                    }
+
+                    const Chunk* chunk = findChunk(mPosition, size);
+                    if (!chunk) {
+                        chunk = loadChunk(mPosition, size);
+                        if (!chunk) {
+                            return TagLib::ByteVector();
+                        }
+                    }
+
+                    const long long offset = mPosition - chunk->offset;
+                    const long long available = std::min(size, static_cast<long long>(chunk->data.size()) - offset);
+                    mPosition += available;
+                    return TagLib::ByteVector(chunk->data.constData() + offset, static_cast<unsigned int>(available));
+                }
+
+                void writeBlock(const TagLib::ByteVector&) override {}
+                void insert(const TagLib::ByteVector&, unsigned long, unsigned long) override {}
+                void removeBlock(unsigned long, unsigned long) override {}
+
+                bool readOnly() const override
+                {
+                    return true;
+                }
+
+                bool isOpen() const override
+                {
+                    return mFile.isOpen();
+                }
+
+                void seek(long offset, Position p) override
+                {
+                    switch (p) {
+                    case Beginning:
+                        mPosition = offset;
+                        break;
+                    case Current:
+                        mPosition += offset;
+                        break;
+                    case End:
+                        mPosition = mLength + offset;
+                        break;
+                    }
+                    mPosition = std::max(mPosition, 0LL);
+                }
+
+                long tell() const override
+                {
+                    return static_cast<long>(mPosition);
+                }
+
+                long length() override
+                {
+                    return static_cast<long>(mLength);
+                }
+
+                void truncate(long) override {}
+
+            private:
+                struct Chunk
+                {
+                    long long offset = -1;
+                    QByteArray data;
+                };
+
+                const Chunk* findChunk(long long position, long long size) const
+                {
+                    for (const Chunk& chunk : mChunks) {
+                        if (chunk.offset != -1 &&
+                                position >= chunk.offset &&
+                                position + size <= chunk.offset + chunk.data.size()) {
+                            return &chunk;
+                        }
+                    }
+                    return nullptr;
+                }
+
+                const Chunk* loadChunk(long long position, long long size)
+                {
+                    // Beginning of file is kept separately, since parsers often return to it
+                    const long long start = position & ~(streamChunkAlignment - 1);
+                    Chunk& chunk = mChunks[start == 0 ? 0 : 1];
+                    const long long chunkLength = std::min(mLength - start, std::max(streamChunkSize, position + size - start));
+                    if (!mBudget.consume(chunkLength)) {
+                        return nullptr;
+                    }
+                    chunk.offset = -1;
+                    chunk.data.resize(static_cast<int>(chunkLength));
+                    if (!mFile.seek(start)) {
+                        return nullptr;
+                    }
+                    const long long read = mFile.read(chunk.data.data(), chunkLength);
+                    if (read <= position - start) {
+                        return nullptr;
+                    }
+                    chunk.data.resize(static_cast<int>(read));
+                    chunk.offset = start;
+                    return &chunk;
+                }
+
+                BudgetState& mBudget;
+                QFile mFile;
+                const QByteArray mName;
+                long long mPosition;
+                long long mLength;
+                Chunk mChunks[2];
+            };
+
             enum class VorbisComment
             {
                 Artist,
@@ -47,64 +254,117 @@ namespace unplayer
                 Genre
             };
 
-            void getTags(const TagLib::Tag* tag, const TagLib::PropertyMap& properties, Info& info)
+            // TagLib stores strings as std::wstring, convert them without intermediate UTF-8 copy
+            QString toQString(const TagLib::String& string)
             {
-                info.title = tag->title().toCString(true);
-                info.year = tag->year();
-                info.trackNumber = tag->track();
+                return unicode::fromWCharArray(string.toCWString(), static_cast<int>(string.size()));
+            }
 
-                const TagLib::StringList& artists = properties["ARTIST"];
-                info.artists.reserve(artists.size());
-                for (const TagLib::String& artist : artists) {
-                    info.artists.push_back(artist.toCString(true));
+            // Lists usually have one or two items, linear search is cheaper than QStringList::removeDuplicates()
+            void appendUnique(const TagLib::StringList& strings, QStringList& list)
+            {
+                list.reserve(list.size() + static_cast<int>(strings.size()));
+                for (const TagLib::String& string : strings) {
+                    QString converted(toQString(string));
+                    if (!list.contains(converted)) {
+                        list.push_back(std::move(converted));
+                    }
                 }
-                info.artists.removeDuplicates();
+            }
 
-                const TagLib::StringList& albums = properties["ALBUM"];
-                info.albums.reserve(albums.size());
-                for (const TagLib::String& album : albums) {
-                    info.albums.push_back(album.toCString(true));
+            // Values are stored as text like "-6.48 dB", unit is ignored.
+            // ID3v2 TXXX frames and APE items are mapped to the same keys by TagLib
+            void getReplayGain(const TagLib::PropertyMap& properties, const char* key, double& value)
+            {
+                const auto found(properties.find(key));
+                if (found == properties.end() || found->second.isEmpty()) {
+                    return;
                 }
-                info.albums.removeDuplicates();
-
-                const TagLib::StringList& genres = properties["GENRE"];
-                info.genres.reserve(genres.size());
-                for (const TagLib::String& genre : genres) {
-                    info.genres.push_back(genre.toCString(true));
+                const QString string(toQString(found->second.front()).trimmed());
+                int end = 0;
+                while (end < string.size() && (string[end].isDigit() || string[end] == QLatin1Char('-') ||
+                                               string[end] == QLatin1Char('+') || string[end] == QLatin1Char('.'))) {
+                    ++end;
                 }
-                info.genres.removeDuplicates();
+                bool ok;
+                const double parsed = string.leftRef(end).toDouble(&ok);
+                if (ok) {
+                    value = parsed;
+                }
+            }
 
-                if (properties.contains("DISCNUMBER")) {
-                    const TagLib::StringList list(properties["DISCNUMBER"]);
-                    if (!list.isEmpty()) {
-                        info.discNumber = list[0].toCString(true);
-                    }
+            void getTags(const TagLib::Tag* tag, const TagLib::PropertyMap& properties, Info& info)
+            {
+                info.title = toQString(tag->title());
+                info.year = tag->year();
+                info.trackNumber = tag->track();
+
+                appendUnique(properties["ARTIST"], info.artists);
+                appendUnique(properties["ALBUM"], info.albums);
+                appendUnique(properties["GENRE"], info.genres);
+
+                const auto discNumber(properties.find("DISCNUMBER"));
+                if (discNumber != properties.end() && !discNumber->second.isEmpty()) {
+                    info.discNumber = toQString(discNumber->second.front());
                 }
+
+                getReplayGain(properties, "REPLAYGAIN_TRACK_GAIN", info.replayGainTrack);
+                getReplayGain(properties, "REPLAYGAIN_ALBUM_GAIN", info.replayGainAlbum);
+                getReplayGain(properties, "REPLAYGAIN_TRACK_PEAK", info.replayGainTrackPeak);
+                getReplayGain(properties, "REPLAYGAIN_ALBUM_PEAK", info.replayGainAlbumPeak);
             }
 
             void getAudioProperties(const TagLib::File& file, Info& info)
             {
+                info.valid = file.isValid();
                 const TagLib::AudioProperties* audioProperties = file.audioProperties();
                 if (audioProperties) {
                     info.duration = audioProperties->length();
                     info.bitrate = audioProperties->bitrate();
+                    info.sampleRate = audioProperties->sampleRate();
+                    info.channels = audioProperties->channels();
                 }
             }
 
-            void setMediaArt(const TagLib::ByteVector& data, Info& info)
+            // TagLib estimates duration of MPEG file without Xing or VBRI header from the first frame,
+            // which is wrong for VBR files
+            void getMpegDuration(TagLib::IOStream* stream, TagLib::MPEG::File& file, Info& info)
             {
-                info.mediaArtData = QByteArray(data.data(), data.size());
+                int tagLength = 0;
+                if (file.hasID3v2Tag()) {
+                    const TagLib::ID3v2::FrameList frames(file.ID3v2Tag()->frameList("TLEN"));
+                    if (!frames.isEmpty()) {
+                        tagLength = frames.front()->toString().toInt();
+                    }
+                }
+
+                const mpegduration::Duration duration(mpegduration::read(stream, tagLength));
+                info.duration = duration.duration;
+                info.bitrate = duration.bitrate;
+                info.sampleRate = duration.sampleRate;
+                info.channels = duration.channels;
+                info.durationEstimated = duration.valid && !duration.exact;
+            }
+
+            void setMediaArt(const TagLib::ByteVector& data, Info& info, const MediaArtHandler& mediaArtHandler)
+            {
+                if (mediaArtHandler) {
+                    // Don't copy data, TagLib buffer is alive until handler returns
+                    mediaArtHandler(QByteArray::fromRawData(data.data(), static_cast<int>(data.size())));
+                } else {
+                    info.mediaArtData = QByteArray(data.data(), data.size());
+                }
             }
 
-            void getFlacMediaArt(TagLib::FLAC::File& file, Info& info)
+            void getFlacMediaArt(TagLib::FLAC::File& file, Info& info, const MediaArtHandler& mediaArtHandler)
             {
                 const TagLib::List<TagLib::FLAC::Picture*> pictures(file.pictureList());
                 if (!pictures.isEmpty()) {
-                    setMediaArt(pictures.front()->data(), info);
+                    setMediaArt(pictures.front()->data(), info, mediaArtHandler);
                 }
             }
 
-            void getApeMediaArt(const TagLib::APE::Tag* tag, Info& info)
+            void getApeMediaArt(const TagLib::APE::Tag* tag, Info& info, const MediaArtHandler& mediaArtHandler)
             {
                 if (!tag) {
                     return;
@@ -116,11 +376,11 @@ namespace unplayer
                     const TagLib::APE::Item item(items["COVER ART (FRONT)"]);
                     TagLib::ByteVector data(item.binaryData());
                     data = data.mid(data.find('\0') + 1);
-                    setMediaArt(data, info);
+                    setMediaArt(data, info, mediaArtHandler);
                 }
             }
 
-            void getMp4MediaArt(const TagLib::MP4::Tag* tag, Info& info)
+            void getMp4MediaArt(const TagLib::MP4::Tag* tag, Info& info, const MediaArtHandler& mediaArtHandler)
             {
                 if (!tag) {
                     return;
@@ -130,12 +390,12 @@ namespace unplayer
                 if (coverItem.isValid()) {
                     const TagLib::MP4::CoverArtList covers(coverItem.toCoverArtList());
                     if (!covers.isEmpty()) {
-                        setMediaArt(covers.front().data(), info);
+                        setMediaArt(covers.front().data(), info, mediaArtHandler);
                     }
                 }
             }
 
-            void getId3v2MediaArt(const TagLib::ID3v2::Tag* tag, Info& info)
+            void getId3v2MediaArt(const TagLib::ID3v2::Tag* tag, Info& info, const MediaArtHandler& mediaArtHandler)
             {
                 if (!tag) {
                     return;
@@ -145,14 +405,14 @@ namespace unplayer
                 if (picFrames.isEmpty()) {
                     const TagLib::ID3v2::FrameList apicFrames(tag->frameList("APIC"));
                     if (!apicFrames.isEmpty()) {
-                        setMediaArt(static_cast<const TagLib::ID3v2::AttachedPictureFrame*>(apicFrames.front())->picture(), info);
+                        setMediaArt(static_cast<const TagLib::ID3v2::AttachedPictureFrame*>(apicFrames.front())->picture(), info, mediaArtHandler);
                     }
                 } else {
-                    setMediaArt(static_cast<const TagLib::ID3v2::AttachedPictureFrameV22*>(picFrames.front())->picture(), info);
+                    setMediaArt(static_cast<const TagLib::ID3v2::AttachedPictureFrameV22*>(picFrames.front())->picture(), info, mediaArtHandler);
                 }
             }
 
-            void getXiphMediaArt(TagLib::Ogg::XiphComment* tag, Info& info)
+            void getXiphMediaArt(TagLib::Ogg::XiphComment* tag, Info& info, const MediaArtHandler& mediaArtHandler)
             {
                 if (!tag) {
                     return;
@@ -160,103 +420,213 @@ namespace unplayer
 
                 const TagLib::List<TagLib::FLAC::Picture*> pictures(tag->pictureList());
                 if (!pictures.isEmpty()) {
-                    setMediaArt(pictures.front()->data(), info);
+                    setMediaArt(pictures.front()->data(), info, mediaArtHandler);
                 }
             }
         }
 
-        Info getTrackInfo(const QFileInfo& fileInfo, const QString& mimeType)
+        Info getTrackInfo(const QFileInfo& fileInfo, MimeType mimeType, ReadProfile profile, const MediaArtHandler& mediaArtHandler, const ReadBudget& budget)
         {
+            perfcounters::add(perfcounters::TagLibOpens);
+
             Info info;
+            BudgetState budgetState(budget);
 
-            switch (mimeTypeFromString(mimeType)) {
+            const bool readProperties = profile != ReadProfile::MediaArtOnly;
+            const bool readTags = profile != ReadProfile::MediaArtOnly && profile != ReadProfile::PropertiesOnly;
+            const bool readMediaArt = profile != ReadProfile::FastWithoutMediaArt &&
+                                      profile != ReadProfile::FullWithoutMediaArt &&
+                                      profile != ReadProfile::PropertiesOnly;
+            const auto readStyle = (profile == ReadProfile::Full ||
+                                    profile == ReadProfile::FullWithoutMediaArt ||
+                                    profile == ReadProfile::PropertiesOnly) ? TagLib::AudioProperties::Average
+                                                                            : TagLib::AudioProperties::Fast;
+
+            switch (mimeType) {
             case MimeType::Flac:
             {
-                TagLib::FLAC::File file(fileInfo.filePath().toUtf8().data());
+                ChunkedFileStream stream(fileInfo.filePath(), budgetState);
+                TagLib::FLAC::File file(&stream, TagLib::ID3v2::FrameFactory::instance(), readProperties, readStyle);
                 getAudioProperties(file, info);
-                if (file.hasID3v2Tag()) {
-                    getTags(file.ID3v2Tag(), file.ID3v2Tag()->properties(), info);
-                } else if (file.hasXiphComment()) {
-                    getTags(file.xiphComment(), file.xiphComment()->properties(), info);
+                if (readTags) {
+                    if (file.hasID3v2Tag()) {
+                        getTags(file.ID3v2Tag(), file.ID3v2Tag()->properties(), info);
+                    } else if (file.hasXiphComment()) {
+                        getTags(file.xiphComment(), file.xiphComment()->properties(), info);
+                    }
+                }
+                if (readMediaArt) {
+                    getFlacMediaArt(file, info, mediaArtHandler);
                 }
-                getFlacMediaArt(file, info);
                 break;
             }
             case MimeType::Mp4:
             case MimeType::Mp4b:
             {
-                const TagLib::MP4::File file(fileInfo.filePath().toUtf8().data());
+                ChunkedFileStream stream(fileInfo.filePath(), budgetState);
+                const TagLib::MP4::File file(&stream, readProperties, readStyle);
                 getAudioProperties(file, info);
                 if (file.hasMP4Tag()) {
-                    getTags(file.tag(), file.tag()->properties(), info);
-                    getMp4MediaArt(file.tag(), info);
+                    if (readTags) {
+                        getTags(file.tag(), file.tag()->properties(), info);
+                    }
+                    if (readMediaArt) {
+                        getMp4MediaArt(file.tag(), info, mediaArtHandler);
+                    }
                 }
                 break;
             }
             case MimeType::Mpeg:
             {
-                TagLib::MPEG::File file(fileInfo.filePath().toUtf8().data());
+                ChunkedFileStream stream(fileInfo.filePath(), budgetState);
+                const bool readMpegDuration = readProperties && readStyle == TagLib::AudioProperties::Fast;
+                TagLib::MPEG::File file(&stream, TagLib::ID3v2::FrameFactory::instance(), readProperties && !readMpegDuration, readStyle);
                 getAudioProperties(file, info);
+                if (readMpegDuration && info.valid) {
+                    getMpegDuration(&stream, file, info);
+                }
                 if (file.hasAPETag()) {
-                    getTags(file.APETag(), file.APETag()->properties(), info);
-                    getApeMediaArt(file.APETag(), info);
+                    if (readTags) {
+                        getTags(file.APETag(), file.APETag()->properties(), info);
+                    }
+                    if (readMediaArt) {
+                        getApeMediaArt(file.APETag(), info, mediaArtHandler);
+                    }
                 } else if (file.hasID3v2Tag()) {
-                    getId3v2MediaArt(file.ID3v2Tag(), info);
-                    getTags(file.ID3v2Tag(), file.ID3v2Tag()->properties(), info);
+                    if (readMediaArt) {
+                        getId3v2MediaArt(file.ID3v2Tag(), info, mediaArtHandler);
+                    }
+                    if (readTags) {
+                        getTags(file.ID3v2Tag(), file.ID3v2Tag()->properties(), info);
+                    }
                 }
                 break;
             }
             case MimeType::VorbisOgg:
             {
-                const TagLib::Ogg::Vorbis::File file(fileInfo.filePath().toUtf8().data());
+                ChunkedFileStream stream(fileInfo.filePath(), budgetState);
+                const TagLib::Ogg::Vorbis::File file(&stream, readProperties, readStyle);
                 getAudioProperties(file, info);
-                getTags(file.tag(), file.tag()->properties(), info);
-                getXiphMediaArt(file.tag(), info);
+                if (readTags) {
+                    getTags(file.tag(), file.tag()->properties(), info);
+                }
+                if (readMediaArt) {
+                    getXiphMediaArt(file.tag(), info, mediaArtHandler);
+                }
                 break;
             }
             case MimeType::FlacOgg:
             {
-                const TagLib::Ogg::FLAC::File file(fileInfo.filePath().toUtf8().data());
+                ChunkedFileStream stream(fileInfo.filePath(), budgetState);
+                const TagLib::Ogg::FLAC::File file(&stream, readProperties, readStyle);
                 getAudioProperties(file, info);
-                getTags(file.tag(), file.tag()->properties(), info);
-                getXiphMediaArt(file.tag(), info);
+                if (readTags) {
+                    getTags(file.tag(), file.tag()->properties(), info);
+                }
+                if (readMediaArt) {
+                    getXiphMediaArt(file.tag(), info, mediaArtHandler);
+                }
                 break;
             }
             case MimeType::OpusOgg:
             {
-                const TagLib::Ogg::Opus::File file(fileInfo.filePath().toUtf8().data());
+                ChunkedFileStream stream(fileInfo.filePath(), budgetState);
+                const TagLib::Ogg::Opus::File file(&stream, readProperties, readStyle);
                 getAudioProperties(file, info);
-                getTags(file.tag(), file.tag()->properties(), info);
-                getXiphMediaArt(file.tag(), info);
+                if (readTags) {
+                    getTags(file.tag(), file.tag()->properties(), info);
+                }
+                if (readMediaArt) {
+                    getXiphMediaArt(file.tag(), info, mediaArtHandler);
+                }
                 break;
             }
             case MimeType::Ape:
             {
-                TagLib::APE::File file(fileInfo.filePath().toUtf8().data());
+                ChunkedFileStream stream(fileInfo.filePath(), budgetState);
+                TagLib::APE::File file(&stream, readProperties, readStyle);
+                getAudioProperties(file, info);
+                if (file.hasAPETag()) {
+                    if (readMediaArt) {
+                        getApeMediaArt(file.APETag(), info, mediaArtHandler);
+                    }
+                    if (readTags) {
+                        getTags(file.APETag(), file.APETag()->properties(), info);
+                    }
+                }
+                break;
+            }
+            case MimeType::Wav:
+            {
+                // Only chunk headers are read, not audio data
+                ChunkedFileStream stream(fileInfo.filePath(), budgetState);
+                TagLib::RIFF::WAV::File file(&stream, readProperties, readStyle);
+                getAudioProperties(file, info);
+                if (file.hasID3v2Tag()) {
+                    if (readMediaArt) {
+                        getId3v2MediaArt(file.ID3v2Tag(), info, mediaArtHandler);
+                    }
+                    if (readTags) {
+                        getTags(file.ID3v2Tag(), file.ID3v2Tag()->properties(), info);
+                    }
+                } else if (file.hasInfoTag() && readTags) {
+                    getTags(file.InfoTag(), file.InfoTag()->properties(), info);
+                }
+                break;
+            }
+            case MimeType::Wavpack:
+            {
+                ChunkedFileStream stream(fileInfo.filePath(), budgetState);
+                TagLib::WavPack::File file(&stream, readProperties, readStyle);
                 getAudioProperties(file, info);
                 if (file.hasAPETag()) {
-                    getApeMediaArt(file.APETag(), info);
-                    getTags(file.APETag(), file.APETag()->properties(), info);
+                    if (readMediaArt) {
+                        getApeMediaArt(file.APETag(), info, mediaArtHandler);
+                    }
+                    if (readTags) {
+                        getTags(file.APETag(), file.APETag()->properties(), info);
+                    }
+                } else if (file.hasID3v1Tag() && readTags) {
+                    getTags(file.ID3v1Tag(), file.ID3v1Tag()->properties(), info);
                 }
                 break;
             }
             default:
             {
-                const TagLib::FileRef file(fileInfo.filePath().toUtf8().data());
+                // Matroska is not supported by TagLib, other formats are detected by FileRef
+                ChunkedFileStream stream(fileInfo.filePath(), budgetState);
+                const TagLib::FileRef file(&stream, readProperties, readStyle);
                 if (file.file()) {
                     getAudioProperties(*file.file(), info);
-                    if (file.tag()) {
+                    if (readTags && file.tag()) {
                         getTags(file.tag(), file.tag()->properties(), info);
                     }
                 }
             }
             }
 
+            if (budgetState.isExceeded()) {
+                info.budgetExceeded = true;
+                info.valid = false;
+            }
+
             if (info.title.isEmpty()) {
                 info.title = fileInfo.fileName();
             }
 
             return info;
         }
+
+        int getExactMpegDuration(const QString& filePath)
+        {
+            const ReadBudget budget;
+            BudgetState budgetState(budget);
+            ChunkedFileStream stream(filePath, budgetState);
+            if (!stream.isOpen()) {
+                return -1;
+            }
+            const mpegduration::Duration duration(mpegduration::count(&stream));
+            return duration.valid ? duration.duration : -1;
+        }
     }
 }
@@ -19,6 +19,9 @@
 #ifndef UNPLAYER_TAGUTILS_H
 #define UNPLAYER_TAGUTILS_H
 
+#include <functional>
+#include <limits>
+
 #include <QString>
 #include <QPixmap>
 
@@ -41,10 +44,61 @@ namespace unplayer
             QString discNumber;
             int duration = 0;
             int bitrate = 0;
+            int sampleRate = 0;
+            int channels = 0;
+            // ReplayGain in dB and peak amplitude, NaN if file doesn't have them
+            double replayGainTrack = std::numeric_limits<double>::quiet_NaN();
+            double replayGainAlbum = std::numeric_limits<double>::quiet_NaN();
+            double replayGainTrackPeak = std::numeric_limits<double>::quiet_NaN();
+            double replayGainAlbumPeak = std::numeric_limits<double>::quiet_NaN();
+            // Duration of MPEG file was extrapolated from sampled frames or taken from TLEN frame,
+            // see getExactMpegDuration()
+            bool durationEstimated = false;
             QByteArray mediaArtData;
+            // False if TagLib could not parse file
+            bool valid = false;
+            // Reading was stopped because ReadBudget was exceeded, info is incomplete
+            bool budgetExceeded = false;
         };
 
-        Info getTrackInfo(const QFileInfo& fileInfo, const QString& mimeType);
+        // Limits of time and bytes read from disk for one file, 0 means no limit.
+        // When exceeded, stream reports end of file and TagLib stops parsing
+        struct ReadBudget
+        {
+            // Milliseconds, checked on every read
+            qint64 maxTime = 0;
+            qint64 maxBytes = 0;
+        };
+
+        // Called with embedded media art while file is open, data must not be used after it returns.
+        // If handler is set, Info::mediaArtData is not filled
+        using MediaArtHandler = std::function<void(const QByteArray& data)>;
+
+        enum class ReadProfile
+        {
+            // Tags, media art and audio properties computed with average accuracy
+            Full,
+            // Tags, media art and audio properties computed with fast accuracy,
+            // duration of MPEG files is estimated, see Info::durationEstimated
+            Fast,
+            // The same as Fast, but pictures are not parsed
+            FastWithoutMediaArt,
+            // The same as Full, but pictures are not parsed
+            FullWithoutMediaArt,
+            // Only audio properties computed with average accuracy
+            PropertiesOnly,
+            // Only media art, audio properties are not read
+            MediaArtOnly
+        };
+
+        Info getTrackInfo(const QFileInfo& fileInfo,
+                          MimeType mimeType,
+                          ReadProfile profile,
+                          const MediaArtHandler& mediaArtHandler = MediaArtHandler(),
+                          const ReadBudget& budget = ReadBudget());
+
+        // Counts frames of MPEG file, reads the whole file. Returns duration in seconds or -1 on error
+        int getExactMpegDuration(const QString& filePath);
     }
 }
 
@@ -0,0 +1,158 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "threadpools.h"
+
+#include <algorithm>
+
+#include <QDebug>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#ifdef Q_OS_LINUX
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace unplayer
+{
+    namespace threadpools
+    {
+        namespace
+        {
+#ifdef Q_OS_LINUX
+            // From linux/ioprio.h, which is not exposed by glibc
+            const int ioprioWhoProcess = 1;
+            const int ioprioClassShift = 13;
+            const int ioprioClassBestEffort = 2;
+            const int ioprioClassIdle = 3;
+#endif
+
+            struct JobClassPriority
+            {
+                int maxThreadCount;
+                int niceness;
+                // Best effort I/O priority level, 0-7, or -1 for idle I/O class
+                int ioPriority;
+            };
+
+            JobClassPriority priority(JobClass jobClass)
+            {
+                const int idealThreadCount = std::max(QThread::idealThreadCount(), 1);
+                switch (jobClass) {
+                case JobClass::Interactive:
+                    // Interactive jobs are short, but they should never wait for each other
+                    return {std::max(idealThreadCount * 2, 4), 0, 4};
+                case JobClass::Bulk:
+                    return {std::max(idealThreadCount / 2, 1), 5, 5};
+                case JobClass::Scan:
+                    // Library updater uses its own worker threads, which inherit priority of this thread.
+                    // Idle I/O class gets disk time only when no one else (e.g. media player) uses it
+                    return {1, 19, -1};
+                }
+                return {1, 0, 4};
+            }
+
+            class PriorityRunnable final : public QRunnable
+            {
+            public:
+                explicit PriorityRunnable(JobClass jobClass, QRunnable* runnable)
+                    : mJobClass(jobClass),
+                      mRunnable(runnable)
+                {
+
+                }
+
+                ~PriorityRunnable() override
+                {
+                    if (mRunnable->autoDelete()) {
+                        delete mRunnable;
+                    }
+                }
+
+                void run() override
+                {
+                    setCurrentThreadClass(mJobClass);
+                    mRunnable->run();
+                }
+
+            private:
+                const JobClass mJobClass;
+                QRunnable* mRunnable;
+            };
+
+            QThreadPool* createPool(JobClass jobClass)
+            {
+                auto pool = new QThreadPool();
+                pool->setMaxThreadCount(priority(jobClass).maxThreadCount);
+                return pool;
+            }
+
+            thread_local bool currentThreadClassSet = false;
+        }
+
+        QThreadPool* pool(JobClass jobClass)
+        {
+            // Pools are not destroyed, threads are finished by the time application exits
+            static QThreadPool* const interactivePool = createPool(JobClass::Interactive);
+            static QThreadPool* const bulkPool = createPool(JobClass::Bulk);
+            static QThreadPool* const scanPool = createPool(JobClass::Scan);
+            switch (jobClass) {
+            case JobClass::Interactive:
+                return interactivePool;
+            case JobClass::Bulk:
+                return bulkPool;
+            case JobClass::Scan:
+                return scanPool;
+            }
+            return interactivePool;
+        }
+
+        void setCurrentThreadClass(JobClass jobClass)
+        {
+            // Threads are never moved between pools
+            if (currentThreadClassSet) {
+                return;
+            }
+            currentThreadClassSet = true;
+
+#ifdef Q_OS_LINUX
+            // Niceness and I/O priority are per-thread on Linux
+            const JobClassPriority p(priority(jobClass));
+            const auto tid = static_cast<id_t>(syscall(SYS_gettid));
+            if (p.niceness != 0 && setpriority(PRIO_PROCESS, tid, p.niceness) != 0) {
+                qWarning() << "failed to set thread niceness";
+            }
+            const int ioprio = p.ioPriority == -1 ? (ioprioClassIdle << ioprioClassShift)
+                                                  : ((ioprioClassBestEffort << ioprioClassShift) | p.ioPriority);
+            if (syscall(SYS_ioprio_set, ioprioWhoProcess, tid, ioprio) != 0) {
+                qWarning() << "failed to set thread I/O priority";
+            }
+#else
+            Q_UNUSED(jobClass)
+#endif
+        }
+
+        void start(JobClass jobClass, QRunnable* runnable)
+        {
+            pool(jobClass)->start(new PriorityRunnable(jobClass, runnable));
+        }
+    }
+}
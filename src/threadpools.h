@@ -0,0 +1,63 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_THREADPOOLS_H
+#define UNPLAYER_THREADPOOLS_H
+
+#include <QFuture>
+#include <QtConcurrentRun>
+
+class QRunnable;
+class QThreadPool;
+
+namespace unplayer
+{
+    namespace threadpools
+    {
+        // Background jobs are split between separate pools so that long jobs
+        // don't take threads from the ones user is waiting for.
+        // Threads of each pool have their own CPU and I/O priority
+        enum class JobClass
+        {
+            // Loading of models and other data that is shown to user right away
+            Interactive,
+            // Reading and writing of many files: adding tracks to queue, removing files, etc.
+            Bulk,
+            // Library scanning, runs with lowest CPU and idle I/O priority
+            Scan
+        };
+
+        QThreadPool* pool(JobClass jobClass);
+
+        // Sets priority of calling thread, does nothing if it is already set
+        void setCurrentThreadClass(JobClass jobClass);
+
+        void start(JobClass jobClass, QRunnable* runnable);
+
+        template<typename Function>
+        auto run(JobClass jobClass, Function function) -> QFuture<decltype(function())>
+        {
+            return QtConcurrent::run(pool(jobClass), [jobClass, function]() mutable {
+                setCurrentThreadClass(jobClass);
+                return function();
+            });
+        }
+    }
+}
+
+#endif // UNPLAYER_THREADPOOLS_H
@@ -0,0 +1,473 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thumbnailatlas.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QVariant>
+
+#include "sqlquery.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        // New atlas is started when the last one reaches this size
+        const qint64 maxAtlasSize = 16 * 1024 * 1024;
+
+        const QLatin1String urlPrefix("image://art/thumbnails/");
+        const QLatin1String idPrefix("thumbnails/");
+
+        // Returns indexes of atlas files in directory, in ascending order
+        std::vector<int> listAtlases(const QString& directory)
+        {
+            const QRegularExpression regex(QStringLiteral("^atlas-(\\d+)\\.bin$"));
+            std::vector<int> atlases;
+            for (const QString& fileName : QDir(directory).entryList({QStringLiteral("atlas-*.bin")}, QDir::Files, QDir::Name)) {
+                const QRegularExpressionMatch match(regex.match(fileName));
+                if (match.hasMatch()) {
+                    atlases.push_back(match.captured(1).toInt());
+                }
+            }
+            std::sort(atlases.begin(), atlases.end());
+            return atlases;
+        }
+    }
+
+    namespace thumbnailatlas
+    {
+        QString directory(const QString& mediaArtDirectory)
+        {
+            return QString::fromLatin1("%1/thumbnails").arg(mediaArtDirectory);
+        }
+
+        QString filePath(const QString& directory, int atlas)
+        {
+            return QString::fromLatin1("%1/atlas-%2.bin").arg(directory).arg(atlas);
+        }
+
+        QString url(int atlas, qint64 offset, int size)
+        {
+            return QString::fromLatin1("%1%2/%3/%4").arg(urlPrefix).arg(atlas).arg(offset).arg(size);
+        }
+
+        bool isThumbnail(const QString& urlOrId)
+        {
+            return urlOrId.startsWith(urlPrefix) || urlOrId.startsWith(idPrefix);
+        }
+
+        bool parse(const QString& urlOrId, int& atlas, qint64& offset, int& size)
+        {
+            QStringRef id;
+            if (urlOrId.startsWith(urlPrefix)) {
+                id = urlOrId.midRef(urlPrefix.size());
+            } else if (urlOrId.startsWith(idPrefix)) {
+                id = urlOrId.midRef(idPrefix.size());
+            } else {
+                return false;
+            }
+            const QVector<QStringRef> parts(id.split(QLatin1Char('/')));
+            if (parts.size() != 3) {
+                return false;
+            }
+            bool ok[3];
+            atlas = parts[0].toInt(&ok[0]);
+            offset = parts[1].toLongLong(&ok[1]);
+            size = parts[2].toInt(&ok[2]);
+            return ok[0] && ok[1] && ok[2] && atlas >= 0 && offset >= 0 && size > 0;
+        }
+
+        QRgb placeholder(const QImage& image)
+        {
+            if (image.isNull()) {
+                return 0;
+            }
+
+            // Pixels are grouped by 4 high bits of each component,
+            // result is average color of the largest group
+            const QImage scaled(image.scaled(16, 16, Qt::IgnoreAspectRatio, Qt::SmoothTransformation).convertToFormat(QImage::Format_RGB32));
+            std::vector<std::pair<int, QRgb>> pixels;
+            pixels.reserve(static_cast<std::size_t>(scaled.width() * scaled.height()));
+            for (int y = 0, height = scaled.height(); y < height; ++y) {
+                const auto line = reinterpret_cast<const QRgb*>(scaled.constScanLine(y));
+                for (int x = 0, width = scaled.width(); x < width; ++x) {
+                    const QRgb pixel = line[x];
+                    pixels.emplace_back(((qRed(pixel) >> 4) << 8) | ((qGreen(pixel) >> 4) << 4) | (qBlue(pixel) >> 4), pixel);
+                }
+            }
+            std::sort(pixels.begin(), pixels.end(), [](const std::pair<int, QRgb>& first, const std::pair<int, QRgb>& second) {
+                return first.first < second.first;
+            });
+
+            auto largest = pixels.begin();
+            auto largestEnd = pixels.begin();
+            for (auto i = pixels.begin(), end = pixels.end(); i != end;) {
+                auto groupEnd = i;
+                while (groupEnd != end && groupEnd->first == i->first) {
+                    ++groupEnd;
+                }
+                if (groupEnd - i > largestEnd - largest) {
+                    largest = i;
+                    largestEnd = groupEnd;
+                }
+                i = groupEnd;
+            }
+
+            int red = 0;
+            int green = 0;
+            int blue = 0;
+            for (auto i = largest; i != largestEnd; ++i) {
+                red += qRed(i->second);
+                green += qGreen(i->second);
+                blue += qBlue(i->second);
+            }
+            const auto count = static_cast<int>(largestEnd - largest);
+            return qRgb(red / count, green / count, blue / count);
+        }
+    }
+
+    ThumbnailAtlasWriter::ThumbnailAtlasWriter(const QString& mediaArtDirectory, const QSqlDatabase& db)
+        : mDirectory(thumbnailatlas::directory(mediaArtDirectory)),
+          mDb(db),
+          mAtlas(-1)
+    {
+
+    }
+
+    QString ThumbnailAtlasWriter::find(const QString& key)
+    {
+        SqlQuery query(mDb);
+        query.prepareCached(QStringLiteral("SELECT url FROM thumbnails WHERE key = ?"));
+        query.addBindValue(key);
+        if (!query.exec()) {
+            qWarning() << "failed to find thumbnail" << query.lastError();
+            return QString();
+        }
+        if (query.next()) {
+            return query.value(0).toString();
+        }
+        return QString();
+    }
+
+    QString ThumbnailAtlasWriter::add(const QString& key, const QByteArray& data, QRgb placeholder)
+    {
+        const QString url(append(data));
+        if (url.isEmpty()) {
+            return url;
+        }
+
+        SqlQuery query(mDb);
+        query.prepare(QStringLiteral("INSERT OR REPLACE INTO thumbnails (key, url, atlas, size, placeholder) VALUES (?, ?, ?, ?, ?)"));
+        query.addBindValue(key);
+        query.addBindValue(url);
+        query.addBindValue(mAtlas);
+        query.addBindValue(data.size());
+        query.addBindValue(placeholder);
+        if (!query.exec()) {
+            qWarning() << "failed to insert thumbnail" << query.lastError();
+        }
+        return url;
+    }
+
+    void ThumbnailAtlasWriter::addMissingPlaceholders()
+    {
+        std::vector<std::pair<QString, QString>> thumbnails;
+        {
+            SqlQuery query(QLatin1String("SELECT key, url FROM thumbnails WHERE placeholder IS NULL ORDER BY atlas"), mDb);
+            while (query.next()) {
+                thumbnails.emplace_back(query.value(0).toString(), query.value(1).toString());
+            }
+        }
+        if (thumbnails.empty()) {
+            return;
+        }
+
+        qDebug() << "computing placeholders of" << thumbnails.size() << "thumbnails";
+
+        SqlQuery query(mDb);
+        query.prepare(QStringLiteral("UPDATE thumbnails SET placeholder = ? WHERE key = ?"));
+        QFile file;
+        int fileAtlas = -1;
+        for (const auto& thumbnail : thumbnails) {
+            // Placeholder is 0 when thumbnail can't be read, so that it is not read again
+            QRgb placeholder = 0;
+            int atlas;
+            qint64 offset;
+            int size;
+            if (thumbnailatlas::parse(thumbnail.second, atlas, offset, size)) {
+                if (atlas != fileAtlas) {
+                    file.close();
+                    file.setFileName(thumbnailatlas::filePath(mDirectory, atlas));
+                    fileAtlas = atlas;
+                    if (!file.open(QIODevice::ReadOnly)) {
+                        qWarning() << "failed to open atlas" << file.fileName() << file.errorString();
+                    }
+                }
+                if (file.isOpen() && file.seek(offset)) {
+                    placeholder = thumbnailatlas::placeholder(QImage::fromData(file.read(size), "JPEG"));
+                }
+            }
+
+            query.bindValue(0, placeholder);
+            query.bindValue(1, thumbnail.first);
+            if (!query.exec()) {
+                qWarning() << "failed to update thumbnail placeholder" << query.lastError();
+            }
+        }
+    }
+
+    void ThumbnailAtlasWriter::removeUnused()
+    {
+        SqlQuery query(mDb);
+        if (!query.exec(QLatin1String("DELETE FROM thumbnails WHERE url NOT IN (SELECT filePath FROM mediaArtFiles)"))) {
+            qWarning() << "failed to remove unused thumbnails" << query.lastError();
+            return;
+        }
+
+        std::unordered_map<int, qint64> usedSizes;
+        if (!this->usedSizes(usedSizes)) {
+            return;
+        }
+        // The last atlas is still being filled
+        const std::vector<int> atlases(listAtlases(mDirectory));
+        for (auto i = atlases.begin(), end = atlases.end() - (atlases.empty() ? 0 : 1); i != end; ++i) {
+            if (usedSizes.find(*i) == usedSizes.end()) {
+                const QString filePath(thumbnailatlas::filePath(mDirectory, *i));
+                if (!QFile::remove(filePath)) {
+                    qWarning() << "failed to remove atlas" << filePath;
+                }
+            }
+        }
+    }
+
+    bool ThumbnailAtlasWriter::compactAtlases()
+    {
+        std::unordered_map<int, qint64> usedSizes;
+        if (!this->usedSizes(usedSizes)) {
+            return false;
+        }
+        bool compacted = false;
+        const std::vector<int> atlases(listAtlases(mDirectory));
+        for (auto i = atlases.begin(), end = atlases.end() - (atlases.empty() ? 0 : 1); i != end; ++i) {
+            const auto found(usedSizes.find(*i));
+            if (found != usedSizes.end() && found->second < QFileInfo(thumbnailatlas::filePath(mDirectory, *i)).size() / 2) {
+                compact(*i);
+                compacted = true;
+            }
+        }
+        return compacted;
+    }
+
+    bool ThumbnailAtlasWriter::usedSizes(std::unordered_map<int, qint64>& sizes)
+    {
+        SqlQuery query(mDb);
+        if (!query.exec(QLatin1String("SELECT atlas, SUM(size) FROM thumbnails GROUP BY atlas"))) {
+            qWarning() << "failed to get sizes of atlases" << query.lastError();
+            return false;
+        }
+        while (query.next()) {
+            sizes.emplace(query.value(0).toInt(), query.value(1).toLongLong());
+        }
+        return true;
+    }
+
+    bool ThumbnailAtlasWriter::open()
+    {
+        if (mFile.isOpen() && mFile.size() < maxAtlasSize) {
+            return true;
+        }
+        mFile.close();
+
+        if (mAtlas < 0) {
+            if (!QDir().mkpath(mDirectory)) {
+                qWarning() << "failed to create thumbnails directory" << mDirectory;
+                return false;
+            }
+            const std::vector<int> atlases(listAtlases(mDirectory));
+            mAtlas = atlases.empty() ? 0 : atlases.back();
+        }
+
+        // Atlas indexes are never reused, image provider may still have old file mapped
+        mFile.setFileName(thumbnailatlas::filePath(mDirectory, mAtlas));
+        if (QFileInfo(mFile).size() >= maxAtlasSize) {
+            ++mAtlas;
+            mFile.setFileName(thumbnailatlas::filePath(mDirectory, mAtlas));
+        }
+        // Unbuffered, so that data is in the file when URL is returned
+        if (!mFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered)) {
+            qWarning() << "failed to open atlas" << mFile.fileName() << mFile.errorString();
+            return false;
+        }
+        return true;
+    }
+
+    QString ThumbnailAtlasWriter::append(const QByteArray& data)
+    {
+        if (!open()) {
+            return QString();
+        }
+        const qint64 offset = mFile.size();
+        if (mFile.write(data) != data.size()) {
+            qWarning() << "failed to write thumbnail to atlas" << mFile.fileName() << mFile.errorString();
+            // Partially written data is not referenced
+            mFile.close();
+            return QString();
+        }
+        return thumbnailatlas::url(mAtlas, offset, data.size());
+    }
+
+    void ThumbnailAtlasWriter::compact(int atlas)
+    {
+        QFile file(thumbnailatlas::filePath(mDirectory, atlas));
+        if (!file.open(QIODevice::ReadOnly)) {
+            qWarning() << "failed to open atlas" << file.fileName() << file.errorString();
+            return;
+        }
+
+        std::vector<std::pair<QString, QString>> thumbnails;
+        {
+            SqlQuery query(mDb);
+            query.prepare(QStringLiteral("SELECT key, url FROM thumbnails WHERE atlas = ?"));
+            query.addBindValue(atlas);
+            if (!query.exec()) {
+                qWarning() << "failed to get thumbnails of atlas" << query.lastError();
+                return;
+            }
+            while (query.next()) {
+                thumbnails.emplace_back(query.value(0).toString(), query.value(1).toString());
+            }
+        }
+
+        qDebug() << "moving" << thumbnails.size() << "thumbnails out of atlas" << file.fileName();
+
+        SqlQuery updateThumbnailQuery(mDb);
+        updateThumbnailQuery.prepare(QStringLiteral("UPDATE thumbnails SET url = ?, atlas = ? WHERE key = ?"));
+        SqlQuery updateTracksQuery(mDb);
+        updateTracksQuery.prepare(QStringLiteral("UPDATE tracks SET mediaArtThumbnail = ? WHERE mediaArtThumbnail = ?"));
+        SqlQuery updateAlbumsQuery(mDb);
+        updateAlbumsQuery.prepare(QStringLiteral("UPDATE albumMediaArt SET mediaArtThumbnail = ? WHERE mediaArtThumbnail = ?"));
+
+        bool moved = true;
+        for (const auto& thumbnail : thumbnails) {
+            int oldAtlas;
+            qint64 offset;
+            int size;
+            if (!thumbnailatlas::parse(thumbnail.second, oldAtlas, offset, size) || !file.seek(offset)) {
+                moved = false;
+                continue;
+            }
+            const QByteArray data(file.read(size));
+            const QString url(data.size() == size ? append(data) : QString());
+            if (url.isEmpty()) {
+                moved = false;
+                continue;
+            }
+
+            updateThumbnailQuery.bindValue(0, url);
+            updateThumbnailQuery.bindValue(1, mAtlas);
+            updateThumbnailQuery.bindValue(2, thumbnail.first);
+            updateTracksQuery.bindValue(0, url);
+            updateTracksQuery.bindValue(1, thumbnail.second);
+            updateAlbumsQuery.bindValue(0, url);
+            updateAlbumsQuery.bindValue(1, thumbnail.second);
+            if (!updateThumbnailQuery.exec() || !updateTracksQuery.exec() || !updateAlbumsQuery.exec()) {
+                qWarning() << "failed to update moved thumbnail" << updateThumbnailQuery.lastError()
+                           << updateTracksQuery.lastError() << updateAlbumsQuery.lastError();
+                moved = false;
+            }
+        }
+
+        // Old URLs are no longer referenced
+        SqlQuery query(mDb);
+        if (!query.exec(QLatin1String("DELETE FROM mediaArtFiles WHERE refCount <= 0"))) {
+            qWarning() << "failed to remove unused media art from database" << query.lastError();
+        }
+
+        file.close();
+        if (moved && !file.remove()) {
+            qWarning() << "failed to remove atlas" << file.fileName();
+        }
+    }
+
+    ThumbnailAtlasReader::ThumbnailAtlasReader(const QString& mediaArtDirectory)
+        : mDirectory(thumbnailatlas::directory(mediaArtDirectory))
+    {
+
+    }
+
+    ThumbnailAtlasReader::Thumbnail ThumbnailAtlasReader::thumbnail(const QString& urlOrId)
+    {
+        int atlas;
+        qint64 offset;
+        int size;
+        if (!thumbnailatlas::parse(urlOrId, atlas, offset, size)) {
+            qWarning() << "invalid thumbnail" << urlOrId;
+            return {};
+        }
+
+        std::shared_ptr<Mapping> mapping(this->mapping(atlas, offset + size));
+        if (!mapping) {
+            return {};
+        }
+        // Nothing is copied until decoder reads it
+        const QByteArray data(QByteArray::fromRawData(reinterpret_cast<const char*>(mapping->data + offset), size));
+        return {std::move(mapping), data};
+    }
+
+    std::shared_ptr<ThumbnailAtlasReader::Mapping> ThumbnailAtlasReader::mapping(int atlas, qint64 end)
+    {
+        const QMutexLocker locker(&mMappingsMutex);
+
+        const auto found(mMappings.find(atlas));
+        if (found != mMappings.end() && found->second->size >= end) {
+            return found->second;
+        }
+
+        const auto mapping(std::make_shared<Mapping>());
+        mapping->file.setFileName(thumbnailatlas::filePath(mDirectory, atlas));
+        if (!mapping->file.open(QIODevice::ReadOnly)) {
+            qWarning() << "failed to open atlas" << mapping->file.fileName() << mapping->file.errorString();
+            return nullptr;
+        }
+        mapping->size = mapping->file.size();
+        if (mapping->size < end) {
+            qWarning() << "thumbnail is out of atlas bounds" << mapping->file.fileName();
+            return nullptr;
+        }
+        // Mapping is released when file is destroyed
+        mapping->data = mapping->file.map(0, mapping->size);
+        if (!mapping->data) {
+            qWarning() << "failed to map atlas" << mapping->file.fileName() << mapping->file.errorString();
+            return nullptr;
+        }
+
+        mMappings[atlas] = mapping;
+        return mapping;
+    }
+}
@@ -0,0 +1,129 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNPLAYER_THUMBNAILATLAS_H
+#define UNPLAYER_THUMBNAILATLAS_H
+
+#include <memory>
+#include <unordered_map>
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QRgb>
+#include <QString>
+
+class QImage;
+class QSqlDatabase;
+
+namespace unplayer
+{
+    // Thumbnails are packed into a few large files in thumbnails directory instead of
+    // a file per image. Location of thumbnail is encoded in its URL,
+    // image://art/thumbnails/<atlas>/<offset>/<size>, which is stored in mediaArtThumbnail
+    // column and served by ArtImageProvider
+    namespace thumbnailatlas
+    {
+        QString directory(const QString& mediaArtDirectory);
+        QString filePath(const QString& directory, int atlas);
+        QString url(int atlas, qint64 offset, int size);
+
+        bool isThumbnail(const QString& urlOrId);
+        // Parses URL or image provider id (URL without scheme and provider id)
+        bool parse(const QString& urlOrId, int& atlas, qint64& offset, int& size);
+
+        // Opaque dominant color of image, which is shown in place of thumbnail until
+        // it is decoded. Returns 0 for null image
+        QRgb placeholder(const QImage& image);
+    }
+
+    // Appends thumbnails to the last atlas file, starting a new one when it is full.
+    // Thumbnails table is updated on given connection, which should be in transaction
+    class ThumbnailAtlasWriter final
+    {
+    public:
+        explicit ThumbnailAtlasWriter(const QString& mediaArtDirectory, const QSqlDatabase& db);
+        ThumbnailAtlasWriter(const ThumbnailAtlasWriter&) = delete;
+        ThumbnailAtlasWriter& operator=(const ThumbnailAtlasWriter&) = delete;
+
+        // Returns URL of existing thumbnail with key, or empty string
+        QString find(const QString& key);
+        // Returns URL of added thumbnail, or empty string on error
+        QString add(const QString& key, const QByteArray& data, QRgb placeholder);
+
+        // Computes placeholders of thumbnails that were added before they were stored
+        void addMissingPlaceholders();
+
+        // Removes thumbnails that are not referenced in mediaArtFiles and deletes atlases
+        // without thumbnails
+        void removeUnused();
+
+        // Moves thumbnails out of atlases that are mostly unused, changing their URLs.
+        // Returns true if any atlas was compacted
+        bool compactAtlases();
+
+    private:
+        bool open();
+        QString append(const QByteArray& data);
+        void compact(int atlas);
+        // Sizes of thumbnails in each atlas
+        bool usedSizes(std::unordered_map<int, qint64>& sizes);
+
+        const QString mDirectory;
+        const QSqlDatabase& mDb;
+        QFile mFile;
+        int mAtlas;
+    };
+
+    // Memory mapped atlas files, thread-safe
+    class ThumbnailAtlasReader final
+    {
+    public:
+        explicit ThumbnailAtlasReader(const QString& mediaArtDirectory);
+        ThumbnailAtlasReader(const ThumbnailAtlasReader&) = delete;
+        ThumbnailAtlasReader& operator=(const ThumbnailAtlasReader&) = delete;
+
+        struct Thumbnail
+        {
+            // Keeps atlas mapped while data is used
+            std::shared_ptr<const void> mapping;
+            // Points to mapped memory, empty on error
+            QByteArray data;
+        };
+        Thumbnail thumbnail(const QString& urlOrId);
+
+    private:
+        struct Mapping
+        {
+            QFile file;
+            const uchar* data;
+            qint64 size;
+        };
+
+        // Atlas is mapped again when it has grown past mapped size.
+        // Old mapping is released when the last reader is done with it
+        std::shared_ptr<Mapping> mapping(int atlas, qint64 end);
+
+        const QString mDirectory;
+
+        QMutex mMappingsMutex;
+        std::unordered_map<int, std::shared_ptr<Mapping>> mMappings;
+    };
+}
+
+#endif // UNPLAYER_THUMBNAILATLAS_H
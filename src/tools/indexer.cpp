@@ -0,0 +1,226 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QStandardPaths>
+#include <QTextStream>
+
+#include "bench/benchutils.h"
+#include "libraryupdater.h"
+#include "libraryutils.h"
+#include "settings.h"
+#include "sqlquery.h"
+
+using namespace unplayer;
+
+// Scans volume on desktop and writes its library database and media art to output directory.
+// Paths in database start with LibraryUpdater::importVolumePlaceholder and
+// LibraryUpdater::importMediaArtPlaceholder, so that the same volume can be
+// imported on the phone with 'harbour-unplayer --import', wherever it is mounted
+
+namespace
+{
+    const QLatin1String outputConnectionName("unplayer-indexer-output");
+
+    void scan()
+    {
+        LibraryUtils* libraryUtils = LibraryUtils::instance();
+        QEventLoop loop;
+        QObject::connect(libraryUtils, &LibraryUtils::updatingChanged, &loop, [&loop, libraryUtils]() {
+            if (!libraryUtils->isUpdating()) {
+                loop.quit();
+            }
+        });
+        libraryUtils->updateDatabase();
+        loop.exec();
+    }
+
+    bool exec(const QSqlDatabase& db, const QString& queryString, const QVariantList& bindValues = QVariantList())
+    {
+        SqlQuery query(db);
+        query.prepare(queryString);
+        for (const QVariant& value : bindValues) {
+            query.addBindValue(value);
+        }
+        if (!query.exec()) {
+            qWarning() << "failed to execute query" << queryString << query.lastError();
+            return false;
+        }
+        return true;
+    }
+
+    // Replaces prefixes of paths with placeholders and removes tables
+    // which describe state of this machine rather than of volume
+    bool rewritePaths(const QString& filePath, const QString& volumeRoot, const QString& mediaArtDirectory)
+    {
+        bool ok = false;
+        {
+            auto db = QSqlDatabase::addDatabase(LibraryUtils::databaseType, outputConnectionName);
+            db.setDatabaseName(filePath);
+            if (!db.open()) {
+                qWarning() << "failed to open output database" << db.lastError();
+                return false;
+            }
+
+            const QString volumePrefix(volumeRoot + QLatin1Char('/'));
+            const QString mediaArtPrefix(mediaArtDirectory + QLatin1Char('/'));
+            const QString volumePlaceholder(QString(LibraryUpdater::importVolumePlaceholder) + QLatin1Char('/'));
+            const QString mediaArtPlaceholder(QString(LibraryUpdater::importMediaArtPlaceholder) + QLatin1Char('/'));
+
+            db.transaction();
+            ok = exec(db,
+                      QLatin1String("UPDATE tracks SET filePath = ? || substr(filePath, length(?) + 1) "
+                                    "WHERE substr(filePath, 1, length(?)) = ?"),
+                      {volumePlaceholder, volumePrefix, volumePrefix, volumePrefix}) &&
+                 exec(db,
+                      QLatin1String("UPDATE tracks SET mediaArtThumbnail = NULL, mediaArt = CASE "
+                                    "WHEN substr(mediaArt, 1, length(?)) = ? THEN ? || substr(mediaArt, length(?) + 1) "
+                                    "WHEN substr(mediaArt, 1, length(?)) = ? THEN ? || substr(mediaArt, length(?) + 1) "
+                                    "ELSE '' END"),
+                      {mediaArtPrefix, mediaArtPrefix, mediaArtPlaceholder, mediaArtPrefix,
+                       volumePrefix, volumePrefix, volumePlaceholder, volumePrefix});
+            for (const char* table : {"directories", "volumes", "directoryMediaArt", "mediaArtFiles",
+                                      "scanStatistics", "quarantinedFiles", "libraryState"}) {
+                ok = ok && exec(db, QString::fromLatin1("DELETE FROM %1").arg(QLatin1String(table)));
+            }
+            if (ok) {
+                ok = db.commit();
+                ok = ok && exec(db, QLatin1String("VACUUM"));
+            } else {
+                db.rollback();
+            }
+            db.close();
+        }
+        QSqlDatabase::removeDatabase(outputConnectionName);
+        return ok;
+    }
+
+    // Thumbnails are not copied, they depend on screen size of the phone
+    int copyMediaArt(const QString& mediaArtDirectory, const QString& outputDirectory)
+    {
+        if (!QDir().mkpath(outputDirectory)) {
+            qWarning() << "failed to create directory" << outputDirectory;
+            return -1;
+        }
+        int count = 0;
+        for (const QFileInfo& fileInfo : QDir(mediaArtDirectory).entryInfoList(QDir::Files)) {
+            const QString outputFilePath(QString::fromLatin1("%1/%2").arg(outputDirectory, fileInfo.fileName()));
+            QFile::remove(outputFilePath);
+            if (!QFile::copy(fileInfo.filePath(), outputFilePath)) {
+                qWarning() << "failed to copy media art" << fileInfo.filePath();
+                return -1;
+            }
+            ++count;
+        }
+        return count;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // Database, media art and settings are kept apart from the ones of the app
+    QStandardPaths::setTestMode(true);
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    const QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QLatin1String("Creates library database of volume, which can be imported with 'harbour-unplayer --import'"));
+    parser.addHelpOption();
+    parser.addPositionalArgument(QLatin1String("volume"), QLatin1String("Mount point of volume"));
+    parser.addPositionalArgument(QLatin1String("output"), QLatin1String("Directory where library.sqlite and media-art are written"));
+    const QCommandLineOption threadsOption(QLatin1String("threads"), QLatin1String("Library update threads count, 0 to use setting's default"), QLatin1String("count"), QLatin1String("0"));
+    const QCommandLineOption directoryMediaArtOption(QLatin1String("directory-media-art"), QLatin1String("Prefer media art from directories over embedded one"));
+    parser.addOptions({threadsOption, directoryMediaArtOption});
+    parser.process(app);
+
+    const QStringList arguments(parser.positionalArguments());
+    if (arguments.size() != 2) {
+        parser.showHelp(1);
+    }
+    const QString volumeRoot(QDir::cleanPath(QFileInfo(arguments[0]).absoluteFilePath()));
+    const QString outputDirectory(QFileInfo(arguments[1]).absoluteFilePath());
+    if (!QFileInfo(volumeRoot).isDir()) {
+        qWarning() << "volume is not a directory:" << volumeRoot;
+        return 1;
+    }
+    if (!QDir().mkpath(outputDirectory)) {
+        qWarning() << "failed to create output directory" << outputDirectory;
+        return 1;
+    }
+
+    bench::resetLocations();
+
+    Settings* settings = Settings::instance();
+    settings->setLibraryDirectories({volumeRoot});
+    settings->setBlacklistedDirectories({});
+    settings->setUseDirectoryMediaArt(parser.isSet(directoryMediaArtOption));
+    const int threads = parser.value(threadsOption).toInt();
+    if (threads > 0) {
+        settings->setLibraryUpdateThreadsCount(threads);
+    }
+
+    if (!bench::waitForDatabase()) {
+        return 1;
+    }
+    LibraryUtils* libraryUtils = LibraryUtils::instance();
+
+    QElapsedTimer timer;
+    timer.start();
+    scan();
+    const qint64 scanTime = timer.elapsed();
+
+    // Write everything to main database file before copying it
+    {
+        SqlQuery query(QLatin1String("PRAGMA wal_checkpoint(TRUNCATE)"));
+        if (query.lastError().type() != QSqlError::NoError) {
+            qWarning() << "failed to checkpoint database" << query.lastError();
+            return 1;
+        }
+    }
+
+    const QString outputFilePath(QString::fromLatin1("%1/library.sqlite").arg(outputDirectory));
+    QFile::remove(outputFilePath);
+    if (!QFile::copy(libraryUtils->databaseFilePath(), outputFilePath)) {
+        qWarning() << "failed to copy database to" << outputFilePath;
+        return 1;
+    }
+    if (!rewritePaths(outputFilePath, volumeRoot, libraryUtils->mediaArtDirectory())) {
+        return 1;
+    }
+    const int mediaArtCount = copyMediaArt(libraryUtils->mediaArtDirectory(), QString::fromLatin1("%1/media-art").arg(outputDirectory));
+    if (mediaArtCount < 0) {
+        return 1;
+    }
+
+    QTextStream(stdout) << "indexed " << libraryUtils->tracksCount() << " tracks in " << scanTime << " ms, "
+                        << libraryUtils->scanBytesRead() / (1024 * 1024) << " MiB read, "
+                        << mediaArtCount << " media art files" << endl;
+    return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "tracing.h"
+
+#include <mutex>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QSaveFile>
+
+namespace unplayer
+{
+    namespace tracing
+    {
+        namespace
+        {
+            const char* const fileVariable = "UNPLAYER_TRACE";
+
+            struct Event
+            {
+                const char* name;
+                // Microseconds since init()
+                qint64 start;
+                // -1 for instant events
+                qint64 duration;
+                int thread;
+                QString detail;
+            };
+
+            std::mutex eventsMutex;
+            std::vector<Event> events;
+
+            // Chrome trace needs small thread ids, main thread is 1
+            int currentThread()
+            {
+                static std::atomic_int lastThread(0);
+                thread_local const int thread = ++lastThread;
+                return thread;
+            }
+
+            void addEvent(Event&& event)
+            {
+                const std::lock_guard<std::mutex> lock(eventsMutex);
+                events.push_back(std::move(event));
+            }
+
+            QByteArray quoted(const QString& string)
+            {
+                // Serializes string with JSON escaping
+                QByteArray json(QJsonDocument(QJsonArray{string}).toJson(QJsonDocument::Compact));
+                return json.mid(1, json.size() - 2);
+            }
+        }
+
+        std::atomic_bool enabled(false);
+        QElapsedTimer timer;
+
+        std::atomic_bool trackMainThread(false);
+        std::atomic<const char*> mainThreadSpan(nullptr);
+        thread_local bool isMainThread = false;
+
+        void init()
+        {
+            isMainThread = true;
+            if (qEnvironmentVariableIsEmpty(fileVariable)) {
+                return;
+            }
+            timer.start();
+            currentThread();
+            enabled = true;
+            qDebug() << "tracing to" << qgetenv(fileVariable);
+        }
+
+        void finish()
+        {
+            if (!enabled) {
+                return;
+            }
+            enabled = false;
+
+            const QString filePath(QFile::decodeName(qgetenv(fileVariable)));
+            QSaveFile file(filePath);
+            if (!file.open(QIODevice::WriteOnly)) {
+                qWarning() << "failed to open trace file" << filePath << file.errorString();
+                return;
+            }
+
+            const std::lock_guard<std::mutex> lock(eventsMutex);
+            const QByteArray pid(QByteArray::number(QCoreApplication::applicationPid()));
+            file.write("{\"traceEvents\":[\n");
+            file.write("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":1,\"args\":{\"name\":\"main\"}}");
+            for (const Event& event : events) {
+                QByteArray line(",\n{\"name\":");
+                line += quoted(QString::fromUtf8(event.name));
+                if (event.duration == -1) {
+                    line += ",\"ph\":\"i\",\"s\":\"t\"";
+                } else {
+                    line += ",\"ph\":\"X\",\"dur\":";
+                    line += QByteArray::number(event.duration);
+                }
+                line += ",\"ts\":";
+                line += QByteArray::number(event.start);
+                line += ",\"pid\":";
+                line += pid;
+                line += ",\"tid\":";
+                line += QByteArray::number(event.thread);
+                if (!event.detail.isEmpty()) {
+                    line += ",\"args\":{\"detail\":";
+                    line += quoted(event.detail);
+                    line += '}';
+                }
+                line += '}';
+                file.write(line);
+            }
+            file.write("\n]}\n");
+
+            if (!file.commit()) {
+                qWarning() << "failed to write trace file" << filePath << file.errorString();
+                return;
+            }
+            qDebug() << "written" << events.size() << "trace events";
+            events.clear();
+        }
+
+        void mark(const char* name)
+        {
+            if (enabled.load(std::memory_order_relaxed)) {
+                addEvent({name, timer.nsecsElapsed() / 1000, -1, currentThread(), QString()});
+            }
+        }
+
+        void Span::record() const
+        {
+            const qint64 end = timer.nsecsElapsed();
+            addEvent({mName, mStart / 1000, (end - mStart) / 1000, currentThread(), mDetail});
+        }
+    }
+}
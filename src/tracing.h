@@ -0,0 +1,101 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_TRACING_H
+#define UNPLAYER_TRACING_H
+
+#include <atomic>
+
+#include <QElapsedTimer>
+#include <QString>
+
+// Records a span from this line to the end of the enclosing scope
+#define UNPLAYER_TRACE_CONCAT_IMPL(a, b) a##b
+#define UNPLAYER_TRACE_CONCAT(a, b) UNPLAYER_TRACE_CONCAT_IMPL(a, b)
+#define UNPLAYER_TRACE(name) const unplayer::tracing::Span UNPLAYER_TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+namespace unplayer
+{
+    // Spans are recorded only when UNPLAYER_TRACE environment variable is set to file path,
+    // they are written there in Chrome trace event format on exit
+    namespace tracing
+    {
+        // Set by init(), spans are not recorded before it is called
+        extern std::atomic_bool enabled;
+        extern QElapsedTimer timer;
+
+        // If set, name of innermost span of main thread is kept in mainThreadSpan, used by StallWatchdog
+        extern std::atomic_bool trackMainThread;
+        extern std::atomic<const char*> mainThreadSpan;
+        extern thread_local bool isMainThread;
+
+        // Called on main thread before any spans are created
+        void init();
+        // Writes recorded events, called after event loop exits
+        void finish();
+
+        // Instant event, e.g. startup phase
+        void mark(const char* name);
+
+        class Span final
+        {
+        public:
+            // name must have static storage duration
+            explicit Span(const char* name)
+                : mName(name),
+                  mStart(enabled.load(std::memory_order_relaxed) ? timer.nsecsElapsed() : -1),
+                  mTracked(trackMainThread.load(std::memory_order_relaxed) && isMainThread),
+                  mPrevious(mTracked ? mainThreadSpan.exchange(name) : nullptr)
+            {
+            }
+
+            ~Span()
+            {
+                if (mTracked) {
+                    mainThreadSpan.store(mPrevious);
+                }
+                if (mStart != -1) {
+                    record();
+                }
+            }
+
+            Span(const Span&) = delete;
+            Span& operator=(const Span&) = delete;
+
+            // Shown in trace viewer as argument of span, ignored when tracing is disabled
+            void setDetail(const QString& detail) const
+            {
+                if (mStart != -1) {
+                    mDetail = detail;
+                }
+            }
+
+        private:
+            void record() const;
+
+            const char* mName;
+            const qint64 mStart;
+            const bool mTracked;
+            const char* const mPrevious;
+            mutable QString mDetail;
+        };
+    }
+}
+
+#endif // UNPLAYER_TRACING_H
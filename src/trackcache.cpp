@@ -0,0 +1,239 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "trackcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QStandardPaths>
+#include <QStorageInfo>
+
+#include "fileutils.h"
+#include "perfcounters.h"
+#include "threadpools.h"
+
+namespace unplayer
+{
+    namespace
+    {
+        // Memory cards are mounted here by Sailfish OS and udisks
+        const QLatin1String memoryCardMountPoints[] = {
+            QLatin1String("/media/sdcard/"),
+            QLatin1String("/run/media/")
+        };
+
+        long long modificationTime(const QFileInfo& fileInfo)
+        {
+            return fileInfo.lastModified().toMSecsSinceEpoch();
+        }
+    }
+
+    TrackCache& TrackCache::instance()
+    {
+        static TrackCache cache;
+        return cache;
+    }
+
+    QString TrackCache::cachedFilePath(const QString& filePath)
+    {
+        {
+            const QMutexLocker locker(&mMutex);
+            if (mEntries.find(filePath) == mEntries.end()) {
+                perfcounters::add(perfcounters::TrackCacheMisses);
+                return QString();
+            }
+        }
+
+        // Don't hold the lock while original file is stat'ed over network
+        const QFileInfo fileInfo(filePath);
+        const bool exists = fileInfo.exists();
+
+        const QMutexLocker locker(&mMutex);
+        const auto found(mEntries.find(filePath));
+        if (found == mEntries.end()) {
+            perfcounters::add(perfcounters::TrackCacheMisses);
+            return QString();
+        }
+        Entry& entry = found->second;
+        if (exists && (fileInfo.size() != entry.size || modificationTime(fileInfo) != entry.modificationTime)) {
+            perfcounters::add(perfcounters::TrackCacheMisses);
+            qDebug() << "cached copy of" << filePath << "is outdated";
+            QFile::remove(entry.cachedFilePath);
+            mSize -= entry.size;
+            mRecent.erase(entry.recent);
+            mEntries.erase(found);
+            return QString();
+        }
+        perfcounters::add(perfcounters::TrackCacheHits);
+        mRecent.splice(mRecent.begin(), mRecent, entry.recent);
+        return entry.cachedFilePath;
+    }
+
+    void TrackCache::cacheFiles(const QStringList& filePaths, qint64 maxSize)
+    {
+        const QMutexLocker locker(&mMutex);
+        mUpcomingFiles = filePaths;
+        mPendingFiles = filePaths;
+        mMaxSize = maxSize;
+        if (!mCopying && !mPendingFiles.isEmpty()) {
+            mCopying = true;
+            threadpools::run(threadpools::JobClass::Bulk, [this]() {
+                copyPendingFiles();
+            });
+        }
+    }
+
+    TrackCache::TrackCache()
+        : mDirectory(QString::fromLatin1("%1/tracks").arg(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))),
+          mSize(0),
+          mMaxSize(0),
+          mCopying(false),
+          mDirectoryCleared(false)
+    {
+    }
+
+    bool TrackCache::isOnSlowStorage(const QString& filePath)
+    {
+        if (fileutils::isNetworkFileSystem(filePath)) {
+            return true;
+        }
+        const QString rootPath(QStorageInfo(filePath).rootPath() + QLatin1Char('/'));
+        for (const QLatin1String& mountPoint : memoryCardMountPoints) {
+            if (rootPath.startsWith(mountPoint)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void TrackCache::copyPendingFiles()
+    {
+        if (!mDirectoryCleared) {
+            QDir directory(mDirectory);
+            if (!directory.removeRecursively()) {
+                qWarning() << "failed to clear tracks cache directory";
+            }
+            if (!directory.mkpath(mDirectory)) {
+                qWarning() << "failed to create tracks cache directory";
+            }
+            mDirectoryCleared = true;
+        }
+
+        while (true) {
+            QString filePath;
+            {
+                const QMutexLocker locker(&mMutex);
+                if (mPendingFiles.isEmpty()) {
+                    mCopying = false;
+                    return;
+                }
+                filePath = mPendingFiles.takeFirst();
+            }
+            copyFile(filePath);
+        }
+    }
+
+    bool TrackCache::copyFile(const QString& filePath)
+    {
+        const QFileInfo fileInfo(filePath);
+        if (!fileInfo.isFile()) {
+            return false;
+        }
+
+        const qint64 size = fileInfo.size();
+        const long long time = modificationTime(fileInfo);
+        {
+            const QMutexLocker locker(&mMutex);
+            if (size > mMaxSize) {
+                return false;
+            }
+            const auto found(mEntries.find(filePath));
+            if (found != mEntries.end() && found->second.size == size && found->second.modificationTime == time) {
+                return true;
+            }
+        }
+
+        if (!isOnSlowStorage(filePath)) {
+            return false;
+        }
+
+        const QString cachedFilePath(QString::fromLatin1("%1/%2.%3")
+                                     .arg(mDirectory,
+                                          QString::fromLatin1(QCryptographicHash::hash(filePath.toUtf8(), QCryptographicHash::Md5).toHex()),
+                                          fileInfo.suffix()));
+        const QString temporaryFilePath(cachedFilePath + QLatin1String(".part"));
+        QFile::remove(temporaryFilePath);
+        if (!QFile::copy(filePath, temporaryFilePath)) {
+            qWarning() << "failed to copy" << filePath << "to tracks cache";
+            QFile::remove(temporaryFilePath);
+            return false;
+        }
+
+        // File may have been changed while it was copied
+        const QFileInfo copiedFileInfo(filePath);
+        if (copiedFileInfo.size() != size || modificationTime(copiedFileInfo) != time) {
+            QFile::remove(temporaryFilePath);
+            return false;
+        }
+
+        const QMutexLocker locker(&mMutex);
+        const auto found(mEntries.find(filePath));
+        if (found != mEntries.end()) {
+            mSize -= found->second.size;
+            mRecent.erase(found->second.recent);
+            mEntries.erase(found);
+        }
+        // Old copy may still be open by player, it is removed when closed
+        QFile::remove(cachedFilePath);
+        if (!QFile::rename(temporaryFilePath, cachedFilePath)) {
+            qWarning() << "failed to rename" << temporaryFilePath;
+            QFile::remove(temporaryFilePath);
+            return false;
+        }
+
+        mRecent.push_front(filePath);
+        mEntries.insert({filePath, {cachedFilePath, size, time, mRecent.begin()}});
+        mSize += size;
+        evict();
+        qDebug() << "cached" << filePath;
+        return true;
+    }
+
+    void TrackCache::evict()
+    {
+        // Files that are going to be played are not removed
+        auto i = mRecent.end();
+        while (mSize > mMaxSize && i != mRecent.begin()) {
+            --i;
+            if (i == mRecent.begin() || mUpcomingFiles.contains(*i)) {
+                continue;
+            }
+            const auto found(mEntries.find(*i));
+            QFile::remove(found->second.cachedFilePath);
+            mSize -= found->second.size;
+            mEntries.erase(found);
+            i = mRecent.erase(i);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_TRACKCACHE_H
+#define UNPLAYER_TRACKCACHE_H
+
+#include <list>
+#include <unordered_map>
+
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+#include "stdutils.h"
+
+namespace unplayer
+{
+    // Local copies of upcoming queue tracks which are on network file systems
+    // or memory cards, so that player opens local file instead of waiting for
+    // slow storage, and doesn't stop when network is briefly unavailable.
+    // Copy is used while size and modification time of original file are the same.
+    // Least recently used copies are removed when cache exceeds its size. Thread-safe
+    class TrackCache final
+    {
+    public:
+        static TrackCache& instance();
+
+        // Returns path of local copy of file, or empty string if it is not cached
+        // or has changed since it was copied. Copy is returned without checking
+        // when original file can't be accessed
+        QString cachedFilePath(const QString& filePath);
+
+        // Copies files which are not cached yet in background, in given order.
+        // Files from previous call that were not copied yet are forgotten.
+        // maxSize is in bytes, copies of other files are removed to fit in it
+        void cacheFiles(const QStringList& filePaths, qint64 maxSize);
+
+    private:
+        TrackCache();
+
+        static bool isOnSlowStorage(const QString& filePath);
+
+        void copyPendingFiles();
+        bool copyFile(const QString& filePath);
+        // Must be called with mMutex locked
+        void evict();
+
+        struct Entry
+        {
+            QString cachedFilePath;
+            qint64 size;
+            long long modificationTime;
+            std::list<QString>::iterator recent;
+        };
+
+        const QString mDirectory;
+
+        QMutex mMutex;
+        std::unordered_map<QString, Entry> mEntries;
+        // Most recently used first
+        std::list<QString> mRecent;
+        qint64 mSize;
+        qint64 mMaxSize;
+        // Files from last cacheFiles() call, they are not evicted
+        QStringList mUpcomingFiles;
+        QStringList mPendingFiles;
+        bool mCopying;
+        // Copies left by previous run are removed before first copy
+        bool mDirectoryCleared;
+    };
+}
+
+#endif // UNPLAYER_TRACKCACHE_H
@@ -18,14 +18,44 @@
 
 #include "trackinfo.h"
 
+#include <cmath>
+
 #include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
 #include <QFileInfo>
+#include <QFutureWatcher>
 #include <QMimeDatabase>
+#include <QSqlError>
 
+#include "libraryutils.h"
+#include "sqlquery.h"
 #include "tagutils.h"
+#include "threadpools.h"
+#include "tracing.h"
 
 namespace unplayer
 {
+    namespace
+    {
+        struct FileDetails
+        {
+            tagutils::Info info;
+            bool hasTags;
+            bool hasProperties;
+            QString mimeType;
+            qint64 fileSize;
+        };
+
+        QString formatGain(double gain)
+        {
+            if (std::isnan(gain)) {
+                return QString();
+            }
+            return qApp->translate("unplayer", "%1 dB").arg(gain, 0, 'f', 2);
+        }
+    }
+
     const QString& TrackInfo::filePath() const
     {
         return mFilePath;
@@ -33,24 +63,162 @@ namespace unplayer
 
     void TrackInfo::setFilePath(const QString& filePath)
     {
+        UNPLAYER_TRACE("TrackInfo::setFilePath");
         mFilePath = filePath;
 
-        mMimeType = QMimeDatabase().mimeTypeForFile(mFilePath, QMimeDatabase::MatchContent).name();
+        if (mLoaded) {
+            mLoaded = false;
+            emit loadedChanged();
+        }
+
+        const long long libraryModificationTime = loadFromLibrary();
+        emit infoChanged();
+
+        const bool hasLibraryAudioDetails = mHasLibraryAudioDetails;
+        auto future = threadpools::run(threadpools::JobClass::Interactive, [filePath, libraryModificationTime, hasLibraryAudioDetails]() {
+            const QFileInfo fileInfo(filePath);
+            const QString mimeType(QMimeDatabase().mimeTypeForFile(fileInfo, QMimeDatabase::MatchContent).name());
+
+            // Tags are read only if library doesn't have them or they are outdated,
+            // and audio properties only if library doesn't have them either
+            const bool readTags = (libraryModificationTime == -1 ||
+                                   fileInfo.lastModified().toMSecsSinceEpoch() != libraryModificationTime);
+            const bool readProperties = readTags || !hasLibraryAudioDetails;
+            return FileDetails{readProperties ? tagutils::getTrackInfo(fileInfo,
+                                                                       mimeTypeFromString(mimeType),
+                                                                       readTags ? tagutils::ReadProfile::FullWithoutMediaArt
+                                                                                : tagutils::ReadProfile::PropertiesOnly)
+                                              : tagutils::Info(),
+                               readTags,
+                               readProperties,
+                               mimeType,
+                               fileInfo.size()};
+        });
 
-        const QFileInfo fileInfo(mFilePath);
+        using FutureWatcher = QFutureWatcher<FileDetails>;
+        auto watcher = new FutureWatcher(this);
+        QObject::connect(watcher, &FutureWatcher::finished, this, [=]() {
+            watcher->deleteLater();
+            if (filePath != mFilePath) {
+                return;
+            }
 
-        tagutils::Info info(tagutils::getTrackInfo(fileInfo, mMimeType));
+            FileDetails details(watcher->result());
+            tagutils::Info& info = details.info;
+            if (details.hasTags) {
+                mTitle = std::move(info.title);
+                mArtist = info.artists.join(QLatin1String(", "));
+                mAlbum = info.albums.join(QLatin1String(", "));
+                mDiscNumber = std::move(info.discNumber);
+                mYear = info.year;
+                mTrackNumber = info.trackNumber;
+                mGenre = info.genres.join(QLatin1String(", "));
+                mTrackGain = info.replayGainTrack;
+                mAlbumGain = info.replayGainAlbum;
+            }
+            mMimeType = std::move(details.mimeType);
+            mFileSize = details.fileSize;
+            if (details.hasProperties) {
+                mDuration = info.duration;
+                mBitrate = info.bitrate;
+                mSampleRate = info.sampleRate;
+                mChannels = info.channels;
+            }
+            emit infoChanged();
 
-        mTitle = std::move(info.title);
-        mArtist = info.artists.join(QLatin1String(", "));
-        mAlbum = info.albums.join(QLatin1String(", "));
-        mDiscNumber = std::move(info.discNumber);
-        mYear = info.year;
-        mTrackNumber = info.trackNumber;
-        mGenre = info.genres.join(QLatin1String(", "));
-        mFileSize = fileInfo.size();
-        mDuration = info.duration;
-        mBitrate = info.bitrate;
+            mLoaded = true;
+            emit loadedChanged();
+        });
+        watcher->setFuture(future);
+    }
+
+    bool TrackInfo::isLoaded() const
+    {
+        return mLoaded;
+    }
+
+    long long TrackInfo::loadFromLibrary()
+    {
+        mTitle.clear();
+        mArtist.clear();
+        mAlbum.clear();
+        mDiscNumber.clear();
+        mYear = 0;
+        mTrackNumber = 0;
+        mGenre.clear();
+        mDuration = 0;
+        mBitrate = 0;
+        mSampleRate = 0;
+        mChannels = 0;
+        mTrackGain = std::numeric_limits<double>::quiet_NaN();
+        mAlbumGain = std::numeric_limits<double>::quiet_NaN();
+        mHasLibraryAudioDetails = false;
+
+        if (!LibraryUtils::instance()->isDatabaseInitialized()) {
+            return -1;
+        }
+
+        SqlQuery query;
+        query.setForwardOnly(true);
+        query.prepareCached(QLatin1String("SELECT modificationTime, tracks.title, year, trackNumber, discNumber, duration, "
+                                          "artists.title, albums.title, genres.title, bitrate, sampleRate, channels, "
+                                          "replayGainTrack, replayGainAlbum FROM tracks "
+                                          "LEFT JOIN tracks_artists ON tracks_artists.trackId = tracks.id "
+                                          "LEFT JOIN artists ON artists.id = tracks_artists.artistId "
+                                          "LEFT JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
+                                          "LEFT JOIN albums ON albums.id = tracks_albums.albumId "
+                                          "LEFT JOIN tracks_genres ON tracks_genres.trackId = tracks.id "
+                                          "LEFT JOIN genres ON genres.id = tracks_genres.genreId "
+                                          "WHERE filePath = ?"));
+        query.addBindValue(mFilePath);
+        LibraryUtils::explainQuery(query);
+        if (!query.exec()) {
+            qWarning() << "failed to get track from database" << query.lastError();
+            return -1;
+        }
+
+        long long modificationTime = -1;
+        QStringList artists;
+        QStringList albums;
+        QStringList genres;
+        while (query.next()) {
+            if (modificationTime == -1) {
+                modificationTime = query.value(0).toLongLong();
+                mTitle = query.value(1).toString();
+                mYear = query.value(2).toInt();
+                mTrackNumber = query.value(3).toInt();
+                mDiscNumber = query.value(4).toString();
+                mDuration = query.value(5).toInt();
+                // Null for tracks added by older versions
+                mHasLibraryAudioDetails = !query.isNull(9);
+                mBitrate = query.value(9).toInt();
+                mSampleRate = query.value(10).toInt();
+                mChannels = query.value(11).toInt();
+                if (!query.isNull(12)) {
+                    mTrackGain = query.value(12).toDouble();
+                }
+                if (!query.isNull(13)) {
+                    mAlbumGain = query.value(13).toDouble();
+                }
+            }
+            artists.push_back(query.value(6).toString());
+            albums.push_back(query.value(7).toString());
+            genres.push_back(query.value(8).toString());
+        }
+
+        if (modificationTime != -1) {
+            artists.removeDuplicates();
+            albums.removeDuplicates();
+            genres.removeDuplicates();
+            artists.removeAll(QString());
+            albums.removeAll(QString());
+            genres.removeAll(QString());
+            mArtist = artists.join(QLatin1String(", "));
+            mAlbum = albums.join(QLatin1String(", "));
+            mGenre = genres.join(QLatin1String(", "));
+        }
+
+        return modificationTime;
     }
 
     const QString& TrackInfo::title() const
@@ -107,4 +275,24 @@ namespace unplayer
     {
         return qApp->translate("unplayer", "%1 kB/s").arg(mBitrate);
     }
+
+    int TrackInfo::sampleRate() const
+    {
+        return mSampleRate;
+    }
+
+    int TrackInfo::channels() const
+    {
+        return mChannels;
+    }
+
+    QString TrackInfo::trackGain() const
+    {
+        return formatGain(mTrackGain);
+    }
+
+    QString TrackInfo::albumGain() const
+    {
+        return formatGain(mAlbumGain);
+    }
 }
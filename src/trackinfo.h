@@ -19,6 +19,8 @@
 #ifndef UNPLAYER_TRACKINFO_H
 #define UNPLAYER_TRACKINFO_H
 
+#include <limits>
+
 #include <QObject>
 
 namespace unplayer
@@ -28,22 +30,32 @@ namespace unplayer
         Q_OBJECT
 
         Q_PROPERTY(QString filePath READ filePath WRITE setFilePath)
+        // Tags of library tracks are available right away, other properties
+        // are read from file in background
+        Q_PROPERTY(bool loaded READ isLoaded NOTIFY loadedChanged)
 
-        Q_PROPERTY(QString title READ title CONSTANT)
-        Q_PROPERTY(QString artist READ artist CONSTANT)
-        Q_PROPERTY(QString album READ album CONSTANT)
-        Q_PROPERTY(QString discNumber READ discNumber CONSTANT)
-        Q_PROPERTY(int year READ year CONSTANT)
-        Q_PROPERTY(int trackNumber READ trackNumber CONSTANT)
-        Q_PROPERTY(QString genre READ genre CONSTANT)
-        Q_PROPERTY(int fileSize READ fileSize CONSTANT)
-        Q_PROPERTY(QString mimeType READ mimeType CONSTANT)
-        Q_PROPERTY(int duration READ duration CONSTANT)
-        Q_PROPERTY(QString bitrate READ bitrate CONSTANT)
+        Q_PROPERTY(QString title READ title NOTIFY infoChanged)
+        Q_PROPERTY(QString artist READ artist NOTIFY infoChanged)
+        Q_PROPERTY(QString album READ album NOTIFY infoChanged)
+        Q_PROPERTY(QString discNumber READ discNumber NOTIFY infoChanged)
+        Q_PROPERTY(int year READ year NOTIFY infoChanged)
+        Q_PROPERTY(int trackNumber READ trackNumber NOTIFY infoChanged)
+        Q_PROPERTY(QString genre READ genre NOTIFY infoChanged)
+        Q_PROPERTY(int fileSize READ fileSize NOTIFY infoChanged)
+        Q_PROPERTY(QString mimeType READ mimeType NOTIFY infoChanged)
+        Q_PROPERTY(int duration READ duration NOTIFY infoChanged)
+        Q_PROPERTY(QString bitrate READ bitrate NOTIFY infoChanged)
+        Q_PROPERTY(int sampleRate READ sampleRate NOTIFY infoChanged)
+        Q_PROPERTY(int channels READ channels NOTIFY infoChanged)
+        // Empty if file doesn't have ReplayGain tags
+        Q_PROPERTY(QString trackGain READ trackGain NOTIFY infoChanged)
+        Q_PROPERTY(QString albumGain READ albumGain NOTIFY infoChanged)
     public:
         const QString& filePath() const;
         void setFilePath(const QString& filePath);
 
+        bool isLoaded() const;
+
         const QString& title() const;
         const QString& artist() const;
         const QString& album() const;
@@ -55,9 +67,18 @@ namespace unplayer
         const QString& mimeType() const;
         int duration() const;
         QString bitrate() const;
+        int sampleRate() const;
+        int channels() const;
+        QString trackGain() const;
+        QString albumGain() const;
 
     private:
+        // Returns modification time of track in library, or -1 if it is not in library.
+        // Sets mHasLibraryAudioDetails
+        long long loadFromLibrary();
+
         QString mFilePath;
+        bool mLoaded = false;
 
         QString mTitle;
         QString mArtist;
@@ -70,6 +91,15 @@ namespace unplayer
         QString mMimeType;
         int mDuration = 0;
         int mBitrate = 0;
+        int mSampleRate = 0;
+        int mChannels = 0;
+        double mTrackGain = std::numeric_limits<double>::quiet_NaN();
+        double mAlbumGain = std::numeric_limits<double>::quiet_NaN();
+        // Audio properties were stored by scan, file doesn't need to be parsed
+        bool mHasLibraryAudioDetails = false;
+    signals:
+        void loadedChanged();
+        void infoChanged();
     };
 }
 
@@ -0,0 +1,83 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "tracklist.h"
+
+#include <QReadLocker>
+
+#include "trackstore.h"
+
+namespace unplayer
+{
+    TrackList::TrackList(std::vector<Entry>&& entries)
+        : mEntries(std::make_shared<std::vector<Entry>>(std::move(entries)))
+    {
+
+    }
+
+    TrackList::TrackList(std::vector<LibraryTrack>&& tracks)
+        : mTracks(std::make_shared<std::vector<LibraryTrack>>(std::move(tracks)))
+    {
+
+    }
+
+    bool TrackList::isEmpty() const
+    {
+        return size() == 0;
+    }
+
+    int TrackList::size() const
+    {
+        if (mEntries) {
+            return mEntries->size();
+        }
+        if (mTracks) {
+            return mTracks->size();
+        }
+        return 0;
+    }
+
+    QString TrackList::filePath(int index) const
+    {
+        if (mEntries) {
+            const TrackStore* store = TrackStore::instance();
+            const QReadLocker locker(store->lock());
+            return store->filePath((*mEntries)[index].track);
+        }
+        return (*mTracks)[index].filePath;
+    }
+
+    std::vector<LibraryTrack> TrackList::tracks() const
+    {
+        if (mEntries) {
+            std::vector<LibraryTrack> tracks;
+            tracks.reserve(mEntries->size());
+            const TrackStore* store = TrackStore::instance();
+            const QReadLocker locker(store->lock());
+            for (const Entry& entry : *mEntries) {
+                tracks.push_back(store->libraryTrack(entry.track, entry.artist, entry.album));
+            }
+            return tracks;
+        }
+        if (mTracks) {
+            return *mTracks;
+        }
+        return {};
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_TRACKLIST_H
+#define UNPLAYER_TRACKLIST_H
+
+#include <memory>
+#include <vector>
+
+#include <QMetaType>
+
+#include "librarytrack.h"
+
+namespace unplayer
+{
+    // Immutable list of library tracks that is passed from models
+    // to queue and playlists. Copying it only copies reference.
+    // Tracks of TracksModel are kept as TrackStore indexes until they are resolved
+    class TrackList final
+    {
+    public:
+        // Indexes in TrackStore
+        struct Entry
+        {
+            quint32 track;
+            quint32 artist;
+            quint32 album;
+        };
+
+        TrackList() = default;
+        explicit TrackList(std::vector<Entry>&& entries);
+        explicit TrackList(std::vector<LibraryTrack>&& tracks);
+
+        bool isEmpty() const;
+        int size() const;
+        QString filePath(int index) const;
+
+        // Can be called from any thread
+        std::vector<LibraryTrack> tracks() const;
+
+    private:
+        std::shared_ptr<const std::vector<Entry>> mEntries;
+        std::shared_ptr<const std::vector<LibraryTrack>> mTracks;
+    };
+}
+
+Q_DECLARE_METATYPE(unplayer::TrackList)
+
+#endif // UNPLAYER_TRACKLIST_H
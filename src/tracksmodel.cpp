@@ -21,16 +21,14 @@
 #include <functional>
 
 #include <QCoreApplication>
-#include <QDebug>
-#include <QFile>
-#include <QFutureWatcher>
-#include <QSqlError>
+#include <QReadLocker>
 #include <QSqlQuery>
-#include <QUrl>
-#include <QtConcurrentRun>
 
 #include "libraryutils.h"
+#include "playstatistics.h"
 #include "settings.h"
+#include "tracing.h"
+#include "trackstore.h"
 
 namespace unplayer
 {
@@ -43,8 +41,117 @@ namespace unplayer
             ArtistField,
             AlbumField,
             DurationField,
-            MediaArtField
+            MediaArtField,
+            IdField,
+            YearField,
+            TrackNumberField,
+            TitleSortKeyField,
+            ArtistSortKeyField,
+            AlbumSortKeyField,
+            DiscNumberSortKeyField
         };
+
+        using SortMode = TracksModel::SortMode;
+        using InsideAlbumSortMode = TracksModel::InsideAlbumSortMode;
+
+        TracksModelRow rowFromQuery(const QSqlQuery& query)
+        {
+            TrackStore* store = TrackStore::instance();
+            return {store->addTrack({query.value(IdField).toInt(),
+                                     query.value(FilePathField).toString(),
+                                     query.value(TitleField).toString(),
+                                     query.value(TitleSortKeyField).toString().toUtf8(),
+                                     query.value(DiscNumberSortKeyField).toString().toUtf8(),
+                                     query.value(DurationField).toInt(),
+                                     LibraryUtils::intSortKey(query.value(YearField)),
+                                     LibraryUtils::intSortKey(query.value(TrackNumberField)),
+                                     query.value(MediaArtField).toString()}),
+                    store->addArtist(query.value(ArtistField).toString(), query.value(ArtistSortKeyField).toString().toUtf8()),
+                    store->addAlbum(query.value(AlbumField).toString(), query.value(AlbumSortKeyField).toString().toUtf8())};
+        }
+
+        QVariantList trackBindValues(const TracksModelRow& row)
+        {
+            const TrackStore* store = TrackStore::instance();
+            const QReadLocker locker(store->lock());
+            return {store->filePath(row.track)};
+        }
+
+        // Track appears once for each of its artists and albums
+        QVariantList rowKey(const TracksModelRow& row)
+        {
+            const TrackStore* store = TrackStore::instance();
+            const QReadLocker locker(store->lock());
+            return {store->id(row.track), store->artist(row.artist), store->album(row.album)};
+        }
+
+        template<typename T>
+        int compare(const T& first, const T& second)
+        {
+            if (first < second) {
+                return -1;
+            }
+            if (second < first) {
+                return 1;
+            }
+            return 0;
+        }
+
+        // Same order as ORDER BY in TracksModel::execQuery(). Sort keys
+        // are compared as UTF-8 bytes, like SQLite does with BINARY collation
+        int compareRows(const TrackStore* store,
+                        const TracksModelRow& first,
+                        const TracksModelRow& second,
+                        SortMode sortMode,
+                        InsideAlbumSortMode insideAlbumSortMode)
+        {
+            int result = 0;
+            switch (sortMode) {
+            case SortMode::Title:
+                return compare(store->titleSortKey(first.track), store->titleSortKey(second.track));
+            case SortMode::AddedDate:
+                return compare(store->id(first.track), store->id(second.track));
+            case SortMode::ArtistAlbumTitle:
+                if ((result = compare(store->artistSortKey(first.artist), store->artistSortKey(second.artist))) != 0 ||
+                        (result = compare(store->albumSortKey(first.album), store->albumSortKey(second.album))) != 0) {
+                    return result;
+                }
+                break;
+            case SortMode::ArtistAlbumYear:
+            {
+                const QByteArray emptySortKey(LibraryUtils::emptySortKey.latin1());
+                if ((result = compare(store->artistSortKey(first.artist), store->artistSortKey(second.artist))) != 0 ||
+                        (result = compare(store->albumSortKey(first.album) == emptySortKey,
+                                        store->albumSortKey(second.album) == emptySortKey)) != 0 ||
+                        (result = compare(store->year(first.track), store->year(second.track))) != 0 ||
+                        (result = compare(store->albumSortKey(first.album), store->albumSortKey(second.album))) != 0) {
+                    return result;
+                }
+                break;
+            }
+            case SortMode::PlayCount:
+            case SortMode::LastPlayed:
+                // Statistics are not loaded, rows are queried again
+                return compare(store->id(first.track), store->id(second.track));
+            }
+
+            switch (insideAlbumSortMode) {
+            case InsideAlbumSortMode::Title:
+                break;
+            case InsideAlbumSortMode::DiscNumberTitle:
+                if ((result = compare(store->discNumberSortKey(first.track), store->discNumberSortKey(second.track))) != 0) {
+                    return result;
+                }
+                break;
+            case InsideAlbumSortMode::DiscNumberTrackNumber:
+                if ((result = compare(store->discNumberSortKey(first.track), store->discNumberSortKey(second.track))) != 0 ||
+                        (result = compare(store->trackNumber(first.track), store->trackNumber(second.track))) != 0) {
+                    return result;
+                }
+                break;
+            }
+            return compare(store->titleSortKey(first.track), store->titleSortKey(second.track));
+        }
     }
 
     TracksModel::~TracksModel()
@@ -86,34 +193,49 @@ namespace unplayer
         emit sortModeChanged();
         emit insideAlbumSortModeChanged();
 
+        mSections.updateOnRowsChanged(this, std::bind(&TracksModel::updateSections, this));
+
         execQuery();
+        QObject::connect(LibraryUtils::instance(), &LibraryUtils::libraryChanged, this, [this](const LibraryChanges& changes) {
+            if (changesFilter()(changes)) {
+                execQuery(true);
+            }
+        });
+        QObject::connect(PlayStatistics::instance(), &PlayStatistics::statisticsChanged, this, [this]() {
+            if (isStatisticsSortMode()) {
+                execQuery(true);
+            }
+        });
     }
 
     QVariant TracksModel::data(const QModelIndex& index, int role) const
     {
-        const LibraryTrack& track = mTracks[index.row()];
+        const TracksModelRow& row = mRows[index.row()];
+        const TrackStore* store = TrackStore::instance();
+        const QReadLocker locker(store->lock());
 
         switch (role) {
         case FilePathRole:
-            return track.filePath;
+            return store->filePath(row.track);
         case TitleRole:
-            return track.title;
+            return store->title(row.track);
         case ArtistRole:
-            return track.artist;
+        {
+            const QString& artist = store->artist(row.artist);
+            return artist.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : artist;
+        }
         case AlbumRole:
-            return track.album;
+        {
+            const QString& album = store->album(row.album);
+            return album.isEmpty() ? qApp->translate("unplayer", "Unknown album") : album;
+        }
         case DurationRole:
-            return track.duration;
+            return store->duration(row.track);
         default:
             return QVariant();
         }
     }
 
-    int TracksModel::rowCount(const QModelIndex&) const
-    {
-        return mTracks.size();
-    }
-
     bool TracksModel::allArtists() const
     {
         return mAllArtists;
@@ -173,7 +295,7 @@ namespace unplayer
     {
         if (descending != mSortDescending) {
             mSortDescending = descending;
-            execQuery();
+            sortRows(true);
         }
     }
 
@@ -185,9 +307,15 @@ namespace unplayer
     void TracksModel::setSortMode(TracksModel::SortMode mode)
     {
         if (mode != mSortMode) {
+            // Statistics modes show only played tracks
+            const bool filterChanged = isStatisticsSortMode();
             mSortMode = mode;
             emit sortModeChanged();
-            execQuery();
+            if (filterChanged || isStatisticsSortMode()) {
+                execQuery();
+            } else {
+                sortRows(false);
+            }
         }
     }
 
@@ -201,28 +329,34 @@ namespace unplayer
         if (mode != mInsideAlbumSortMode) {
             mInsideAlbumSortMode = mode;
             emit insideAlbumSortModeChanged();
-            execQuery();
+            if (mSortMode == SortMode::ArtistAlbumTitle || mSortMode == SortMode::ArtistAlbumYear) {
+                sortRows(false);
+            }
         }
     }
 
-    bool TracksModel::isRemovingFiles() const
+    SectionsModel* TracksModel::sections()
     {
-        return mRemovingFiles;
+        return &mSections;
     }
 
-    std::vector<LibraryTrack> TracksModel::getTracks(const std::vector<int>& indexes)
+    TrackList TracksModel::getTracks(const std::vector<int>& indexes)
     {
-        std::vector<LibraryTrack> tracks;
-        tracks.reserve(indexes.size());
+        // Tracks are resolved by receiver
+        std::vector<TrackList::Entry> entries;
+        entries.reserve(indexes.size());
         for (int index : indexes) {
-            tracks.push_back(mTracks[index]);
+            entries.push_back(mRows[index]);
         }
-        return tracks;
+        return TrackList(std::move(entries));
     }
 
     LibraryTrack TracksModel::getTrack(int index)
     {
-        return mTracks[index];
+        const TracksModelRow& row = mRows[index];
+        const TrackStore* store = TrackStore::instance();
+        const QReadLocker locker(store->lock());
+        return store->libraryTrack(row.track, row.artist, row.album);
     }
 
     void TracksModel::removeTrack(int index, bool deleteFile)
@@ -232,73 +366,11 @@ namespace unplayer
 
     void TracksModel::removeTracks(const std::vector<int>& indexes, bool deleteFiles)
     {
-        if (mRemovingFiles) {
-            return;
-        }
-
-        mRemovingFiles = true;
-        emit removingFilesChanged();
-
-        std::vector<QString> tracks;
-        tracks.reserve(mTracks.size());
-        for (int index : indexes) {
-            tracks.push_back(mTracks[index].filePath);
-        }
-
-        auto future = QtConcurrent::run(std::bind([deleteFiles](std::vector<int>& indexes, std::vector<QString>& tracks) {
-            std::vector<int> removed;
-            {
-                auto db = QSqlDatabase::addDatabase(LibraryUtils::databaseType, staticMetaObject.className());
-                db.setDatabaseName(LibraryUtils::instance()->databaseFilePath());
-                if (!db.open()) {
-                    QSqlDatabase::removeDatabase(staticMetaObject.className());
-                    qWarning() << "failed to open database" << db.lastError();
-                    return removed;
-                }
-
-                db.transaction();
-
-                std::sort(indexes.begin(), indexes.end(), std::greater<int>());
-                for (int index : indexes) {
-                    const QString& filePath = tracks[index];
-
-                    QSqlQuery query(db);
-                    query.prepare(QStringLiteral("DELETE FROM tracks WHERE filePath = ?"));
-                    query.addBindValue(filePath);
-                    if (query.exec()) {
-                        removed.push_back(index);
-                    } else {
-                        qWarning() << "failed to remove file from database" << query.lastQuery()  << query.lastError();
-                    }
-
-                    if (deleteFiles) {
-                        if (!QFile::remove(filePath)) {
-                            qWarning() << "failed to remove file:" << filePath << query.lastError();
-                        }
-                    }
-                }
-
-                db.commit();
-            }
-            QSqlDatabase::removeDatabase(staticMetaObject.className());
-            return removed;
-        }, indexes, std::move(tracks)));
-
-        using Watcher = QFutureWatcher<std::vector<int>>;
-        auto watcher = new Watcher(this);
-        QObject::connect(watcher, &Watcher::finished, this, [this, watcher]() {
-            mRemovingFiles = false;
-            emit removingFilesChanged();
-
-            for (int index : watcher->result()) {
-                beginRemoveRows(QModelIndex(), index, index);
-                mTracks.erase(mTracks.begin() + index);
-                endRemoveRows();
-            }
-            emit LibraryUtils::instance()->databaseChanged();
-            watcher->deleteLater();
-        });
-        watcher->setFuture(future);
+        removeRows(indexes,
+                   deleteFiles,
+                   QLatin1String("SELECT tracks.id FROM query_keys "
+                                 "JOIN tracks ON tracks.filePath = query_keys.key0"),
+                   trackBindValues);
     }
 
     QHash<int, QByteArray> TracksModel::roleNames() const
@@ -310,37 +382,58 @@ namespace unplayer
             {DurationRole, "duration"}};
     }
 
-    void TracksModel::execQuery()
+    void TracksModel::execQuery(bool update)
     {
-        QString queryString(QLatin1String("SELECT filePath, title, artist, album, duration, mediaArt FROM tracks "));
+        UNPLAYER_TRACE("TracksModel::execQuery");
+        // One row for each artist and album of track
+        QString queryString(QLatin1String("SELECT filePath, tracks.title AS title, artists.title AS artist, albums.title AS album, duration, mediaArt, "
+                                          "tracks.id, year, trackNumber, titleSortKey, artists.sortKey, albums.sortKey, discNumberSortKey FROM tracks "
+                                          "JOIN tracks_artists ON tracks_artists.trackId = tracks.id "
+                                          "JOIN artists ON artists.id = tracks_artists.artistId "
+                                          "JOIN tracks_albums ON tracks_albums.trackId = tracks.id "
+                                          "JOIN albums ON albums.id = tracks_albums.albumId "));
 
         if (mAllArtists) {
             if (!mGenre.isEmpty()) {
-                queryString += QLatin1String("WHERE genre = ? ");
+                queryString += QLatin1String("WHERE tracks.id IN (SELECT trackId FROM tracks_genres "
+                                             "JOIN genres ON genres.id = tracks_genres.genreId "
+                                             "WHERE genres.title = ?) ");
             }
-            queryString += QLatin1String("GROUP BY id, artist, album ");
         } else {
-            queryString += QLatin1String("WHERE artist = ? ");
-            if (mAllAlbums) {
-                queryString += QLatin1String("GROUP BY id, album ");
-            } else {
-                queryString += QLatin1String("AND album = ? "
-                                       "GROUP BY id ");
+            queryString += QLatin1String("WHERE artists.title = ? ");
+            if (!mAllAlbums) {
+                queryString += QLatin1String("AND albums.title = ? ");
             }
         }
 
+        // Conditions match partial indexes on play statistics
+        if (isStatisticsSortMode()) {
+            queryString += (mAllArtists && mGenre.isEmpty()) ? QLatin1String("WHERE ") : QLatin1String("AND ");
+            queryString += (mSortMode == SortMode::PlayCount) ? QLatin1String("playCount > 0 ")
+                                                               : QLatin1String("lastPlayed > 0 ");
+        }
+
+        // Sort keys are indexed, and empty strings are sorted last by their keys
         switch (mSortMode) {
         case SortMode::Title:
-            queryString += QLatin1String("ORDER BY title %1");
+            queryString += QLatin1String("ORDER BY titleSortKey %1");
             break;
         case SortMode::AddedDate:
-            queryString += QLatin1String("ORDER BY id %1");
+            queryString += QLatin1String("ORDER BY tracks.id %1");
             break;
         case SortMode::ArtistAlbumTitle:
-            queryString += QLatin1String("ORDER BY artist = '' %1, artist %1, album = '' %1, album %1, ");
+            queryString += QLatin1String("ORDER BY artists.sortKey %1, albums.sortKey %1, ");
             break;
         case SortMode::ArtistAlbumYear:
-            queryString += QLatin1String("ORDER BY artist = '' %1, artist %1, album = '' %1, year %1, album %1, ");
+            // Albums with unknown title are after other ones regardless of year
+            queryString += QString::fromLatin1("ORDER BY artists.sortKey %1, albums.sortKey = '%2' %1, year %1, albums.sortKey %1, ")
+                    .arg(QLatin1String("%1"), LibraryUtils::emptySortKey);
+            break;
+        case SortMode::PlayCount:
+            queryString += QLatin1String("ORDER BY playCount %1, lastPlayed %1");
+            break;
+        case SortMode::LastPlayed:
+            queryString += QLatin1String("ORDER BY lastPlayed %1");
             break;
         }
 
@@ -348,55 +441,100 @@ namespace unplayer
                 mSortMode == SortMode::ArtistAlbumYear) {
             switch (mInsideAlbumSortMode) {
             case InsideAlbumSortMode::Title:
-                queryString += QLatin1String("title %1");
+                queryString += QLatin1String("titleSortKey %1");
                 break;
             case InsideAlbumSortMode::DiscNumberTitle:
-                queryString += QLatin1String("discNumber = '' %1, discNumber %1, title %1");
+                queryString += QLatin1String("discNumberSortKey %1, titleSortKey %1");
                 break;
             case InsideAlbumSortMode::DiscNumberTrackNumber:
-                queryString += QLatin1String("discNumber = '' %1, discNumber %1, trackNumber %1, title %1");
+                queryString += QLatin1String("discNumberSortKey %1, trackNumber %1, titleSortKey %1");
                 break;
             }
         }
 
-        queryString = queryString.arg(mSortDescending ? QLatin1String("DESC")
-                                                      : QLatin1String("ASC"));
-
-        QSqlQuery query;
-        query.prepare(queryString);
+        // Largest play statistics are first in ascending order
+        const bool descending = isStatisticsSortMode() ? !mSortDescending : mSortDescending;
+        queryString = queryString.arg(descending ? QLatin1String("DESC")
+                                                 : QLatin1String("ASC"));
 
+        QVariantList bindValues;
         if (mAllArtists) {
             if (!mGenre.isEmpty()) {
-                query.addBindValue(mGenre);
+                bindValues.push_back(mGenre);
             }
         } else {
-            query.addBindValue(mArtist);
+            bindValues.push_back(mArtist);
             if (!mAllAlbums) {
-                query.addBindValue(mAlbum);
+                bindValues.push_back(mAlbum);
             }
         }
 
-        beginResetModel();
-        mTracks.clear();
-        if (query.exec()) {
-            query.last();
-            if (query.at() > 0) {
-                mTracks.reserve(query.at() + 1);
-            }
-            query.seek(QSql::BeforeFirstRow);
-            while (query.next()) {
-                const QString artist(query.value(ArtistField).toString());
-                const QString album(query.value(AlbumField).toString());
-                mTracks.push_back({query.value(FilePathField).toString(),
-                                   query.value(TitleField).toString(),
-                                   artist.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : artist,
-                                   album.isEmpty() ? qApp->translate("unplayer", "Unknown album") : album,
-                                   query.value(DurationField).toInt(),
-                                   query.value(MediaArtField).toString()});
+        AsyncQueryModel::execQuery(queryString, bindValues, rowFromQuery, update ? rowKey : nullptr, changesFilter());
+    }
+
+    TracksModel::LibraryChangesFilter TracksModel::changesFilter() const
+    {
+        // FIXME: use init capture when moving to C++14
+        const bool allArtists = mAllArtists;
+        const bool allAlbums = mAllAlbums;
+        const QString artist(mArtist);
+        const QString album(mAlbum);
+        const QString genre(mGenre);
+        return [allArtists, allAlbums, artist, album, genre](const LibraryChanges& changes) {
+            return allArtists ? (genre.isEmpty() || changes.affectsGenre(genre))
+                              : (changes.affectsArtist(artist) && (allAlbums || changes.affectsAlbum(album)));
+        };
+    }
+
+    void TracksModel::updateSections()
+    {
+        if (mSortMode == SortMode::AddedDate || isStatisticsSortMode()) {
+            mSections.clear();
+            return;
+        }
+
+        // Sections model is reset outside of lock, since views read tracks when it changes
+        std::vector<QByteArray> keys;
+        keys.reserve(mRows.size());
+        {
+            const TrackStore* store = TrackStore::instance();
+            const QReadLocker locker(store->lock());
+            for (const TracksModelRow& row : mRows) {
+                keys.push_back((mSortMode == SortMode::Title) ? store->titleSortKey(row.track)
+                                                              : store->artistSortKey(row.artist));
             }
-        } else {
-            qWarning() << query.lastError();
         }
-        endResetModel();
+        mSections.update(keys.size(), [&](int row) {
+            return keys[row];
+        });
+    }
+
+    bool TracksModel::isStatisticsSortMode() const
+    {
+        return mSortMode == SortMode::PlayCount || mSortMode == SortMode::LastPlayed;
+    }
+
+    void TracksModel::sortRows(bool reverse)
+    {
+        if (!canSortRows()) {
+            execQuery();
+            return;
+        }
+
+        // Only direction has changed
+        if (reverse && !isSortingRows()) {
+            reverseRows();
+            return;
+        }
+
+        const bool descending = mSortDescending;
+        const SortMode sortMode = mSortMode;
+        const InsideAlbumSortMode insideAlbumSortMode = mInsideAlbumSortMode;
+        AsyncQueryModel::sortRows([=](const TracksModelRow& first, const TracksModelRow& second) {
+            const TrackStore* store = TrackStore::instance();
+            const QReadLocker locker(store->lock());
+            return descending ? compareRows(store, second, first, sortMode, insideAlbumSortMode) < 0
+                              : compareRows(store, first, second, sortMode, insideAlbumSortMode) < 0;
+        });
     }
 }
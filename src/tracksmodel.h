@@ -21,10 +21,12 @@
 
 #include <vector>
 
-#include <QAbstractListModel>
 #include <QQmlParserStatus>
 
+#include "asyncquerymodel.h"
 #include "librarytrack.h"
+#include "sectionsmodel.h"
+#include "tracklist.h"
 
 namespace unplayer
 {
@@ -37,7 +39,10 @@ namespace unplayer
             Title,
             AddedDate,
             ArtistAlbumTitle,
-            ArtistAlbumYear
+            ArtistAlbumYear,
+            // Only played tracks, most played or recently played first in ascending order
+            PlayCount,
+            LastPlayed
         };
         Q_ENUM(Mode)
     };
@@ -55,7 +60,9 @@ namespace unplayer
         Q_ENUM(Mode)
     };
 
-    class TracksModel : public QAbstractListModel, public QQmlParserStatus
+    using TracksModelRow = TrackList::Entry;
+
+    class TracksModel : public AsyncQueryModel<TracksModelRow>, public QQmlParserStatus
     {
         Q_OBJECT
 
@@ -70,8 +77,7 @@ namespace unplayer
         Q_PROPERTY(bool sortDescending READ sortDescending WRITE setSortDescending)
         Q_PROPERTY(unplayer::TracksModelSortMode::Mode sortMode READ sortMode WRITE setSortMode NOTIFY sortModeChanged)
         Q_PROPERTY(unplayer::TracksModelInsideAlbumSortMode::Mode insideAlbumSortMode READ insideAlbumSortMode WRITE setInsideAlbumSortMode NOTIFY insideAlbumSortModeChanged)
-
-        Q_PROPERTY(bool removingFiles READ isRemovingFiles NOTIFY removingFilesChanged)
+        Q_PROPERTY(unplayer::SectionsModel* sections READ sections CONSTANT)
     public:
         enum Role
         {
@@ -91,7 +97,6 @@ namespace unplayer
         void componentComplete() override;
 
         QVariant data(const QModelIndex& index, int role) const override;
-        int rowCount(const QModelIndex& parent) const override;
 
         bool allArtists() const;
         void setAllArtists(bool allArtists);
@@ -117,9 +122,10 @@ namespace unplayer
         InsideAlbumSortMode insideAlbumSortMode() const;
         void setInsideAlbumSortMode(InsideAlbumSortMode mode);
 
-        bool isRemovingFiles() const;
+        // Empty when tracks are sorted by added date or play statistics
+        SectionsModel* sections();
 
-        Q_INVOKABLE std::vector<unplayer::LibraryTrack> getTracks(const std::vector<int>& indexes);
+        Q_INVOKABLE unplayer::TrackList getTracks(const std::vector<int>& indexes);
         Q_INVOKABLE unplayer::LibraryTrack getTrack(int index);
 
         Q_INVOKABLE void removeTrack(int index, bool deleteFile);
@@ -129,9 +135,14 @@ namespace unplayer
         QHash<int, QByteArray> roleNames() const override;
 
     private:
-        void execQuery();
-
-        std::vector<LibraryTrack> mTracks;
+        // Updates rows in place if update is true
+        void execQuery(bool update = false);
+        // Changes that affect rows with current artist, album or genre
+        LibraryChangesFilter changesFilter() const;
+        bool isStatisticsSortMode() const;
+        // Reorders rows in memory if all of them are loaded, otherwise queries them again
+        void sortRows(bool reverse);
+        void updateSections();
 
         bool mAllArtists = true;
         bool mAllAlbums = true;
@@ -143,12 +154,11 @@ namespace unplayer
         SortMode mSortMode = SortMode::ArtistAlbumYear;
         InsideAlbumSortMode mInsideAlbumSortMode = InsideAlbumSortMode::DiscNumberTrackNumber;
 
-        bool mRemovingFiles = false;
+        SectionsModel mSections;
 
     signals:
         void sortModeChanged();
         void insideAlbumSortModeChanged();
-        void removingFilesChanged();
     };
 }
 
@@ -0,0 +1,185 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "trackstore.h"
+
+#include <QCoreApplication>
+
+namespace unplayer
+{
+    quint32 TrackStore::StringPool::add(const QString& string, const QByteArray& sortKey)
+    {
+        const auto found(mIndexes.find(string));
+        if (found != mIndexes.end()) {
+            return found->second;
+        }
+        const quint32 index = mStrings.size();
+        mStrings.push_back(string);
+        mSortKeys.push_back(sortKey);
+        mIndexes.emplace(string, index);
+        return index;
+    }
+
+    const QString& TrackStore::StringPool::string(quint32 index) const
+    {
+        return mStrings[index];
+    }
+
+    const QByteArray& TrackStore::StringPool::sortKey(quint32 index) const
+    {
+        return mSortKeys[index];
+    }
+
+    TrackStore* TrackStore::instance()
+    {
+        static TrackStore store;
+        return &store;
+    }
+
+    quint32 TrackStore::addTrack(const Track& track)
+    {
+        const QWriteLocker locker(&mLock);
+
+        const quint32 mediaArt = mMediaArtPaths.add(track.mediaArtPath);
+
+        const auto found(mIndexes.find(track.id));
+        if (found != mIndexes.end() && isSameTrack(found->second, track, mediaArt)) {
+            return found->second;
+        }
+
+        const quint32 index = mIds.size();
+        mIds.push_back(track.id);
+        mFilePaths.push_back(track.filePath);
+        mTitles.push_back(track.title);
+        mTitleSortKeys.push_back(track.titleSortKey);
+        mDiscNumberSortKeys.push_back(track.discNumberSortKey);
+        mDurations.push_back(track.duration);
+        mYears.push_back(track.year);
+        mTrackNumbers.push_back(track.trackNumber);
+        mMediaArt.push_back(mediaArt);
+        mIndexes[track.id] = index;
+        return index;
+    }
+
+    quint32 TrackStore::addArtist(const QString& title, const QByteArray& sortKey)
+    {
+        const QWriteLocker locker(&mLock);
+        return mArtists.add(title, sortKey);
+    }
+
+    quint32 TrackStore::addAlbum(const QString& title, const QByteArray& sortKey)
+    {
+        const QWriteLocker locker(&mLock);
+        return mAlbums.add(title, sortKey);
+    }
+
+    QReadWriteLock* TrackStore::lock() const
+    {
+        return &mLock;
+    }
+
+    int TrackStore::id(quint32 track) const
+    {
+        return mIds[track];
+    }
+
+    const QString& TrackStore::filePath(quint32 track) const
+    {
+        return mFilePaths[track];
+    }
+
+    const QString& TrackStore::title(quint32 track) const
+    {
+        return mTitles[track];
+    }
+
+    const QByteArray& TrackStore::titleSortKey(quint32 track) const
+    {
+        return mTitleSortKeys[track];
+    }
+
+    const QByteArray& TrackStore::discNumberSortKey(quint32 track) const
+    {
+        return mDiscNumberSortKeys[track];
+    }
+
+    int TrackStore::duration(quint32 track) const
+    {
+        return mDurations[track];
+    }
+
+    int TrackStore::year(quint32 track) const
+    {
+        return mYears[track];
+    }
+
+    int TrackStore::trackNumber(quint32 track) const
+    {
+        return mTrackNumbers[track];
+    }
+
+    const QString& TrackStore::mediaArtPath(quint32 track) const
+    {
+        return mMediaArtPaths.string(mMediaArt[track]);
+    }
+
+    const QString& TrackStore::artist(quint32 artist) const
+    {
+        return mArtists.string(artist);
+    }
+
+    const QByteArray& TrackStore::artistSortKey(quint32 artist) const
+    {
+        return mArtists.sortKey(artist);
+    }
+
+    const QString& TrackStore::album(quint32 album) const
+    {
+        return mAlbums.string(album);
+    }
+
+    const QByteArray& TrackStore::albumSortKey(quint32 album) const
+    {
+        return mAlbums.sortKey(album);
+    }
+
+    LibraryTrack TrackStore::libraryTrack(quint32 track, quint32 artist, quint32 album) const
+    {
+        const QString& artistTitle = mArtists.string(artist);
+        const QString& albumTitle = mAlbums.string(album);
+        return {mFilePaths[track],
+                mTitles[track],
+                artistTitle.isEmpty() ? qApp->translate("unplayer", "Unknown artist") : artistTitle,
+                albumTitle.isEmpty() ? qApp->translate("unplayer", "Unknown album") : albumTitle,
+                mDurations[track],
+                mMediaArtPaths.string(mMediaArt[track])};
+    }
+
+    bool TrackStore::isSameTrack(quint32 index, const Track& track, quint32 mediaArt) const
+    {
+        return mMediaArt[index] == mediaArt &&
+                mDurations[index] == track.duration &&
+                mYears[index] == track.year &&
+                mTrackNumbers[index] == track.trackNumber &&
+                mFilePaths[index] == track.filePath &&
+                mTitles[index] == track.title &&
+                mTitleSortKeys[index] == track.titleSortKey &&
+                mDiscNumberSortKeys[index] == track.discNumberSortKey;
+    }
+}
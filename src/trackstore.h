@@ -0,0 +1,123 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_TRACKSTORE_H
+#define UNPLAYER_TRACKSTORE_H
+
+#include <unordered_map>
+#include <vector>
+
+#include <QByteArray>
+#include <QReadWriteLock>
+#include <QString>
+
+#include "librarytrack.h"
+#include "stdutils.h"
+
+namespace unplayer
+{
+    // Library tracks shared by all models, stored column by column.
+    // Artists, albums and media art paths are interned, models keep
+    // only 32-bit indexes of tracks and strings instead of copying them.
+    // Entries are never removed, so that indexes stay valid
+    class TrackStore final
+    {
+    public:
+        struct Track
+        {
+            int id;
+            QString filePath;
+            QString title;
+            QByteArray titleSortKey;
+            QByteArray discNumberSortKey;
+            int duration;
+            // Values of LibraryUtils::intSortKey()
+            int year;
+            int trackNumber;
+            QString mediaArtPath;
+        };
+
+        static TrackStore* instance();
+
+        // Returns index of track with the same database id if it has not changed,
+        // otherwise adds new entry, which old one is kept for models that use it
+        quint32 addTrack(const Track& track);
+        quint32 addArtist(const QString& title, const QByteArray& sortKey);
+        quint32 addAlbum(const QString& title, const QByteArray& sortKey);
+
+        // Accessors below must be called with lock() locked for reading
+        QReadWriteLock* lock() const;
+
+        int id(quint32 track) const;
+        const QString& filePath(quint32 track) const;
+        const QString& title(quint32 track) const;
+        const QByteArray& titleSortKey(quint32 track) const;
+        const QByteArray& discNumberSortKey(quint32 track) const;
+        int duration(quint32 track) const;
+        int year(quint32 track) const;
+        int trackNumber(quint32 track) const;
+        const QString& mediaArtPath(quint32 track) const;
+
+        const QString& artist(quint32 artist) const;
+        const QByteArray& artistSortKey(quint32 artist) const;
+        const QString& album(quint32 album) const;
+        const QByteArray& albumSortKey(quint32 album) const;
+
+        // Empty artist and album are replaced with "Unknown artist" and "Unknown album"
+        LibraryTrack libraryTrack(quint32 track, quint32 artist, quint32 album) const;
+
+    private:
+        class StringPool
+        {
+        public:
+            quint32 add(const QString& string, const QByteArray& sortKey = QByteArray());
+            const QString& string(quint32 index) const;
+            const QByteArray& sortKey(quint32 index) const;
+
+        private:
+            std::vector<QString> mStrings;
+            std::vector<QByteArray> mSortKeys;
+            std::unordered_map<QString, quint32> mIndexes;
+        };
+
+        TrackStore() = default;
+        bool isSameTrack(quint32 index, const Track& track, quint32 mediaArt) const;
+
+        mutable QReadWriteLock mLock;
+
+        std::vector<int> mIds;
+        std::vector<QString> mFilePaths;
+        std::vector<QString> mTitles;
+        std::vector<QByteArray> mTitleSortKeys;
+        std::vector<QByteArray> mDiscNumberSortKeys;
+        std::vector<int> mDurations;
+        std::vector<int> mYears;
+        std::vector<int> mTrackNumbers;
+        std::vector<quint32> mMediaArt;
+
+        // Latest entry of each database id
+        std::unordered_map<int, quint32> mIndexes;
+
+        StringPool mArtists;
+        StringPool mAlbums;
+        StringPool mMediaArtPaths;
+    };
+}
+
+#endif // UNPLAYER_TRACKSTORE_H
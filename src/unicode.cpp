@@ -0,0 +1,241 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "unicode.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define UNPLAYER_UNICODE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define UNPLAYER_UNICODE_NEON
+#endif
+
+namespace unplayer
+{
+    namespace unicode
+    {
+        namespace
+        {
+            const ushort replacementCharacter = 0xFFFD;
+
+            // Converts ASCII characters at the beginning of source, returns their count.
+            // destination must have space for size characters
+            int widenAscii(const uchar* source, int size, ushort* destination)
+            {
+                int i = 0;
+#if defined(UNPLAYER_UNICODE_SSE2)
+                const __m128i zero(_mm_setzero_si128());
+                for (; i + 16 <= size; i += 16) {
+                    const __m128i chunk(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)));
+                    // Whole chunk is stored, but only characters before the first non-ASCII one are counted
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_unpacklo_epi8(chunk, zero));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i + 8), _mm_unpackhi_epi8(chunk, zero));
+                    const int mask = _mm_movemask_epi8(chunk);
+                    if (mask != 0) {
+                        return i + __builtin_ctz(static_cast<unsigned int>(mask));
+                    }
+                }
+#elif defined(UNPLAYER_UNICODE_NEON)
+                for (; i + 16 <= size; i += 16) {
+                    const uint8x16_t chunk(vld1q_u8(source + i));
+                    const uint8x8_t high(vorr_u8(vget_low_u8(chunk), vget_high_u8(chunk)));
+                    if ((vget_lane_u64(vreinterpret_u64_u8(high), 0) & 0x8080808080808080ULL) != 0) {
+                        break;
+                    }
+                    vst1q_u16(destination + i, vmovl_u8(vget_low_u8(chunk)));
+                    vst1q_u16(destination + i + 8, vmovl_u8(vget_high_u8(chunk)));
+                }
+#endif
+                for (; i < size && source[i] < 0x80; ++i) {
+                    destination[i] = source[i];
+                }
+                return i;
+            }
+
+            // Converts code points below surrogates at the beginning of source, returns their count
+            int narrowBmp(const uint* source, int size, ushort* destination)
+            {
+                int i = 0;
+#if defined(UNPLAYER_UNICODE_SSE2)
+                // Code points are below 2^31, so signed comparison works
+                const __m128i limit(_mm_set1_epi32(0xD800));
+                for (; i + 8 <= size; i += 8) {
+                    const __m128i first(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)));
+                    const __m128i second(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i + 4)));
+                    const __m128i below(_mm_and_si128(_mm_cmplt_epi32(first, limit), _mm_cmplt_epi32(second, limit)));
+                    if (_mm_movemask_epi8(below) != 0xFFFF) {
+                        break;
+                    }
+                    // Sign extension of low halves, so that signed saturation keeps them as they are
+                    const __m128i packed(_mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(first, 16), 16),
+                                                         _mm_srai_epi32(_mm_slli_epi32(second, 16), 16)));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), packed);
+                }
+#elif defined(UNPLAYER_UNICODE_NEON)
+                const uint32x4_t limit(vdupq_n_u32(0xD800));
+                for (; i + 8 <= size; i += 8) {
+                    const uint32x4_t first(vld1q_u32(source + i));
+                    const uint32x4_t second(vld1q_u32(source + i + 4));
+                    const uint16x8_t below(vcombine_u16(vmovn_u32(vcltq_u32(first, limit)), vmovn_u32(vcltq_u32(second, limit))));
+                    const uint8x8_t belowBytes(vmovn_u16(below));
+                    if (vget_lane_u64(vreinterpret_u64_u8(belowBytes), 0) != ~0ULL) {
+                        break;
+                    }
+                    vst1q_u16(destination + i, vcombine_u16(vmovn_u32(first), vmovn_u32(second)));
+                }
+#endif
+                for (; i < size && source[i] < 0xD800; ++i) {
+                    destination[i] = static_cast<ushort>(source[i]);
+                }
+                return i;
+            }
+
+            bool isContinuation(uchar byte)
+            {
+                return (byte & 0xC0) == 0x80;
+            }
+
+            // Decodes one sequence that doesn't start with ASCII character.
+            // Returns number of bytes consumed and sets number of written characters
+            int decodeSequence(const uchar* source, int size, ushort* destination, int& written)
+            {
+                written = 1;
+                const uchar lead = source[0];
+                int length;
+                uint codePoint;
+                uint minimum;
+                if (lead >= 0xC2 && lead <= 0xDF) {
+                    length = 2;
+                    codePoint = lead & 0x1F;
+                    minimum = 0x80;
+                } else if ((lead & 0xF0) == 0xE0) {
+                    length = 3;
+                    codePoint = lead & 0x0F;
+                    minimum = 0x800;
+                } else if (lead >= 0xF0 && lead <= 0xF4) {
+                    length = 4;
+                    codePoint = lead & 0x07;
+                    minimum = 0x10000;
+                } else {
+                    destination[0] = replacementCharacter;
+                    return 1;
+                }
+
+                if (length > size) {
+                    destination[0] = replacementCharacter;
+                    return 1;
+                }
+                for (int i = 1; i < length; ++i) {
+                    if (!isContinuation(source[i])) {
+                        destination[0] = replacementCharacter;
+                        return 1;
+                    }
+                    codePoint = (codePoint << 6) | (source[i] & 0x3F);
+                }
+                // Overlong sequences, surrogates and values above U+10FFFF
+                if (codePoint < minimum || (codePoint >= 0xD800 && codePoint <= 0xDFFF) || codePoint > 0x10FFFF) {
+                    destination[0] = replacementCharacter;
+                    return 1;
+                }
+
+                if (codePoint >= 0x10000) {
+                    destination[0] = static_cast<ushort>(0xD800 + ((codePoint - 0x10000) >> 10));
+                    destination[1] = static_cast<ushort>(0xDC00 + ((codePoint - 0x10000) & 0x3FF));
+                    written = 2;
+                } else {
+                    destination[0] = static_cast<ushort>(codePoint);
+                }
+                return length;
+            }
+        }
+
+        QString fromUtf8(const char* data, int size)
+        {
+            if (!data) {
+                return QString();
+            }
+            if (size < 0) {
+                size = static_cast<int>(qstrlen(data));
+            }
+
+            // UTF-16 string is never longer than UTF-8 one
+            QString string(size, Qt::Uninitialized);
+            ushort* const begin = reinterpret_cast<ushort*>(string.data());
+            ushort* destination = begin;
+            const uchar* source = reinterpret_cast<const uchar*>(data);
+            const uchar* const end = source + size;
+            while (source < end) {
+                const int ascii = widenAscii(source, static_cast<int>(end - source), destination);
+                source += ascii;
+                destination += ascii;
+                if (source == end) {
+                    break;
+                }
+                int written;
+                source += decodeSequence(source, static_cast<int>(end - source), destination, written);
+                destination += written;
+            }
+            string.resize(static_cast<int>(destination - begin));
+            return string;
+        }
+
+        QString fromUcs4(const uint* data, int size)
+        {
+            if (!data) {
+                return QString();
+            }
+
+            // Each code point takes at most two UTF-16 characters
+            QString string(size * 2, Qt::Uninitialized);
+            ushort* const begin = reinterpret_cast<ushort*>(string.data());
+            ushort* destination = begin;
+            const uint* source = data;
+            const uint* const end = source + size;
+            while (source < end) {
+                const int bmp = narrowBmp(source, static_cast<int>(end - source), destination);
+                source += bmp;
+                destination += bmp;
+                if (source == end) {
+                    break;
+                }
+                const uint codePoint = *source;
+                if (codePoint >= 0x10000 && codePoint <= 0x10FFFF) {
+                    *destination++ = static_cast<ushort>(0xD800 + ((codePoint - 0x10000) >> 10));
+                    *destination++ = static_cast<ushort>(0xDC00 + ((codePoint - 0x10000) & 0x3FF));
+                } else if (codePoint > 0xDFFF && codePoint < 0x10000) {
+                    *destination++ = static_cast<ushort>(codePoint);
+                } else {
+                    *destination++ = replacementCharacter;
+                }
+                ++source;
+            }
+            string.resize(static_cast<int>(destination - begin));
+            return string;
+        }
+
+        QString fromWCharArray(const wchar_t* data, int size)
+        {
+            if (sizeof(wchar_t) == sizeof(uint)) {
+                return fromUcs4(reinterpret_cast<const uint*>(data), size);
+            }
+            return QString::fromWCharArray(data, size);
+        }
+    }
+}
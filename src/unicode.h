@@ -0,0 +1,43 @@
+/*
+ * Unplayer
+ * Copyright (C) 2015-2018 Alexey Rochev <equeim@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef UNPLAYER_UNICODE_H
+#define UNPLAYER_UNICODE_H
+
+#include <QString>
+
+namespace unplayer
+{
+    // Conversions to QString for bulk text from tags, playlists and the database.
+    // Most of it is ASCII, which is widened 16 characters at a time using SSE2 or NEON.
+    // Other characters are converted one by one
+    namespace unicode
+    {
+        // Invalid sequences are replaced by U+FFFD, one for each byte
+        QString fromUtf8(const char* data, int size);
+
+        // UTF-32, as TagLib::String and std::wstring store text on Linux.
+        // Values that are not Unicode code points are replaced by U+FFFD
+        QString fromUcs4(const uint* data, int size);
+
+        QString fromWCharArray(const wchar_t* data, int size);
+    }
+}
+
+#endif // UNPLAYER_UNICODE_H
@@ -18,11 +18,15 @@
 
 #include "utils.h"
 
+#include <algorithm>
+
+#include <QAbstractItemModel>
 #include <QCoreApplication>
+#include <QDebug>
 #include <QDir>
 #include <QFile>
+#include <QImage>
 #include <QImageReader>
-#include <QItemSelection>
 #include <QLocale>
 #include <QRegularExpression>
 #include <QStandardPaths>
@@ -30,23 +34,33 @@
 #include <qqml.h>
 
 #include "albumsmodel.h"
+#include "artimageprovider.h"
 #include "artistsmodel.h"
+#include "diagnostics.h"
 #include "directorycontentmodel.h"
 #include "directorycontentproxymodel.h"
 #include "directorytracksmodel.h"
+#include "facetsmodel.h"
 #include "filterproxymodel.h"
 #include "genresmodel.h"
+#include "jobmanager.h"
 #include "librarydirectoriesmodel.h"
+#include "librarysearchmodel.h"
 #include "libraryutils.h"
+#include "perfcounters.h"
 #include "player.h"
 #include "playlistmodel.h"
 #include "playlistsmodel.h"
 #include "playlistutils.h"
 #include "queue.h"
 #include "queuemodel.h"
+#include "recentlyaddedalbumsmodel.h"
+#include "recentlyaddedtracksmodel.h"
+#include "sectionsmodel.h"
 #include "settings.h"
 #include "stdutils.h"
 #include "trackinfo.h"
+#include "tracing.h"
 #include "tracksmodel.h"
 
 Q_DECLARE_METATYPE(unplayer::LibraryTrack)
@@ -54,11 +68,63 @@ Q_DECLARE_METATYPE(std::vector<unplayer::LibraryTrack>)
 
 namespace unplayer
 {
+    namespace
+    {
+        // Qt JPEG handler uses fast IDCT and upsampling below quality 50
+        const int fastJpegDecodingQuality = 49;
+
+        QImage decodeScaledImage(QImageReader& reader, const QSize& imageSize, const QSize& size)
+        {
+            if (!imageSize.isValid() || !size.isValid() ||
+                    (size.width() >= imageSize.width() && size.height() >= imageSize.height())) {
+                return reader.read();
+            }
+
+            if (reader.format() != "jpeg") {
+                reader.setScaledSize(size);
+                return reader.read();
+            }
+
+            // Largest denominator which doesn't make image smaller than size.
+            // Decoder picks the same one and doesn't resize the result itself
+            int denominator = 1;
+            while (denominator < 8 &&
+                   imageSize.width() / (denominator * 2) >= size.width() &&
+                   imageSize.height() / (denominator * 2) >= size.height()) {
+                denominator *= 2;
+            }
+            if (denominator > 1) {
+                reader.setScaledSize(QSize(imageSize.width() / denominator, imageSize.height() / denominator));
+                // Artifacts of fast IDCT are not visible after downscaling
+                reader.setQuality(fastJpegDecodingQuality);
+            }
+
+            QImage image(reader.read());
+            if (!image.isNull() && image.size() != size) {
+                image = image.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            }
+            return image;
+        }
+    }
+
+    QElapsedTimer Utils::startupTimer;
+    bool Utils::profileStartup = false;
+
+    void Utils::reportStartupPhase(const char* phase)
+    {
+        tracing::mark(phase);
+        if (profileStartup) {
+            qDebug().nospace() << "startup: " << phase << " in " << startupTimer.elapsed() << " ms";
+        }
+    }
+
     void Utils::registerTypes()
     {
         qRegisterMetaType<std::vector<int>>();
         qRegisterMetaType<LibraryTrack>();
         qRegisterMetaType<std::vector<LibraryTrack>>();
+        qRegisterMetaType<TrackList>();
+        qRegisterMetaType<LibraryChanges>();
 
         const char* url = "harbour.unplayer";
         const int major = 0;
@@ -74,14 +140,22 @@ namespace unplayer
 
         qmlRegisterType<ArtistsModel>(url, major, minor, "ArtistsModel");
         qmlRegisterType<AlbumsModel>(url, major, minor, "AlbumsModel");
+        qmlRegisterUncreatableType<SectionsModel>(url, major, minor, "SectionsModel", QString());
 
         qmlRegisterType<TracksModel>(url, major, minor, "TracksModel");
         qmlRegisterUncreatableType<TracksModelSortMode>(url, major, minor, "TracksModelSortMode", QString());
         qmlRegisterUncreatableType<TracksModelInsideAlbumSortMode>(url, major, minor, "TracksModelInsideAlbumSortMode", QString());
 
         qmlRegisterType<GenresModel>(url, major, minor, "GenresModel");
+        qmlRegisterType<FacetsModel>(url, major, minor, "FacetsModel");
+
+        qmlRegisterType<RecentlyAddedTracksModel>(url, major, minor, "RecentlyAddedTracksModel");
+        qmlRegisterType<RecentlyAddedAlbumsModel>(url, major, minor, "RecentlyAddedAlbumsModel");
+
+        qmlRegisterType<LibrarySearchModel>(url, major, minor, "LibrarySearchModel");
 
         qmlRegisterSingletonType<PlaylistUtils>(url, major, minor, "PlaylistUtils", [](QQmlEngine*, QJSEngine*) -> QObject* { return PlaylistUtils::instance(); });
+        qmlRegisterSingletonType<JobManager>(url, major, minor, "JobManager", [](QQmlEngine*, QJSEngine*) -> QObject* { return JobManager::instance(); });
         qmlRegisterType<PlaylistsModel>(url, major, minor, "PlaylistsModel");
         qmlRegisterType<PlaylistModel>(url, major, minor, "PlaylistModel");
 
@@ -92,12 +166,12 @@ namespace unplayer
         qmlRegisterType<DirectoryContentProxyModel>(url, major, minor, "DirectoryContentProxyModel");
 
         qmlRegisterType<FilterProxyModel>(url, major, minor, "FilterProxyModel");
-        qmlRegisterType<QItemSelectionModel>();
         qmlRegisterType<QAbstractItemModel>();
 
         qmlRegisterSingletonType<Utils>(url, major, minor, "Utils", [](QQmlEngine*, QJSEngine*) -> QObject* { return new Utils(); });
         qmlRegisterType<TrackInfo>(url, major, minor, "TrackInfo");
         qmlRegisterType<LibraryDirectoriesModel>(url, major, minor, "LibraryDirectoriesModel");
+        qmlRegisterType<Diagnostics>(url, major, minor, "Diagnostics");
     }
 
     QStringList Utils::parseArguments(const QStringList& arguments)
@@ -194,6 +268,30 @@ namespace unplayer
         return QRegularExpression::escape(string);
     }
 
+    void Utils::prefetchMediaArt(QAbstractItemModel* model, int first, int last, int size)
+    {
+        ArtImageProvider* provider = ArtImageProvider::instance();
+        if (!provider || !model) {
+            return;
+        }
+        const int role = model->roleNames().key("mediaArt", -1);
+        if (role == -1) {
+            return;
+        }
+        first = std::max(first, 0);
+        last = std::min(last, model->rowCount() - 1);
+        QStringList urls;
+        for (int row = first; row <= last; ++row) {
+            const QString url(model->data(model->index(row, 0), role).toString());
+            if (!url.isEmpty()) {
+                urls.push_back(url);
+            }
+        }
+        if (!urls.isEmpty()) {
+            provider->prefetch(urls, QSize(0, size));
+        }
+    }
+
     QString Utils::homeDirectory()
     {
         return QStandardPaths::writableLocation(QStandardPaths::HomeLocation);
@@ -225,6 +323,16 @@ namespace unplayer
         return nameFilters;
     }
 
+    QImage Utils::readScaledImage(QImageReader& reader, const QSize& imageSize, const QSize& size)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        const QImage image(decodeScaledImage(reader, imageSize, size));
+        perfcounters::add(perfcounters::ImageDecodes);
+        perfcounters::add(perfcounters::ImageDecodesTime, timer.nsecsElapsed());
+        return image;
+    }
+
     QString Utils::translators()
     {
         QFile file(QLatin1String(":/translators.html"));
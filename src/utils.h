@@ -19,10 +19,16 @@
 #ifndef UNPLAYER_UTILS_H
 #define UNPLAYER_UTILS_H
 
+#include <QElapsedTimer>
 #include <QObject>
 #include <QStringList>
 #include <QUrl>
 
+class QAbstractItemModel;
+class QImage;
+class QImageReader;
+class QSize;
+
 namespace unplayer
 {
     class Utils final : public QObject
@@ -38,16 +44,30 @@ namespace unplayer
 
         static QStringList parseArguments(const QStringList& arguments);
 
+        // Time since start of main(), reported for startup phases if profileStartup is true
+        static QElapsedTimer startupTimer;
+        static bool profileStartup;
+        static void reportStartupPhase(const char* phase);
+
         Q_INVOKABLE static QString formatDuration(uint seconds);
         Q_INVOKABLE static QString formatByteSize(double size);
 
         Q_INVOKABLE static QString escapeRegExp(const QString& string);
 
+        // Decodes media art of rows from first to last of model with "mediaArt" role,
+        // size is sourceSize.height of MediaArt that will show it. See ArtImageProvider::prefetch()
+        Q_INVOKABLE static void prefetchMediaArt(QAbstractItemModel* model, int first, int last, int size);
+
         static QString homeDirectory();
         static QString sdcardPath(bool emptyIfNotMounted = false);
 
         static QStringList imageNameFilters();
 
+        // Decodes image downscaled to size, imageSize is size reported by reader.
+        // JPEG is decoded with DCT scaling by 1/2, 1/4 or 1/8 and fast IDCT,
+        // and then is scaled smoothly the rest of the way
+        static QImage readScaledImage(QImageReader& reader, const QSize& imageSize, const QSize& size);
+
         static QString translators();
         static QString license();
     };